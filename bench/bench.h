@@ -0,0 +1,86 @@
+﻿#pragma once
+
+// Timing helpers for the programs under bench/. Each benchmark is a plain
+// executable that prints one line per measurement; they are built with
+// -DHW3D_BUILD_BENCHMARKS=ON and run by hand (not by ctest).
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#include "hw3d/memory_tracker.h"
+
+namespace hw3d::bench {
+
+// Keeps the optimizer from dropping a computation whose result is unused.
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r"(&value) : "memory");
+#else
+  static volatile const void* sink;
+  sink = &value;
+#endif
+}
+
+// Runs `body` `repeats` times and returns the fastest run in nanoseconds.
+// The minimum is the least noisy estimate on a shared machine.
+template <typename Body>
+double BestOfNs(int repeats, Body&& body) {
+  double best = 0.0;
+  for (int r = 0; r < repeats; r++) {
+    const auto start = std::chrono::steady_clock::now();
+    body();
+    const auto stop = std::chrono::steady_clock::now();
+    const double ns =
+        std::chrono::duration<double, std::nano>(stop - start).count();
+    if (r == 0 || ns < best) {
+      best = ns;
+    }
+  }
+  return best;
+}
+
+// Prints "<name>  <ms> ms  <rate> <unit>/s" for `units` processed in `ns`.
+inline void Report(const char* name, double ns, double units,
+                   const char* unit) {
+  std::printf("%-40s %10.3f ms %12.1f M%s/s\n", name, ns * 1e-6,
+              units / ns * 1e3, unit);
+}
+
+// Runs `body` `runs` times, each as one MemoryTracker frame with a budget of
+// `budget` heap allocations on any thread, and prints the most a run made.
+// Returns false if a run went over, for main() to fail with. Only a build
+// with HW3D_MEMORY_TRACKING counts; elsewhere the check is skipped and
+// passes.
+template <typename Body>
+bool CheckFrameBudget(const char* name, int runs, std::uint64_t budget,
+                      Body&& body) {
+  if (!MemoryTracker::kEnabled) {
+    std::printf("%-40s    skipped (no HW3D_MEMORY_TRACKING)\n", name);
+    return true;
+  }
+  MemoryTracker& tracker = MemoryTracker::Get();
+  const std::uint64_t previous_budget = tracker.frame_budget();
+  tracker.set_frame_budget(budget);
+  // closes whatever ran before
+  tracker.EndFrame();
+  const std::uint64_t over_before = tracker.frame_stats().frames_over_budget;
+  std::uint64_t most = 0;
+  for (int r = 0; r < runs; r++) {
+    body();
+    tracker.EndFrame();
+    most = std::max(most, tracker.frame_stats().last_frame_allocations);
+  }
+  const std::uint64_t over =
+      tracker.frame_stats().frames_over_budget - over_before;
+  tracker.set_frame_budget(previous_budget);
+  std::printf("%-40s %10llu allocs/run, %s a budget of %llu\n", name,
+              static_cast<unsigned long long>(most),
+              over == 0 ? "within" : "OVER",
+              static_cast<unsigned long long>(budget));
+  return over == 0;
+}
+
+}  // namespace hw3d::bench
@@ -0,0 +1,190 @@
+﻿// Bvh against a linear scan over 100k boxes in a 2000-unit cube: build
+// (on the calling thread and from a 4-worker JobSystem), 10k raycasts,
+// 10k nearest queries and 10k overlap queries of radius 10, and a refit
+// after 10% of the boxes moved by up to 2 units. The scan runs 1% of the
+// queries and is scaled up. Every query result is checked against the
+// scan once.
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+#include "bench/bench.h"
+#include "hw3d/bvh.h"
+#include "hw3d/job_system.h"
+
+namespace {
+
+constexpr std::size_t kBoxes = 100000;
+constexpr int kQueries = 10000;
+constexpr int kScanQueries = kQueries / 100;
+constexpr int kRepeats = 5;
+constexpr float kInf = std::numeric_limits<float>::infinity();
+
+class Random {
+ public:
+  explicit Random(std::uint32_t seed) : state_(seed) {}
+  // Uniform in [lo, hi).
+  float Next(float lo, float hi) {
+    state_ = state_ * 1664525u + 1013904223u;
+    return lo + (hi - lo) * static_cast<float>(state_ >> 8) / 16777216.0f;
+  }
+
+ private:
+  std::uint32_t state_;
+};
+
+struct Query {
+  hw3d::Ray ray;
+  hw3d::Float3 point;
+  hw3d::Aabb box;
+};
+
+float ScanRay(const std::vector<hw3d::Aabb>& boxes, const hw3d::Ray& ray) {
+  const hw3d::Float3 inv = hw3d::InverseDirection(ray);
+  float best = kInf;
+  for (const hw3d::Aabb& box : boxes) {
+    float t;
+    if (hw3d::IntersectRay(ray.origin, inv, box, best, &t) && t < best) {
+      best = t;
+    }
+  }
+  return best;
+}
+
+float ScanNearest(const std::vector<hw3d::Aabb>& boxes, hw3d::Float3 p) {
+  float best = kInf;
+  for (const hw3d::Aabb& box : boxes) {
+    const float d = hw3d::DistanceSquared(box, p);
+    best = d < best ? d : best;
+  }
+  return best;
+}
+
+std::size_t ScanOverlap(const std::vector<hw3d::Aabb>& boxes,
+                        const hw3d::Aabb& query) {
+  std::size_t n = 0;
+  for (const hw3d::Aabb& box : boxes) {
+    n += hw3d::Overlaps(box, query) ? 1 : 0;
+  }
+  return n;
+}
+
+}  // namespace
+
+int main() {
+  Random random(9);
+  std::vector<hw3d::Aabb> boxes(kBoxes);
+  for (hw3d::Aabb& box : boxes) {
+    const hw3d::Float3 c{random.Next(-1000, 1000), random.Next(-1000, 1000),
+                         random.Next(-1000, 1000)};
+    const float e = random.Next(0.5f, 4);
+    box = {c - hw3d::Float3{e, e, e}, c + hw3d::Float3{e, e, e}};
+  }
+  std::vector<Query> queries(kQueries);
+  for (Query& q : queries) {
+    q.ray.origin = {random.Next(-1000, 1000), random.Next(-1000, 1000),
+                    random.Next(-1000, 1000)};
+    q.ray.direction = {random.Next(-1, 1), random.Next(-1, 1),
+                       random.Next(-1, 1)};
+    q.point = {random.Next(-1000, 1000), random.Next(-1000, 1000),
+               random.Next(-1000, 1000)};
+    q.box = {q.point - hw3d::Float3{10, 10, 10},
+             q.point + hw3d::Float3{10, 10, 10}};
+  }
+
+  hw3d::Bvh bvh;
+  double ns = hw3d::bench::BestOfNs(
+      kRepeats, [&] { bvh.Build(boxes.data(), boxes.size()); });
+  hw3d::bench::Report("build", ns, kBoxes, "boxes");
+  {
+    hw3d::JobSystemSession session(4);
+    ns = hw3d::bench::BestOfNs(
+        kRepeats, [&] { bvh.Build(boxes.data(), boxes.size()); });
+    hw3d::bench::Report("build, 4 workers", ns, kBoxes, "boxes");
+  }
+  std::printf("  %zu nodes, SAH cost %.1f\n", bvh.node_count(),
+              bvh.SahCost());
+
+  int mismatches = 0;
+  for (int i = 0; i < kScanQueries; i++) {
+    const Query& q = queries[i];
+    hw3d::Bvh::RayHit ray_hit;
+    const float t = ScanRay(boxes, q.ray);
+    if (bvh.Raycast(q.ray, kInf, &ray_hit) != (t < kInf) ||
+        (t < kInf && ray_hit.t != t)) {
+      mismatches++;
+    }
+    hw3d::Bvh::NearestHit near_hit;
+    if (!bvh.Nearest(q.point, kInf, &near_hit) ||
+        near_hit.distance_squared != ScanNearest(boxes, q.point)) {
+      mismatches++;
+    }
+    std::size_t n = 0;
+    bvh.QueryOverlap(q.box, [&](std::uint32_t) { n++; });
+    if (n != ScanOverlap(boxes, q.box)) {
+      mismatches++;
+    }
+  }
+
+  std::size_t sink = 0;
+  ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    for (const Query& q : queries) {
+      hw3d::Bvh::RayHit hit;
+      sink += bvh.Raycast(q.ray, kInf, &hit) ? hit.object : 0;
+    }
+  });
+  hw3d::bench::Report("raycast", ns, kQueries, "queries");
+  ns = hw3d::bench::BestOfNs(1, [&] {
+    for (int i = 0; i < kScanQueries; i++) {
+      hw3d::bench::DoNotOptimize(ScanRay(boxes, queries[i].ray));
+    }
+  });
+  hw3d::bench::Report("raycast, linear scan", ns * 100, kQueries, "queries");
+
+  ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    for (const Query& q : queries) {
+      hw3d::Bvh::NearestHit hit;
+      sink += bvh.Nearest(q.point, kInf, &hit) ? hit.object : 0;
+    }
+  });
+  hw3d::bench::Report("nearest", ns, kQueries, "queries");
+  ns = hw3d::bench::BestOfNs(1, [&] {
+    for (int i = 0; i < kScanQueries; i++) {
+      hw3d::bench::DoNotOptimize(ScanNearest(boxes, queries[i].point));
+    }
+  });
+  hw3d::bench::Report("nearest, linear scan", ns * 100, kQueries, "queries");
+
+  ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    for (const Query& q : queries) {
+      bvh.QueryOverlap(q.box, [&](std::uint32_t o) { sink += o; });
+    }
+  });
+  hw3d::bench::Report("overlap", ns, kQueries, "queries");
+  ns = hw3d::bench::BestOfNs(1, [&] {
+    for (int i = 0; i < kScanQueries; i++) {
+      hw3d::bench::DoNotOptimize(ScanOverlap(boxes, queries[i].box));
+    }
+  });
+  hw3d::bench::Report("overlap, linear scan", ns * 100, kQueries, "queries");
+
+  double refit_ns = 0;
+  std::size_t rebuilt = 0;
+  for (int round = 0; round < kRepeats; round++) {
+    for (std::uint32_t i = 0; i < kBoxes; i += 10) {
+      const hw3d::Float3 v{random.Next(-2, 2), random.Next(-2, 2),
+                           random.Next(-2, 2)};
+      boxes[i] = {boxes[i].min + v, boxes[i].max + v};
+      bvh.Update(i, boxes[i]);
+    }
+    const double round_ns = hw3d::bench::BestOfNs(1, [&] { bvh.Refit(); });
+    refit_ns = round == 0 || round_ns < refit_ns ? round_ns : refit_ns;
+    rebuilt += bvh.last_rebuilt_objects();
+  }
+  hw3d::bench::Report("refit, 10% moved", refit_ns, kBoxes, "boxes");
+  std::printf("  %zu objects rebuilt over %d refits\n", rebuilt, kRepeats);
+  hw3d::bench::DoNotOptimize(sink);
+  std::printf("mismatches against the scan: %d\n", mismatches);
+  return 0;
+}
@@ -0,0 +1,118 @@
+﻿// 1M entities with Position and Velocity, half of them also with Health
+// (two archetypes): creation, pos += vel through ForEach and ForEachChunk
+// against a plain array-of-structs loop, and a deferred destroy of 100k
+// entities through a CommandBuffer. The ForEach loops must make no heap
+// allocations (checked in HW3D_MEMORY_TRACKING builds).
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "bench/bench.h"
+#include "hw3d/ecs.h"
+
+namespace {
+
+constexpr int kEntities = 1000000;
+constexpr int kDestroyed = 100000;
+constexpr int kRepeats = 10;
+
+struct Position {
+  float x, y, z;
+};
+struct Velocity {
+  float x, y, z;
+};
+struct Health {
+  int value;
+};
+
+// What App-style code without an ECS would hold per object.
+struct GameObject {
+  Position position;
+  Velocity velocity;
+  Health health;
+  bool has_health;
+  float mesh_and_material[8];
+};
+
+double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+}  // namespace
+
+int main() {
+  using hw3d::bench::BestOfNs;
+  using hw3d::bench::DoNotOptimize;
+  using hw3d::bench::Report;
+
+  hw3d::World world;
+  std::vector<hw3d::Entity> entities;
+  entities.reserve(kEntities);
+  const auto create_start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kEntities; i++) {
+    const float f = static_cast<float>(i);
+    entities.push_back(
+        i % 2 == 0
+            ? world.Create(Position{f, 0, 0}, Velocity{1, 2, 3})
+            : world.Create(Position{f, 0, 0}, Velocity{1, 2, 3}, Health{100}));
+  }
+  std::printf("%-40s %10.3f ms (%zu chunks)\n", "create 1M",
+              MillisecondsSince(create_start), world.chunk_count());
+
+  std::vector<GameObject> objects(kEntities);
+  for (int i = 0; i < kEntities; i++) {
+    objects[i].position = {static_cast<float>(i), 0, 0};
+    objects[i].velocity = {1, 2, 3};
+    objects[i].has_health = i % 2 != 0;
+  }
+  Report("AoS struct pos += vel", BestOfNs(kRepeats, [&] {
+           for (GameObject& o : objects) {
+             o.position.x += o.velocity.x;
+             o.position.y += o.velocity.y;
+             o.position.z += o.velocity.z;
+           }
+           DoNotOptimize(objects[0]);
+         }),
+         kEntities, "entities");
+  Report("ForEach pos += vel", BestOfNs(kRepeats, [&] {
+           world.ForEach<Position, const Velocity>(
+               [](Position& p, const Velocity& v) {
+                 p.x += v.x;
+                 p.y += v.y;
+                 p.z += v.z;
+               });
+         }),
+         kEntities, "entities");
+  Report("ForEachChunk pos += vel", BestOfNs(kRepeats, [&] {
+           world.ForEachChunk<Position, const Velocity>(
+               [](std::size_t n, const hw3d::Entity*, Position* p,
+                  const Velocity* v) {
+                 for (std::size_t i = 0; i < n; i++) {
+                   p[i].x += v[i].x;
+                   p[i].y += v[i].y;
+                   p[i].z += v[i].z;
+                 }
+               });
+         }),
+         kEntities, "entities");
+
+  const auto for_each = [&] {
+    world.ForEach<Position, const Velocity>(
+        [](Position& p, const Velocity& v) { p.x += v.x; });
+  };
+  const bool ok =
+      hw3d::bench::CheckFrameBudget("ForEach pos += vel", 3, 0, for_each);
+
+  hw3d::CommandBuffer commands;
+  for (int i = 0; i < kDestroyed; i++) {
+    commands.Destroy(entities[static_cast<std::size_t>(i) * 10]);
+  }
+  const auto destroy_start = std::chrono::steady_clock::now();
+  commands.Apply(world);
+  std::printf("%-40s %10.3f ms (%zu left)\n", "deferred destroy of 100k",
+              MillisecondsSince(destroy_start), world.size());
+  return ok ? 0 : 1;
+}
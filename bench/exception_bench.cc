@@ -0,0 +1,134 @@
+﻿// Throw, catch and what() of an HRESULT exception with debug-layer detail,
+// on the portable HRESULT: the fixed-buffer Hw3dException report against
+// the std::ostringstream formatting it replaced, which built what() again
+// on every call. Also checks that formatting allocates nothing; the thrown
+// object itself comes from the C++ runtime, which the tracker does not see.
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "bench/bench.h"
+#include "hw3d/exception.h"
+
+namespace {
+
+constexpr int kThrows = 20000;
+constexpr int kWhatCalls = 200000;
+constexpr int kRepeats = 10;
+constexpr HRESULT kDeviceRemoved = static_cast<HRESULT>(0x887A0005);
+constexpr const char* kDetail =
+    "ID3D11Device::CreateTexture2D: The Dimensions are invalid.\n";
+
+class FixedHrException : public hw3d::Hw3dException {
+ public:
+  FixedHrException(int line, const char* file, HRESULT hr,
+                   std::string_view detail) noexcept
+      : Hw3dException(line, file), hr_(hr) {
+    SetDetail(detail);
+  }
+  const char* GetType() const noexcept override {
+    return "hw3d Graphics Exception";
+  }
+
+ protected:
+  void FormatWhat(WhatBuffer& out) const noexcept override {
+    out.Append(GetType()).Append('\n');
+    AppendErrorCode(out, hr_);
+    out.Append("[Error Info]\n").Append(GetDetail()).Append("\n\n");
+    AppendOrigin(out);
+  }
+
+ private:
+  HRESULT hr_;
+};
+
+// The formatting before the fixed buffers: strings in the exception and a
+// stream per what() and per GetOriginString().
+class StreamHrException : public std::exception {
+ public:
+  StreamHrException(int line, const char* file, HRESULT hr,
+                    const std::string& detail)
+      : line_(line), file_(file), hr_(hr), info_(detail) {
+    // the old constructor dropped the final newline of the joined messages
+    if (!info_.empty()) {
+      info_.pop_back();
+    }
+  }
+  const char* what() const noexcept override {
+    std::ostringstream oss;
+    oss << "hw3d Graphics Exception" << std::endl
+        << "[Error Code] 0x" << std::hex << std::uppercase
+        << static_cast<unsigned long>(hr_) << std::dec << " ("
+        << static_cast<unsigned long>(hr_) << ")" << std::endl
+        << "[Error Info]\n"
+        << info_ << std::endl
+        << std::endl
+        << GetOriginString();
+    what_buffer_ = oss.str();
+    return what_buffer_.c_str();
+  }
+  std::string GetOriginString() const {
+    std::ostringstream oss;
+    oss << "[File] " << file_ << std::endl << "[Line] " << line_;
+    return oss.str();
+  }
+
+ private:
+  int line_;
+  std::string file_;
+  HRESULT hr_;
+  std::string info_;
+  mutable std::string what_buffer_;
+};
+
+template <typename Exception>
+std::size_t ThrowCatchWhat(int line) {
+  try {
+    throw Exception(line, __FILE__, kDeviceRemoved, kDetail);
+  } catch (const std::exception& e) {
+    return std::string_view(e.what()).size();
+  }
+}
+
+template <typename Exception>
+void Measure(const char* throw_name, const char* what_name) {
+  std::size_t length = 0;
+  double ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    for (int i = 0; i < kThrows; i++) {
+      length += ThrowCatchWhat<Exception>(i);
+    }
+  });
+  hw3d::bench::DoNotOptimize(length);
+  hw3d::bench::Report(throw_name, ns, kThrows, "throws");
+  std::printf("  %.0f ns per throw\n", ns / kThrows);
+
+  const Exception e(__LINE__, __FILE__, kDeviceRemoved, kDetail);
+  ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    for (int i = 0; i < kWhatCalls; i++) {
+      const char* what = e.what();
+      hw3d::bench::DoNotOptimize(what);
+    }
+  });
+  hw3d::bench::Report(what_name, ns, kWhatCalls, "calls");
+  std::printf("  %.1f ns per call\n", ns / kWhatCalls);
+}
+
+}  // namespace
+
+int main() {
+  Measure<StreamHrException>("throw+catch+what(), ostringstream",
+                             "what() again, ostringstream");
+  Measure<FixedHrException>("throw+catch+what(), fixed buffers",
+                            "what() again, fixed buffers");
+
+  const bool ok = hw3d::bench::CheckFrameBudget(
+      "throw+catch+what(), fixed buffers", 10, 0, [] {
+        std::size_t length = 0;
+        for (int i = 0; i < 100; i++) {
+          length += ThrowCatchWhat<FixedHrException>(i);
+        }
+        hw3d::bench::DoNotOptimize(length);
+      });
+  return ok ? 0 : 1;
+}
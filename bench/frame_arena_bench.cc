@@ -0,0 +1,144 @@
+﻿// Per-frame temporaries: 50k small allocations of 16..256 bytes, then
+// everything released, through FrameArena, ScratchScope and operator new,
+// single-threaded and from 4 threads at once; plus a pmr vector filled from
+// the arena against a std::vector. The arena loops must make no heap
+// allocations (checked in HW3D_MEMORY_TRACKING builds).
+#include <cstdio>
+#include <memory_resource>
+#include <thread>
+#include <vector>
+
+#include "bench/bench.h"
+#include "hw3d/frame_arena.h"
+
+namespace {
+
+constexpr int kAllocations = 50000;
+constexpr int kRepeats = 30;
+constexpr int kThreads = 4;
+
+std::size_t SizeOf(int i) {
+  return 16 + static_cast<std::size_t>(i * 37 % 241);
+}
+
+void Touch(void* p) {
+  static_cast<unsigned char*>(p)[0] = 1;
+}
+
+}  // namespace
+
+int main() {
+  std::vector<void*> pointers(kAllocations);
+  // enough for the whole frame, so nothing overflows
+  hw3d::FrameArena arena(kAllocations * 272 * kThreads);
+
+  double ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    for (int i = 0; i < kAllocations; i++) {
+      pointers[i] = ::operator new(SizeOf(i));
+      Touch(pointers[i]);
+    }
+    for (int i = 0; i < kAllocations; i++) {
+      ::operator delete(pointers[i]);
+    }
+  });
+  hw3d::bench::Report("operator new/delete", ns, kAllocations, "allocs");
+
+  ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    for (int i = 0; i < kAllocations; i++) {
+      pointers[i] = arena.Allocate(SizeOf(i), 16);
+      Touch(pointers[i]);
+    }
+    arena.Reset();
+  });
+  hw3d::bench::Report("FrameArena + Reset", ns, kAllocations, "allocs");
+
+  ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    for (int block = 0; block < kAllocations / 1000; block++) {
+      hw3d::ScratchScope scratch;
+      for (int i = 0; i < 1000; i++) {
+        void* p = scratch.Allocate(SizeOf(i), 16);
+        Touch(p);
+        hw3d::bench::DoNotOptimize(p);
+      }
+    }
+  });
+  hw3d::bench::Report("ScratchScope (1000 per scope)", ns, kAllocations,
+                      "allocs");
+
+  const auto threaded = [&](bool use_arena) {
+    return hw3d::bench::BestOfNs(kRepeats, [&] {
+      std::vector<std::thread> threads;
+      for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&arena, use_arena] {
+          std::vector<void*> own(kAllocations);
+          for (int i = 0; i < kAllocations; i++) {
+            own[i] = use_arena ? arena.Allocate(SizeOf(i), 16)
+                               : ::operator new(SizeOf(i));
+            Touch(own[i]);
+          }
+          if (!use_arena) {
+            for (void* p : own) {
+              ::operator delete(p);
+            }
+          }
+        });
+      }
+      for (auto& thread : threads) {
+        thread.join();
+      }
+      if (use_arena) {
+        arena.Reset();
+      }
+    });
+  };
+  hw3d::bench::Report("operator new/delete, 4 threads", threaded(false),
+                      kAllocations * kThreads, "allocs");
+  hw3d::bench::Report("FrameArena, 4 threads", threaded(true),
+                      kAllocations * kThreads, "allocs");
+
+  ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    std::vector<int> values;
+    for (int i = 0; i < kAllocations; i++) {
+      values.push_back(i);
+    }
+    hw3d::bench::DoNotOptimize(values.back());
+  });
+  hw3d::bench::Report("std::vector<int> push_back", ns, kAllocations,
+                      "items");
+
+  ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    {
+      std::pmr::vector<int> values(arena.resource());
+      for (int i = 0; i < kAllocations; i++) {
+        values.push_back(i);
+      }
+      hw3d::bench::DoNotOptimize(values.back());
+    }
+    arena.Reset();
+  });
+  hw3d::bench::Report("pmr::vector<int> on FrameArena", ns, kAllocations,
+                      "items");
+
+  bool ok = hw3d::bench::CheckFrameBudget("FrameArena + Reset", 3, 0, [&] {
+    for (int i = 0; i < kAllocations; i++) {
+      pointers[i] = arena.Allocate(SizeOf(i), 16);
+    }
+    arena.Reset();
+  });
+  ok &= hw3d::bench::CheckFrameBudget("ScratchScope", 3, 0, [&] {
+    hw3d::ScratchScope scratch;
+    for (int i = 0; i < 1000; i++) {
+      hw3d::bench::DoNotOptimize(scratch.Allocate(SizeOf(i), 16));
+    }
+  });
+  const auto pmr_frame = [&] {
+    {
+      std::pmr::vector<int> values(arena.resource());
+      values.resize(kAllocations);
+    }
+    arena.Reset();
+  };
+  ok &= hw3d::bench::CheckFrameBudget("pmr::vector<int> on FrameArena", 3, 0,
+                                      pmr_frame);
+  return ok ? 0 : 1;
+}
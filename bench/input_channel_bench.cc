@@ -0,0 +1,156 @@
+﻿// Input handoff from a pump thread to the game thread through InputChannel:
+//   headless    a HeadlessWindow in PumpMode::kDedicatedThread whose source
+//               makes 64 mouse moves and a key press or release per frame,
+//               pumped for 2000 frames with no frame work
+//   throughput  a raw pump thread pushing 1M mouse moves, waiting while the
+//               queue is full, and the game thread draining in a loop
+//   stall       a pump making 8 moves per 1 ms tick and a key press or
+//               release every 10 ticks for 2 s, while the game thread
+//               drains only every 250 ms, so the queue overflows
+// Reports delivered events per second and the push-to-drain latency, plus
+// what was dropped or merged while the queue was full.
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "hw3d/headless_window.h"
+#include "hw3d/input_channel.h"
+
+namespace {
+
+constexpr std::uint64_t kFrames = 2000;
+constexpr int kMovesPerFrame = 64;
+constexpr int kEvents = 1000000;
+constexpr int kStallTicks = 2000;
+constexpr int kStallMs = 250;
+
+hw3d::InputEvent Event(hw3d::InputEvent::Type type, int code, int x) {
+  hw3d::InputEvent event;
+  event.type = type;
+  event.code = code;
+  event.x = x;
+  return event;
+}
+
+class Source : public hw3d::SyntheticEventSource {
+ public:
+  std::optional<int> Generate(std::uint64_t frame,
+                              std::vector<hw3d::InputEvent>& out) override {
+    for (int i = 0; i < kMovesPerFrame; i++) {
+      out.push_back(Event(hw3d::InputEvent::Type::kMouseMove, 0, i));
+    }
+    out.push_back(Event(frame % 2 == 0 ? hw3d::InputEvent::Type::kKeyDown
+                                       : hw3d::InputEvent::Type::kKeyUp,
+                        'W', 0));
+    if (frame + 1 >= kFrames) {
+      return 0;
+    }
+    return std::nullopt;
+  }
+};
+
+void Print(const char* name, const hw3d::InputChannel::Stats& stats,
+           double seconds) {
+  const double mean_us =
+      stats.delivered > 0
+          ? static_cast<double>(stats.total_latency_ns) / stats.delivered * 1e-3
+          : 0.0;
+  std::printf("%-10s %8.0f events/s  latency mean %8.1f us  max %8.1f us  "
+              "dropped %llu  merged %llu\n",
+              name, stats.delivered / seconds, mean_us,
+              static_cast<double>(stats.max_latency_ns) * 1e-3,
+              static_cast<unsigned long long>(stats.dropped),
+              static_cast<unsigned long long>(stats.coalesced));
+}
+
+void Headless() {
+  hw3d::HeadlessWindow window(640, 480, std::make_unique<Source>(),
+                              hw3d::PumpMode::kDedicatedThread);
+  const auto start = std::chrono::steady_clock::now();
+  while (!window.PumpMessages()) {
+  }
+  const auto stop = std::chrono::steady_clock::now();
+  Print("headless", window.input_stats(),
+        std::chrono::duration<double>(stop - start).count());
+}
+
+void Throughput() {
+  hw3d::InputChannel channel;
+  const auto start = std::chrono::steady_clock::now();
+  std::thread pump([&] {
+    for (int i = 0; i < kEvents; i++) {
+      // wait for room, so this measures the queue rather than the overflow
+      while (!channel.TryPush(
+          Event(hw3d::InputEvent::Type::kMouseMove, 0, i))) {
+        std::this_thread::yield();
+      }
+    }
+    channel.RequestQuit(0);
+  });
+  while (!channel.Drain([](const hw3d::InputEvent&) {})) {
+  }
+  const auto stop = std::chrono::steady_clock::now();
+  pump.join();
+  Print("throughput", channel.stats(),
+        std::chrono::duration<double>(stop - start).count());
+}
+
+void Stall() {
+  hw3d::InputChannel channel;
+  std::atomic<bool> done{false};
+  int transitions_pushed = 0;
+  const auto start = std::chrono::steady_clock::now();
+  std::thread pump([&] {
+    for (int tick = 0; tick < kStallTicks; tick++) {
+      for (int i = 0; i < 8; i++) {
+        channel.Push(Event(hw3d::InputEvent::Type::kMouseMove, 0, i));
+      }
+      if (tick % 10 == 0) {
+        channel.Push(Event(tick % 20 == 0 ? hw3d::InputEvent::Type::kKeyDown
+                                          : hw3d::InputEvent::Type::kKeyUp,
+                           'W', 0));
+        transitions_pushed++;
+      }
+      channel.Flush();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    while (!channel.Flush()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    channel.RequestQuit(0);
+    done.store(true);
+  });
+  int transitions = 0;
+  for (;;) {
+    const std::optional<int> quit =
+        channel.Drain([&](const hw3d::InputEvent& event) {
+          transitions += event.type != hw3d::InputEvent::Type::kMouseMove;
+        });
+    if (quit) {
+      break;
+    }
+    // a frame hitch: the pump keeps going
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(done.load() ? 1 : kStallMs));
+  }
+  const auto stop = std::chrono::steady_clock::now();
+  pump.join();
+  Print("stall", channel.stats(),
+        std::chrono::duration<double>(stop - start).count());
+  std::printf("           key transitions delivered %d of %d\n",
+              transitions, transitions_pushed);
+}
+
+}  // namespace
+
+int main() {
+  Headless();
+  Throughput();
+  Stall();
+  return 0;
+}
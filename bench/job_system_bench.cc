@@ -0,0 +1,66 @@
+﻿// Job throughput as the worker count grows from 1 to N (default: hardware
+// threads; pass N to override). Each round submits kJobs jobs of roughly
+// `work` iterations of integer hashing from worker 0 and waits on them.
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "bench/bench.h"
+#include "hw3d/job_system.h"
+
+namespace {
+
+constexpr int kJobs = 20000;
+constexpr int kRepeats = 10;
+
+std::uint32_t Spin(std::uint32_t seed, int work) {
+  for (int i = 0; i < work; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    seed ^= seed >> 13;
+  }
+  return seed;
+}
+
+double Measure(unsigned workers, int work) {
+  hw3d::JobSystemSession session(workers);
+  hw3d::JobSystem& jobs = hw3d::JobSystem::Get();
+  static std::uint32_t results[kJobs];
+  return hw3d::bench::BestOfNs(kRepeats, [&] {
+    hw3d::JobCounter counter;
+    for (int i = 0; i < kJobs; i++) {
+      std::uint32_t* out = &results[i];
+      jobs.Run([out, i, work] { *out = Spin(static_cast<std::uint32_t>(i),
+                                            work); },
+               &counter);
+    }
+    jobs.Wait(counter);
+    hw3d::bench::DoNotOptimize(results);
+  });
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  unsigned max_workers = std::thread::hardware_concurrency();
+  if (argc > 1) {
+    max_workers = static_cast<unsigned>(std::atoi(argv[1]));
+  }
+  if (max_workers == 0) {
+    max_workers = 1;
+  }
+  for (const int work : {0, 100, 2000}) {
+    double single = 0.0;
+    for (unsigned workers = 1; workers <= max_workers; workers++) {
+      const double ns = Measure(workers, work);
+      if (workers == 1) {
+        single = ns;
+      }
+      char label[64];
+      std::snprintf(label, sizeof(label), "work %4d, %2u workers (x%.2f)",
+                    work, workers, single / ns);
+      hw3d::bench::Report(label, ns, kJobs, "jobs");
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,87 @@
+﻿// Moves a camera with a jittery forward-and-back walk over 600 frames
+// through 200k spheres on a 2000 x 2000 field, half of them with a
+// 5-level mesh and half with a 3-level one, and reports per frame the
+// level switches, the instance lists to rebuild and the time in Update()
+// for each LodSelectorConfig below:
+//   hysteresis 0 / 0.2  x  coarsen_delay 0 / 8
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+#include "hw3d/lod_selector.h"
+
+namespace {
+
+constexpr std::size_t kObjects = 200000;
+constexpr int kFrames = 600;
+
+class Random {
+ public:
+  explicit Random(std::uint32_t seed) : state_(seed) {}
+  // Uniform in [0, 1).
+  float Next() {
+    state_ = state_ * 1664525u + 1013904223u;
+    return static_cast<float>(state_ >> 8) / 16777216.0f;
+  }
+
+ private:
+  std::uint32_t state_;
+};
+
+void Walk(const hw3d::SphereArray& spheres, float hysteresis,
+          std::uint32_t coarsen_delay) {
+  hw3d::LodSelectorConfig config;
+  config.hysteresis = hysteresis;
+  config.coarsen_delay = coarsen_delay;
+  hw3d::LodSelector lod(config);
+  const float fine[] = {0.0f, 0.01f, 0.04f, 0.16f, 0.64f};
+  const float coarse[] = {0.0f, 0.05f, 0.2f};
+  lod.AddMesh(fine, 5);
+  lod.AddMesh(coarse, 3);
+  lod.Resize(kObjects);
+  for (std::uint32_t i = 0; i < kObjects; i++) {
+    lod.SetMesh(i, i % 2);
+  }
+  hw3d::LodView view;
+  view.pixel_scale = hw3d::LodPixelScale(1.0f, 1080.0f);
+  view.max_error_pixels = 1.0f;
+  std::size_t switched = 0, batches = 0;
+  double ns = 0;
+  for (int frame = 0; frame < kFrames; frame++) {
+    view.eye = hw3d::Float3{0.0f, 10.0f,
+                            0.5f * std::sin(frame * 0.7f) + frame * 0.05f};
+    lod.Update(view, spheres);
+    // the first frame places every object
+    if (frame > 0) {
+      switched += lod.stats().switched;
+      batches += lod.changed_batches().size();
+      ns += static_cast<double>(lod.stats().ns);
+    }
+    lod.ClearChangedBatches();
+  }
+  const double frames = kFrames - 1;
+  std::printf("hysteresis %.1f delay %u: switches/frame %6.0f  "
+              "rebuilt lists/frame %4.1f  update %6.0f us/frame\n",
+              hysteresis, coarsen_delay, switched / frames, batches / frames,
+              ns / frames * 1e-3);
+}
+
+}  // namespace
+
+int main() {
+  Random random(3);
+  hw3d::SphereArray spheres;
+  spheres.Resize(kObjects);
+  for (std::size_t i = 0; i < kObjects; i++) {
+    const hw3d::Float3 center{random.Next() * 2000 - 1000,
+                              random.Next() * 30,
+                              random.Next() * 2000 - 1000};
+    spheres.Set(i, hw3d::BoundingSphere{center, 1 + random.Next() * 3});
+  }
+  for (float hysteresis : {0.0f, 0.2f}) {
+    for (std::uint32_t delay : {0u, 8u}) {
+      Walk(spheres, hysteresis, delay);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,96 @@
+﻿// ParallelFor and ParallelReduce on 1..N workers (default: hardware threads;
+// pass N to override), for a cheap and an expensive per-item body, with the
+// grain picked from the measured cost as in real call sites.
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "bench/bench.h"
+#include "hw3d/parallel.h"
+
+namespace {
+
+constexpr std::size_t kItems = 1 << 20;
+constexpr int kRepeats = 20;
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  unsigned max_workers = std::thread::hardware_concurrency();
+  if (argc > 1) {
+    max_workers = static_cast<unsigned>(std::atoi(argv[1]));
+  }
+  if (max_workers == 0) {
+    max_workers = 1;
+  }
+  std::vector<float> in(kItems);
+  std::vector<float> out(kItems);
+  for (std::size_t i = 0; i < kItems; i++) {
+    in[i] = static_cast<float>(i % 1000) * 0.001f;
+  }
+
+  for (unsigned workers = 1; workers <= max_workers; workers++) {
+    hw3d::JobSystemSession session(workers);
+    char label[64];
+
+    // cheap: a multiply-add per item, memory bound
+    hw3d::ParallelCost cheap_cost;
+    hw3d::ParallelOptions cheap;
+    cheap.cost = &cheap_cost;
+    cheap.item_bytes = sizeof(float);
+    double ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+      hw3d::ParallelForRange(
+          0, kItems,
+          [&](std::size_t b, std::size_t e) {
+            for (std::size_t i = b; i < e; i++) {
+              out[i] = in[i] * 1.5f + 0.25f;
+            }
+          },
+          cheap);
+      hw3d::bench::DoNotOptimize(out[0]);
+    });
+    std::snprintf(label, sizeof(label), "for madd, %2u workers", workers);
+    hw3d::bench::Report(label, ns, kItems, "items");
+
+    // expensive: a few transcendental calls per item
+    hw3d::ParallelCost heavy_cost;
+    hw3d::ParallelOptions heavy;
+    heavy.cost = &heavy_cost;
+    heavy.item_bytes = sizeof(float);
+    ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+      hw3d::ParallelForRange(
+          0, kItems,
+          [&](std::size_t b, std::size_t e) {
+            for (std::size_t i = b; i < e; i++) {
+              out[i] = std::sin(in[i]) * std::exp(in[i]) + std::sqrt(in[i]);
+            }
+          },
+          heavy);
+      hw3d::bench::DoNotOptimize(out[0]);
+    });
+    std::snprintf(label, sizeof(label), "for sin/exp, %2u workers", workers);
+    hw3d::bench::Report(label, ns, kItems, "items");
+
+    hw3d::ParallelCost reduce_cost;
+    hw3d::ParallelOptions reduce;
+    reduce.cost = &reduce_cost;
+    ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+      const double sum = hw3d::ParallelReduce(
+          0, kItems, 0.0,
+          [&](std::size_t b, std::size_t e) {
+            double s = 0.0;
+            for (std::size_t i = b; i < e; i++) {
+              s += in[i];
+            }
+            return s;
+          },
+          [](double a, double b) { return a + b; }, reduce);
+      hw3d::bench::DoNotOptimize(sum);
+    });
+    std::snprintf(label, sizeof(label), "reduce sum, %2u workers", workers);
+    hw3d::bench::Report(label, ns, kItems, "items");
+  }
+  return 0;
+}
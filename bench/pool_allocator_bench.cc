@@ -0,0 +1,81 @@
+﻿// Object churn: each thread does 2M random new/delete of a 56-byte object
+// with up to 256 alive at once, through HW3D_POOL_ALLOCATED and through the
+// global operator new, on 1 and 4 threads.
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "bench/bench.h"
+#include "hw3d/pool_allocator.h"
+
+namespace {
+
+constexpr int kOperations = 2000000;
+constexpr int kLive = 256;
+constexpr int kRepeats = 5;
+
+struct Plain {
+  std::uint64_t fields[7];
+};
+static_assert(sizeof(Plain) == 56, "benchmark object should be 56 bytes");
+
+struct Pooled {
+  std::uint64_t fields[7];
+  HW3D_POOL_ALLOCATED(Pooled)
+};
+static_assert(sizeof(Pooled) == 56, "benchmark object should be 56 bytes");
+
+template <typename T>
+void Churn(std::uint32_t seed) {
+  T* live[kLive] = {};
+  for (int i = 0; i < kOperations; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    T*& slot = live[(seed >> 8) % kLive];
+    if (slot == nullptr) {
+      slot = new T;
+      slot->fields[0] = seed;
+    } else {
+      delete slot;
+      slot = nullptr;
+    }
+  }
+  for (T* p : live) {
+    delete p;
+  }
+}
+
+template <typename T>
+double Measure(int threads) {
+  return hw3d::bench::BestOfNs(kRepeats, [threads] {
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+      workers.emplace_back(
+          [t] { Churn<T>(0x9E3779B9u * static_cast<std::uint32_t>(t + 1)); });
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  });
+}
+
+}  // namespace
+
+int main() {
+  for (const int threads : {1, 4}) {
+    char label[64];
+    std::snprintf(label, sizeof(label), "operator new/delete, %d threads",
+                  threads);
+    hw3d::bench::Report(label, Measure<Plain>(threads),
+                        static_cast<double>(kOperations) * threads, "ops");
+    std::snprintf(label, sizeof(label), "FixedPool, %d threads", threads);
+    hw3d::bench::Report(label, Measure<Pooled>(threads),
+                        static_cast<double>(kOperations) * threads, "ops");
+  }
+  const auto stats = hw3d::PoolFor<Pooled>().stats();
+  std::printf("pool: %llu slabs, %llu refills, %llu flushes\n",
+              static_cast<unsigned long long>(stats.slabs),
+              static_cast<unsigned long long>(stats.refills),
+              static_cast<unsigned long long>(stats.flushes));
+  return 0;
+}
@@ -0,0 +1,83 @@
+﻿// Random lookups over 100k live resources: a ResourcePool handle against
+// the usual alternatives, a raw pointer, a shared_ptr copy and an
+// unordered_map keyed by id.
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "bench/bench.h"
+#include "hw3d/resource_registry.h"
+
+namespace {
+
+constexpr std::size_t kResources = 100000;
+constexpr std::size_t kLookups = 1 << 20;
+constexpr int kRepeats = 10;
+
+struct Resource {
+  std::uint64_t payload[4];
+};
+
+}  // namespace
+
+int main() {
+  hw3d::ResourcePool<Resource> pool;
+  std::vector<hw3d::ResourcePool<Resource>::HandleType> handles;
+  std::vector<std::shared_ptr<Resource>> shared;
+  std::vector<Resource*> raw;
+  std::unordered_map<std::uint32_t, Resource> by_id;
+  for (std::size_t i = 0; i < kResources; i++) {
+    handles.push_back(pool.Create(Resource{{i, 0, 0, 0}}));
+    shared.push_back(std::make_shared<Resource>(Resource{{i, 0, 0, 0}}));
+    raw.push_back(shared.back().get());
+    by_id.emplace(static_cast<std::uint32_t>(i), Resource{{i, 0, 0, 0}});
+  }
+  // churn the pool so the dense order no longer follows the handles
+  std::mt19937 rng(3);
+  for (std::size_t i = 0; i < kResources / 2; i++) {
+    const std::size_t k = rng() % kResources;
+    pool.Destroy(handles[k]);
+    handles[k] = pool.Create(Resource{{k, 0, 0, 0}});
+  }
+  std::vector<std::uint32_t> order(kLookups);
+  for (auto& o : order) {
+    o = static_cast<std::uint32_t>(rng() % kResources);
+  }
+
+  std::uint64_t sum = 0;
+  double ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    for (const std::uint32_t i : order) {
+      sum += pool.Get(handles[i])->payload[0];
+    }
+    hw3d::bench::DoNotOptimize(sum);
+  });
+  hw3d::bench::Report("ResourcePool::Get", ns, kLookups, "lookups");
+
+  ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    for (const std::uint32_t i : order) {
+      sum += raw[i]->payload[0];
+    }
+    hw3d::bench::DoNotOptimize(sum);
+  });
+  hw3d::bench::Report("raw pointer", ns, kLookups, "lookups");
+
+  ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    for (const std::uint32_t i : order) {
+      const std::shared_ptr<Resource> copy = shared[i];
+      sum += copy->payload[0];
+    }
+    hw3d::bench::DoNotOptimize(sum);
+  });
+  hw3d::bench::Report("shared_ptr copy", ns, kLookups, "lookups");
+
+  ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    for (const std::uint32_t i : order) {
+      sum += by_id.find(i)->second.payload[0];
+    }
+    hw3d::bench::DoNotOptimize(sum);
+  });
+  hw3d::bench::Report("unordered_map::find", ns, kLookups, "lookups");
+  return 0;
+}
@@ -0,0 +1,99 @@
+﻿// Batch kernels of simd_math.h against a scalar libm loop, 64k elements
+// per call: sin on animation-sized angles and on arguments past the
+// polynomial range (the libm slow path), exp, log and atan2. Build with
+// -mavx2 -mfma or -mavx512f to compare widths.
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "bench/bench.h"
+#include "hw3d/simd_math.h"
+
+namespace {
+
+constexpr std::size_t kCount = 1 << 16;
+constexpr int kRepeats = 20;
+
+std::vector<float> Uniform(float lo, float hi, std::uint32_t seed) {
+  std::vector<float> values(kCount);
+  for (float& v : values) {
+    seed = seed * 1664525u + 1013904223u;
+    v = lo + (hi - lo) * static_cast<float>(seed >> 8) / 16777216.0f;
+  }
+  return values;
+}
+
+template <typename Body>
+void Run(const char* name, Body&& body) {
+  hw3d::bench::Report(name, hw3d::bench::BestOfNs(kRepeats, body), kCount,
+                      "elems");
+}
+
+}  // namespace
+
+int main() {
+  using hw3d::bench::DoNotOptimize;
+  std::vector<float> out(kCount);
+
+  const std::vector<float> angles = Uniform(-100.0f, 100.0f, 1);
+  Run("sin, libm", [&] {
+    for (std::size_t i = 0; i < kCount; i++) {
+      out[i] = std::sin(angles[i]);
+    }
+    DoNotOptimize(out[0]);
+  });
+  Run("sin, SinBatch", [&] {
+    hw3d::SinBatch(angles.data(), out.data(), kCount);
+    DoNotOptimize(out[0]);
+  });
+
+  const std::vector<float> huge = Uniform(1e6f, 1e9f, 2);
+  Run("sin |x| in [1e6, 1e9], libm", [&] {
+    for (std::size_t i = 0; i < kCount; i++) {
+      out[i] = std::sin(huge[i]);
+    }
+    DoNotOptimize(out[0]);
+  });
+  Run("sin |x| in [1e6, 1e9], SinBatch", [&] {
+    hw3d::SinBatch(huge.data(), out.data(), kCount);
+    DoNotOptimize(out[0]);
+  });
+
+  const std::vector<float> exponents = Uniform(-80.0f, 80.0f, 3);
+  Run("exp, libm", [&] {
+    for (std::size_t i = 0; i < kCount; i++) {
+      out[i] = std::exp(exponents[i]);
+    }
+    DoNotOptimize(out[0]);
+  });
+  Run("exp, ExpBatch", [&] {
+    hw3d::ExpBatch(exponents.data(), out.data(), kCount);
+    DoNotOptimize(out[0]);
+  });
+
+  const std::vector<float> positive = Uniform(1e-3f, 1e6f, 4);
+  Run("log, libm", [&] {
+    for (std::size_t i = 0; i < kCount; i++) {
+      out[i] = std::log(positive[i]);
+    }
+    DoNotOptimize(out[0]);
+  });
+  Run("log, LogBatch", [&] {
+    hw3d::LogBatch(positive.data(), out.data(), kCount);
+    DoNotOptimize(out[0]);
+  });
+
+  const std::vector<float> y = Uniform(-10.0f, 10.0f, 5);
+  const std::vector<float> x = Uniform(-10.0f, 10.0f, 6);
+  Run("atan2, libm", [&] {
+    for (std::size_t i = 0; i < kCount; i++) {
+      out[i] = std::atan2(y[i], x[i]);
+    }
+    DoNotOptimize(out[0]);
+  });
+  Run("atan2, Atan2Batch", [&] {
+    hw3d::Atan2Batch(y.data(), x.data(), out.data(), kCount);
+    DoNotOptimize(out[0]);
+  });
+  return 0;
+}
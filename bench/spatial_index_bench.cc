@@ -0,0 +1,160 @@
+﻿// LooseOctree and SpatialHashGrid against a linear scan, on two scenes of
+// 100k objects over 8 frames (best frame reported):
+//   dense  400 x 400 area, every object moving, sphere queries of radius 8
+//   mixed  2000 x 2000 area, a quarter moving, 2% large static objects,
+//          radius 20
+// Each frame applies one batched Update() and runs 10k sphere queries per
+// structure; the scan runs 200 of them and is scaled to 10k. Query hit
+// counts are checked against the scan.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "hw3d/loose_octree.h"
+#include "hw3d/spatial_hash_grid.h"
+
+namespace {
+
+constexpr std::size_t kObjects = 100000;
+constexpr int kFrames = 8;
+constexpr int kQueries = 10000;
+constexpr int kScanQueries = 200;
+constexpr int kOctreeDepth = 6;
+constexpr float kCellSize = 8.0f;
+
+class Random {
+ public:
+  explicit Random(std::uint32_t seed) : state_(seed) {}
+  // Uniform in [0, 1).
+  float Next() {
+    state_ = state_ * 1664525u + 1013904223u;
+    return static_cast<float>(state_ >> 8) / 16777216.0f;
+  }
+
+ private:
+  std::uint32_t state_;
+};
+
+double Milliseconds(std::chrono::steady_clock::time_point start,
+                    std::chrono::steady_clock::time_point stop) {
+  return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+void Run(bool mixed) {
+  const float size = mixed ? 2000.0f : 400.0f;
+  const float radius = mixed ? 20.0f : 8.0f;
+  Random random(3);
+  std::vector<hw3d::Aabb> boxes(kObjects);
+  std::vector<hw3d::Float3> velocity(kObjects);
+  std::vector<std::uint32_t> moving;
+  for (std::size_t i = 0; i < kObjects; i++) {
+    const hw3d::Float3 c{random.Next() * size - size / 2, random.Next() * 20,
+                         random.Next() * size - size / 2};
+    const bool large = mixed && i % 50 == 0;
+    const float e =
+        large ? 5.0f + random.Next() * 40.0f : 0.25f + random.Next() * 0.5f;
+    boxes[i] = {c - hw3d::Float3{e, e, e}, c + hw3d::Float3{e, e, e}};
+    if (!mixed || (i % 4 == 0 && !large)) {
+      moving.push_back(static_cast<std::uint32_t>(i));
+      velocity[i] = hw3d::Float3{random.Next() - 0.5f, 0.0f,
+                                 random.Next() - 0.5f} *
+                    0.6f;
+    }
+  }
+  std::vector<std::uint32_t> all(kObjects);
+  for (std::size_t i = 0; i < kObjects; i++) {
+    all[i] = static_cast<std::uint32_t>(i);
+  }
+
+  const hw3d::Aabb world{{-size / 2, 0, -size / 2}, {size / 2, 20, size / 2}};
+  hw3d::LooseOctree octree(world, kOctreeDepth);
+  hw3d::SpatialHashGrid grid(kCellSize);
+  octree.Insert(all.data(), boxes.data(), kObjects);
+  grid.Insert(all.data(), boxes.data(), kObjects);
+
+  std::vector<hw3d::Aabb> moved(moving.size());
+  std::vector<hw3d::Float3> queries(kQueries);
+  double octree_update = 1e30, grid_update = 1e30;
+  double octree_query = 1e30, grid_query = 1e30, scan_query = 1e30;
+  std::size_t hits = 0;
+  int mismatches = 0;
+  for (int frame = 0; frame < kFrames; frame++) {
+    for (std::size_t k = 0; k < moving.size(); k++) {
+      const std::uint32_t i = moving[k];
+      hw3d::Float3 v = velocity[i];
+      // the odd teleport, so some objects cross many cells
+      if (random.Next() < 0.001f) {
+        v = hw3d::Float3{random.Next() - 0.5f, 0.0f, random.Next() - 0.5f} *
+            (size * 0.5f);
+      }
+      boxes[i] = {boxes[i].min + v, boxes[i].max + v};
+      moved[k] = boxes[i];
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    octree.Update(moving.data(), moved.data(), moving.size());
+    auto t1 = std::chrono::steady_clock::now();
+    grid.Update(moving.data(), moved.data(), moving.size());
+    auto t2 = std::chrono::steady_clock::now();
+    octree_update = std::min(octree_update, Milliseconds(t0, t1));
+    grid_update = std::min(grid_update, Milliseconds(t1, t2));
+
+    for (hw3d::Float3& q : queries) {
+      q = {random.Next() * size - size / 2, random.Next() * 20,
+           random.Next() * size - size / 2};
+    }
+    std::vector<std::uint32_t> octree_hits(kQueries), grid_hits(kQueries);
+    t0 = std::chrono::steady_clock::now();
+    for (int j = 0; j < kQueries; j++) {
+      octree.QuerySphere(queries[j], radius,
+                         [&](std::uint32_t) { octree_hits[j]++; });
+    }
+    t1 = std::chrono::steady_clock::now();
+    for (int j = 0; j < kQueries; j++) {
+      grid.QuerySphere(queries[j], radius,
+                       [&](std::uint32_t) { grid_hits[j]++; });
+    }
+    t2 = std::chrono::steady_clock::now();
+    std::vector<std::uint32_t> scan_hits(kScanQueries);
+    const float r2 = radius * radius;
+    for (int j = 0; j < kScanQueries; j++) {
+      for (const hw3d::Aabb& box : boxes) {
+        scan_hits[j] += hw3d::DistanceSquared(box, queries[j]) <= r2 ? 1 : 0;
+      }
+    }
+    const auto t3 = std::chrono::steady_clock::now();
+    octree_query = std::min(octree_query, Milliseconds(t0, t1));
+    grid_query = std::min(grid_query, Milliseconds(t1, t2));
+    scan_query = std::min(scan_query, Milliseconds(t2, t3) * kQueries /
+                                          kScanQueries);
+    for (int j = 0; j < kScanQueries; j++) {
+      mismatches += octree_hits[j] != scan_hits[j] ? 1 : 0;
+      mismatches += grid_hits[j] != scan_hits[j] ? 1 : 0;
+    }
+    hits = 0;
+    for (const std::uint32_t n : grid_hits) {
+      hits += n;
+    }
+  }
+
+  std::printf("%s: %zu objects, %zu moving, %zu octree nodes, %zu cells, "
+              "%zu large, %.1f hits per query, %d mismatches\n",
+              mixed ? "mixed" : "dense", kObjects, moving.size(),
+              octree.node_count(), grid.cell_count(), grid.large_count(),
+              static_cast<double>(hits) / kQueries, mismatches);
+  std::printf("  update         octree %7.2f ms   grid %7.2f ms\n",
+              octree_update, grid_update);
+  std::printf("  per query      octree %7.2f us   grid %7.2f us   "
+              "scan %7.1f us\n",
+              octree_query * 1e3 / kQueries, grid_query * 1e3 / kQueries,
+              scan_query * 1e3 / kQueries);
+}
+
+}  // namespace
+
+int main() {
+  Run(false);
+  Run(true);
+  return 0;
+}
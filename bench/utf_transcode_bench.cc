@@ -0,0 +1,210 @@
+﻿// UTF-8 <-> UTF-16 throughput on 1 MiB of text of different mixes, against a
+// byte-at-a-time decoder with the same validation.
+//
+// The baseline the Windows code replaced is the two-pass MultiByteToWideChar
+// pattern (one call to size the output, one to convert). That API exists
+// only on Windows and these benchmarks run on any host, so a plain scalar
+// decoder that rejects what MB_ERR_INVALID_CHARS rejects stands in for it.
+// It makes one pass, not two, so it is if anything a faster baseline. Before
+// timing, main() checks that it accepts and rejects the same inputs as
+// hw3d::Utf8ToUtf16.
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+
+#include "bench/bench.h"
+#include "hw3d/utf_transcode.h"
+
+namespace {
+
+constexpr std::size_t kBytes = 1 << 20;
+constexpr int kRepeats = 30;
+
+void AppendUtf8(std::string& out, std::uint32_t cp) {
+  if (cp < 0x80) {
+    out += static_cast<char>(cp);
+  } else if (cp < 0x800) {
+    out += static_cast<char>(0xC0 | (cp >> 6));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    out += static_cast<char>(0xE0 | (cp >> 12));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else {
+    out += static_cast<char>(0xF0 | (cp >> 18));
+    out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+}
+
+// `non_ascii_percent` of the characters are drawn from [lo, hi].
+std::string MakeText(int non_ascii_percent, std::uint32_t lo,
+                     std::uint32_t hi) {
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<int> percent(0, 99);
+  std::uniform_int_distribution<std::uint32_t> ascii(0x20, 0x7E);
+  std::uniform_int_distribution<std::uint32_t> other(lo, hi);
+  std::string text;
+  while (text.size() < kBytes) {
+    AppendUtf8(text, percent(rng) < non_ascii_percent ? other(rng)
+                                                       : ascii(rng));
+  }
+  return text;
+}
+
+// Reference: validates and decodes one code point per iteration. Returns 0
+// for invalid input: stray continuation bytes, lead bytes C0, C1 and F5 and
+// up, truncated sequences, overlong forms, surrogates and code points above
+// U+10FFFF.
+std::size_t NaiveUtf8ToUtf16(const std::string& in, char16_t* out) {
+  const auto* b = reinterpret_cast<const std::uint8_t*>(in.data());
+  const std::size_t n = in.size();
+  std::size_t i = 0;
+  std::size_t o = 0;
+  while (i < n) {
+    std::uint32_t cp = b[i];
+    if ((cp >= 0x80 && cp < 0xC2) || cp >= 0xF5) {
+      return 0;
+    }
+    std::size_t len = cp < 0x80 ? 1 : cp < 0xE0 ? 2 : cp < 0xF0 ? 3 : 4;
+    if (i + len > n) {
+      return 0;
+    }
+    for (std::size_t k = 1; k < len; k++) {
+      if ((b[i + k] & 0xC0) != 0x80) {
+        return 0;
+      }
+    }
+    if (len == 2) {
+      cp = ((cp & 0x1F) << 6) | (b[i + 1] & 0x3F);
+    } else if (len == 3) {
+      cp = ((cp & 0x0F) << 12) | ((b[i + 1] & 0x3F) << 6) | (b[i + 2] & 0x3F);
+    } else if (len == 4) {
+      cp = ((cp & 0x07) << 18) | ((b[i + 1] & 0x3F) << 12) |
+           ((b[i + 2] & 0x3F) << 6) | (b[i + 3] & 0x3F);
+    }
+    // C2 and up already rule out overlong two-byte forms
+    if ((len == 3 && cp < 0x800) || (len == 4 && cp < 0x10000) ||
+        (cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) {
+      return 0;
+    }
+    if (cp < 0x10000) {
+      out[o++] = static_cast<char16_t>(cp);
+    } else {
+      cp -= 0x10000;
+      out[o++] = static_cast<char16_t>(0xD800 + (cp >> 10));
+      out[o++] = static_cast<char16_t>(0xDC00 + (cp & 0x3FF));
+    }
+    i += len;
+  }
+  return o;
+}
+
+// True if the reference and hw3d::Utf8ToUtf16 agree on `utf8`: both reject
+// it, or both accept it with the same output.
+bool ReferenceAgrees(const std::string& utf8) {
+  std::u16string naive(hw3d::Utf16LengthBound(utf8.size()) + 1, u'\0');
+  std::u16string fast(naive.size(), u'\0');
+  const std::size_t naive_units = NaiveUtf8ToUtf16(utf8, &naive[0]);
+  const hw3d::UtfResult result =
+      hw3d::Utf8ToUtf16(utf8, &fast[0], fast.size());
+  if (!result.ok()) {
+    return naive_units == 0;
+  }
+  return naive_units == result.written &&
+         naive.compare(0, naive_units, fast, 0, result.written) == 0;
+}
+
+bool CheckReference() {
+  const char* const kInvalid[] = {
+      "\x80",              // stray continuation byte
+      "a\xBF" "b",         // stray continuation byte
+      "\xC0\xAF",          // overlong '/'
+      "\xC1\xBF",          // overlong U+007F
+      "\xE0\x80\xAF",      // overlong '/'
+      "\xE0\x9F\xBF",      // overlong U+07FF
+      "\xF0\x8F\xBF\xBF",  // overlong U+FFFF
+      "\xED\xA0\x80",      // U+D800
+      "\xED\xBF\xBF",      // U+DFFF
+      "\xF4\x90\x80\x80",  // U+110000
+      "\xF5\x80\x80\x80",  // lead byte past U+10FFFF
+      "\xF8\x88\x80\x80\x80",
+      "\xFF",
+      "\xE2\x82",          // truncated
+      "\xE2\x28\xA1",      // bad continuation
+  };
+  const char* const kValid[] = {
+      "\xC2\x80",          // U+0080
+      "\xDF\xBF",          // U+07FF
+      "\xE0\xA0\x80",      // U+0800
+      "\xED\x9F\xBF",      // U+D7FF
+      "\xEE\x80\x80",      // U+E000
+      "\xEF\xBF\xBF",      // U+FFFF
+      "\xF0\x90\x80\x80",  // U+10000
+      "\xF4\x8F\xBF\xBF",  // U+10FFFF
+  };
+  bool ok = true;
+  for (const char* s : kInvalid) {
+    ok &= ReferenceAgrees(s);
+  }
+  for (const char* s : kValid) {
+    ok &= ReferenceAgrees(std::string("x") + s + "y");
+  }
+  return ok;
+}
+
+void Run(const char* name, const std::string& utf8) {
+  std::u16string utf16(hw3d::Utf16LengthBound(utf8.size()), u'\0');
+  std::string back(hw3d::Utf8LengthBound(utf16.size()), '\0');
+  std::size_t units = 0;
+  char label[64];
+
+  double ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    units = NaiveUtf8ToUtf16(utf8, &utf16[0]);
+    hw3d::bench::DoNotOptimize(units);
+  });
+  std::snprintf(label, sizeof(label), "%s 8->16 naive", name);
+  hw3d::bench::Report(label, ns, static_cast<double>(utf8.size()), "B");
+
+  ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    units = hw3d::Utf8ToUtf16(utf8, &utf16[0], utf16.size()).written;
+    hw3d::bench::DoNotOptimize(units);
+  });
+  std::snprintf(label, sizeof(label), "%s 8->16", name);
+  hw3d::bench::Report(label, ns, static_cast<double>(utf8.size()), "B");
+
+  ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    units = hw3d::Utf8ToUtf16(utf8, &utf16[0], utf16.size(),
+                              hw3d::UtfErrors::kReplace)
+                .written;
+    hw3d::bench::DoNotOptimize(units);
+  });
+  std::snprintf(label, sizeof(label), "%s 8->16 replacing", name);
+  hw3d::bench::Report(label, ns, static_cast<double>(utf8.size()), "B");
+
+  const std::u16string_view wide(utf16.data(), units);
+  ns = hw3d::bench::BestOfNs(kRepeats, [&] {
+    const std::size_t written =
+        hw3d::Utf16ToUtf8(wide, &back[0], back.size()).written;
+    hw3d::bench::DoNotOptimize(written);
+  });
+  std::snprintf(label, sizeof(label), "%s 16->8", name);
+  hw3d::bench::Report(label, ns, static_cast<double>(utf8.size()), "B");
+}
+
+}  // namespace
+
+int main() {
+  if (!CheckReference()) {
+    std::fprintf(stderr, "the reference decoder disagrees with Utf8ToUtf16\n");
+    return 1;
+  }
+  Run("ascii", MakeText(0, 0, 0));
+  Run("1% latin-1", MakeText(1, 0xA0, 0xFF));
+  Run("10% latin-1", MakeText(10, 0xA0, 0xFF));
+  Run("cjk", MakeText(100, 0x4E00, 0x9FFF));
+  Run("emoji", MakeText(30, 0x1F300, 0x1F5FF));
+  return 0;
+}
@@ -0,0 +1,103 @@
+﻿// Point and matrix throughput of vector_math.h against the constexpr
+// scalar helpers on Float4x4 (the "naive" rows): 64 passes of 16k points
+// through one matrix as AoS and SoA, and 100k matrix products. The point
+// arrays fit in L2, so the rows measure the arithmetic rather than memory
+// bandwidth. Build with -mavx2 -mfma, or -DHW3D_MATH_SCALAR, to compare
+// the other code paths.
+#include <cstdint>
+#include <vector>
+
+#include "bench/bench.h"
+#include "hw3d/vector_math.h"
+
+namespace {
+
+constexpr std::size_t kPoints = 1 << 14;
+constexpr int kPasses = 64;
+constexpr std::size_t kMatrices = 100000;
+constexpr int kRepeats = 10;
+
+float NextFloat(std::uint32_t& state) {
+  state = state * 1664525u + 1013904223u;
+  return static_cast<float>(state >> 8) / 16777216.0f * 2.0f - 1.0f;
+}
+
+hw3d::Float4x4 MakeMatrix(std::uint32_t& state) {
+  hw3d::Float4x4 m;
+  for (auto& row : m.m) {
+    for (float& v : row) {
+      v = NextFloat(state);
+    }
+  }
+  return m;
+}
+
+}  // namespace
+
+int main() {
+  using hw3d::bench::BestOfNs;
+  using hw3d::bench::DoNotOptimize;
+  using hw3d::bench::Report;
+
+  std::uint32_t state = 1;
+  const hw3d::Float4x4 m = MakeMatrix(state);
+  const hw3d::Mat4 mat = hw3d::Load(m);
+
+  std::vector<hw3d::Float3> points(kPoints);
+  std::vector<float> x(kPoints), y(kPoints), z(kPoints);
+  for (std::size_t i = 0; i < kPoints; i++) {
+    points[i] = {NextFloat(state), NextFloat(state), NextFloat(state)};
+    x[i] = points[i].x;
+    y[i] = points[i].y;
+    z[i] = points[i].z;
+  }
+  std::vector<hw3d::Float3> out(kPoints);
+  std::vector<float> out_x(kPoints), out_y(kPoints), out_z(kPoints);
+
+  Report("points, naive", BestOfNs(kRepeats, [&] {
+           for (int pass = 0; pass < kPasses; pass++) {
+             for (std::size_t i = 0; i < kPoints; i++) {
+               out[i] = hw3d::TransformPoint(points[i], m);
+             }
+             DoNotOptimize(out[kPoints - 1]);
+           }
+         }),
+         kPoints * kPasses, "points");
+  Report("points, TransformPoints (AoS)", BestOfNs(kRepeats, [&] {
+           for (int pass = 0; pass < kPasses; pass++) {
+             hw3d::TransformPoints(mat, points.data(), out.data(), kPoints);
+             DoNotOptimize(out[kPoints - 1]);
+           }
+         }),
+         kPoints * kPasses, "points");
+  Report("points, TransformPointsSoA", BestOfNs(kRepeats, [&] {
+           for (int pass = 0; pass < kPasses; pass++) {
+             hw3d::TransformPointsSoA(mat, x.data(), y.data(), z.data(),
+                                      out_x.data(), out_y.data(),
+                                      out_z.data(), kPoints);
+             DoNotOptimize(out_x[kPoints - 1]);
+           }
+         }),
+         kPoints * kPasses, "points");
+
+  std::vector<hw3d::Float4x4> floats(kMatrices), float_out(kMatrices);
+  std::vector<hw3d::Mat4> mats(kMatrices), mat_out(kMatrices);
+  for (std::size_t i = 0; i < kMatrices; i++) {
+    floats[i] = MakeMatrix(state);
+    mats[i] = hw3d::Load(floats[i]);
+  }
+  Report("matrix multiply, naive", BestOfNs(kRepeats, [&] {
+           for (std::size_t i = 0; i < kMatrices; i++) {
+             float_out[i] = hw3d::Multiply(floats[i], m);
+           }
+           DoNotOptimize(float_out[kMatrices - 1]);
+         }),
+         kMatrices, "mats");
+  Report("matrix multiply, MultiplyMatrices", BestOfNs(kRepeats, [&] {
+           hw3d::MultiplyMatrices(mats.data(), mat, mat_out.data(),
+                                  kMatrices);
+           DoNotOptimize(mat_out[kMatrices - 1]);
+         }),
+         kMatrices, "mats");
+  return 0;
+}
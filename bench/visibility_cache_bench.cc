@@ -0,0 +1,157 @@
+﻿// Replays six camera paths over 600 frames against 200k boxes on a
+// 2000 x 2000 field, 2k of them moving (none in "static"), and compares a
+// plain FrustumCuller with VisibilityCache per frame:
+//   static  camera fixed, nothing moves
+//   still   camera fixed, movers move
+//   walk    walking pace with a gentle turn
+//   run     five times faster, with some pitch
+//   pan     turning on the spot at 1 degree per frame
+//   cuts    slow drift with a jump to a random spot every 60 frames
+// Every frame's visible set is checked against the FrustumCuller one.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "hw3d/visibility_cache.h"
+
+namespace {
+
+constexpr std::size_t kBoxes = 200000;
+constexpr std::size_t kMovers = 2000;
+constexpr int kFrames = 600;
+
+class Random {
+ public:
+  explicit Random(std::uint32_t seed) : state_(seed) {}
+  // Uniform in [0, 1).
+  float Next() {
+    state_ = state_ * 1664525u + 1013904223u;
+    return static_cast<float>(state_ >> 8) / 16777216.0f;
+  }
+
+ private:
+  std::uint32_t state_;
+};
+
+struct Camera {
+  hw3d::Float3 eye{0, 10, 0};
+  float yaw = 0.0f;
+  float pitch = 0.0f;
+};
+
+hw3d::Frustum FrustumOf(const Camera& camera) {
+  const hw3d::Float3 dir{std::cos(camera.pitch) * std::sin(camera.yaw),
+                         std::sin(camera.pitch),
+                         std::cos(camera.pitch) * std::cos(camera.yaw)};
+  const hw3d::Float3& e = camera.eye;
+  const hw3d::Mat4 view = hw3d::MatLookAtLH(
+      hw3d::VecSet(e.x, e.y, e.z, 1),
+      hw3d::VecSet(e.x + dir.x, e.y + dir.y, e.z + dir.z, 1),
+      hw3d::VecSet(0, 1, 0, 0));
+  return hw3d::FrustumFromMatrix(
+      view * hw3d::MatPerspectiveFovLH(hw3d::ToRadians(60.0f), 16.0f / 9.0f,
+                                       0.1f, 1000.0f));
+}
+
+void Step(const char* path, int frame, Random& random, Camera* camera) {
+  if (std::strcmp(path, "walk") == 0) {
+    camera->yaw += 0.003f * std::sin(frame * 0.02f);
+    camera->eye = camera->eye + hw3d::Float3{std::sin(camera->yaw), 0.0f,
+                                             std::cos(camera->yaw)} *
+                                    0.15f;
+  } else if (std::strcmp(path, "run") == 0) {
+    camera->yaw += 0.01f * std::sin(frame * 0.05f);
+    camera->pitch = 0.1f * std::sin(frame * 0.03f);
+    camera->eye = camera->eye + hw3d::Float3{std::sin(camera->yaw), 0.0f,
+                                             std::cos(camera->yaw)};
+  } else if (std::strcmp(path, "pan") == 0) {
+    camera->yaw += hw3d::ToRadians(1.0f);
+  } else if (std::strcmp(path, "cuts") == 0) {
+    camera->eye = camera->eye + hw3d::Float3{0.2f, 0.0f, 0.1f};
+    if (frame % 60 == 0) {
+      camera->eye = {random.Next() * 1000 - 500, 10,
+                     random.Next() * 1000 - 500};
+      camera->yaw = random.Next() * 6.28f;
+    }
+  }
+}
+
+void Replay(const char* path) {
+  Random random(5);
+  hw3d::AabbArray boxes;
+  boxes.Resize(kBoxes);
+  std::vector<hw3d::Float3> centers(kBoxes), velocity(kBoxes);
+  for (std::size_t i = 0; i < kBoxes; i++) {
+    centers[i] = {random.Next() * 2000 - 1000, random.Next() * 30,
+                  random.Next() * 2000 - 1000};
+    const float e = 0.5f + random.Next() * 3;
+    boxes.Set(i, centers[i], hw3d::Float3{e, e, e});
+    velocity[i] =
+        hw3d::Float3{random.Next() - 0.5f, 0.0f, random.Next() - 0.5f} * 0.5f;
+  }
+  const bool movers = std::strcmp(path, "static") != 0;
+  std::vector<std::uint32_t> moved;
+  std::vector<std::uint32_t> expected(kBoxes), got;
+  hw3d::VisibilityCache cache;
+  hw3d::FrustumCuller culler;
+  Camera camera;
+  double culler_us = 0, cache_us = 0, cache_max_us = 0;
+  int resets = 0, mismatches = 0;
+  std::size_t tested = 0;
+  double build_ms = 0;
+  for (int frame = 0; frame < kFrames; frame++) {
+    Step(path, frame, random, &camera);
+    moved.clear();
+    if (movers) {
+      for (std::size_t k = 0; k < kMovers; k++) {
+        const std::size_t i = k * (kBoxes / kMovers);
+        centers[i] = centers[i] + velocity[i];
+        boxes.Set(i, centers[i], hw3d::Float3{1, 1, 1});
+        moved.push_back(static_cast<std::uint32_t>(i));
+      }
+    }
+    const hw3d::Frustum frustum = FrustumOf(camera);
+    const auto t0 = std::chrono::steady_clock::now();
+    const std::size_t count = culler.Cull(frustum, boxes, expected.data());
+    const auto t1 = std::chrono::steady_clock::now();
+    cache.Cull(frustum, camera.eye, boxes, moved.data(), moved.size());
+    const auto t2 = std::chrono::steady_clock::now();
+    const double cull = std::chrono::duration<double, std::micro>(t1 - t0)
+                            .count();
+    const double cached = std::chrono::duration<double, std::micro>(t2 - t1)
+                              .count();
+    culler_us += cull;
+    cache_us += cached;
+    if (cache.stats().rebuilt) {
+      build_ms += cached * 1e-3;
+    } else {
+      cache_max_us = std::max(cache_max_us, cached);
+    }
+    resets += cache.stats().reset ? 1 : 0;
+    tested += cache.stats().tested_boxes;
+    got = cache.visible();
+    std::sort(got.begin(), got.end());
+    if (got.size() != count ||
+        !std::equal(got.begin(), got.end(), expected.begin())) {
+      mismatches++;
+    }
+  }
+  std::printf("%-7s culler %6.0f us  cache %6.0f us (max %5.0f, build "
+              "%4.1f ms)  resets %3d  tested/frame %6.0f  mismatches %d\n",
+              path, culler_us / kFrames, cache_us / kFrames, cache_max_us,
+              build_ms, resets, static_cast<double>(tested) / kFrames,
+              mismatches);
+}
+
+}  // namespace
+
+int main() {
+  for (const char* path : {"static", "still", "walk", "run", "pan", "cuts"}) {
+    Replay(path);
+  }
+  return 0;
+}
@@ -1,20 +1,28 @@
-﻿#include "App.h"
+﻿#include "app.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <sstream>
-// use embedded resource id
-#include "resource.h"
+#include <utility>
+#include "hw3d/flight_recorder.h"
+#include "hw3d/log.h"
+#include "hw3d/memory_tracker.h"
 
-App::App() : wnd_(800, 600, "The Donkey Fart Box") {
-  wnd_.SetIconFromResource(IDI_HW3D);
-}
+App::App(std::unique_ptr<hw3d::PlatformWindow> wnd, unsigned pipeline_depth)
+    : wnd_(std::move(wnd)),
+      frames_(std::max(pipeline_depth, 1u)),
+      pipeline_(pipeline_depth,
+                [this](unsigned slot) { RenderFrame(frames_[slot]); }) {}
 
 int App::Loop() {
   while (true) {
     // process all messages pending, but to not block for new messages
-    if (const auto ecode = hw3d::Window::ProcessMessages()) {
+    if (const auto ecode = wnd_->PumpMessages()) {
       // if return optional has value, means we're quitting so return exit
       // code
+      pipeline_.Flush();
+      LogPipelineStats();
       return *ecode;
     }
     DoFrame();
@@ -25,9 +33,52 @@ void App::DoFrame() {
   // const float t = timer_.Peek();
   // std::ostringstream oss;
   // oss << "Time elapsed: " << std::setprecision(1) << std::fixed << t << "s";
-  // wnd_.SetTitle(oss.str());
+  // wnd_->SetTitle(oss.str());
+
+  FrameData& frame = frames_[pipeline_.BeginFrame()];
+  const float c = std::sin(timer_.Peek()) / 2.0f + 0.5f;
+  frame.clear_red = c;
+  frame.clear_green = c;
+  frame.clear_blue = 1.0f;
+  pipeline_.EndFrame();
+  hw3d::MemoryTracker::Get().EndFrame();
+}
 
-  const float c = sin(timer_.Peek()) / 2.0f + 0.5f;
-  wnd_.graphics().ClearBuffer(c, c, 1.0f);
-  wnd_.graphics().Present();
+void App::RenderFrame(FrameData& frame) {
+  wnd_->surface().ClearBuffer(frame.clear_red, frame.clear_green,
+                              frame.clear_blue);
+  wnd_->surface().Present();
+  // closed on the thread that presents, so the frame record and
+  // RecordPresent() never race
+  hw3d::FlightRecorder::Get().EndFrame(frame_timer_.Mark());
+  frame.arena.Reset();
+}
+
+void App::LogPipelineStats() const {
+  const auto stats = pipeline_.stats();
+  if (stats.frames == 0) {
+    return;
+  }
+  const double frames = static_cast<double>(stats.frames);
+  HW3D_LOG(hw3d::LogLevel::kInfo,
+           "frame pipeline depth {}: {} frames, latency {} ms mean {} ms max, "
+           "simulate {} ms, render {} ms, stalled {} ms per frame",
+           pipeline_.depth(), stats.frames,
+           stats.total_latency_ns / frames / 1e6,
+           stats.max_latency_ns / 1e6, stats.simulate_ns / frames / 1e6,
+           stats.render_ns / frames / 1e6, stats.stall_ns / frames / 1e6);
+  std::size_t arena_peak = 0;
+  std::uint64_t arena_overflows = 0;
+  for (const auto& frame : frames_) {
+    const auto arena = frame.arena.stats();
+    arena_peak = std::max(arena_peak, arena.peak_frame_bytes);
+    arena_overflows += arena.overflow_allocations;
+  }
+  HW3D_LOG(hw3d::LogLevel::kInfo,
+           "frame arena: peak {} of {} bytes, {} overflow allocations",
+           arena_peak, frames_.front().arena.capacity(), arena_overflows);
+  const auto heap = hw3d::MemoryTracker::Get().frame_stats();
+  HW3D_LOG(hw3d::LogLevel::kInfo,
+           "heap: {} allocations in the last frame, {} at most",
+           heap.last_frame_allocations, heap.max_frame_allocations);
 }
\ No newline at end of file
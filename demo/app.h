@@ -1,17 +1,49 @@
 ﻿#pragma once
-#include "hw3d/window.h"
+#include <memory>
+#include <vector>
+
+#include "hw3d/frame_arena.h"
+#include "hw3d/frame_pipeline.h"
+#include "hw3d/platform_window.h"
 #include "hw3d/timer.h"
 
 class App {
  public:
-  App();
+  // Runs on any PlatformWindow: the Win32 Window or a HeadlessWindow.
+  // With a pipeline depth above 1 the next frame is simulated while the
+  // current one is rendered and presented on a separate thread. Only use
+  // that with a HeadlessWindow for now: DXGI's Present can wait on the
+  // thread that owns the window to process messages, while that thread
+  // waits in BeginFrame() for the render thread to free a slot.
+  explicit App(std::unique_ptr<hw3d::PlatformWindow> wnd,
+               unsigned pipeline_depth = 1);
   // master frame / message loop
   int Loop();
 
  private:
+  // everything the render stage needs from one simulated frame
+  struct FrameData {
+    float clear_red = 0.0f;
+    float clear_green = 0.0f;
+    float clear_blue = 0.0f;
+    // the frame's temporaries; reset once the frame is presented
+    hw3d::FrameArena arena;
+  };
+
+  // simulation stage: fills the frame's slot
   void DoFrame();
+  // render stage: runs on the pipeline's render thread
+  void RenderFrame(FrameData& frame);
+  void LogPipelineStats() const;
 
  private:
-  hw3d::Window wnd_;
+  std::unique_ptr<hw3d::PlatformWindow> wnd_;
   hw3d::Timer timer_;
+  // Present-to-Present interval fed to the flight recorder; render stage
+  // only
+  hw3d::Timer frame_timer_;
+  // one per pipeline slot
+  std::vector<FrameData> frames_;
+  // declared last: stops the render thread before the rest goes away
+  hw3d::FramePipeline pipeline_;
 };
\ No newline at end of file
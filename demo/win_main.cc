@@ -1,5 +1,24 @@
-﻿#include <sstream>
+﻿#include <memory>
+#include <sstream>
 #include "app.h"
+#include "hw3d/flight_recorder.h"
+#include "hw3d/log.h"
+#include "hw3d/memory_tracker.h"
+#include "hw3d/window.h"
+// use embedded resource id
+#include "resource.h"
+
+namespace {
+
+// Writes the flight recorder's rings next to the executable. The mapped ring
+// file is flushed as well so it matches the text report.
+void DumpFlightRecorder() {
+  auto& recorder = hw3d::FlightRecorder::Get();
+  recorder.Flush();
+  recorder.DumpText("hw3d_crash.txt");
+}
+
+}  // namespace
 
 int CALLBACK WinMain(HINSTANCE hInstance,
                      HINSTANCE hPrevInstance,
@@ -7,14 +26,41 @@ int CALLBACK WinMain(HINSTANCE hInstance,
                      int nCmdShow) {
   // MessageBox(NULL, L"Hello, World!", L"My First Windows App", MB_OK);
 
+  // decode with tools/hw3d_log_decode
+  hw3d::LogSession log_session("hw3d.log");
+
+  // the rings live in a mapped file so they survive a hard crash (decode with
+  // tools/hw3d_flight_decode); fall back to heap storage if the file cannot
+  // be created
+  hw3d::FlightRecorderConfig recorder_config;
+  recorder_config.mapped_path = "hw3d_flight.bin";
+  if (!hw3d::FlightRecorder::Get().Start(recorder_config)) {
+    recorder_config.mapped_path = nullptr;
+    hw3d::FlightRecorder::Get().Start(recorder_config);
+  }
+
   try {
-    return App{}.Loop();
+    // everything the window and the app allocate should be gone once the
+    // app is; what is left ends up in the report
+    hw3d::MemoryTracker::Get().BeginLeakCheck();
+    auto wnd = std::make_unique<hw3d::Window>(800, 600, "The Donkey Fart Box");
+    wnd->SetIconFromResource(IDI_HW3D);
+    const int exit_code = App{std::move(wnd)}.Loop();
+    hw3d::MemoryTracker::Get().EndLeakCheck();
+    hw3d::MemoryTracker::Get().WriteReport("hw3d_memory.txt");
+    return exit_code;
   } catch (const hw3d::Hw3dException& e) {
+    HW3D_LOG(hw3d::LogLevel::kError, "{}: {}", e.GetType(), e.what());
+    DumpFlightRecorder();
     MessageBox(nullptr, e.what(), e.GetType(), MB_OK | MB_ICONEXCLAMATION);
   } catch (const std::exception& e) {
+    HW3D_LOG(hw3d::LogLevel::kError, "standard exception: {}", e.what());
+    DumpFlightRecorder();
     MessageBox(nullptr, e.what(), "Standard Exception",
                MB_OK | MB_ICONEXCLAMATION);
   } catch (...) {
+    HW3D_LOG(hw3d::LogLevel::kError, "unknown exception");
+    DumpFlightRecorder();
     MessageBox(nullptr, "No details available", "Unknown Exception",
                MB_OK | MB_ICONEXCLAMATION);
   }
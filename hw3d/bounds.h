@@ -0,0 +1,225 @@
+﻿#pragma once
+
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include "vector_math.h"
+
+// Bounding volumes and view frusta shared by the culling and spatial query
+// code. Plain storage, like Float3; the batch tests that matter for speed
+// live with their callers.
+
+namespace hw3d {
+
+// Axis-aligned box. The default box is empty (min above max), so it can
+// start a running union.
+struct Aabb {
+  Float3 min{std::numeric_limits<float>::infinity(),
+             std::numeric_limits<float>::infinity(),
+             std::numeric_limits<float>::infinity()};
+  Float3 max{-std::numeric_limits<float>::infinity(),
+             -std::numeric_limits<float>::infinity(),
+             -std::numeric_limits<float>::infinity()};
+};
+
+struct BoundingSphere {
+  Float3 center;
+  float radius = 0.0f;
+};
+
+// origin + t * direction for t >= 0. The direction need not be unit
+// length; t is then in units of its length.
+struct Ray {
+  Float3 origin;
+  Float3 direction{0.0f, 0.0f, 1.0f};
+};
+
+// Planes in (nx, ny, nz, d) form with the normals pointing inwards: a point
+// p is on the inner side of a plane when dot(n, p) + d >= 0. Normals are
+// unit length, so the value is a distance.
+struct Frustum {
+  enum Side { kLeft, kRight, kBottom, kTop, kNear, kFar, kSideCount };
+
+  Float4 planes[kSideCount];
+};
+
+constexpr bool IsEmpty(const Aabb& box) noexcept {
+  return box.max.x < box.min.x || box.max.y < box.min.y ||
+         box.max.z < box.min.z;
+}
+
+constexpr Float3 Center(const Aabb& box) noexcept {
+  return (box.min + box.max) * 0.5f;
+}
+
+// Half the size along each axis.
+constexpr Float3 Extent(const Aabb& box) noexcept {
+  return (box.max - box.min) * 0.5f;
+}
+
+constexpr Aabb Union(const Aabb& a, const Aabb& b) noexcept {
+  return {{a.min.x < b.min.x ? a.min.x : b.min.x,
+           a.min.y < b.min.y ? a.min.y : b.min.y,
+           a.min.z < b.min.z ? a.min.z : b.min.z},
+          {a.max.x > b.max.x ? a.max.x : b.max.x,
+           a.max.y > b.max.y ? a.max.y : b.max.y,
+           a.max.z > b.max.z ? a.max.z : b.max.z}};
+}
+
+constexpr Aabb Union(const Aabb& a, Float3 p) noexcept {
+  return Union(a, Aabb{p, p});
+}
+
+// Touching boxes overlap.
+constexpr bool Overlaps(const Aabb& a, const Aabb& b) noexcept {
+  return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y &&
+         b.min.y <= a.max.y && a.min.z <= b.max.z && b.min.z <= a.max.z;
+}
+
+constexpr bool Contains(const Aabb& box, Float3 p) noexcept {
+  return box.min.x <= p.x && p.x <= box.max.x && box.min.y <= p.y &&
+         p.y <= box.max.y && box.min.z <= p.z && p.z <= box.max.z;
+}
+
+// Squared distance from p to the nearest point of the box; 0 inside.
+constexpr float DistanceSquared(const Aabb& box, Float3 p) noexcept {
+  const float dx = p.x < box.min.x   ? box.min.x - p.x
+                   : p.x > box.max.x ? p.x - box.max.x
+                                     : 0.0f;
+  const float dy = p.y < box.min.y   ? box.min.y - p.y
+                   : p.y > box.max.y ? p.y - box.max.y
+                                     : 0.0f;
+  const float dz = p.z < box.min.z   ? box.min.z - p.z
+                   : p.z > box.max.z ? p.z - box.max.z
+                                     : 0.0f;
+  return dx * dx + dy * dy + dz * dz;
+}
+
+// The box around a sphere.
+constexpr Aabb BoundsOf(const BoundingSphere& s) noexcept {
+  const Float3 r{s.radius, s.radius, s.radius};
+  return {s.center - r, s.center + r};
+}
+
+// Slab test. On a hit within [0, max_t], *t is where the ray enters the
+// box (0 if it starts inside). Empty boxes are never hit.
+// `inverse_direction` is 1 / ray.direction per component; axis-parallel
+// rays give infinities there, which the test handles.
+inline bool IntersectRay(Float3 origin,
+                         Float3 inverse_direction,
+                         const Aabb& box,
+                         float max_t,
+                         float* t) noexcept {
+  float t0 = 0.0f;
+  float t1 = max_t;
+  const float o[3] = {origin.x, origin.y, origin.z};
+  const float inv[3] = {inverse_direction.x, inverse_direction.y,
+                        inverse_direction.z};
+  const float lo[3] = {box.min.x, box.min.y, box.min.z};
+  const float hi[3] = {box.max.x, box.max.y, box.max.z};
+  for (int a = 0; a < 3; a++) {
+    // empty boxes would pass the slab test with swapped planes
+    if (!(lo[a] <= hi[a])) {
+      return false;
+    }
+    float near_t = (lo[a] - o[a]) * inv[a];
+    float far_t = (hi[a] - o[a]) * inv[a];
+    if (near_t > far_t) {
+      std::swap(near_t, far_t);
+    }
+    // written so a NaN (0 * inf on a slab face) leaves the bound alone
+    t0 = near_t > t0 ? near_t : t0;
+    t1 = far_t < t1 ? far_t : t1;
+  }
+  *t = t0;
+  return t0 <= t1;
+}
+
+inline Float3 InverseDirection(const Ray& ray) noexcept {
+  return {1.0f / ray.direction.x, 1.0f / ray.direction.y,
+          1.0f / ray.direction.z};
+}
+
+// The ray through pixel (x, y) of a width x height viewport, from the near
+// plane towards the far plane, for picking with the mouse position (add
+// 0.5 to aim at the pixel centre). t = 1 reaches the far plane.
+inline Ray ScreenRay(float x,
+                     float y,
+                     float width,
+                     float height,
+                     const Mat4& inverse_view_projection) noexcept {
+  const float ndc_x = 2.0f * x / width - 1.0f;
+  const float ndc_y = 1.0f - 2.0f * y / height;
+  const Vec4 near_point =
+      Transform(VecSet(ndc_x, ndc_y, 0.0f, 1.0f), inverse_view_projection);
+  const Vec4 far_point =
+      Transform(VecSet(ndc_x, ndc_y, 1.0f, 1.0f), inverse_view_projection);
+  Float3 a;
+  Float3 b;
+  Store(&a, near_point * VecSplat(1.0f / GetW(near_point)));
+  Store(&b, far_point * VecSplat(1.0f / GetW(far_point)));
+  return {a, b - a};
+}
+
+// The frustum of a view * projection matrix (row vectors, depth in [0, 1];
+// see vector_math.h): each plane is a sum or difference of the matrix
+// columns (Gribb and Hartmann). Planes of a world * view * projection
+// matrix are in object space instead.
+inline Frustum FrustumFromMatrix(const Mat4& view_projection) noexcept {
+  Float4x4 f;
+  Store(&f, view_projection);
+  const auto column = [&f](int c) {
+    return Float4{f.m[0][c], f.m[1][c], f.m[2][c], f.m[3][c]};
+  };
+  const auto add = [](Float4 a, Float4 b, float s) {
+    return Float4{a.x + b.x * s, a.y + b.y * s, a.z + b.z * s, a.w + b.w * s};
+  };
+  const Float4 x = column(0);
+  const Float4 y = column(1);
+  const Float4 z = column(2);
+  const Float4 w = column(3);
+  Frustum frustum;
+  frustum.planes[Frustum::kLeft] = add(w, x, 1.0f);
+  frustum.planes[Frustum::kRight] = add(w, x, -1.0f);
+  frustum.planes[Frustum::kBottom] = add(w, y, 1.0f);
+  frustum.planes[Frustum::kTop] = add(w, y, -1.0f);
+  frustum.planes[Frustum::kNear] = z;
+  frustum.planes[Frustum::kFar] = add(w, z, -1.0f);
+  for (Float4& p : frustum.planes) {
+    const float length = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+    const float s = length > 0.0f ? 1.0f / length : 0.0f;
+    p = {p.x * s, p.y * s, p.z * s, p.w * s};
+  }
+  return frustum;
+}
+
+// True unless the box is entirely outside one plane. Boxes that straddle
+// two planes outside a corner of the frustum still pass; that is the usual
+// trade for a test this cheap.
+inline bool Intersects(const Frustum& frustum, const Aabb& box) noexcept {
+  const Float3 c = Center(box);
+  const Float3 e = Extent(box);
+  for (const Float4& p : frustum.planes) {
+    const float d = p.x * c.x + p.y * c.y + p.z * c.z + p.w;
+    const float r =
+        std::fabs(p.x) * e.x + std::fabs(p.y) * e.y + std::fabs(p.z) * e.z;
+    if (d + r < 0.0f) {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline bool Intersects(const Frustum& frustum,
+                       const BoundingSphere& sphere) noexcept {
+  const Float3 c = sphere.center;
+  for (const Float4& p : frustum.planes) {
+    if (p.x * c.x + p.y * c.y + p.z * c.z + p.w < -sphere.radius) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace hw3d
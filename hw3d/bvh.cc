@@ -0,0 +1,429 @@
+﻿#include "bvh.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+#include "job_system.h"
+#include "vector_math.h"
+
+namespace hw3d {
+
+namespace {
+
+// Split candidates per axis.
+constexpr int kBins = 16;
+// Leaves hold at most this many objects; the heuristic decides below it.
+constexpr std::uint32_t kMaxLeafObjects = 8;
+// Visiting a node, relative to testing one object's box.
+constexpr float kTraversalCost = 1.0f;
+// A subtree whose area grew past this factor since it was built is rebuilt
+// by Refit().
+constexpr float kRebuildAreaRatio = 2.0f;
+// The whole tree is rebuilt once its SAH cost grew past this factor of the
+// cost after the last full build.
+constexpr float kFullRebuildCostRatio = 1.5f;
+// Subtrees with fewer objects than this are built on one thread.
+constexpr std::uint32_t kParallelBuildObjects = 8192;
+
+float SurfaceArea(const Aabb& box) noexcept {
+  if (IsEmpty(box)) {
+    return 0.0f;
+  }
+  const Float3 d = box.max - box.min;
+  return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+float Axis(Float3 v, int axis) noexcept {
+  return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+// Bin bounds are kept in vector registers: two min/max ops per object
+// instead of six compares. Only the xyz lanes mean anything.
+struct Bin {
+  Vec4 min = VecSplat(std::numeric_limits<float>::infinity());
+  Vec4 max = VecSplat(-std::numeric_limits<float>::infinity());
+  std::uint32_t count = 0;
+};
+
+float SurfaceArea(Vec4 min, Vec4 max) noexcept {
+  float d[4];
+  math_detail::StoreFloats(d, max - min);
+  if (!(d[0] >= 0.0f)) {
+    return 0.0f;
+  }
+  return 2.0f * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+}
+
+}  // namespace
+
+void Bvh::Build(const Aabb* boxes, std::size_t count) {
+  if (count >= kNoObject) {
+    throw std::length_error("too many objects for a Bvh");
+  }
+  boxes_.assign(boxes, boxes + count);
+  Rebuild();
+}
+
+void Bvh::Rebuild() {
+  const std::size_t count = boxes_.size();
+  objects_.resize(count);
+  std::iota(objects_.begin(), objects_.end(), 0u);
+  BuildOutput out;
+  out.nodes.reserve(count / 2 + 1);
+  out.areas.reserve(count / 2 + 1);
+  if (count > 0) {
+    BuildRange(out, 0, static_cast<std::uint32_t>(count), 0);
+  }
+  nodes_ = std::move(out.nodes);
+  build_areas_ = std::move(out.areas);
+  built_cost_ = SahCost();
+  moved_ = false;
+}
+
+void Bvh::BuildRange(BuildOutput& out,
+                     std::uint32_t begin,
+                     std::uint32_t end,
+                     int depth) {
+  std::vector<BuildRef> refs(end - begin);
+  for (std::uint32_t i = begin; i < end; i++) {
+    const std::uint32_t object = objects_[i];
+    refs[i - begin] = {boxes_[object], CentroidOf(boxes_[object]), object};
+  }
+  BuildSubtree(out, refs.data(), end - begin, begin, depth);
+}
+
+void Bvh::BuildSubtree(BuildOutput& out,
+                       BuildRef* refs,
+                       std::uint32_t count,
+                       std::uint32_t first,
+                       int depth) {
+  Bin box_bin;
+  Bin centroid_bin;
+  for (std::uint32_t i = 0; i < count; i++) {
+    // box.max is followed by the centroid and the centroid by the object,
+    // so none of the loads leaves the ref
+    const Vec4 min = math_detail::LoadFloats(&refs[i].box.min.x);
+    const Vec4 max = math_detail::LoadFloats(&refs[i].box.max.x);
+    box_bin.min = Min(box_bin.min, min);
+    box_bin.max = Max(box_bin.max, max);
+    const Vec4 centroid = math_detail::LoadFloats(&refs[i].centroid.x);
+    centroid_bin.min = Min(centroid_bin.min, centroid);
+    centroid_bin.max = Max(centroid_bin.max, centroid);
+  }
+  Aabb bounds;
+  Aabb centroid_bounds;
+  if (count > 0) {
+    Store(&bounds.min, box_bin.min);
+    Store(&bounds.max, box_bin.max);
+    Store(&centroid_bounds.min, centroid_bin.min);
+    Store(&centroid_bounds.max, centroid_bin.max);
+  }
+  const auto index = static_cast<std::uint32_t>(out.nodes.size());
+  out.nodes.push_back({bounds.min, first, bounds.max, count});
+  out.areas.push_back(SurfaceArea(bounds));
+  const auto make_leaf = [&] {
+    for (std::uint32_t i = 0; i < count; i++) {
+      objects_[first + i] = refs[i].object;
+    }
+  };
+  if (count <= 1) {
+    make_leaf();
+    return;
+  }
+
+  // binned SAH over all three axes in one pass: the cheapest plane between
+  // bins, in units of (area * objects); the node's own area divides out of
+  // the comparison
+  float lo[3];
+  float scale[3];
+  for (int axis = 0; axis < 3; axis++) {
+    lo[axis] = Axis(centroid_bounds.min, axis);
+    const float extent = Axis(centroid_bounds.max, axis) - lo[axis];
+    // a flat axis puts everything in bin 0 and offers no plane
+    scale[axis] = extent > 0.0f ? kBins / extent : 0.0f;
+  }
+  const auto bin_of = [&](Float3 centroid, int axis) {
+    return std::min(kBins - 1, static_cast<int>((Axis(centroid, axis) -
+                                                 lo[axis]) *
+                                                scale[axis]));
+  };
+  Bin bins[3][kBins];
+  for (std::uint32_t i = 0; i < count; i++) {
+    const Vec4 min = math_detail::LoadFloats(&refs[i].box.min.x);
+    const Vec4 max = math_detail::LoadFloats(&refs[i].box.max.x);
+    for (int axis = 0; axis < 3; axis++) {
+      Bin& bin = bins[axis][bin_of(refs[i].centroid, axis)];
+      bin.count++;
+      bin.min = Min(bin.min, min);
+      bin.max = Max(bin.max, max);
+    }
+  }
+  float best_cost = std::numeric_limits<float>::infinity();
+  int best_axis = -1;
+  int best_split = 0;
+  for (int axis = 0; axis < 3; axis++) {
+    // right-side costs of every plane, then sweep in from the left
+    float right_cost[kBins];
+    Bin right;
+    for (int b = kBins - 1; b > 0; b--) {
+      right.min = Min(right.min, bins[axis][b].min);
+      right.max = Max(right.max, bins[axis][b].max);
+      right.count += bins[axis][b].count;
+      right_cost[b] = right.count == 0
+                          ? -1.0f
+                          : SurfaceArea(right.min, right.max) * right.count;
+    }
+    Bin left;
+    for (int b = 1; b < kBins; b++) {
+      left.min = Min(left.min, bins[axis][b - 1].min);
+      left.max = Max(left.max, bins[axis][b - 1].max);
+      left.count += bins[axis][b - 1].count;
+      if (left.count == 0 || right_cost[b] < 0.0f) {
+        continue;
+      }
+      const float cost =
+          SurfaceArea(left.min, left.max) * left.count + right_cost[b];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = b;
+      }
+    }
+  }
+
+  const float area = SurfaceArea(bounds);
+  const float split_cost =
+      area > 0.0f ? kTraversalCost + best_cost / area : kTraversalCost;
+  if (count <= kMaxLeafObjects &&
+      (best_axis < 0 || split_cost >= static_cast<float>(count))) {
+    make_leaf();
+    return;
+  }
+
+  std::uint32_t mid;
+  // past half the depth budget every split halves the range, which keeps
+  // the traversal stacks big enough whatever the input
+  if (best_axis >= 0 && depth < kMaxDepth / 2 - 1) {
+    BuildRef* middle =
+        std::partition(refs, refs + count, [&](const BuildRef& ref) {
+          return bin_of(ref.centroid, best_axis) < best_split;
+        });
+    mid = static_cast<std::uint32_t>(middle - refs);
+  } else {
+    // median on the widest axis; also the fallback when every centroid is
+    // the same point
+    const Float3 extent = centroid_bounds.max - centroid_bounds.min;
+    const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0
+                     : extent.y >= extent.z                       ? 1
+                                                                  : 2;
+    mid = count / 2;
+    std::nth_element(refs, refs + mid, refs + count,
+                     [axis](const BuildRef& a, const BuildRef& b) {
+                       return Axis(a.centroid, axis) < Axis(b.centroid, axis);
+                     });
+  }
+  out.nodes[index].count = 0;
+
+  JobSystem& jobs = JobSystem::Get();
+  const bool fork = count >= 2 * kParallelBuildObjects && jobs.IsRunning() &&
+                    JobSystem::CurrentWorker() >= 0;
+  if (!fork) {
+    BuildSubtree(out, refs, mid, first, depth + 1);
+    out.nodes[index].right_or_first =
+        static_cast<std::uint32_t>(out.nodes.size());
+    BuildSubtree(out, refs + mid, count - mid, first + mid, depth + 1);
+    return;
+  }
+  // the halves own disjoint refs and objects_ ranges, so they can be built
+  // at once into outputs of their own and spliced in after
+  struct Half {
+    Bvh* bvh;
+    BuildOutput* out;
+    BuildRef* refs;
+    std::uint32_t count;
+    std::uint32_t first;
+    int depth;
+  };
+  BuildOutput left;
+  Half half{this, &left, refs, mid, first, depth + 1};
+  Half* task = &half;
+  JobCounter counter;
+  jobs.Run(
+      [task] {
+        task->bvh->BuildSubtree(*task->out, task->refs, task->count,
+                                task->first, task->depth);
+      },
+      &counter);
+  BuildOutput right;
+  BuildSubtree(right, refs + mid, count - mid, first + mid, depth + 1);
+  jobs.Wait(counter);
+  Append(out, left);
+  out.nodes[index].right_or_first =
+      static_cast<std::uint32_t>(out.nodes.size());
+  Append(out, right);
+}
+
+void Bvh::Append(BuildOutput& out, const BuildOutput& subtree) {
+  const auto base = static_cast<std::uint32_t>(out.nodes.size());
+  for (Node node : subtree.nodes) {
+    if (!node.IsLeaf()) {
+      node.right_or_first += base;
+    }
+    out.nodes.push_back(node);
+  }
+  out.areas.insert(out.areas.end(), subtree.areas.begin(),
+                   subtree.areas.end());
+}
+
+void Bvh::RefitNodes() noexcept {
+  // children come after their parent, so a backwards sweep sees them first
+  for (std::size_t i = nodes_.size(); i-- > 0;) {
+    Node& node = nodes_[i];
+    Aabb bounds;
+    if (node.IsLeaf()) {
+      for (std::uint32_t k = 0; k < node.count; k++) {
+        bounds = Union(bounds, boxes_[objects_[node.right_or_first + k]]);
+      }
+    } else {
+      bounds = Union(nodes_[i + 1].Bounds(),
+                     nodes_[node.right_or_first].Bounds());
+    }
+    node.min = bounds.min;
+    node.max = bounds.max;
+  }
+}
+
+void Bvh::Refit() {
+  last_rebuilt_objects_ = 0;
+  if (!moved_) {
+    return;
+  }
+  moved_ = false;
+  RefitNodes();
+
+  // the topmost subtrees that have degraded too far
+  std::vector<std::uint8_t> rebuild(nodes_.size(), 0);
+  std::uint32_t stack[kMaxDepth];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const std::uint32_t i = stack[--top];
+    const Node& node = nodes_[i];
+    if (node.IsLeaf()) {
+      continue;
+    }
+    if (SurfaceArea(node.Bounds()) > kRebuildAreaRatio * build_areas_[i]) {
+      rebuild[i] = 1;
+      std::uint32_t begin;
+      std::uint32_t end;
+      ObjectRange(i, &begin, &end);
+      last_rebuilt_objects_ += end - begin;
+      continue;
+    }
+    stack[top++] = node.right_or_first;
+    stack[top++] = i + 1;
+  }
+  if (last_rebuilt_objects_ == 0) {
+    if (SahCost() > kFullRebuildCostRatio * built_cost_) {
+      Rebuild();
+      last_rebuilt_objects_ = boxes_.size();
+    }
+    return;
+  }
+  if (last_rebuilt_objects_ * 2 > boxes_.size()) {
+    Rebuild();
+    last_rebuilt_objects_ = boxes_.size();
+    return;
+  }
+  BuildOutput out;
+  out.nodes.reserve(nodes_.size());
+  out.areas.reserve(nodes_.size());
+  Relink(out, 0, 0, rebuild);
+  nodes_ = std::move(out.nodes);
+  build_areas_ = std::move(out.areas);
+  if (SahCost() > kFullRebuildCostRatio * built_cost_) {
+    Rebuild();
+    last_rebuilt_objects_ = boxes_.size();
+  }
+}
+
+void Bvh::Relink(BuildOutput& out,
+                 std::uint32_t node,
+                 int depth,
+                 const std::vector<std::uint8_t>& rebuild) {
+  if (rebuild[node] != 0) {
+    std::uint32_t begin;
+    std::uint32_t end;
+    ObjectRange(node, &begin, &end);
+    BuildRange(out, begin, end, depth);
+    return;
+  }
+  const Node copy = nodes_[node];
+  const auto index = static_cast<std::uint32_t>(out.nodes.size());
+  out.nodes.push_back(copy);
+  out.areas.push_back(build_areas_[node]);
+  if (copy.IsLeaf()) {
+    return;
+  }
+  Relink(out, node + 1, depth + 1, rebuild);
+  out.nodes[index].right_or_first =
+      static_cast<std::uint32_t>(out.nodes.size());
+  Relink(out, copy.right_or_first, depth + 1, rebuild);
+}
+
+void Bvh::ObjectRange(std::uint32_t node,
+                      std::uint32_t* begin,
+                      std::uint32_t* end) const noexcept {
+  std::uint32_t first = node;
+  while (!nodes_[first].IsLeaf()) {
+    first++;
+  }
+  std::uint32_t last = node;
+  while (!nodes_[last].IsLeaf()) {
+    last = nodes_[last].right_or_first;
+  }
+  *begin = nodes_[first].right_or_first;
+  *end = nodes_[last].right_or_first + nodes_[last].count;
+}
+
+float Bvh::SahCost() const noexcept {
+  if (nodes_.empty()) {
+    return 0.0f;
+  }
+  const float root = SurfaceArea(nodes_[0].Bounds());
+  if (root <= 0.0f) {
+    return 0.0f;
+  }
+  double cost = 0.0;
+  for (const Node& node : nodes_) {
+    const float area = SurfaceArea(node.Bounds());
+    cost += node.IsLeaf() ? static_cast<double>(area) * node.count
+                          : static_cast<double>(area) * kTraversalCost;
+  }
+  return static_cast<float>(cost / root);
+}
+
+bool Bvh::Raycast(const Ray& ray, float max_t, RayHit* hit) const {
+  const Float3 inv = InverseDirection(ray);
+  return Raycast(
+      ray, max_t,
+      [&](std::uint32_t object, float t_max) {
+        float t;
+        return IntersectRay(ray.origin, inv, boxes_[object], t_max, &t)
+                   ? t
+                   : t_max;
+      },
+      hit);
+}
+
+bool Bvh::Nearest(Float3 point, float max_distance, NearestHit* hit) const {
+  return Nearest(
+      point, max_distance,
+      [&](std::uint32_t object, float) {
+        return hw3d::DistanceSquared(boxes_[object], point);
+      },
+      hit);
+}
+
+}  // namespace hw3d
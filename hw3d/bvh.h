@@ -0,0 +1,345 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "bounds.h"
+
+namespace hw3d {
+
+// Bounding volume hierarchy over a fixed set of objects, each known by its
+// index and box, for picking, overlap and nearest-object queries.
+//
+// Build() splits by a binned surface area heuristic; large inputs are
+// built on JobSystem workers when called from one. Nodes are 32 bytes,
+// stored depth-first, so a left child sits right after its parent and two
+// nodes share a cache line.
+//
+// Moving objects: Update() their boxes, then Refit() once. Refit() grows
+// the node boxes in place and rebuilds only the subtrees whose surface
+// area has more than doubled since they were built. Objects cannot leave
+// their subtree that way, so once the SAH cost has grown by half since the
+// last full build, or most of the tree would be rebuilt anyway, the whole
+// tree is rebuilt instead.
+//
+// Queries are const and may run on several threads at once; Build(),
+// Update() and Refit() must not overlap them.
+class Bvh {
+ public:
+  static constexpr std::uint32_t kNoObject =
+      std::numeric_limits<std::uint32_t>::max();
+
+  struct RayHit {
+    std::uint32_t object = kNoObject;
+    float t = 0.0f;
+  };
+
+  struct NearestHit {
+    std::uint32_t object = kNoObject;
+    float distance_squared = 0.0f;
+  };
+
+  // Object i gets boxes[i]. Empty boxes are allowed and never hit.
+  void Build(const Aabb* boxes, std::size_t count);
+  void Update(std::uint32_t object, const Aabb& box) noexcept {
+    boxes_[object] = box;
+    moved_ = true;
+  }
+  // Brings the tree up to date after Update() calls.
+  void Refit();
+
+  // Closest object whose box the ray enters within [0, max_t].
+  bool Raycast(const Ray& ray, float max_t, RayHit* hit) const;
+  // The same with an exact test: intersect(object, t_max) returns the
+  // distance to the object along the ray, or anything not below t_max for
+  // a miss. It is only called for objects whose box the ray enters before
+  // the closest hit so far.
+  template <typename Intersect>
+  bool Raycast(const Ray& ray,
+               float max_t,
+               Intersect&& intersect,
+               RayHit* hit) const;
+
+  // Calls fn(object) for every object whose box overlaps `box`.
+  template <typename Fn>
+  void QueryOverlap(const Aabb& box, Fn&& fn) const;
+
+  // Object whose box is closest to `point`, nearer than max_distance.
+  bool Nearest(Float3 point, float max_distance, NearestHit* hit) const;
+  // With an exact distance: distance_squared(object, best_squared) returns
+  // the squared distance to the object, or anything not below
+  // best_squared when it is farther. It is only called for objects whose
+  // box is nearer than the best so far.
+  template <typename DistanceSquared>
+  bool Nearest(Float3 point,
+               float max_distance,
+               DistanceSquared&& distance_squared,
+               NearestHit* hit) const;
+
+  std::size_t size() const noexcept { return boxes_.size(); }
+  const Aabb& bounds(std::uint32_t object) const noexcept {
+    return boxes_[object];
+  }
+  std::size_t node_count() const noexcept { return nodes_.size(); }
+  // Expected cost of a query under the surface area heuristic, in box
+  // tests; compare across refits to see the tree degrade.
+  float SahCost() const noexcept;
+  // Objects in the subtrees the last Refit() rebuilt.
+  std::size_t last_rebuilt_objects() const noexcept {
+    return last_rebuilt_objects_;
+  }
+
+ private:
+  struct alignas(32) Node {
+    Float3 min;
+    // interior: index of the right child (the left one is next);
+    // leaf: first entry in objects_
+    std::uint32_t right_or_first;
+    Float3 max;
+    // objects in a leaf; 0 for an interior node
+    std::uint32_t count;
+
+    bool IsLeaf() const noexcept { return count != 0; }
+    Aabb Bounds() const noexcept { return {min, max}; }
+  };
+  static_assert(sizeof(Node) == 32, "two nodes per cache line");
+
+  // Traversal stacks hold this many entries; builds fall back to median
+  // splits, which halve the object count, before a branch gets this deep.
+  static constexpr int kMaxDepth = 64;
+
+  // What the build sorts: an object's box and centroid travel with it, so
+  // the binning passes read memory in order.
+  struct BuildRef {
+    Aabb box;
+    Float3 centroid;
+    std::uint32_t object;
+  };
+  struct BuildOutput {
+    std::vector<Node> nodes;
+    std::vector<float> areas;
+  };
+  // Empty boxes sort with the origin; they never pass a query test.
+  static Float3 CentroidOf(const Aabb& box) noexcept {
+    return IsEmpty(box) ? Float3{} : Center(box);
+  }
+  // Builds the subtree over refs[0, count) at the end of `out`. The refs
+  // are the objects_ entries from `first` on, which the leaves fill in;
+  // `depth` is that of the subtree's root.
+  void BuildSubtree(BuildOutput& out,
+                    BuildRef* refs,
+                    std::uint32_t count,
+                    std::uint32_t first,
+                    int depth);
+  // Builds the whole tree over boxes_.
+  void Rebuild();
+  // Rebuilds the objects_ range [begin, end) at the end of `out`.
+  void BuildRange(BuildOutput& out,
+                  std::uint32_t begin,
+                  std::uint32_t end,
+                  int depth);
+  // Appends a subtree that was built into its own output.
+  static void Append(BuildOutput& out, const BuildOutput& subtree);
+  // Bottom-up recomputation of every node box.
+  void RefitNodes() noexcept;
+  // Copies the subtree at `node` into `out`, rebuilding the marked ones.
+  void Relink(BuildOutput& out,
+              std::uint32_t node,
+              int depth,
+              const std::vector<std::uint8_t>& rebuild);
+  // The objects_ range under `node`.
+  void ObjectRange(std::uint32_t node,
+                   std::uint32_t* begin,
+                   std::uint32_t* end) const noexcept;
+
+  std::vector<Aabb> boxes_;
+  // object indices in leaf order; every subtree owns a contiguous range
+  std::vector<std::uint32_t> objects_;
+  std::vector<Node> nodes_;
+  // surface area of each node when it was built
+  std::vector<float> build_areas_;
+  // SahCost() after the last full build
+  float built_cost_ = 0.0f;
+  bool moved_ = false;
+  std::size_t last_rebuilt_objects_ = 0;
+};
+
+template <typename Intersect>
+bool Bvh::Raycast(const Ray& ray,
+                  float max_t,
+                  Intersect&& intersect,
+                  RayHit* hit) const {
+  if (nodes_.empty()) {
+    return false;
+  }
+  const Float3 inv = InverseDirection(ray);
+  struct Entry {
+    std::uint32_t node;
+    float t;
+  };
+  Entry stack[kMaxDepth];
+  int top = 0;
+  float best = max_t;
+  std::uint32_t best_object = kNoObject;
+  float t;
+  if (!IntersectRay(ray.origin, inv, nodes_[0].Bounds(), best, &t)) {
+    return false;
+  }
+  stack[top++] = {0, t};
+  while (top > 0) {
+    const Entry entry = stack[--top];
+    // a closer hit may have turned up since this was pushed
+    if (entry.t > best) {
+      continue;
+    }
+    const Node* node = &nodes_[entry.node];
+    while (!node->IsLeaf()) {
+      const auto left = static_cast<std::uint32_t>(node - nodes_.data()) + 1;
+      const std::uint32_t right = node->right_or_first;
+      float t_left = 0.0f;
+      float t_right = 0.0f;
+      const bool hit_left =
+          IntersectRay(ray.origin, inv, nodes_[left].Bounds(), best, &t_left);
+      const bool hit_right = IntersectRay(ray.origin, inv,
+                                          nodes_[right].Bounds(), best,
+                                          &t_right);
+      if (hit_left && hit_right) {
+        // nearer child first, the other one later
+        if (t_right < t_left) {
+          stack[top++] = {left, t_left};
+          node = &nodes_[right];
+        } else {
+          stack[top++] = {right, t_right};
+          node = &nodes_[left];
+        }
+      } else if (hit_left) {
+        node = &nodes_[left];
+      } else if (hit_right) {
+        node = &nodes_[right];
+      } else {
+        node = nullptr;
+        break;
+      }
+    }
+    if (node == nullptr) {
+      continue;
+    }
+    for (std::uint32_t i = 0; i < node->count; i++) {
+      const std::uint32_t object = objects_[node->right_or_first + i];
+      if (!IntersectRay(ray.origin, inv, boxes_[object], best, &t)) {
+        continue;
+      }
+      const float exact = intersect(object, best);
+      if (exact < best) {
+        best = exact;
+        best_object = object;
+      }
+    }
+  }
+  if (best_object == kNoObject) {
+    return false;
+  }
+  hit->object = best_object;
+  hit->t = best;
+  return true;
+}
+
+template <typename Fn>
+void Bvh::QueryOverlap(const Aabb& box, Fn&& fn) const {
+  if (nodes_.empty() || !Overlaps(nodes_[0].Bounds(), box)) {
+    return;
+  }
+  std::uint32_t stack[kMaxDepth];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const Node& node = nodes_[stack[--top]];
+    if (node.IsLeaf()) {
+      for (std::uint32_t i = 0; i < node.count; i++) {
+        const std::uint32_t object = objects_[node.right_or_first + i];
+        if (Overlaps(boxes_[object], box)) {
+          fn(object);
+        }
+      }
+      continue;
+    }
+    const auto left = static_cast<std::uint32_t>(&node - nodes_.data()) + 1;
+    if (Overlaps(nodes_[node.right_or_first].Bounds(), box)) {
+      stack[top++] = node.right_or_first;
+    }
+    if (Overlaps(nodes_[left].Bounds(), box)) {
+      stack[top++] = left;
+    }
+  }
+}
+
+template <typename DistanceSquared>
+bool Bvh::Nearest(Float3 point,
+                  float max_distance,
+                  DistanceSquared&& distance_squared,
+                  NearestHit* hit) const {
+  if (nodes_.empty()) {
+    return false;
+  }
+  struct Entry {
+    std::uint32_t node;
+    float distance_squared;
+  };
+  Entry stack[kMaxDepth];
+  int top = 0;
+  float best = max_distance * max_distance;
+  std::uint32_t best_object = kNoObject;
+  const float root = hw3d::DistanceSquared(nodes_[0].Bounds(), point);
+  if (root > best) {
+    return false;
+  }
+  stack[top++] = {0, root};
+  while (top > 0) {
+    const Entry entry = stack[--top];
+    if (entry.distance_squared > best) {
+      continue;
+    }
+    const Node& node = nodes_[entry.node];
+    if (node.IsLeaf()) {
+      for (std::uint32_t i = 0; i < node.count; i++) {
+        const std::uint32_t object = objects_[node.right_or_first + i];
+        if (hw3d::DistanceSquared(boxes_[object], point) > best) {
+          continue;
+        }
+        const float d = distance_squared(object, best);
+        if (d < best) {
+          best = d;
+          best_object = object;
+        }
+      }
+      continue;
+    }
+    const std::uint32_t left = entry.node + 1;
+    const std::uint32_t right = node.right_or_first;
+    const float d_left = hw3d::DistanceSquared(nodes_[left].Bounds(), point);
+    const float d_right =
+        hw3d::DistanceSquared(nodes_[right].Bounds(), point);
+    // the nearer child goes on top
+    const bool left_first = d_left <= d_right;
+    const Entry near_entry = left_first ? Entry{left, d_left}
+                                        : Entry{right, d_right};
+    const Entry far_entry = left_first ? Entry{right, d_right}
+                                       : Entry{left, d_left};
+    if (far_entry.distance_squared <= best) {
+      stack[top++] = far_entry;
+    }
+    if (near_entry.distance_squared <= best) {
+      stack[top++] = near_entry;
+    }
+  }
+  if (best_object == kNoObject) {
+    return false;
+  }
+  hit->object = best_object;
+  hit->distance_squared = best;
+  return true;
+}
+
+}  // namespace hw3d
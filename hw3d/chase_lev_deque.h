@@ -0,0 +1,107 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace hw3d {
+
+// Fixed-capacity work-stealing deque (Chase and Lev, with the C11 memory
+// orderings of Le, Pop, Cohen and Zappa Nardelli, PPoPP 2013). The owning
+// thread pushes and pops at the bottom like a stack; any other thread may
+// steal from the top. Pointers only, so a steal reads one word.
+template <typename T>
+class ChaseLevDeque {
+ public:
+  // `capacity` is rounded up to a power of two.
+  explicit ChaseLevDeque(std::size_t capacity)
+      : mask_(static_cast<std::int64_t>(RoundUpPow2(capacity)) - 1),
+        slots_(std::make_unique<std::atomic<T*>[]>(
+            static_cast<std::size_t>(mask_ + 1))) {}
+  ChaseLevDeque(const ChaseLevDeque&) = delete;
+  ChaseLevDeque& operator=(const ChaseLevDeque&) = delete;
+
+  // Owner only. Returns false if the deque is full.
+  bool Push(T* item) noexcept {
+    const std::int64_t b = bottom_.load(std::memory_order_relaxed);
+    const std::int64_t t = top_.load(std::memory_order_acquire);
+    if (b - t > mask_) {
+      return false;
+    }
+    slots_[b & mask_].store(item, std::memory_order_relaxed);
+    // publishes the item to thieves (the paper's release fence, folded into
+    // the store)
+    bottom_.store(b + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Owner only. Takes the most recently pushed item, or nullptr.
+  T* Pop() noexcept {
+    const std::int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t t = top_.load(std::memory_order_relaxed);
+    if (t > b) {
+      // empty
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T* item = slots_[b & mask_].load(std::memory_order_relaxed);
+    if (t == b) {
+      // last item: race the thieves for it
+      if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+        item = nullptr;
+      }
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  // Any thread. Takes the oldest item, or nullptr if the deque is empty or
+  // another thread won the race for it.
+  T* Steal() noexcept {
+    std::int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const std::int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) {
+      return nullptr;
+    }
+    T* item = slots_[t & mask_].load(std::memory_order_relaxed);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return item;
+  }
+
+  // Racy snapshot; only a hint for idle threads.
+  bool LooksEmpty() const noexcept {
+    return top_.load(std::memory_order_relaxed) >=
+           bottom_.load(std::memory_order_relaxed);
+  }
+
+  std::size_t capacity() const noexcept {
+    return static_cast<std::size_t>(mask_ + 1);
+  }
+
+ private:
+  static constexpr std::size_t kCacheLine = 64;
+
+  static std::size_t RoundUpPow2(std::size_t n) noexcept {
+    std::size_t p = 2;
+    while (p < n) {
+      p <<= 1;
+    }
+    return p;
+  }
+
+  const std::int64_t mask_;
+  std::unique_ptr<std::atomic<T*>[]> slots_;
+  // thieves hammer top_; keep it off the owner's line
+  alignas(kCacheLine) std::atomic<std::int64_t> top_{0};
+  alignas(kCacheLine) std::atomic<std::int64_t> bottom_{0};
+};
+
+}  // namespace hw3d
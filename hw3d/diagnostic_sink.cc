@@ -0,0 +1,48 @@
+﻿#include "diagnostic_sink.h"
+
+namespace hw3d {
+
+DiagnosticSink::DiagnosticSink(std::size_t initial_capacity) {
+  text_.reserve(initial_capacity);
+  ends_.reserve(32);
+  scratch_.resize(
+      (initial_capacity + sizeof(std::max_align_t) - 1) /
+      sizeof(std::max_align_t));
+}
+
+void DiagnosticSink::Clear() noexcept {
+  text_.clear();
+  ends_.clear();
+}
+
+void DiagnosticSink::Append(std::string_view message) {
+  if (!ends_.empty()) {
+    text_.push_back('\n');
+  }
+  text_.insert(text_.end(), message.begin(), message.end());
+  ends_.push_back(text_.size());
+}
+
+std::size_t DiagnosticSink::Drain(const InfoQueueSource& queue,
+                                  DiagnosticCursor since) {
+  Clear();
+  const std::uint64_t end = queue.GetNumStoredMessages();
+  for (std::uint64_t i = since.index; i < end; i++) {
+    std::string_view description;
+    std::size_t size = scratch_.size() * sizeof(std::max_align_t);
+    auto result = queue.ReadMessage(i, scratch_.data(), &size, &description);
+    if (result == InfoQueueSource::ReadResult::kBufferTooSmall) {
+      // grow once to the reported size and keep it for later messages
+      scratch_.resize((size + sizeof(std::max_align_t) - 1) /
+                      sizeof(std::max_align_t));
+      size = scratch_.size() * sizeof(std::max_align_t);
+      result = queue.ReadMessage(i, scratch_.data(), &size, &description);
+    }
+    if (result == InfoQueueSource::ReadResult::kOk && !description.empty()) {
+      Append(description);
+    }
+  }
+  return size();
+}
+
+}  // namespace hw3d
@@ -0,0 +1,76 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace hw3d {
+
+// Position in a debug message queue. Messages stored at or after `index` are
+// attributed to whatever call followed the Mark() that produced the cursor.
+struct DiagnosticCursor {
+  std::uint64_t index = 0;
+};
+
+// Minimal view of a debug-layer message queue. On Windows this wraps
+// IDXGIInfoQueue; elsewhere a fake can stand in for it.
+class InfoQueueSource {
+ public:
+  enum class ReadResult { kOk, kBufferTooSmall, kFailed };
+
+  virtual ~InfoQueueSource() = default;
+
+  virtual std::uint64_t GetNumStoredMessages() const noexcept = 0;
+
+  // Reads message `index` into `buffer`, whose capacity in bytes is `*size`.
+  // On kOk `description` views text inside `buffer`. On kBufferTooSmall
+  // `*size` holds the number of bytes required.
+  virtual ReadResult ReadMessage(std::uint64_t index,
+                                 void* buffer,
+                                 std::size_t* size,
+                                 std::string_view* description) const
+      noexcept = 0;
+};
+
+// Collects diagnostic messages into one reusable arena. Clearing keeps the
+// arena's capacity, so once warmed up capturing messages does not allocate.
+class DiagnosticSink {
+ public:
+  explicit DiagnosticSink(std::size_t initial_capacity = 4096);
+
+  void Clear() noexcept;
+  void Append(std::string_view message);
+
+  // Replaces the contents with the messages stored in `queue` since `since`.
+  // Returns the number of messages captured.
+  std::size_t Drain(const InfoQueueSource& queue, DiagnosticCursor since);
+
+  std::size_t size() const noexcept { return ends_.size(); }
+  bool empty() const noexcept { return ends_.empty(); }
+
+  // All messages joined with '\n', without a trailing newline.
+  std::string_view Joined() const noexcept {
+    return std::string_view(text_.data(), text_.size());
+  }
+
+  // Invokes `callback(std::string_view)` for every message in order.
+  template <typename Callback>
+  void ForEach(Callback&& callback) const {
+    std::size_t begin = 0;
+    for (const std::size_t end : ends_) {
+      callback(std::string_view(text_.data() + begin, end - begin));
+      begin = end + 1;
+    }
+  }
+
+ private:
+  // message text separated by '\n'
+  std::vector<char> text_;
+  // end offset of each message within text_
+  std::vector<std::size_t> ends_;
+  // reusable read buffer for raw queue entries, aligned for the SDK structs
+  std::vector<std::max_align_t> scratch_;
+};
+
+}  // namespace hw3d
@@ -1,9 +1,7 @@
 ﻿#include "dxgi_info_manager.h"
 
-#include <memory>
-
-#include "graphics.h"
-#include "window.h"
+#include <cstdint>
+#include <string_view>
 
 #pragma comment(lib, "dxguid.lib")
 
@@ -11,13 +9,50 @@ namespace wrl = Microsoft::WRL;
 
 namespace hw3d {
 
-#define GFX_THROW_NOINFO(hrcall)                           \
-  {                                                        \
-    HRESULT hr;                                            \
-    if (FAILED(hr = (hrcall)))                             \
-      throw Graphics::HrException(__LINE__, __FILE__, hr); \
+namespace {
+
+// Reads IDXGIInfoQueue entries straight into the sink's scratch buffer, so
+// each message normally costs a single GetMessage call.
+class DxgiInfoQueueSource : public InfoQueueSource {
+ public:
+  explicit DxgiInfoQueueSource(IDXGIInfoQueue* queue) noexcept
+      : queue_(queue) {}
+
+  std::uint64_t GetNumStoredMessages() const noexcept override {
+    return queue_->GetNumStoredMessages(DXGI_DEBUG_ALL);
   }
 
+  ReadResult ReadMessage(std::uint64_t index,
+                         void* buffer,
+                         std::size_t* size,
+                         std::string_view* description) const
+      noexcept override {
+    auto message = static_cast<DXGI_INFO_QUEUE_MESSAGE*>(buffer);
+    SIZE_T length = *size;
+    if (SUCCEEDED(queue_->GetMessage(DXGI_DEBUG_ALL, index, message,
+                                     &length))) {
+      *description = message->pDescription != nullptr
+                         ? std::string_view(message->pDescription)
+                         : std::string_view();
+      return ReadResult::kOk;
+    }
+    // the buffer was probably too small; only now ask for the exact size
+    length = 0;
+    if (SUCCEEDED(queue_->GetMessage(DXGI_DEBUG_ALL, index, nullptr,
+                                     &length)) &&
+        length > *size) {
+      *size = length;
+      return ReadResult::kBufferTooSmall;
+    }
+    return ReadResult::kFailed;
+  }
+
+ private:
+  IDXGIInfoQueue* queue_;
+};
+
+}  // namespace
+
 DxgiInfoManager::DxgiInfoManager() {
   // define function signature of DXGIGetDebugInterface
   typedef HRESULT(WINAPI * DXGIGetDebugInterface)(REFIID, void**);
@@ -58,41 +93,13 @@ DxgiInfoManager::~DxgiInfoManager() {
   }
 }
 
-void DxgiInfoManager::Set() noexcept {
-  // set the index (next) so that the next call to GetMessages()
-  // will only get errors generated after this call
+const DiagnosticSink& DxgiInfoManager::Collect(DiagnosticCursor since) {
   if (!info_queue_) {
-    return;
-  }
-  next_ = info_queue_->GetNumStoredMessages(DXGI_DEBUG_ALL);
-}
-
-std::vector<std::string> DxgiInfoManager::GetMessages() const {
-  std::vector<std::string> messages;
-  if (!info_queue_) {
-    return messages;
-  }
-  const auto end = info_queue_->GetNumStoredMessages(DXGI_DEBUG_ALL);
-  for (auto i = next_; i < end; i++) {
-    HRESULT hr;
-    SIZE_T messageLength = 0;
-    // get the size of message i in bytes
-    if (FAILED(info_queue_->GetMessage(DXGI_DEBUG_ALL, i, nullptr,
-                                       &messageLength))) {
-      continue;
-    }
-    // allocate a buffer and read the message
-    std::vector<char> bytes(messageLength);
-    auto pMessage = reinterpret_cast<DXGI_INFO_QUEUE_MESSAGE*>(bytes.data());
-    if (FAILED(info_queue_->GetMessage(DXGI_DEBUG_ALL, i, pMessage,
-                                       &messageLength))) {
-      continue;
-    }
-    if (pMessage->pDescription) {
-      messages.emplace_back(pMessage->pDescription);
-    }
+    sink_.Clear();
+    return sink_;
   }
-  return messages;
+  sink_.Drain(DxgiInfoQueueSource(info_queue_.Get()), since);
+  return sink_;
 }
 
 }  // namespace hw3d
\ No newline at end of file
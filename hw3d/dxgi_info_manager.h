@@ -3,12 +3,11 @@
 #include <dxgidebug.h>
 #include <wrl.h>
 
-#include <string>
-#include <vector>
+#include <utility>
 
+#include "diagnostic_sink.h"
 #include "windows_config.h"
 
-
 namespace hw3d {
 
 class DxgiInfoManager {
@@ -17,15 +16,33 @@ class DxgiInfoManager {
   ~DxgiInfoManager();
   DxgiInfoManager(const DxgiInfoManager&) = delete;
   DxgiInfoManager& operator=(const DxgiInfoManager&) = delete;
-  void Set() noexcept;
-  std::vector<std::string> GetMessages() const;
+
+  // Cursor at the end of the queue; take one right before a call so only
+  // messages generated by that call are collected afterwards.
+  DiagnosticCursor Mark() const noexcept {
+    if (!info_queue_) {
+      return {};
+    }
+    return {info_queue_->GetNumStoredMessages(DXGI_DEBUG_ALL)};
+  }
+
+  // Captures every message stored since `since` into the manager's reusable
+  // sink. The returned sink is overwritten by the next Collect().
+  const DiagnosticSink& Collect(DiagnosticCursor since);
+
+  // Invokes `callback(std::string_view)` for each message stored since
+  // `since`.
+  template <typename Callback>
+  void ForEachMessage(DiagnosticCursor since, Callback&& callback) {
+    Collect(since).ForEach(std::forward<Callback>(callback));
+  }
 
   bool IsAvailable() const noexcept { return info_queue_ != nullptr; }
 
  private:
-  SIZE_T next_ = 0u;
   HMODULE h_dxgi_debug_ = nullptr;
   Microsoft::WRL::ComPtr<IDXGIInfoQueue> info_queue_;
+  DiagnosticSink sink_;
 };
 
 }  // namespace hw3d
\ No newline at end of file
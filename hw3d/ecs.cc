@@ -0,0 +1,299 @@
+﻿#include "ecs.h"
+
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+namespace hw3d {
+
+namespace ecs_detail {
+
+namespace {
+
+struct Registry {
+  std::mutex mutex;
+  ComponentInfo infos[kMaxComponentTypes] = {};
+  ComponentId count = 0;
+};
+
+Registry& GetRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+}  // namespace
+
+ComponentId RegisterComponent(const ComponentInfo& info) {
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  if (registry.count >= kMaxComponentTypes) {
+    throw std::length_error("ECS: too many component types");
+  }
+  registry.infos[registry.count] = info;
+  return registry.count++;
+}
+
+const ComponentInfo& GetComponentInfo(ComponentId id) noexcept {
+  // ids reach other threads through IdOf's static, which orders this read
+  // after the write in RegisterComponent
+  return GetRegistry().infos[id];
+}
+
+}  // namespace ecs_detail
+
+namespace {
+
+std::size_t RoundUp(std::size_t n) noexcept {
+  return (n + ecs_detail::kCacheLine - 1) & ~(ecs_detail::kCacheLine - 1);
+}
+
+void DestroyComponent(void* p, ComponentId id) noexcept {
+  const ComponentInfo& info = ecs_detail::GetComponentInfo(id);
+  if (info.destroy != nullptr) {
+    info.destroy(p);
+  }
+}
+
+void RelocateComponent(void* dst,
+                       void* src,
+                       ComponentId id,
+                       std::size_t size) noexcept {
+  const ComponentInfo& info = ecs_detail::GetComponentInfo(id);
+  if (info.relocate != nullptr) {
+    info.relocate(dst, src);
+  } else {
+    std::memcpy(dst, src, size);
+  }
+}
+
+}  // namespace
+
+World::World()
+    : chunk_pool_(ecs_detail::kChunkBytes, ecs_detail::kCacheLine) {}
+
+World::~World() {
+  for (const auto& a : archetypes_) {
+    for (const ComponentId id : a->ids) {
+      if (ecs_detail::GetComponentInfo(id).destroy == nullptr) {
+        continue;
+      }
+      for (std::uint32_t row = 0; row < a->size; row++) {
+        DestroyComponent(a->At(row, id), id);
+      }
+    }
+    for (unsigned char* chunk : a->chunks) {
+      chunk_pool_.Deallocate(chunk);
+    }
+  }
+}
+
+void World::Destroy(Entity e) noexcept {
+  Record* r = Find(e);
+  if (r == nullptr) {
+    return;
+  }
+  Archetype& a = *archetypes_[r->archetype];
+  for (const ComponentId id : a.ids) {
+    DestroyComponent(a.At(r->row, id), id);
+  }
+  CloseRow(a, r->row);
+  FreeEntity(e);
+}
+
+std::size_t World::chunk_count() const noexcept {
+  std::size_t n = 0;
+  for (const auto& a : archetypes_) {
+    n += a->chunks.size();
+  }
+  return n;
+}
+
+const World::Record* World::Find(Entity e) const noexcept {
+  const std::uint32_t index = e.index();
+  if (!e || index >= records_.size() ||
+      records_[index].generation != e.generation()) {
+    return nullptr;
+  }
+  return &records_[index];
+}
+
+std::uint32_t World::ArchetypeFor(ComponentMask mask) {
+  const auto found = archetype_index_.find(mask);
+  if (found != archetype_index_.end()) {
+    return found->second;
+  }
+  auto a = std::make_unique<Archetype>();
+  a->mask = mask;
+  std::size_t row_bytes = sizeof(Entity);
+  for (ComponentId id = 0; id < kMaxComponentTypes; id++) {
+    if ((mask & ecs_detail::Bit(id)) != 0) {
+      a->ids.push_back(id);
+      a->sizes[id] = static_cast<std::uint32_t>(
+          ecs_detail::GetComponentInfo(id).size);
+      row_bytes += a->sizes[id];
+    }
+  }
+  // as many rows as fit once every array is padded to a cache line
+  const auto bytes_for = [&a](std::size_t rows) {
+    std::size_t bytes = RoundUp(rows * sizeof(Entity));
+    for (const ComponentId id : a->ids) {
+      bytes += RoundUp(rows * a->sizes[id]);
+    }
+    return bytes;
+  };
+  std::size_t rows = ecs_detail::kChunkBytes / row_bytes;
+  while (rows > 0 && bytes_for(rows) > ecs_detail::kChunkBytes) {
+    rows--;
+  }
+  if (rows == 0) {
+    throw std::length_error("ECS: components do not fit a chunk");
+  }
+  a->capacity = static_cast<std::uint32_t>(rows);
+  std::size_t offset = RoundUp(rows * sizeof(Entity));
+  for (const ComponentId id : a->ids) {
+    a->offsets[id] = static_cast<std::uint32_t>(offset);
+    offset += RoundUp(rows * a->sizes[id]);
+  }
+
+  const auto index = static_cast<std::uint32_t>(archetypes_.size());
+  archetypes_.push_back(std::move(a));
+  try {
+    archetype_index_.emplace(mask, index);
+  } catch (...) {
+    archetypes_.pop_back();
+    throw;
+  }
+  return index;
+}
+
+Entity World::NewEntity() {
+  if (free_head_ == kNone) {
+    if (records_.size() >= kMaxEntities) {
+      throw std::length_error("ECS: out of entities");
+    }
+    records_.push_back(Record{1, kNone, 0});
+    free_head_ = static_cast<std::uint32_t>(records_.size() - 1);
+  }
+  const std::uint32_t index = free_head_;
+  Record& r = records_[index];
+  free_head_ = r.archetype;
+  r.archetype = kNone;
+  live_++;
+  return Entity::FromParts(index, r.generation);
+}
+
+void World::FreeEntity(Entity e) noexcept {
+  Record& r = records_[e.index()];
+  // bump the generation so every handle to the record goes stale; a
+  // record out of generations is retired instead of reused
+  r.generation = Entity::NextGeneration(r.generation);
+  live_--;
+  if (r.generation == Entity::kRetiredGeneration) {
+    r.archetype = kNone;
+    return;
+  }
+  r.archetype = free_head_;
+  free_head_ = e.index();
+}
+
+std::uint32_t World::AppendRow(Archetype& a, Entity e) {
+  if (a.size == a.chunks.size() * a.capacity) {
+    a.chunks.reserve(a.chunks.size() + 1);
+    a.chunks.push_back(static_cast<unsigned char*>(chunk_pool_.Allocate()));
+  }
+  const std::uint32_t row = a.size++;
+  a.Entities(row / a.capacity)[row % a.capacity] = e;
+  return row;
+}
+
+void World::CloseRow(Archetype& a, std::uint32_t row) noexcept {
+  const std::uint32_t last = a.size - 1;
+  if (row != last) {
+    for (const ComponentId id : a.ids) {
+      RelocateComponent(a.At(row, id), a.At(last, id), id, a.sizes[id]);
+    }
+    const Entity moved = a.Entities(last / a.capacity)[last % a.capacity];
+    a.Entities(row / a.capacity)[row % a.capacity] = moved;
+    records_[moved.index()].row = row;
+  }
+  a.size--;
+  if (a.size <= (a.chunks.size() - 1) * a.capacity) {
+    chunk_pool_.Deallocate(a.chunks.back());
+    a.chunks.pop_back();
+  }
+}
+
+std::uint32_t World::MoveRow(Record& r, std::uint32_t to) {
+  Archetype& from = *archetypes_[r.archetype];
+  Archetype& dst = *archetypes_[to];
+  const Entity e = from.Entities(r.row / from.capacity)[r.row % from.capacity];
+  // the only step that can throw, so it goes first
+  const std::uint32_t row = AppendRow(dst, e);
+  for (const ComponentId id : from.ids) {
+    void* src = from.At(r.row, id);
+    if ((dst.mask & ecs_detail::Bit(id)) != 0) {
+      RelocateComponent(dst.At(row, id), src, id, from.sizes[id]);
+    } else {
+      DestroyComponent(src, id);
+    }
+  }
+  CloseRow(from, r.row);
+  r.archetype = to;
+  r.row = row;
+  return row;
+}
+
+void* CommandBuffer::Allocate(std::size_t size, std::size_t alignment) {
+  for (;;) {
+    if (block_ == blocks_.size()) {
+      blocks_.push_back(std::make_unique<Block>());
+      offset_ = 0;
+    }
+    const std::size_t start = (offset_ + alignment - 1) & ~(alignment - 1);
+    if (start + size <= kBlockBytes) {
+      offset_ = start + size;
+      return blocks_[block_]->bytes + start;
+    }
+    block_++;
+    offset_ = 0;
+  }
+}
+
+void CommandBuffer::Apply(World& world) {
+  Command* next = head_;
+  head_ = nullptr;
+  tail_ = nullptr;
+  try {
+    while (next != nullptr) {
+      Command* command = next;
+      next = command->next;
+      command->run(command, &world);
+    }
+  } catch (...) {
+    while (next != nullptr) {
+      Command* command = next;
+      next = command->next;
+      command->run(command, nullptr);
+    }
+    block_ = 0;
+    offset_ = 0;
+    throw;
+  }
+  block_ = 0;
+  offset_ = 0;
+}
+
+void CommandBuffer::Clear() noexcept {
+  Command* next = head_;
+  while (next != nullptr) {
+    Command* command = next;
+    next = command->next;
+    command->run(command, nullptr);
+  }
+  head_ = nullptr;
+  tail_ = nullptr;
+  block_ = 0;
+  offset_ = 0;
+}
+
+}  // namespace hw3d
@@ -0,0 +1,466 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "parallel.h"
+#include "pool_allocator.h"
+#include "resource_registry.h"
+
+namespace hw3d {
+
+class World;
+
+// An entity is only a handle; its data lives in components.
+using Entity = Handle<World>;
+
+using ComponentId = std::uint32_t;
+using ComponentMask = std::uint64_t;
+constexpr std::size_t kMaxComponentTypes = 64;
+
+// How the world moves and destroys a component it only knows by id.
+struct ComponentInfo {
+  std::size_t size;
+  std::size_t alignment;
+  // move-constructs *dst from *src, then destroys *src; nullptr means a
+  // byte copy does
+  void (*relocate)(void* dst, void* src) noexcept;
+  // nullptr for trivially destructible types
+  void (*destroy)(void* p) noexcept;
+};
+
+namespace ecs_detail {
+
+constexpr std::size_t kChunkBytes = 16 * 1024;
+constexpr std::size_t kCacheLine = 64;
+
+// Gives out ids in order of first use; throws std::length_error past
+// kMaxComponentTypes. Thread-safe.
+ComponentId RegisterComponent(const ComponentInfo& info);
+const ComponentInfo& GetComponentInfo(ComponentId id) noexcept;
+
+template <typename T>
+void Relocate(void* dst, void* src) noexcept {
+  T* from = static_cast<T*>(src);
+  new (dst) T(std::move(*from));
+  from->~T();
+}
+
+template <typename T>
+void Destroy(void* p) noexcept {
+  static_cast<T*>(p)->~T();
+}
+
+template <typename T>
+ComponentId IdOf() {
+  static_assert(std::is_nothrow_move_constructible_v<T>,
+                "components are moved between chunks and must not throw");
+  static_assert(alignof(T) <= kCacheLine,
+                "components may be aligned to a cache line at most");
+  static const ComponentId id = RegisterComponent(
+      {sizeof(T), alignof(T),
+       std::is_trivially_copyable_v<T> ? nullptr : &Relocate<T>,
+       std::is_trivially_destructible_v<T> ? nullptr : &Destroy<T>});
+  return id;
+}
+
+constexpr ComponentMask Bit(ComponentId id) noexcept {
+  return ComponentMask{1} << id;
+}
+
+template <typename... Ts>
+constexpr bool kDistinct = true;
+template <typename T, typename... Ts>
+constexpr bool kDistinct<T, Ts...> =
+    (!std::is_same_v<std::remove_cv_t<T>, std::remove_cv_t<Ts>> && ...) &&
+    kDistinct<Ts...>;
+
+// Entities that have exactly one set of component types. Rows are packed
+// into 16 KB chunks; a chunk holds `capacity` rows as an Entity array
+// followed by one array per component, each starting on a cache line, so
+// a query walks plain arrays. Every chunk but the last is full.
+struct Archetype {
+  ComponentMask mask = 0;
+  // ascending
+  std::vector<ComponentId> ids;
+  // per component id in `mask`: where its array starts in a chunk, and
+  // the size of one element
+  std::uint32_t offsets[kMaxComponentTypes] = {};
+  std::uint32_t sizes[kMaxComponentTypes] = {};
+  std::uint32_t capacity = 0;
+  std::uint32_t size = 0;
+  std::vector<unsigned char*> chunks;
+
+  std::uint32_t ChunkRows(std::size_t chunk) const noexcept {
+    return std::min(capacity,
+                    size - static_cast<std::uint32_t>(chunk) * capacity);
+  }
+  Entity* Entities(std::size_t chunk) const noexcept {
+    return reinterpret_cast<Entity*>(chunks[chunk]);
+  }
+  void* At(std::uint32_t row, ComponentId id) const noexcept {
+    return chunks[row / capacity] + offsets[id] +
+           static_cast<std::size_t>(row % capacity) * sizes[id];
+  }
+};
+
+}  // namespace ecs_detail
+
+// Id of component type T (const or not), assigned on first use. Component
+// types must be nothrow-move-constructible and aligned to at most a cache
+// line; at most kMaxComponentTypes types exist per process.
+template <typename T>
+ComponentId ComponentIdOf() {
+  return ecs_detail::IdOf<std::remove_cv_t<T>>();
+}
+
+// Entity-component store. Entities with the same component types share an
+// archetype and sit in its chunks, one array per component, so queries run
+// over contiguous memory and never look at entities that lack a queried
+// component.
+//
+// Create, Destroy, Add and Remove move rows between chunks and must not run
+// during a query or alongside any other access; record them in a
+// CommandBuffer instead. Queries and Get may run on several threads at
+// once as long as no two touch the same component type with one of them
+// writing, which is what SystemScheduler arranges.
+class World {
+ public:
+  // index kIndexMask is reserved as the free-list terminator
+  static constexpr std::size_t kMaxEntities = Entity::kIndexMask;
+
+  World();
+  ~World();
+  World(const World&) = delete;
+  World& operator=(const World&) = delete;
+
+  // Throws std::length_error once kMaxEntities entities exist, counting
+  // records retired after kGenerationMask reuses, or if the components do
+  // not fit a chunk together. Copying a component in must not throw; move
+  // it in instead.
+  template <typename... Ts>
+  Entity Create(Ts&&... components);
+  // Stale handles are ignored.
+  void Destroy(Entity e) noexcept;
+  bool IsAlive(Entity e) const noexcept { return Find(e) != nullptr; }
+
+  // Sets T on the entity, adding it if missing. Returns false for a stale
+  // handle.
+  template <typename T>
+  bool Add(Entity e, T&& value);
+  // Returns false for a stale handle or if the entity has no T.
+  template <typename T>
+  bool Remove(Entity e);
+  // nullptr for a stale handle or if the entity has no T. The pointer is
+  // good until the next structural change.
+  template <typename T>
+  T* Get(Entity e) const;
+  template <typename T>
+  bool Has(Entity e) const {
+    const Record* r = Find(e);
+    return r != nullptr &&
+           (archetypes_[r->archetype]->mask &
+            ecs_detail::Bit(ComponentIdOf<T>())) != 0;
+  }
+
+  // Calls fn(count, entities, Ts*... arrays) for every chunk whose entities
+  // have all of Ts; const in Ts gives const arrays.
+  template <typename... Ts, typename Fn>
+  void ForEachChunk(Fn&& fn) const;
+  // Calls fn(Ts&...) for every entity that has all of Ts.
+  template <typename... Ts, typename Fn>
+  void ForEach(Fn&& fn) const;
+  // ForEachChunk with the chunks spread over JobSystem workers; fn must be
+  // safe to call concurrently for different chunks.
+  template <typename... Ts, typename Fn>
+  void ParallelForEachChunk(Fn&& fn) const;
+
+  std::size_t size() const noexcept { return live_; }
+  std::size_t archetype_count() const noexcept { return archetypes_.size(); }
+  std::size_t chunk_count() const noexcept;
+
+ private:
+  using Archetype = ecs_detail::Archetype;
+
+  struct Record {
+    std::uint32_t generation;
+    // archetype index while alive, next free record while free
+    std::uint32_t archetype;
+    std::uint32_t row;
+  };
+
+  static constexpr std::uint32_t kNone = 0xFFFFFFFF;
+
+  const Record* Find(Entity e) const noexcept;
+  Record* Find(Entity e) noexcept {
+    return const_cast<Record*>(static_cast<const World*>(this)->Find(e));
+  }
+  // The archetype for `mask`, made on first use; throws std::length_error
+  // if one row of it does not fit a chunk.
+  std::uint32_t ArchetypeFor(ComponentMask mask);
+  Entity NewEntity();
+  void FreeEntity(Entity e) noexcept;
+  // Appends a row for `e`, taking a fresh chunk if the last one is full.
+  std::uint32_t AppendRow(Archetype& a, Entity e);
+  // Fills the hole at `row` with the last row; the components at `row`
+  // must already be moved out or destroyed.
+  void CloseRow(Archetype& a, std::uint32_t row) noexcept;
+  // Moves the entity's row to `to`, carrying the components both share and
+  // destroying the rest. Returns the new row.
+  std::uint32_t MoveRow(Record& r, std::uint32_t to);
+
+  static ComponentMask MaskOf(const ComponentId* ids,
+                              std::size_t n) noexcept {
+    ComponentMask mask = 0;
+    for (std::size_t i = 0; i < n; i++) {
+      mask |= ecs_detail::Bit(ids[i]);
+    }
+    return mask;
+  }
+  template <typename... Ts, typename Fn, std::size_t... I>
+  static void CallChunk(const Archetype& a,
+                        std::size_t chunk,
+                        const ComponentId* ids,
+                        Fn& fn,
+                        std::index_sequence<I...>) {
+    unsigned char* base = a.chunks[chunk];
+    fn(static_cast<std::size_t>(a.ChunkRows(chunk)),
+       static_cast<const Entity*>(a.Entities(chunk)),
+       reinterpret_cast<Ts*>(base + a.offsets[ids[I]])...);
+  }
+
+  FixedPool chunk_pool_;
+  std::vector<std::unique_ptr<Archetype>> archetypes_;
+  std::unordered_map<ComponentMask, std::uint32_t> archetype_index_;
+  std::vector<Record> records_;
+  std::uint32_t free_head_ = kNone;
+  std::size_t live_ = 0;
+};
+
+// Structural changes recorded while queries or systems run and applied
+// later, in recording order, by Apply(). Commands are kept in blocks the
+// buffer reuses, so recording rarely allocates. Not thread-safe: give each
+// system or thread its own.
+class CommandBuffer {
+ public:
+  static constexpr std::size_t kBlockBytes = 16 * 1024;
+
+  CommandBuffer() = default;
+  ~CommandBuffer() { Clear(); }
+  CommandBuffer(const CommandBuffer&) = delete;
+  CommandBuffer& operator=(const CommandBuffer&) = delete;
+
+  template <typename... Ts>
+  void Create(Ts&&... components) {
+    Push([c = std::make_tuple(std::forward<Ts>(components)...)](
+             World& world) mutable {
+      std::apply([&world](auto&... v) { world.Create(std::move(v)...); }, c);
+    });
+  }
+  void Destroy(Entity e) {
+    Push([e](World& world) { world.Destroy(e); });
+  }
+  template <typename T>
+  void Add(Entity e, T&& value) {
+    Push([e, v = std::decay_t<T>(std::forward<T>(value))](
+             World& world) mutable { world.Add(e, std::move(v)); });
+  }
+  template <typename T>
+  void Remove(Entity e) {
+    Push([e](World& world) { world.Remove<T>(e); });
+  }
+
+  // Runs every command against `world`, then empties the buffer. Commands
+  // on entities that are gone by then do nothing. If a command throws, the
+  // rest are dropped and the exception propagates.
+  void Apply(World& world);
+  // Drops every command without running it.
+  void Clear() noexcept;
+  bool empty() const noexcept { return head_ == nullptr; }
+
+ private:
+  struct Command {
+    // runs the command if `world` is set, then destroys it either way
+    void (*run)(Command* self, World* world);
+    Command* next;
+  };
+
+  template <typename F>
+  struct Recorded : Command {
+    F fn;
+
+    explicit Recorded(F&& f) : Command{&Run, nullptr}, fn(std::move(f)) {}
+
+    static void Run(Command* self, World* world) {
+      auto* recorded = static_cast<Recorded*>(self);
+      struct Destroyer {
+        Recorded* r;
+        ~Destroyer() { r->~Recorded(); }
+      } destroyer{recorded};
+      if (world != nullptr) {
+        recorded->fn(*world);
+      }
+    }
+  };
+
+  struct alignas(ecs_detail::kCacheLine) Block {
+    unsigned char bytes[kBlockBytes];
+  };
+
+  template <typename F>
+  void Push(F&& fn) {
+    using R = Recorded<std::decay_t<F>>;
+    static_assert(sizeof(R) <= kBlockBytes, "command too large");
+    static_assert(alignof(R) <= ecs_detail::kCacheLine,
+                  "command over-aligned");
+    auto* command = new (Allocate(sizeof(R), alignof(R)))
+        R(std::forward<F>(fn));
+    if (tail_ != nullptr) {
+      tail_->next = command;
+    } else {
+      head_ = command;
+    }
+    tail_ = command;
+  }
+  void* Allocate(std::size_t size, std::size_t alignment);
+
+  std::vector<std::unique_ptr<Block>> blocks_;
+  std::size_t block_ = 0;
+  std::size_t offset_ = 0;
+  Command* head_ = nullptr;
+  Command* tail_ = nullptr;
+};
+
+// ---------------------------------------------------------------------------
+// World templates
+
+template <typename... Ts>
+Entity World::Create(Ts&&... components) {
+  static_assert(ecs_detail::kDistinct<Ts...>,
+                "an entity has at most one component of each type");
+  static_assert(
+      (std::is_nothrow_constructible_v<std::decay_t<Ts>, Ts&&> && ...),
+      "copying this component can throw; move it in");
+  const ComponentMask mask =
+      (ComponentMask{0} | ... | ecs_detail::Bit(ComponentIdOf<Ts>()));
+  const std::uint32_t index = ArchetypeFor(mask);
+  Archetype& a = *archetypes_[index];
+  const Entity e = NewEntity();
+  std::uint32_t row;
+  try {
+    row = AppendRow(a, e);
+  } catch (...) {
+    FreeEntity(e);
+    throw;
+  }
+  (new (a.At(row, ComponentIdOf<Ts>()))
+       std::decay_t<Ts>(std::forward<Ts>(components)),
+   ...);
+  Record& r = records_[e.index()];
+  r.archetype = index;
+  r.row = row;
+  return e;
+}
+
+template <typename T>
+bool World::Add(Entity e, T&& value) {
+  using U = std::decay_t<T>;
+  static_assert(std::is_nothrow_constructible_v<U, T&&>,
+                "copying this component can throw; move it in");
+  Record* r = Find(e);
+  if (r == nullptr) {
+    return false;
+  }
+  const ComponentId id = ComponentIdOf<U>();
+  const ComponentMask mask = archetypes_[r->archetype]->mask;
+  if ((mask & ecs_detail::Bit(id)) != 0) {
+    *static_cast<U*>(archetypes_[r->archetype]->At(r->row, id)) =
+        std::forward<T>(value);
+    return true;
+  }
+  const std::uint32_t to = ArchetypeFor(mask | ecs_detail::Bit(id));
+  const std::uint32_t row = MoveRow(*r, to);
+  new (archetypes_[to]->At(row, id)) U(std::forward<T>(value));
+  return true;
+}
+
+template <typename T>
+bool World::Remove(Entity e) {
+  Record* r = Find(e);
+  if (r == nullptr) {
+    return false;
+  }
+  const ComponentMask bit = ecs_detail::Bit(ComponentIdOf<T>());
+  const ComponentMask mask = archetypes_[r->archetype]->mask;
+  if ((mask & bit) == 0) {
+    return false;
+  }
+  MoveRow(*r, ArchetypeFor(mask & ~bit));
+  return true;
+}
+
+template <typename T>
+T* World::Get(Entity e) const {
+  const Record* r = Find(e);
+  if (r == nullptr) {
+    return nullptr;
+  }
+  const ComponentId id = ComponentIdOf<T>();
+  const Archetype& a = *archetypes_[r->archetype];
+  if ((a.mask & ecs_detail::Bit(id)) == 0) {
+    return nullptr;
+  }
+  return static_cast<T*>(a.At(r->row, id));
+}
+
+template <typename... Ts, typename Fn>
+void World::ForEachChunk(Fn&& fn) const {
+  static_assert(ecs_detail::kDistinct<Ts...>, "component listed twice");
+  // the trailing 0 keeps the array non-empty for an all-entities query
+  const ComponentId ids[] = {ComponentIdOf<Ts>()..., 0};
+  const ComponentMask mask = MaskOf(ids, sizeof...(Ts));
+  for (const auto& a : archetypes_) {
+    if ((a->mask & mask) != mask) {
+      continue;
+    }
+    for (std::size_t c = 0; c < a->chunks.size(); c++) {
+      CallChunk<Ts...>(*a, c, ids, fn, std::index_sequence_for<Ts...>());
+    }
+  }
+}
+
+template <typename... Ts, typename Fn>
+void World::ForEach(Fn&& fn) const {
+  ForEachChunk<Ts...>([&fn](std::size_t n, const Entity*, Ts*... arrays) {
+    for (std::size_t i = 0; i < n; i++) {
+      fn(arrays[i]...);
+    }
+  });
+}
+
+template <typename... Ts, typename Fn>
+void World::ParallelForEachChunk(Fn&& fn) const {
+  static_assert(ecs_detail::kDistinct<Ts...>, "component listed twice");
+  const ComponentId ids[] = {ComponentIdOf<Ts>()..., 0};
+  const ComponentMask mask = MaskOf(ids, sizeof...(Ts));
+  for (const auto& a : archetypes_) {
+    if ((a->mask & mask) != mask || a->chunks.empty()) {
+      continue;
+    }
+    const Archetype& archetype = *a;
+    ParallelFor(0, archetype.chunks.size(), [&](std::size_t c) {
+      CallChunk<Ts...>(archetype, c, ids, fn,
+                       std::index_sequence_for<Ts...>());
+    });
+  }
+}
+
+}  // namespace hw3d
@@ -1,17 +1,128 @@
 ﻿#include "exception.h"
 
-#include <sstream>
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <thread>
 
 namespace hw3d {
 
+namespace {
+
+// Exceptions alive at once with a pool report. Nested rethrows and a few
+// stored exception_ptrs fit; past that, reports come from the heap.
+constexpr std::size_t kReportCount = 16;
+constexpr std::size_t kOriginCapacity = 320;
+
+// states of a lazily formatted report text
+constexpr std::uint8_t kStale = 0;
+constexpr std::uint8_t kFormatting = 1;
+constexpr std::uint8_t kReady = 2;
+
+// Runs `format` once per stale text even if several threads ask at once;
+// the others wait for it to finish.
+template <typename Format>
+void FormatOnce(std::atomic<std::uint8_t>& state, Format&& format) noexcept {
+  std::uint8_t current = kStale;
+  if (state.compare_exchange_strong(current, kFormatting,
+                                    std::memory_order_acquire)) {
+    format();
+    state.store(kReady, std::memory_order_release);
+    return;
+  }
+  while (current != kReady) {
+    std::this_thread::yield();
+    current = state.load(std::memory_order_acquire);
+  }
+}
+
+}  // namespace
+
+struct Hw3dException::Report {
+  // exceptions sharing the report; 0 when free
+  std::atomic<std::uint32_t> refs{0};
+  // made when the pool was empty; deleted with the last user
+  bool heap = false;
+  std::atomic<std::uint8_t> what_state{kStale};
+  std::atomic<std::uint8_t> origin_state{kStale};
+  WhatBuffer what;
+  FormatBuffer<kOriginCapacity> origin;
+  FormatBuffer<kDetailCapacity> detail;
+};
+
+Hw3dException::Report* Hw3dException::AcquireReport() noexcept {
+  static Report reports[kReportCount];
+  for (Report& report : reports) {
+    std::uint32_t expected = 0;
+    // acquire: the last user of a freed report is done with its text
+    if (report.refs.compare_exchange_strong(expected, 1,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+      report.what_state.store(kStale, std::memory_order_relaxed);
+      report.origin_state.store(kStale, std::memory_order_relaxed);
+      report.detail.Clear();
+      return &report;
+    }
+  }
+  // rather than lose file, line and detail
+  Report* report = new (std::nothrow) Report();
+  if (report != nullptr) {
+    report->refs.store(1, std::memory_order_relaxed);
+    report->heap = true;
+  }
+  return report;
+}
+
+void Hw3dException::ReleaseReport(Report* report) noexcept {
+  // acq_rel: the last user of a heap report sees the others' writes
+  if (report != nullptr &&
+      report->refs.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+      report->heap) {
+    delete report;
+  }
+}
+
 Hw3dException::Hw3dException(int line, const char* file) noexcept
-    : line_(line), file_(file) {}
+    : line_(line),
+      file_(file != nullptr ? file : ""),
+      report_(AcquireReport()) {}
+
+Hw3dException::Hw3dException(const Hw3dException& other) noexcept
+    : std::exception(other),
+      line_(other.line_),
+      file_(other.file_),
+      report_(other.report_) {
+  if (report_ != nullptr) {
+    report_->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+Hw3dException& Hw3dException::operator=(
+    const Hw3dException& other) noexcept {
+  if (other.report_ != nullptr) {
+    other.report_->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  ReleaseReport(report_);
+  std::exception::operator=(other);
+  line_ = other.line_;
+  file_ = other.file_;
+  report_ = other.report_;
+  return *this;
+}
+
+Hw3dException::~Hw3dException() {
+  ReleaseReport(report_);
+}
 
 const char* Hw3dException::what() const noexcept {
-  std::ostringstream oss;
-  oss << GetType() << std::endl << GetOriginString();
-  what_buffer_ = oss.str();
-  return what_buffer_.c_str();
+  if (report_ == nullptr) {
+    return GetType();
+  }
+  FormatOnce(report_->what_state, [this] {
+    report_->what.Clear();
+    FormatWhat(report_->what);
+  });
+  return report_->what.c_str();
 }
 
 const char* Hw3dException::GetType() const noexcept {
@@ -22,14 +133,53 @@ int Hw3dException::GetLine() const noexcept {
   return line_;
 }
 
-const std::string& Hw3dException::GetFile() const noexcept {
+std::string_view Hw3dException::GetFile() const noexcept {
   return file_;
 }
 
-std::string Hw3dException::GetOriginString() const noexcept {
-  std::ostringstream oss;
-  oss << "[File] " << file_ << std::endl << "[Line] " << line_;
-  return oss.str();
+std::string_view Hw3dException::GetOriginString() const noexcept {
+  if (report_ == nullptr) {
+    return file_;
+  }
+  FormatOnce(report_->origin_state, [this] {
+    report_->origin.Clear();
+    report_->origin.Append("[File] ")
+        .Append(file_)
+        .Append("\n[Line] ")
+        .AppendDecimal(line_);
+  });
+  return report_->origin.view();
+}
+
+void Hw3dException::FormatWhat(WhatBuffer& out) const noexcept {
+  out.Append(GetType()).Append('\n');
+  AppendOrigin(out);
+}
+
+void Hw3dException::AppendOrigin(WhatBuffer& out) const noexcept {
+  out.Append(GetOriginString());
+}
+
+void Hw3dException::AppendErrorCode(WhatBuffer& out, HRESULT hr) noexcept {
+  // HRESULTs are 32 bits; print them unsigned like the SDK headers do
+  const auto code = static_cast<std::uint32_t>(hr);
+  out.Append("[Error Code] 0x")
+      .AppendHex(code)
+      .Append(" (")
+      .AppendDecimal(code)
+      .Append(")\n");
+}
+
+void Hw3dException::SetDetail(std::string_view text) noexcept {
+  if (report_ != nullptr) {
+    report_->detail.Clear();
+    report_->detail.Append(text).TrimTrailingWhitespace();
+    report_->what_state.store(kStale, std::memory_order_relaxed);
+  }
+}
+
+std::string_view Hw3dException::GetDetail() const noexcept {
+  return report_ != nullptr ? report_->detail.view() : std::string_view();
 }
 
-}  // namespace hw3d
\ No newline at end of file
+}  // namespace hw3d
@@ -1,30 +1,74 @@
 ﻿#pragma once
 
+#include <cstddef>
 #include <exception>
-#include <string>
+#include <string_view>
+
+#include "format_buffer.h"
+#include "hresult.h"
 
 namespace hw3d {
 
+// Base of the hw3d exceptions. The report text does not live in the
+// exception: the constructor claims one of a few static report buffers,
+// shared by copies of the exception and freed with the last of them, so
+// an exception is a few words to copy while it unwinds and formatting
+// allocates nothing. With more exceptions alive than there are buffers,
+// the report comes from the heap; only if that fails too does what() fall
+// back to GetType() and detail text get dropped.
 class Hw3dException : public std::exception {
  public:
+  // Longest report what() can hold; anything beyond is truncated.
+  static constexpr std::size_t kWhatCapacity = 2048;
+  // Longest detail text SetDetail() keeps.
+  static constexpr std::size_t kDetailCapacity = 1024;
+  using WhatBuffer = FormatBuffer<kWhatCapacity>;
+
   Hw3dException(int line, const char* file) noexcept;
+  Hw3dException(const Hw3dException& other) noexcept;
+  Hw3dException& operator=(const Hw3dException& other) noexcept;
+  ~Hw3dException() override;
 
-  virtual const char* what() const noexcept override;
+  // Formats the report on the first call and returns the cached text after
+  // that. Never allocates; threads sharing an exception may call it at once.
+  const char* what() const noexcept override;
 
   virtual const char* GetType() const noexcept;
 
   int GetLine() const noexcept;
 
-  const std::string& GetFile() const noexcept;
+  std::string_view GetFile() const noexcept;
 
-  std::string GetOriginString() const noexcept;
+  std::string_view GetOriginString() const noexcept;
 
  protected:
-  mutable std::string what_buffer_;
+  // Writes the full report into `out`. Overrides append their own fields and
+  // usually finish with AppendOrigin().
+  virtual void FormatWhat(WhatBuffer& out) const noexcept;
+
+  void AppendOrigin(WhatBuffer& out) const noexcept;
+
+  // "[Error Code] 0x887A0005 (2289696773)" line shared by the HRESULT
+  // exceptions.
+  static void AppendErrorCode(WhatBuffer& out, HRESULT hr) noexcept;
+
+  // Keeps `text`, without trailing whitespace, with the report for
+  // FormatWhat() and accessors: debug-layer messages and the like. Call it
+  // while constructing the exception, before anything reads the report.
+  void SetDetail(std::string_view text) noexcept;
+  std::string_view GetDetail() const noexcept;
 
  private:
+  struct Report;
+
+  // A free pool report, else a heap one; nullptr if both run out.
+  static Report* AcquireReport() noexcept;
+  static void ReleaseReport(Report* report) noexcept;
+
   int line_;
-  std::string file_;
+  // __FILE__ literal, so it outlives the exception without a copy
+  const char* file_;
+  Report* report_;
 };
 
-}  // namespace hw3d
\ No newline at end of file
+}  // namespace hw3d
@@ -0,0 +1,287 @@
+﻿#include "fiber.h"
+
+#include <cstdint>
+#include <new>
+
+#if defined(_WIN32)
+#include "windows_config.h"
+#endif
+#if defined(HW3D_FIBER_TSAN)
+#include <sanitizer/tsan_interface.h>
+#endif
+
+namespace hw3d {
+
+#if !defined(_WIN32)
+
+namespace {
+
+// Both POSIX variants report their contexts to ThreadSanitizer, which would
+// otherwise see one thread jumping between unrelated stacks.
+void* TsanCurrentFiber() noexcept {
+#if defined(HW3D_FIBER_TSAN)
+  return __tsan_get_current_fiber();
+#else
+  return nullptr;
+#endif
+}
+
+void* TsanCreateFiber() noexcept {
+#if defined(HW3D_FIBER_TSAN)
+  return __tsan_create_fiber(0);
+#else
+  return nullptr;
+#endif
+}
+
+void TsanDestroyFiber(void* fiber) noexcept {
+#if defined(HW3D_FIBER_TSAN)
+  if (fiber != nullptr) {
+    __tsan_destroy_fiber(fiber);
+  }
+#else
+  static_cast<void>(fiber);
+#endif
+}
+
+void TsanSwitchToFiber(void* fiber) noexcept {
+#if defined(HW3D_FIBER_TSAN)
+  __tsan_switch_to_fiber(fiber, 0);
+#else
+  static_cast<void>(fiber);
+#endif
+}
+
+}  // namespace
+
+#endif  // !_WIN32
+
+#if defined(_WIN32)
+
+namespace {
+
+struct StartInfo {
+  FiberContext::Entry entry;
+  void* arg;
+};
+
+}  // namespace
+
+bool FiberContext::BindThread() noexcept {
+  fiber_ = ConvertThreadToFiber(nullptr);
+  if (fiber_ == nullptr) {
+    // already a fiber: use the current one
+    if (GetLastError() != ERROR_ALREADY_FIBER) {
+      return false;
+    }
+    fiber_ = GetCurrentFiber();
+    return true;
+  }
+  converted_ = true;
+  return true;
+}
+
+void FiberContext::ReleaseThread() noexcept {
+  if (converted_) {
+    ConvertFiberToThread();
+    converted_ = false;
+  }
+  fiber_ = nullptr;
+}
+
+bool FiberContext::Create(Entry entry,
+                          void* arg,
+                          unsigned char* /*stack*/,
+                          std::size_t stack_size) noexcept {
+  // the fiber procedure gets a single pointer; hand it entry and arg
+  // together
+  struct Trampoline {
+    static void WINAPI Run(void* param) {
+      const auto* info = static_cast<const StartInfo*>(param);
+      info->entry(info->arg);
+    }
+  };
+  // lives as long as the fiber: freed in Destroy()
+  auto* info = new (std::nothrow) StartInfo{entry, arg};
+  if (info == nullptr) {
+    return false;
+  }
+  fiber_ = CreateFiberEx(stack_size, stack_size, FIBER_FLAG_FLOAT_SWITCH,
+                         &Trampoline::Run, info);
+  if (fiber_ == nullptr) {
+    delete info;
+    return false;
+  }
+  start_info_ = info;
+  return true;
+}
+
+void FiberContext::Destroy() noexcept {
+  if (fiber_ != nullptr) {
+    DeleteFiber(fiber_);
+    fiber_ = nullptr;
+  }
+  delete static_cast<StartInfo*>(start_info_);
+  start_info_ = nullptr;
+}
+
+void FiberContext::Switch(FiberContext& /*from*/, FiberContext& to) noexcept {
+  SwitchToFiber(to.fiber_);
+}
+
+#elif defined(HW3D_FIBER_UCONTEXT)
+
+namespace {
+
+// makecontext passes int arguments only, so pointers travel in halves
+void Trampoline(unsigned entry_hi,
+                unsigned entry_lo,
+                unsigned arg_hi,
+                unsigned arg_lo) {
+  const auto join = [](unsigned hi, unsigned lo) {
+    return (static_cast<std::uintptr_t>(hi) << 16 << 16) | lo;
+  };
+  const auto entry =
+      reinterpret_cast<FiberContext::Entry>(join(entry_hi, entry_lo));
+  entry(reinterpret_cast<void*>(join(arg_hi, arg_lo)));
+}
+
+}  // namespace
+
+bool FiberContext::BindThread() noexcept {
+  // the context is filled in by the first Switch() away from this thread
+  tsan_fiber_ = TsanCurrentFiber();
+  return true;
+}
+
+void FiberContext::ReleaseThread() noexcept {
+  tsan_fiber_ = nullptr;
+}
+
+bool FiberContext::Create(Entry entry,
+                          void* arg,
+                          unsigned char* stack,
+                          std::size_t stack_size) noexcept {
+  if (getcontext(&context_) != 0) {
+    return false;
+  }
+  context_.uc_stack.ss_sp = stack;
+  context_.uc_stack.ss_size = stack_size;
+  context_.uc_link = nullptr;
+  const auto e = reinterpret_cast<std::uintptr_t>(entry);
+  const auto a = reinterpret_cast<std::uintptr_t>(arg);
+  makecontext(&context_, reinterpret_cast<void (*)()>(&Trampoline), 4,
+              static_cast<unsigned>(e >> 16 >> 16), static_cast<unsigned>(e),
+              static_cast<unsigned>(a >> 16 >> 16), static_cast<unsigned>(a));
+  tsan_fiber_ = TsanCreateFiber();
+  return true;
+}
+
+void FiberContext::Destroy() noexcept {
+  TsanDestroyFiber(tsan_fiber_);
+  tsan_fiber_ = nullptr;
+}
+
+void FiberContext::Switch(FiberContext& from, FiberContext& to) noexcept {
+  TsanSwitchToFiber(to.tsan_fiber_);
+  swapcontext(&from.context_, &to.context_);
+}
+
+#else  // Linux x86-64
+
+// void hw3d_fiber_switch(void** from_sp, void* to_sp)
+//
+// Pushes the System V callee-saved registers plus MXCSR and the x87 control
+// word, stores the stack pointer in *from_sp, loads to_sp and pops the same
+// frame from there. A fresh context's stack is laid out by Create() so that
+// the final `ret` lands in hw3d_fiber_start.
+//
+// hw3d_fiber_start calls entry(arg), taken from r12 and r13.
+asm(R"(
+  .text
+  .globl hw3d_fiber_switch
+  .type hw3d_fiber_switch, @function
+hw3d_fiber_switch:
+  pushq %rbp
+  pushq %rbx
+  pushq %r12
+  pushq %r13
+  pushq %r14
+  pushq %r15
+  subq $8, %rsp
+  stmxcsr (%rsp)
+  fnstcw 4(%rsp)
+  movq %rsp, (%rdi)
+  movq %rsi, %rsp
+  ldmxcsr (%rsp)
+  fldcw 4(%rsp)
+  addq $8, %rsp
+  popq %r15
+  popq %r14
+  popq %r13
+  popq %r12
+  popq %rbx
+  popq %rbp
+  ret
+  .size hw3d_fiber_switch, .-hw3d_fiber_switch
+
+  .globl hw3d_fiber_start
+  .type hw3d_fiber_start, @function
+hw3d_fiber_start:
+  movq %r13, %rdi
+  callq *%r12
+  ud2
+  .size hw3d_fiber_start, .-hw3d_fiber_start
+)");
+
+extern "C" void hw3d_fiber_switch(void** from_sp, void* to_sp);
+extern "C" void hw3d_fiber_start();
+
+bool FiberContext::BindThread() noexcept {
+  // the stack pointer is saved by the first Switch() away from this thread
+  tsan_fiber_ = TsanCurrentFiber();
+  return true;
+}
+
+void FiberContext::ReleaseThread() noexcept {
+  sp_ = nullptr;
+  tsan_fiber_ = nullptr;
+}
+
+bool FiberContext::Create(Entry entry,
+                          void* arg,
+                          unsigned char* stack,
+                          std::size_t stack_size) noexcept {
+  // after `ret` into hw3d_fiber_start the stack pointer must be 16-byte
+  // aligned, so the call into `entry` sees the ABI's alignment
+  auto top = reinterpret_cast<std::uintptr_t>(stack + stack_size);
+  top &= ~static_cast<std::uintptr_t>(15);
+  auto* frame = reinterpret_cast<std::uint64_t*>(top - 16);
+  *--frame = reinterpret_cast<std::uint64_t>(&hw3d_fiber_start);  // ret
+  *--frame = 0;                                                    // rbp
+  *--frame = 0;                                                    // rbx
+  *--frame = reinterpret_cast<std::uint64_t>(entry);               // r12
+  *--frame = reinterpret_cast<std::uint64_t>(arg);                 // r13
+  *--frame = 0;                                                    // r14
+  *--frame = 0;                                                    // r15
+  // default MXCSR (all exceptions masked) and x87 control word
+  *--frame = 0x1F80u | (static_cast<std::uint64_t>(0x037Fu) << 32);
+  sp_ = frame;
+  tsan_fiber_ = TsanCreateFiber();
+  return true;
+}
+
+void FiberContext::Destroy() noexcept {
+  sp_ = nullptr;
+  TsanDestroyFiber(tsan_fiber_);
+  tsan_fiber_ = nullptr;
+}
+
+void FiberContext::Switch(FiberContext& from, FiberContext& to) noexcept {
+  TsanSwitchToFiber(to.tsan_fiber_);
+  hw3d_fiber_switch(&from.sp_, to.sp_);
+}
+
+#endif
+
+}  // namespace hw3d
@@ -0,0 +1,67 @@
+﻿#pragma once
+
+#include <cstddef>
+
+#if !defined(_WIN32) && !(defined(__x86_64__) && defined(__linux__))
+#include <ucontext.h>
+#define HW3D_FIBER_UCONTEXT 1
+#endif
+
+// ThreadSanitizer has to be told about stack switches
+#if defined(__SANITIZE_THREAD__)
+#define HW3D_FIBER_TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define HW3D_FIBER_TSAN 1
+#endif
+#endif
+
+namespace hw3d {
+
+// A saved execution context that can be switched to and from on the same
+// thread. Windows fibers on Win32; a hand-written switch of the callee-saved
+// registers on Linux x86-64; ucontext on other POSIX systems.
+class FiberContext {
+ public:
+  using Entry = void (*)(void* arg);
+
+  FiberContext() = default;
+  FiberContext(const FiberContext&) = delete;
+  FiberContext& operator=(const FiberContext&) = delete;
+
+  // Makes the calling thread's own context switchable. Pair with
+  // ReleaseThread() on the same thread before it exits.
+  bool BindThread() noexcept;
+  void ReleaseThread() noexcept;
+
+  // Prepares a context that starts running `entry(arg)` on `stack` the first
+  // time it is switched to. `entry` must never return. On Windows the OS
+  // allocates the stack itself and `stack` is ignored.
+  bool Create(Entry entry,
+              void* arg,
+              unsigned char* stack,
+              std::size_t stack_size) noexcept;
+  void Destroy() noexcept;
+
+  // Saves the current context into `from` and resumes `to`.
+  static void Switch(FiberContext& from, FiberContext& to) noexcept;
+
+ private:
+#if defined(_WIN32)
+  void* fiber_ = nullptr;
+  // entry and arg for the fiber procedure; owned
+  void* start_info_ = nullptr;
+  bool converted_ = false;
+#elif defined(HW3D_FIBER_UCONTEXT)
+  ucontext_t context_;
+#else
+  // saved stack pointer; the registers live on the stack
+  void* sp_ = nullptr;
+#endif
+#if !defined(_WIN32)
+  // ThreadSanitizer's handle for this context; null in other builds
+  void* tsan_fiber_ = nullptr;
+#endif
+};
+
+}  // namespace hw3d
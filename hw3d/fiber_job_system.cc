@@ -0,0 +1,419 @@
+﻿#include "fiber_job_system.h"
+
+#include <chrono>
+
+#include "memory_tracker.h"
+#include "simd_config.h"
+
+#if defined(_MSC_VER)
+#define HW3D_NOINLINE __declspec(noinline)
+#else
+#define HW3D_NOINLINE __attribute__((noinline))
+#endif
+
+namespace hw3d {
+
+namespace {
+
+constexpr unsigned kSpinRounds = 256;
+constexpr unsigned kYieldRounds = 64;
+constexpr auto kMaxSleep = std::chrono::milliseconds(2);
+
+// A fiber can resume on another thread, and compilers may keep the address
+// of a thread_local in a register across calls. These accessors are never
+// inlined, so every read goes to the current thread's copy.
+thread_local void* tls_worker = nullptr;
+thread_local void* tls_fiber = nullptr;
+
+HW3D_NOINLINE void* CurrentWorkerSlot() noexcept {
+  return tls_worker;
+}
+HW3D_NOINLINE void SetCurrentWorkerSlot(void* worker) noexcept {
+  tls_worker = worker;
+}
+HW3D_NOINLINE void* CurrentFiberSlot() noexcept {
+  return tls_fiber;
+}
+HW3D_NOINLINE void SetCurrentFiberSlot(void* fiber) noexcept {
+  tls_fiber = fiber;
+}
+
+void CpuRelax() noexcept {
+#if defined(HW3D_SIMD_SSE2)
+  _mm_pause();
+#elif defined(HW3D_SIMD_NEON)
+  __asm__ __volatile__("yield");
+#else
+  std::this_thread::yield();
+#endif
+}
+
+std::uint32_t NextRandom(std::uint32_t& state) noexcept {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+}  // namespace
+
+FiberJobSystem::Worker::Worker(unsigned index)
+    : index(index),
+      deque(kJobsPerWorker),
+      slots(kJobsPerWorker),
+      rng(0x9E3779B9u * (index + 1)) {}
+
+FiberJobSystem& FiberJobSystem::Get() noexcept {
+  static FiberJobSystem system;
+  return system;
+}
+
+FiberJobSystem::~FiberJobSystem() {
+  Stop();
+}
+
+bool FiberJobSystem::InFiber() noexcept {
+  return CurrentFiberSlot() != nullptr;
+}
+
+bool FiberJobSystem::Start(const FiberJobSystemConfig& config) {
+  if (IsRunning() || config.fiber_count == 0) {
+    return false;
+  }
+  HW3D_MEMORY_SCOPE(MemoryTag::kJobs);
+  unsigned worker_count = config.worker_count;
+  if (worker_count == 0) {
+    worker_count = std::thread::hardware_concurrency();
+    if (worker_count == 0) {
+      worker_count = 1;
+    }
+  }
+
+  // every stack up front, 64-byte aligned
+  const std::size_t stack_size = (config.stack_size + 63) & ~std::size_t{63};
+  fiber_count_ = config.fiber_count;
+  fibers_ = std::make_unique<Fiber[]>(fiber_count_);
+#if !defined(_WIN32)
+  stacks_.reset(new unsigned char[stack_size * fiber_count_ + 64]);
+#endif
+  auto* stack_base = reinterpret_cast<unsigned char*>(
+      (reinterpret_cast<std::uintptr_t>(stacks_.get()) + 63) &
+      ~std::uintptr_t{63});
+  free_fibers_.reserve(fiber_count_);
+  waiting_.reserve(fiber_count_);
+  for (std::uint32_t i = 0; i < fiber_count_; i++) {
+    unsigned char* stack =
+        stacks_ != nullptr ? stack_base + stack_size * i : nullptr;
+    if (!fibers_[i].context.Create(&FiberJobSystem::FiberMain, &fibers_[i],
+                                   stack, stack_size)) {
+      for (std::uint32_t j = 0; j < i; j++) {
+        fibers_[j].context.Destroy();
+      }
+      fibers_.reset();
+      stacks_.reset();
+      free_fibers_.clear();
+      return false;
+    }
+    free_fibers_.push_back(&fibers_[i]);
+  }
+
+  stop_requested_.store(false, std::memory_order_relaxed);
+  workers_.reserve(worker_count);
+  for (unsigned i = 0; i < worker_count; i++) {
+    workers_.push_back(std::make_unique<Worker>(i));
+  }
+  running_.store(true, std::memory_order_release);
+  threads_.reserve(worker_count);
+  for (unsigned i = 0; i < worker_count; i++) {
+    threads_.emplace_back(&FiberJobSystem::WorkerLoop, this, i);
+  }
+  return true;
+}
+
+void FiberJobSystem::Stop() noexcept {
+  if (!running_.exchange(false, std::memory_order_acq_rel)) {
+    return;
+  }
+  // workers finish queued and suspended jobs before they exit
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stop_requested_.store(true, std::memory_order_release);
+  }
+  sleep_cv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+  workers_.clear();
+  for (std::uint32_t i = 0; i < fiber_count_; i++) {
+    fibers_[i].context.Destroy();
+  }
+  fibers_.reset();
+  stacks_.reset();
+  fiber_count_ = 0;
+  free_fibers_.clear();
+  waiting_.clear();
+  injected_.clear();
+  injected_count_.store(0, std::memory_order_relaxed);
+}
+
+void FiberJobSystem::Submit(const Job& job) noexcept {
+  if (job.counter != nullptr) {
+    job.counter->pending_.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (!running_.load(std::memory_order_relaxed)) {
+    Execute(job);
+    return;
+  }
+  auto* self = static_cast<Worker*>(CurrentWorkerSlot());
+  if (self == nullptr) {
+    std::lock_guard<std::mutex> lock(inject_mutex_);
+    injected_.push_back(job);
+    injected_count_.fetch_add(1, std::memory_order_release);
+  } else if (!Queue(*self, job)) {
+    Execute(job);
+    return;
+  }
+  WakeOne();
+}
+
+void FiberJobSystem::Wait(const JobCounter& counter) noexcept {
+  auto* fiber = static_cast<Fiber*>(CurrentFiberSlot());
+  if (fiber == nullptr) {
+    if (auto* self = static_cast<Worker*>(CurrentWorkerSlot())) {
+      // a job running inline on the worker's own stack (see RunOne): it
+      // cannot be parked, so keep the worker busy until the counter is done
+      while (!counter.IsDone()) {
+        if (!RunOne(*self)) {
+          CpuRelax();
+        }
+      }
+      return;
+    }
+    // not a worker: spin briefly, then sleep until a job finishes a counter
+    for (unsigned i = 0; i < kSpinRounds && !counter.IsDone(); i++) {
+      CpuRelax();
+    }
+    if (counter.IsDone()) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(done_mutex_);
+    external_waiters_.fetch_add(1, std::memory_order_relaxed);
+    // pairs with the fence in NotifyCounterDone()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!counter.IsDone()) {
+      done_cv_.wait_for(lock, kMaxSleep);
+    }
+    external_waiters_.fetch_sub(1, std::memory_order_relaxed);
+    return;
+  }
+  while (!counter.IsDone()) {
+    fiber->waiting_on = &counter;
+    fiber->state = FiberState::kWaiting;
+    // the scheduler parks this fiber once it has switched away from it
+    FiberContext::Switch(fiber->context, fiber->worker->context);
+    // resumed, possibly on another worker
+  }
+}
+
+void FiberJobSystem::FiberMain(void* arg) {
+  auto* fiber = static_cast<Fiber*>(arg);
+  for (;;) {
+    Execute(fiber->job);
+    fiber->state = FiberState::kFinished;
+    FiberContext::Switch(fiber->context, fiber->worker->context);
+  }
+}
+
+void FiberJobSystem::WorkerLoop(unsigned index) noexcept {
+  Worker& self = *workers_[index];
+  SetCurrentWorkerSlot(&self);
+  self.context.BindThread();
+  unsigned idle = 0;
+  while (!stop_requested_.load(std::memory_order_acquire)) {
+    if (RunOne(self)) {
+      idle = 0;
+    } else if (++idle < kSpinRounds) {
+      CpuRelax();
+    } else if (idle < kSpinRounds + kYieldRounds) {
+      std::this_thread::yield();
+    } else {
+      Sleep();
+      idle = 0;
+    }
+  }
+  // help finish everything, including jobs suspended on other workers
+  while (RunOne(self) || AnyWorkQueued() || AnyFiberBusy()) {
+    std::this_thread::yield();
+  }
+  self.context.ReleaseThread();
+  SetCurrentWorkerSlot(nullptr);
+}
+
+bool FiberJobSystem::RunOne(Worker& self) noexcept {
+  if (Fiber* fiber = TakeReadyFiber()) {
+    SwitchTo(self, *fiber);
+    return true;
+  }
+  Job job;
+  if (!TakeJob(self, job)) {
+    return false;
+  }
+  Fiber* fiber = AcquireFiber();
+  if (fiber == nullptr) {
+    // every fiber is busy, possibly all waiting on this very job: run it
+    // on the worker's own stack. Requeueing it instead could leave every
+    // worker passing the same job around forever.
+    Execute(job);
+    return true;
+  }
+  fiber->job = job;
+  SwitchTo(self, *fiber);
+  return true;
+}
+
+void FiberJobSystem::SwitchTo(Worker& self, Fiber& fiber) noexcept {
+  fiber.worker = &self;
+  fiber.state = FiberState::kRunning;
+  SetCurrentFiberSlot(&fiber);
+  FiberContext::Switch(self.context, fiber.context);
+  SetCurrentFiberSlot(nullptr);
+  // the fiber's context is saved now, so it is safe to hand it on
+  if (fiber.state == FiberState::kFinished) {
+    std::lock_guard<std::mutex> lock(free_mutex_);
+    free_fibers_.push_back(&fiber);
+  } else {
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    waiting_.push_back(&fiber);
+    waiting_count_.fetch_add(1, std::memory_order_release);
+  }
+}
+
+FiberJobSystem::Fiber* FiberJobSystem::TakeReadyFiber() noexcept {
+  if (waiting_count_.load(std::memory_order_acquire) == 0) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(wait_mutex_);
+  for (std::size_t i = 0; i < waiting_.size(); i++) {
+    Fiber* fiber = waiting_[i];
+    if (fiber->waiting_on->IsDone()) {
+      waiting_[i] = waiting_.back();
+      waiting_.pop_back();
+      waiting_count_.fetch_sub(1, std::memory_order_relaxed);
+      return fiber;
+    }
+  }
+  return nullptr;
+}
+
+bool FiberJobSystem::Queue(Worker& self, const Job& job) noexcept {
+  Job* slot = self.slots.Put(job);
+  if (slot == nullptr) {
+    return false;
+  }
+  if (!self.deque.Push(slot)) {
+    self.slots.Take(slot);
+    return false;
+  }
+  return true;
+}
+
+bool FiberJobSystem::TakeJob(Worker& self, Job& out) noexcept {
+  if (Job* slot = self.deque.Pop()) {
+    out = self.slots.Take(slot);
+    return true;
+  }
+  const std::size_t count = workers_.size();
+  std::size_t victim = NextRandom(self.rng) % count;
+  for (std::size_t i = 0; i < count; i++, victim = (victim + 1) % count) {
+    if (victim == self.index) {
+      continue;
+    }
+    Worker& other = *workers_[victim];
+    if (Job* slot = other.deque.Steal()) {
+      out = other.slots.Take(slot);
+      return true;
+    }
+  }
+  if (injected_count_.load(std::memory_order_acquire) != 0) {
+    std::lock_guard<std::mutex> lock(inject_mutex_);
+    if (!injected_.empty()) {
+      out = injected_.front();
+      injected_.pop_front();
+      injected_count_.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+FiberJobSystem::Fiber* FiberJobSystem::AcquireFiber() noexcept {
+  std::lock_guard<std::mutex> lock(free_mutex_);
+  if (free_fibers_.empty()) {
+    return nullptr;
+  }
+  Fiber* fiber = free_fibers_.back();
+  free_fibers_.pop_back();
+  return fiber;
+}
+
+bool FiberJobSystem::AnyWorkQueued() const noexcept {
+  if (injected_count_.load(std::memory_order_relaxed) != 0) {
+    return true;
+  }
+  for (const auto& worker : workers_) {
+    if (!worker->deque.LooksEmpty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool FiberJobSystem::AnyFiberBusy() noexcept {
+  std::lock_guard<std::mutex> lock(free_mutex_);
+  return free_fibers_.size() < fiber_count_;
+}
+
+void FiberJobSystem::Sleep() noexcept {
+  std::unique_lock<std::mutex> lock(sleep_mutex_);
+  sleepers_.fetch_add(1, std::memory_order_relaxed);
+  // pairs with the fence in WakeOne()
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!AnyWorkQueued() && !stop_requested_.load(std::memory_order_relaxed)) {
+    sleep_cv_.wait_for(lock, kMaxSleep);
+  }
+  sleepers_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void FiberJobSystem::WakeOne() noexcept {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleepers_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+  }
+  sleep_cv_.notify_one();
+}
+
+void FiberJobSystem::NotifyCounterDone() noexcept {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (external_waiters_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  {
+    // a waiter between its check and its wait holds the mutex
+    std::lock_guard<std::mutex> lock(done_mutex_);
+  }
+  done_cv_.notify_all();
+}
+
+void FiberJobSystem::Execute(Job job) noexcept {
+  job.function(job.payload);
+  if (job.counter != nullptr &&
+      job.counter->pending_.fetch_sub(1, std::memory_order_release) == 1) {
+    Get().NotifyCounterDone();
+  }
+}
+
+}  // namespace hw3d
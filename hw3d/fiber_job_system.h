@@ -0,0 +1,161 @@
+﻿#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "chase_lev_deque.h"
+#include "fiber.h"
+#include "job_system.h"
+
+namespace hw3d {
+
+struct FiberJobSystemConfig {
+  // 0: one worker thread per hardware thread
+  unsigned worker_count = 0;
+  // jobs that can be in progress (running or suspended) at once
+  std::uint32_t fiber_count = 128;
+  std::size_t stack_size = 64 * 1024;
+};
+
+// Job system whose jobs run on fibers, so a job can Wait() on a counter
+// without blocking its worker thread: the fiber is parked, the worker picks
+// up other work, and the fiber later resumes on whichever worker sees the
+// counter reach zero. All fibers and their stacks are allocated by Start().
+//
+// Unlike JobSystem, every worker is a dedicated thread; other threads
+// (such as the one running the frame loop) submit root jobs and block in
+// Wait() until they finish, so the workers alone keep the cores busy.
+//
+// Jobs are the same Job/JobCounter as JobSystem's. Per worker, submitted
+// jobs go to a Chase-Lev deque that other workers steal from; submissions
+// from outside the workers go to a shared queue. When every fiber is in use
+// a job runs on the worker thread's own stack instead; if it waits, that
+// worker runs other jobs until the counter is done rather than parking.
+class FiberJobSystem {
+ public:
+  static constexpr std::size_t kJobsPerWorker = 4096;
+
+  static FiberJobSystem& Get() noexcept;
+
+  FiberJobSystem(const FiberJobSystem&) = delete;
+  FiberJobSystem& operator=(const FiberJobSystem&) = delete;
+
+  // Allocates the fibers and starts the workers. Returns false if already
+  // running or if the fibers could not be created.
+  bool Start(const FiberJobSystemConfig& config = FiberJobSystemConfig());
+  // Finishes every queued and suspended job and joins the workers.
+  void Stop() noexcept;
+
+  bool IsRunning() const noexcept {
+    return running_.load(std::memory_order_acquire);
+  }
+  unsigned worker_count() const noexcept {
+    return static_cast<unsigned>(workers_.size());
+  }
+  // True when called from a job.
+  static bool InFiber() noexcept;
+
+  void Submit(const Job& job) noexcept;
+  // Queues a callable; see MakeJob() for what it may capture.
+  template <typename F>
+  void Run(F&& f, JobCounter* counter = nullptr) noexcept {
+    Submit(MakeJob(std::forward<F>(f), counter));
+  }
+
+  // Inside a job: suspends the job until `counter` is done; the worker runs
+  // other jobs meanwhile. Elsewhere: blocks the calling thread, sleeping
+  // after a short spin until a job finishes a counter.
+  void Wait(const JobCounter& counter) noexcept;
+
+ private:
+  struct Worker;
+
+  enum class FiberState : std::uint8_t {
+    kRunning,
+    kFinished,
+    kWaiting,
+  };
+
+  struct Fiber {
+    FiberContext context;
+    Job job;
+    // the worker currently running this fiber; it switches back there
+    Worker* worker = nullptr;
+    const JobCounter* waiting_on = nullptr;
+    FiberState state = FiberState::kFinished;
+  };
+
+  struct alignas(64) Worker {
+    explicit Worker(unsigned index);
+
+    unsigned index;
+    // the worker thread's own context, which runs the scheduling loop
+    FiberContext context;
+    ChaseLevDeque<Job> deque;
+    JobSlots slots;
+    std::uint32_t rng;
+  };
+
+  FiberJobSystem() = default;
+  ~FiberJobSystem();
+
+  static void FiberMain(void* arg);
+  void WorkerLoop(unsigned index) noexcept;
+  // Resumes a fiber whose counter is done, or starts a queued job.
+  bool RunOne(Worker& self) noexcept;
+  void SwitchTo(Worker& self, Fiber& fiber) noexcept;
+  Fiber* TakeReadyFiber() noexcept;
+  // Pushes onto the worker's own deque; false if it is full.
+  bool Queue(Worker& self, const Job& job) noexcept;
+  bool TakeJob(Worker& self, Job& out) noexcept;
+  Fiber* AcquireFiber() noexcept;
+  bool AnyWorkQueued() const noexcept;
+  bool AnyFiberBusy() noexcept;
+  void Sleep() noexcept;
+  void WakeOne() noexcept;
+  // Wakes threads blocked in Wait() outside the workers.
+  void NotifyCounterDone() noexcept;
+  static void Execute(Job job) noexcept;
+
+ private:
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::atomic<bool> running_{false};
+  std::atomic<bool> stop_requested_{false};
+
+  std::unique_ptr<Fiber[]> fibers_;
+  std::uint32_t fiber_count_ = 0;
+  std::unique_ptr<unsigned char[]> stacks_;
+
+  std::mutex free_mutex_;
+  std::vector<Fiber*> free_fibers_;
+
+  // suspended fibers; scanned for counters that reached zero
+  std::mutex wait_mutex_;
+  std::vector<Fiber*> waiting_;
+  std::atomic<std::uint32_t> waiting_count_{0};
+
+  // jobs submitted from threads that are not workers
+  std::mutex inject_mutex_;
+  std::deque<Job> injected_;
+  std::atomic<std::uint32_t> injected_count_{0};
+
+  std::mutex sleep_mutex_;
+  std::condition_variable sleep_cv_;
+  std::atomic<unsigned> sleepers_{0};
+
+  // threads that are not workers, blocked in Wait()
+  std::mutex done_mutex_;
+  std::condition_variable done_cv_;
+  std::atomic<unsigned> external_waiters_{0};
+};
+
+}  // namespace hw3d
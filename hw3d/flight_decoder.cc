@@ -0,0 +1,168 @@
+﻿#include "flight_recorder.h"
+
+#include <cstring>
+#include <memory>
+
+namespace hw3d {
+
+namespace {
+
+std::size_t AlignUp(std::size_t n) noexcept {
+  constexpr std::size_t kAlign = 64;
+  return (n + kAlign - 1) & ~(kAlign - 1);
+}
+
+const char* InputKindName(FlightRecorder::InputKind kind) noexcept {
+  switch (kind) {
+    case FlightRecorder::InputKind::kKeyDown:
+      return "key down";
+    case FlightRecorder::InputKind::kKeyUp:
+      return "key up";
+    case FlightRecorder::InputKind::kChar:
+      return "char";
+    case FlightRecorder::InputKind::kMouseMove:
+      return "mouse move";
+    case FlightRecorder::InputKind::kMouseDown:
+      return "mouse down";
+    case FlightRecorder::InputKind::kMouseUp:
+      return "mouse up";
+    case FlightRecorder::InputKind::kWheel:
+      return "wheel";
+    case FlightRecorder::InputKind::kFocusLost:
+      return "focus lost";
+    case FlightRecorder::InputKind::kResize:
+      return "resize";
+  }
+  return "?";
+}
+
+// First index still present in a ring that has seen `written` entries.
+std::uint64_t OldestIndex(std::uint64_t written, std::uint32_t capacity) {
+  return written > capacity ? written - capacity : 0;
+}
+
+}  // namespace
+
+FlightRecorder::Layout FlightRecorder::ComputeLayout(
+    std::uint32_t frame_capacity,
+    std::uint32_t input_capacity,
+    std::uint32_t error_capacity) noexcept {
+  Layout layout;
+  layout.frames = AlignUp(sizeof(Header));
+  layout.inputs =
+      layout.frames + AlignUp(sizeof(FrameRecord) * frame_capacity);
+  layout.errors =
+      layout.inputs + AlignUp(sizeof(InputRecord) * input_capacity);
+  layout.total =
+      layout.errors + AlignUp(sizeof(ErrorRecord) * error_capacity);
+  return layout;
+}
+
+bool FlightRecorder::WriteReport(const Header& header,
+                                 double age_s,
+                                 std::FILE* f) noexcept {
+  const Layout layout = ComputeLayout(
+      header.frame_capacity, header.input_capacity, header.error_capacity);
+  const auto* storage = reinterpret_cast<const unsigned char*>(&header);
+  const auto* frames =
+      reinterpret_cast<const FrameRecord*>(storage + layout.frames);
+  const auto* inputs =
+      reinterpret_cast<const InputRecord*>(storage + layout.inputs);
+  const auto* errors =
+      reinterpret_cast<const ErrorRecord*>(storage + layout.errors);
+  const std::uint64_t frames_written =
+      header.frames_written.load(std::memory_order_acquire);
+  const std::uint64_t inputs_written =
+      header.inputs_written.load(std::memory_order_acquire);
+  const std::uint64_t errors_written =
+      header.errors_written.load(std::memory_order_acquire);
+
+  std::fprintf(f, "hw3d flight recorder\n");
+  std::fprintf(f, "started at %llu (unix seconds)",
+               static_cast<unsigned long long>(header.start_unix_ns /
+                                               1000000000u));
+  if (age_s >= 0.0) {
+    std::fprintf(f, ", dumped %.6fs later", age_s);
+  }
+  std::fprintf(f, "\n");
+
+  std::fprintf(f, "\n[Frames] %llu total, last %llu\n",
+               static_cast<unsigned long long>(frames_written),
+               static_cast<unsigned long long>(
+                   frames_written -
+                   OldestIndex(frames_written, header.frame_capacity)));
+  std::fprintf(f, "%10s %14s %10s %12s %7s %7s\n", "frame", "end (s)",
+               "ms", "present", "inputs", "errors");
+  for (std::uint64_t i = OldestIndex(frames_written, header.frame_capacity);
+       i < frames_written; i++) {
+    const FrameRecord& r = frames[i % header.frame_capacity];
+    std::fprintf(f, "%10llu %14.6f %10.3f   0x%08lX %7u %7u\n",
+                 static_cast<unsigned long long>(r.index), r.end_ns / 1e9,
+                 r.seconds * 1000.0f,
+                 static_cast<unsigned long>(
+                     static_cast<std::uint32_t>(r.present_result)),
+                 static_cast<unsigned>(r.input_events),
+                 static_cast<unsigned>(r.errors));
+  }
+
+  std::fprintf(f, "\n[Input] %llu total\n",
+               static_cast<unsigned long long>(inputs_written));
+  for (std::uint64_t i = OldestIndex(inputs_written, header.input_capacity);
+       i < inputs_written; i++) {
+    const InputRecord& r = inputs[i % header.input_capacity];
+    std::fprintf(f, "frame %10llu %-10s code %5u at (%d, %d)\n",
+                 static_cast<unsigned long long>(r.frame),
+                 InputKindName(r.kind), static_cast<unsigned>(r.code), r.x,
+                 r.y);
+  }
+
+  std::fprintf(f, "\n[Errors] %llu total\n",
+               static_cast<unsigned long long>(errors_written));
+  for (std::uint64_t i = OldestIndex(errors_written, header.error_capacity);
+       i < errors_written; i++) {
+    const ErrorRecord& r = errors[i % header.error_capacity];
+    // bounded: a file from a crashed process may end mid-record
+    std::fprintf(f, "frame %10llu %14.6fs 0x%08lX %.*s:%d\n",
+                 static_cast<unsigned long long>(r.frame), r.ns / 1e9,
+                 static_cast<unsigned long>(static_cast<std::uint32_t>(r.code)),
+                 static_cast<int>(ErrorRecord::kFileChars), r.file,
+                 static_cast<int>(r.line));
+  }
+
+  return std::ferror(f) == 0;
+}
+
+bool FlightRecorder::DecodeFile(const char* path, std::FILE* out) {
+  std::FILE* in = std::fopen(path, "rb");
+  if (in == nullptr) {
+    return false;
+  }
+  alignas(Header) unsigned char header_bytes[sizeof(Header)];
+  const auto* header = reinterpret_cast<const Header*>(header_bytes);
+  bool ok = std::fread(header_bytes, sizeof(header_bytes), 1, in) == 1 &&
+            std::memcmp(header->magic, Header::kMagic,
+                        sizeof(Header::kMagic)) == 0 &&
+            header->version == Header::kVersion &&
+            header->frame_capacity != 0 && header->input_capacity != 0 &&
+            header->error_capacity != 0;
+  Layout layout{};
+  if (ok) {
+    layout = ComputeLayout(header->frame_capacity, header->input_capacity,
+                           header->error_capacity);
+    // check the size before allocating for what the header claims
+    ok = std::fseek(in, 0, SEEK_END) == 0 &&
+         std::ftell(in) >= static_cast<long>(layout.total) &&
+         std::fseek(in, 0, SEEK_SET) == 0;
+  }
+  // new[] aligns for any record type; the report reads the rings in place
+  std::unique_ptr<unsigned char[]> storage;
+  if (ok) {
+    storage.reset(new unsigned char[layout.total]);
+    ok = std::fread(storage.get(), 1, layout.total, in) == layout.total;
+  }
+  std::fclose(in);
+  return ok && WriteReport(*reinterpret_cast<const Header*>(storage.get()),
+                           -1.0, out);
+}
+
+}  // namespace hw3d
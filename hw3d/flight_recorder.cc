@@ -0,0 +1,202 @@
+﻿#include "flight_recorder.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include "memory_tracker.h"
+
+namespace hw3d {
+
+namespace {
+
+std::uint64_t SteadyNs() noexcept {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+std::int16_t ClampToI16(int v) noexcept {
+  return static_cast<std::int16_t>(v < -32768 ? -32768
+                                   : v > 32767  ? 32767
+                                                : v);
+}
+
+}  // namespace
+
+FlightRecorder& FlightRecorder::Get() noexcept {
+  static FlightRecorder recorder;
+  return recorder;
+}
+
+FlightRecorder::~FlightRecorder() {
+  Stop();
+}
+
+bool FlightRecorder::Start(const FlightRecorderConfig& config) {
+  if (IsRecording() || config.frame_capacity == 0 ||
+      config.input_capacity == 0 || config.error_capacity == 0) {
+    return false;
+  }
+  HW3D_MEMORY_SCOPE(MemoryTag::kLogging);
+  const Layout layout = ComputeLayout(
+      config.frame_capacity, config.input_capacity, config.error_capacity);
+
+  unsigned char* storage;
+  if (config.mapped_path != nullptr) {
+    if (!mapped_storage_.Open(config.mapped_path, layout.total)) {
+      return false;
+    }
+    storage = static_cast<unsigned char*>(mapped_storage_.data());
+  } else {
+    heap_storage_.reset(new unsigned char[layout.total]);
+    storage = heap_storage_.get();
+  }
+  // touch every page now so recording never faults in fresh memory
+  std::memset(storage, 0, layout.total);
+
+  auto* header = new (storage) Header();
+  std::memcpy(header->magic, Header::kMagic, sizeof(Header::kMagic));
+  header->version = Header::kVersion;
+  header->frame_capacity = config.frame_capacity;
+  header->input_capacity = config.input_capacity;
+  header->error_capacity = config.error_capacity;
+  header->start_unix_ns = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count());
+  frames_ = reinterpret_cast<FrameRecord*>(storage + layout.frames);
+  inputs_ = reinterpret_cast<InputRecord*>(storage + layout.inputs);
+  errors_ = reinterpret_cast<ErrorRecord*>(storage + layout.errors);
+  start_ns_ = SteadyNs();
+  frame_inputs_.store(0, std::memory_order_relaxed);
+  frame_errors_.store(0, std::memory_order_relaxed);
+  frame_present_.store(0, std::memory_order_relaxed);
+
+  header_.store(header, std::memory_order_release);
+  return true;
+}
+
+void FlightRecorder::Stop() noexcept {
+  Header* header = header_.exchange(nullptr, std::memory_order_acq_rel);
+  if (header == nullptr) {
+    return;
+  }
+  header->~Header();
+  frames_ = nullptr;
+  inputs_ = nullptr;
+  errors_ = nullptr;
+  mapped_storage_.Close();
+  heap_storage_.reset();
+}
+
+std::uint64_t FlightRecorder::NowNs() const noexcept {
+  return SteadyNs() - start_ns_;
+}
+
+void FlightRecorder::EndFrame(float seconds) noexcept {
+  Header* header = header_.load(std::memory_order_acquire);
+  if (header == nullptr) {
+    return;
+  }
+  const std::uint64_t index =
+      header->frames_written.load(std::memory_order_relaxed);
+  FrameRecord& frame = frames_[index % header->frame_capacity];
+  frame.index = index;
+  frame.end_ns = NowNs();
+  frame.seconds = seconds;
+  frame.present_result =
+      frame_present_.exchange(0, std::memory_order_relaxed);
+  const std::uint32_t inputs =
+      frame_inputs_.exchange(0, std::memory_order_relaxed);
+  frame.input_events =
+      static_cast<std::uint16_t>(inputs < 0xFFFF ? inputs : 0xFFFF);
+  const std::uint32_t errors =
+      frame_errors_.exchange(0, std::memory_order_relaxed);
+  frame.errors =
+      static_cast<std::uint16_t>(errors < 0xFFFF ? errors : 0xFFFF);
+  frame.reserved = 0;
+  // publish after the record is complete
+  header->frames_written.store(index + 1, std::memory_order_release);
+}
+
+void FlightRecorder::RecordInput(InputKind kind,
+                                 int code,
+                                 int x,
+                                 int y) noexcept {
+  Header* header = header_.load(std::memory_order_acquire);
+  if (header == nullptr) {
+    return;
+  }
+  const std::uint64_t index =
+      header->inputs_written.fetch_add(1, std::memory_order_relaxed);
+  InputRecord& input = inputs_[index % header->input_capacity];
+  input.frame = header->frames_written.load(std::memory_order_relaxed);
+  input.kind = kind;
+  input.reserved = 0;
+  input.code = static_cast<std::uint16_t>(code);
+  input.x = ClampToI16(x);
+  input.y = ClampToI16(y);
+  frame_inputs_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FlightRecorder::RecordPresent(HRESULT hr) noexcept {
+  if (!IsRecording()) {
+    return;
+  }
+  // a failure sticks for the rest of the frame; successes only replace
+  // successes
+  if (FAILED(hr) || !FAILED(frame_present_.load(std::memory_order_relaxed))) {
+    frame_present_.store(hr, std::memory_order_relaxed);
+  }
+}
+
+void FlightRecorder::RecordError(HRESULT code,
+                                 const char* file,
+                                 int line) noexcept {
+  Header* header = header_.load(std::memory_order_acquire);
+  if (header == nullptr) {
+    return;
+  }
+  const std::uint64_t index =
+      header->errors_written.fetch_add(1, std::memory_order_relaxed);
+  ErrorRecord& error = errors_[index % header->error_capacity];
+  error.frame = header->frames_written.load(std::memory_order_relaxed);
+  error.ns = NowNs();
+  error.code = code;
+  error.line = line;
+  // keep the end of the path; that is the informative part
+  const char* src = file != nullptr ? file : "";
+  std::size_t length = std::strlen(src);
+  if (length > ErrorRecord::kFileChars - 1) {
+    src += length - (ErrorRecord::kFileChars - 1);
+    length = ErrorRecord::kFileChars - 1;
+  }
+  std::memcpy(error.file, src, length);
+  error.file[length] = '\0';
+  frame_errors_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool FlightRecorder::DumpText(const char* path) const noexcept {
+  const Header* header = header_.load(std::memory_order_acquire);
+  if (header == nullptr) {
+    return false;
+  }
+  std::FILE* f = std::fopen(path, "w");
+  if (f == nullptr) {
+    return false;
+  }
+  const bool ok = WriteReport(*header, NowNs() / 1e9, f);
+  return std::fclose(f) == 0 && ok;
+}
+
+bool FlightRecorder::Flush() noexcept {
+  if (!IsRecording() || !mapped_storage_.IsOpen()) {
+    return false;
+  }
+  return mapped_storage_.Flush();
+}
+
+}  // namespace hw3d
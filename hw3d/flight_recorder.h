@@ -0,0 +1,167 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include "hresult.h"
+#include "mapped_file.h"
+
+namespace hw3d {
+
+struct FlightRecorderConfig {
+  // ring sizes; the oldest entries are overwritten
+  std::uint32_t frame_capacity = 600;
+  std::uint32_t input_capacity = 2048;
+  std::uint32_t error_capacity = 64;
+  // if set, the rings live in a memory-mapped file at this path so they
+  // survive a hard crash; otherwise they live in one heap block
+  const char* mapped_path = nullptr;
+};
+
+// Always-on, fixed-memory record of the last few hundred frames: frame
+// times, input events, Present results and error codes. All storage is
+// reserved by Start(); recording is a handful of stores into ring buffers
+// and never allocates, so it can stay enabled in release builds. Call
+// DumpText() from a crash handler to get a readable report; if the process
+// died without one, tools/hw3d_flight_decode renders the mapped ring file.
+class FlightRecorder {
+ public:
+  enum class InputKind : std::uint8_t {
+    kKeyDown,
+    kKeyUp,
+    kChar,
+    kMouseMove,
+    kMouseDown,
+    kMouseUp,
+    kWheel,
+    kFocusLost,
+    kResize,
+  };
+
+  struct FrameRecord {
+    std::uint64_t index;
+    // ns since Start() when the frame ended
+    std::uint64_t end_ns;
+    float seconds;
+    HRESULT present_result;
+    std::uint16_t input_events;
+    std::uint16_t errors;
+    std::uint32_t reserved;
+  };
+
+  struct InputRecord {
+    std::uint64_t frame;
+    InputKind kind;
+    std::uint8_t reserved;
+    std::uint16_t code;
+    std::int16_t x;
+    std::int16_t y;
+  };
+
+  struct ErrorRecord {
+    static constexpr std::size_t kFileChars = 40;
+
+    std::uint64_t frame;
+    std::uint64_t ns;
+    HRESULT code;
+    std::int32_t line;
+    // tail of the source path, null-terminated
+    char file[kFileChars];
+  };
+
+  static FlightRecorder& Get() noexcept;
+
+  FlightRecorder(const FlightRecorder&) = delete;
+  FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+  // Reserves the rings. Returns false if already recording or if the mapped
+  // file could not be created. Start() and Stop() must not race with the
+  // recording calls; the recorder is meant to live for the whole run.
+  bool Start(const FlightRecorderConfig& config = FlightRecorderConfig());
+  void Stop() noexcept;
+  bool IsRecording() const noexcept {
+    return header_.load(std::memory_order_acquire) != nullptr;
+  }
+
+  // Closes the current frame: stores its duration together with the input,
+  // Present and error activity recorded since the previous EndFrame().
+  // EndFrame() and RecordPresent() must be called from the same thread, the
+  // one that presents; input and errors may be recorded from any thread.
+  void EndFrame(float seconds) noexcept;
+  void RecordInput(InputKind kind, int code, int x, int y) noexcept;
+  void RecordPresent(HRESULT hr) noexcept;
+  void RecordError(HRESULT code, const char* file, int line) noexcept;
+
+  // Writes a text report of everything still in the rings. Meant for catch
+  // handlers: it only reads the rings and writes through stdio.
+  bool DumpText(const char* path) const noexcept;
+  // Pushes a memory-mapped ring file to disk; no-op for heap storage.
+  bool Flush() noexcept;
+
+  // Writes the DumpText() report for a ring file left behind by a recorder
+  // started with `mapped_path`. Returns false if `path` is not a complete
+  // ring file. An entry that was being written when the process died may be
+  // garbled. Defined in flight_decoder.cc so tools can build it alone.
+  static bool DecodeFile(const char* path, std::FILE* out);
+
+ private:
+  // Lives at the start of the storage block so a mapped file is
+  // self-describing.
+  struct Header {
+    static constexpr char kMagic[8] = {'H', 'W', '3', 'D', 'F', 'L', 'T', '1'};
+    static constexpr std::uint32_t kVersion = 1;
+
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t frame_capacity;
+    std::uint32_t input_capacity;
+    std::uint32_t error_capacity;
+    std::uint64_t start_unix_ns;
+    std::atomic<std::uint64_t> frames_written;
+    std::atomic<std::uint64_t> inputs_written;
+    std::atomic<std::uint64_t> errors_written;
+  };
+
+  // Byte offsets of the rings in the storage block, which starts with the
+  // Header.
+  struct Layout {
+    std::size_t frames;
+    std::size_t inputs;
+    std::size_t errors;
+    std::size_t total;
+  };
+
+  FlightRecorder() = default;
+  ~FlightRecorder();
+
+  static Layout ComputeLayout(std::uint32_t frame_capacity,
+                              std::uint32_t input_capacity,
+                              std::uint32_t error_capacity) noexcept;
+  // Writes the report for the storage block that starts at `header`.
+  // `age_s` is the time since Start(), or negative if unknown.
+  static bool WriteReport(const Header& header,
+                          double age_s,
+                          std::FILE* f) noexcept;
+
+  std::uint64_t NowNs() const noexcept;
+
+ private:
+  std::atomic<Header*> header_{nullptr};
+  FrameRecord* frames_ = nullptr;
+  InputRecord* inputs_ = nullptr;
+  ErrorRecord* errors_ = nullptr;
+  std::uint64_t start_ns_ = 0;
+
+  // activity in the frame currently being recorded
+  std::atomic<std::uint32_t> frame_inputs_{0};
+  std::atomic<std::uint32_t> frame_errors_{0};
+  std::atomic<HRESULT> frame_present_{0};
+
+  std::unique_ptr<unsigned char[]> heap_storage_;
+  MappedFile mapped_storage_;
+};
+
+}  // namespace hw3d
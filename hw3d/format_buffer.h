@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+namespace hw3d {
+
+// Fixed-capacity, null-terminated character buffer for building diagnostic
+// text without touching the heap. Appends never throw; text that does not fit
+// is truncated and `truncated()` reports it.
+template <std::size_t Capacity>
+class FormatBuffer {
+  static_assert(Capacity > 1, "FormatBuffer needs room for a terminator");
+
+ public:
+  FormatBuffer() noexcept { data_[0] = '\0'; }
+
+  void Clear() noexcept {
+    size_ = 0;
+    truncated_ = false;
+    data_[0] = '\0';
+  }
+
+  FormatBuffer& Append(std::string_view s) noexcept {
+    std::size_t n = s.size();
+    if (n > Remaining()) {
+      n = Remaining();
+      truncated_ = true;
+    }
+    if (n > 0) {
+      std::memcpy(data_ + size_, s.data(), n);
+      size_ += n;
+    }
+    data_[size_] = '\0';
+    return *this;
+  }
+
+  FormatBuffer& Append(const char* s) noexcept {
+    return Append(s != nullptr ? std::string_view(s) : std::string_view());
+  }
+
+  FormatBuffer& Append(char c) noexcept {
+    if (Remaining() == 0) {
+      truncated_ = true;
+      return *this;
+    }
+    data_[size_++] = c;
+    data_[size_] = '\0';
+    return *this;
+  }
+
+  template <typename Int,
+            typename = std::enable_if_t<std::is_integral_v<Int>>>
+  FormatBuffer& AppendDecimal(Int value) noexcept {
+    if constexpr (std::is_signed_v<Int>) {
+      if (value < 0) {
+        Append('-');
+        // negate in unsigned space so the minimum value does not overflow
+        return AppendUnsigned(~static_cast<std::uint64_t>(value) + 1u);
+      }
+    }
+    return AppendUnsigned(static_cast<std::uint64_t>(value));
+  }
+
+  // Upper-case hexadecimal without prefix, zero-padded to `min_digits`.
+  FormatBuffer& AppendHex(std::uint64_t value, int min_digits = 1) noexcept {
+    static constexpr char kDigits[] = "0123456789ABCDEF";
+    char digits[16];
+    int n = 0;
+    do {
+      digits[sizeof(digits) - ++n] = kDigits[value & 0xF];
+      value >>= 4;
+    } while (value != 0 && n < 16);
+    while (n < min_digits && n < 16) {
+      digits[sizeof(digits) - ++n] = '0';
+    }
+    return Append(std::string_view(digits + sizeof(digits) - n,
+                                   static_cast<std::size_t>(n)));
+  }
+
+  // Drops trailing spaces, tabs and line breaks (e.g. from FormatMessage).
+  FormatBuffer& TrimTrailingWhitespace() noexcept {
+    while (size_ > 0) {
+      const char c = data_[size_ - 1];
+      if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+        break;
+      }
+      --size_;
+    }
+    data_[size_] = '\0';
+    return *this;
+  }
+
+  std::string_view view() const noexcept { return {data_, size_}; }
+  const char* c_str() const noexcept { return data_; }
+  std::size_t size() const noexcept { return size_; }
+  bool empty() const noexcept { return size_ == 0; }
+  bool truncated() const noexcept { return truncated_; }
+  static constexpr std::size_t capacity() noexcept { return Capacity - 1; }
+
+ private:
+  std::size_t Remaining() const noexcept { return Capacity - 1 - size_; }
+
+  FormatBuffer& AppendUnsigned(std::uint64_t value) noexcept {
+    char digits[20];
+    std::size_t n = 0;
+    do {
+      digits[sizeof(digits) - ++n] = static_cast<char>('0' + value % 10);
+      value /= 10;
+    } while (value != 0);
+    return Append(std::string_view(digits + sizeof(digits) - n, n));
+  }
+
+ private:
+  std::size_t size_ = 0;
+  bool truncated_ = false;
+  char data_[Capacity];
+};
+
+}  // namespace hw3d
@@ -0,0 +1,142 @@
+﻿#include "frame_arena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+namespace hw3d {
+
+namespace {
+
+constexpr std::size_t kBlockAlign = 64;
+
+[[maybe_unused]] bool IsPowerOfTwo(std::size_t n) noexcept {
+  return n != 0 && (n & (n - 1)) == 0;
+}
+
+std::uintptr_t AlignUp(std::uintptr_t p, std::size_t alignment) noexcept {
+  return (p + alignment - 1) & ~static_cast<std::uintptr_t>(alignment - 1);
+}
+
+// Calling thread's scratch stack.
+struct ScratchStack {
+  std::unique_ptr<unsigned char[]> storage;
+  unsigned char* base = nullptr;
+  std::size_t top = 0;
+};
+
+thread_local ScratchStack tls_scratch;
+
+std::atomic<std::size_t> scratch_peak{0};
+std::atomic<std::uint64_t> scratch_overflows{0};
+
+}  // namespace
+
+FrameArena::FrameArena(std::size_t capacity)
+    : storage_(new unsigned char[capacity + kBlockAlign]),
+      block_(reinterpret_cast<unsigned char*>(
+          AlignUp(reinterpret_cast<std::uintptr_t>(storage_.get()),
+                  kBlockAlign))),
+      capacity_(capacity) {}
+
+void* FrameArena::Allocate(std::size_t size, std::size_t alignment) {
+  assert(IsPowerOfTwo(alignment));
+  const auto base = reinterpret_cast<std::uintptr_t>(block_);
+  std::size_t offset = offset_.load(std::memory_order_relaxed);
+  for (;;) {
+    const std::size_t start = AlignUp(base + offset, alignment) - base;
+    const std::size_t end = start + size;
+    if (end > capacity_) {
+      break;
+    }
+    if (offset_.compare_exchange_weak(offset, end,
+                                      std::memory_order_relaxed)) {
+      return block_ + start;
+    }
+  }
+  return AllocateOverflow(size, alignment);
+}
+
+void* FrameArena::AllocateOverflow(std::size_t size, std::size_t alignment) {
+  std::unique_ptr<unsigned char[]> block(new unsigned char[size + alignment]);
+  void* p = reinterpret_cast<void*>(
+      AlignUp(reinterpret_cast<std::uintptr_t>(block.get()), alignment));
+  std::lock_guard<std::mutex> lock(overflow_mutex_);
+  overflow_.push_back(std::move(block));
+  overflow_bytes_ += size;
+  stats_.overflow_allocations++;
+  return p;
+}
+
+FrameArena::Stats FrameArena::stats() const noexcept {
+  std::lock_guard<std::mutex> lock(overflow_mutex_);
+  return stats_;
+}
+
+void FrameArena::Reset() noexcept {
+  // Allocate() must not run concurrently, but the lock still orders this
+  // with overflow allocations made on other threads earlier in the frame
+  // and with stats() readers
+  std::lock_guard<std::mutex> lock(overflow_mutex_);
+  const std::size_t bytes = used() + overflow_bytes_;
+  stats_.frames++;
+  stats_.last_frame_bytes = bytes;
+  stats_.peak_frame_bytes = std::max(stats_.peak_frame_bytes, bytes);
+  offset_.store(0, std::memory_order_relaxed);
+  overflow_.clear();
+  overflow_bytes_ = 0;
+}
+
+ScratchScope::ScratchScope() {
+  ScratchStack& stack = tls_scratch;
+  if (stack.storage == nullptr) {
+    stack.storage.reset(new unsigned char[kCapacity + kBlockAlign]);
+    stack.base = reinterpret_cast<unsigned char*>(AlignUp(
+        reinterpret_cast<std::uintptr_t>(stack.storage.get()), kBlockAlign));
+  }
+  mark_ = stack.top;
+}
+
+ScratchScope::~ScratchScope() {
+  ScratchStack& stack = tls_scratch;
+  // publish this thread's high-water mark before rewinding
+  std::size_t peak = scratch_peak.load(std::memory_order_relaxed);
+  while (stack.top > peak && !scratch_peak.compare_exchange_weak(
+                                 peak, stack.top, std::memory_order_relaxed)) {
+  }
+  stack.top = mark_;
+  while (overflow_ != nullptr) {
+    auto* block = static_cast<unsigned char*>(overflow_);
+    std::memcpy(&overflow_, block, sizeof(void*));
+    delete[] block;
+  }
+}
+
+void* ScratchScope::Allocate(std::size_t size, std::size_t alignment) {
+  assert(IsPowerOfTwo(alignment));
+  ScratchStack& stack = tls_scratch;
+  const auto base = reinterpret_cast<std::uintptr_t>(stack.base);
+  const std::size_t start = AlignUp(base + stack.top, alignment) - base;
+  if (start + size <= kCapacity) {
+    stack.top = start + size;
+    return stack.base + start;
+  }
+  // link the block first, then align the payload after the link
+  scratch_overflows.fetch_add(1, std::memory_order_relaxed);
+  auto* block = new unsigned char[sizeof(void*) + size + alignment];
+  std::memcpy(block, &overflow_, sizeof(void*));
+  overflow_ = block;
+  return reinterpret_cast<void*>(AlignUp(
+      reinterpret_cast<std::uintptr_t>(block + sizeof(void*)), alignment));
+}
+
+ScratchScope::Stats ScratchScope::stats() noexcept {
+  Stats stats;
+  stats.peak_bytes = scratch_peak.load(std::memory_order_relaxed);
+  stats.overflow_allocations =
+      scratch_overflows.load(std::memory_order_relaxed);
+  return stats;
+}
+
+}  // namespace hw3d
@@ -0,0 +1,152 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace hw3d {
+
+// Wraps an arena as a std::pmr::memory_resource so pmr containers can
+// allocate from it. Deallocation is a no-op; the arena releases everything
+// at once.
+template <typename Arena>
+class ArenaResource : public std::pmr::memory_resource {
+ public:
+  explicit ArenaResource(Arena& arena) noexcept : arena_(arena) {}
+
+ private:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+    return arena_.Allocate(bytes, alignment);
+  }
+  void do_deallocate(void*, std::size_t, std::size_t) override {}
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+  Arena& arena_;
+};
+
+// Linear allocator for data that lives for one frame. Allocating bumps an
+// offset into a block reserved up front; any thread may allocate at once.
+// Nothing is freed one by one: Reset(), typically right after the frame is
+// presented, releases it all and records the frame's usage. Requests that
+// do not fit the block go to the heap until the next Reset() and are
+// counted, so the block can be sized from the stats.
+//
+// Only trivially destructible objects belong here; nothing runs their
+// destructors.
+class FrameArena {
+ public:
+  static constexpr std::size_t kDefaultCapacity = 256 * 1024;
+
+  struct Stats {
+    std::uint64_t frames = 0;
+    // bytes handed out in the last frame and in the busiest one, overflow
+    // included
+    std::size_t last_frame_bytes = 0;
+    std::size_t peak_frame_bytes = 0;
+    std::uint64_t overflow_allocations = 0;
+  };
+
+  explicit FrameArena(std::size_t capacity = kDefaultCapacity);
+  FrameArena(const FrameArena&) = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+
+  // Never fails; see the class comment for requests that do not fit.
+  // `alignment` must be a power of two.
+  void* Allocate(std::size_t size,
+                 std::size_t alignment = alignof(std::max_align_t));
+
+  // Uninitialized storage for `count` objects.
+  template <typename T>
+  T* AllocateArray(std::size_t count) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "arena memory is released without running destructors");
+    return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+  }
+  template <typename T, typename... Args>
+  T* New(Args&&... args) {
+    return new (AllocateArray<T>(1)) T(std::forward<Args>(args)...);
+  }
+
+  // Must not race with Allocate().
+  void Reset() noexcept;
+
+  std::size_t capacity() const noexcept { return capacity_; }
+  // Bytes handed out from the block since the last Reset().
+  std::size_t used() const noexcept {
+    return std::min(offset_.load(std::memory_order_relaxed), capacity_);
+  }
+  Stats stats() const noexcept;
+  std::pmr::memory_resource* resource() noexcept { return &resource_; }
+
+ private:
+  void* AllocateOverflow(std::size_t size, std::size_t alignment);
+
+ private:
+  std::unique_ptr<unsigned char[]> storage_;
+  unsigned char* block_;
+  std::size_t capacity_;
+  std::atomic<std::size_t> offset_{0};
+
+  // guards overflow_, overflow_bytes_ and stats_
+  mutable std::mutex overflow_mutex_;
+  std::vector<std::unique_ptr<unsigned char[]>> overflow_;
+  std::size_t overflow_bytes_ = 0;
+
+  Stats stats_;
+  ArenaResource<FrameArena> resource_{*this};
+};
+
+// Scratch memory for temporaries that die before the current function
+// returns. Each thread has its own stack of scratch memory (reserved the
+// first time the thread opens a scope); a ScratchScope marks the stack and
+// rewinds it when it closes, releasing everything allocated through it.
+// Scopes nest, but allocate only from the innermost open scope of the
+// thread. Requests beyond the stack's capacity go to the heap and are freed
+// when the scope closes.
+class ScratchScope {
+ public:
+  static constexpr std::size_t kCapacity = 256 * 1024;
+
+  struct Stats {
+    // deepest the scratch stack of any thread has been
+    std::size_t peak_bytes = 0;
+    std::uint64_t overflow_allocations = 0;
+  };
+
+  ScratchScope();
+  ~ScratchScope();
+  ScratchScope(const ScratchScope&) = delete;
+  ScratchScope& operator=(const ScratchScope&) = delete;
+
+  void* Allocate(std::size_t size,
+                 std::size_t alignment = alignof(std::max_align_t));
+  template <typename T>
+  T* AllocateArray(std::size_t count) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "scratch memory is released without running destructors");
+    return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+  }
+  std::pmr::memory_resource* resource() noexcept { return &resource_; }
+
+  static Stats stats() noexcept;
+
+ private:
+  std::size_t mark_;
+  // heap blocks for requests that did not fit, chained through their
+  // first bytes
+  void* overflow_ = nullptr;
+  ArenaResource<ScratchScope> resource_{*this};
+};
+
+}  // namespace hw3d
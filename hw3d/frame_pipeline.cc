@@ -0,0 +1,144 @@
+﻿#include "frame_pipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include "memory_tracker.h"
+
+namespace hw3d {
+
+namespace {
+
+std::uint64_t NowNs() noexcept {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+}  // namespace
+
+FramePipeline::FramePipeline(unsigned depth, RenderFunction render)
+    : depth_(std::clamp(depth, 1u, kMaxDepth)),
+      render_(std::move(render)),
+      times_(depth_) {
+  if (depth_ > 1) {
+    render_thread_ = std::thread(&FramePipeline::RenderLoop, this);
+  }
+}
+
+FramePipeline::~FramePipeline() {
+  if (render_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    submitted_cv_.notify_one();
+    render_thread_.join();
+  }
+}
+
+unsigned FramePipeline::BeginFrame() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  RethrowRenderError();
+  const std::uint64_t frame = begun_;
+  if (frame - rendered_ >= depth_) {
+    const std::uint64_t wait_start = NowNs();
+    rendered_cv_.wait(lock, [&] {
+      return frame - rendered_ < depth_ || render_error_ != nullptr;
+    });
+    stats_.stall_ns += NowNs() - wait_start;
+    RethrowRenderError();
+  }
+  begun_ = frame + 1;
+  const unsigned slot = static_cast<unsigned>(frame % depth_);
+  times_[slot].begin_ns = NowNs();
+  return slot;
+}
+
+void FramePipeline::EndFrame() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  RethrowRenderError();
+  const std::uint64_t frame = submitted_;
+  SlotTimes& times = times_[frame % depth_];
+  times.end_ns = NowNs();
+  stats_.simulate_ns += times.end_ns - times.begin_ns;
+  submitted_ = frame + 1;
+  if (depth_ == 1) {
+    lock.unlock();
+    try {
+      RenderFrame(frame);
+    } catch (...) {
+      // as RenderLoop does: the frame never finishes, so later calls must
+      // rethrow rather than wait for it
+      lock.lock();
+      render_error_ = std::current_exception();
+      throw;
+    }
+    return;
+  }
+  lock.unlock();
+  submitted_cv_.notify_one();
+}
+
+void FramePipeline::Flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  rendered_cv_.wait(lock, [this] {
+    return rendered_ == submitted_ || render_error_ != nullptr;
+  });
+  RethrowRenderError();
+}
+
+FramePipeline::Stats FramePipeline::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void FramePipeline::RenderLoop() noexcept {
+  HW3D_MEMORY_SCOPE(MemoryTag::kGraphics);
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    submitted_cv_.wait(lock,
+                       [this] { return rendered_ < submitted_ || stopping_; });
+    if (rendered_ == submitted_) {
+      return;  // stopping, and everything handed over is rendered
+    }
+    const std::uint64_t frame = rendered_;
+    lock.unlock();
+    try {
+      RenderFrame(frame);
+    } catch (...) {
+      lock.lock();
+      render_error_ = std::current_exception();
+      rendered_cv_.notify_all();
+      return;
+    }
+    lock.lock();
+  }
+}
+
+void FramePipeline::RenderFrame(std::uint64_t frame) {
+  const unsigned slot = static_cast<unsigned>(frame % depth_);
+  const std::uint64_t start = NowNs();
+  render_(slot);
+  const std::uint64_t end = NowNs();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::uint64_t latency = end - times_[slot].begin_ns;
+    stats_.frames++;
+    stats_.render_ns += end - start;
+    stats_.total_latency_ns += latency;
+    stats_.max_latency_ns = std::max(stats_.max_latency_ns, latency);
+    rendered_ = frame + 1;
+  }
+  rendered_cv_.notify_one();
+}
+
+void FramePipeline::RethrowRenderError() {
+  if (render_error_ != nullptr) {
+    std::rethrow_exception(render_error_);
+  }
+}
+
+}  // namespace hw3d
@@ -0,0 +1,95 @@
+﻿#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hw3d {
+
+// Overlaps the simulation of frame N+1 with the rendering of frame N. The
+// caller simulates into one of `depth` frame slots between BeginFrame() and
+// EndFrame(); a render thread then calls `render(slot)` for each finished
+// frame in order. Per-frame render data lives in the caller's own array
+// indexed by slot, so each stage only ever touches its own slot.
+//
+// Depth 1 renders inline in EndFrame(), with no render thread. Depth 2 lets
+// simulation run one frame ahead of rendering; each extra slot lets it run
+// one frame further ahead at the cost of one more frame of latency.
+//
+// An exception thrown by `render` stops the pipeline. At depth 1 it leaves
+// the EndFrame() that rendered inline; otherwise it stops the render thread
+// and is rethrown from the next BeginFrame(), EndFrame() or Flush() on the
+// caller's thread. Either way every later call rethrows it.
+class FramePipeline {
+ public:
+  static constexpr unsigned kMaxDepth = 8;
+
+  struct Stats {
+    // frames fully rendered
+    std::uint64_t frames = 0;
+    // BeginFrame() to the end of render, over all rendered frames
+    std::uint64_t total_latency_ns = 0;
+    std::uint64_t max_latency_ns = 0;
+    std::uint64_t simulate_ns = 0;
+    std::uint64_t render_ns = 0;
+    // time BeginFrame() waited for the render stage to free a slot
+    std::uint64_t stall_ns = 0;
+  };
+
+  using RenderFunction = std::function<void(unsigned slot)>;
+
+  // `depth` is clamped to [1, kMaxDepth].
+  FramePipeline(unsigned depth, RenderFunction render);
+  // Renders every frame already handed over, then stops the render thread.
+  ~FramePipeline();
+  FramePipeline(const FramePipeline&) = delete;
+  FramePipeline& operator=(const FramePipeline&) = delete;
+
+  unsigned depth() const noexcept { return depth_; }
+
+  // Returns the slot to simulate the next frame into, waiting while every
+  // slot is still queued for or being rendered.
+  unsigned BeginFrame();
+  // Hands the slot from the last BeginFrame() to the render stage.
+  void EndFrame();
+  // Waits until every frame handed over has been rendered.
+  void Flush();
+
+  Stats stats() const;
+
+ private:
+  struct SlotTimes {
+    std::uint64_t begin_ns = 0;
+    std::uint64_t end_ns = 0;
+  };
+
+  void RenderLoop() noexcept;
+  // Renders the oldest submitted frame; called without the lock held.
+  void RenderFrame(std::uint64_t frame);
+  // Caller thread, with the lock held.
+  void RethrowRenderError();
+
+ private:
+  const unsigned depth_;
+  RenderFunction render_;
+  std::vector<SlotTimes> times_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable submitted_cv_;
+  std::condition_variable rendered_cv_;
+  // frame counters; slot = frame % depth
+  std::uint64_t begun_ = 0;
+  std::uint64_t submitted_ = 0;
+  std::uint64_t rendered_ = 0;
+  bool stopping_ = false;
+  std::exception_ptr render_error_;
+  Stats stats_;
+
+  std::thread render_thread_;
+};
+
+}  // namespace hw3d
@@ -0,0 +1,504 @@
+﻿#include "frustum_culling.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "simd_config.h"
+
+namespace hw3d {
+
+namespace {
+
+// Volumes tested per loop iteration.
+#if defined(HW3D_SIMD_AVX512)
+constexpr std::size_t kBatch = 16;
+#else
+constexpr std::size_t kBatch = 8;
+#endif
+
+// The 4-wide path works on Vec4. SSE has no broadcast load, so its planes
+// are splatted once per call rather than once per batch.
+#if !defined(HW3D_SIMD_AVX2) && \
+    (defined(HW3D_MATH_SSE) || defined(HW3D_MATH_NEON))
+#define HW3D_CULL_VEC4 1
+#endif
+
+// The six planes split into arrays, with the normal's absolute values for
+// the box test.
+struct Planes {
+  float nx[Frustum::kSideCount];
+  float ny[Frustum::kSideCount];
+  float nz[Frustum::kSideCount];
+  float d[Frustum::kSideCount];
+  float ax[Frustum::kSideCount];
+  float ay[Frustum::kSideCount];
+  float az[Frustum::kSideCount];
+#if defined(HW3D_CULL_VEC4)
+  Vec4 splat_nx[Frustum::kSideCount];
+  Vec4 splat_ny[Frustum::kSideCount];
+  Vec4 splat_nz[Frustum::kSideCount];
+  Vec4 splat_d[Frustum::kSideCount];
+  Vec4 splat_ax[Frustum::kSideCount];
+  Vec4 splat_ay[Frustum::kSideCount];
+  Vec4 splat_az[Frustum::kSideCount];
+#endif
+
+  explicit Planes(const Frustum& frustum) noexcept {
+    for (int k = 0; k < Frustum::kSideCount; k++) {
+      const Float4& p = frustum.planes[k];
+      nx[k] = p.x;
+      ny[k] = p.y;
+      nz[k] = p.z;
+      d[k] = p.w;
+      ax[k] = std::fabs(p.x);
+      ay[k] = std::fabs(p.y);
+      az[k] = std::fabs(p.z);
+#if defined(HW3D_CULL_VEC4)
+      splat_nx[k] = VecSplat(nx[k]);
+      splat_ny[k] = VecSplat(ny[k]);
+      splat_nz[k] = VecSplat(nz[k]);
+      splat_d[k] = VecSplat(d[k]);
+      splat_ax[k] = VecSplat(ax[k]);
+      splat_ay[k] = VecSplat(ay[k]);
+      splat_az[k] = VecSplat(az[k]);
+#endif
+    }
+  }
+};
+
+// Set bits of every byte. A table rather than a popcount instruction,
+// which x86 builds cannot assume below SSE4.2; the lookup stays off the
+// loop's dependency chain anyway.
+constexpr std::array<std::uint8_t, 256> MakeBitCounts() {
+  std::array<std::uint8_t, 256> table{};
+  for (int i = 1; i < 256; i++) {
+    table[i] = static_cast<std::uint8_t>(table[i >> 1] + (i & 1));
+  }
+  return table;
+}
+
+constexpr std::array<std::uint8_t, 256> kBitCounts = MakeBitCounts();
+
+inline std::uint32_t PopCount(std::uint32_t bits) noexcept {
+  return kBitCounts[bits & 0xFF] + kBitCounts[(bits >> 8) & 0xFF];
+}
+
+// Left-packing by table: for every mask of four lanes, the offsets of its
+// set lanes, first to last. Adding the first index of the group to a row
+// gives the packed indices directly, so no shuffle is needed.
+struct PackTable4 {
+  alignas(16) std::int32_t offsets[16][4];
+};
+
+constexpr PackTable4 MakePackTable4() {
+  PackTable4 table{};
+  for (int mask = 0; mask < 16; mask++) {
+    int n = 0;
+    for (int lane = 0; lane < 4; lane++) {
+      if ((mask >> lane) & 1) {
+        table.offsets[mask][n++] = lane;
+      }
+    }
+  }
+  return table;
+}
+
+[[maybe_unused]] constexpr PackTable4 kPackTable4 = MakePackTable4();
+
+// The same for eight lanes, one nibble per offset.
+constexpr std::array<std::uint32_t, 256> MakePackTable8() {
+  std::array<std::uint32_t, 256> table{};
+  for (std::uint32_t mask = 0; mask < 256; mask++) {
+    std::uint32_t n = 0;
+    for (std::uint32_t lane = 0; lane < 8; lane++) {
+      if ((mask >> lane) & 1) {
+        table[mask] |= lane << (4 * n++);
+      }
+    }
+  }
+  return table;
+}
+
+[[maybe_unused]] constexpr std::array<std::uint32_t, 256> kPackTable8 =
+    MakePackTable8();
+
+// Stores first + (index of each set bit of `mask`) at `out`, in order, and
+// returns how many. `mask` has kBatch bits; always writes kBatch entries.
+inline std::size_t LeftPack(std::uint32_t mask,
+                            std::uint32_t first,
+                            std::uint32_t* out) noexcept {
+#if defined(HW3D_SIMD_AVX512)
+  const __m512i index = _mm512_add_epi32(
+      _mm512_set1_epi32(static_cast<int>(first)),
+      _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+  // compress into a register, then store: a compressing store to memory
+  // is microcoded on some cores
+  _mm512_storeu_si512(
+      out, _mm512_maskz_compress_epi32(static_cast<__mmask16>(mask), index));
+  return PopCount(mask);
+#elif defined(HW3D_SIMD_AVX2)
+  const __m256i offsets = _mm256_and_si256(
+      _mm256_srlv_epi32(
+          _mm256_set1_epi32(static_cast<int>(kPackTable8[mask])),
+          _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28)),
+      _mm256_set1_epi32(0xF));
+  _mm256_storeu_si256(
+      reinterpret_cast<__m256i*>(out),
+      _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(first)), offsets));
+  return PopCount(mask);
+#elif defined(HW3D_SIMD_SSE2)
+  const __m128i base = _mm_set1_epi32(static_cast<int>(first));
+  const std::uint32_t low = mask & 0xF;
+  _mm_storeu_si128(
+      reinterpret_cast<__m128i*>(out),
+      _mm_add_epi32(base, _mm_load_si128(reinterpret_cast<const __m128i*>(
+                              kPackTable4.offsets[low]))));
+  const std::size_t n = PopCount(low);
+  _mm_storeu_si128(
+      reinterpret_cast<__m128i*>(out + n),
+      _mm_add_epi32(_mm_add_epi32(base, _mm_set1_epi32(4)),
+                    _mm_load_si128(reinterpret_cast<const __m128i*>(
+                        kPackTable4.offsets[mask >> 4]))));
+  return n + PopCount(mask >> 4);
+#elif defined(HW3D_SIMD_NEON)
+  const int32x4_t base = vdupq_n_s32(static_cast<std::int32_t>(first));
+  const std::uint32_t low = mask & 0xF;
+  vst1q_s32(reinterpret_cast<std::int32_t*>(out),
+            vaddq_s32(base, vld1q_s32(kPackTable4.offsets[low])));
+  const std::size_t n = PopCount(low);
+  vst1q_s32(reinterpret_cast<std::int32_t*>(out + n),
+            vaddq_s32(vaddq_s32(base, vdupq_n_s32(4)),
+                      vld1q_s32(kPackTable4.offsets[mask >> 4])));
+  return n + PopCount(mask >> 4);
+#else
+  std::size_t n = 0;
+  for (std::uint32_t lane = 0; lane < kBatch; lane++) {
+    out[n] = first + lane;
+    n += (mask >> lane) & 1;
+  }
+  return n;
+#endif
+}
+
+// One volume, same arithmetic as the batches; for the tail of a range and
+// for builds without SIMD. A volume is culled when it is entirely outside
+// one plane: d + r < 0, with d the signed distance of its centre and r its
+// extent along the normal (the radius for a sphere). NaN fails every
+// comparison, so it stays visible.
+inline bool AabbVisible(const Planes& p,
+                        const AabbArray& boxes,
+                        std::size_t i) noexcept {
+  bool outside = false;
+  for (int k = 0; k < Frustum::kSideCount; k++) {
+    const float d =
+        boxes.center_x()[i] * p.nx[k] + boxes.center_y()[i] * p.ny[k] +
+        boxes.center_z()[i] * p.nz[k] + p.d[k] +
+        boxes.extent_x()[i] * p.ax[k] + boxes.extent_y()[i] * p.ay[k] +
+        boxes.extent_z()[i] * p.az[k];
+    outside |= d < 0.0f;
+  }
+  return !outside;
+}
+
+inline bool SphereVisible(const Planes& p,
+                          const SphereArray& spheres,
+                          std::size_t i) noexcept {
+  bool outside = false;
+  for (int k = 0; k < Frustum::kSideCount; k++) {
+    const float d = spheres.center_x()[i] * p.nx[k] +
+                    spheres.center_y()[i] * p.ny[k] +
+                    spheres.center_z()[i] * p.nz[k] + p.d[k] +
+                    spheres.radius()[i];
+    outside |= d < 0.0f;
+  }
+  return !outside;
+}
+
+// Visible-lane masks for the kBatch volumes starting at i.
+
+#if defined(HW3D_SIMD_AVX512)
+
+inline std::uint32_t AabbBatch(const Planes& p,
+                               const AabbArray& boxes,
+                               std::size_t i) noexcept {
+  const __m512 cx = _mm512_loadu_ps(boxes.center_x() + i);
+  const __m512 cy = _mm512_loadu_ps(boxes.center_y() + i);
+  const __m512 cz = _mm512_loadu_ps(boxes.center_z() + i);
+  const __m512 ex = _mm512_loadu_ps(boxes.extent_x() + i);
+  const __m512 ey = _mm512_loadu_ps(boxes.extent_y() + i);
+  const __m512 ez = _mm512_loadu_ps(boxes.extent_z() + i);
+  __mmask16 outside = 0;
+  for (int k = 0; k < Frustum::kSideCount; k++) {
+    __m512 d = _mm512_fmadd_ps(cx, _mm512_set1_ps(p.nx[k]),
+                               _mm512_set1_ps(p.d[k]));
+    d = _mm512_fmadd_ps(cy, _mm512_set1_ps(p.ny[k]), d);
+    d = _mm512_fmadd_ps(cz, _mm512_set1_ps(p.nz[k]), d);
+    d = _mm512_fmadd_ps(ex, _mm512_set1_ps(p.ax[k]), d);
+    d = _mm512_fmadd_ps(ey, _mm512_set1_ps(p.ay[k]), d);
+    d = _mm512_fmadd_ps(ez, _mm512_set1_ps(p.az[k]), d);
+    outside |= _mm512_cmp_ps_mask(d, _mm512_setzero_ps(), _CMP_LT_OQ);
+  }
+  return static_cast<std::uint16_t>(~outside);
+}
+
+inline std::uint32_t SphereBatch(const Planes& p,
+                                 const SphereArray& spheres,
+                                 std::size_t i) noexcept {
+  const __m512 cx = _mm512_loadu_ps(spheres.center_x() + i);
+  const __m512 cy = _mm512_loadu_ps(spheres.center_y() + i);
+  const __m512 cz = _mm512_loadu_ps(spheres.center_z() + i);
+  const __m512 r = _mm512_loadu_ps(spheres.radius() + i);
+  __mmask16 outside = 0;
+  for (int k = 0; k < Frustum::kSideCount; k++) {
+    __m512 d = _mm512_fmadd_ps(cx, _mm512_set1_ps(p.nx[k]),
+                               _mm512_add_ps(r, _mm512_set1_ps(p.d[k])));
+    d = _mm512_fmadd_ps(cy, _mm512_set1_ps(p.ny[k]), d);
+    d = _mm512_fmadd_ps(cz, _mm512_set1_ps(p.nz[k]), d);
+    outside |= _mm512_cmp_ps_mask(d, _mm512_setzero_ps(), _CMP_LT_OQ);
+  }
+  return static_cast<std::uint16_t>(~outside);
+}
+
+#elif defined(HW3D_SIMD_AVX2)
+
+inline __m256 MulAdd8(__m256 a, __m256 b, __m256 c) noexcept {
+#if defined(HW3D_MATH_FMA)
+  return _mm256_fmadd_ps(a, b, c);
+#else
+  return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+inline std::uint32_t AabbBatch(const Planes& p,
+                               const AabbArray& boxes,
+                               std::size_t i) noexcept {
+  const __m256 cx = _mm256_loadu_ps(boxes.center_x() + i);
+  const __m256 cy = _mm256_loadu_ps(boxes.center_y() + i);
+  const __m256 cz = _mm256_loadu_ps(boxes.center_z() + i);
+  const __m256 ex = _mm256_loadu_ps(boxes.extent_x() + i);
+  const __m256 ey = _mm256_loadu_ps(boxes.extent_y() + i);
+  const __m256 ez = _mm256_loadu_ps(boxes.extent_z() + i);
+  __m256 outside = _mm256_setzero_ps();
+  for (int k = 0; k < Frustum::kSideCount; k++) {
+    __m256 d = MulAdd8(cx, _mm256_set1_ps(p.nx[k]), _mm256_set1_ps(p.d[k]));
+    d = MulAdd8(cy, _mm256_set1_ps(p.ny[k]), d);
+    d = MulAdd8(cz, _mm256_set1_ps(p.nz[k]), d);
+    d = MulAdd8(ex, _mm256_set1_ps(p.ax[k]), d);
+    d = MulAdd8(ey, _mm256_set1_ps(p.ay[k]), d);
+    d = MulAdd8(ez, _mm256_set1_ps(p.az[k]), d);
+    outside = _mm256_or_ps(
+        outside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_LT_OQ));
+  }
+  return static_cast<std::uint32_t>(_mm256_movemask_ps(outside)) ^ 0xFF;
+}
+
+inline std::uint32_t SphereBatch(const Planes& p,
+                                 const SphereArray& spheres,
+                                 std::size_t i) noexcept {
+  const __m256 cx = _mm256_loadu_ps(spheres.center_x() + i);
+  const __m256 cy = _mm256_loadu_ps(spheres.center_y() + i);
+  const __m256 cz = _mm256_loadu_ps(spheres.center_z() + i);
+  const __m256 r = _mm256_loadu_ps(spheres.radius() + i);
+  __m256 outside = _mm256_setzero_ps();
+  for (int k = 0; k < Frustum::kSideCount; k++) {
+    __m256 d = MulAdd8(cx, _mm256_set1_ps(p.nx[k]),
+                       _mm256_add_ps(r, _mm256_set1_ps(p.d[k])));
+    d = MulAdd8(cy, _mm256_set1_ps(p.ny[k]), d);
+    d = MulAdd8(cz, _mm256_set1_ps(p.nz[k]), d);
+    outside = _mm256_or_ps(
+        outside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_LT_OQ));
+  }
+  return static_cast<std::uint32_t>(_mm256_movemask_ps(outside)) ^ 0xFF;
+}
+
+#elif defined(HW3D_CULL_VEC4)
+
+// Two vectors per batch; only the final compare and mask extraction need
+// intrinsics.
+inline std::uint32_t OutsideBits(Vec4 d) noexcept {
+#if defined(HW3D_MATH_SSE)
+  return static_cast<std::uint32_t>(
+      _mm_movemask_ps(_mm_cmplt_ps(d.v, _mm_setzero_ps())));
+#else
+  const uint32x4_t lt = vcltq_f32(d.v, vdupq_n_f32(0.0f));
+  const int32x4_t shift = {0, 1, 2, 3};
+  return vaddvq_u32(vshlq_u32(vshrq_n_u32(lt, 31), shift));
+#endif
+}
+
+inline std::uint32_t AabbBatch(const Planes& p,
+                               const AabbArray& boxes,
+                               std::size_t i) noexcept {
+  std::uint32_t outside = 0;
+  for (std::size_t half = 0; half < 2; half++) {
+    const std::size_t j = i + 4 * half;
+    const Vec4 cx = math_detail::LoadFloats(boxes.center_x() + j);
+    const Vec4 cy = math_detail::LoadFloats(boxes.center_y() + j);
+    const Vec4 cz = math_detail::LoadFloats(boxes.center_z() + j);
+    const Vec4 ex = math_detail::LoadFloats(boxes.extent_x() + j);
+    const Vec4 ey = math_detail::LoadFloats(boxes.extent_y() + j);
+    const Vec4 ez = math_detail::LoadFloats(boxes.extent_z() + j);
+    std::uint32_t bits = 0;
+    for (int k = 0; k < Frustum::kSideCount; k++) {
+      Vec4 d = MulAdd(cx, p.splat_nx[k], p.splat_d[k]);
+      d = MulAdd(cy, p.splat_ny[k], d);
+      d = MulAdd(cz, p.splat_nz[k], d);
+      d = MulAdd(ex, p.splat_ax[k], d);
+      d = MulAdd(ey, p.splat_ay[k], d);
+      d = MulAdd(ez, p.splat_az[k], d);
+      bits |= OutsideBits(d);
+    }
+    outside |= bits << (4 * half);
+  }
+  return outside ^ 0xFF;
+}
+
+inline std::uint32_t SphereBatch(const Planes& p,
+                                 const SphereArray& spheres,
+                                 std::size_t i) noexcept {
+  std::uint32_t outside = 0;
+  for (std::size_t half = 0; half < 2; half++) {
+    const std::size_t j = i + 4 * half;
+    const Vec4 cx = math_detail::LoadFloats(spheres.center_x() + j);
+    const Vec4 cy = math_detail::LoadFloats(spheres.center_y() + j);
+    const Vec4 cz = math_detail::LoadFloats(spheres.center_z() + j);
+    const Vec4 r = math_detail::LoadFloats(spheres.radius() + j);
+    std::uint32_t bits = 0;
+    for (int k = 0; k < Frustum::kSideCount; k++) {
+      Vec4 d = MulAdd(cx, p.splat_nx[k], r + p.splat_d[k]);
+      d = MulAdd(cy, p.splat_ny[k], d);
+      d = MulAdd(cz, p.splat_nz[k], d);
+      bits |= OutsideBits(d);
+    }
+    outside |= bits << (4 * half);
+  }
+  return outside ^ 0xFF;
+}
+
+#else
+
+inline std::uint32_t AabbBatch(const Planes& p,
+                               const AabbArray& boxes,
+                               std::size_t i) noexcept {
+  std::uint32_t bits = 0;
+  for (std::uint32_t lane = 0; lane < kBatch; lane++) {
+    bits |= static_cast<std::uint32_t>(AabbVisible(p, boxes, i + lane))
+            << lane;
+  }
+  return bits;
+}
+
+inline std::uint32_t SphereBatch(const Planes& p,
+                                 const SphereArray& spheres,
+                                 std::size_t i) noexcept {
+  std::uint32_t bits = 0;
+  for (std::uint32_t lane = 0; lane < kBatch; lane++) {
+    bits |= static_cast<std::uint32_t>(SphereVisible(p, spheres, i + lane))
+            << lane;
+  }
+  return bits;
+}
+
+#endif
+
+template <typename BatchFn, typename OneFn>
+std::size_t CullRange(std::size_t begin,
+                      std::size_t end,
+                      std::uint32_t* visible,
+                      const BatchFn& batch,
+                      const OneFn& one) noexcept {
+  std::size_t count = 0;
+  std::size_t i = begin;
+  for (; i + kBatch <= end; i += kBatch) {
+    count += LeftPack(batch(i), static_cast<std::uint32_t>(i), visible + count);
+  }
+  for (; i < end; i++) {
+    visible[count] = static_cast<std::uint32_t>(i);
+    count += one(i) ? 1 : 0;
+  }
+  return count;
+}
+
+}  // namespace
+
+void AabbArray::Resize(std::size_t n) {
+  for (auto* v : {&center_x_, &center_y_, &center_z_, &extent_x_, &extent_y_,
+                  &extent_z_}) {
+    v->resize(n);
+  }
+  size_ = n;
+}
+
+void AabbArray::Set(std::size_t i, const Aabb& box) noexcept {
+  Set(i, Center(box), Extent(box));
+}
+
+void AabbArray::Set(std::size_t i, Float3 center, Float3 extent) noexcept {
+  center_x_[i] = center.x;
+  center_y_[i] = center.y;
+  center_z_[i] = center.z;
+  extent_x_[i] = extent.x;
+  extent_y_[i] = extent.y;
+  extent_z_[i] = extent.z;
+}
+
+void SphereArray::Resize(std::size_t n) {
+  for (auto* v : {&center_x_, &center_y_, &center_z_, &radius_}) {
+    v->resize(n);
+  }
+  size_ = n;
+}
+
+void SphereArray::Set(std::size_t i, const BoundingSphere& sphere) noexcept {
+  center_x_[i] = sphere.center.x;
+  center_y_[i] = sphere.center.y;
+  center_z_[i] = sphere.center.z;
+  radius_[i] = sphere.radius;
+}
+
+std::size_t CullAabbs(const Frustum& frustum,
+                      const AabbArray& boxes,
+                      std::size_t begin,
+                      std::size_t end,
+                      std::uint32_t* visible) noexcept {
+  const Planes planes(frustum);
+  return CullRange(
+      begin, end, visible,
+      [&](std::size_t i) { return AabbBatch(planes, boxes, i); },
+      [&](std::size_t i) { return AabbVisible(planes, boxes, i); });
+}
+
+std::size_t CullSpheres(const Frustum& frustum,
+                        const SphereArray& spheres,
+                        std::size_t begin,
+                        std::size_t end,
+                        std::uint32_t* visible) noexcept {
+  const Planes planes(frustum);
+  return CullRange(
+      begin, end, visible,
+      [&](std::size_t i) { return SphereBatch(planes, spheres, i); },
+      [&](std::size_t i) { return SphereVisible(planes, spheres, i); });
+}
+
+std::size_t FrustumCuller::Cull(const Frustum& frustum,
+                                const AabbArray& boxes,
+                                std::uint32_t* visible) {
+  return compactor_.Run(
+      boxes.size(), visible, &aabb_cost_,
+      [&](std::size_t b, std::size_t e, std::uint32_t* out) {
+        return CullAabbs(frustum, boxes, b, e, out);
+      });
+}
+
+std::size_t FrustumCuller::Cull(const Frustum& frustum,
+                                const SphereArray& spheres,
+                                std::uint32_t* visible) {
+  return compactor_.Run(
+      spheres.size(), visible, &sphere_cost_,
+      [&](std::size_t b, std::size_t e, std::uint32_t* out) {
+        return CullSpheres(frustum, spheres, b, e, out);
+      });
+}
+
+}  // namespace hw3d
@@ -0,0 +1,95 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "bounds.h"
+#include "parallel.h"
+
+// Frustum culling over bounding volumes in structure-of-arrays form. A
+// batch of 16 (AVX-512) or 8 (AVX2, or two SSE/NEON vectors) volumes is
+// tested against all six planes at once, and the indices of the visible
+// ones are left-packed straight into the output list, so there is no
+// per-object branch. FrustumCuller splits large arrays across JobSystem
+// workers.
+
+namespace hw3d {
+
+// Boxes as centre and half-extent arrays.
+class AabbArray {
+ public:
+  std::size_t size() const noexcept { return size_; }
+  void Resize(std::size_t n);
+  void Set(std::size_t i, const Aabb& box) noexcept;
+  void Set(std::size_t i, Float3 center, Float3 extent) noexcept;
+
+  const float* center_x() const noexcept { return center_x_.data(); }
+  const float* center_y() const noexcept { return center_y_.data(); }
+  const float* center_z() const noexcept { return center_z_.data(); }
+  const float* extent_x() const noexcept { return extent_x_.data(); }
+  const float* extent_y() const noexcept { return extent_y_.data(); }
+  const float* extent_z() const noexcept { return extent_z_.data(); }
+
+ private:
+  std::size_t size_ = 0;
+  std::vector<float> center_x_, center_y_, center_z_;
+  std::vector<float> extent_x_, extent_y_, extent_z_;
+};
+
+class SphereArray {
+ public:
+  std::size_t size() const noexcept { return size_; }
+  void Resize(std::size_t n);
+  void Set(std::size_t i, const BoundingSphere& sphere) noexcept;
+
+  const float* center_x() const noexcept { return center_x_.data(); }
+  const float* center_y() const noexcept { return center_y_.data(); }
+  const float* center_z() const noexcept { return center_z_.data(); }
+  const float* radius() const noexcept { return radius_.data(); }
+
+ private:
+  std::size_t size_ = 0;
+  std::vector<float> center_x_, center_y_, center_z_, radius_;
+};
+
+// Writes the indices in [begin, end) of the volumes that intersect the
+// frustum (as Intersects() in bounds.h decides) to `visible`, in ascending
+// order, and returns how many there are. `visible` needs room for
+// end - begin indices: a batch stores a whole vector of them before knowing
+// how many are kept, so entries past the returned count are overwritten
+// too. Volumes with NaN coordinates count as visible.
+std::size_t CullAabbs(const Frustum& frustum,
+                      const AabbArray& boxes,
+                      std::size_t begin,
+                      std::size_t end,
+                      std::uint32_t* visible) noexcept;
+std::size_t CullSpheres(const Frustum& frustum,
+                        const SphereArray& spheres,
+                        std::size_t begin,
+                        std::size_t end,
+                        std::uint32_t* visible) noexcept;
+
+// Culls whole arrays, on several workers when called from a JobSystem
+// worker and the array is large enough to pay for it. Each chunk packs its
+// visible indices in place at its own offset in `visible`, then the chunks
+// are slid together (ParallelCompactor), so the result is the same as the
+// serial one. Keep one culler per call site: it remembers the per-object
+// cost and its scratch.
+class FrustumCuller {
+ public:
+  // `visible` needs room for size() indices.
+  std::size_t Cull(const Frustum& frustum,
+                   const AabbArray& boxes,
+                   std::uint32_t* visible);
+  std::size_t Cull(const Frustum& frustum,
+                   const SphereArray& spheres,
+                   std::uint32_t* visible);
+
+ private:
+  ParallelCost aabb_cost_;
+  ParallelCost sphere_cost_;
+  ParallelCompactor compactor_;
+};
+
+}  // namespace hw3d
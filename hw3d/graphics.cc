@@ -1,9 +1,13 @@
 ﻿
 #include "graphics.h"
 
-#include <sstream>
+#include <cstdint>
+#include <utility>
 
 #include "dxerr.h"
+#include "flight_recorder.h"
+#include "log.h"
+#include "memory_tracker.h"
 
 #pragma comment(lib, "d3d11.lib")
 
@@ -22,28 +26,29 @@ namespace wrl = Microsoft::WRL;
 
 #ifndef NDEBUG
 
-#define GFX_EXCEPTION(hr)                               \
+#define GFX_EXCEPTION_SINCE(hr, cursor)                 \
   hw3d::Graphics::HrException(__LINE__, __FILE__, (hr), \
-                              info_manager_.GetMessages())
-
-#define GFX_THROW_INFO(hrcall) \
-  {                            \
-    info_manager_.Set();       \
-    HRESULT hr = (hrcall);     \
-    if (FAILED(hr))            \
-      throw GFX_EXCEPTION(hr); \
+                              info_manager_.Collect(cursor).Joined())
+
+#define GFX_THROW_INFO(hrcall)                      \
+  {                                                 \
+    const auto info_cursor = info_manager_.Mark();  \
+    HRESULT hr = (hrcall);                          \
+    if (FAILED(hr))                                 \
+      throw GFX_EXCEPTION_SINCE(hr, info_cursor);   \
   }
 
-#define GFX_DEVICE_REMOVED_EXCEPTION(hr)                           \
+#define GFX_DEVICE_REMOVED_EXCEPTION_SINCE(hr, cursor)             \
   hw3d::Graphics::DeviceRemovedException(__LINE__, __FILE__, (hr), \
-                                         info_manager_.GetMessages())
+                                         info_manager_.Collect(cursor).Joined())
 #else  // NDEBUG
 
-#define GFX_EXCEPTION(hr) hw3d::Graphics::HrException(__LINE__, __FILE__, (hr))
+#define GFX_EXCEPTION_SINCE(hr, cursor) \
+  hw3d::Graphics::HrException(__LINE__, __FILE__, (hr))
 
 #define GFX_THROW_INFO(hrcall) GFX_THROW_NOINFO(hrcall)
 
-#define GFX_DEVICE_REMOVED_EXCEPTION(hr) \
+#define GFX_DEVICE_REMOVED_EXCEPTION_SINCE(hr, cursor) \
   hw3d::Graphics::DeviceRemovedException(__LINE__, __FILE__, (hr))
 
 #endif
@@ -55,33 +60,29 @@ Graphics::HrException::HrException(
     int line,
     const char* file,
     HRESULT hr,
-    const std::vector<std::string>& infoMsgs) noexcept
+    std::string_view infoMsgs) noexcept
     : Hw3dException(line, file), hr(hr) {
-  // join all info messages with newlines into single string
-  for (const auto& msg : infoMsgs) {
-    info += msg;
-    info.push_back('\n');
-  }
-  // remove final newline if exists
-  if (!info.empty()) {
-    info.pop_back();
+  // newline-joined messages are copied into the shared report buffer
+  if (!infoMsgs.empty()) {
+    SetDetail(infoMsgs);
   }
+  FlightRecorder::Get().RecordError(hr, file, line);
 }
 
-const char* Graphics::HrException::what() const noexcept {
-  std::ostringstream oss;
-  oss << GetType() << std::endl
-      << "[Error Code] 0x" << std::hex << std::uppercase << GetErrorCode()
-      << std::dec << " (" << (unsigned long)GetErrorCode() << ")" << std::endl
-      << "[Error String] " << GetErrorString() << std::endl
-      << "[Description] " << GetErrorDescription() << std::endl;
+void Graphics::HrException::FormatWhat(WhatBuffer& out) const noexcept {
+  char description[512];
+  const std::string_view info = GetErrorInfo();
+
+  out.Append(GetType()).Append('\n');
+  AppendErrorCode(out, GetErrorCode());
+  out.Append("[Error String] ").Append(GetErrorString()).Append('\n');
+  out.Append("[Description] ")
+      .Append(GetErrorDescription(description, sizeof(description)))
+      .Append('\n');
   if (!info.empty()) {
-    oss << "\n[Error Info]\n" << GetErrorInfo() << std::endl << std::endl;
+    out.Append("\n[Error Info]\n").Append(info).Append("\n\n");
   }
-  oss << GetOriginString();
-
-  what_buffer_ = oss.str();
-  return what_buffer_.c_str();
+  AppendOrigin(out);
 }
 
 const char* Graphics::HrException::GetType() const noexcept {
@@ -92,18 +93,23 @@ HRESULT Graphics::HrException::GetErrorCode() const noexcept {
   return hr;
 }
 
-std::string Graphics::HrException::GetErrorString() const noexcept {
+std::string_view Graphics::HrException::GetErrorString() const noexcept {
   return DXGetErrorString(hr);
 }
 
-std::string Graphics::HrException::GetErrorDescription() const noexcept {
-  char buf[512];
-  DXGetErrorDescription(hr, buf, sizeof(buf));
-  return buf;
+std::string_view Graphics::HrException::GetErrorDescription(
+    char* buffer,
+    std::size_t size) const noexcept {
+  if (size == 0) {
+    return {};
+  }
+  buffer[0] = '\0';
+  DXGetErrorDescription(hr, buffer, size);
+  return buffer;
 }
 
-std::string Graphics::HrException::GetErrorInfo() const noexcept {
-  return info;
+std::string_view Graphics::HrException::GetErrorInfo() const noexcept {
+  return GetDetail();
 }
 
 const char* Graphics::DeviceRemovedException::GetType() const noexcept {
@@ -112,6 +118,7 @@ const char* Graphics::DeviceRemovedException::GetType() const noexcept {
 }
 
 Graphics::Graphics(HWND hwnd) {
+  HW3D_MEMORY_SCOPE(MemoryTag::kGraphics);
   UINT swapCreateFlags = 0u;
 #ifndef NDEBUG
   swapCreateFlags |= D3D11_CREATE_DEVICE_DEBUG;
@@ -156,8 +163,13 @@ Graphics::Graphics(HWND hwnd) {
       0, __uuidof(ID3D11Resource),
       reinterpret_cast<void**>(pBackBuffer.GetAddressOf())));
 
+  wrl::ComPtr<ID3D11RenderTargetView> target;
   GFX_THROW_INFO(device_->CreateRenderTargetView(pBackBuffer.Get(), nullptr,
-                                                 target_.GetAddressOf()));
+                                                 target.GetAddressOf()));
+  target_ = render_targets_.Create(std::move(target));
+
+  HW3D_LOG(LogLevel::kInfo, "d3d11 device created, feature level 0x{:x}",
+           static_cast<unsigned int>(device_->GetFeatureLevel()));
 
   // swap_chain_->GetBuffer(0, __uuidof(ID3D11Texture2D),
   //                        reinterpret_cast<void**>(&target_));
@@ -168,27 +180,33 @@ Graphics::~Graphics() {
 }
 
 void Graphics::Present() {
+  HW3D_MEMORY_SCOPE(MemoryTag::kGraphics);
 #ifndef NDEBUG
-  info_manager_.Set();
+  const auto info_cursor = info_manager_.Mark();
 #endif
   // wait for vertical blanking interval before presenting
   HRESULT hr = swap_chain_->Present(1u, 0u);
+  FlightRecorder::Get().RecordPresent(hr);
   if (!FAILED(hr)) {
     return;
   }
 
+  HW3D_LOG(LogLevel::kError, "Present failed: hr 0x{:x}",
+           static_cast<std::uint32_t>(hr));
   if (hr == DXGI_ERROR_DEVICE_REMOVED) {
+    HW3D_LOG(LogLevel::kError, "device removed, reason 0x{:x}",
+             static_cast<std::uint32_t>(device_->GetDeviceRemovedReason()));
     // Device was removed; throw a specific exception with the removal reason
-    throw GFX_DEVICE_REMOVED_EXCEPTION(hr);
+    throw GFX_DEVICE_REMOVED_EXCEPTION_SINCE(hr, info_cursor);
   } else {
     // For other failures, throw a generic HRESULT exception
-    throw GFX_EXCEPTION(hr);
+    throw GFX_EXCEPTION_SINCE(hr, info_cursor);
   }
 }
 
 void Graphics::ClearBuffer(float red, float green, float blue) {
   const float color[] = {red, green, blue, 1.0f};
-  context_->ClearRenderTargetView(target_.Get(), color);
+  context_->ClearRenderTargetView(render_targets_.Get(target_)->Get(), color);
 }
 
 }  // namespace hw3d
\ No newline at end of file
@@ -4,16 +4,19 @@
 #include <d3d11.h>
 #include <wrl.h>
 
+#include <cstddef>
 #include <string>
-#include <vector>
+#include <string_view>
 
 #include "dxgi_Info_manager.h"
 #include "exception.h"
+#include "resource_registry.h"
+#include "surface.h"
 #include "windows_config.h"
 
 namespace hw3d {
 
-class Graphics {
+class Graphics : public Surface {
  public:
   // Exception class for DirectX HRESULT errors
   class HrException : public Hw3dException {
@@ -21,17 +24,21 @@ class Graphics {
     HrException(int line,
                 const char* file,
                 HRESULT hr,
-                const std::vector<std::string>& infoMsgs = {}) noexcept;
-    const char* what() const noexcept override;
+                std::string_view infoMsgs = {}) noexcept;
     const char* GetType() const noexcept override;
     HRESULT GetErrorCode() const noexcept;
-    std::string GetErrorString() const noexcept;
-    std::string GetErrorDescription() const noexcept;
-    std::string GetErrorInfo() const noexcept;
+    std::string_view GetErrorString() const noexcept;
+    // Writes the DirectX description of the error into `buffer`.
+    std::string_view GetErrorDescription(char* buffer,
+                                         std::size_t size) const noexcept;
+    // Joined debug-layer text, up to kDetailCapacity bytes of it.
+    std::string_view GetErrorInfo() const noexcept;
+
+   protected:
+    void FormatWhat(WhatBuffer& out) const noexcept override;
 
    private:
     HRESULT hr;
-    std::string info;
   };
   // Exception class for device removed errors
   class DeviceRemovedException : public HrException {
@@ -45,19 +52,24 @@ class Graphics {
   Graphics(HWND hWnd);
   Graphics(const Graphics&) = delete;
   Graphics& operator=(const Graphics&) = delete;
-  ~Graphics();
+  ~Graphics() override;
 
-  void Present();
-  void ClearBuffer(float red, float green, float blue);
+  void Present() override;
+  void ClearBuffer(float red, float green, float blue) override;
 
  private:
+  using RenderTargetPool =
+      ResourcePool<Microsoft::WRL::ComPtr<ID3D11RenderTargetView>>;
+
 #ifndef NDEBUG
   DxgiInfoManager info_manager_;
 #endif
   Microsoft::WRL::ComPtr<ID3D11Device> device_;
   Microsoft::WRL::ComPtr<IDXGISwapChain> swap_chain_;
   Microsoft::WRL::ComPtr<ID3D11DeviceContext> context_;
-  Microsoft::WRL::ComPtr<ID3D11RenderTargetView> target_;
+  // views are owned here and referred to by handle
+  RenderTargetPool render_targets_;
+  RenderTargetPool::HandleType target_;
 };
 
 // #define GFX_THROW_FAILED(hrcall)                           \
@@ -0,0 +1,177 @@
+﻿#include "headless_window.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#include "memory_tracker.h"
+
+namespace hw3d {
+
+namespace {
+
+std::uint32_t ToChannel(float value) noexcept {
+  const float clamped = std::min(std::max(value, 0.0f), 1.0f);
+  return static_cast<std::uint32_t>(clamped * 255.0f + 0.5f);
+}
+
+}  // namespace
+
+OffscreenSurface::OffscreenSurface(int width, int height)
+    : width_(width), height_(height) {
+  if (width <= 0 || height <= 0) {
+    throw std::invalid_argument("OffscreenSurface: empty size");
+  }
+  HW3D_MEMORY_SCOPE(MemoryTag::kGraphics);
+  pixels_.resize(static_cast<std::size_t>(width) *
+                 static_cast<std::size_t>(height));
+}
+
+void OffscreenSurface::Resize(int width, int height) {
+  if (width <= 0 || height <= 0) {
+    throw std::invalid_argument("OffscreenSurface: empty size");
+  }
+  HW3D_MEMORY_SCOPE(MemoryTag::kGraphics);
+  pixels_.resize(static_cast<std::size_t>(width) *
+                 static_cast<std::size_t>(height));
+  width_ = width;
+  height_ = height;
+}
+
+void OffscreenSurface::ClearBuffer(float red, float green, float blue) {
+  // RGBA in memory order, opaque alpha
+  const std::uint32_t color = ToChannel(red) | (ToChannel(green) << 8) |
+                              (ToChannel(blue) << 16) | (0xFFu << 24);
+  std::fill(pixels_.begin(), pixels_.end(), color);
+}
+
+ScriptedEventSource& ScriptedEventSource::At(std::uint64_t frame,
+                                             const InputEvent& event) {
+  const auto pos = std::upper_bound(
+      entries_.begin() + next_, entries_.end(), frame,
+      [](std::uint64_t f, const Entry& entry) { return f < entry.frame; });
+  entries_.insert(pos, Entry{frame, event});
+  return *this;
+}
+
+ScriptedEventSource& ScriptedEventSource::QuitAt(std::uint64_t frame,
+                                                 int exit_code) {
+  quit_frame_ = frame;
+  exit_code_ = exit_code;
+  return *this;
+}
+
+std::optional<int> ScriptedEventSource::Generate(
+    std::uint64_t frame,
+    std::vector<InputEvent>& out) {
+  while (next_ < entries_.size() && entries_[next_].frame <= frame) {
+    out.push_back(entries_[next_++].event);
+  }
+  if (quit_frame_ && frame >= *quit_frame_) {
+    return exit_code_;
+  }
+  return std::nullopt;
+}
+
+HeadlessWindow::HeadlessWindow(int width,
+                               int height,
+                               std::unique_ptr<SyntheticEventSource> source,
+                               PumpMode mode)
+    : input_(kbd_, mouse_, width, height),
+      surface_(width, height),
+      source_(std::move(source)) {
+  if (source_ == nullptr) {
+    throw std::invalid_argument("HeadlessWindow: no event source");
+  }
+  HW3D_MEMORY_SCOPE(MemoryTag::kWindow);
+  if (mode == PumpMode::kDedicatedThread) {
+    channel_ = std::make_unique<InputChannel>();
+    source_thread_ = std::thread(&HeadlessWindow::SourceThread, this);
+  }
+}
+
+HeadlessWindow::~HeadlessWindow() {
+  if (source_thread_.joinable()) {
+    stop_.store(true, std::memory_order_relaxed);
+    source_thread_.join();
+  }
+}
+
+std::optional<int> HeadlessWindow::PumpMessages() noexcept {
+  if (exit_code_) {
+    return exit_code_;
+  }
+  if (channel_ != nullptr) {
+    frame_.fetch_add(1, std::memory_order_release);
+    const std::optional<int> exit_code =
+        channel_->Drain([this](const InputEvent& event) { Dispatch(event); });
+    if (!exit_code_) {
+      exit_code_ = exit_code;
+    }
+    return exit_code_;
+  }
+
+  pending_.clear();
+  try {
+    exit_code_ = source_->Generate(frame_.load(std::memory_order_relaxed),
+                                   pending_);
+  } catch (...) {
+    // a broken script ends the run instead of escaping the pump
+    exit_code_ = -1;
+  }
+  frame_.fetch_add(1, std::memory_order_relaxed);
+  // there is no pointer to capture; the dispatcher's request is moot
+  for (const InputEvent& event : pending_) {
+    Dispatch(event);
+  }
+  return exit_code_;
+}
+
+void HeadlessWindow::Dispatch(const InputEvent& event) noexcept {
+  if (event.type == InputEvent::Type::kResize) {
+    try {
+      surface_.Resize(event.x, event.y);
+    } catch (...) {
+      exit_code_ = -1;
+    }
+  }
+  input_.Dispatch(event);
+}
+
+InputChannel::Stats HeadlessWindow::input_stats() const noexcept {
+  return channel_ != nullptr ? channel_->stats() : InputChannel::Stats();
+}
+
+void HeadlessWindow::SourceThread() noexcept {
+  for (std::uint64_t frame = 0;; frame++) {
+    // wait until the game thread has begun pump `frame`
+    while (frame_.load(std::memory_order_acquire) <= frame) {
+      if (stop_.load(std::memory_order_relaxed)) {
+        return;
+      }
+      std::this_thread::yield();
+    }
+    pending_.clear();
+    std::optional<int> exit_code;
+    try {
+      exit_code = source_->Generate(frame, pending_);
+    } catch (...) {
+      exit_code = -1;
+    }
+    // a script can wait for the game thread, so it never drops events
+    for (const InputEvent& event : pending_) {
+      while (!channel_->TryPush(event)) {
+        if (stop_.load(std::memory_order_relaxed)) {
+          return;
+        }
+        std::this_thread::yield();
+      }
+    }
+    if (exit_code) {
+      channel_->RequestQuit(*exit_code);
+      return;
+    }
+  }
+}
+
+}  // namespace hw3d
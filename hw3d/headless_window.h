@@ -0,0 +1,137 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "input_channel.h"
+#include "input_event.h"
+#include "keyboard.h"
+#include "mouse.h"
+#include "platform_window.h"
+#include "surface.h"
+
+namespace hw3d {
+
+// Surface backed by a plain 32-bit RGBA buffer in system memory.
+class OffscreenSurface : public Surface {
+ public:
+  OffscreenSurface(int width, int height);
+
+  void ClearBuffer(float red, float green, float blue) override;
+  void Present() override { ++present_count_; }
+
+  int width() const noexcept { return width_; }
+  int height() const noexcept { return height_; }
+  const std::uint32_t* pixels() const noexcept { return pixels_.data(); }
+  // Reallocates the buffer; its contents are undefined until the next
+  // ClearBuffer().
+  void Resize(int width, int height);
+  std::uint64_t present_count() const noexcept { return present_count_; }
+
+ private:
+  int width_;
+  int height_;
+  std::vector<std::uint32_t> pixels_;
+  std::uint64_t present_count_ = 0;
+};
+
+// Produces the input a headless window sees. Generate() is called once per
+// PumpMessages() with the number of pumps so far.
+class SyntheticEventSource {
+ public:
+  virtual ~SyntheticEventSource() = default;
+
+  // Appends the events for `frame` to `out`. Returning an exit code asks
+  // the window to quit after those events have been dispatched.
+  virtual std::optional<int> Generate(std::uint64_t frame,
+                                      std::vector<InputEvent>& out) = 0;
+};
+
+// Replays a fixed list of events, each at a given frame, and quits at a
+// given frame.
+class ScriptedEventSource : public SyntheticEventSource {
+ public:
+  ScriptedEventSource& At(std::uint64_t frame, const InputEvent& event);
+  ScriptedEventSource& QuitAt(std::uint64_t frame, int exit_code = 0);
+
+  std::optional<int> Generate(std::uint64_t frame,
+                              std::vector<InputEvent>& out) override;
+
+ private:
+  struct Entry {
+    std::uint64_t frame;
+    InputEvent event;
+  };
+  // sorted by frame; entries on the same frame keep insertion order
+  std::vector<Entry> entries_;
+  std::size_t next_ = 0;
+  std::optional<std::uint64_t> quit_frame_;
+  int exit_code_ = 0;
+};
+
+// Window without a display: draws into an OffscreenSurface and feeds its
+// Keyboard and Mouse from a SyntheticEventSource, so the frame loop can run
+// unattended (for example on a build server). A resize event resizes the
+// surface; one with an empty size, or that cannot be allocated, ends the run
+// with exit code -1.
+//
+// With PumpMode::kDedicatedThread the source runs on its own thread and
+// hands events over through an InputChannel, like a Window with a pump
+// thread, which makes the handoff measurable without a display. The source
+// is asked for frame N once the game thread has begun pump N, so its events
+// show up a pump or more later than in caller-thread mode; a source that
+// falls behind catches up in a burst, waiting whenever the channel is full.
+class HeadlessWindow : public PlatformWindow {
+ public:
+  HeadlessWindow(int width,
+                 int height,
+                 std::unique_ptr<SyntheticEventSource> source,
+                 PumpMode mode = PumpMode::kCallerThread);
+  ~HeadlessWindow() override;
+  HeadlessWindow(const HeadlessWindow&) = delete;
+  HeadlessWindow& operator=(const HeadlessWindow&) = delete;
+
+  Keyboard& kbd() noexcept override { return kbd_; }
+  Mouse& mouse() noexcept override { return mouse_; }
+  Surface& surface() noexcept override { return surface_; }
+  OffscreenSurface& offscreen() noexcept { return surface_; }
+
+  void SetTitle(const std::string& title) override { title_ = title; }
+  const std::string& title() const noexcept { return title_; }
+
+  std::optional<int> PumpMessages() noexcept override;
+  // number of PumpMessages() calls so far
+  std::uint64_t frame() const noexcept {
+    return frame_.load(std::memory_order_relaxed);
+  }
+  // Handoff counters of the source thread; all zero without one.
+  InputChannel::Stats input_stats() const noexcept;
+
+ private:
+  Keyboard kbd_;
+  Mouse mouse_;
+  InputDispatcher input_;
+  OffscreenSurface surface_;
+  std::unique_ptr<SyntheticEventSource> source_;
+  // reused between pumps so steady-state pumping does not allocate
+  std::vector<InputEvent> pending_;
+  std::string title_;
+  std::atomic<std::uint64_t> frame_{0};
+  std::optional<int> exit_code_;
+
+  void Dispatch(const InputEvent& event) noexcept;
+
+  // only with PumpMode::kDedicatedThread
+  void SourceThread() noexcept;
+  std::unique_ptr<InputChannel> channel_;
+  std::atomic<bool> stop_{false};
+  std::thread source_thread_;
+};
+
+}  // namespace hw3d
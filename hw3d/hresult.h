@@ -0,0 +1,19 @@
+#pragma once
+
+// HRESULT shim: on Windows this is the real SDK definition, elsewhere a
+// 32-bit stand-in so portable code (error formatting, diagnostics) compiles
+// and can be exercised off Windows.
+#ifdef _WIN32
+#include "windows_config.h"
+#else
+#include <cstdint>
+
+typedef std::int32_t HRESULT;
+
+#ifndef SUCCEEDED
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#endif
+#ifndef FAILED
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#endif
+#endif
@@ -0,0 +1,194 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "input_event.h"
+#include "spsc_queue.h"
+
+namespace hw3d {
+
+// Hands InputEvents and the quit request from a pump thread to the game
+// thread. The pump pushes; the game thread drains once per frame. Each event
+// carries the time it was pushed so the handoff latency can be measured.
+//
+// When the game thread falls behind and the queue fills, Push() spills into
+// an overflow owned by the pump thread, which Flush() empties into the
+// queue in order as room appears. Consecutive mouse moves in the overflow
+// merge into one. Moves, characters, wheel turns and autorepeat are dropped
+// once the overflow is half full. The other half holds key and button
+// transitions, so a burst of mouse moves can never leave a key stuck down.
+// Transitions are dropped only when kOverflowCapacity events are already
+// waiting behind a full queue.
+class InputChannel {
+ public:
+  // Events queued before the game thread drains them.
+  static constexpr std::size_t kCapacity = 1024;
+  // Events held on the pump thread while the queue is full.
+  static constexpr std::size_t kOverflowCapacity = 256;
+
+  struct Stats {
+    std::uint64_t delivered = 0;
+    std::uint64_t dropped = 0;
+    // mouse moves merged into the one before while the queue was full
+    std::uint64_t coalesced = 0;
+    // push-to-drain latency over all delivered events
+    std::uint64_t total_latency_ns = 0;
+    std::uint64_t max_latency_ns = 0;
+  };
+
+  InputChannel() : queue_(kCapacity) { overflow_.reserve(kOverflowCapacity); }
+  InputChannel(const InputChannel&) = delete;
+  InputChannel& operator=(const InputChannel&) = delete;
+
+  // Pump thread only. Queues the event, or holds it in the overflow while
+  // the queue is full. Returns false if it was dropped (and counted).
+  bool Push(const InputEvent& event) noexcept {
+    const Entry entry{event, NowNs()};
+    if (Flush() && queue_.TryPush(entry)) {
+      return true;
+    }
+    return Spill(entry);
+  }
+  // Pump thread only. Leaves a full queue alone so the caller can retry.
+  bool TryPush(const InputEvent& event) noexcept {
+    return Flush() && queue_.TryPush(Entry{event, NowNs()});
+  }
+  // Pump thread only. Moves held events into the queue as far as it has
+  // room; returns true once none are left. Call it while waiting for new
+  // events, so held ones reach the game thread without a new push.
+  bool Flush() noexcept {
+    while (overflow_head_ < overflow_.size()) {
+      if (!queue_.TryPush(overflow_[overflow_head_])) {
+        return false;
+      }
+      overflow_head_++;
+    }
+    overflow_.clear();
+    overflow_head_ = 0;
+    if (quit_pending_) {
+      PublishQuit(*quit_pending_);
+      quit_pending_.reset();
+    }
+    return true;
+  }
+  // Pump thread only. Events pushed before this are still delivered: the
+  // game thread sees the quit once Flush() has emptied the overflow.
+  void RequestQuit(int exit_code) noexcept {
+    if (overflow_head_ < overflow_.size()) {
+      quit_pending_ = exit_code;
+    } else {
+      PublishQuit(exit_code);
+    }
+  }
+
+  // Game thread only: calls `handler(event)` for every queued event in
+  // order, then returns the exit code if the pump asked to quit.
+  template <typename Handler>
+  std::optional<int> Drain(Handler&& handler) {
+    // read the flag first so no event pushed before the quit is missed
+    const bool quit = quit_requested_.load(std::memory_order_acquire);
+    Entry entry;
+    const std::uint64_t now = NowNs();
+    while (queue_.TryPop(entry)) {
+      const std::uint64_t latency = now > entry.push_ns ? now - entry.push_ns
+                                                        : 0;
+      stats_.delivered++;
+      stats_.total_latency_ns += latency;
+      if (latency > stats_.max_latency_ns) {
+        stats_.max_latency_ns = latency;
+      }
+      handler(entry.event);
+    }
+    if (quit) {
+      return quit_code_.load(std::memory_order_relaxed);
+    }
+    return std::nullopt;
+  }
+
+  // Game thread only.
+  Stats stats() const noexcept {
+    Stats stats = stats_;
+    stats.dropped = dropped_.load(std::memory_order_relaxed);
+    stats.coalesced = coalesced_.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+ private:
+  struct Entry {
+    InputEvent event;
+    std::uint64_t push_ns;
+  };
+
+  static std::uint64_t NowNs() noexcept {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+  }
+
+  // Key and button transitions (and focus loss, which releases every key)
+  // change state the game thread keeps; the rest only adds detail.
+  static bool IsTransition(const InputEvent& event) noexcept {
+    switch (event.type) {
+      case InputEvent::Type::kKeyDown:
+        return !event.repeat;
+      case InputEvent::Type::kChar:
+      case InputEvent::Type::kMouseMove:
+      case InputEvent::Type::kWheel:
+        return false;
+      default:
+        return true;
+    }
+  }
+
+  bool Spill(const Entry& entry) noexcept {
+    const InputEvent& event = entry.event;
+    const std::size_t held = overflow_.size() - overflow_head_;
+    if (event.type == InputEvent::Type::kMouseMove && held > 0 &&
+        overflow_.back().event.type == InputEvent::Type::kMouseMove) {
+      // keep the older timestamp: the merged move has waited since then
+      overflow_.back().event = event;
+      coalesced_.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    const std::size_t limit =
+        IsTransition(event) ? kOverflowCapacity : kOverflowCapacity / 2;
+    if (held >= limit) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    if (overflow_.size() == kOverflowCapacity) {
+      // reuse the flushed front instead of growing
+      overflow_.erase(overflow_.begin(),
+                      overflow_.begin() +
+                          static_cast<std::ptrdiff_t>(overflow_head_));
+      overflow_head_ = 0;
+    }
+    overflow_.push_back(entry);
+    return true;
+  }
+
+  void PublishQuit(int exit_code) noexcept {
+    quit_code_.store(exit_code, std::memory_order_relaxed);
+    quit_requested_.store(true, std::memory_order_release);
+  }
+
+  SpscQueue<Entry> queue_;
+  std::atomic<std::uint64_t> dropped_{0};
+  std::atomic<std::uint64_t> coalesced_{0};
+  std::atomic<bool> quit_requested_{false};
+  std::atomic<int> quit_code_{0};
+  // owned by the pump thread; entries before overflow_head_ are queued
+  std::vector<Entry> overflow_;
+  std::size_t overflow_head_ = 0;
+  std::optional<int> quit_pending_;
+  // owned by the game thread
+  Stats stats_;
+};
+
+}  // namespace hw3d
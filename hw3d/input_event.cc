@@ -0,0 +1,123 @@
+﻿#include "input_event.h"
+
+#include "flight_recorder.h"
+#include "memory_tracker.h"
+
+namespace hw3d {
+
+namespace {
+
+// button codes in the flight recorder (same values as VK_LBUTTON/VK_RBUTTON)
+constexpr int kLeftButton = 1;
+constexpr int kRightButton = 2;
+
+void Record(FlightRecorder::InputKind kind, int code, int x, int y) noexcept {
+  FlightRecorder::Get().RecordInput(kind, code, x, y);
+}
+
+}  // namespace
+
+MouseCapture MouseCaptureTracker::Update(const InputEvent& event) noexcept {
+  const bool inside = InClientArea(event.x, event.y);
+  switch (event.type) {
+    case InputEvent::Type::kMouseMove:
+      // in client region -> enter + capture mouse (if not previously in
+      // window)
+      if (inside) {
+        if (!in_window_) {
+          in_window_ = true;
+          return MouseCapture::kAcquire;
+        }
+      } else if (!event.buttons_held) {
+        // button up -> release capture / leave
+        in_window_ = false;
+        return MouseCapture::kRelease;
+      }
+      // not in client region with a button down -> maintain capture
+      break;
+    // release mouse if a press or release lands outside of window
+    case InputEvent::Type::kLeftDown:
+    case InputEvent::Type::kRightUp:
+      if (!inside) {
+        in_window_ = false;
+        return MouseCapture::kRelease;
+      }
+      break;
+    // the next move decides whether the mouse is still inside
+    case InputEvent::Type::kResize:
+      width_ = event.x;
+      height_ = event.y;
+      break;
+    default:
+      break;
+  }
+  return MouseCapture::kKeep;
+}
+
+MouseCapture InputDispatcher::Dispatch(const InputEvent& event) noexcept {
+  using Kind = FlightRecorder::InputKind;
+  HW3D_MEMORY_SCOPE(MemoryTag::kInput);
+  const MouseCapture capture = capture_.Update(event);
+  switch (event.type) {
+    case InputEvent::Type::kKeyDown:
+      // Only handle the key press event the first time a key is pressed,
+      // preventing repeated triggers when holding down the key, unless
+      // auto-repeat is enabled.
+      if (!event.repeat || kbd_.AutorepeatIsEnabled()) {
+        Record(Kind::kKeyDown, event.code, 0, 0);
+        kbd_.OnKeyPressed(static_cast<unsigned char>(event.code));
+      }
+      break;
+    case InputEvent::Type::kKeyUp:
+      Record(Kind::kKeyUp, event.code, 0, 0);
+      kbd_.OnKeyReleased(static_cast<unsigned char>(event.code));
+      break;
+    case InputEvent::Type::kChar:
+      Record(Kind::kChar, event.code, 0, 0);
+      kbd_.OnChar(static_cast<char>(event.code));
+      break;
+    // clear keystate when window loses focus to prevent input getting "stuck"
+    case InputEvent::Type::kFocusLost:
+      Record(Kind::kFocusLost, 0, 0, 0);
+      kbd_.ClearState();
+      break;
+
+    case InputEvent::Type::kMouseMove:
+      Record(Kind::kMouseMove, 0, event.x, event.y);
+      if (capture != MouseCapture::kRelease) {
+        mouse_.OnMouseMove(event.x, event.y);
+      }
+      break;
+    case InputEvent::Type::kLeftDown:
+      Record(Kind::kMouseDown, kLeftButton, event.x, event.y);
+      mouse_.OnLeftPressed(event.x, event.y);
+      break;
+    case InputEvent::Type::kRightDown:
+      Record(Kind::kMouseDown, kRightButton, event.x, event.y);
+      mouse_.OnRightPressed(event.x, event.y);
+      break;
+    case InputEvent::Type::kLeftUp:
+      Record(Kind::kMouseUp, kLeftButton, event.x, event.y);
+      mouse_.OnLeftReleased(event.x, event.y);
+      break;
+    case InputEvent::Type::kRightUp:
+      Record(Kind::kMouseUp, kRightButton, event.x, event.y);
+      mouse_.OnRightReleased(event.x, event.y);
+      break;
+    case InputEvent::Type::kWheel:
+      Record(Kind::kWheel, event.code, event.x, event.y);
+      mouse_.OnWheelDelta(event.x, event.y, event.code);
+      break;
+    case InputEvent::Type::kResize:
+      Record(Kind::kResize, 0, event.x, event.y);
+      break;
+  }
+  if (capture == MouseCapture::kAcquire) {
+    mouse_.OnMouseEnter();
+  } else if (capture == MouseCapture::kRelease) {
+    mouse_.OnMouseLeave();
+  }
+  return capture;
+}
+
+}  // namespace hw3d
@@ -0,0 +1,87 @@
+﻿#pragma once
+
+#include <cstdint>
+
+#include "keyboard.h"
+#include "mouse.h"
+
+namespace hw3d {
+
+// One input event in platform-neutral form. The Win32 window translates
+// messages into these; headless runs generate them from a script.
+struct InputEvent {
+  enum class Type : std::uint8_t {
+    kKeyDown,
+    kKeyUp,
+    kChar,
+    kMouseMove,
+    kLeftDown,
+    kLeftUp,
+    kRightDown,
+    kRightUp,
+    kWheel,
+    kFocusLost,
+    // the client area changed size; the Win32 window has a fixed size and
+    // never sends it
+    kResize,
+  };
+
+  Type type = Type::kMouseMove;
+  // key down: the key was already down (autorepeat)
+  bool repeat = false;
+  // mouse move: a button is held, so the window keeps the mouse outside
+  bool buttons_held = false;
+  // virtual-key code, character, or wheel delta (120 per notch)
+  int code = 0;
+  // client-area position for mouse events, new client size for a resize
+  int x = 0;
+  int y = 0;
+};
+
+// What the platform should do with mouse capture after an event.
+enum class MouseCapture {
+  kKeep,
+  kAcquire,
+  kRelease,
+};
+
+// Decides when the mouse enters or leaves the client area. InputDispatcher
+// uses it to raise Enter/Leave; a pump thread keeps its own copy as shadow
+// state so it can set capture without looking at the game thread's Mouse.
+class MouseCaptureTracker {
+ public:
+  MouseCaptureTracker(int width, int height) noexcept
+      : width_(width), height_(height) {}
+
+  MouseCapture Update(const InputEvent& event) noexcept;
+  bool in_window() const noexcept { return in_window_; }
+
+ private:
+  bool InClientArea(int x, int y) const noexcept {
+    return x >= 0 && x < width_ && y >= 0 && y < height_;
+  }
+
+ private:
+  int width_;
+  int height_;
+  bool in_window_ = false;
+};
+
+// Applies InputEvents to a Keyboard and a Mouse. This holds the rules the
+// Win32 window used to apply inline (autorepeat filtering, entering and
+// leaving the client area), so every backend behaves the same. Each event
+// is also recorded by the flight recorder.
+class InputDispatcher {
+ public:
+  InputDispatcher(Keyboard& kbd, Mouse& mouse, int width, int height) noexcept
+      : kbd_(kbd), mouse_(mouse), capture_(width, height) {}
+
+  MouseCapture Dispatch(const InputEvent& event) noexcept;
+
+ private:
+  Keyboard& kbd_;
+  Mouse& mouse_;
+  MouseCaptureTracker capture_;
+};
+
+}  // namespace hw3d
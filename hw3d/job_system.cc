@@ -0,0 +1,290 @@
+﻿#include "job_system.h"
+
+
+#include "memory_tracker.h"
+#include "simd_config.h"
+
+namespace hw3d {
+
+namespace {
+
+// idle rounds spent spinning, then yielding, before a worker sleeps
+constexpr unsigned kSpinRounds = 256;
+constexpr unsigned kYieldRounds = 64;
+
+thread_local JobSystem* tls_system = nullptr;
+thread_local int tls_worker_index = -1;
+
+void CpuRelax() noexcept {
+#if defined(HW3D_SIMD_SSE2)
+  _mm_pause();
+#elif defined(HW3D_SIMD_NEON)
+  __asm__ __volatile__("yield");
+#else
+  std::this_thread::yield();
+#endif
+}
+
+std::uint32_t NextRandom(std::uint32_t& state) noexcept {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+}  // namespace
+
+JobSlots::JobSlots(std::size_t capacity)
+    : jobs_(std::make_unique<Job[]>(capacity)),
+      queued_(std::make_unique<std::atomic<bool>[]>(capacity)),
+      mask_(capacity - 1) {
+  for (std::size_t i = 0; i < capacity; i++) {
+    queued_[i].store(false, std::memory_order_relaxed);
+  }
+}
+
+Job* JobSlots::Put(const Job& job) noexcept {
+  // a full ring is the common case once submissions outrun the workers;
+  // answer it without scanning every slot
+  if (queued_count_.load(std::memory_order_relaxed) > mask_) {
+    return nullptr;
+  }
+  // slots are mostly taken in order, so the next one is usually free; a
+  // worker that pops its own newest job frees the slot it just put, which
+  // the hint finds
+  std::size_t i = next_ & mask_;
+  if (queued_[i].load(std::memory_order_acquire)) {
+    i = last_freed_.load(std::memory_order_relaxed);
+    for (std::size_t probe = 0;
+         queued_[i].load(std::memory_order_acquire); probe++) {
+      if (probe > mask_) {
+        return nullptr;
+      }
+      i = next_++ & mask_;
+    }
+  }
+  // acquire above: the previous job's reader is done with the slot
+  next_ = i + 1;
+  jobs_[i] = job;
+  queued_[i].store(true, std::memory_order_relaxed);
+  queued_count_.fetch_add(1, std::memory_order_relaxed);
+  return &jobs_[i];
+}
+
+Job JobSlots::Take(Job* slot) noexcept {
+  const Job job = *slot;
+  const auto i = static_cast<std::size_t>(slot - jobs_.get());
+  queued_count_.fetch_sub(1, std::memory_order_relaxed);
+  last_freed_.store(i, std::memory_order_relaxed);
+  queued_[i].store(false, std::memory_order_release);
+  return job;
+}
+
+JobSystem::Worker::Worker(unsigned index)
+    : index(index),
+      deque(kJobsPerWorker),
+      slots(kJobsPerWorker),
+      rng(0x9E3779B9u * (index + 1)) {}
+
+JobSystem& JobSystem::Get() noexcept {
+  static JobSystem system;
+  return system;
+}
+
+JobSystem::~JobSystem() {
+  Stop();
+}
+
+int JobSystem::CurrentWorker() noexcept {
+  return tls_worker_index;
+}
+
+bool JobSystem::Start(unsigned worker_count) {
+  if (IsRunning()) {
+    return false;
+  }
+  HW3D_MEMORY_SCOPE(MemoryTag::kJobs);
+  if (worker_count == 0) {
+    worker_count = std::thread::hardware_concurrency();
+    if (worker_count == 0) {
+      worker_count = 1;
+    }
+  }
+  stop_requested_.store(false, std::memory_order_relaxed);
+  workers_.reserve(worker_count);
+  for (unsigned i = 0; i < worker_count; i++) {
+    workers_.push_back(std::make_unique<Worker>(i));
+  }
+  tls_system = this;
+  tls_worker_index = 0;
+  running_.store(true, std::memory_order_release);
+  threads_.reserve(worker_count - 1);
+  for (unsigned i = 1; i < worker_count; i++) {
+    threads_.emplace_back(&JobSystem::WorkerLoop, this, i);
+  }
+  return true;
+}
+
+void JobSystem::Stop() noexcept {
+  if (!running_.exchange(false, std::memory_order_acq_rel)) {
+    return;
+  }
+  // from here on jobs execute inline; finish what is queued
+  Worker& self = *workers_[0];
+  while (RunOne(self)) {
+  }
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stop_requested_.store(true, std::memory_order_release);
+  }
+  sleep_cv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+  while (RunOne(self)) {
+  }
+  workers_.clear();
+  tls_system = nullptr;
+  tls_worker_index = -1;
+}
+
+void JobSystem::Submit(const Job& job) noexcept {
+  if (job.counter != nullptr) {
+    job.counter->pending_.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (tls_system != this || !running_.load(std::memory_order_relaxed)) {
+    Execute(job);
+    return;
+  }
+  Worker& self = *workers_[static_cast<std::size_t>(tls_worker_index)];
+  Job* slot = self.slots.Put(job);
+  if (slot == nullptr || !self.deque.Push(slot)) {
+    // full: no point queueing behind thousands of jobs
+    if (slot != nullptr) {
+      self.slots.Take(slot);
+    }
+    Execute(job);
+    return;
+  }
+  WakeOne();
+}
+
+void JobSystem::Wait(const JobCounter& counter) noexcept {
+  Worker* self = tls_system == this && !workers_.empty()
+                     ? workers_[static_cast<std::size_t>(tls_worker_index)]
+                           .get()
+                     : nullptr;
+  unsigned idle = 0;
+  while (!counter.IsDone()) {
+    if (self != nullptr && RunOne(*self)) {
+      idle = 0;
+    } else if (++idle < kSpinRounds) {
+      CpuRelax();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void JobSystem::WorkerLoop(unsigned index) noexcept {
+  tls_system = this;
+  tls_worker_index = static_cast<int>(index);
+  Worker& self = *workers_[index];
+  unsigned idle = 0;
+  while (!stop_requested_.load(std::memory_order_acquire)) {
+    if (RunOne(self)) {
+      idle = 0;
+    } else if (++idle < kSpinRounds) {
+      CpuRelax();
+    } else if (idle < kSpinRounds + kYieldRounds) {
+      std::this_thread::yield();
+    } else {
+      Sleep();
+      // if another worker took the job this one was woken for, go back to
+      // sleep without spinning again
+      idle = kSpinRounds + kYieldRounds - 1;
+    }
+  }
+  // jobs may still be queued here or elsewhere; help finish them
+  while (RunOne(self)) {
+  }
+  tls_system = nullptr;
+  tls_worker_index = -1;
+}
+
+bool JobSystem::RunOne(Worker& self) noexcept {
+  if (Job* slot = self.deque.Pop()) {
+    Execute(self.slots.Take(slot));
+    return true;
+  }
+  Job job;
+  if (!Steal(self, job)) {
+    return false;
+  }
+  Execute(job);
+  return true;
+}
+
+bool JobSystem::Steal(Worker& self, Job& out) noexcept {
+  const std::size_t count = workers_.size();
+  if (count < 2) {
+    return false;
+  }
+  // start at a random victim so thieves spread out
+  std::size_t victim = NextRandom(self.rng) % count;
+  for (std::size_t i = 0; i < count; i++, victim = (victim + 1) % count) {
+    if (victim == self.index) {
+      continue;
+    }
+    Worker& other = *workers_[victim];
+    if (Job* slot = other.deque.Steal()) {
+      out = other.slots.Take(slot);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool JobSystem::AnyWorkQueued() const noexcept {
+  for (const auto& worker : workers_) {
+    if (!worker->deque.LooksEmpty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void JobSystem::Sleep() noexcept {
+  std::unique_lock<std::mutex> lock(sleep_mutex_);
+  sleepers_.fetch_add(1, std::memory_order_relaxed);
+  // pairs with the fence in WakeOne(): either the submitter sees this
+  // sleeper, or this check sees its job. Stop() sets the flag under the
+  // mutex, so no timed poll is needed.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  sleep_cv_.wait(lock, [this] {
+    return AnyWorkQueued() || stop_requested_.load(std::memory_order_relaxed);
+  });
+  sleepers_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void JobSystem::WakeOne() noexcept {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleepers_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  {
+    // a sleeper between its check and its wait holds the mutex
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+  }
+  sleep_cv_.notify_one();
+}
+
+void JobSystem::Execute(Job job) noexcept {
+  job.function(job.payload);
+  if (job.counter != nullptr) {
+    job.counter->pending_.fetch_sub(1, std::memory_order_release);
+  }
+}
+
+}  // namespace hw3d
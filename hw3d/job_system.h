@@ -0,0 +1,188 @@
+﻿#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "chase_lev_deque.h"
+
+namespace hw3d {
+
+// Counts unfinished jobs. Pass one to Run() for every job that should be
+// waited on together, then Wait() on it. Must outlive those jobs.
+class JobCounter {
+ public:
+  JobCounter() = default;
+  JobCounter(const JobCounter&) = delete;
+  JobCounter& operator=(const JobCounter&) = delete;
+
+  bool IsDone() const noexcept {
+    return pending_.load(std::memory_order_acquire) == 0;
+  }
+
+ private:
+  friend class JobSystem;
+  friend class FiberJobSystem;
+  std::atomic<std::uint32_t> pending_{0};
+};
+
+// A unit of work: a function pointer plus a small inline payload, so
+// submitting never allocates. One cache line.
+struct Job {
+  static constexpr std::size_t kPayloadSize = 48;
+  using Function = void (*)(void* payload);
+
+  Function function = nullptr;
+  JobCounter* counter = nullptr;
+  alignas(8) unsigned char payload[kPayloadSize];
+};
+static_assert(sizeof(Job) == 64, "Job should fill exactly one cache line");
+
+// Packs a callable into a Job. It is copied into the payload, so it must be
+// small and trivially copyable (capture pointers or references, not
+// containers).
+template <typename F>
+Job MakeJob(F&& f, JobCounter* counter = nullptr) noexcept {
+  using Fn = std::decay_t<F>;
+  static_assert(sizeof(Fn) <= Job::kPayloadSize,
+                "job captures too much; capture a pointer to the data");
+  static_assert(alignof(Fn) <= 8, "job callable is over-aligned");
+  static_assert(std::is_trivially_copyable_v<Fn> &&
+                    std::is_trivially_destructible_v<Fn>,
+                "job callables are copied bytewise and never destroyed");
+  Job job;
+  job.function = [](void* payload) { (*static_cast<Fn*>(payload))(); };
+  job.counter = counter;
+  new (job.payload) Fn(std::forward<F>(f));
+  return job;
+}
+
+// Backing storage for a worker's queued jobs; its deque holds pointers into
+// it. Only the owning worker calls Put(), any thread may Take(). A slot is
+// handed out again only once the job in it has been taken, however long it
+// sat in the deque.
+class JobSlots {
+ public:
+  // `capacity` must be a power of two.
+  explicit JobSlots(std::size_t capacity);
+
+  // Copies `job` into a free slot. Returns nullptr if every slot is queued.
+  Job* Put(const Job& job) noexcept;
+  // Copies the job out of a slot returned by Put() and frees the slot.
+  Job Take(Job* slot) noexcept;
+
+ private:
+  std::unique_ptr<Job[]> jobs_;
+  std::unique_ptr<std::atomic<bool>[]> queued_;
+  std::size_t mask_;
+  std::size_t next_ = 0;
+  // slots currently queued, and the most recently freed one
+  std::atomic<std::size_t> queued_count_{0};
+  std::atomic<std::size_t> last_freed_{0};
+};
+
+// Work-stealing job system: one worker per core, the thread that calls
+// Start() being worker 0. Every worker owns a Chase-Lev deque; it runs its
+// own jobs newest-first and, when it runs dry, steals the oldest job of a
+// random other worker. Idle workers spin briefly, then sleep until work is
+// submitted.
+//
+// Run(), Submit() and Wait() may be called from any worker, including from
+// inside a job. Wait() runs other jobs while the counter is not done
+// (help-while-waiting), so waiting never idles a core. From a thread that is
+// not a worker, or while the system is stopped, jobs execute immediately.
+//
+// A worker can have kJobsPerWorker jobs queued; past that its submissions
+// run inline.
+class JobSystem {
+ public:
+  static constexpr std::size_t kJobsPerWorker = 4096;
+
+  static JobSystem& Get() noexcept;
+
+  JobSystem(const JobSystem&) = delete;
+  JobSystem& operator=(const JobSystem&) = delete;
+
+  // Starts `worker_count - 1` threads (0: one worker per hardware thread).
+  // The calling thread becomes worker 0 and must also call Stop(). Returns
+  // false if already running.
+  bool Start(unsigned worker_count = 0);
+  // Finishes every queued job and joins the worker threads.
+  void Stop() noexcept;
+
+  bool IsRunning() const noexcept {
+    return running_.load(std::memory_order_acquire);
+  }
+  unsigned worker_count() const noexcept {
+    return static_cast<unsigned>(workers_.size());
+  }
+  // Index of the calling worker, or -1 if the caller is not a worker.
+  static int CurrentWorker() noexcept;
+
+  // Queues `function(payload)`; the 48 payload bytes are copied.
+  void Submit(const Job& job) noexcept;
+
+  // Queues a callable; see MakeJob() for what it may capture.
+  template <typename F>
+  void Run(F&& f, JobCounter* counter = nullptr) noexcept {
+    Submit(MakeJob(std::forward<F>(f), counter));
+  }
+
+  // Returns once every job counted by `counter` has finished, running other
+  // jobs in the meantime.
+  void Wait(const JobCounter& counter) noexcept;
+
+ private:
+  struct alignas(64) Worker {
+    explicit Worker(unsigned index);
+
+    unsigned index;
+    ChaseLevDeque<Job> deque;
+    JobSlots slots;
+    // xorshift state for picking steal victims
+    std::uint32_t rng;
+  };
+
+  JobSystem() = default;
+  ~JobSystem();
+
+  void WorkerLoop(unsigned index) noexcept;
+  // Runs one job from the worker's own deque or a stolen one.
+  bool RunOne(Worker& self) noexcept;
+  bool Steal(Worker& self, Job& out) noexcept;
+  bool AnyWorkQueued() const noexcept;
+  void Sleep() noexcept;
+  void WakeOne() noexcept;
+  static void Execute(Job job) noexcept;
+
+ private:
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::atomic<bool> running_{false};
+  std::atomic<bool> stop_requested_{false};
+
+  std::mutex sleep_mutex_;
+  std::condition_variable sleep_cv_;
+  std::atomic<unsigned> sleepers_{0};
+};
+
+// Starts the job system for the lifetime of the object.
+class JobSystemSession {
+ public:
+  explicit JobSystemSession(unsigned worker_count = 0) {
+    JobSystem::Get().Start(worker_count);
+  }
+  ~JobSystemSession() { JobSystem::Get().Stop(); }
+  JobSystemSession(const JobSystemSession&) = delete;
+  JobSystemSession& operator=(const JobSystemSession&) = delete;
+};
+
+}  // namespace hw3d
@@ -31,7 +31,7 @@
 namespace hw3d {
 
 class Keyboard {
-  friend class Window;
+  friend class InputDispatcher;
 
  public:
   class Event {
@@ -0,0 +1,229 @@
+﻿#include "lod_selector.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+namespace hw3d {
+
+namespace {
+
+constexpr std::uint8_t kMaxAge = 0xFF;
+
+std::uint64_t NowNs() noexcept {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+}  // namespace
+
+LodSelector::LodSelector(const LodSelectorConfig& config) : config_(config) {}
+
+std::uint32_t LodSelector::AddMesh(const float* errors,
+                                   std::size_t level_count) {
+  if (level_count == 0 || level_count > kMaxLevels) {
+    throw std::invalid_argument("a mesh needs 1 to 8 levels of detail");
+  }
+  float previous = -std::numeric_limits<float>::infinity();
+  for (std::size_t level = 0; level < level_count; level++) {
+    // also rejects NaN
+    if (!(errors[level] >= previous)) {
+      throw std::invalid_argument("level errors must not decrease");
+    }
+    previous = errors[level];
+  }
+  const auto mesh = static_cast<std::uint32_t>(mesh_levels_.size());
+  Errors padded;
+  padded.fill(std::numeric_limits<float>::infinity());
+  std::copy(errors, errors + level_count, padded.begin());
+  mesh_errors_.push_back(padded);
+  mesh_first_batch_.push_back(static_cast<std::uint32_t>(batches_.size()));
+  mesh_levels_.push_back(static_cast<std::uint8_t>(level_count));
+  for (std::size_t level = 0; level < level_count; level++) {
+    batch_ids_.push_back({mesh, static_cast<std::uint32_t>(level)});
+    batches_.emplace_back();
+    batch_changed_.push_back(0);
+  }
+  // MarkChanged() never allocates
+  changed_batches_.reserve(batches_.size());
+  return mesh;
+}
+
+void LodSelector::Resize(std::size_t count) {
+  for (std::size_t i = count; i < meshes_.size(); i++) {
+    if (levels_[i] != kNoLevel) {
+      Unlink(static_cast<std::uint32_t>(i));
+    }
+  }
+  meshes_.resize(count, kNoMesh);
+  levels_.resize(count, kNoLevel);
+  next_levels_.resize(count, kNoLevel);
+  ages_.resize(count, 0);
+  slots_.resize(count, 0);
+}
+
+void LodSelector::SetMesh(std::uint32_t object, std::uint32_t mesh) {
+  assert(object < size());
+  assert(mesh == kNoMesh || mesh < mesh_levels_.size());
+  if (levels_[object] != kNoLevel) {
+    Unlink(object);
+  }
+  meshes_[object] = mesh;
+  ages_[object] = 0;
+}
+
+void LodSelector::Update(const LodView& view, const SphereArray& bounds) {
+  // also rejects NaN
+  if (!(view.pixel_scale > 0.0f && std::isfinite(view.pixel_scale))) {
+    throw std::invalid_argument("pixel_scale must be positive and finite");
+  }
+  if (!(view.max_error_pixels >= 0.0f &&
+        std::isfinite(view.max_error_pixels))) {
+    throw std::invalid_argument(
+        "max_error_pixels must be finite and not negative");
+  }
+  const std::uint64_t start = NowNs();
+  stats_ = Stats();
+  const std::size_t n = size();
+  assert(bounds.size() >= n);
+  ParallelOptions options;
+  options.item_bytes = sizeof(std::uint8_t);
+  options.cost = &choose_cost_;
+  ParallelForRange(
+      0, n,
+      [&](std::size_t b, std::size_t e) { Choose(view, bounds, b, e); },
+      options);
+
+  // Serial, so that each instance list sees all of its changes at once.
+  for (std::size_t i = 0; i < n; i++) {
+    const std::uint8_t next = next_levels_[i];
+    if (next == levels_[i]) {
+      continue;
+    }
+    const auto object = static_cast<std::uint32_t>(i);
+    if (levels_[i] != kNoLevel) {
+      Unlink(object);
+    }
+    Link(object, next);
+    stats_.switched++;
+  }
+  stats_.ns = NowNs() - start;
+}
+
+void LodSelector::Choose(const LodView& view,
+                         const SphereArray& bounds,
+                         std::size_t begin,
+                         std::size_t end) noexcept {
+  // The allowed error grows with the distance to the sphere's surface;
+  // inside the sphere it is 0, which asks for the finest level. NaN
+  // spheres end up there too.
+  const float per_unit = view.max_error_pixels / view.pixel_scale;
+  const float coarsen = 1.0f - config_.hysteresis;
+  const auto finish = [&](std::size_t i, float allowed) {
+    const std::uint32_t mesh = meshes_[i];
+    if (mesh == kNoMesh) {
+      return;
+    }
+    // A far object under a small pixel_scale overflows to infinity, which
+    // the padding past the mesh's last level would fit; NaN stays NaN and
+    // keeps the finest level.
+    allowed = std::min(allowed, std::numeric_limits<float>::max());
+    // Most objects keep their level, which two lookups show: errors do
+    // not decrease, so the finest level allowed is below this one exactly
+    // when this one's error is too large, and above it only if the next
+    // one's error fits.
+    const Errors& errors = mesh_errors_[mesh];
+    const std::uint8_t level = levels_[i];
+    std::uint8_t next = level;
+    if (level == kNoLevel || errors[level] > allowed) {
+      next = Select(errors, allowed);
+    } else if (ages_[i] >= config_.coarsen_delay &&
+               errors[level + 1] <= allowed * coarsen) {
+      next = Select(errors, allowed * coarsen);
+    }
+    next_levels_[i] = next;
+    ages_[i] = next != level ? 0
+               : ages_[i] < kMaxAge ? static_cast<std::uint8_t>(ages_[i] + 1)
+                                    : kMaxAge;
+  };
+
+  const Vec4 eye_x = VecSplat(view.eye.x);
+  const Vec4 eye_y = VecSplat(view.eye.y);
+  const Vec4 eye_z = VecSplat(view.eye.z);
+  const Vec4 scale = VecSplat(per_unit);
+  const Vec4 zero = VecZero();
+  std::size_t i = begin;
+  for (; i + 4 <= end; i += 4) {
+    const Vec4 dx = math_detail::LoadFloats(bounds.center_x() + i) - eye_x;
+    const Vec4 dy = math_detail::LoadFloats(bounds.center_y() + i) - eye_y;
+    const Vec4 dz = math_detail::LoadFloats(bounds.center_z() + i) - eye_z;
+    const Vec4 distance = Sqrt(MulAdd(dx, dx, MulAdd(dy, dy, dz * dz))) -
+                          math_detail::LoadFloats(bounds.radius() + i);
+    float allowed[4];
+    math_detail::StoreFloats(allowed, Max(distance, zero) * scale);
+    for (std::size_t k = 0; k < 4; k++) {
+      finish(i + k, allowed[k]);
+    }
+  }
+  for (; i < end; i++) {
+    const float dx = bounds.center_x()[i] - view.eye.x;
+    const float dy = bounds.center_y()[i] - view.eye.y;
+    const float dz = bounds.center_z()[i] - view.eye.z;
+    const float distance =
+        std::sqrt(dx * dx + dy * dy + dz * dz) - bounds.radius()[i];
+    finish(i, distance > 0.0f ? distance * per_unit : 0.0f);
+  }
+}
+
+std::uint8_t LodSelector::Select(const Errors& errors,
+                                 float allowed) noexcept {
+  // how many levels past the first fit; counting has no branch to miss
+  std::uint8_t level = 0;
+  for (std::size_t i = 1; i < kMaxLevels; i++) {
+    level += errors[i] <= allowed;
+  }
+  return level;
+}
+
+void LodSelector::Link(std::uint32_t object, std::uint8_t level) {
+  const std::uint32_t batch = mesh_first_batch_[meshes_[object]] + level;
+  std::vector<std::uint32_t>& list = batches_[batch];
+  slots_[object] = static_cast<std::uint32_t>(list.size());
+  list.push_back(object);
+  levels_[object] = level;
+  MarkChanged(batch);
+}
+
+void LodSelector::Unlink(std::uint32_t object) {
+  const std::uint32_t batch =
+      mesh_first_batch_[meshes_[object]] + levels_[object];
+  std::vector<std::uint32_t>& list = batches_[batch];
+  const std::uint32_t slot = slots_[object];
+  const std::uint32_t last = list.back();
+  list[slot] = last;
+  slots_[last] = slot;
+  list.pop_back();
+  levels_[object] = kNoLevel;
+  next_levels_[object] = kNoLevel;
+  MarkChanged(batch);
+}
+
+void LodSelector::MarkChanged(std::uint32_t batch) {
+  if (batch_changed_[batch] == 0) {
+    batch_changed_[batch] = 1;
+    changed_batches_.push_back(batch_ids_[batch]);
+  }
+}
+
+void LodSelector::ClearChangedBatches() noexcept {
+  for (const Batch& batch : changed_batches_) {
+    batch_changed_[mesh_first_batch_[batch.mesh] + batch.level] = 0;
+  }
+  changed_batches_.clear();
+}
+
+}  // namespace hw3d
@@ -0,0 +1,162 @@
+﻿#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "frustum_culling.h"
+#include "parallel.h"
+#include "vector_math.h"
+
+namespace hw3d {
+
+// Pixels covered by one world unit seen face-on at distance 1, for a
+// vertical field of view `fov_y` (radians) over `viewport_height` pixels.
+inline float LodPixelScale(float fov_y, float viewport_height) noexcept {
+  return 0.5f * viewport_height / std::tan(0.5f * fov_y);
+}
+
+struct LodView {
+  Float3 eye;
+  // LodPixelScale() of the camera
+  float pixel_scale = 1.0f;
+  // largest geometric error allowed on screen, in pixels
+  float max_error_pixels = 1.0f;
+};
+
+struct LodSelectorConfig {
+  // A coarser level is taken only once its error is this fraction below
+  // the allowed error, so an object sitting at a switching distance does
+  // not flip every frame.
+  float hysteresis = 0.2f;
+  // Frames an object keeps a level before it may move to a coarser one,
+  // up to 255. Finer levels are taken at once: detail missing on screen
+  // is worse than detail kept a little longer.
+  std::uint32_t coarsen_delay = 8;
+};
+
+// Picks a level of detail per object from its projected screen-space
+// error, and keeps an instance list per mesh and level for the renderer.
+//
+// Each mesh lists the geometric error of its levels in world units, from
+// the finest (level 0) to the coarsest. An error e seen at distance d
+// covers e * pixel_scale / d pixels, so an object may use the coarsest
+// level whose error is at most max_error_pixels * d / pixel_scale, with d
+// measured to the nearest point of its bounding sphere. Update() computes
+// that allowance four objects at a time, on JobSystem workers when called
+// from one, then moves the objects whose level changed between instance
+// lists in one pass; LodSelectorConfig keeps objects near a switching
+// distance from flipping back and forth. The lists that changed are
+// collected in changed_batches(), so each instance buffer is rebuilt once
+// per frame however many of its objects switched.
+//
+// Objects are known by their index in the SphereArray given to Update().
+class LodSelector {
+ public:
+  static constexpr std::size_t kMaxLevels = 8;
+  static constexpr std::uint32_t kNoMesh =
+      std::numeric_limits<std::uint32_t>::max();
+  static constexpr std::uint8_t kNoLevel = 0xFF;
+
+  struct Batch {
+    std::uint32_t mesh;
+    std::uint32_t level;
+  };
+
+  // Work of the last Update().
+  struct Stats {
+    std::size_t switched = 0;
+    std::uint64_t ns = 0;
+  };
+
+  explicit LodSelector(const LodSelectorConfig& config = LodSelectorConfig());
+
+  // Registers a mesh and returns its id. `errors` holds one geometric
+  // error per level, finest first. Throws std::invalid_argument unless
+  // there are 1 to kMaxLevels levels with non-decreasing errors.
+  std::uint32_t AddMesh(const float* errors, std::size_t level_count);
+  std::size_t level_count(std::uint32_t mesh) const noexcept {
+    return mesh_levels_[mesh];
+  }
+
+  // Objects past `count` leave their instance lists; new ones have no
+  // mesh.
+  void Resize(std::size_t count);
+  std::size_t size() const noexcept { return meshes_.size(); }
+  // Gives `object` a mesh, or kNoMesh to take it out of every instance
+  // list. Its level is chosen by the next Update(), without hysteresis.
+  void SetMesh(std::uint32_t object, std::uint32_t mesh);
+
+  // Chooses levels for every object with a mesh. `bounds` needs size()
+  // spheres. Throws std::invalid_argument unless view.pixel_scale is
+  // positive and finite and view.max_error_pixels is finite and not
+  // negative; to turn LOD off, give every object a one-level mesh.
+  void Update(const LodView& view, const SphereArray& bounds);
+
+  // kNoLevel until the first Update() after SetMesh().
+  std::uint8_t level(std::uint32_t object) const noexcept {
+    return levels_[object];
+  }
+  // Objects drawn with a mesh at a level, in no particular order.
+  const std::vector<std::uint32_t>& instances(
+      std::uint32_t mesh,
+      std::uint32_t level) const noexcept {
+    return batches_[mesh_first_batch_[mesh] + level];
+  }
+  // Instance lists that changed since ClearChangedBatches(), each once.
+  const std::vector<Batch>& changed_batches() const noexcept {
+    return changed_batches_;
+  }
+  // Call once the instance buffers of changed_batches() are rebuilt.
+  void ClearChangedBatches() noexcept;
+
+  const Stats& stats() const noexcept { return stats_; }
+
+ private:
+  // Level errors of a mesh, padded with infinity past its last level and
+  // one past kMaxLevels. Choose() keeps allowances finite, so the padding
+  // never fits.
+  using Errors = std::array<float, kMaxLevels + 1>;
+
+  // Chooses levels into next_levels_, in parallel; Update() then moves
+  // the objects that changed.
+  void Choose(const LodView& view,
+              const SphereArray& bounds,
+              std::size_t begin,
+              std::size_t end) noexcept;
+  // The coarsest level whose error is at most `allowed`, which must be
+  // finite.
+  static std::uint8_t Select(const Errors& errors, float allowed) noexcept;
+  void Link(std::uint32_t object, std::uint8_t level);
+  void Unlink(std::uint32_t object);
+  void MarkChanged(std::uint32_t batch);
+
+  LodSelectorConfig config_;
+  Stats stats_;
+
+  // per mesh
+  std::vector<Errors> mesh_errors_;
+  std::vector<std::uint32_t> mesh_first_batch_;
+  std::vector<std::uint8_t> mesh_levels_;
+  // per batch: mesh_first_batch_[mesh] + level
+  std::vector<Batch> batch_ids_;
+  std::vector<std::vector<std::uint32_t>> batches_;
+  std::vector<std::uint8_t> batch_changed_;
+  std::vector<Batch> changed_batches_;
+
+  // per object
+  std::vector<std::uint32_t> meshes_;
+  std::vector<std::uint8_t> levels_;
+  std::vector<std::uint8_t> next_levels_;
+  // frames at the current level, saturating
+  std::vector<std::uint8_t> ages_;
+  // index in the object's instance list
+  std::vector<std::uint32_t> slots_;
+
+  ParallelCost choose_cost_;
+};
+
+}  // namespace hw3d
@@ -0,0 +1,203 @@
+﻿#include "log.h"
+
+#include <chrono>
+
+#include "log_format.h"
+#include "memory_tracker.h"
+
+namespace hw3d {
+
+namespace {
+
+std::uint64_t SteadyNs() noexcept {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+// Little-endian helpers for the file writer.
+void PutU8(std::FILE* f, std::uint8_t v) noexcept {
+  std::fputc(v, f);
+}
+
+void PutU16(std::FILE* f, std::uint16_t v) noexcept {
+  const unsigned char b[2] = {static_cast<unsigned char>(v),
+                              static_cast<unsigned char>(v >> 8)};
+  std::fwrite(b, 1, sizeof(b), f);
+}
+
+void PutU32(std::FILE* f, std::uint32_t v) noexcept {
+  unsigned char b[4];
+  for (int i = 0; i < 4; i++) {
+    b[i] = static_cast<unsigned char>(v >> (8 * i));
+  }
+  std::fwrite(b, 1, sizeof(b), f);
+}
+
+void PutU64(std::FILE* f, std::uint64_t v) noexcept {
+  unsigned char b[8];
+  for (int i = 0; i < 8; i++) {
+    b[i] = static_cast<unsigned char>(v >> (8 * i));
+  }
+  std::fwrite(b, 1, sizeof(b), f);
+}
+
+void PutString(std::FILE* f, const char* s) noexcept {
+  const std::size_t length = s != nullptr ? std::strlen(s) : 0;
+  const auto n = static_cast<std::uint16_t>(length < 0xFFFF ? length : 0xFFFF);
+  PutU16(f, n);
+  std::fwrite(s, 1, n, f);
+}
+
+}  // namespace
+
+Logger& Logger::Get() noexcept {
+  static Logger logger;
+  return logger;
+}
+
+Logger::~Logger() {
+  Stop();
+}
+
+bool Logger::Start(const char* path, std::size_t queue_capacity) {
+  if (IsRunning()) {
+    return false;
+  }
+  HW3D_MEMORY_SCOPE(MemoryTag::kLogging);
+  file_ = std::fopen(path, "wb");
+  if (file_ == nullptr) {
+    return false;
+  }
+  std::setvbuf(file_, nullptr, _IOFBF, 1 << 16);
+
+  // the queue outlives Stop() because late producers may still be pushing
+  if (!queue_) {
+    queue_ = std::make_unique<MpscQueue<LogRecord>>(queue_capacity);
+  }
+  // discard records that raced with the previous Stop()
+  LogRecord stale;
+  while (queue_->TryPop(stale)) {
+  }
+  for (bool& written : site_written_) {
+    written = false;
+  }
+  dropped_.store(0, std::memory_order_relaxed);
+  dropped_reported_ = 0;
+  start_ns_ = SteadyNs();
+
+  const auto wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::system_clock::now().time_since_epoch())
+                           .count();
+  std::fwrite(kLogMagic, 1, sizeof(kLogMagic), file_);
+  PutU32(file_, kLogVersion);
+  PutU64(file_, static_cast<std::uint64_t>(wall_ns));
+
+  stop_requested_.store(false, std::memory_order_relaxed);
+  writer_ = std::thread([this] { WriterLoop(); });
+  running_.store(true, std::memory_order_release);
+  return true;
+}
+
+void Logger::Stop() noexcept {
+  if (!writer_.joinable()) {
+    return;
+  }
+  running_.store(false, std::memory_order_relaxed);
+  stop_requested_.store(true, std::memory_order_release);
+  writer_.join();
+  std::fclose(file_);
+  file_ = nullptr;
+}
+
+std::uint32_t Logger::RegisterSite(const LogSite& site) noexcept {
+  const std::uint32_t id = site_count_.fetch_add(1, std::memory_order_relaxed);
+  if (id >= kMaxSites) {
+    return kInvalidSite;
+  }
+  sites_[id].store(&site, std::memory_order_release);
+  return id;
+}
+
+void Logger::Submit(const LogRecord& record) noexcept {
+  if (!queue_->TryPush(record)) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+std::uint64_t Logger::NowNs() const noexcept {
+  return SteadyNs() - start_ns_;
+}
+
+std::uint16_t Logger::CurrentThreadId() noexcept {
+  static std::atomic<std::uint16_t> next_id{0};
+  thread_local const std::uint16_t id =
+      next_id.fetch_add(1, std::memory_order_relaxed);
+  return id;
+}
+
+void Logger::WriterLoop() noexcept {
+  LogRecord record;
+  for (;;) {
+    // read the flag before draining so everything pushed before Stop() is
+    // written out
+    const bool stopping = stop_requested_.load(std::memory_order_acquire);
+    std::size_t written = 0;
+    while (queue_->TryPop(record)) {
+      WriteRecord(record);
+      ++written;
+    }
+    const std::uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+    if (dropped != dropped_reported_) {
+      WriteDropped(dropped);
+      dropped_reported_ = dropped;
+    }
+    if (stopping) {
+      break;
+    }
+    if (written == 0) {
+      std::fflush(file_);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  std::fflush(file_);
+}
+
+void Logger::WriteRecord(const LogRecord& record) noexcept {
+  const std::uint32_t id = record.site_id;
+  if (!site_written_[id]) {
+    const LogSite* site = sites_[id].load(std::memory_order_acquire);
+    if (site == nullptr) {
+      return;
+    }
+    WriteSite(id, *site);
+    site_written_[id] = true;
+  }
+  PutU8(file_, kLogEntryRecord);
+  PutU32(file_, id);
+  PutU64(file_, record.timestamp_ns);
+  PutU16(file_, record.thread_id);
+  PutU16(file_, record.payload_size);
+  std::fwrite(record.payload, 1, record.payload_size, file_);
+}
+
+void Logger::WriteSite(std::uint32_t id, const LogSite& site) noexcept {
+  PutU8(file_, kLogEntrySite);
+  PutU32(file_, id);
+  PutU8(file_, static_cast<std::uint8_t>(site.level));
+  PutU32(file_, static_cast<std::uint32_t>(site.line));
+  PutU8(file_, site.arg_count);
+  for (std::uint8_t i = 0; i < site.arg_count; i++) {
+    PutU8(file_, static_cast<std::uint8_t>(site.arg_types[i]));
+  }
+  PutString(file_, site.file);
+  PutString(file_, site.format);
+}
+
+void Logger::WriteDropped(std::uint64_t count) noexcept {
+  PutU8(file_, kLogEntryDropped);
+  PutU64(file_, count);
+}
+
+}  // namespace hw3d
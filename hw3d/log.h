@@ -0,0 +1,291 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+#include "mpsc_queue.h"
+
+namespace hw3d {
+
+// Asynchronous binary logging.
+//
+// A call site such as
+//   HW3D_LOG(LogLevel::kInfo, "resized to {}x{}", width, height);
+// registers its format string, file, line and argument types once, then on
+// every call only copies the raw argument values into a fixed-size record and
+// pushes it onto a lock-free queue. A background thread writes records (and
+// each site's definition the first time it shows up) to a compact binary
+// file; log_decoder.h renders that file as text.
+//
+// Placeholders are "{}" (default rendering) and "{:x}" (hexadecimal).
+// Strings are copied and truncated to the space left in the record. When the
+// queue is full the record is dropped and counted rather than blocking the
+// caller.
+
+enum class LogLevel : std::uint8_t {
+  kTrace,
+  kDebug,
+  kInfo,
+  kWarning,
+  kError,
+};
+
+enum class LogArgType : std::uint8_t {
+  kInt,
+  kUint,
+  kDouble,
+  kBool,
+  kString,
+};
+
+// Static description of one HW3D_LOG call site.
+struct LogSite {
+  LogLevel level;
+  const char* file;
+  int line;
+  const char* format;
+  const LogArgType* arg_types;
+  std::uint8_t arg_count;
+};
+
+// One queued log call: the site id plus the serialized argument values.
+struct LogRecord {
+  static constexpr std::size_t kPayloadCapacity = 104;
+
+  std::uint64_t timestamp_ns;
+  std::uint32_t site_id;
+  std::uint16_t thread_id;
+  std::uint16_t payload_size;
+  unsigned char payload[kPayloadCapacity];
+};
+
+class Logger {
+ public:
+  static constexpr std::uint32_t kMaxSites = 4096;
+  static constexpr std::uint32_t kInvalidSite = 0xFFFFFFFFu;
+
+  static Logger& Get() noexcept;
+
+  Logger(const Logger&) = delete;
+  Logger& operator=(const Logger&) = delete;
+
+  // Opens `path` and starts the writer thread. Returns false if the file
+  // could not be opened or the logger is already running.
+  bool Start(const char* path, std::size_t queue_capacity = 8192);
+  // Drains the queue, writes everything out and joins the writer thread.
+  void Stop() noexcept;
+
+  bool IsRunning() const noexcept {
+    return running_.load(std::memory_order_acquire);
+  }
+  void SetMinLevel(LogLevel level) noexcept {
+    min_level_.store(level, std::memory_order_relaxed);
+  }
+  LogLevel GetMinLevel() const noexcept {
+    return min_level_.load(std::memory_order_relaxed);
+  }
+  bool ShouldLog(LogLevel level) const noexcept {
+    return IsRunning() && level >= GetMinLevel();
+  }
+
+  // Number of records dropped because the queue was full.
+  std::uint64_t GetDroppedCount() const noexcept {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+  std::uint32_t RegisterSite(const LogSite& site) noexcept;
+  void Submit(const LogRecord& record) noexcept;
+  std::uint64_t NowNs() const noexcept;
+
+  static std::uint16_t CurrentThreadId() noexcept;
+
+ private:
+  Logger() = default;
+  ~Logger();
+
+  void WriterLoop() noexcept;
+  void WriteRecord(const LogRecord& record) noexcept;
+  void WriteSite(std::uint32_t id, const LogSite& site) noexcept;
+  void WriteDropped(std::uint64_t count) noexcept;
+
+ private:
+  std::atomic<bool> running_{false};
+  std::atomic<bool> stop_requested_{false};
+  std::atomic<LogLevel> min_level_{LogLevel::kInfo};
+  std::atomic<std::uint64_t> dropped_{0};
+  std::uint64_t dropped_reported_ = 0;
+  std::uint64_t start_ns_ = 0;
+
+  std::atomic<std::uint32_t> site_count_{0};
+  std::atomic<const LogSite*> sites_[kMaxSites] = {};
+  bool site_written_[kMaxSites] = {};
+
+  std::unique_ptr<MpscQueue<LogRecord>> queue_;
+  std::FILE* file_ = nullptr;
+  std::thread writer_;
+};
+
+// Starts the logger for the lifetime of the object.
+class LogSession {
+ public:
+  explicit LogSession(const char* path) { Logger::Get().Start(path); }
+  ~LogSession() { Logger::Get().Stop(); }
+  LogSession(const LogSession&) = delete;
+  LogSession& operator=(const LogSession&) = delete;
+};
+
+namespace log_detail {
+
+template <typename T, typename = void>
+struct ArgTraits;
+
+template <>
+struct ArgTraits<bool> {
+  static constexpr LogArgType kType = LogArgType::kBool;
+};
+
+template <typename T>
+struct ArgTraits<T,
+                 std::enable_if_t<std::is_integral_v<T> &&
+                                  !std::is_same_v<T, bool> &&
+                                  std::is_signed_v<T>>> {
+  static constexpr LogArgType kType = LogArgType::kInt;
+};
+
+template <typename T>
+struct ArgTraits<T,
+                 std::enable_if_t<std::is_integral_v<T> &&
+                                  !std::is_same_v<T, bool> &&
+                                  std::is_unsigned_v<T>>> {
+  static constexpr LogArgType kType = LogArgType::kUint;
+};
+
+template <typename T>
+struct ArgTraits<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+  static constexpr LogArgType kType = LogArgType::kDouble;
+};
+
+template <typename T>
+struct ArgTraits<T, std::enable_if_t<std::is_enum_v<T>>>
+    : ArgTraits<std::underlying_type_t<T>> {};
+
+template <>
+struct ArgTraits<const char*> {
+  static constexpr LogArgType kType = LogArgType::kString;
+};
+template <>
+struct ArgTraits<char*> : ArgTraits<const char*> {};
+template <>
+struct ArgTraits<std::string_view> : ArgTraits<const char*> {};
+template <>
+struct ArgTraits<std::string> : ArgTraits<const char*> {};
+
+// Appends raw argument bytes to a record payload, truncating strings. The
+// payload ends at the first argument that does not fit, so that one and
+// every later one decode as missing.
+class PayloadWriter {
+ public:
+  explicit PayloadWriter(LogRecord& record) noexcept : record_(record) {}
+
+  template <typename T>
+  void Put(const T& value) noexcept {
+    using Arg = std::decay_t<T>;
+    constexpr LogArgType type = ArgTraits<Arg>::kType;
+    if constexpr (type == LogArgType::kString) {
+      PutString(value);
+    } else if constexpr (type == LogArgType::kBool) {
+      const std::uint8_t v = value ? 1 : 0;
+      PutRaw(&v, sizeof(v));
+    } else if constexpr (type == LogArgType::kDouble) {
+      const double v = static_cast<double>(value);
+      PutRaw(&v, sizeof(v));
+    } else if constexpr (type == LogArgType::kInt) {
+      const auto v = static_cast<std::int64_t>(value);
+      PutRaw(&v, sizeof(v));
+    } else {
+      const auto v = static_cast<std::uint64_t>(value);
+      PutRaw(&v, sizeof(v));
+    }
+  }
+
+ private:
+  void PutString(std::string_view s) noexcept {
+    const std::size_t room = LogRecord::kPayloadCapacity -
+                             record_.payload_size - sizeof(std::uint16_t);
+    std::uint16_t n = 0;
+    if (!full_ && record_.payload_size + sizeof(std::uint16_t) <=
+                      LogRecord::kPayloadCapacity) {
+      n = static_cast<std::uint16_t>(s.size() < room ? s.size() : room);
+    }
+    PutRaw(&n, sizeof(n));
+    PutRaw(s.data(), n);
+  }
+  void PutString(const char* s) noexcept {
+    PutString(s != nullptr ? std::string_view(s) : std::string_view());
+  }
+
+  void PutRaw(const void* data, std::size_t size) noexcept {
+    if (full_ || record_.payload_size + size > LogRecord::kPayloadCapacity) {
+      // out of room: a later, smaller argument must not fill the gap, or
+      // the decoder would read it in place of this one
+      full_ = true;
+      return;
+    }
+    std::memcpy(record_.payload + record_.payload_size, data, size);
+    record_.payload_size = static_cast<std::uint16_t>(record_.payload_size +
+                                                      size);
+  }
+
+  LogRecord& record_;
+  bool full_ = false;
+};
+
+template <typename Site, typename... Args>
+void Write(LogLevel level,
+           const char* file,
+           int line,
+           const char* format,
+           const Args&... args) noexcept {
+  Logger& logger = Logger::Get();
+  if (!logger.ShouldLog(level)) {
+    return;
+  }
+  // one registration per call site (Site is unique to each HW3D_LOG)
+  static constexpr LogArgType kTypes[sizeof...(Args) + 1] = {
+      ArgTraits<std::decay_t<Args>>::kType..., LogArgType::kInt};
+  static const LogSite site = {level, file, line, format, kTypes,
+                               static_cast<std::uint8_t>(sizeof...(Args))};
+  static const std::uint32_t site_id = logger.RegisterSite(site);
+  if (site_id == Logger::kInvalidSite) {
+    return;
+  }
+
+  LogRecord record;
+  record.timestamp_ns = logger.NowNs();
+  record.site_id = site_id;
+  record.thread_id = Logger::CurrentThreadId();
+  record.payload_size = 0;
+  PayloadWriter writer(record);
+  (writer.Put(args), ...);
+  (void)writer;
+  logger.Submit(record);
+}
+
+}  // namespace log_detail
+
+}  // namespace hw3d
+
+#define HW3D_LOG(level, ...)                                              \
+  do {                                                                    \
+    struct Hw3dLogSite {};                                                \
+    ::hw3d::log_detail::Write<Hw3dLogSite>((level), __FILE__, __LINE__, \
+                                           __VA_ARGS__);                  \
+  } while (0)
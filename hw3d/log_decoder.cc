@@ -0,0 +1,263 @@
+﻿#include "log_decoder.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "log.h"
+#include "log_format.h"
+
+namespace hw3d {
+
+namespace {
+
+struct SiteDef {
+  LogLevel level = LogLevel::kInfo;
+  std::int32_t line = 0;
+  std::vector<LogArgType> arg_types;
+  std::string file;
+  std::string format;
+};
+
+class Reader {
+ public:
+  explicit Reader(std::istream& in) : in_(in) {}
+
+  bool Bytes(void* out, std::size_t n) {
+    in_.read(static_cast<char*>(out), static_cast<std::streamsize>(n));
+    return static_cast<std::size_t>(in_.gcount()) == n;
+  }
+  template <typename T>
+  bool Uint(T& out) {
+    unsigned char b[sizeof(T)];
+    if (!Bytes(b, sizeof(b))) {
+      return false;
+    }
+    std::uint64_t v = 0;
+    for (std::size_t i = 0; i < sizeof(T); i++) {
+      v |= static_cast<std::uint64_t>(b[i]) << (8 * i);
+    }
+    out = static_cast<T>(v);
+    return true;
+  }
+  bool String(std::string& out) {
+    std::uint16_t n;
+    if (!Uint(n)) {
+      return false;
+    }
+    out.resize(n);
+    return n == 0 || Bytes(&out[0], n);
+  }
+
+ private:
+  std::istream& in_;
+};
+
+const char* LevelName(LogLevel level) {
+  switch (level) {
+    case LogLevel::kTrace:
+      return "TRACE";
+    case LogLevel::kDebug:
+      return "DEBUG";
+    case LogLevel::kInfo:
+      return "INFO ";
+    case LogLevel::kWarning:
+      return "WARN ";
+    case LogLevel::kError:
+      return "ERROR";
+  }
+  return "?????";
+}
+
+std::string_view BaseName(std::string_view path) {
+  const auto slash = path.find_last_of("/\\");
+  return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+// Reads one argument of `type` from the payload and appends its text.
+bool RenderArg(LogArgType type,
+               bool hex,
+               const unsigned char*& p,
+               const unsigned char* end,
+               std::string& out) {
+  char buf[32];
+  const auto remaining = static_cast<std::size_t>(end - p);
+  switch (type) {
+    case LogArgType::kInt:
+    case LogArgType::kUint: {
+      if (remaining < 8) {
+        return false;
+      }
+      std::uint64_t v;
+      std::memcpy(&v, p, 8);
+      p += 8;
+      if (hex) {
+        std::snprintf(buf, sizeof(buf), "0x%llX",
+                      static_cast<unsigned long long>(v));
+      } else if (type == LogArgType::kInt) {
+        std::snprintf(buf, sizeof(buf), "%lld",
+                      static_cast<long long>(static_cast<std::int64_t>(v)));
+      } else {
+        std::snprintf(buf, sizeof(buf), "%llu",
+                      static_cast<unsigned long long>(v));
+      }
+      out += buf;
+      return true;
+    }
+    case LogArgType::kDouble: {
+      if (remaining < 8) {
+        return false;
+      }
+      double v;
+      std::memcpy(&v, p, 8);
+      p += 8;
+      std::snprintf(buf, sizeof(buf), "%g", v);
+      out += buf;
+      return true;
+    }
+    case LogArgType::kBool:
+      if (remaining < 1) {
+        return false;
+      }
+      out += *p++ ? "true" : "false";
+      return true;
+    case LogArgType::kString: {
+      if (remaining < 2) {
+        return false;
+      }
+      const std::size_t n = p[0] | (p[1] << 8);
+      p += 2;
+      if (static_cast<std::size_t>(end - p) < n) {
+        return false;
+      }
+      out.append(reinterpret_cast<const char*>(p), n);
+      p += n;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string RenderMessage(const SiteDef& site,
+                          const unsigned char* payload,
+                          std::size_t size) {
+  std::string out;
+  const unsigned char* p = payload;
+  const unsigned char* end = payload + size;
+  std::size_t arg = 0;
+  const std::string& f = site.format;
+  for (std::size_t i = 0; i < f.size(); i++) {
+    if (f[i] == '{' && i + 1 < f.size() && f[i + 1] == '{') {
+      out += '{';
+      ++i;
+    } else if (f[i] == '}' && i + 1 < f.size() && f[i + 1] == '}') {
+      out += '}';
+      ++i;
+    } else if (f[i] == '{') {
+      const auto close = f.find('}', i);
+      if (close == std::string::npos) {
+        out.append(f, i, std::string::npos);
+        break;
+      }
+      const bool hex = f.compare(i, close - i + 1, "{:x}") == 0;
+      if (arg >= site.arg_types.size() ||
+          !RenderArg(site.arg_types[arg], hex, p, end, out)) {
+        out += "<?>";
+      }
+      ++arg;
+      i = close;
+    } else {
+      out += f[i];
+    }
+  }
+  return out;
+}
+
+}  // namespace
+
+bool DecodeLog(std::istream& in, std::ostream& out) {
+  Reader reader(in);
+  char magic[sizeof(kLogMagic)];
+  std::uint32_t version;
+  std::uint64_t start_unix_ns;
+  if (!reader.Bytes(magic, sizeof(magic)) ||
+      std::memcmp(magic, kLogMagic, sizeof(magic)) != 0 ||
+      !reader.Uint(version) || version != kLogVersion ||
+      !reader.Uint(start_unix_ns)) {
+    return false;
+  }
+  out << "# hw3d log, started at " << start_unix_ns / 1000000000u
+      << " (unix seconds)\n";
+
+  std::unordered_map<std::uint32_t, SiteDef> sites;
+  std::vector<unsigned char> payload;
+  char stamp[32];
+  for (;;) {
+    std::uint8_t tag;
+    if (!reader.Uint(tag)) {
+      return true;  // clean end of file
+    }
+    if (tag == kLogEntrySite) {
+      std::uint32_t id;
+      std::uint8_t level;
+      std::uint32_t line;
+      std::uint8_t argc;
+      SiteDef site;
+      if (!reader.Uint(id) || !reader.Uint(level) || !reader.Uint(line) ||
+          !reader.Uint(argc)) {
+        return false;
+      }
+      site.level = static_cast<LogLevel>(level);
+      site.line = static_cast<std::int32_t>(line);
+      site.arg_types.resize(argc);
+      for (auto& type : site.arg_types) {
+        std::uint8_t t;
+        if (!reader.Uint(t)) {
+          return false;
+        }
+        type = static_cast<LogArgType>(t);
+      }
+      if (!reader.String(site.file) || !reader.String(site.format)) {
+        return false;
+      }
+      sites[id] = std::move(site);
+    } else if (tag == kLogEntryRecord) {
+      std::uint32_t id;
+      std::uint64_t ns;
+      std::uint16_t thread;
+      std::uint16_t size;
+      if (!reader.Uint(id) || !reader.Uint(ns) || !reader.Uint(thread) ||
+          !reader.Uint(size)) {
+        return false;
+      }
+      payload.resize(size);
+      if (size > 0 && !reader.Bytes(payload.data(), size)) {
+        return false;
+      }
+      const auto site = sites.find(id);
+      std::snprintf(stamp, sizeof(stamp), "+%.6fs", ns / 1e9);
+      if (site == sites.end()) {
+        out << stamp << " ????? T" << thread << " <unknown site " << id
+            << ">\n";
+        continue;
+      }
+      out << stamp << ' ' << LevelName(site->second.level) << " T" << thread
+          << ' ' << BaseName(site->second.file) << ':' << site->second.line
+          << ' ' << RenderMessage(site->second, payload.data(), size) << '\n';
+    } else if (tag == kLogEntryDropped) {
+      std::uint64_t count;
+      if (!reader.Uint(count)) {
+        return false;
+      }
+      out << "# " << count << " records dropped so far (queue full)\n";
+    } else {
+      return false;
+    }
+  }
+}
+
+}  // namespace hw3d
@@ -0,0 +1,14 @@
+﻿#pragma once
+
+#include <istream>
+#include <ostream>
+
+namespace hw3d {
+
+// Renders a binary log written by Logger as text, one line per record:
+//   +12.345678s INFO  T0 window.cc:312 window close requested
+// Returns false if the input is not an hw3d log or ends in a truncated entry;
+// everything decoded up to that point has already been written to `out`.
+bool DecodeLog(std::istream& in, std::ostream& out);
+
+}  // namespace hw3d
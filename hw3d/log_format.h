@@ -0,0 +1,31 @@
+﻿#pragma once
+
+#include <cstdint>
+
+namespace hw3d {
+
+// Layout of the binary log written by Logger (all integers little-endian).
+//
+//   header : magic[8] "HW3DLOG1", u32 version, u64 start time (ns since the
+//            Unix epoch)
+//   entries: u8 tag followed by
+//     kLogEntrySite   : u32 site id, u8 level, i32 line, u8 arg count,
+//                       u8 arg types[arg count], u16 file length, file,
+//                       u16 format length, format
+//     kLogEntryRecord : u32 site id, u64 ns since start, u16 thread id,
+//                       u16 payload length, payload
+//     kLogEntryDropped: u64 total records dropped so far
+//
+// Record payloads hold the arguments in site order: integers and doubles as
+// 8 bytes, bools as 1 byte, strings as u16 length plus bytes, and end after
+// the last argument that fit; the rest render as "<?>". Payloads are
+// copied in host byte order, which is little-endian on every target hw3d
+// builds for.
+constexpr char kLogMagic[8] = {'H', 'W', '3', 'D', 'L', 'O', 'G', '1'};
+constexpr std::uint32_t kLogVersion = 1;
+
+constexpr std::uint8_t kLogEntrySite = 1;
+constexpr std::uint8_t kLogEntryRecord = 2;
+constexpr std::uint8_t kLogEntryDropped = 3;
+
+}  // namespace hw3d
@@ -0,0 +1,270 @@
+﻿#include "loose_octree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace hw3d {
+
+namespace {
+
+constexpr int kCoordBits = 16;
+constexpr std::uint64_t kCoordMask = (1u << kCoordBits) - 1;
+static_assert(LooseOctree::kMaxDepth <= kCoordBits, "cells must fit a key");
+
+int DepthOf(std::uint64_t placement) noexcept {
+  return static_cast<int>(placement >> (3 * kCoordBits));
+}
+
+std::uint32_t CoordOf(std::uint64_t placement, int axis) noexcept {
+  return static_cast<std::uint32_t>(
+      (placement >> ((2 - axis) * kCoordBits)) & kCoordMask);
+}
+
+}  // namespace
+
+LooseOctree::LooseOctree(const Aabb& world, int max_depth)
+    : max_depth_(max_depth) {
+  if (IsEmpty(world)) {
+    throw std::invalid_argument("LooseOctree: empty world bounds");
+  }
+  if (max_depth < 0 || max_depth > kMaxDepth) {
+    throw std::invalid_argument("LooseOctree: depth out of range");
+  }
+  const Float3 size = world.max - world.min;
+  world_size_ = std::max({size.x, size.y, size.z});
+  if (!(world_size_ > 0.0f) || !std::isfinite(world_size_)) {
+    throw std::invalid_argument("LooseOctree: world bounds have no size");
+  }
+  const float half = world_size_ * 0.5f;
+  origin_ = Center(world) - Float3{half, half, half};
+  // a few ulps of the largest coordinate in the world
+  const float largest = std::max({std::fabs(origin_.x), std::fabs(origin_.y),
+                                  std::fabs(origin_.z)}) +
+                        world_size_;
+  slack_ = largest * 4.0f * std::numeric_limits<float>::epsilon();
+  Clear();
+}
+
+void LooseOctree::Reserve(std::size_t objects) {
+  if (objects > slots_.size()) {
+    slots_.resize(objects);
+    placement_of_.resize(objects);
+  }
+}
+
+void LooseOctree::Clear() {
+  // entry arrays stay allocated for the nodes that will reuse them
+  for (std::vector<Entry>& entries : entries_) {
+    entries.clear();
+  }
+  nodes_.clear();
+  free_nodes_.clear();
+  // the root's loose box is the world cube grown by half its size all round
+  NewNode(origin_ + Float3{0.5f, 0.5f, 0.5f} * world_size_,
+          world_size_ + slack_, kNoNode);
+  std::fill(slots_.begin(), slots_.end(), Slot());
+  size_ = 0;
+}
+
+std::uint64_t LooseOctree::Place(const Aabb& box) const noexcept {
+  const Float3 local = (Center(box) - origin_) * (1.0f / world_size_);
+  // also sends NaN and infinite boxes to the root
+  if (!(local.x >= 0.0f && local.x < 1.0f && local.y >= 0.0f &&
+        local.y < 1.0f && local.z >= 0.0f && local.z < 1.0f)) {
+    return 0;
+  }
+  const Float3 size = box.max - box.min;
+  const float largest = std::max({size.x, size.y, size.z});
+  // deepest level whose cell is still as large as the object, so the
+  // object stays inside the loose box of the cell holding its centre
+  int depth = 0;
+  float cell = world_size_;
+  while (depth < max_depth_ && largest <= cell * 0.5f) {
+    cell *= 0.5f;
+    depth++;
+  }
+  const float cells = static_cast<float>(1u << depth);
+  const std::uint32_t last = (1u << depth) - 1;
+  const std::uint64_t x =
+      std::min(static_cast<std::uint32_t>(local.x * cells), last);
+  const std::uint64_t y =
+      std::min(static_cast<std::uint32_t>(local.y * cells), last);
+  const std::uint64_t z =
+      std::min(static_cast<std::uint32_t>(local.z * cells), last);
+  return static_cast<std::uint64_t>(depth) << (3 * kCoordBits) |
+         x << (2 * kCoordBits) | y << kCoordBits | z;
+}
+
+std::uint32_t LooseOctree::NewNode(Float3 center,
+                                   float extent,
+                                   std::uint32_t parent) {
+  std::uint32_t index;
+  if (!free_nodes_.empty()) {
+    index = free_nodes_.back();
+    free_nodes_.pop_back();
+  } else {
+    index = static_cast<std::uint32_t>(nodes_.size());
+    nodes_.emplace_back();
+    if (entries_.size() < nodes_.size()) {
+      entries_.emplace_back();
+    }
+    // so that Unlink() never allocates
+    free_nodes_.reserve(nodes_.capacity());
+  }
+  Node& node = nodes_[index];
+  node.center = center;
+  node.extent = extent;
+  std::fill(std::begin(node.children), std::end(node.children), kNoNode);
+  node.parent = parent;
+  node.subtree_count = 0;
+  node.reserved[0] = 0;
+  node.reserved[1] = 0;
+  return index;
+}
+
+std::uint32_t LooseOctree::Acquire(std::uint64_t placement) {
+  const int depth = DepthOf(placement);
+  const std::uint32_t x = CoordOf(placement, 0);
+  const std::uint32_t y = CoordOf(placement, 1);
+  const std::uint32_t z = CoordOf(placement, 2);
+  std::uint32_t node = 0;
+  nodes_[node].subtree_count++;
+  float cell = world_size_;
+  for (int level = 1; level <= depth; level++) {
+    const int shift = depth - level;
+    const std::uint32_t cx = x >> shift;
+    const std::uint32_t cy = y >> shift;
+    const std::uint32_t cz = z >> shift;
+    const int slot = (cx & 1) | (cy & 1) << 1 | (cz & 1) << 2;
+    cell *= 0.5f;
+    std::uint32_t child = nodes_[node].children[slot];
+    if (child == kNoNode) {
+      const Float3 center =
+          origin_ + Float3{cx + 0.5f, cy + 0.5f, cz + 0.5f} * cell;
+      // NewNode() may move nodes_, so no reference is held across it
+      child = NewNode(center, cell + slack_, node);
+      nodes_[node].children[slot] = child;
+    }
+    node = child;
+    nodes_[node].subtree_count++;
+  }
+  return node;
+}
+
+void LooseOctree::Link(std::uint32_t object,
+                       const Aabb& box,
+                       std::uint64_t placement) {
+  const std::uint32_t node = Acquire(placement);
+  std::vector<Entry>& entries = entries_[node];
+  slots_[object] = {node, static_cast<std::uint32_t>(entries.size())};
+  entries.push_back({box, object});
+  placement_of_[object] = placement;
+}
+
+void LooseOctree::Unlink(std::uint32_t object) noexcept {
+  const Slot slot = slots_[object];
+  std::vector<Entry>& entries = entries_[slot.node];
+  entries[slot.index] = entries.back();
+  slots_[entries[slot.index].object].index = slot.index;
+  entries.pop_back();
+  // give back the nodes left empty; the root always stays
+  std::uint32_t node = slot.node;
+  while (node != 0) {
+    Node& n = nodes_[node];
+    const std::uint32_t parent = n.parent;
+    if (--n.subtree_count == 0) {
+      std::uint32_t* children = nodes_[parent].children;
+      *std::find(children, children + 8, node) = kNoNode;
+      free_nodes_.push_back(node);
+    }
+    node = parent;
+  }
+  nodes_[0].subtree_count--;
+  slots_[object] = Slot();
+}
+
+void LooseOctree::Grow(const std::uint32_t* objects, std::size_t count) {
+  std::uint32_t largest = 0;
+  for (std::size_t i = 0; i < count; i++) {
+    assert(objects[i] != kNoObject);
+    largest = std::max(largest, objects[i]);
+  }
+  Reserve(static_cast<std::size_t>(largest) + 1);
+}
+
+void LooseOctree::Insert(std::uint32_t object, const Aabb& box) {
+  Grow(&object, 1);
+  assert(!Contains(object));
+  Link(object, box, Place(box));
+  size_++;
+}
+
+void LooseOctree::Update(std::uint32_t object, const Aabb& box) {
+  assert(Contains(object));
+  const std::uint64_t placement = Place(box);
+  if (placement != placement_of_[object]) {
+    Unlink(object);
+    Link(object, box, placement);
+  } else {
+    entries_[slots_[object].node][slots_[object].index].box = box;
+  }
+}
+
+void LooseOctree::Remove(std::uint32_t object) noexcept {
+  if (!Contains(object)) {
+    return;
+  }
+  Unlink(object);
+  size_--;
+}
+
+void LooseOctree::PlaceBatch(const std::uint32_t* objects,
+                             const Aabb* boxes,
+                             std::size_t count,
+                             bool store_boxes) {
+  placements_.resize(count);
+  ParallelOptions options;
+  options.item_bytes = sizeof(std::uint64_t);
+  options.cost = &place_cost_;
+  ParallelForRange(
+      0, count,
+      [&](std::size_t b, std::size_t e) {
+        for (std::size_t i = b; i < e; i++) {
+          placements_[i] = Place(boxes[i]);
+          if (store_boxes) {
+            const Slot slot = slots_[objects[i]];
+            entries_[slot.node][slot.index].box = boxes[i];
+          }
+        }
+      },
+      options);
+}
+
+void LooseOctree::Insert(const std::uint32_t* objects,
+                         const Aabb* boxes,
+                         std::size_t count) {
+  Grow(objects, count);
+  PlaceBatch(objects, boxes, count, false);
+  for (std::size_t i = 0; i < count; i++) {
+    assert(!Contains(objects[i]));
+    Link(objects[i], boxes[i], placements_[i]);
+  }
+  size_ += count;
+}
+
+void LooseOctree::Update(const std::uint32_t* objects,
+                         const Aabb* boxes,
+                         std::size_t count) {
+  PlaceBatch(objects, boxes, count, true);
+  for (std::size_t i = 0; i < count; i++) {
+    const std::uint32_t object = objects[i];
+    assert(Contains(object));
+    if (placements_[i] != placement_of_[object]) {
+      Unlink(object);
+      Link(object, boxes[i], placements_[i]);
+    }
+  }
+}
+
+}  // namespace hw3d
@@ -0,0 +1,203 @@
+﻿#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "bounds.h"
+#include "parallel.h"
+
+namespace hw3d {
+
+// Loose octree over objects that come and go and move, for "what is near
+// here" queries on mixed static and dynamic scenes.
+//
+// Each node's box is its octree cell grown to twice the size, so an object
+// lives in the one node at the depth matching its size whose cell holds
+// its centre; it never straddles children and moving it only relinks it
+// when its centre crosses a cell. A node keeps the boxes of its objects in
+// one array, so queries scan them in order. Arrays and nodes are pooled:
+// a node freed when its branch empties keeps its array's capacity for the
+// next one, so inserts, moves and removals stop allocating once the pool
+// has grown to the working set. Empty branches are never walked.
+//
+// max_depth bounds how small cells get. Queries are fastest when the
+// smallest cell is about the size of a typical query; deeper trees spend
+// more time visiting nodes than they save in box tests.
+//
+// Objects are known by caller-chosen indices, which should be dense:
+// records are kept for every index up to the largest one inserted. Objects
+// whose centre lies outside the world box live in the root.
+//
+// Queries are const and may run on several threads at once; Insert(),
+// Update() and Remove() must not overlap them.
+class LooseOctree {
+ public:
+  static constexpr std::uint32_t kNoObject =
+      std::numeric_limits<std::uint32_t>::max();
+  static constexpr int kMaxDepth = 16;
+
+  // Throws std::invalid_argument if `world` is empty or max_depth is not
+  // within [0, kMaxDepth].
+  explicit LooseOctree(const Aabb& world, int max_depth = 8);
+
+  // Makes room for objects below `objects` without growing later.
+  void Reserve(std::size_t objects);
+  void Clear();
+
+  // `object` must not be in the tree yet.
+  void Insert(std::uint32_t object, const Aabb& box);
+  // `object` must be in the tree.
+  void Update(std::uint32_t object, const Aabb& box);
+  void Remove(std::uint32_t object) noexcept;
+  // Batches of distinct objects. Placement is computed on JobSystem workers
+  // when called from one; only objects that changed node are relinked.
+  void Insert(const std::uint32_t* objects,
+              const Aabb* boxes,
+              std::size_t count);
+  void Update(const std::uint32_t* objects,
+              const Aabb* boxes,
+              std::size_t count);
+
+  bool Contains(std::uint32_t object) const noexcept {
+    return object < slots_.size() && slots_[object].node != kNoNode;
+  }
+
+  // Calls fn(object) for every object whose box overlaps `box`.
+  template <typename Fn>
+  void QueryOverlap(const Aabb& box, Fn&& fn) const;
+  // Calls fn(object) for every object whose box is within `radius` of
+  // `center`.
+  template <typename Fn>
+  void QuerySphere(Float3 center, float radius, Fn&& fn) const;
+
+  std::size_t size() const noexcept { return size_; }
+  const Aabb& bounds(std::uint32_t object) const noexcept {
+    assert(Contains(object));
+    return entries_[slots_[object].node][slots_[object].index].box;
+  }
+  // Nodes in use, the root included.
+  std::size_t node_count() const noexcept {
+    return nodes_.size() - free_nodes_.size();
+  }
+
+ private:
+  static constexpr std::uint32_t kNoNode =
+      std::numeric_limits<std::uint32_t>::max();
+
+  struct alignas(64) Node {
+    // loose bounds: center +- extent on every axis
+    Float3 center;
+    float extent;
+    std::uint32_t children[8];
+    std::uint32_t parent;
+    // objects stored here and below; a node is freed when this reaches 0
+    std::uint32_t subtree_count;
+    std::uint32_t reserved[2];
+
+    Aabb Loose() const noexcept {
+      const Float3 e{extent, extent, extent};
+      return {center - e, center + e};
+    }
+  };
+  static_assert(sizeof(Node) == 64, "one node per cache line");
+
+  struct Entry {
+    Aabb box;
+    std::uint32_t object;
+  };
+
+  // Where an object's entry is.
+  struct Slot {
+    std::uint32_t node = kNoNode;
+    std::uint32_t index = 0;
+  };
+
+  // Depth and cell of the node an object belongs in, packed as
+  // depth << 48 | x << 32 | y << 16 | z. The root is 0.
+  std::uint64_t Place(const Aabb& box) const noexcept;
+  // Finds or creates the node for a placement and counts one more object
+  // on the way down.
+  std::uint32_t Acquire(std::uint64_t placement);
+  std::uint32_t NewNode(Float3 center, float extent, std::uint32_t parent);
+  void Link(std::uint32_t object, const Aabb& box, std::uint64_t placement);
+  void Unlink(std::uint32_t object) noexcept;
+  void Grow(const std::uint32_t* objects, std::size_t count);
+  // Parallel half of the batch calls: computes placements_, and for
+  // objects already in the tree stores their new boxes.
+  void PlaceBatch(const std::uint32_t* objects,
+                  const Aabb* boxes,
+                  std::size_t count,
+                  bool store_boxes);
+
+  template <typename NodeTest, typename ObjectTest, typename Fn>
+  void Visit(const NodeTest& node_test,
+             const ObjectTest& object_test,
+             Fn& fn) const;
+
+  Float3 origin_;
+  float world_size_;
+  // added to every loose extent to cover rounding in the cell centres
+  float slack_;
+  int max_depth_;
+  std::size_t size_ = 0;
+
+  std::vector<Node> nodes_;
+  // objects stored in each node, indexed like nodes_
+  std::vector<std::vector<Entry>> entries_;
+  std::vector<std::uint32_t> free_nodes_;
+  std::vector<Slot> slots_;
+  // current placement of each object, compared to skip relinking
+  std::vector<std::uint64_t> placement_of_;
+  // batch scratch, kept to avoid reallocating
+  std::vector<std::uint64_t> placements_;
+  ParallelCost place_cost_;
+};
+
+template <typename NodeTest, typename ObjectTest, typename Fn>
+void LooseOctree::Visit(const NodeTest& node_test,
+                        const ObjectTest& object_test,
+                        Fn& fn) const {
+  // every pop pushes at most eight children, one level further down
+  std::uint32_t stack[8 * kMaxDepth + 1];
+  int top = 0;
+  // the root is always visited: it also holds objects outside the world
+  stack[top++] = 0;
+  while (top > 0) {
+    const std::uint32_t index = stack[--top];
+    for (const Entry& entry : entries_[index]) {
+      if (object_test(entry.box)) {
+        fn(entry.object);
+      }
+    }
+    const Node& node = nodes_[index];
+    for (const std::uint32_t child : node.children) {
+      if (child != kNoNode && node_test(nodes_[child])) {
+        stack[top++] = child;
+      }
+    }
+  }
+}
+
+template <typename Fn>
+void LooseOctree::QueryOverlap(const Aabb& box, Fn&& fn) const {
+  Visit([&box](const Node& node) { return Overlaps(node.Loose(), box); },
+        [&box](const Aabb& object) { return Overlaps(object, box); }, fn);
+}
+
+template <typename Fn>
+void LooseOctree::QuerySphere(Float3 center, float radius, Fn&& fn) const {
+  const float radius_squared = radius * radius;
+  Visit(
+      [&](const Node& node) {
+        return DistanceSquared(node.Loose(), center) <= radius_squared;
+      },
+      [&](const Aabb& object) {
+        return DistanceSquared(object, center) <= radius_squared;
+      },
+      fn);
+}
+
+}  // namespace hw3d
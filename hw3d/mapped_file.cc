@@ -0,0 +1,116 @@
+﻿#include "mapped_file.h"
+
+#ifdef _WIN32
+#include "windows_config.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace hw3d {
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const char* path, std::size_t size) noexcept {
+  Close();
+  HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                            nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  const auto size64 = static_cast<unsigned long long>(size);
+  HANDLE mapping = CreateFileMappingA(
+      file, nullptr, PAGE_READWRITE, static_cast<DWORD>(size64 >> 32),
+      static_cast<DWORD>(size64 & 0xFFFFFFFFu), nullptr);
+  if (mapping == nullptr) {
+    CloseHandle(file);
+    return false;
+  }
+  void* view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  if (view == nullptr) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  file_ = file;
+  mapping_ = mapping;
+  data_ = view;
+  size_ = size;
+  return true;
+}
+
+void MappedFile::Close() noexcept {
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+    data_ = nullptr;
+  }
+  if (mapping_ != nullptr) {
+    CloseHandle(static_cast<HANDLE>(mapping_));
+    mapping_ = nullptr;
+  }
+  if (file_ != nullptr) {
+    CloseHandle(static_cast<HANDLE>(file_));
+    file_ = nullptr;
+  }
+  size_ = 0;
+}
+
+bool MappedFile::Flush() noexcept {
+  if (data_ == nullptr) {
+    return false;
+  }
+  return FlushViewOfFile(data_, size_) != 0 &&
+         FlushFileBuffers(static_cast<HANDLE>(file_)) != 0;
+}
+
+#else  // _WIN32
+
+bool MappedFile::Open(const char* path, std::size_t size) noexcept {
+  Close();
+  const int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    ::close(fd);
+    return false;
+  }
+  void* view = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (view == MAP_FAILED) {
+    ::close(fd);
+    return false;
+  }
+  fd_ = fd;
+  data_ = view;
+  size_ = size;
+  return true;
+}
+
+void MappedFile::Close() noexcept {
+  if (data_ != nullptr) {
+    ::munmap(data_, size_);
+    data_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  size_ = 0;
+}
+
+bool MappedFile::Flush() noexcept {
+  if (data_ == nullptr) {
+    return false;
+  }
+  return ::msync(data_, size_, MS_SYNC) == 0;
+}
+
+#endif  // _WIN32
+
+}  // namespace hw3d
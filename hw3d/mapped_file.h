@@ -0,0 +1,39 @@
+﻿#pragma once
+
+#include <cstddef>
+
+namespace hw3d {
+
+// Read/write memory mapping of a file of fixed size. Writes land in the OS
+// page cache as they happen, so the contents reach disk even if the process
+// dies without running any cleanup.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Creates (or truncates) `path` to `size` bytes and maps it. Returns false
+  // on failure, leaving the object closed.
+  bool Open(const char* path, std::size_t size) noexcept;
+  void Close() noexcept;
+  // Asks the OS to write dirty pages out now.
+  bool Flush() noexcept;
+
+  bool IsOpen() const noexcept { return data_ != nullptr; }
+  void* data() const noexcept { return data_; }
+  std::size_t size() const noexcept { return size_; }
+
+ private:
+  void* data_ = nullptr;
+  std::size_t size_ = 0;
+#ifdef _WIN32
+  void* file_ = nullptr;
+  void* mapping_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+};
+
+}  // namespace hw3d
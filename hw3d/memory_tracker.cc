@@ -0,0 +1,633 @@
+﻿#include "memory_tracker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#include <intrin.h>
+
+#include "windows_config.h"
+#else
+#include <dlfcn.h>
+#endif
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+
+namespace hw3d {
+
+namespace {
+
+constexpr std::size_t kTagCount = static_cast<std::size_t>(MemoryTag::kCount);
+
+constexpr std::size_t kMaxThreadSlots = 128;
+// A thread adds its byte count to the shared per-tag total, which is what
+// the high-water mark follows, once it has drifted this far; a single larger
+// allocation goes through at once. Peaks are exact to within this much per
+// thread.
+constexpr std::int64_t kPeakBatchBytes = 4096;
+
+// Counters owned by one thread at a time. The owner updates them with
+// relaxed loads and stores, so counting costs no locked instructions;
+// readers sum all slots. When a thread exits its slot goes, values and all,
+// to the next new thread, so the sums never go backwards. Threads past
+// kMaxThreadSlots, and threads already running their thread_local
+// destructors, share g_shared_slot and pay for atomic adds.
+struct alignas(64) ThreadSlot {
+  std::atomic<bool> owned{false};
+  std::atomic<std::int64_t> bytes[kTagCount];
+  std::atomic<std::uint64_t> allocations[kTagCount];
+  std::atomic<std::uint64_t> frees[kTagCount];
+  // bytes not yet added to the tag's published total; owner only
+  std::int64_t unpublished[kTagCount];
+};
+
+struct alignas(64) TagPeak {
+  std::atomic<std::int64_t> published{0};
+  std::atomic<std::int64_t> peak{0};
+};
+
+ThreadSlot g_slots[kMaxThreadSlots];
+ThreadSlot g_shared_slot;
+// slots [0, g_slots_used) have been claimed at some point
+std::atomic<std::size_t> g_slots_used{0};
+TagPeak g_peaks[kTagCount];
+
+thread_local ThreadSlot* tls_slot = nullptr;
+
+// Hands the thread's slot back when the thread exits.
+struct SlotRelease {
+  ThreadSlot* slot = nullptr;
+
+  ~SlotRelease() {
+    if (slot != nullptr) {
+      // allocations made by later thread_local destructors still count
+      tls_slot = &g_shared_slot;
+      slot->owned.store(false, std::memory_order_release);
+    }
+  }
+};
+
+thread_local SlotRelease tls_release;
+
+ThreadSlot& ClaimSlot() noexcept {
+  for (std::size_t i = 0; i < kMaxThreadSlots; i++) {
+    ThreadSlot& slot = g_slots[i];
+    bool expected = false;
+    if (!slot.owned.load(std::memory_order_relaxed) &&
+        slot.owned.compare_exchange_strong(expected, true,
+                                           std::memory_order_acquire)) {
+      std::size_t used = g_slots_used.load(std::memory_order_relaxed);
+      while (used < i + 1 && !g_slots_used.compare_exchange_weak(
+                                 used, i + 1, std::memory_order_relaxed)) {
+      }
+      tls_release.slot = &slot;
+      tls_slot = &slot;
+      return slot;
+    }
+  }
+  tls_slot = &g_shared_slot;
+  return g_shared_slot;
+}
+
+ThreadSlot& CurrentSlot() noexcept {
+  ThreadSlot* slot = tls_slot;
+  return slot != nullptr ? *slot : ClaimSlot();
+}
+
+template <typename T>
+void Bump(std::atomic<T>& counter, T delta, bool shared) noexcept {
+  if (shared) {
+    counter.fetch_add(delta, std::memory_order_relaxed);
+  } else {
+    counter.store(counter.load(std::memory_order_relaxed) + delta,
+                  std::memory_order_relaxed);
+  }
+}
+
+void RaisePeak(TagPeak& tag, std::int64_t now) noexcept {
+  std::int64_t peak = tag.peak.load(std::memory_order_relaxed);
+  while (now > peak && !tag.peak.compare_exchange_weak(
+                           peak, now, std::memory_order_relaxed)) {
+  }
+}
+
+void Count(MemoryTag tag, std::int64_t bytes, bool allocation) noexcept {
+  const auto t = static_cast<std::size_t>(tag);
+  ThreadSlot& slot = CurrentSlot();
+  const bool shared = &slot == &g_shared_slot;
+  Bump(slot.bytes[t], bytes, shared);
+  Bump(allocation ? slot.allocations[t] : slot.frees[t], std::uint64_t{1},
+       shared);
+
+  std::int64_t pending = bytes;
+  if (!shared) {
+    pending += slot.unpublished[t];
+    if (pending < kPeakBatchBytes && pending > -kPeakBatchBytes) {
+      slot.unpublished[t] = pending;
+      return;
+    }
+    slot.unpublished[t] = 0;
+  }
+  TagPeak& peak = g_peaks[t];
+  RaisePeak(peak, peak.published.fetch_add(pending,
+                                           std::memory_order_relaxed) +
+                      pending);
+}
+
+// Visits every slot that may hold counts.
+template <typename F>
+void ForEachSlot(F&& f) noexcept {
+  const std::size_t used = g_slots_used.load(std::memory_order_relaxed);
+  for (std::size_t i = 0; i < used; i++) {
+    f(g_slots[i]);
+  }
+  f(g_shared_slot);
+}
+
+// Sits right in front of every block handed out. 16 bytes, so the default
+// new alignment is kept.
+struct BlockHeader {
+  std::uint64_t size;
+  // from the malloc'd pointer to the user pointer
+  std::uint32_t offset;
+  MemoryTag tag;
+  // a SiteRecord sits in front of the header
+  bool tracked;
+  std::uint16_t reserved;
+};
+static_assert(sizeof(BlockHeader) == 16, "header must keep 16-byte alignment");
+
+// In front of the header of blocks allocated during a leak check; links the
+// live ones into a list.
+struct SiteRecord {
+  SiteRecord* prev;
+  SiteRecord* next;
+  const char* site;
+  void* caller;
+};
+static_assert(sizeof(SiteRecord) % 16 == 0, "record must keep alignment");
+
+thread_local MemoryTag tls_tag = MemoryTag::kUntagged;
+thread_local const char* tls_site = nullptr;
+// set while the report is built, so its own allocations neither take the
+// list lock nor show up as leaks
+thread_local bool tls_untracked = false;
+
+std::atomic<bool> g_leak_check{false};
+std::mutex g_sites_mutex;
+// circular list of live tracked blocks; the sentinel links to itself
+SiteRecord g_sites = {&g_sites, &g_sites, nullptr, nullptr};
+std::size_t g_site_count = 0;
+
+BlockHeader* HeaderOf(void* p) noexcept {
+  return static_cast<BlockHeader*>(p) - 1;
+}
+
+SiteRecord* RecordOf(BlockHeader* header) noexcept {
+  return reinterpret_cast<SiteRecord*>(header) - 1;
+}
+
+void* Allocate(std::size_t size, std::size_t alignment, void* caller) noexcept {
+  alignment = std::max<std::size_t>(alignment, alignof(BlockHeader));
+  const bool track =
+      g_leak_check.load(std::memory_order_relaxed) && !tls_untracked;
+  const std::size_t prefix =
+      sizeof(BlockHeader) + (track ? sizeof(SiteRecord) : 0);
+  const std::size_t slack = prefix + alignment - 1;
+  if (size > SIZE_MAX - slack) {
+    return nullptr;
+  }
+  auto* raw = static_cast<unsigned char*>(std::malloc(size + slack));
+  if (raw == nullptr) {
+    return nullptr;
+  }
+  const auto first = reinterpret_cast<std::uintptr_t>(raw + prefix);
+  auto* user = raw + (((first + alignment - 1) & ~(alignment - 1)) -
+                      reinterpret_cast<std::uintptr_t>(raw));
+
+  const MemoryTag tag = tls_tag;
+  BlockHeader* header = HeaderOf(user);
+  header->size = size;
+  header->offset = static_cast<std::uint32_t>(user - raw);
+  header->tag = tag;
+  header->tracked = track;
+  header->reserved = 0;
+
+  Count(tag, static_cast<std::int64_t>(size), true);
+
+  if (track) {
+    SiteRecord* record = RecordOf(header);
+    record->site = tls_site;
+    record->caller = caller;
+    std::lock_guard<std::mutex> lock(g_sites_mutex);
+    record->prev = &g_sites;
+    record->next = g_sites.next;
+    g_sites.next->prev = record;
+    g_sites.next = record;
+    ++g_site_count;
+  }
+  return user;
+}
+
+[[maybe_unused]] void Free(void* p) noexcept {
+  if (p == nullptr) {
+    return;
+  }
+  BlockHeader* header = HeaderOf(p);
+  Count(header->tag, -static_cast<std::int64_t>(header->size), false);
+  if (header->tracked) {
+    SiteRecord* record = RecordOf(header);
+    std::lock_guard<std::mutex> lock(g_sites_mutex);
+    record->prev->next = record->next;
+    record->next->prev = record->prev;
+    --g_site_count;
+  }
+  std::free(static_cast<unsigned char*>(p) - header->offset);
+}
+
+[[maybe_unused]] void* AllocateOrThrow(std::size_t size,
+                                       std::size_t alignment,
+                                       void* caller) {
+  for (;;) {
+    if (void* p = Allocate(size, alignment, caller)) {
+      return p;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+const char* BaseName(const char* path) noexcept {
+  const char* base = path;
+  for (const char* p = path; *p != '\0'; p++) {
+    if (*p == '/' || *p == '\\') {
+      base = p + 1;
+    }
+  }
+  return base;
+}
+
+// "module(function+0x12)" where the platform can tell, else the raw address.
+void DescribeAddress(void* address, char* out, std::size_t size) noexcept {
+  if (address == nullptr) {
+    std::snprintf(out, size, "?");
+    return;
+  }
+#ifdef _WIN32
+  HMODULE module = nullptr;
+  char name[MAX_PATH];
+  if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                             GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                         static_cast<LPCSTR>(address), &module) &&
+      GetModuleFileNameA(module, name, MAX_PATH) != 0) {
+    std::snprintf(out, size, "%s+0x%llx", BaseName(name),
+                  static_cast<unsigned long long>(
+                      static_cast<const char*>(address) -
+                      reinterpret_cast<const char*>(module)));
+    return;
+  }
+#else
+  Dl_info info;
+  if (dladdr(address, &info) != 0 && info.dli_fname != nullptr) {
+    if (info.dli_sname == nullptr) {
+      std::snprintf(out, size, "%s+0x%llx", BaseName(info.dli_fname),
+                    static_cast<unsigned long long>(
+                        static_cast<const char*>(address) -
+                        static_cast<const char*>(info.dli_fbase)));
+      return;
+    }
+    const char* symbol = info.dli_sname;
+#if defined(__GNUG__)
+    // the demangler allocates with malloc, not operator new
+    int status = 0;
+    char* demangled =
+        abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    if (status == 0 && demangled != nullptr) {
+      symbol = demangled;
+    }
+#endif
+    std::snprintf(out, size, "%s(%s+0x%llx)", BaseName(info.dli_fname),
+                  symbol,
+                  static_cast<unsigned long long>(
+                      static_cast<const char*>(address) -
+                      static_cast<const char*>(info.dli_saddr)));
+#if defined(__GNUG__)
+    std::free(demangled);
+#endif
+    return;
+  }
+#endif
+  std::snprintf(out, size, "%p", address);
+}
+
+struct LeakGroup {
+  const char* site;
+  void* caller;
+  MemoryTag tag;
+  std::size_t blocks;
+  std::uint64_t bytes;
+};
+
+}  // namespace
+
+const char* MemoryTagName(MemoryTag tag) noexcept {
+  switch (tag) {
+    case MemoryTag::kUntagged:
+      return "untagged";
+    case MemoryTag::kWindow:
+      return "window";
+    case MemoryTag::kInput:
+      return "input";
+    case MemoryTag::kGraphics:
+      return "graphics";
+    case MemoryTag::kAssets:
+      return "assets";
+    case MemoryTag::kJobs:
+      return "jobs";
+    case MemoryTag::kLogging:
+      return "logging";
+    case MemoryTag::kCount:
+      break;
+  }
+  return "?";
+}
+
+MemoryTracker& MemoryTracker::Get() noexcept {
+  static MemoryTracker tracker;
+  return tracker;
+}
+
+MemoryTracker::TagStats MemoryTracker::tag_stats(
+    MemoryTag tag) const noexcept {
+  TagStats stats;
+  if (tag >= MemoryTag::kCount) {
+    return stats;
+  }
+  const auto t = static_cast<std::size_t>(tag);
+  ForEachSlot([&](const ThreadSlot& slot) {
+    stats.current_bytes += slot.bytes[t].load(std::memory_order_relaxed);
+    stats.allocations += slot.allocations[t].load(std::memory_order_relaxed);
+    stats.frees += slot.frees[t].load(std::memory_order_relaxed);
+  });
+  stats.peak_bytes = std::max(stats.current_bytes,
+                              g_peaks[t].peak.load(std::memory_order_relaxed));
+  return stats;
+}
+
+void MemoryTracker::EndFrame() noexcept {
+  std::uint64_t total = 0;
+  ForEachSlot([&](const ThreadSlot& slot) {
+    for (const auto& allocations : slot.allocations) {
+      total += allocations.load(std::memory_order_relaxed);
+    }
+  });
+  const std::uint64_t count = total - frame_start_allocations_;
+  frame_start_allocations_ = total;
+  frames_.frames++;
+  frames_.last_frame_allocations = count;
+  frames_.max_frame_allocations =
+      std::max(frames_.max_frame_allocations, count);
+  if (count > frame_budget_) {
+    frames_.frames_over_budget++;
+  }
+}
+
+MemoryTracker::FrameStats MemoryTracker::frame_stats() const noexcept {
+  return frames_;
+}
+
+void MemoryTracker::BeginLeakCheck() noexcept {
+  g_leak_check.store(true, std::memory_order_relaxed);
+}
+
+void MemoryTracker::EndLeakCheck() noexcept {
+  g_leak_check.store(false, std::memory_order_relaxed);
+}
+
+std::size_t MemoryTracker::LiveTrackedAllocations() const noexcept {
+  std::lock_guard<std::mutex> lock(g_sites_mutex);
+  return g_site_count;
+}
+
+bool MemoryTracker::WriteReport(const char* path) const noexcept {
+  std::FILE* f = std::fopen(path, "w");
+  if (f == nullptr) {
+    return false;
+  }
+  std::fprintf(f, "hw3d memory report (tracking %s)\n",
+               kEnabled ? "on" : "off");
+
+  std::fprintf(f, "\n[Tags]\n%-10s %14s %14s %12s %12s\n", "tag",
+               "current B", "peak B", "allocs", "frees");
+  for (std::size_t i = 0; i < kTagCount; i++) {
+    const auto tag = static_cast<MemoryTag>(i);
+    const TagStats s = tag_stats(tag);
+    std::fprintf(f, "%-10s %14lld %14lld %12llu %12llu\n", MemoryTagName(tag),
+                 static_cast<long long>(s.current_bytes),
+                 static_cast<long long>(s.peak_bytes),
+                 static_cast<unsigned long long>(s.allocations),
+                 static_cast<unsigned long long>(s.frees));
+  }
+
+  std::fprintf(f,
+               "\n[Frames] %llu frames, last %llu allocations, max %llu",
+               static_cast<unsigned long long>(frames_.frames),
+               static_cast<unsigned long long>(frames_.last_frame_allocations),
+               static_cast<unsigned long long>(frames_.max_frame_allocations));
+  if (frame_budget_ == kNoBudget) {
+    std::fprintf(f, ", no budget\n");
+  } else {
+    std::fprintf(f, ", %llu over a budget of %llu\n",
+                 static_cast<unsigned long long>(frames_.frames_over_budget),
+                 static_cast<unsigned long long>(frame_budget_));
+  }
+
+  // group the live blocks by site and caller; nothing allocated here is
+  // tracked, so building the groups under the lock cannot deadlock
+  const bool was_untracked = tls_untracked;
+  tls_untracked = true;
+  std::vector<LeakGroup> groups;
+  std::size_t blocks = 0;
+  std::uint64_t bytes = 0;
+  try {
+    std::lock_guard<std::mutex> lock(g_sites_mutex);
+    groups.reserve(g_site_count);
+    for (const SiteRecord* r = g_sites.next; r != &g_sites; r = r->next) {
+      const auto* header = reinterpret_cast<const BlockHeader*>(r + 1);
+      groups.push_back({r->site, r->caller, header->tag, 1, header->size});
+    }
+  } catch (const std::bad_alloc&) {
+    groups.clear();
+  }
+  std::sort(groups.begin(), groups.end(),
+            [](const LeakGroup& a, const LeakGroup& b) {
+              return a.site != b.site ? std::less<>()(a.site, b.site)
+                                      : std::less<>()(a.caller, b.caller);
+            });
+  std::size_t merged = 0;
+  for (std::size_t i = 0; i < groups.size(); i++) {
+    blocks++;
+    bytes += groups[i].bytes;
+    if (merged > 0 && groups[merged - 1].site == groups[i].site &&
+        groups[merged - 1].caller == groups[i].caller) {
+      groups[merged - 1].blocks++;
+      groups[merged - 1].bytes += groups[i].bytes;
+    } else {
+      groups[merged++] = groups[i];
+    }
+  }
+  groups.resize(merged);
+  std::sort(groups.begin(), groups.end(),
+            [](const LeakGroup& a, const LeakGroup& b) {
+              return a.bytes > b.bytes;
+            });
+
+  std::fprintf(f, "\n[Leaks] %zu blocks, %llu bytes still live\n", blocks,
+               static_cast<unsigned long long>(bytes));
+  char caller[512];
+  for (const LeakGroup& g : groups) {
+    DescribeAddress(g.caller, caller, sizeof(caller));
+    std::fprintf(f, "%10llu B in %6zu blocks  %-8s %s from %s\n",
+                 static_cast<unsigned long long>(g.bytes), g.blocks,
+                 MemoryTagName(g.tag),
+                 g.site != nullptr ? BaseName(g.site) : "(no scope)", caller);
+  }
+  std::vector<LeakGroup>().swap(groups);
+  tls_untracked = was_untracked;
+
+  const bool ok = std::ferror(f) == 0;
+  return std::fclose(f) == 0 && ok;
+}
+
+MemoryTagScope::MemoryTagScope(MemoryTag tag, const char* site) noexcept
+    : previous_tag_(tls_tag), previous_site_(tls_site) {
+  tls_tag = tag;
+  tls_site = site;
+}
+
+MemoryTagScope::~MemoryTagScope() {
+  tls_tag = previous_tag_;
+  tls_site = previous_site_;
+}
+
+}  // namespace hw3d
+
+#if defined(HW3D_MEMORY_TRACKING) && HW3D_MEMORY_TRACKING
+
+// Replacements for every form of the global allocation functions. The
+// caller's address is taken here, in the operator itself, so it points at
+// the code that said `new` (or at the standard library helper that did).
+
+#ifdef _MSC_VER
+#define HW3D_CALLER() _ReturnAddress()
+#else
+#define HW3D_CALLER() __builtin_return_address(0)
+#endif
+
+namespace {
+
+constexpr std::size_t kDefaultAlign = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+  return hw3d::AllocateOrThrow(size, kDefaultAlign, HW3D_CALLER());
+}
+
+void* operator new[](std::size_t size) {
+  return hw3d::AllocateOrThrow(size, kDefaultAlign, HW3D_CALLER());
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return hw3d::Allocate(size, kDefaultAlign, HW3D_CALLER());
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return hw3d::Allocate(size, kDefaultAlign, HW3D_CALLER());
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+  return hw3d::AllocateOrThrow(size, static_cast<std::size_t>(align),
+                               HW3D_CALLER());
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+  return hw3d::AllocateOrThrow(size, static_cast<std::size_t>(align),
+                               HW3D_CALLER());
+}
+
+void* operator new(std::size_t size,
+                   std::align_val_t align,
+                   const std::nothrow_t&) noexcept {
+  return hw3d::Allocate(size, static_cast<std::size_t>(align), HW3D_CALLER());
+}
+
+void* operator new[](std::size_t size,
+                     std::align_val_t align,
+                     const std::nothrow_t&) noexcept {
+  return hw3d::Allocate(size, static_cast<std::size_t>(align), HW3D_CALLER());
+}
+
+void operator delete(void* p) noexcept {
+  hw3d::Free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  hw3d::Free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  hw3d::Free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+  hw3d::Free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+  hw3d::Free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  hw3d::Free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+  hw3d::Free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+  hw3d::Free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+  hw3d::Free(p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {
+  hw3d::Free(p);
+}
+
+void operator delete(void* p,
+                     std::align_val_t,
+                     const std::nothrow_t&) noexcept {
+  hw3d::Free(p);
+}
+
+void operator delete[](void* p,
+                       std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+  hw3d::Free(p);
+}
+
+#endif  // HW3D_MEMORY_TRACKING
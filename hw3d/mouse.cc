@@ -27,8 +27,6 @@
  ******************************************************************************************/
 #include "mouse.h"
 
-#include <windows.h>
-
 namespace hw3d {
 
 std::pair<int, int> Mouse::GetPos() const noexcept {
@@ -89,40 +87,40 @@ void Mouse::OnMouseEnter() noexcept {
   TrimBuffer();
 }
 
-void Mouse::OnLeftPressed(int x, int y) noexcept {
+void Mouse::OnLeftPressed(int /*x*/, int /*y*/) noexcept {
   left_is_pressed_ = true;
 
   buffer_.push(Mouse::Event(Mouse::Event::Type::LPress, *this));
   TrimBuffer();
 }
 
-void Mouse::OnLeftReleased(int x, int y) noexcept {
+void Mouse::OnLeftReleased(int /*x*/, int /*y*/) noexcept {
   left_is_pressed_ = false;
 
   buffer_.push(Mouse::Event(Mouse::Event::Type::LRelease, *this));
   TrimBuffer();
 }
 
-void Mouse::OnRightPressed(int x, int y) noexcept {
+void Mouse::OnRightPressed(int /*x*/, int /*y*/) noexcept {
   right_is_pressed_ = true;
 
   buffer_.push(Mouse::Event(Mouse::Event::Type::RPress, *this));
   TrimBuffer();
 }
 
-void Mouse::OnRightReleased(int x, int y) noexcept {
+void Mouse::OnRightReleased(int /*x*/, int /*y*/) noexcept {
   right_is_pressed_ = false;
 
   buffer_.push(Mouse::Event(Mouse::Event::Type::RRelease, *this));
   TrimBuffer();
 }
 
-void Mouse::OnWheelUp(int x, int y) noexcept {
+void Mouse::OnWheelUp(int /*x*/, int /*y*/) noexcept {
   buffer_.push(Mouse::Event(Mouse::Event::Type::WheelUp, *this));
   TrimBuffer();
 }
 
-void Mouse::OnWheelDown(int x, int y) noexcept {
+void Mouse::OnWheelDown(int /*x*/, int /*y*/) noexcept {
   buffer_.push(Mouse::Event(Mouse::Event::Type::WheelDown, *this));
   TrimBuffer();
 }
@@ -136,12 +134,12 @@ void Mouse::TrimBuffer() noexcept {
 void Mouse::OnWheelDelta(int x, int y, int delta) noexcept {
   wheel_delta_carry_ += delta;
   // generate events for every 120
-  while (wheel_delta_carry_ >= WHEEL_DELTA) {
-    wheel_delta_carry_ -= WHEEL_DELTA;
+  while (wheel_delta_carry_ >= wheelDelta) {
+    wheel_delta_carry_ -= wheelDelta;
     OnWheelUp(x, y);
   }
-  while (wheel_delta_carry_ <= -WHEEL_DELTA) {
-    wheel_delta_carry_ += WHEEL_DELTA;
+  while (wheel_delta_carry_ <= -wheelDelta) {
+    wheel_delta_carry_ += wheelDelta;
     OnWheelDown(x, y);
   }
 }
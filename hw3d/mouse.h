@@ -30,7 +30,7 @@
 namespace hw3d {
 
 class Mouse {
-  friend class Window;
+  friend class InputDispatcher;
 
  public:
   class Event {
@@ -106,8 +106,10 @@ class Mouse {
 
  private:
   static constexpr unsigned int bufferSize = 16u;
-  int x;
-  int y;
+  // wheel delta of one notch (WHEEL_DELTA on Win32)
+  static constexpr int wheelDelta = 120;
+  int x = 0;
+  int y = 0;
   bool left_is_pressed_ = false;
   bool right_is_pressed_ = false;
   bool is_in_window_ = false;
@@ -0,0 +1,94 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+namespace hw3d {
+
+// Bounded lock-free queue for many producers and a single consumer (after
+// Dmitry Vyukov's bounded MPMC ring). Each cell carries a sequence number
+// that tells producers and the consumer whose turn it is, so pushing is one
+// CAS on the tail plus a copy and a release store. A full queue rejects the
+// push instead of blocking.
+template <typename T>
+class MpscQueue {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "MpscQueue copies elements with plain assignment");
+
+ public:
+  // `capacity` is rounded up to a power of two.
+  explicit MpscQueue(std::size_t capacity)
+      : mask_(RoundUpPow2(capacity) - 1),
+        cells_(std::make_unique<Cell[]>(mask_ + 1)) {
+    for (std::size_t i = 0; i <= mask_; i++) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  // Safe to call from any number of threads.
+  bool TryPush(const T& value) noexcept {
+    std::size_t pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& cell = cells_[pos & mask_];
+      const std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+      const auto diff =
+          static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          cell.value = value;
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        // the consumer has not freed this cell yet: full
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Only the single consumer thread may call this.
+  bool TryPop(T& out) noexcept {
+    Cell& cell = cells_[head_ & mask_];
+    const std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+    if (seq != head_ + 1) {
+      return false;
+    }
+    out = cell.value;
+    cell.sequence.store(head_ + mask_ + 1, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+
+  std::size_t capacity() const noexcept { return mask_ + 1; }
+
+ private:
+  static constexpr std::size_t kCacheLine = 64;
+
+  struct Cell {
+    std::atomic<std::size_t> sequence;
+    T value;
+  };
+
+  static std::size_t RoundUpPow2(std::size_t n) noexcept {
+    std::size_t p = 2;
+    while (p < n) {
+      p <<= 1;
+    }
+    return p;
+  }
+
+  const std::size_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+  // producers and the consumer each get their own cache line
+  alignas(kCacheLine) std::atomic<std::size_t> tail_{0};
+  alignas(kCacheLine) std::size_t head_ = 0;
+};
+
+}  // namespace hw3d
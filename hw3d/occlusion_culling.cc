@@ -0,0 +1,557 @@
+﻿#include "occlusion_culling.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+namespace hw3d {
+
+namespace {
+
+// Tile rows per rasterizer task.
+constexpr int kBandTileRows = 4;
+
+std::uint64_t NowNs() noexcept {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+// Bits [lo, hi) of one 8-pixel tile row; the bounds are relative to the
+// tile and may fall outside it.
+inline std::uint32_t RowBits(int lo, int hi) noexcept {
+  lo = std::clamp(lo, 0, OcclusionCuller::kTileWidth);
+  hi = std::clamp(hi, 0, OcclusionCuller::kTileWidth);
+  return hi > lo ? (1u << hi) - (1u << lo) : 0u;
+}
+
+// Bit 0 of every tile row in [first, last].
+inline std::uint32_t RowSelect(int first, int last) noexcept {
+  return (0x01010101u >> (8 * (3 - (last - first)))) << (8 * first);
+}
+
+// Pixel coordinates, clamped to [-1, limit] first so that they stay in the
+// int range. Truncating a positive shifted value rounds without a call to
+// floorf, which SSE2 builds would need.
+inline int FloorToInt(float v, float limit) noexcept {
+  return static_cast<int>(std::clamp(v, -1.0f, limit) + 1.0f) - 1;
+}
+
+inline int CeilToInt(float v, float limit) noexcept {
+  const float shift = limit + 1.0f;
+  return static_cast<int>(shift) -
+         static_cast<int>(shift - std::clamp(v, -1.0f, limit));
+}
+
+}  // namespace
+
+OcclusionCuller::OcclusionCuller(int width, int height) {
+  if (width <= 0 || height <= 0) {
+    throw std::invalid_argument("occlusion buffer size must be positive");
+  }
+  tiles_x_ = (width + kTileWidth - 1) / kTileWidth;
+  tiles_y_ = (height + kTileHeight - 1) / kTileHeight;
+  width_ = tiles_x_ * kTileWidth;
+  height_ = tiles_y_ * kTileHeight;
+  tiles_.resize(static_cast<std::size_t>(tiles_x_) * tiles_y_);
+  BeginFrame(MatIdentity());
+}
+
+void OcclusionCuller::BeginFrame(const Mat4& view_projection) {
+  view_projection_ = view_projection;
+  Float4x4 elements;
+  Store(&elements, view_projection);
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      splat_view_projection_[i][j] = VecSplat(elements.m[i][j]);
+    }
+  }
+  std::fill(tiles_.begin(), tiles_.end(), Tile{0, 1.0f, 0.0f});
+  triangle_slots_ = 0;
+  triangle_ranges_.clear();
+  stats_ = Stats();
+}
+
+void OcclusionCuller::AddOccluder(const Float3* vertices,
+                                  std::size_t vertex_count,
+                                  const std::uint32_t* indices,
+                                  std::size_t index_count,
+                                  const Mat4& world,
+                                  bool cull_back_faces) {
+  const std::uint64_t start = NowNs();
+  const Mat4 m = world * view_projection_;
+  clip_.resize(vertex_count);
+  screen_.resize(vertex_count);
+  ParallelOptions vertex_options;
+  vertex_options.item_bytes = sizeof(Float4);
+  vertex_options.cost = &vertex_cost_;
+  ParallelForRange(
+      0, vertex_count,
+      [&](std::size_t b, std::size_t e) {
+        for (std::size_t i = b; i < e; i++) {
+          Store(&clip_[i], TransformPoint(Load(vertices[i]), m));
+          // meaningless for vertices the near plane cuts away, which
+          // SetupTriangle() projects again after clipping
+          screen_[i] = Project(clip_[i]);
+        }
+      },
+      vertex_options);
+
+  const std::size_t count = index_count / 3;
+  const std::size_t base = triangle_slots_;
+  triangle_slots_ += 2 * count;
+  // grown, never shrunk, so a steady frame does not clear the slots again
+  if (triangles_.size() < triangle_slots_) {
+    triangles_.resize(triangle_slots_);
+  }
+  ParallelOptions setup_options;
+  setup_options.item_bytes = 2 * sizeof(Triangle);
+  setup_options.cost = &setup_cost_;
+  ParallelForRange(
+      0, count,
+      [&](std::size_t b, std::size_t e) {
+        // a chunk packs its triangles at the start of its own slots
+        const std::size_t first = base + 2 * b;
+        std::size_t made = 0;
+        for (std::size_t i = b; i < e; i++) {
+          made += SetupTriangle(indices + 3 * i, cull_back_faces,
+                                &triangles_[first + made]);
+        }
+        std::lock_guard<std::mutex> lock(triangle_ranges_mutex_);
+        triangle_ranges_.push_back({static_cast<std::uint32_t>(first),
+                                    static_cast<std::uint32_t>(made)});
+        stats_.rasterized_triangles += made;
+      },
+      setup_options);
+  stats_.occluder_triangles += count;
+  stats_.setup_ns += NowNs() - start;
+}
+
+Float3 OcclusionCuller::Project(const Float4& clip) const noexcept {
+  const float inverse_w = 1.0f / clip.w;
+  return {(clip.x * inverse_w + 1.0f) * (0.5f * width_),
+          (1.0f - clip.y * inverse_w) * (0.5f * height_), clip.z * inverse_w};
+}
+
+std::size_t OcclusionCuller::SetupTriangle(const std::uint32_t* index,
+                                           bool cull_back_faces,
+                                           Triangle* out) const noexcept {
+  const Float4& a = clip_[index[0]];
+  const Float4& b = clip_[index[1]];
+  const Float4& c = clip_[index[2]];
+  // wholly outside one clip plane
+  if ((a.x < -a.w && b.x < -b.w && c.x < -c.w) ||
+      (a.x > a.w && b.x > b.w && c.x > c.w) ||
+      (a.y < -a.w && b.y < -b.w && c.y < -c.w) ||
+      (a.y > a.w && b.y > b.w && c.y > c.w) ||
+      (a.z < 0.0f && b.z < 0.0f && c.z < 0.0f) ||
+      (a.z > a.w && b.z > b.w && c.z > c.w)) {
+    return 0;
+  }
+  // past the near plane (which for any usual projection means w > 0 too)
+  // the vertices were projected already
+  if (a.z >= 0.0f && b.z >= 0.0f && c.z >= 0.0f && a.w > 0.0f &&
+      b.w > 0.0f && c.w > 0.0f) {
+    const Float3 v[3] = {screen_[index[0]], screen_[index[1]],
+                         screen_[index[2]]};
+    return AddScreenTriangle(v, cull_back_faces, out) ? 1 : 0;
+  }
+  // cut at the near plane, which leaves a triangle or a quad
+  const Float4* in[3] = {&a, &b, &c};
+  Float4 polygon[4];
+  int n = 0;
+  for (int i = 0; i < 3; i++) {
+    const Float4& p = *in[i];
+    const Float4& q = *in[(i + 1) % 3];
+    if (p.z >= 0.0f) {
+      polygon[n++] = p;
+    }
+    if ((p.z >= 0.0f) != (q.z >= 0.0f)) {
+      const float t = p.z / (p.z - q.z);
+      polygon[n++] = {p.x + (q.x - p.x) * t, p.y + (q.y - p.y) * t, 0.0f,
+                      p.w + (q.w - p.w) * t};
+    }
+  }
+  Float3 screen[4];
+  for (int i = 0; i < n; i++) {
+    // only an odd projection puts w <= 0 past the near plane; dropping an
+    // occluder is always safe
+    if (!(polygon[i].w > 0.0f)) {
+      return 0;
+    }
+    screen[i] = Project(polygon[i]);
+  }
+  std::size_t made = 0;
+  for (int i = 2; i < n; i++) {
+    const Float3 v[3] = {screen[0], screen[i - 1], screen[i]};
+    made += AddScreenTriangle(v, cull_back_faces, out + made) ? 1 : 0;
+  }
+  return made;
+}
+
+bool OcclusionCuller::AddScreenTriangle(const Float3 (&in)[3],
+                                        bool cull_back_faces,
+                                        Triangle* out) const noexcept {
+  Float3 v[3] = {in[0], in[1], in[2]};
+  // positive for clockwise on screen, y pointing down
+  float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) -
+               (v[2].x - v[0].x) * (v[1].y - v[0].y);
+  if (!(area > 0.0f)) {
+    if (cull_back_faces || !(area < 0.0f)) {
+      return false;
+    }
+    std::swap(v[1], v[2]);
+    area = -area;
+  }
+  Triangle& tri = *out;
+  tri.min_x = std::min({v[0].x, v[1].x, v[2].x});
+  tri.max_x = std::max({v[0].x, v[1].x, v[2].x});
+  tri.min_y = std::min({v[0].y, v[1].y, v[2].y});
+  tri.max_y = std::max({v[0].y, v[1].y, v[2].y});
+  float row_min = std::max(tri.min_y, 0.0f);
+  float row_max = std::min(tri.max_y, static_cast<float>(height_));
+  for (int i = 0; i < 3; i++) {
+    const Float3& p = v[i];
+    const Float3& q = v[(i + 1) % 3];
+    const float a = p.y - q.y;
+    const float b = q.x - p.x;
+    // centres on a shared edge go to both triangles, so meshes have no
+    // cracks
+    const float c = -(a * p.x + b * p.y);
+    tri.edge_a[i] = a;
+    tri.edge_b[i] = b;
+    tri.edge_c[i] = c;
+    tri.side[i] = a > 0.0f ? 1 : a < 0.0f ? -1 : 0;
+    if (a == 0.0f) {
+      // b * y + c >= 0
+      if (b > 0.0f) {
+        row_min = std::max(row_min, -c / b);
+      } else {
+        row_max = std::min(row_max, -c / b);
+      }
+    }
+  }
+  // rows whose centres lie in [row_min, row_max]
+  const auto width = static_cast<float>(width_);
+  const auto height = static_cast<float>(height_);
+  tri.first_row = CeilToInt(row_min - 0.5f, height);
+  tri.last_row = std::min(FloorToInt(row_max - 0.5f, height), height_ - 1);
+  // no pixel centre inside the bounding box: most small triangles of a
+  // dense mesh end here
+  if (tri.first_row > tri.last_row ||
+      std::max(CeilToInt(tri.min_x - 0.5f, width), 0) >
+          std::min(FloorToInt(tri.max_x - 0.5f, width), width_ - 1)) {
+    return false;
+  }
+
+  const float x1 = v[1].x - v[0].x;
+  const float y1 = v[1].y - v[0].y;
+  const float z1 = v[1].z - v[0].z;
+  const float x2 = v[2].x - v[0].x;
+  const float y2 = v[2].y - v[0].y;
+  const float z2 = v[2].z - v[0].z;
+  tri.dz_dx = (z1 * y2 - z2 * y1) / area;
+  tri.dz_dy = (z2 * x1 - z1 * x2) / area;
+  tri.z_origin = v[0].z - tri.dz_dx * v[0].x - tri.dz_dy * v[0].y;
+  tri.z_max = std::max({v[0].z, v[1].z, v[2].z});
+  return true;
+}
+
+void OcclusionCuller::Rasterize() {
+  const std::uint64_t start = NowNs();
+  const int bands = (tiles_y_ + kBandTileRows - 1) / kBandTileRows;
+  band_triangles_.resize(bands);
+  for (auto& list : band_triangles_) {
+    list.clear();
+  }
+  // submission order, whichever order the setup chunks finished in
+  std::sort(triangle_ranges_.begin(), triangle_ranges_.end(),
+            [](const TriangleRange& a, const TriangleRange& b) {
+              return a.first < b.first;
+            });
+  for (const TriangleRange& range : triangle_ranges_) {
+    for (std::uint32_t i = range.first; i < range.first + range.count; i++) {
+      const Triangle& tri = triangles_[i];
+      const int first = tri.first_row / (kTileHeight * kBandTileRows);
+      const int last = tri.last_row / (kTileHeight * kBandTileRows);
+      for (int band = first; band <= last; band++) {
+        band_triangles_[band].push_back(i);
+      }
+    }
+  }
+  ParallelOptions options;
+  options.grain = 1;
+  ParallelFor(
+      0, static_cast<std::size_t>(bands),
+      [&](std::size_t band) {
+        const int first = static_cast<int>(band) * kBandTileRows;
+        RasterizeBand(band_triangles_[band], first,
+                      std::min(tiles_y_, first + kBandTileRows));
+      },
+      options);
+  stats_.rasterize_ns += NowNs() - start;
+}
+
+void OcclusionCuller::RasterizeBand(const std::vector<std::uint32_t>& band,
+                                    int first_tile_row,
+                                    int end_tile_row) noexcept {
+  // triangles in submission order, so the result does not depend on how
+  // bands are scheduled
+  for (const std::uint32_t index : band) {
+    const Triangle& tri = triangles_[index];
+    const int first = std::max(first_tile_row, tri.first_row / kTileHeight);
+    const int last = std::min(end_tile_row - 1, tri.last_row / kTileHeight);
+    for (int tile_row = first; tile_row <= last; tile_row++) {
+      RasterizeTileRow(tri, tile_row);
+    }
+  }
+}
+
+void OcclusionCuller::RasterizeTileRow(const Triangle& tri,
+                                       int tile_row) noexcept {
+  // the four pixel rows of the tile row at once: the span of pixel
+  // centres inside every edge
+  const int top = tile_row * kTileHeight;
+  const float y = static_cast<float>(top) + 0.5f;
+  const Vec4 row_y = VecSet(y, y + 1.0f, y + 2.0f, y + 3.0f);
+  const auto width = static_cast<float>(width_);
+  Vec4 left = VecZero();
+  Vec4 right = VecSplat(width);
+  for (int i = 0; i < 3; i++) {
+    if (tri.side[i] == 0) {
+      continue;
+    }
+    // a * x + b * y + c >= 0 solved for x; dividing rather than
+    // multiplying by 1 / a keeps near-horizontal edges finite
+    const Vec4 bound = MulAdd(row_y, VecSplat(tri.edge_b[i]),
+                              VecSplat(tri.edge_c[i])) /
+                       VecSplat(-tri.edge_a[i]);
+    if (tri.side[i] > 0) {
+      left = Max(left, bound);
+    } else {
+      right = Min(right, bound);
+    }
+  }
+  // pixel i is in when left <= i + 0.5 <= right
+  float lefts[4];
+  float rights[4];
+  math_detail::StoreFloats(lefts, Min(left, VecSplat(width)) - VecSplat(0.5f));
+  math_detail::StoreFloats(rights, Max(right, VecZero()) - VecSplat(0.5f));
+  int lo[4];
+  int hi[4];
+  int span_lo = width_;
+  int span_hi = 0;
+  for (int k = 0; k < kTileHeight; k++) {
+    const int row = top + k;
+    lo[k] = CeilToInt(lefts[k], width);
+    hi[k] = FloorToInt(rights[k], width) + 1;
+    if (row < tri.first_row || row > tri.last_row || hi[k] <= lo[k]) {
+      lo[k] = hi[k] = 0;
+      continue;
+    }
+    span_lo = std::min(span_lo, lo[k]);
+    span_hi = std::max(span_hi, hi[k]);
+  }
+  if (span_lo >= span_hi) {
+    return;
+  }
+
+  // the depth plane peaks at a corner of the tile clipped to the bounding
+  // box, and never passes the farthest vertex
+  const float y0 = std::max(tri.min_y, static_cast<float>(top));
+  const float y1 = std::min(tri.max_y, static_cast<float>(top + kTileHeight));
+  const float z_rows =
+      tri.z_origin + std::max(tri.dz_dy * y0, tri.dz_dy * y1);
+  Tile* tiles = &tiles_[static_cast<std::size_t>(tile_row) * tiles_x_];
+  for (int tx = span_lo / kTileWidth; tx <= (span_hi - 1) / kTileWidth;
+       tx++) {
+    const int x = tx * kTileWidth;
+    const float x0 = std::max(tri.min_x, static_cast<float>(x));
+    const float x1 = std::min(tri.max_x, static_cast<float>(x + kTileWidth));
+    const float z = std::min(
+        z_rows + std::max(tri.dz_dx * x0, tri.dz_dx * x1), tri.z_max);
+    Tile& tile = tiles[tx];
+    if (!(z < tile.z0)) {
+      continue;
+    }
+    std::uint32_t mask = 0;
+    for (int k = 0; k < kTileHeight; k++) {
+      mask |= RowBits(lo[k] - x, hi[k] - x) << (8 * k);
+    }
+    if (mask == 0) {
+      continue;
+    }
+    // when the triangle is nearer the reference layer than the working
+    // one, merging would push the working layer back further than
+    // starting it over loses
+    if (z - tile.z1 > tile.z0 - z) {
+      tile.mask = 0;
+      tile.z1 = 0.0f;
+    }
+    tile.mask |= mask;
+    tile.z1 = std::max(tile.z1, z);
+    if (tile.mask == ~0u) {
+      tile.z0 = tile.z1;
+      tile.mask = 0;
+      tile.z1 = 0.0f;
+    }
+  }
+}
+
+bool OcclusionCuller::IsRectVisible(int x0,
+                                    int y0,
+                                    int x1,
+                                    int y1,
+                                    float z) const noexcept {
+  for (int ty = y0 / kTileHeight; ty <= y1 / kTileHeight; ty++) {
+    const int top = ty * kTileHeight;
+    const std::uint32_t rows = RowSelect(std::max(y0 - top, 0),
+                                         std::min(y1 - top, kTileHeight - 1));
+    const Tile* tiles = &tiles_[static_cast<std::size_t>(ty) * tiles_x_];
+    for (int tx = x0 / kTileWidth; tx <= x1 / kTileWidth; tx++) {
+      const int x = tx * kTileWidth;
+      // no carries: the row bits fit in a byte
+      const std::uint32_t covered = RowBits(x0 - x, x1 + 1 - x) * rows;
+      const Tile& tile = tiles[tx];
+      if (((covered & ~tile.mask) != 0 && z <= tile.z0) ||
+          ((covered & tile.mask) != 0 && z <= tile.z1)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void OcclusionCuller::ProjectBoxes(const Vec4 (&center)[3],
+                                   const Vec4 (&extent)[3],
+                                   BoxRects* out) const noexcept {
+  const Vec4(&m)[4][4] = splat_view_projection_;
+  // clip-space centres, and the extents along each box axis
+  Vec4 c[4];
+  Vec4 e[3][4];
+  for (int j = 0; j < 4; j++) {
+    c[j] = MulAdd(center[0], m[0][j],
+                  MulAdd(center[1], m[1][j], MulAdd(center[2], m[2][j],
+                                                    m[3][j])));
+    for (int a = 0; a < 3; a++) {
+      e[a][j] = extent[a] * m[a][j];
+    }
+  }
+  Vec4 min_x = VecSplat(std::numeric_limits<float>::infinity());
+  Vec4 max_x = -min_x;
+  Vec4 min_y = min_x;
+  Vec4 max_y = max_x;
+  Vec4 min_z = min_x;
+  Vec4 near = min_x;
+  for (int corner = 0; corner < 8; corner++) {
+    Vec4 p[4];
+    for (int j = 0; j < 4; j++) {
+      p[j] = corner & 1 ? c[j] + e[0][j] : c[j] - e[0][j];
+      p[j] = corner & 2 ? p[j] + e[1][j] : p[j] - e[1][j];
+      p[j] = corner & 4 ? p[j] + e[2][j] : p[j] - e[2][j];
+    }
+    near = Min(near, Min(p[2], p[3]));
+    const Vec4 inverse_w = VecSplat(1.0f) / p[3];
+    const Vec4 x = p[0] * inverse_w;
+    const Vec4 y = p[1] * inverse_w;
+    min_x = Min(min_x, x);
+    max_x = Max(max_x, x);
+    min_y = Min(min_y, y);
+    max_y = Max(max_y, y);
+    min_z = Min(min_z, p[2] * inverse_w);
+  }
+  // to pixels; y points down on screen
+  const Vec4 half_width = VecSplat(0.5f * width_);
+  const Vec4 half_height = VecSplat(0.5f * height_);
+  math_detail::StoreFloats(out->min_x,
+                           MulAdd(min_x, half_width, half_width));
+  math_detail::StoreFloats(out->max_x,
+                           MulAdd(max_x, half_width, half_width));
+  math_detail::StoreFloats(out->min_y,
+                           half_height - max_y * half_height);
+  math_detail::StoreFloats(out->max_y,
+                           half_height - min_y * half_height);
+  math_detail::StoreFloats(out->min_z, min_z);
+  math_detail::StoreFloats(out->near, near);
+}
+
+bool OcclusionCuller::IsBoxVisible(const BoxRects& rects,
+                                   int lane) const noexcept {
+  // NaN fails the comparison too
+  if (!(rects.near[lane] > 0.0f)) {
+    return true;
+  }
+  const auto width = static_cast<float>(width_);
+  const auto height = static_cast<float>(height_);
+  const float left = rects.min_x[lane];
+  const float right = rects.max_x[lane];
+  const float top = rects.min_y[lane];
+  const float bottom = rects.max_y[lane];
+  if (right < 0.0f || left >= width || bottom < 0.0f || top >= height) {
+    return false;
+  }
+  // every pixel the rectangle touches
+  return IsRectVisible(std::max(FloorToInt(left, width), 0),
+                       std::max(FloorToInt(top, height), 0),
+                       std::min(FloorToInt(right, width), width_ - 1),
+                       std::min(FloorToInt(bottom, height), height_ - 1),
+                       rects.min_z[lane]);
+}
+
+bool OcclusionCuller::IsVisible(const Aabb& box) const noexcept {
+  if (IsEmpty(box)) {
+    return false;
+  }
+  const Float3 center = Center(box);
+  const Float3 extent = Extent(box);
+  BoxRects rects;
+  ProjectBoxes({VecSplat(center.x), VecSplat(center.y), VecSplat(center.z)},
+               {VecSplat(extent.x), VecSplat(extent.y), VecSplat(extent.z)},
+               &rects);
+  return IsBoxVisible(rects, 0);
+}
+
+std::size_t OcclusionCuller::Cull(const AabbArray& boxes,
+                                  const std::uint32_t* candidates,
+                                  std::size_t count,
+                                  std::uint32_t* visible) {
+  const std::uint64_t start = NowNs();
+  const std::size_t total = compactor_.Run(
+      count, visible, &test_cost_,
+      [&](std::size_t b, std::size_t e, std::uint32_t* out) {
+        // in place is fine: a chunk writes at or before what it reads
+        std::size_t kept = 0;
+        for (std::size_t i = b; i < e; i += 4) {
+          // a short last group repeats its last box
+          const auto lanes = static_cast<int>(std::min<std::size_t>(4, e - i));
+          std::uint32_t objects[4];
+          for (int k = 0; k < 4; k++) {
+            objects[k] = candidates[i + std::min(k, lanes - 1)];
+          }
+          const auto gather = [&objects](const float* v) {
+            return VecSet(v[objects[0]], v[objects[1]], v[objects[2]],
+                          v[objects[3]]);
+          };
+          BoxRects rects;
+          ProjectBoxes({gather(boxes.center_x()), gather(boxes.center_y()),
+                        gather(boxes.center_z())},
+                       {gather(boxes.extent_x()), gather(boxes.extent_y()),
+                        gather(boxes.extent_z())},
+                       &rects);
+          for (int k = 0; k < lanes; k++) {
+            out[kept] = objects[k];
+            kept += IsBoxVisible(rects, k) ? 1 : 0;
+          }
+        }
+        return kept;
+      });
+  stats_.tested_objects += count;
+  stats_.occluded_objects += count - total;
+  stats_.test_ns += NowNs() - start;
+  return total;
+}
+
+}  // namespace hw3d
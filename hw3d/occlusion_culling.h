@@ -0,0 +1,193 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "bounds.h"
+#include "frustum_culling.h"
+#include "parallel.h"
+#include "vector_math.h"
+
+// Software occlusion culling in the style of masked occlusion culling:
+// occluder triangles are rasterized into a small depth buffer that keeps,
+// per 8x4 pixel tile, a 32-bit coverage mask and two conservative depths
+// instead of a depth per pixel. Occludee boxes are then tested against it
+// before their draws are submitted.
+//
+// Culling is conservative at the buffer's resolution: occluders cover the
+// pixels whose centres they contain, as on the GPU, tile depths are upper
+// bounds of what was drawn, and occludees are tested with every pixel their
+// screen rectangle touches at their nearest depth. Only a sliver thinner
+// than a buffer pixel between occluders can be culled by mistake. Expects
+// the Direct3D depth range (clip z in [0, w], 1 at the far plane), as
+// MatPerspectiveFovLH() produces.
+
+namespace hw3d {
+
+class OcclusionCuller {
+ public:
+  // Tile size in pixels: one bit of the coverage mask per pixel.
+  static constexpr int kTileWidth = 8;
+  static constexpr int kTileHeight = 4;
+
+  // Work of the current frame, reset by BeginFrame().
+  struct Stats {
+    std::uint64_t occluder_triangles = 0;
+    // left after back-face, off-screen and near-plane culling; a triangle
+    // cut by the near plane can count twice
+    std::uint64_t rasterized_triangles = 0;
+    std::uint64_t tested_objects = 0;
+    std::uint64_t occluded_objects = 0;
+    std::uint64_t setup_ns = 0;
+    std::uint64_t rasterize_ns = 0;
+    std::uint64_t test_ns = 0;
+  };
+
+  // The buffer size is rounded up to whole tiles; the viewport is stretched
+  // over it, which only changes the pixel aspect. 320x192 or so is plenty
+  // for occlusion.
+  OcclusionCuller(int width, int height);
+
+  int width() const noexcept { return width_; }
+  int height() const noexcept { return height_; }
+
+  // Clears the buffer and the stats and sets the camera for the frame.
+  void BeginFrame(const Mat4& view_projection);
+  // Queues an indexed triangle list, transformed by `world`. Occluders
+  // should be closed or solid from the camera's side, and simplified: a
+  // few hundred triangles per object at most. With `cull_back_faces`,
+  // counter-clockwise triangles, as seen on screen, are skipped, which is
+  // the Direct3D default.
+  void AddOccluder(const Float3* vertices,
+                   std::size_t vertex_count,
+                   const std::uint32_t* indices,
+                   std::size_t index_count,
+                   const Mat4& world,
+                   bool cull_back_faces = true);
+  // Rasterizes every queued occluder, in bands of tile rows that run in
+  // parallel when called from a JobSystem worker. Call once per frame
+  // between the last AddOccluder() and the first test.
+  void Rasterize();
+
+  // Whether any part of a world-space box may be visible. Boxes crossing
+  // the near plane always are; boxes entirely off screen never are.
+  bool IsVisible(const Aabb& box) const noexcept;
+  // Writes the entries of `candidates` (indices into `boxes`, usually the
+  // output of FrustumCuller) whose boxes may be visible to `visible`, in
+  // order, and returns how many. `visible` may be `candidates`. Runs on
+  // several workers for long lists.
+  std::size_t Cull(const AabbArray& boxes,
+                   const std::uint32_t* candidates,
+                   std::size_t count,
+                   std::uint32_t* visible);
+
+  Stats stats() const noexcept { return stats_; }
+
+ private:
+  // Pixels in the mask are covered by the working layer and lie no
+  // farther than z1; the rest lie no farther than z0. Once the working
+  // layer covers the tile it becomes the new z0.
+  struct Tile {
+    std::uint32_t mask;
+    float z0;
+    float z1;
+  };
+
+  // A screen-space triangle ready for the band rasterizers.
+  struct Triangle {
+    // edge functions a * x + b * y + c, non-negative inside; side says
+    // whether an edge bounds rows from the left (+1) or the right (-1), or
+    // is horizontal (0) and already folded into the rows
+    float edge_a[3];
+    float edge_b[3];
+    float edge_c[3];
+    std::int32_t side[3];
+    // pixel rows that may have coverage, inclusive
+    std::int32_t first_row;
+    std::int32_t last_row;
+    // bounding box in pixels
+    float min_x;
+    float min_y;
+    float max_x;
+    float max_y;
+    // depth plane z = z_origin + dz_dx * x + dz_dy * y, and its maximum
+    // over the triangle
+    float z_origin;
+    float dz_dx;
+    float dz_dy;
+    float z_max;
+  };
+
+  // Screen rectangles and nearest depths of four boxes, one per lane.
+  struct BoxRects {
+    float min_x[4];
+    float min_y[4];
+    float max_x[4];
+    float max_y[4];
+    float min_z[4];
+    // smallest clip z or w of any corner; not positive when the box
+    // reaches in front of the near plane
+    float near[4];
+  };
+
+  // Triangles set up by one chunk of an AddOccluder() call.
+  struct TriangleRange {
+    std::uint32_t first;
+    std::uint32_t count;
+  };
+
+  // Clip space to pixels and depth.
+  Float3 Project(const Float4& clip) const noexcept;
+  // Sets up the triangle of the three vertices at `index` into `out`,
+  // which has room for the two a near-plane cut can produce; returns how
+  // many.
+  std::size_t SetupTriangle(const std::uint32_t* index,
+                            bool cull_back_faces,
+                            Triangle* out) const noexcept;
+  bool AddScreenTriangle(const Float3 (&v)[3],
+                         bool cull_back_faces,
+                         Triangle* out) const noexcept;
+  void RasterizeBand(const std::vector<std::uint32_t>& band,
+                     int first_tile_row,
+                     int end_tile_row) noexcept;
+  void RasterizeTileRow(const Triangle& tri, int tile_row) noexcept;
+  // Projects the eight corners of four boxes given as centre and extent
+  // vectors, one box per lane.
+  void ProjectBoxes(const Vec4 (&center)[3],
+                    const Vec4 (&extent)[3],
+                    BoxRects* out) const noexcept;
+  bool IsBoxVisible(const BoxRects& rects, int lane) const noexcept;
+  // Tests the pixel rectangle [x0, x1] x [y0, y1] at depth z.
+  bool IsRectVisible(int x0, int y0, int x1, int y1, float z) const noexcept;
+
+ private:
+  int width_;
+  int height_;
+  int tiles_x_;
+  int tiles_y_;
+  Mat4 view_projection_;
+  // every element of view_projection_ splatted, for four boxes at a time
+  Vec4 splat_view_projection_[4][4];
+  std::vector<Tile> tiles_;
+  // vertices of the occluder being added, in clip space and on screen
+  std::vector<Float4> clip_;
+  std::vector<Float3> screen_;
+  // two slots per queued triangle, since the near plane can cut one in
+  // two; only the ranges below hold set-up triangles
+  std::vector<Triangle> triangles_;
+  std::size_t triangle_slots_ = 0;
+  std::vector<TriangleRange> triangle_ranges_;
+  std::mutex triangle_ranges_mutex_;
+  // indices of the triangles touching each band of tile rows
+  std::vector<std::vector<std::uint32_t>> band_triangles_;
+  Stats stats_;
+
+  ParallelCost vertex_cost_;
+  ParallelCost setup_cost_;
+  ParallelCost test_cost_;
+  ParallelCompactor compactor_;
+};
+
+}  // namespace hw3d
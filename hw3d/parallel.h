@@ -0,0 +1,407 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "job_system.h"
+
+// Data-parallel loops on top of JobSystem. The calling thread works on the
+// loop too, then helps with other jobs until every chunk is done. Outside a
+// JobSystem worker, or with one worker, loops run serially on the caller.
+//
+// Unless a fixed grain is given, a loop first runs a few growing slices
+// serially to time one item, then sizes chunks to about kTargetChunkNs of
+// work and stays serial if the whole loop would take less than
+// kMinParallelNs. Chunks are claimed dynamically, so uneven items balance
+// out. Loop bodies must not throw.
+
+namespace hw3d {
+
+// Keeps the measured cost of one item across calls, so a loop that runs
+// every frame stops probing once it has a measurement and keeps adapting as
+// the cost drifts. One per call site; not thread-safe.
+class ParallelCost {
+ public:
+  // 0 until the first measurement.
+  double ns_per_item() const noexcept { return ns_per_item_; }
+
+  void Record(std::size_t items, std::uint64_t ns) noexcept {
+    if (items == 0) {
+      return;
+    }
+    const double sample = static_cast<double>(ns) / items;
+    ns_per_item_ = ns_per_item_ == 0.0
+                       ? sample
+                       : ns_per_item_ + (sample - ns_per_item_) * 0.25;
+  }
+
+ private:
+  double ns_per_item_ = 0.0;
+};
+
+struct ParallelOptions {
+  // items per chunk; 0 picks one from the measured cost
+  std::size_t grain = 0;
+  // bytes of output per item; chunks are rounded to whole cache lines of
+  // output so neighbouring chunks never write the same line (assuming the
+  // output starts on a line)
+  std::size_t item_bytes = 0;
+  ParallelCost* cost = nullptr;
+};
+
+namespace parallel_detail {
+
+constexpr std::size_t kCacheLine = 64;
+// long enough to make the ~100 ns of job overhead negligible, short enough
+// to leave several chunks per worker
+constexpr std::uint64_t kTargetChunkNs = 20000;
+// below this, waking workers costs more than it saves
+constexpr std::uint64_t kMinParallelNs = 40000;
+// a probe slice this long gives a usable per-item time
+constexpr std::uint64_t kProbeNs = 2000;
+// chunks per task at least, so a slow worker does not hold up the loop
+constexpr std::size_t kChunksPerTask = 4;
+
+inline std::uint64_t NowNs() noexcept {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+// Tasks a loop may fan out to from the calling thread.
+inline unsigned AvailableTasks() noexcept {
+  JobSystem& jobs = JobSystem::Get();
+  if (!jobs.IsRunning() || JobSystem::CurrentWorker() < 0) {
+    return 1;
+  }
+  return jobs.worker_count();
+}
+
+inline std::size_t RoundUp(std::size_t n, std::size_t multiple) noexcept {
+  return (n + multiple - 1) / multiple * multiple;
+}
+
+// State shared by the tasks of one loop; lives on the caller's stack.
+template <typename Fn>
+struct Loop {
+  Fn* fn;
+  std::size_t end;
+  std::size_t grain;
+  alignas(kCacheLine) std::atomic<std::size_t> next;
+  alignas(kCacheLine) std::atomic<std::uint64_t> busy_ns{0};
+
+  void Work(unsigned task) noexcept {
+    const std::uint64_t start = NowNs();
+    for (;;) {
+      const std::size_t b = next.fetch_add(grain, std::memory_order_relaxed);
+      if (b >= end) {
+        break;
+      }
+      (*fn)(task, b, std::min(end, b + grain));
+    }
+    busy_ns.fetch_add(NowNs() - start, std::memory_order_relaxed);
+  }
+};
+
+// Calls fn(task, chunk_begin, chunk_end) over [begin, end) on up to
+// `max_tasks` tasks; `task` is below the task count and no two chunks of
+// the same task run at once.
+template <typename Fn>
+void RunChunks(std::size_t begin,
+               std::size_t end,
+               const ParallelOptions& options,
+               unsigned max_tasks,
+               Fn&& fn) {
+  if (begin >= end) {
+    return;
+  }
+  unsigned tasks = std::min(AvailableTasks(), std::max(max_tasks, 1u));
+  const std::size_t line_items =
+      options.item_bytes == 0 || options.item_bytes >= kCacheLine
+          ? 1
+          : kCacheLine / options.item_bytes;
+  std::size_t grain = options.grain;
+
+  if (tasks > 1 && grain == 0) {
+    double ns_per_item =
+        options.cost != nullptr ? options.cost->ns_per_item() : 0.0;
+    if (ns_per_item == 0.0) {
+      // time growing slices until one is long enough to measure
+      std::size_t count = line_items;
+      std::size_t probed = 0;
+      std::uint64_t probe_ns = 0;
+      while (begin < end && probe_ns < kProbeNs) {
+        count = std::min(count, end - begin);
+        const std::uint64_t t0 = NowNs();
+        fn(0u, begin, begin + count);
+        probe_ns += NowNs() - t0;
+        probed += count;
+        begin += count;
+        count *= 2;
+      }
+      if (options.cost != nullptr) {
+        options.cost->Record(probed, probe_ns);
+      }
+      ns_per_item = static_cast<double>(probe_ns) / probed;
+    }
+    const std::size_t remaining = end - begin;
+    if (ns_per_item * remaining < kMinParallelNs) {
+      tasks = 1;
+    } else {
+      // clamp in floating point: for a tiny per-item cost the quotient does
+      // not fit in size_t, and converting it would be undefined
+      const double per_chunk = kTargetChunkNs / ns_per_item;
+      const std::size_t target =
+          per_chunk < static_cast<double>(remaining)
+              ? static_cast<std::size_t>(per_chunk) + 1
+              : remaining;
+      const std::size_t balanced =
+          std::max<std::size_t>(1, remaining / (tasks * kChunksPerTask));
+      grain = std::min(target, balanced);
+    }
+  }
+  if (begin >= end) {
+    return;
+  }
+
+  if (tasks <= 1) {
+    const std::uint64_t t0 = options.cost != nullptr ? NowNs() : 0;
+    fn(0u, begin, end);
+    if (options.cost != nullptr) {
+      options.cost->Record(end - begin, NowNs() - t0);
+    }
+    return;
+  }
+
+  grain = RoundUp(std::max<std::size_t>(grain, 1), line_items);
+  const std::size_t chunks = (end - begin + grain - 1) / grain;
+  tasks = static_cast<unsigned>(std::min<std::size_t>(tasks, chunks));
+  using Fun = std::remove_reference_t<Fn>;
+  Loop<Fun> loop{&fn, end, grain, {begin}};
+  JobCounter counter;
+  JobSystem& jobs = JobSystem::Get();
+  for (unsigned task = 1; task < tasks; task++) {
+    Loop<Fun>* shared = &loop;
+    jobs.Run([shared, task] { shared->Work(task); }, &counter);
+  }
+  loop.Work(0);
+  jobs.Wait(counter);
+  if (options.cost != nullptr) {
+    options.cost->Record(end - begin,
+                         loop.busy_ns.load(std::memory_order_relaxed));
+  }
+}
+
+template <typename T>
+struct alignas(kCacheLine) Partial {
+  T value;
+};
+
+}  // namespace parallel_detail
+
+// Calls body(i) for every i in [begin, end), in no particular order.
+template <typename Body>
+void ParallelFor(std::size_t begin,
+                 std::size_t end,
+                 Body&& body,
+                 const ParallelOptions& options = ParallelOptions()) {
+  parallel_detail::RunChunks(
+      begin, end, options, ~0u,
+      [&body](unsigned, std::size_t b, std::size_t e) {
+        for (std::size_t i = b; i < e; i++) {
+          body(i);
+        }
+      });
+}
+
+// Calls body(chunk_begin, chunk_end) over disjoint chunks covering
+// [begin, end), for bodies with a tighter inner loop than one call per item.
+template <typename Body>
+void ParallelForRange(std::size_t begin,
+                      std::size_t end,
+                      Body&& body,
+                      const ParallelOptions& options = ParallelOptions()) {
+  parallel_detail::RunChunks(
+      begin, end, options, ~0u,
+      [&body](unsigned, std::size_t b, std::size_t e) { body(b, e); });
+}
+
+// Folds [begin, end): map(chunk_begin, chunk_end) returns the value of a
+// chunk and combine(a, b) merges two values. Each task folds its chunks into
+// its own partial, and the partials are combined in task order, so combine
+// must be associative and `identity` neutral; with floating point the
+// rounding can differ from run to run.
+template <typename T, typename Map, typename Combine>
+T ParallelReduce(std::size_t begin,
+                 std::size_t end,
+                 T identity,
+                 Map&& map,
+                 Combine&& combine,
+                 const ParallelOptions& options = ParallelOptions()) {
+  const unsigned tasks = parallel_detail::AvailableTasks();
+  std::vector<parallel_detail::Partial<T>> partials(
+      tasks, parallel_detail::Partial<T>{identity});
+  parallel_detail::RunChunks(
+      begin, end, options, tasks,
+      [&](unsigned task, std::size_t b, std::size_t e) {
+        T& partial = partials[task].value;
+        partial = combine(std::move(partial), map(b, e));
+      });
+  T result = std::move(identity);
+  for (auto& partial : partials) {
+    result = combine(std::move(result), std::move(partial.value));
+  }
+  return result;
+}
+
+// Filters [0, n) in parallel into a packed array. kernel(chunk_begin,
+// chunk_end, out) writes the items it keeps from its chunk to `out`, which
+// points at out + chunk_begin, and returns how many; the chunks are then
+// slid together in order, so the result is the same as the serial one.
+// Chunks end on cache lines of the output, so neighbours never share one.
+// Keeps its scratch across calls; one per call site.
+class ParallelCompactor {
+ public:
+  template <typename T, typename Kernel>
+  std::size_t Run(std::size_t n,
+                  T* out,
+                  ParallelCost* cost,
+                  const Kernel& kernel) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "chunks are moved with memmove");
+    chunks_.clear();
+    ParallelOptions options;
+    options.item_bytes = sizeof(T);
+    options.cost = cost;
+    ParallelForRange(
+        0, n,
+        [&](std::size_t b, std::size_t e) {
+          const std::size_t kept = kernel(b, e, out + b);
+          std::lock_guard<std::mutex> lock(mutex_);
+          chunks_.push_back({b, kept});
+        },
+        options);
+    // in the order they finished
+    std::sort(chunks_.begin(), chunks_.end(),
+              [](const Chunk& a, const Chunk& b) { return a.begin < b.begin; });
+    std::size_t total = 0;
+    for (const Chunk& chunk : chunks_) {
+      if (chunk.begin != total) {
+        std::memmove(out + total, out + chunk.begin, chunk.kept * sizeof(T));
+      }
+      total += chunk.kept;
+    }
+    return total;
+  }
+
+ private:
+  struct Chunk {
+    std::size_t begin;
+    std::size_t kept;
+  };
+
+  std::mutex mutex_;
+  std::vector<Chunk> chunks_;
+};
+
+namespace parallel_detail {
+
+// blocks smaller than this are not worth a task in a scan
+constexpr std::size_t kMinScanBlock = 4096;
+
+template <typename T, typename Op>
+void Scan(const T* in,
+          T* out,
+          std::size_t n,
+          const T& identity,
+          Op& op,
+          bool inclusive) {
+  const auto scan_block = [&](std::size_t b, std::size_t e, T acc) {
+    for (std::size_t i = b; i < e; i++) {
+      if (inclusive) {
+        acc = op(acc, in[i]);
+        out[i] = acc;
+      } else {
+        T value = in[i];
+        out[i] = acc;
+        acc = op(acc, value);
+      }
+    }
+  };
+  const unsigned tasks = AvailableTasks();
+  const std::size_t line_items = std::max<std::size_t>(
+      1, kCacheLine / std::max<std::size_t>(sizeof(T), 1));
+  const std::size_t block = RoundUp(
+      std::max(kMinScanBlock, n / (std::size_t{tasks} * kChunksPerTask) + 1),
+      line_items);
+  const std::size_t blocks = (n + block - 1) / block;
+  if (tasks <= 1 || blocks < 2) {
+    scan_block(0, n, identity);
+    return;
+  }
+
+  // pass 1: the total of every block but the last
+  ParallelOptions per_block;
+  per_block.grain = 1;
+  std::vector<T> offsets(blocks, identity);
+  RunChunks(0, blocks - 1, per_block, tasks,
+            [&](unsigned, std::size_t first, std::size_t last) {
+              for (std::size_t k = first; k < last; k++) {
+                T sum = identity;
+                const std::size_t e = std::min(n, (k + 1) * block);
+                for (std::size_t i = k * block; i < e; i++) {
+                  sum = op(sum, in[i]);
+                }
+                offsets[k] = std::move(sum);
+              }
+            });
+  // block totals to block offsets
+  T running = identity;
+  for (std::size_t k = 0; k < blocks; k++) {
+    T sum = std::move(offsets[k]);
+    offsets[k] = running;
+    running = op(running, sum);
+  }
+  // pass 2: scan every block from its offset
+  RunChunks(0, blocks, per_block, tasks,
+            [&](unsigned, std::size_t first, std::size_t last) {
+              for (std::size_t k = first; k < last; k++) {
+                scan_block(k * block, std::min(n, (k + 1) * block),
+                           offsets[k]);
+              }
+            });
+}
+
+}  // namespace parallel_detail
+
+// out[i] = in[0] op ... op in[i]. `op` must be associative; `in` and `out`
+// may be the same array.
+template <typename T, typename Op>
+void ParallelInclusiveScan(const T* in,
+                           T* out,
+                           std::size_t n,
+                           const T& identity,
+                           Op op) {
+  parallel_detail::Scan(in, out, n, identity, op, true);
+}
+
+// out[i] = identity op in[0] op ... op in[i - 1].
+template <typename T, typename Op>
+void ParallelExclusiveScan(const T* in,
+                           T* out,
+                           std::size_t n,
+                           const T& identity,
+                           Op op) {
+  parallel_detail::Scan(in, out, n, identity, op, false);
+}
+
+}  // namespace hw3d
@@ -0,0 +1,41 @@
+﻿#pragma once
+
+#include <optional>
+#include <string>
+
+#include "keyboard.h"
+#include "mouse.h"
+#include "surface.h"
+
+namespace hw3d {
+
+// Where a window's event pump runs.
+enum class PumpMode {
+  // PumpMessages() handles OS events on the calling (game) thread
+  kCallerThread,
+  // a dedicated thread pumps events and forwards input through an
+  // InputChannel; PumpMessages() only drains it. Modal loops (dragging the
+  // window) and slow message handlers then no longer stall frames, and a
+  // slow frame no longer stalls the pump.
+  kDedicatedThread,
+};
+
+// Platform-neutral view of a window as the frame loop uses it: input
+// devices, a surface to draw into and a message pump. Implemented by the
+// Win32 Window and by HeadlessWindow.
+class PlatformWindow {
+ public:
+  virtual ~PlatformWindow() = default;
+
+  virtual Keyboard& kbd() noexcept = 0;
+  virtual Mouse& mouse() noexcept = 0;
+  virtual Surface& surface() noexcept = 0;
+
+  virtual void SetTitle(const std::string& title) = 0;
+
+  // Handles every pending event without blocking. Returns the exit code once
+  // the window has been asked to quit, std::nullopt otherwise.
+  virtual std::optional<int> PumpMessages() noexcept = 0;
+};
+
+}  // namespace hw3d
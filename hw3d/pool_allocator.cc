@@ -0,0 +1,315 @@
+﻿#include "pool_allocator.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace hw3d {
+
+namespace {
+
+constexpr std::size_t kGuardBytes = 16;
+constexpr unsigned char kGuardByte = 0xFD;
+// payload of a free block
+constexpr unsigned char kFreeByte = 0xDD;
+// payload of a block just handed out
+constexpr unsigned char kFreshByte = 0xCD;
+
+std::size_t RoundUp(std::size_t n, std::size_t multiple) noexcept {
+  return (n + multiple - 1) / multiple * multiple;
+}
+
+// Assigns thread cache slots to pools. A slot's generation changes every
+// time it is handed out, so a cache left over from a destroyed pool is
+// recognised and dropped.
+struct CacheRegistry {
+  std::mutex mutex;
+  FixedPool* pools[FixedPool::kMaxCachedPools] = {};
+  std::uint32_t generations[FixedPool::kMaxCachedPools] = {};
+};
+
+// Never destroyed: thread caches flush through it when threads exit,
+// which can be after static destruction started.
+CacheRegistry& Registry() {
+  static CacheRegistry* registry = new CacheRegistry();
+  return *registry;
+}
+
+// Free blocks are chained through their first bytes.
+void* Next(const void* block) noexcept {
+  void* next;
+  std::memcpy(&next, block, sizeof(next));
+  return next;
+}
+
+void SetNext(void* block, void* next) noexcept {
+  std::memcpy(block, &next, sizeof(next));
+}
+
+}  // namespace
+
+// The calling thread's caches, one per registered pool. Returns cached
+// blocks to their pools when the thread exits.
+struct PoolThreadCaches {
+  FixedPool::Cache caches[FixedPool::kMaxCachedPools];
+
+  ~PoolThreadCaches() {
+    CacheRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (std::size_t i = 0; i < FixedPool::kMaxCachedPools; i++) {
+      FixedPool* pool = registry.pools[i];
+      if (pool != nullptr && caches[i].generation == registry.generations[i]) {
+        pool->Flush(caches[i], 0);
+      }
+    }
+  }
+};
+
+namespace {
+
+thread_local PoolThreadCaches tls_caches;
+
+}  // namespace
+
+FixedPool::FixedPool(std::size_t block_size, std::size_t alignment)
+    : block_size_(block_size),
+      alignment_(std::max(alignment, alignof(void*))) {
+  // The free-list link sits in a block's first bytes: over the payload in
+  // release builds, ahead of the front guard in debug builds so that the
+  // whole payload can stay poisoned.
+#if HW3D_POOL_DEBUG
+  payload_offset_ = RoundUp(sizeof(void*) + kGuardBytes, alignment_);
+  stride_ = RoundUp(payload_offset_ + block_size_ + kGuardBytes, alignment_);
+#else
+  payload_offset_ = 0;
+  stride_ = RoundUp(std::max(block_size_, sizeof(void*)), alignment_);
+#endif
+  blocks_per_slab_ = std::max<std::size_t>(16, kSlabBytes / stride_);
+  stats_.block_size = block_size_;
+
+  CacheRegistry& registry = Registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (std::size_t i = 0; i < kMaxCachedPools; i++) {
+    if (registry.pools[i] == nullptr) {
+      registry.pools[i] = this;
+      // never 0, which marks an unused cache
+      generation_ = ++registry.generations[i];
+      if (generation_ == 0) {
+        generation_ = ++registry.generations[i];
+      }
+      cache_index_ = static_cast<int>(i);
+      break;
+    }
+  }
+}
+
+FixedPool::~FixedPool() {
+  if (cache_index_ >= 0) {
+    CacheRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.pools[cache_index_] = nullptr;
+  }
+  for (void* slab : slabs_) {
+    ::operator delete(slab, std::align_val_t(alignment_));
+  }
+}
+
+void* FixedPool::Allocate() {
+  unsigned char* block;
+  if (Cache* cache = ThreadCache()) {
+    if (cache->head == nullptr) {
+      Refill(*cache);
+    }
+    block = static_cast<unsigned char*>(cache->head);
+    cache->head = Next(block);
+    cache->count--;
+    cache->allocations++;
+  } else {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_head_ == nullptr) {
+      AddSlab();
+    }
+    block = static_cast<unsigned char*>(free_head_);
+    free_head_ = Next(block);
+    free_count_--;
+    stats_.allocations++;
+    live_++;
+    stats_.peak_live =
+        std::max(stats_.peak_live, static_cast<std::uint64_t>(live_));
+  }
+  void* payload = ToPayload(block);
+#if HW3D_POOL_DEBUG
+  CheckPoison(block);
+  std::memset(payload, kFreshByte, block_size_);
+#endif
+  return payload;
+}
+
+void FixedPool::Deallocate(void* p) noexcept {
+  if (p == nullptr) {
+    return;
+  }
+  void* block = ToBlock(p);
+#if HW3D_POOL_DEBUG
+  CheckGuards(static_cast<unsigned char*>(block));
+  std::memset(p, kFreeByte, block_size_);
+#endif
+  if (Cache* cache = ThreadCache()) {
+    SetNext(block, cache->head);
+    cache->head = block;
+    cache->count++;
+    cache->frees++;
+    if (cache->count >= 2 * kCacheBatch) {
+      Flush(*cache, kCacheBatch);
+    }
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  SetNext(block, free_head_);
+  free_head_ = block;
+  free_count_++;
+  stats_.frees++;
+  live_--;
+}
+
+FixedPool::Stats FixedPool::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+FixedPool::Cache* FixedPool::ThreadCache() noexcept {
+  if (cache_index_ < 0) {
+    return nullptr;
+  }
+  Cache& cache = tls_caches.caches[cache_index_];
+  if (cache.generation != generation_) {
+    // left over from a pool that has been destroyed; its blocks are gone
+    cache = Cache();
+    cache.generation = generation_;
+  }
+  return &cache;
+}
+
+void FixedPool::Refill(Cache& cache) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_head_ == nullptr) {
+    AddSlab();
+  }
+  for (std::uint32_t i = 0; i < kCacheBatch && free_head_ != nullptr; i++) {
+    void* link = free_head_;
+    free_head_ = Next(link);
+    free_count_--;
+    SetNext(link, cache.head);
+    cache.head = link;
+    cache.count++;
+  }
+  stats_.refills++;
+  FoldCounts(cache);
+}
+
+void FixedPool::Flush(Cache& cache, std::uint32_t count) noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (count == 0) {
+    count = cache.count;
+  }
+  for (std::uint32_t i = 0; i < count && cache.head != nullptr; i++) {
+    void* link = cache.head;
+    cache.head = Next(link);
+    cache.count--;
+    SetNext(link, free_head_);
+    free_head_ = link;
+    free_count_++;
+  }
+  stats_.flushes++;
+  FoldCounts(cache);
+}
+
+void FixedPool::AddSlab() {
+  const std::size_t bytes = blocks_per_slab_ * stride_;
+  auto* slab = static_cast<unsigned char*>(
+      ::operator new(bytes, std::align_val_t(alignment_)));
+  slabs_.push_back(slab);
+#if HW3D_POOL_DEBUG
+  std::memset(slab, kGuardByte, bytes);
+  for (std::size_t i = 0; i < blocks_per_slab_; i++) {
+    std::memset(slab + i * stride_ + payload_offset_, kFreeByte, block_size_);
+  }
+#endif
+  // link in reverse so blocks are handed out in address order
+  for (std::size_t i = blocks_per_slab_; i-- > 0;) {
+    void* block = slab + i * stride_;
+    SetNext(block, free_head_);
+    free_head_ = block;
+  }
+  free_count_ += blocks_per_slab_;
+  stats_.slabs++;
+  stats_.reserved_bytes += bytes;
+}
+
+void FixedPool::FoldCounts(Cache& cache) noexcept {
+  stats_.allocations += cache.allocations;
+  stats_.frees += cache.frees;
+  live_ += static_cast<std::int64_t>(cache.allocations) -
+           static_cast<std::int64_t>(cache.frees);
+  if (live_ > 0) {
+    stats_.peak_live =
+        std::max(stats_.peak_live, static_cast<std::uint64_t>(live_));
+  }
+  cache.allocations = 0;
+  cache.frees = 0;
+}
+
+void* FixedPool::ToPayload(void* block) const noexcept {
+  return static_cast<unsigned char*>(block) + payload_offset_;
+}
+
+void* FixedPool::ToBlock(void* payload) const noexcept {
+  return static_cast<unsigned char*>(payload) - payload_offset_;
+}
+
+#if HW3D_POOL_DEBUG
+
+namespace {
+
+[[noreturn]] void ReportCorruption(const char* what,
+                                   std::size_t block_size,
+                                   const void* payload) {
+  std::fprintf(stderr, "hw3d::FixedPool: %s (%zu-byte block at %p)\n", what,
+               block_size, payload);
+  std::abort();
+}
+
+bool AllBytes(const unsigned char* p, std::size_t n, unsigned char value) {
+  for (std::size_t i = 0; i < n; i++) {
+    if (p[i] != value) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+void FixedPool::CheckGuards(const unsigned char* block) const noexcept {
+  // the link ahead of the front guard is not checked
+  const unsigned char* tail = block + payload_offset_ + block_size_;
+  if (!AllBytes(block + sizeof(void*), payload_offset_ - sizeof(void*),
+                kGuardByte) ||
+      !AllBytes(tail, stride_ - payload_offset_ - block_size_, kGuardByte)) {
+    ReportCorruption("guard bytes overwritten (buffer overrun or bad free)",
+                     block_size_, block + payload_offset_);
+  }
+}
+
+void FixedPool::CheckPoison(const unsigned char* block) const noexcept {
+  const unsigned char* payload = block + payload_offset_;
+  if (!AllBytes(payload, block_size_, kFreeByte)) {
+    ReportCorruption("free block written to (use after free)", block_size_,
+                     payload);
+  }
+}
+
+#endif  // HW3D_POOL_DEBUG
+
+}  // namespace hw3d
@@ -0,0 +1,148 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Guard and poison checks; on by default in debug builds.
+#ifndef HW3D_POOL_DEBUG
+#ifdef NDEBUG
+#define HW3D_POOL_DEBUG 0
+#else
+#define HW3D_POOL_DEBUG 1
+#endif
+#endif
+
+namespace hw3d {
+
+// Allocator for blocks of one fixed size. Blocks are carved from slabs that
+// the pool grows on demand and keeps until it is destroyed. Each thread
+// caches up to 2 * kCacheBatch free blocks per pool, so allocating and
+// freeing are a few loads and stores on the thread's own list; the shared
+// free list is locked only to move a batch in or out of a cache.
+//
+// With HW3D_POOL_DEBUG every block is framed by guard bytes, checked when it
+// is freed, and its payload is poisoned while free and checked when handed
+// out again; a mismatch aborts with a message on stderr.
+class FixedPool {
+ public:
+  // pools beyond this many work without thread caches
+  static constexpr std::size_t kMaxCachedPools = 64;
+  static constexpr std::uint32_t kCacheBatch = 32;
+  static constexpr std::size_t kSlabBytes = 64 * 1024;
+
+  struct Stats {
+    std::size_t block_size = 0;
+    // counts from thread caches are folded in at every batch move, so they
+    // can lag by up to a cache's worth of operations per thread
+    std::uint64_t allocations = 0;
+    std::uint64_t frees = 0;
+    std::uint64_t peak_live = 0;
+    std::uint64_t slabs = 0;
+    std::size_t reserved_bytes = 0;
+    // batches moved between the shared list and thread caches
+    std::uint64_t refills = 0;
+    std::uint64_t flushes = 0;
+  };
+
+  explicit FixedPool(std::size_t block_size,
+                     std::size_t alignment = alignof(std::max_align_t));
+  // Frees every slab. Blocks still cached by other threads are dropped.
+  ~FixedPool();
+  FixedPool(const FixedPool&) = delete;
+  FixedPool& operator=(const FixedPool&) = delete;
+
+  // Throws std::bad_alloc if a new slab cannot be allocated.
+  void* Allocate();
+  void Deallocate(void* p) noexcept;
+
+  std::size_t block_size() const noexcept { return block_size_; }
+  Stats stats() const;
+
+ private:
+  friend struct PoolThreadCaches;
+
+  struct Cache {
+    void* head = nullptr;
+    std::uint32_t count = 0;
+    std::uint32_t generation = 0;
+    std::uint64_t allocations = 0;
+    std::uint64_t frees = 0;
+  };
+
+  // This thread's cache for the pool, or nullptr if the pool has none.
+  Cache* ThreadCache() noexcept;
+  void Refill(Cache& cache);
+  // Moves `count` blocks (all if 0) from the cache to the shared list.
+  void Flush(Cache& cache, std::uint32_t count) noexcept;
+  // With mutex_ held.
+  void AddSlab();
+  void FoldCounts(Cache& cache) noexcept;
+
+  void* ToPayload(void* block) const noexcept;
+  void* ToBlock(void* payload) const noexcept;
+#if HW3D_POOL_DEBUG
+  void CheckGuards(const unsigned char* block) const noexcept;
+  void CheckPoison(const unsigned char* block) const noexcept;
+#endif
+
+ private:
+  const std::size_t block_size_;
+  const std::size_t alignment_;
+  // bytes from a block's start to its payload, and from one block to the
+  // next
+  std::size_t payload_offset_;
+  std::size_t stride_;
+  std::size_t blocks_per_slab_;
+  // slot in the thread cache tables, or -1
+  int cache_index_ = -1;
+  std::uint32_t generation_ = 0;
+
+  mutable std::mutex mutex_;
+  void* free_head_ = nullptr;
+  std::size_t free_count_ = 0;
+  std::vector<void*> slabs_;
+  Stats stats_;
+  // signed: a cache's frees can be folded in before the matching
+  // allocations from another thread's cache
+  std::int64_t live_ = 0;
+};
+
+// The pool behind HW3D_POOL_ALLOCATED(T). Created on first use and never
+// destroyed, so objects may still be freed during static destruction.
+template <typename T>
+FixedPool& PoolFor() {
+  static FixedPool* pool = new FixedPool(sizeof(T), alignof(T));
+  return *pool;
+}
+
+template <typename T>
+void* PooledNew(std::size_t size) {
+  // a derived class that is larger than T uses the global heap
+  return size <= sizeof(T) ? PoolFor<T>().Allocate() : ::operator new(size);
+}
+
+template <typename T>
+void PooledDelete(void* p, std::size_t size) noexcept {
+  if (size <= sizeof(T)) {
+    PoolFor<T>().Deallocate(p);
+  } else {
+    ::operator delete(p);
+  }
+}
+
+}  // namespace hw3d
+
+// Put in a class body to allocate the class (with new/delete) from its own
+// FixedPool. Classes derived from it need a virtual destructor so delete
+// sees their real size.
+#define HW3D_POOL_ALLOCATED(Class)                                  \
+  static void* operator new(std::size_t size) {                     \
+    return ::hw3d::PooledNew<Class>(size);                          \
+  }                                                                 \
+  static void operator delete(void* p, std::size_t size) noexcept { \
+    ::hw3d::PooledDelete<Class>(p, size);                           \
+  }
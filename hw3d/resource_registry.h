@@ -0,0 +1,272 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace hw3d {
+
+// 32-bit reference to a resource in a ResourcePool: the low kIndexBits
+// select a slot, the rest hold the slot's generation when the handle was
+// made. Destroying a resource bumps its slot's generation, so old handles
+// to a reused slot are detected instead of reaching the new resource. The
+// default handle is null and never valid; generations start at 1, and a
+// slot that has used the last one is retired rather than wrapped, so no
+// handle can ever match a later resource.
+template <typename Tag>
+class Handle {
+ public:
+  static constexpr unsigned kIndexBits = 20;
+  static constexpr unsigned kGenerationBits = 32 - kIndexBits;
+  static constexpr std::uint32_t kIndexMask = (1u << kIndexBits) - 1;
+  static constexpr std::uint32_t kGenerationMask =
+      (1u << kGenerationBits) - 1;
+  // Slot generation no handle carries, for retired slots.
+  static constexpr std::uint32_t kRetiredGeneration = kGenerationMask + 1;
+
+  // The generation a slot moves to when its handles go stale;
+  // kRetiredGeneration once they are used up, and the slot must not be
+  // reused.
+  static constexpr std::uint32_t NextGeneration(
+      std::uint32_t generation) noexcept {
+    return generation < kGenerationMask ? generation + 1 : kRetiredGeneration;
+  }
+
+  constexpr Handle() noexcept = default;
+
+  constexpr std::uint32_t index() const noexcept { return value_ & kIndexMask; }
+  constexpr std::uint32_t generation() const noexcept {
+    return value_ >> kIndexBits;
+  }
+  constexpr std::uint32_t value() const noexcept { return value_; }
+  constexpr explicit operator bool() const noexcept { return value_ != 0; }
+
+  friend constexpr bool operator==(Handle a, Handle b) noexcept {
+    return a.value_ == b.value_;
+  }
+  friend constexpr bool operator!=(Handle a, Handle b) noexcept {
+    return a.value_ != b.value_;
+  }
+
+  static constexpr Handle FromParts(std::uint32_t index,
+                                    std::uint32_t generation) noexcept {
+    Handle h;
+    h.value_ = (generation << kIndexBits) | (index & kIndexMask);
+    return h;
+  }
+
+ private:
+  std::uint32_t value_ = 0;
+};
+
+// Owns resources of one type in a densely packed array, addressed through
+// generational handles. Get() is two array reads and a compare. Destroying
+// a resource moves the last one into its place, so the values stay packed
+// for iteration; do not hold pointers across Create/Destroy/RetireFrames.
+//
+// Release() is the deferred form of Destroy() for resources the GPU may
+// still read: the handle goes stale at once, and the value is destroyed by
+// the first RetireFrames() call whose completed frame has reached the frame
+// that last used it. Not thread-safe; a pool belongs to the thread that
+// records and submits frames.
+template <typename T, typename Tag = T>
+class ResourcePool {
+ public:
+  using HandleType = Handle<Tag>;
+  // index kIndexMask is reserved as the free-list terminator
+  static constexpr std::size_t kMaxResources = HandleType::kIndexMask;
+
+  ResourcePool() = default;
+  ResourcePool(const ResourcePool&) = delete;
+  ResourcePool& operator=(const ResourcePool&) = delete;
+
+  // Throws std::length_error once kMaxResources slots are taken (live,
+  // awaiting retirement, or retired after kGenerationMask reuses).
+  template <typename... Args>
+  HandleType Create(Args&&... args) {
+    if (free_head_ == kNoSlot) {
+      if (slots_.size() >= kMaxResources) {
+        throw std::length_error("ResourcePool: out of handles");
+      }
+      slots_.push_back(Slot{kNoSlot, 1});
+      free_head_ = static_cast<std::uint32_t>(slots_.size() - 1);
+    }
+    values_.emplace_back(std::forward<Args>(args)...);
+    try {
+      dense_slots_.push_back(free_head_);
+    } catch (...) {
+      values_.pop_back();
+      throw;
+    }
+    const std::uint32_t index = free_head_;
+    Slot& slot = slots_[index];
+    free_head_ = slot.dense;
+    slot.dense = static_cast<std::uint32_t>(values_.size() - 1);
+    return HandleType::FromParts(index, slot.generation);
+  }
+
+  // nullptr if the handle is null, stale, or from another pool's range.
+  T* Get(HandleType h) noexcept {
+    const std::uint32_t dense = DenseIndex(h);
+    return dense == kNoSlot ? nullptr : &values_[dense];
+  }
+  const T* Get(HandleType h) const noexcept {
+    const std::uint32_t dense = DenseIndex(h);
+    return dense == kNoSlot ? nullptr : &values_[dense];
+  }
+  bool IsAlive(HandleType h) const noexcept { return DenseIndex(h) != kNoSlot; }
+
+  // Destroys the resource now. Stale handles are ignored.
+  void Destroy(HandleType h) {
+    const std::uint32_t dense = DenseIndex(h);
+    if (dense == kNoSlot) {
+      return;
+    }
+    Invalidate(h.index());
+    Erase(dense);
+    FreeSlot(h.index());
+  }
+
+  // Makes the handle stale now and destroys the resource once a frame at or
+  // after `last_use_frame` has been retired. Stale handles are ignored.
+  void Release(HandleType h, std::uint64_t last_use_frame) {
+    if (!IsAlive(h)) {
+      return;
+    }
+    Invalidate(h.index());
+    pending_.push_back(Pending{last_use_frame, h.index()});
+  }
+
+  // Destroys the released resources whose last use is at or before
+  // `completed_frame`. Returns how many were destroyed.
+  std::size_t RetireFrames(std::uint64_t completed_frame) {
+    std::size_t retired = 0;
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < pending_.size(); i++) {
+      const Pending p = pending_[i];
+      if (p.last_use_frame <= completed_frame) {
+        Erase(slots_[p.slot].dense);
+        FreeSlot(p.slot);
+        retired++;
+      } else {
+        pending_[kept++] = p;
+      }
+    }
+    pending_.resize(kept);
+    return retired;
+  }
+
+  // Resources with a live handle plus those awaiting retirement.
+  std::size_t size() const noexcept { return values_.size(); }
+  std::size_t pending() const noexcept { return pending_.size(); }
+
+  // The packed values (including released ones not yet retired), in no
+  // particular order.
+  T* begin() noexcept { return values_.data(); }
+  T* end() noexcept { return values_.data() + values_.size(); }
+  const T* begin() const noexcept { return values_.data(); }
+  const T* end() const noexcept { return values_.data() + values_.size(); }
+
+ private:
+  static constexpr std::uint32_t kNoSlot = HandleType::kIndexMask;
+
+  // While the slot is in use `dense` indexes values_; while it is free it
+  // links to the next free slot.
+  struct Slot {
+    std::uint32_t dense;
+    std::uint32_t generation;
+  };
+
+  struct Pending {
+    std::uint64_t last_use_frame;
+    std::uint32_t slot;
+  };
+
+  std::uint32_t DenseIndex(HandleType h) const noexcept {
+    const std::uint32_t index = h.index();
+    if (index >= slots_.size() || slots_[index].generation != h.generation()) {
+      return kNoSlot;
+    }
+    return slots_[index].dense;
+  }
+
+  // Bumps the generation so every handle to the slot goes stale.
+  void Invalidate(std::uint32_t index) noexcept {
+    std::uint32_t& generation = slots_[index].generation;
+    generation = HandleType::NextGeneration(generation);
+  }
+
+  // Moves the last value into the hole at `dense`.
+  void Erase(std::uint32_t dense) {
+    const std::uint32_t last = static_cast<std::uint32_t>(values_.size() - 1);
+    if (dense != last) {
+      values_[dense] = std::move(values_[last]);
+      dense_slots_[dense] = dense_slots_[last];
+      slots_[dense_slots_[dense]].dense = dense;
+    }
+    values_.pop_back();
+    dense_slots_.pop_back();
+  }
+
+  void FreeSlot(std::uint32_t index) noexcept {
+    if (slots_[index].generation == HandleType::kRetiredGeneration) {
+      // out of generations; 8 bytes stay behind
+      slots_[index].dense = kNoSlot;
+      return;
+    }
+    slots_[index].dense = free_head_;
+    free_head_ = index;
+  }
+
+  std::vector<T> values_;
+  // slot of each value, for fixing up the slot when a value moves
+  std::vector<std::uint32_t> dense_slots_;
+  std::vector<Slot> slots_;
+  std::uint32_t free_head_ = kNoSlot;
+  std::vector<Pending> pending_;
+};
+
+// One ResourcePool per resource type, retired together.
+template <typename... Ts>
+class ResourceRegistry {
+ public:
+  template <typename T>
+  ResourcePool<T>& pool() noexcept {
+    return std::get<ResourcePool<T>>(pools_);
+  }
+  template <typename T>
+  const ResourcePool<T>& pool() const noexcept {
+    return std::get<ResourcePool<T>>(pools_);
+  }
+
+  template <typename T, typename... Args>
+  Handle<T> Create(Args&&... args) {
+    return pool<T>().Create(std::forward<Args>(args)...);
+  }
+  template <typename T>
+  T* Get(Handle<T> h) noexcept {
+    return pool<T>().Get(h);
+  }
+  template <typename T>
+  void Release(Handle<T> h, std::uint64_t last_use_frame) {
+    pool<T>().Release(h, last_use_frame);
+  }
+
+  // Retires `completed_frame` in every pool; returns the resources
+  // destroyed.
+  std::size_t RetireFrames(std::uint64_t completed_frame) {
+    return std::apply(
+        [completed_frame](auto&... pools) {
+          return (std::size_t{0} + ... + pools.RetireFrames(completed_frame));
+        },
+        pools_);
+  }
+
+ private:
+  std::tuple<ResourcePool<Ts>...> pools_;
+};
+
+}  // namespace hw3d
@@ -0,0 +1,50 @@
+﻿#pragma once
+
+// Compile-time SIMD feature selection shared by the vectorized code paths.
+// Everything keys off what the compiler was told it may target (-msse4.1,
+// -mavx2, /arch:AVX2, ...), so there is no runtime dispatch; each path keeps
+// a scalar fallback.
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HW3D_SIMD_SSE2 1
+#endif
+
+// MSVC has no SSE4.1 macro; /arch:AVX and up imply it
+#if defined(HW3D_SIMD_SSE2) && (defined(__SSE4_1__) || defined(__AVX__))
+#define HW3D_SIMD_SSE41 1
+#endif
+
+#if defined(HW3D_SIMD_SSE2) && defined(__AVX2__)
+#define HW3D_SIMD_AVX2 1
+#endif
+
+#if defined(HW3D_SIMD_AVX2) && defined(__AVX512F__)
+#define HW3D_SIMD_AVX512 1
+#endif
+
+// AArch64 only: the across-vector reductions used here are not in ARMv7
+#if (defined(__ARM_NEON) && defined(__aarch64__)) || defined(_M_ARM64)
+#define HW3D_SIMD_NEON 1
+#endif
+
+#if defined(HW3D_SIMD_AVX2) || defined(HW3D_SIMD_AVX512)
+// GCC 12's AVX-512 intrinsics pass an uninitialized pass-through operand,
+// which -Wuninitialized flags at every inlined call (GCC bug 105593)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#else
+#include <immintrin.h>
+#endif
+#elif defined(HW3D_SIMD_SSE41)
+#include <smmintrin.h>
+#elif defined(HW3D_SIMD_SSE2)
+#include <emmintrin.h>
+#endif
+
+#if defined(HW3D_SIMD_NEON)
+#include <arm_neon.h>
+#endif
@@ -0,0 +1,823 @@
+﻿#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include "vector_math.h"
+
+// sin, cos, exp, log and atan2 on 4, 8 (AVX2) or 16 (AVX-512) floats at a
+// time, plus array versions that use the widest width the build targets.
+// The polynomials are the Cephes single-precision ones; every width runs
+// the same kernel, so results do not depend on the width.
+//
+// Max error against a double-precision reference, measured on every float
+// (sin/cos/exp/log) or on a dense grid (atan2):
+//   Sin, Cos  1.6 ulp when the build has FMA, 2.4 ulp without. The
+//             polynomial path reduces |x| <= 1e5 (FMA) or 8192; lanes
+//             past that, and infinities, go to libm on a slow path
+//   Exp       1.3 ulp; gradual underflow below -87.3, inf above 88.72
+//   Log       0.9 ulp for every positive float, denormals included;
+//             log(0) = -inf, negative inputs give NaN
+//   Atan2     3.2 ulp; signed zeros and infinities follow libm
+// NaN inputs give NaN. The kernels assume round-to-nearest and no
+// -ffast-math.
+
+namespace hw3d {
+
+namespace simd_math_detail {
+
+// ---------------------------------------------------------------------------
+// Packs: a float vector F, an int32 vector I and a lane mask M of the same
+// width, with the handful of operations the kernels need.
+
+struct F1 {
+  float v;
+};
+struct I1 {
+  std::int32_t v;
+};
+struct M1 {
+  bool v;
+};
+
+inline F1 operator+(F1 a, F1 b) { return {a.v + b.v}; }
+inline F1 operator-(F1 a, F1 b) { return {a.v - b.v}; }
+inline F1 operator*(F1 a, F1 b) { return {a.v * b.v}; }
+inline F1 operator/(F1 a, F1 b) { return {a.v / b.v}; }
+inline M1 operator<(F1 a, F1 b) { return {a.v < b.v}; }
+inline M1 operator==(F1 a, F1 b) { return {a.v == b.v}; }
+inline M1 operator|(M1 a, M1 b) { return {a.v || b.v}; }
+inline M1 operator&(M1 a, M1 b) { return {a.v && b.v}; }
+// int lanes wrap like the SIMD ones do
+inline I1 operator+(I1 a, I1 b) {
+  return {static_cast<std::int32_t>(static_cast<std::uint32_t>(a.v) +
+                                    static_cast<std::uint32_t>(b.v))};
+}
+inline I1 operator-(I1 a, I1 b) {
+  return {static_cast<std::int32_t>(static_cast<std::uint32_t>(a.v) -
+                                    static_cast<std::uint32_t>(b.v))};
+}
+inline I1 operator&(I1 a, I1 b) { return {a.v & b.v}; }
+inline I1 operator|(I1 a, I1 b) { return {a.v | b.v}; }
+inline I1 operator^(I1 a, I1 b) { return {a.v ^ b.v}; }
+inline F1 MulAdd(F1 a, F1 b, F1 c) { return {a.v * b.v + c.v}; }
+inline F1 Min(F1 a, F1 b) { return {b.v < a.v ? b.v : a.v}; }
+inline F1 Max(F1 a, F1 b) { return {a.v < b.v ? b.v : a.v}; }
+inline F1 Select(M1 m, F1 a, F1 b) { return m.v ? a : b; }
+inline I1 Select(M1 m, I1 a, I1 b) { return m.v ? a : b; }
+inline M1 IsNan(F1 a) { return {a.v != a.v}; }
+inline M1 NonZero(I1 a) { return {a.v != 0}; }
+inline bool Any(M1 m) { return m.v; }
+inline I1 RoundToInt(F1 a) {
+  // out of range and NaN give INT32_MIN, as cvtps2dq does
+  const float r = std::nearbyint(a.v);
+  return {r > -2147483648.0f && r < 2147483648.0f
+              ? static_cast<std::int32_t>(r)
+              : INT32_MIN};
+}
+inline F1 ToFloat(I1 a) { return {static_cast<float>(a.v)}; }
+inline I1 AsInt(F1 a) {
+  I1 r;
+  std::memcpy(&r.v, &a.v, 4);
+  return r;
+}
+inline F1 AsFloat(I1 a) {
+  F1 r;
+  std::memcpy(&r.v, &a.v, 4);
+  return r;
+}
+template <int N>
+I1 ShiftLeft(I1 a) {
+  return {static_cast<std::int32_t>(static_cast<std::uint32_t>(a.v) << N)};
+}
+template <int N>
+I1 ShiftRightLogical(I1 a) {
+  return {static_cast<std::int32_t>(static_cast<std::uint32_t>(a.v) >> N)};
+}
+template <int N>
+I1 ShiftRightArith(I1 a) {
+  // arithmetic for negative values on every compiler hw3d supports
+  return {a.v >> N};
+}
+
+struct Pack1 {
+  using F = F1;
+  using I = I1;
+  using M = M1;
+  static constexpr std::size_t kWidth = 1;
+  // whether MulAdd rounds once; SinCos picks its range reduction by it
+  static constexpr bool kFused = false;
+  static F Splat(float f) { return {f}; }
+  static I SplatInt(std::int32_t i) { return {i}; }
+  static F Load(const float* p) { return {*p}; }
+  static void Store(float* p, F a) { *p = a.v; }
+};
+
+#if defined(HW3D_MATH_FMA)
+#define HW3D_SIMD_MATH_FUSED true
+#else
+#define HW3D_SIMD_MATH_FUSED false
+#endif
+
+#if defined(_MSC_VER)
+#define HW3D_SIMD_MATH_NOINLINE __declspec(noinline)
+#else
+#define HW3D_SIMD_MATH_NOINLINE __attribute__((noinline))
+#endif
+
+#if defined(HW3D_MATH_SSE)
+
+struct F4 {
+  __m128 v;
+};
+struct I4 {
+  __m128i v;
+};
+struct M4 {
+  __m128 v;
+};
+
+inline F4 operator+(F4 a, F4 b) { return {_mm_add_ps(a.v, b.v)}; }
+inline F4 operator-(F4 a, F4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+inline F4 operator*(F4 a, F4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+inline F4 operator/(F4 a, F4 b) { return {_mm_div_ps(a.v, b.v)}; }
+inline M4 operator<(F4 a, F4 b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+inline M4 operator==(F4 a, F4 b) { return {_mm_cmpeq_ps(a.v, b.v)}; }
+inline M4 operator|(M4 a, M4 b) { return {_mm_or_ps(a.v, b.v)}; }
+inline M4 operator&(M4 a, M4 b) { return {_mm_and_ps(a.v, b.v)}; }
+inline I4 operator+(I4 a, I4 b) { return {_mm_add_epi32(a.v, b.v)}; }
+inline I4 operator-(I4 a, I4 b) { return {_mm_sub_epi32(a.v, b.v)}; }
+inline I4 operator&(I4 a, I4 b) { return {_mm_and_si128(a.v, b.v)}; }
+inline I4 operator|(I4 a, I4 b) { return {_mm_or_si128(a.v, b.v)}; }
+inline I4 operator^(I4 a, I4 b) { return {_mm_xor_si128(a.v, b.v)}; }
+inline F4 MulAdd(F4 a, F4 b, F4 c) {
+  return {MulAdd(Vec4{a.v}, Vec4{b.v}, Vec4{c.v}).v};
+}
+inline F4 Min(F4 a, F4 b) { return {_mm_min_ps(a.v, b.v)}; }
+inline F4 Max(F4 a, F4 b) { return {_mm_max_ps(a.v, b.v)}; }
+inline F4 Select(M4 m, F4 a, F4 b) {
+#if defined(HW3D_SIMD_SSE41)
+  return {_mm_blendv_ps(b.v, a.v, m.v)};
+#else
+  return {_mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v))};
+#endif
+}
+inline I4 Select(M4 m, I4 a, I4 b) {
+  const __m128i mi = _mm_castps_si128(m.v);
+  return {_mm_or_si128(_mm_and_si128(mi, a.v), _mm_andnot_si128(mi, b.v))};
+}
+inline M4 IsNan(F4 a) { return {_mm_cmpunord_ps(a.v, a.v)}; }
+inline M4 NonZero(I4 a) {
+  const __m128i zero = _mm_cmpeq_epi32(a.v, _mm_setzero_si128());
+  return {_mm_castsi128_ps(_mm_xor_si128(zero, _mm_set1_epi32(-1)))};
+}
+inline bool Any(M4 m) { return _mm_movemask_ps(m.v) != 0; }
+inline I4 RoundToInt(F4 a) { return {_mm_cvtps_epi32(a.v)}; }
+inline F4 ToFloat(I4 a) { return {_mm_cvtepi32_ps(a.v)}; }
+inline I4 AsInt(F4 a) { return {_mm_castps_si128(a.v)}; }
+inline F4 AsFloat(I4 a) { return {_mm_castsi128_ps(a.v)}; }
+template <int N>
+I4 ShiftLeft(I4 a) {
+  return {_mm_slli_epi32(a.v, N)};
+}
+template <int N>
+I4 ShiftRightLogical(I4 a) {
+  return {_mm_srli_epi32(a.v, N)};
+}
+template <int N>
+I4 ShiftRightArith(I4 a) {
+  return {_mm_srai_epi32(a.v, N)};
+}
+
+struct Pack4 {
+  using F = F4;
+  using I = I4;
+  using M = M4;
+  static constexpr std::size_t kWidth = 4;
+  static constexpr bool kFused = HW3D_SIMD_MATH_FUSED;
+  static F Splat(float f) { return {_mm_set1_ps(f)}; }
+  static I SplatInt(std::int32_t i) { return {_mm_set1_epi32(i)}; }
+  static F Load(const float* p) { return {_mm_loadu_ps(p)}; }
+  static void Store(float* p, F a) { _mm_storeu_ps(p, a.v); }
+};
+
+#elif defined(HW3D_MATH_NEON)
+
+struct F4 {
+  float32x4_t v;
+};
+struct I4 {
+  int32x4_t v;
+};
+struct M4 {
+  uint32x4_t v;
+};
+
+inline F4 operator+(F4 a, F4 b) { return {vaddq_f32(a.v, b.v)}; }
+inline F4 operator-(F4 a, F4 b) { return {vsubq_f32(a.v, b.v)}; }
+inline F4 operator*(F4 a, F4 b) { return {vmulq_f32(a.v, b.v)}; }
+inline F4 operator/(F4 a, F4 b) { return {vdivq_f32(a.v, b.v)}; }
+inline M4 operator<(F4 a, F4 b) { return {vcltq_f32(a.v, b.v)}; }
+inline M4 operator==(F4 a, F4 b) { return {vceqq_f32(a.v, b.v)}; }
+inline M4 operator|(M4 a, M4 b) { return {vorrq_u32(a.v, b.v)}; }
+inline M4 operator&(M4 a, M4 b) { return {vandq_u32(a.v, b.v)}; }
+inline I4 operator+(I4 a, I4 b) { return {vaddq_s32(a.v, b.v)}; }
+inline I4 operator-(I4 a, I4 b) { return {vsubq_s32(a.v, b.v)}; }
+inline I4 operator&(I4 a, I4 b) { return {vandq_s32(a.v, b.v)}; }
+inline I4 operator|(I4 a, I4 b) { return {vorrq_s32(a.v, b.v)}; }
+inline I4 operator^(I4 a, I4 b) { return {veorq_s32(a.v, b.v)}; }
+inline F4 MulAdd(F4 a, F4 b, F4 c) { return {vfmaq_f32(c.v, a.v, b.v)}; }
+inline F4 Min(F4 a, F4 b) { return {vminq_f32(a.v, b.v)}; }
+inline F4 Max(F4 a, F4 b) { return {vmaxq_f32(a.v, b.v)}; }
+inline F4 Select(M4 m, F4 a, F4 b) { return {vbslq_f32(m.v, a.v, b.v)}; }
+inline I4 Select(M4 m, I4 a, I4 b) { return {vbslq_s32(m.v, a.v, b.v)}; }
+inline M4 IsNan(F4 a) { return {vmvnq_u32(vceqq_f32(a.v, a.v))}; }
+inline M4 NonZero(I4 a) { return {vtstq_s32(a.v, a.v)}; }
+inline bool Any(M4 m) { return vmaxvq_u32(m.v) != 0; }
+inline I4 RoundToInt(F4 a) { return {vcvtnq_s32_f32(a.v)}; }
+inline F4 ToFloat(I4 a) { return {vcvtq_f32_s32(a.v)}; }
+inline I4 AsInt(F4 a) { return {vreinterpretq_s32_f32(a.v)}; }
+inline F4 AsFloat(I4 a) { return {vreinterpretq_f32_s32(a.v)}; }
+template <int N>
+I4 ShiftLeft(I4 a) {
+  return {vshlq_n_s32(a.v, N)};
+}
+template <int N>
+I4 ShiftRightLogical(I4 a) {
+  return {vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(a.v), N))};
+}
+template <int N>
+I4 ShiftRightArith(I4 a) {
+  return {vshrq_n_s32(a.v, N)};
+}
+
+struct Pack4 {
+  using F = F4;
+  using I = I4;
+  using M = M4;
+  static constexpr std::size_t kWidth = 4;
+  static constexpr bool kFused = true;
+  static F Splat(float f) { return {vdupq_n_f32(f)}; }
+  static I SplatInt(std::int32_t i) { return {vdupq_n_s32(i)}; }
+  static F Load(const float* p) { return {vld1q_f32(p)}; }
+  static void Store(float* p, F a) { vst1q_f32(p, a.v); }
+};
+
+#endif  // HW3D_MATH_SSE / HW3D_MATH_NEON
+
+#if defined(HW3D_MATH_SSE) && defined(HW3D_SIMD_AVX2)
+
+struct F8 {
+  __m256 v;
+};
+struct I8 {
+  __m256i v;
+};
+struct M8 {
+  __m256 v;
+};
+
+inline F8 operator+(F8 a, F8 b) { return {_mm256_add_ps(a.v, b.v)}; }
+inline F8 operator-(F8 a, F8 b) { return {_mm256_sub_ps(a.v, b.v)}; }
+inline F8 operator*(F8 a, F8 b) { return {_mm256_mul_ps(a.v, b.v)}; }
+inline F8 operator/(F8 a, F8 b) { return {_mm256_div_ps(a.v, b.v)}; }
+inline M8 operator<(F8 a, F8 b) {
+  return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)};
+}
+inline M8 operator==(F8 a, F8 b) {
+  return {_mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ)};
+}
+inline M8 operator|(M8 a, M8 b) { return {_mm256_or_ps(a.v, b.v)}; }
+inline M8 operator&(M8 a, M8 b) { return {_mm256_and_ps(a.v, b.v)}; }
+inline I8 operator+(I8 a, I8 b) { return {_mm256_add_epi32(a.v, b.v)}; }
+inline I8 operator-(I8 a, I8 b) { return {_mm256_sub_epi32(a.v, b.v)}; }
+inline I8 operator&(I8 a, I8 b) { return {_mm256_and_si256(a.v, b.v)}; }
+inline I8 operator|(I8 a, I8 b) { return {_mm256_or_si256(a.v, b.v)}; }
+inline I8 operator^(I8 a, I8 b) { return {_mm256_xor_si256(a.v, b.v)}; }
+inline F8 MulAdd(F8 a, F8 b, F8 c) {
+#if defined(HW3D_MATH_FMA)
+  return {_mm256_fmadd_ps(a.v, b.v, c.v)};
+#else
+  return {_mm256_add_ps(_mm256_mul_ps(a.v, b.v), c.v)};
+#endif
+}
+inline F8 Min(F8 a, F8 b) { return {_mm256_min_ps(a.v, b.v)}; }
+inline F8 Max(F8 a, F8 b) { return {_mm256_max_ps(a.v, b.v)}; }
+inline F8 Select(M8 m, F8 a, F8 b) {
+  return {_mm256_blendv_ps(b.v, a.v, m.v)};
+}
+inline I8 Select(M8 m, I8 a, I8 b) {
+  return {_mm256_blendv_epi8(b.v, a.v, _mm256_castps_si256(m.v))};
+}
+inline M8 IsNan(F8 a) { return {_mm256_cmp_ps(a.v, a.v, _CMP_UNORD_Q)}; }
+inline M8 NonZero(I8 a) {
+  const __m256i zero = _mm256_cmpeq_epi32(a.v, _mm256_setzero_si256());
+  return {_mm256_castsi256_ps(_mm256_xor_si256(zero, _mm256_set1_epi32(-1)))};
+}
+inline bool Any(M8 m) { return _mm256_movemask_ps(m.v) != 0; }
+inline I8 RoundToInt(F8 a) { return {_mm256_cvtps_epi32(a.v)}; }
+inline F8 ToFloat(I8 a) { return {_mm256_cvtepi32_ps(a.v)}; }
+inline I8 AsInt(F8 a) { return {_mm256_castps_si256(a.v)}; }
+inline F8 AsFloat(I8 a) { return {_mm256_castsi256_ps(a.v)}; }
+template <int N>
+I8 ShiftLeft(I8 a) {
+  return {_mm256_slli_epi32(a.v, N)};
+}
+template <int N>
+I8 ShiftRightLogical(I8 a) {
+  return {_mm256_srli_epi32(a.v, N)};
+}
+template <int N>
+I8 ShiftRightArith(I8 a) {
+  return {_mm256_srai_epi32(a.v, N)};
+}
+
+struct Pack8 {
+  using F = F8;
+  using I = I8;
+  using M = M8;
+  static constexpr std::size_t kWidth = 8;
+  static constexpr bool kFused = HW3D_SIMD_MATH_FUSED;
+  static F Splat(float f) { return {_mm256_set1_ps(f)}; }
+  static I SplatInt(std::int32_t i) { return {_mm256_set1_epi32(i)}; }
+  static F Load(const float* p) { return {_mm256_loadu_ps(p)}; }
+  static void Store(float* p, F a) { _mm256_storeu_ps(p, a.v); }
+};
+
+#endif  // HW3D_SIMD_AVX2
+
+#if defined(HW3D_MATH_SSE) && defined(HW3D_SIMD_AVX512)
+
+// AVX-512F only: float bit operations go through the integer domain, since
+// the float forms need AVX-512DQ.
+struct F16 {
+  __m512 v;
+};
+struct I16 {
+  __m512i v;
+};
+struct M16 {
+  __mmask16 v;
+};
+
+inline F16 operator+(F16 a, F16 b) { return {_mm512_add_ps(a.v, b.v)}; }
+inline F16 operator-(F16 a, F16 b) { return {_mm512_sub_ps(a.v, b.v)}; }
+inline F16 operator*(F16 a, F16 b) { return {_mm512_mul_ps(a.v, b.v)}; }
+inline F16 operator/(F16 a, F16 b) { return {_mm512_div_ps(a.v, b.v)}; }
+inline M16 operator<(F16 a, F16 b) {
+  return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ)};
+}
+inline M16 operator==(F16 a, F16 b) {
+  return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_EQ_OQ)};
+}
+inline M16 operator|(M16 a, M16 b) {
+  return {static_cast<__mmask16>(a.v | b.v)};
+}
+inline M16 operator&(M16 a, M16 b) {
+  return {static_cast<__mmask16>(a.v & b.v)};
+}
+inline I16 operator+(I16 a, I16 b) { return {_mm512_add_epi32(a.v, b.v)}; }
+inline I16 operator-(I16 a, I16 b) { return {_mm512_sub_epi32(a.v, b.v)}; }
+inline I16 operator&(I16 a, I16 b) { return {_mm512_and_si512(a.v, b.v)}; }
+inline I16 operator|(I16 a, I16 b) { return {_mm512_or_si512(a.v, b.v)}; }
+inline I16 operator^(I16 a, I16 b) {
+  return {_mm512_xor_si512(a.v, b.v)};
+}
+inline F16 MulAdd(F16 a, F16 b, F16 c) {
+  return {_mm512_fmadd_ps(a.v, b.v, c.v)};
+}
+inline F16 Min(F16 a, F16 b) { return {_mm512_min_ps(a.v, b.v)}; }
+inline F16 Max(F16 a, F16 b) { return {_mm512_max_ps(a.v, b.v)}; }
+inline F16 Select(M16 m, F16 a, F16 b) {
+  return {_mm512_mask_blend_ps(m.v, b.v, a.v)};
+}
+inline I16 Select(M16 m, I16 a, I16 b) {
+  return {_mm512_mask_blend_epi32(m.v, b.v, a.v)};
+}
+inline M16 IsNan(F16 a) {
+  return {_mm512_cmp_ps_mask(a.v, a.v, _CMP_UNORD_Q)};
+}
+inline M16 NonZero(I16 a) { return {_mm512_test_epi32_mask(a.v, a.v)}; }
+inline bool Any(M16 m) { return m.v != 0; }
+inline I16 RoundToInt(F16 a) { return {_mm512_cvtps_epi32(a.v)}; }
+inline F16 ToFloat(I16 a) { return {_mm512_cvtepi32_ps(a.v)}; }
+inline I16 AsInt(F16 a) { return {_mm512_castps_si512(a.v)}; }
+inline F16 AsFloat(I16 a) { return {_mm512_castsi512_ps(a.v)}; }
+template <int N>
+I16 ShiftLeft(I16 a) {
+  return {_mm512_slli_epi32(a.v, N)};
+}
+template <int N>
+I16 ShiftRightLogical(I16 a) {
+  return {_mm512_srli_epi32(a.v, N)};
+}
+template <int N>
+I16 ShiftRightArith(I16 a) {
+  return {_mm512_srai_epi32(a.v, N)};
+}
+
+struct Pack16 {
+  using F = F16;
+  using I = I16;
+  using M = M16;
+  static constexpr std::size_t kWidth = 16;
+  static constexpr bool kFused = true;
+  static F Splat(float f) { return {_mm512_set1_ps(f)}; }
+  static I SplatInt(std::int32_t i) { return {_mm512_set1_epi32(i)}; }
+  static F Load(const float* p) { return {_mm512_loadu_ps(p)}; }
+  static void Store(float* p, F a) { _mm512_storeu_ps(p, a.v); }
+};
+
+#endif  // HW3D_SIMD_AVX512
+
+// ---------------------------------------------------------------------------
+// Kernels, written once against the pack interface
+
+template <typename P>
+typename P::F Abs(typename P::F x) {
+  return AsFloat(AsInt(x) & P::SplatInt(0x7FFFFFFF));
+}
+
+// x with its sign flipped wherever `sign` has bit 31 set.
+template <typename P>
+typename P::F XorSign(typename P::F x, typename P::I sign) {
+  return AsFloat(AsInt(x) ^ (sign & P::SplatInt(INT32_MIN)));
+}
+
+// 2^e for e in [-126, 127].
+template <typename P>
+typename P::F Pow2(typename P::I e) {
+  return AsFloat(ShiftLeft<23>(e + P::SplatInt(127)));
+}
+
+// Largest |x| the pi/2 split in SinCos reduces accurately.
+template <typename P>
+constexpr float kSinCosRange = P::kFused ? 1e5f : 8192.0f;
+
+// Redoes the lanes of a SinCos result whose |x| is past kSinCosRange with
+// libm, whose reduction is exact for every float. Out of line: animation
+// phases and angles stay far below the range, so this is the cold path.
+template <typename P>
+HW3D_SIMD_MATH_NOINLINE void SinCosLibm(typename P::F x,
+                                        typename P::F* sin_out,
+                                        typename P::F* cos_out) {
+  float xs[P::kWidth];
+  float s[P::kWidth];
+  float c[P::kWidth];
+  P::Store(xs, x);
+  P::Store(s, *sin_out);
+  P::Store(c, *cos_out);
+  for (std::size_t i = 0; i < P::kWidth; i++) {
+    if (std::fabs(xs[i]) > kSinCosRange<P>) {
+      s[i] = std::sin(xs[i]);
+      c[i] = std::cos(xs[i]);
+    }
+  }
+  *sin_out = P::Load(s);
+  *cos_out = P::Load(c);
+}
+
+template <typename P>
+void SinCos(typename P::F x, typename P::F* sin_out, typename P::F* cos_out) {
+  using F = typename P::F;
+  using I = typename P::I;
+  // work on |x| and put the sign back at the end: sin is odd, cos even
+  const F ax = Abs<P>(x);
+  // |x| = q * pi/2 + r with |r| <= pi/4, pi/2 split into a sum of
+  // floats. With a fused multiply-add each step rounds once, so three
+  // full-width parts hold up to 1e5. Without one, four short parts keep
+  // every q * part exact for |x| <= 8192.
+  const I q = RoundToInt(ax * P::Splat(0.636619772367581343f));
+  const F qf = ToFloat(q);
+  F r;
+  if constexpr (P::kFused) {
+    r = MulAdd(qf, P::Splat(-1.57079637050628662f), ax);
+    r = MulAdd(qf, P::Splat(4.37113882867379296e-8f), r);
+    r = MulAdd(qf, P::Splat(1.71512451000588193e-15f), r);
+  } else {
+    r = ax - qf * P::Splat(1.5703125f);
+    r = r - qf * P::Splat(4.83751296997070312e-4f);
+    r = r - qf * P::Splat(7.54953362047672271e-8f);
+    r = r - qf * P::Splat(2.56334406825708961e-12f);
+  }
+  const F z = r * r;
+
+  F ps = MulAdd(P::Splat(-1.9515295891e-4f), z, P::Splat(8.3321608736e-3f));
+  ps = MulAdd(ps, z, P::Splat(-1.6666654611e-1f));
+  const F sin_r = MulAdd(ps * z, r, r);
+  F pc = MulAdd(P::Splat(2.443315711809948e-5f), z,
+                P::Splat(-1.388731625493765e-3f));
+  pc = MulAdd(pc, z, P::Splat(4.166664568298827e-2f));
+  const F cos_r =
+      MulAdd(pc * z, z, MulAdd(z, P::Splat(-0.5f), P::Splat(1.0f)));
+
+  // sin x is sin r, cos r, -sin r, -cos r for q mod 4 = 0..3; cos x is
+  // the same sequence one quadrant on
+  const auto odd = NonZero(q & P::SplatInt(1));
+  *sin_out = XorSign<P>(Select(odd, cos_r, sin_r),
+                        ShiftLeft<30>(q) ^ AsInt(x));
+  *cos_out = XorSign<P>(Select(odd, sin_r, cos_r),
+                        ShiftLeft<30>(q + P::SplatInt(1)));
+  // past the range q * pi/2 loses bits, and q itself overflows at 2^31
+  if (Any(P::Splat(kSinCosRange<P>) < ax)) {
+    SinCosLibm<P>(x, sin_out, cos_out);
+  }
+}
+
+template <typename P>
+typename P::F Exp(typename P::F x) {
+  using F = typename P::F;
+  using I = typename P::I;
+  // past these the result is 0 or inf anyway; keeps 2^n below in range
+  F xc = Min(Max(x, P::Splat(-104.0f)), P::Splat(89.0f));
+  xc = Select(IsNan(x), P::Splat(0.0f), xc);
+  // x = n * ln 2 + r, ln 2 split in two
+  const I n = RoundToInt(xc * P::Splat(1.44269504088896341f));
+  const F nf = ToFloat(n);
+  F r = MulAdd(nf, P::Splat(-0.693359375f), xc);
+  r = MulAdd(nf, P::Splat(2.12194440e-4f), r);
+
+  F p = MulAdd(P::Splat(1.9875691500e-4f), r, P::Splat(1.3981999507e-3f));
+  p = MulAdd(p, r, P::Splat(8.3334519073e-3f));
+  p = MulAdd(p, r, P::Splat(4.1665795894e-2f));
+  p = MulAdd(p, r, P::Splat(1.6666665459e-1f));
+  p = MulAdd(p, r, P::Splat(5.0000001201e-1f));
+  F y = MulAdd(p, r * r, r + P::Splat(1.0f));
+
+  // y * 2^n in two steps, so n from -150 (denormals) to 128 (inf) works
+  const I half = ShiftRightArith<1>(n);
+  y = y * Pow2<P>(half) * Pow2<P>(n - half);
+  return Select(IsNan(x), x, y);
+}
+
+template <typename P>
+typename P::F Log(typename P::F x) {
+  using F = typename P::F;
+  using I = typename P::I;
+  // scale denormals into the normal range first
+  const auto tiny = x < P::Splat(std::numeric_limits<float>::min());
+  const I bits = AsInt(Select(tiny, x * P::Splat(8388608.0f), x));
+  // x = m * 2^e with m in [0.5, 1), then m moved to [sqrt(1/2), sqrt(2))
+  I e = ShiftRightLogical<23>(bits) - P::SplatInt(126);
+  e = e - Select(tiny, P::SplatInt(23), P::SplatInt(0));
+  F m = AsFloat((bits & P::SplatInt(0x007FFFFF)) | P::SplatInt(0x3F000000));
+  const auto low = m < P::Splat(0.707106781186547524f);
+  e = e - Select(low, P::SplatInt(1), P::SplatInt(0));
+  m = Select(low, m + m, m) - P::Splat(1.0f);
+  const F ef = ToFloat(e);
+  const F z = m * m;
+
+  F p = MulAdd(P::Splat(7.0376836292e-2f), m, P::Splat(-1.1514610310e-1f));
+  p = MulAdd(p, m, P::Splat(1.1676998740e-1f));
+  p = MulAdd(p, m, P::Splat(-1.2420140846e-1f));
+  p = MulAdd(p, m, P::Splat(1.4249322787e-1f));
+  p = MulAdd(p, m, P::Splat(-1.6668057665e-1f));
+  p = MulAdd(p, m, P::Splat(2.0000714765e-1f));
+  p = MulAdd(p, m, P::Splat(-2.4999993993e-1f));
+  p = MulAdd(p, m, P::Splat(3.3333331174e-1f));
+  F y = p * m * z;
+  y = MulAdd(ef, P::Splat(-2.12194440e-4f), y);
+  y = MulAdd(z, P::Splat(-0.5f), y);
+  F r = MulAdd(ef, P::Splat(0.693359375f), m + y);
+
+  const F inf = P::Splat(std::numeric_limits<float>::infinity());
+  r = Select(x == P::Splat(0.0f), P::Splat(0.0f) - inf, r);
+  r = Select(x == inf, inf, r);
+  r = Select(x < P::Splat(0.0f),
+             P::Splat(std::numeric_limits<float>::quiet_NaN()), r);
+  return Select(IsNan(x), x, r);
+}
+
+template <typename P>
+typename P::F Atan2(typename P::F y, typename P::F x) {
+  using F = typename P::F;
+  const F ax = Abs<P>(x);
+  const F ay = Abs<P>(y);
+  const F inf = P::Splat(std::numeric_limits<float>::infinity());
+  // atan of t = min/max in [0, 1]; 0/0 and inf/inf are fixed up to 0 and 1
+  const F hi = Max(ax, ay);
+  F t = Min(ax, ay) / hi;
+  t = Select(hi == P::Splat(0.0f), P::Splat(0.0f), t);
+  t = Select((ax == inf) & (ay == inf), P::Splat(1.0f), t);
+  // past tan(pi/8), atan t = pi/4 + atan((t - 1) / (t + 1))
+  const auto big = P::Splat(0.414213562373095f) < t;
+  t = Select(big, (t - P::Splat(1.0f)) / (t + P::Splat(1.0f)), t);
+  const F z = t * t;
+
+  F p = MulAdd(P::Splat(8.05374449538e-2f), z, P::Splat(-1.38776856032e-1f));
+  p = MulAdd(p, z, P::Splat(1.99777106478e-1f));
+  p = MulAdd(p, z, P::Splat(-3.33329491539e-1f));
+  F a = MulAdd(p * z, t, t) +
+        Select(big, P::Splat(0.785398163397448310f), P::Splat(0.0f));
+
+  // unfold to the full circle; going by sign bits makes -0 act negative
+  a = Select(ax < ay, P::Splat(1.57079632679489662f) - a, a);
+  a = Select(NonZero(AsInt(x) & P::SplatInt(INT32_MIN)),
+             P::Splat(3.14159265358979324f) - a, a);
+  a = XorSign<P>(a, AsInt(y));
+  return Select(IsNan(x) | IsNan(y), x + y, a);
+}
+
+// Array drivers: whole packs, then the tail through a zero-padded pack.
+template <typename P, typename Kernel>
+void Map(const float* in, float* out, std::size_t n, Kernel kernel) {
+  constexpr std::size_t w = P::kWidth;
+  const std::size_t full = n - n % w;
+  for (std::size_t i = 0; i < full; i += w) {
+    P::Store(out + i, kernel(P::Load(in + i)));
+  }
+  if (full < n) {
+    float buf[w] = {};
+    std::memcpy(buf, in + full, (n - full) * sizeof(float));
+    P::Store(buf, kernel(P::Load(buf)));
+    std::memcpy(out + full, buf, (n - full) * sizeof(float));
+  }
+}
+
+template <typename P>
+void SinCosMap(const float* in, float* sin_out, float* cos_out, std::size_t n) {
+  constexpr std::size_t w = P::kWidth;
+  const std::size_t full = n - n % w;
+  typename P::F s, c;
+  for (std::size_t i = 0; i < full; i += w) {
+    SinCos<P>(P::Load(in + i), &s, &c);
+    P::Store(sin_out + i, s);
+    P::Store(cos_out + i, c);
+  }
+  if (full < n) {
+    float buf[w] = {};
+    std::memcpy(buf, in + full, (n - full) * sizeof(float));
+    SinCos<P>(P::Load(buf), &s, &c);
+    P::Store(buf, s);
+    std::memcpy(sin_out + full, buf, (n - full) * sizeof(float));
+    P::Store(buf, c);
+    std::memcpy(cos_out + full, buf, (n - full) * sizeof(float));
+  }
+}
+
+template <typename P>
+void Atan2Map(const float* y, const float* x, float* out, std::size_t n) {
+  constexpr std::size_t w = P::kWidth;
+  const std::size_t full = n - n % w;
+  for (std::size_t i = 0; i < full; i += w) {
+    P::Store(out + i, Atan2<P>(P::Load(y + i), P::Load(x + i)));
+  }
+  if (full < n) {
+    float buf_y[w] = {};
+    float buf_x[w] = {};
+    std::memcpy(buf_y, y + full, (n - full) * sizeof(float));
+    std::memcpy(buf_x, x + full, (n - full) * sizeof(float));
+    P::Store(buf_y, Atan2<P>(P::Load(buf_y), P::Load(buf_x)));
+    std::memcpy(out + full, buf_y, (n - full) * sizeof(float));
+  }
+}
+
+#if defined(HW3D_MATH_SSE) && defined(HW3D_SIMD_AVX512)
+using WidestPack = Pack16;
+#elif defined(HW3D_MATH_SSE) && defined(HW3D_SIMD_AVX2)
+using WidestPack = Pack8;
+#elif defined(HW3D_MATH_SSE) || defined(HW3D_MATH_NEON)
+using WidestPack = Pack4;
+#else
+using WidestPack = Pack1;
+#endif
+
+#undef HW3D_SIMD_MATH_FUSED
+#undef HW3D_SIMD_MATH_NOINLINE
+
+}  // namespace simd_math_detail
+
+// ---------------------------------------------------------------------------
+// Arrays. `out` may alias the input; the widest pack the build targets is
+// used, with the tail handled by a padded pack.
+
+inline void SinBatch(const float* x, float* out, std::size_t n) noexcept {
+  using P = simd_math_detail::WidestPack;
+  simd_math_detail::Map<P>(x, out, n, [](P::F v) {
+    P::F s, c;
+    simd_math_detail::SinCos<P>(v, &s, &c);
+    return s;
+  });
+}
+
+inline void CosBatch(const float* x, float* out, std::size_t n) noexcept {
+  using P = simd_math_detail::WidestPack;
+  simd_math_detail::Map<P>(x, out, n, [](P::F v) {
+    P::F s, c;
+    simd_math_detail::SinCos<P>(v, &s, &c);
+    return c;
+  });
+}
+
+inline void SinCosBatch(const float* x,
+                        float* sin_out,
+                        float* cos_out,
+                        std::size_t n) noexcept {
+  simd_math_detail::SinCosMap<simd_math_detail::WidestPack>(x, sin_out,
+                                                            cos_out, n);
+}
+
+inline void ExpBatch(const float* x, float* out, std::size_t n) noexcept {
+  using P = simd_math_detail::WidestPack;
+  simd_math_detail::Map<P>(
+      x, out, n, [](P::F v) { return simd_math_detail::Exp<P>(v); });
+}
+
+inline void LogBatch(const float* x, float* out, std::size_t n) noexcept {
+  using P = simd_math_detail::WidestPack;
+  simd_math_detail::Map<P>(
+      x, out, n, [](P::F v) { return simd_math_detail::Log<P>(v); });
+}
+
+inline void Atan2Batch(const float* y,
+                       const float* x,
+                       float* out,
+                       std::size_t n) noexcept {
+  simd_math_detail::Atan2Map<simd_math_detail::WidestPack>(y, x, out, n);
+}
+
+// ---------------------------------------------------------------------------
+// Registers: Vec4 always, Vec8 with AVX2 and Vec16 with AVX-512.
+
+#if defined(HW3D_MATH_SSE) && defined(HW3D_SIMD_AVX2)
+struct Vec8 {
+  __m256 v;
+};
+#endif
+#if defined(HW3D_MATH_SSE) && defined(HW3D_SIMD_AVX512)
+struct Vec16 {
+  __m512 v;
+};
+#endif
+
+#define HW3D_SIMD_MATH_OVERLOADS(Vec, Pack)                                \
+  inline void SinCos(Vec x, Vec* sin_out, Vec* cos_out) noexcept {         \
+    simd_math_detail::Pack::F s, c;                                        \
+    simd_math_detail::SinCos<simd_math_detail::Pack>({x.v}, &s, &c);       \
+    *sin_out = {s.v};                                                      \
+    *cos_out = {c.v};                                                      \
+  }                                                                        \
+  inline Vec Sin(Vec x) noexcept {                                         \
+    Vec s, c;                                                              \
+    SinCos(x, &s, &c);                                                     \
+    return s;                                                              \
+  }                                                                        \
+  inline Vec Cos(Vec x) noexcept {                                         \
+    Vec s, c;                                                              \
+    SinCos(x, &s, &c);                                                     \
+    return c;                                                              \
+  }                                                                        \
+  inline Vec Exp(Vec x) noexcept {                                         \
+    return {simd_math_detail::Exp<simd_math_detail::Pack>({x.v}).v};       \
+  }                                                                        \
+  inline Vec Log(Vec x) noexcept {                                         \
+    return {simd_math_detail::Log<simd_math_detail::Pack>({x.v}).v};       \
+  }                                                                        \
+  inline Vec Atan2(Vec y, Vec x) noexcept {                                \
+    return {                                                               \
+        simd_math_detail::Atan2<simd_math_detail::Pack>({y.v}, {x.v}).v};  \
+  }
+
+#if defined(HW3D_MATH_SSE) || defined(HW3D_MATH_NEON)
+HW3D_SIMD_MATH_OVERLOADS(Vec4, Pack4)
+#endif
+#if defined(HW3D_MATH_SSE) && defined(HW3D_SIMD_AVX2)
+HW3D_SIMD_MATH_OVERLOADS(Vec8, Pack8)
+#endif
+#if defined(HW3D_MATH_SSE) && defined(HW3D_SIMD_AVX512)
+HW3D_SIMD_MATH_OVERLOADS(Vec16, Pack16)
+#endif
+
+#undef HW3D_SIMD_MATH_OVERLOADS
+
+#if !defined(HW3D_MATH_SSE) && !defined(HW3D_MATH_NEON)
+// Without SIMD a Vec4 is a plain float[4]; go through the array versions.
+inline void SinCos(Vec4 x, Vec4* sin_out, Vec4* cos_out) noexcept {
+  SinCosBatch(x.v.f, sin_out->v.f, cos_out->v.f, 4);
+}
+inline Vec4 Sin(Vec4 x) noexcept {
+  SinBatch(x.v.f, x.v.f, 4);
+  return x;
+}
+inline Vec4 Cos(Vec4 x) noexcept {
+  CosBatch(x.v.f, x.v.f, 4);
+  return x;
+}
+inline Vec4 Exp(Vec4 x) noexcept {
+  ExpBatch(x.v.f, x.v.f, 4);
+  return x;
+}
+inline Vec4 Log(Vec4 x) noexcept {
+  LogBatch(x.v.f, x.v.f, 4);
+  return x;
+}
+inline Vec4 Atan2(Vec4 y, Vec4 x) noexcept {
+  Atan2Batch(y.v.f, x.v.f, y.v.f, 4);
+  return y;
+}
+#endif
+
+}  // namespace hw3d
@@ -0,0 +1,278 @@
+﻿#include "spatial_hash_grid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+namespace hw3d {
+
+namespace {
+
+// Smallest cell table; it doubles whenever it would be over half full.
+constexpr std::size_t kMinTableSize = 64;
+
+int Log2(std::size_t power_of_two) noexcept {
+  int log = 0;
+  while ((std::size_t{1} << log) < power_of_two) {
+    log++;
+  }
+  return log;
+}
+
+}  // namespace
+
+SpatialHashGrid::SpatialHashGrid(float cell_size)
+    : cell_size_(cell_size), inverse_cell_size_(1.0f / cell_size) {
+  if (!(cell_size > 0.0f) || !std::isfinite(cell_size)) {
+    throw std::invalid_argument("SpatialHashGrid: bad cell size");
+  }
+  Clear();
+}
+
+void SpatialHashGrid::Reserve(std::size_t objects) {
+  if (objects > slots_.size()) {
+    slots_.resize(objects);
+    key_of_.resize(objects, kNoCell);
+  }
+}
+
+void SpatialHashGrid::Clear() {
+  // keeps the table at the size it grew to, and the buckets' capacity
+  cells_.assign(std::max(cells_.size(), kMinTableSize), Cell());
+  hash_shift_ = 64 - Log2(cells_.size());
+  used_cells_ = 0;
+  if (buckets_.empty()) {
+    buckets_.emplace_back();
+  }
+  free_buckets_.clear();
+  for (std::size_t i = buckets_.size(); i-- > 0;) {
+    buckets_[i].clear();
+    if (i != kLargeBucket) {
+      free_buckets_.push_back(static_cast<std::uint32_t>(i));
+    }
+  }
+  std::fill(slots_.begin(), slots_.end(), Slot());
+  std::fill(key_of_.begin(), key_of_.end(), kNoCell);
+  size_ = 0;
+}
+
+int SpatialHashGrid::CellCoord(float scaled) noexcept {
+  const float cell = std::floor(scaled);
+  // NaN ends up in the lowest cell, like -infinity
+  if (cell >= static_cast<float>(kMaxCoord)) {
+    return kMaxCoord;
+  }
+  return cell > static_cast<float>(kMinCoord) ? static_cast<int>(cell)
+                                              : kMinCoord;
+}
+
+SpatialHashGrid::CellRange SpatialHashGrid::Range(Float3 min,
+                                                  Float3 max) const noexcept {
+  // objects stay within half a cell of the cell holding their centre
+  const Float3 margin{0.5f, 0.5f, 0.5f};
+  const Float3 low = min * inverse_cell_size_ - margin;
+  const Float3 high = max * inverse_cell_size_ + margin;
+  return {{CellCoord(low.x), CellCoord(low.y), CellCoord(low.z)},
+          {CellCoord(high.x), CellCoord(high.y), CellCoord(high.z)}};
+}
+
+std::uint64_t SpatialHashGrid::Place(const Aabb& box) const noexcept {
+  // reaching more than half a cell past its centre; empty boxes stay in
+  // the cells, where they are never hit anyway
+  const Float3 size = box.max - box.min;
+  if (size.x > cell_size_ || size.y > cell_size_ || size.z > cell_size_) {
+    return kLargeKey;
+  }
+  const Float3 center = Center(box) * inverse_cell_size_;
+  return CellKey(CellCoord(center.x), CellCoord(center.y),
+                 CellCoord(center.z));
+}
+
+std::size_t SpatialHashGrid::Find(std::uint64_t key) const noexcept {
+  const std::size_t mask = cells_.size() - 1;
+  // the table is never more than half full, so an empty slot ends the probe
+  for (std::size_t slot = Home(key);; slot = (slot + 1) & mask) {
+    if (cells_[slot].key == key) {
+      return slot;
+    }
+    if (cells_[slot].key == kNoCell) {
+      return kNoSlot;
+    }
+  }
+}
+
+std::uint32_t SpatialHashGrid::Acquire(std::uint64_t key) {
+  if (key == kLargeKey) {
+    return kLargeBucket;
+  }
+  const std::size_t found = Find(key);
+  if (found != kNoSlot) {
+    return cells_[found].bucket;
+  }
+  if ((used_cells_ + 1) * 2 > cells_.size()) {
+    Rehash(cells_.size() * 2);
+  }
+  const std::size_t mask = cells_.size() - 1;
+  std::size_t slot = Home(key);
+  while (cells_[slot].key != kNoCell) {
+    slot = (slot + 1) & mask;
+  }
+  std::uint32_t bucket;
+  if (!free_buckets_.empty()) {
+    bucket = free_buckets_.back();
+    free_buckets_.pop_back();
+  } else {
+    bucket = static_cast<std::uint32_t>(buckets_.size());
+    buckets_.emplace_back();
+    // so that Unlink() never allocates
+    free_buckets_.reserve(buckets_.capacity());
+  }
+  cells_[slot] = {key, bucket};
+  used_cells_++;
+  return bucket;
+}
+
+void SpatialHashGrid::Erase(std::size_t slot) noexcept {
+  // Shifts later entries of the probe run back into the hole, unless that
+  // would move one in front of its home slot. Lookups then still stop at
+  // the first empty slot, without tombstones.
+  const std::size_t mask = cells_.size() - 1;
+  std::size_t hole = slot;
+  for (std::size_t next = (hole + 1) & mask; cells_[next].key != kNoCell;
+       next = (next + 1) & mask) {
+    const std::size_t home = Home(cells_[next].key);
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      cells_[hole] = cells_[next];
+      hole = next;
+    }
+  }
+  cells_[hole] = Cell();
+  used_cells_--;
+}
+
+void SpatialHashGrid::Rehash(std::size_t capacity) {
+  std::vector<Cell> old = std::move(cells_);
+  cells_.assign(capacity, Cell());
+  hash_shift_ = 64 - Log2(capacity);
+  const std::size_t mask = capacity - 1;
+  for (const Cell& cell : old) {
+    if (cell.key == kNoCell) {
+      continue;
+    }
+    std::size_t slot = Home(cell.key);
+    while (cells_[slot].key != kNoCell) {
+      slot = (slot + 1) & mask;
+    }
+    cells_[slot] = cell;
+  }
+}
+
+void SpatialHashGrid::Link(std::uint32_t object,
+                           const Aabb& box,
+                           std::uint64_t key) {
+  const std::uint32_t bucket = Acquire(key);
+  std::vector<Entry>& entries = buckets_[bucket];
+  slots_[object] = {bucket, static_cast<std::uint32_t>(entries.size())};
+  entries.push_back({box, object});
+  key_of_[object] = key;
+}
+
+void SpatialHashGrid::Unlink(std::uint32_t object) noexcept {
+  const Slot slot = slots_[object];
+  std::vector<Entry>& entries = buckets_[slot.bucket];
+  entries[slot.index] = entries.back();
+  slots_[entries[slot.index].object].index = slot.index;
+  entries.pop_back();
+  if (entries.empty() && slot.bucket != kLargeBucket) {
+    Erase(Find(key_of_[object]));
+    free_buckets_.push_back(slot.bucket);
+  }
+  slots_[object] = Slot();
+  key_of_[object] = kNoCell;
+}
+
+void SpatialHashGrid::Grow(const std::uint32_t* objects, std::size_t count) {
+  std::uint32_t largest = 0;
+  for (std::size_t i = 0; i < count; i++) {
+    assert(objects[i] != kNoObject);
+    largest = std::max(largest, objects[i]);
+  }
+  Reserve(static_cast<std::size_t>(largest) + 1);
+}
+
+void SpatialHashGrid::Insert(std::uint32_t object, const Aabb& box) {
+  Grow(&object, 1);
+  assert(!Contains(object));
+  Link(object, box, Place(box));
+  size_++;
+}
+
+void SpatialHashGrid::Update(std::uint32_t object, const Aabb& box) {
+  assert(Contains(object));
+  const std::uint64_t key = Place(box);
+  if (key != key_of_[object]) {
+    Unlink(object);
+    Link(object, box, key);
+  } else {
+    buckets_[slots_[object].bucket][slots_[object].index].box = box;
+  }
+}
+
+void SpatialHashGrid::Remove(std::uint32_t object) noexcept {
+  if (!Contains(object)) {
+    return;
+  }
+  Unlink(object);
+  size_--;
+}
+
+void SpatialHashGrid::PlaceBatch(const std::uint32_t* objects,
+                                 const Aabb* boxes,
+                                 std::size_t count,
+                                 bool store_boxes) {
+  keys_.resize(count);
+  ParallelOptions options;
+  options.item_bytes = sizeof(std::uint64_t);
+  options.cost = &place_cost_;
+  ParallelForRange(
+      0, count,
+      [&](std::size_t b, std::size_t e) {
+        for (std::size_t i = b; i < e; i++) {
+          keys_[i] = Place(boxes[i]);
+          if (store_boxes) {
+            const Slot slot = slots_[objects[i]];
+            buckets_[slot.bucket][slot.index].box = boxes[i];
+          }
+        }
+      },
+      options);
+}
+
+void SpatialHashGrid::Insert(const std::uint32_t* objects,
+                             const Aabb* boxes,
+                             std::size_t count) {
+  Grow(objects, count);
+  PlaceBatch(objects, boxes, count, false);
+  for (std::size_t i = 0; i < count; i++) {
+    assert(!Contains(objects[i]));
+    Link(objects[i], boxes[i], keys_[i]);
+  }
+  size_ += count;
+}
+
+void SpatialHashGrid::Update(const std::uint32_t* objects,
+                             const Aabb* boxes,
+                             std::size_t count) {
+  PlaceBatch(objects, boxes, count, true);
+  for (std::size_t i = 0; i < count; i++) {
+    const std::uint32_t object = objects[i];
+    assert(Contains(object));
+    if (keys_[i] != key_of_[object]) {
+      Unlink(object);
+      Link(object, boxes[i], keys_[i]);
+    }
+  }
+}
+
+}  // namespace hw3d
@@ -0,0 +1,243 @@
+﻿#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "bounds.h"
+#include "parallel.h"
+
+namespace hw3d {
+
+// Uniform grid hashed so that only occupied cells take memory, for dense
+// crowds of similar-sized moving objects.
+//
+// An object is stored in the one cell holding its box centre, so queries
+// look half a cell further out on every side. Objects larger than a cell
+// would need a wider margin; they go on one list that every query scans
+// instead, so keep them few or put them in a LooseOctree. A move only
+// relinks an object when its centre crosses a cell border. Queries are
+// fastest with cells about as large as a typical query radius: smaller
+// ones cost a table lookup each, larger ones more box tests.
+//
+// Each cell keeps the boxes of its objects in one array, so queries scan
+// them in order. Arrays are pooled and keep their capacity when a cell
+// empties, and the cell table is open-addressed with backward-shift
+// deletion, so it never fills up with dead entries: inserts, moves and
+// removals stop allocating once the pool has grown to the working set.
+//
+// Objects are known by caller-chosen indices, which should be dense:
+// records are kept for every index up to the largest one inserted.
+//
+// Queries are const and may run on several threads at once; Insert(),
+// Update() and Remove() must not overlap them.
+class SpatialHashGrid {
+ public:
+  static constexpr std::uint32_t kNoObject =
+      std::numeric_limits<std::uint32_t>::max();
+
+  // Throws std::invalid_argument unless cell_size is positive and finite.
+  explicit SpatialHashGrid(float cell_size);
+
+  // Makes room for objects below `objects` without growing later.
+  void Reserve(std::size_t objects);
+  void Clear();
+
+  // `object` must not be in the grid yet.
+  void Insert(std::uint32_t object, const Aabb& box);
+  // `object` must be in the grid.
+  void Update(std::uint32_t object, const Aabb& box);
+  void Remove(std::uint32_t object) noexcept;
+  // Batches of distinct objects. Cells are computed on JobSystem workers
+  // when called from one; only objects that changed cell are relinked.
+  void Insert(const std::uint32_t* objects,
+              const Aabb* boxes,
+              std::size_t count);
+  void Update(const std::uint32_t* objects,
+              const Aabb* boxes,
+              std::size_t count);
+
+  bool Contains(std::uint32_t object) const noexcept {
+    return object < slots_.size() && slots_[object].bucket != kNoBucket;
+  }
+
+  // Calls fn(object) for every object whose box overlaps `box`.
+  template <typename Fn>
+  void QueryOverlap(const Aabb& box, Fn&& fn) const;
+  // Calls fn(object) for every object whose box is within `radius` of
+  // `center`.
+  template <typename Fn>
+  void QuerySphere(Float3 center, float radius, Fn&& fn) const;
+
+  float cell_size() const noexcept { return cell_size_; }
+  std::size_t size() const noexcept { return size_; }
+  const Aabb& bounds(std::uint32_t object) const noexcept {
+    assert(Contains(object));
+    return buckets_[slots_[object].bucket][slots_[object].index].box;
+  }
+  // Occupied cells.
+  std::size_t cell_count() const noexcept { return used_cells_; }
+  // Objects on the list every query scans.
+  std::size_t large_count() const noexcept {
+    return buckets_[kLargeBucket].size();
+  }
+
+ private:
+  // Cell coordinates are clamped to 21 bits and keys pack them biased to
+  // unsigned, so the top bit is never set by a real cell.
+  static constexpr int kCoordBits = 21;
+  static constexpr int kMinCoord = -(1 << (kCoordBits - 1));
+  static constexpr int kMaxCoord = (1 << (kCoordBits - 1)) - 1;
+  static constexpr std::uint64_t kNoCell =
+      std::numeric_limits<std::uint64_t>::max();
+  // Key of the objects larger than a cell.
+  static constexpr std::uint64_t kLargeKey = std::uint64_t{1} << 63;
+  static constexpr std::uint32_t kNoBucket =
+      std::numeric_limits<std::uint32_t>::max();
+  // Bucket of the objects larger than a cell; it is never in the table.
+  static constexpr std::uint32_t kLargeBucket = 0;
+  static constexpr std::size_t kNoSlot =
+      std::numeric_limits<std::size_t>::max();
+
+  struct Cell {
+    std::uint64_t key = kNoCell;
+    // index into buckets_; it stays put while the table moves cells around
+    std::uint32_t bucket = kNoBucket;
+  };
+
+  struct Entry {
+    Aabb box;
+    std::uint32_t object;
+  };
+
+  // Where an object's entry is.
+  struct Slot {
+    std::uint32_t bucket = kNoBucket;
+    std::uint32_t index = 0;
+  };
+
+  struct CellRange {
+    int min[3];
+    int max[3];
+  };
+
+  static std::uint64_t CellKey(int x, int y, int z) noexcept {
+    const auto bias = [](int v) {
+      return static_cast<std::uint64_t>(v - kMinCoord);
+    };
+    return bias(x) | bias(y) << kCoordBits | bias(z) << (2 * kCoordBits);
+  }
+
+  // Cell coordinate of a position already divided by the cell size.
+  static int CellCoord(float scaled) noexcept;
+  // Cells whose objects can reach into [min, max].
+  CellRange Range(Float3 min, Float3 max) const noexcept;
+  std::uint64_t Place(const Aabb& box) const noexcept;
+  // Preferred table slot of a key.
+  std::size_t Home(std::uint64_t key) const noexcept {
+    return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >>
+                                    hash_shift_);
+  }
+  std::size_t Find(std::uint64_t key) const noexcept;
+  // Bucket of the cell with `key`, adding the cell if it is new.
+  std::uint32_t Acquire(std::uint64_t key);
+  void Erase(std::size_t slot) noexcept;
+  void Rehash(std::size_t capacity);
+  void Link(std::uint32_t object, const Aabb& box, std::uint64_t key);
+  void Unlink(std::uint32_t object) noexcept;
+  void Grow(const std::uint32_t* objects, std::size_t count);
+  // Parallel half of the batch calls: computes keys_, and for objects
+  // already in the grid stores their new boxes.
+  void PlaceBatch(const std::uint32_t* objects,
+                  const Aabb* boxes,
+                  std::size_t count,
+                  bool store_boxes);
+
+  template <typename ObjectTest, typename Fn>
+  void Visit(const CellRange& range,
+             const ObjectTest& object_test,
+             Fn& fn) const;
+
+  float cell_size_;
+  float inverse_cell_size_;
+  std::size_t size_ = 0;
+
+  // open-addressed, linear probing; the size is a power of two
+  std::vector<Cell> cells_;
+  int hash_shift_ = 0;
+  std::size_t used_cells_ = 0;
+
+  // objects of each cell; buckets not in use are empty and on the free list
+  std::vector<std::vector<Entry>> buckets_;
+  std::vector<std::uint32_t> free_buckets_;
+  std::vector<Slot> slots_;
+  // current cell of each object, compared to skip relinking
+  std::vector<std::uint64_t> key_of_;
+  // batch scratch, kept to avoid reallocating
+  std::vector<std::uint64_t> keys_;
+  ParallelCost place_cost_;
+};
+
+template <typename ObjectTest, typename Fn>
+void SpatialHashGrid::Visit(const CellRange& range,
+                            const ObjectTest& object_test,
+                            Fn& fn) const {
+  const auto visit_bucket = [&](std::uint32_t bucket) {
+    for (const Entry& entry : buckets_[bucket]) {
+      if (object_test(entry.box)) {
+        fn(entry.object);
+      }
+    }
+  };
+  visit_bucket(kLargeBucket);
+  if (range.max[0] < range.min[0] || range.max[1] < range.min[1] ||
+      range.max[2] < range.min[2]) {
+    return;
+  }
+  std::uint64_t cells = 1;
+  for (int axis = 0; axis < 3; axis++) {
+    cells *= static_cast<std::uint64_t>(
+        static_cast<std::int64_t>(range.max[axis]) - range.min[axis] + 1);
+  }
+  // a range covering more cells than are occupied is cheaper to answer by
+  // walking the table
+  if (cells > used_cells_) {
+    for (const Cell& cell : cells_) {
+      if (cell.key != kNoCell) {
+        visit_bucket(cell.bucket);
+      }
+    }
+    return;
+  }
+  for (int z = range.min[2]; z <= range.max[2]; z++) {
+    for (int y = range.min[1]; y <= range.max[1]; y++) {
+      for (int x = range.min[0]; x <= range.max[0]; x++) {
+        const std::size_t slot = Find(CellKey(x, y, z));
+        if (slot != kNoSlot) {
+          visit_bucket(cells_[slot].bucket);
+        }
+      }
+    }
+  }
+}
+
+template <typename Fn>
+void SpatialHashGrid::QueryOverlap(const Aabb& box, Fn&& fn) const {
+  Visit(Range(box.min, box.max),
+        [&box](const Aabb& object) { return Overlaps(object, box); }, fn);
+}
+
+template <typename Fn>
+void SpatialHashGrid::QuerySphere(Float3 center, float radius, Fn&& fn) const {
+  const float radius_squared = radius * radius;
+  const Float3 r{radius, radius, radius};
+  Visit(Range(center - r, center + r),
+        [&](const Aabb& object) {
+          return DistanceSquared(object, center) <= radius_squared;
+        },
+        fn);
+}
+
+}  // namespace hw3d
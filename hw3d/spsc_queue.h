@@ -0,0 +1,79 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+namespace hw3d {
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Each side owns its index and keeps a cached copy of the other's,
+// so a push or pop touches the shared cache line only when the cached view
+// says the queue looks full (or empty). A full queue rejects the push
+// instead of blocking.
+template <typename T>
+class SpscQueue {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "SpscQueue copies elements with plain assignment");
+
+ public:
+  // `capacity` is rounded up to a power of two.
+  explicit SpscQueue(std::size_t capacity)
+      : mask_(RoundUpPow2(capacity) - 1),
+        slots_(std::make_unique<T[]>(mask_ + 1)) {}
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  // Only the producer thread may call this.
+  bool TryPush(const T& value) noexcept {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_cache_ > mask_) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (tail - head_cache_ > mask_) {
+        return false;
+      }
+    }
+    slots_[tail & mask_] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Only the consumer thread may call this.
+  bool TryPop(T& out) noexcept {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_cache_) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if (head == tail_cache_) {
+        return false;
+      }
+    }
+    out = slots_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::size_t capacity() const noexcept { return mask_ + 1; }
+
+ private:
+  static constexpr std::size_t kCacheLine = 64;
+
+  static std::size_t RoundUpPow2(std::size_t n) noexcept {
+    std::size_t p = 2;
+    while (p < n) {
+      p <<= 1;
+    }
+    return p;
+  }
+
+  const std::size_t mask_;
+  std::unique_ptr<T[]> slots_;
+  // producer side: its index and its view of the consumer's
+  alignas(kCacheLine) std::atomic<std::size_t> tail_{0};
+  std::size_t head_cache_ = 0;
+  // consumer side: its index and its view of the producer's
+  alignas(kCacheLine) std::atomic<std::size_t> head_{0};
+  std::size_t tail_cache_ = 0;
+};
+
+}  // namespace hw3d
@@ -1,7 +1,8 @@
 #include "string_utils.h"
 
 #include <stdexcept>
-#include <vector>
+
+#include "utf_transcode.h"
 
 namespace hw3d {
 
@@ -9,24 +10,39 @@ std::wstring MultiByteToWide(const std::string& s, UINT codePage) {
   if (s.empty())
     return std::wstring();
 
-  int required = ::MultiByteToWideChar(codePage, 0, s.c_str(), -1, nullptr, 0);
-  if (required == 0) {
-    throw std::runtime_error("MultiByteToWideChar failed: " +
-                             std::to_string(::GetLastError()));
+  // one character per input byte is the worst case for every code page, so a
+  // single conversion pass is enough
+  std::wstring out(s.size(), L'\0');
+  out.resize(MultiByteToWide(s, &out[0], out.size(), codePage));
+  return out;
+}
+
+std::size_t MultiByteToWide(std::string_view s,
+                            wchar_t* out,
+                            std::size_t capacity,
+                            UINT codePage) {
+  if (s.empty())
+    return 0;
+
+  if (codePage == CP_UTF8) {
+    // substitute U+FFFD like MultiByteToWideChar, so a stray byte in a path
+    // or title does not throw
+    const UtfResult result =
+        Utf8ToUtf16(s, out, capacity, UtfErrors::kReplace);
+    if (result.status == UtfStatus::kOutputTooSmall) {
+      throw std::runtime_error("MultiByteToWide: output buffer too small");
+    }
+    return result.written;
   }
 
-  std::wstring out;
-  out.resize(required);
-  int res =
-      ::MultiByteToWideChar(codePage, 0, s.c_str(), -1, &out[0], required);
+  int res = ::MultiByteToWideChar(codePage, 0, s.data(),
+                                  static_cast<int>(s.size()), out,
+                                  static_cast<int>(capacity));
   if (res == 0) {
     throw std::runtime_error("MultiByteToWideChar failed: " +
                              std::to_string(::GetLastError()));
   }
-  // remove terminating null added by API
-  if (!out.empty() && out.back() == L'\0')
-    out.pop_back();
-  return out;
+  return static_cast<std::size_t>(res);
 }
 
 }  // namespace hw3d
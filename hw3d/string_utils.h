@@ -1,7 +1,9 @@
 ﻿#pragma once
 
 #include <windows.h>
+#include <cstddef>
 #include <string>
+#include <string_view>
 
 // Some older Windows SDKs may not define CP_UTF8; provide a fallback.
 #ifndef CP_UTF8
@@ -10,7 +12,17 @@
 
 namespace hw3d {
 // Convert a multibyte string to a wide string using the specified code page.
-// Throws std::runtime_error on failure.
+// Invalid UTF-8 becomes U+FFFD, as with MultiByteToWideChar. Throws
+// std::runtime_error if the conversion fails.
 std::wstring MultiByteToWide(const std::string& s, UINT codePage = CP_UTF8);
 
+// Convert into a caller-provided buffer without allocating. Returns the
+// number of wide characters written (no terminator is added). A buffer of
+// `s.size()` characters is always large enough. Throws std::runtime_error on
+// failure or if `capacity` is too small.
+std::size_t MultiByteToWide(std::string_view s,
+                            wchar_t* out,
+                            std::size_t capacity,
+                            UINT codePage = CP_UTF8);
+
 }  // namespace hw3d
@@ -0,0 +1,15 @@
+﻿#pragma once
+
+namespace hw3d {
+
+// What the frame loop draws into: the D3D11 swap chain on Windows
+// (Graphics) or an offscreen buffer for headless runs (OffscreenSurface).
+class Surface {
+ public:
+  virtual ~Surface() = default;
+
+  virtual void ClearBuffer(float red, float green, float blue) = 0;
+  virtual void Present() = 0;
+};
+
+}  // namespace hw3d
@@ -0,0 +1,51 @@
+﻿#include "system_scheduler.h"
+
+#include <algorithm>
+
+#include "job_system.h"
+
+namespace hw3d {
+
+void SystemScheduler::AddSystem(std::string name,
+                                ComponentMask reads,
+                                ComponentMask writes,
+                                SystemFunction fn) {
+  auto system = std::make_unique<System>();
+  system->name = std::move(name);
+  system->reads = reads & ~writes;
+  system->writes = writes;
+  system->fn = std::move(fn);
+  // one batch after the last system it conflicts with
+  std::size_t batch = 0;
+  for (const auto& other : systems_) {
+    const bool conflict =
+        (writes & (other->reads | other->writes)) != 0 ||
+        (other->writes & reads) != 0;
+    if (conflict) {
+      batch = std::max(batch, other->batch + 1);
+    }
+  }
+  system->batch = batch;
+  if (batches_.size() <= batch) {
+    batches_.resize(batch + 1);
+  }
+  batches_[batch].push_back(system.get());
+  systems_.push_back(std::move(system));
+}
+
+void SystemScheduler::Run(World& world) {
+  JobSystem& jobs = JobSystem::Get();
+  for (const auto& batch : batches_) {
+    JobCounter counter;
+    for (System* system : batch) {
+      World* w = &world;
+      jobs.Run([system, w] { system->fn(*w, system->commands); }, &counter);
+    }
+    jobs.Wait(counter);
+  }
+  for (const auto& system : systems_) {
+    system->commands.Apply(world);
+  }
+}
+
+}  // namespace hw3d
@@ -0,0 +1,71 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ecs.h"
+
+namespace hw3d {
+
+// Component access a system declares when it is added.
+template <typename... Ts>
+struct Reads {};
+template <typename... Ts>
+struct Writes {};
+
+// Runs systems over a World, in parallel wherever their declared access
+// allows. Two systems conflict if either writes a component the other
+// reads or writes; conflicting systems run in the order they were added,
+// others may run together on JobSystem workers. Systems record structural
+// changes into their own CommandBuffer, and the buffers are applied in the
+// order the systems were added once every system has run.
+//
+// A system must touch only what it declares and must not throw. Run() it
+// from a JobSystem worker (the thread that called Start()) to get
+// parallelism; elsewhere the systems run one after another.
+class SystemScheduler {
+ public:
+  using SystemFunction = std::function<void(World&, CommandBuffer&)>;
+
+  SystemScheduler() = default;
+  SystemScheduler(const SystemScheduler&) = delete;
+  SystemScheduler& operator=(const SystemScheduler&) = delete;
+
+  template <typename... R, typename... W>
+  void Add(std::string name, Reads<R...>, Writes<W...>, SystemFunction fn) {
+    AddSystem(std::move(name),
+              (ComponentMask{0} | ... | ecs_detail::Bit(ComponentIdOf<R>())),
+              (ComponentMask{0} | ... | ecs_detail::Bit(ComponentIdOf<W>())),
+              std::move(fn));
+  }
+
+  void Run(World& world);
+
+  std::size_t system_count() const noexcept { return systems_.size(); }
+  // Groups of systems that run together; a group starts once the one
+  // before it has finished.
+  std::size_t batch_count() const noexcept { return batches_.size(); }
+
+ private:
+  struct System {
+    std::string name;
+    ComponentMask reads;
+    ComponentMask writes;
+    SystemFunction fn;
+    CommandBuffer commands;
+    std::size_t batch;
+  };
+
+  void AddSystem(std::string name,
+                 ComponentMask reads,
+                 ComponentMask writes,
+                 SystemFunction fn);
+
+  std::vector<std::unique_ptr<System>> systems_;
+  std::vector<std::vector<System*>> batches_;
+};
+
+}  // namespace hw3d
@@ -0,0 +1,419 @@
+﻿#include "transform_hierarchy.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace hw3d {
+
+namespace {
+
+// nodes whose local matrices are built together
+constexpr std::size_t kGroup = 4;
+
+template <typename T>
+void PermuteArray(std::vector<T>& v, const std::vector<std::uint32_t>& order) {
+  std::vector<T> out;
+  out.reserve(order.size());
+  for (const std::uint32_t old : order) {
+    out.push_back(v[old]);
+  }
+  v.swap(out);
+}
+
+// Room for `n` elements, growing geometrically: reserving exactly n on every
+// Add would copy the whole array each time.
+template <typename T>
+void Grow(std::vector<T>& v, std::size_t n) {
+  if (v.capacity() < n) {
+    v.reserve(std::max(n, 2 * v.capacity()));
+  }
+}
+
+}  // namespace
+
+TransformHierarchy::NodeHandle TransformHierarchy::Add(
+    NodeHandle parent,
+    const LocalTransform& local) {
+  std::uint32_t parent_dense = kNone;
+  if (parent) {
+    parent_dense = Dense(parent);
+    if (parent_dense == kNone) {
+      throw std::invalid_argument("TransformHierarchy: stale parent");
+    }
+  }
+  if (free_head_ == kNone) {
+    if (slots_.size() >= kMaxNodes) {
+      throw std::length_error("TransformHierarchy: out of handles");
+    }
+    slots_.push_back(Slot{kNone, 1});
+    free_head_ = static_cast<std::uint32_t>(slots_.size() - 1);
+  }
+  // reserve everything first so the pushes below cannot fail halfway
+  const std::size_t n = ids_.size() + 1;
+  Grow(ids_, n);
+  Grow(parent_, n);
+  Grow(dirty_, n);
+  Grow(world_, n);
+  for (auto& component : components_) {
+    Grow(component, n + kGroup - 1);
+  }
+
+  const auto dense = static_cast<std::uint32_t>(ids_.size());
+  const std::uint32_t index = free_head_;
+  ids_.push_back(index);
+  parent_.push_back(parent_dense);
+  dirty_.push_back(0);
+  world_.push_back(MatIdentity());
+  PadComponents();
+  Store(dense, local);
+  MarkDirty(dense);
+  order_stale_ = true;
+
+  Slot& slot = slots_[index];
+  free_head_ = slot.dense;
+  slot.dense = dense;
+  return NodeHandle::FromParts(index, slot.generation);
+}
+
+void TransformHierarchy::Remove(NodeHandle node) {
+  const std::uint32_t root = Dense(node);
+  if (root == kNone) {
+    return;
+  }
+  // a node goes if it or an ancestor is the removed node; each walk stops
+  // at the first ancestor already decided
+  constexpr std::uint8_t kUnknown = 0;
+  constexpr std::uint8_t kKeep = 1;
+  constexpr std::uint8_t kDrop = 2;
+  const std::size_t n = ids_.size();
+  std::vector<std::uint8_t> state(n, kUnknown);
+  state[root] = kDrop;
+  std::vector<std::uint32_t> path;
+  for (std::uint32_t i = 0; i < n; i++) {
+    std::uint32_t j = i;
+    while (state[j] == kUnknown && parent_[j] != kNone) {
+      path.push_back(j);
+      j = parent_[j];
+    }
+    const std::uint8_t decided = state[j] == kUnknown ? kKeep : state[j];
+    state[j] = decided;
+    for (const std::uint32_t k : path) {
+      state[k] = decided;
+    }
+    path.clear();
+  }
+
+  std::vector<std::uint32_t> order;
+  order.reserve(n);
+  for (std::uint32_t i = 0; i < n; i++) {
+    if (state[i] == kKeep) {
+      order.push_back(i);
+      continue;
+    }
+    // bump the generation so every handle to the slot goes stale; a slot
+    // out of generations is retired instead of reused
+    Slot& slot = slots_[ids_[i]];
+    slot.generation = NodeHandle::NextGeneration(slot.generation);
+    if (slot.generation == NodeHandle::kRetiredGeneration) {
+      slot.dense = kNone;
+      continue;
+    }
+    slot.dense = free_head_;
+    free_head_ = ids_[i];
+  }
+  Permute(order);
+  order_stale_ = true;
+}
+
+void TransformHierarchy::SetParent(NodeHandle node, NodeHandle parent) {
+  const std::uint32_t dense = Dense(node);
+  if (dense == kNone) {
+    return;
+  }
+  std::uint32_t parent_dense = kNone;
+  if (parent) {
+    parent_dense = Dense(parent);
+    if (parent_dense == kNone) {
+      throw std::invalid_argument("TransformHierarchy: stale parent");
+    }
+    for (std::uint32_t p = parent_dense; p != kNone; p = parent_[p]) {
+      if (p == dense) {
+        throw std::invalid_argument(
+            "TransformHierarchy: parent is inside the node's subtree");
+      }
+    }
+  }
+  if (parent_[dense] == parent_dense) {
+    return;
+  }
+  parent_[dense] = parent_dense;
+  MarkDirty(dense);
+  order_stale_ = true;
+}
+
+TransformHierarchy::NodeHandle TransformHierarchy::parent(
+    NodeHandle node) const noexcept {
+  const std::uint32_t dense = Dense(node);
+  if (dense == kNone || parent_[dense] == kNone) {
+    return NodeHandle();
+  }
+  const std::uint32_t index = ids_[parent_[dense]];
+  return NodeHandle::FromParts(index, slots_[index].generation);
+}
+
+void TransformHierarchy::SetLocal(NodeHandle node,
+                                  const LocalTransform& local) noexcept {
+  const std::uint32_t dense = Dense(node);
+  if (dense != kNone) {
+    Store(dense, local);
+    MarkDirty(dense);
+  }
+}
+
+void TransformHierarchy::SetPosition(NodeHandle node,
+                                     Float3 position) noexcept {
+  const std::uint32_t dense = Dense(node);
+  if (dense != kNone) {
+    components_[kPositionX][dense] = position.x;
+    components_[kPositionY][dense] = position.y;
+    components_[kPositionZ][dense] = position.z;
+    MarkDirty(dense);
+  }
+}
+
+void TransformHierarchy::SetRotation(NodeHandle node,
+                                     Float4 rotation) noexcept {
+  const std::uint32_t dense = Dense(node);
+  if (dense != kNone) {
+    components_[kRotationX][dense] = rotation.x;
+    components_[kRotationY][dense] = rotation.y;
+    components_[kRotationZ][dense] = rotation.z;
+    components_[kRotationW][dense] = rotation.w;
+    MarkDirty(dense);
+  }
+}
+
+void TransformHierarchy::SetScale(NodeHandle node, Float3 scale) noexcept {
+  const std::uint32_t dense = Dense(node);
+  if (dense != kNone) {
+    components_[kScaleX][dense] = scale.x;
+    components_[kScaleY][dense] = scale.y;
+    components_[kScaleZ][dense] = scale.z;
+    MarkDirty(dense);
+  }
+}
+
+LocalTransform TransformHierarchy::local(NodeHandle node) const noexcept {
+  LocalTransform t;
+  const std::uint32_t dense = Dense(node);
+  if (dense == kNone) {
+    return t;
+  }
+  const auto& c = components_;
+  t.position = {c[kPositionX][dense], c[kPositionY][dense],
+                c[kPositionZ][dense]};
+  t.rotation = {c[kRotationX][dense], c[kRotationY][dense],
+                c[kRotationZ][dense], c[kRotationW][dense]};
+  t.scale = {c[kScaleX][dense], c[kScaleY][dense], c[kScaleZ][dense]};
+  return t;
+}
+
+const Mat4* TransformHierarchy::world(NodeHandle node) const noexcept {
+  const std::uint32_t dense = Dense(node);
+  return dense == kNone ? nullptr : &world_[dense];
+}
+
+void TransformHierarchy::Update() {
+  if (order_stale_) {
+    Rebuild();
+  }
+  last_updated_ = 0;
+  if (!any_dirty_) {
+    return;
+  }
+  ParallelOptions options;
+  options.item_bytes = sizeof(Mat4);
+  options.cost = &cost_;
+  // a level only reads the one above it, which is finished by then
+  for (std::size_t level = 0; level + 1 < levels_.size(); level++) {
+    std::atomic<std::size_t> updated{0};
+    ParallelForRange(
+        levels_[level], levels_[level + 1],
+        [this, &updated](std::size_t b, std::size_t e) {
+          updated.fetch_add(UpdateRange(b, e), std::memory_order_relaxed);
+        },
+        options);
+    last_updated_ += updated.load(std::memory_order_relaxed);
+  }
+  std::fill(dirty_.begin(), dirty_.end(), std::uint8_t{0});
+  any_dirty_ = false;
+}
+
+std::uint32_t TransformHierarchy::Dense(NodeHandle node) const noexcept {
+  const std::uint32_t index = node.index();
+  if (!node || index >= slots_.size() ||
+      slots_[index].generation != node.generation()) {
+    return kNone;
+  }
+  return slots_[index].dense;
+}
+
+void TransformHierarchy::Store(std::uint32_t dense,
+                               const LocalTransform& local) noexcept {
+  auto& c = components_;
+  c[kPositionX][dense] = local.position.x;
+  c[kPositionY][dense] = local.position.y;
+  c[kPositionZ][dense] = local.position.z;
+  c[kRotationX][dense] = local.rotation.x;
+  c[kRotationY][dense] = local.rotation.y;
+  c[kRotationZ][dense] = local.rotation.z;
+  c[kRotationW][dense] = local.rotation.w;
+  c[kScaleX][dense] = local.scale.x;
+  c[kScaleY][dense] = local.scale.y;
+  c[kScaleZ][dense] = local.scale.z;
+}
+
+void TransformHierarchy::PadComponents() {
+  // a group may start at the last node, so three floats of slack; their
+  // values only feed local matrices that are thrown away
+  for (auto& component : components_) {
+    component.resize(ids_.size() + kGroup - 1);
+  }
+}
+
+void TransformHierarchy::Permute(const std::vector<std::uint32_t>& order) {
+  std::vector<std::uint32_t> new_index(ids_.size(), kNone);
+  for (std::uint32_t i = 0; i < order.size(); i++) {
+    new_index[order[i]] = i;
+  }
+  std::vector<std::uint32_t> parent;
+  parent.reserve(order.size());
+  for (const std::uint32_t old : order) {
+    parent.push_back(parent_[old] == kNone ? kNone : new_index[parent_[old]]);
+  }
+  parent_.swap(parent);
+  PermuteArray(ids_, order);
+  PermuteArray(dirty_, order);
+  PermuteArray(world_, order);
+  for (auto& component : components_) {
+    PermuteArray(component, order);
+  }
+  PadComponents();
+  for (std::uint32_t i = 0; i < ids_.size(); i++) {
+    slots_[ids_[i]].dense = i;
+  }
+}
+
+void TransformHierarchy::Rebuild() {
+  // depth of every node; each walk stops at the first known ancestor
+  const std::size_t n = ids_.size();
+  std::vector<std::uint32_t> depth(n, kNone);
+  std::vector<std::uint32_t> path;
+  std::uint32_t max_depth = 0;
+  for (std::uint32_t i = 0; i < n; i++) {
+    std::uint32_t j = i;
+    while (depth[j] == kNone && parent_[j] != kNone) {
+      path.push_back(j);
+      j = parent_[j];
+    }
+    if (depth[j] == kNone) {
+      depth[j] = 0;
+    }
+    std::uint32_t d = depth[j];
+    for (auto k = path.rbegin(); k != path.rend(); ++k) {
+      depth[*k] = ++d;
+    }
+    max_depth = std::max(max_depth, d);
+    path.clear();
+  }
+
+  // counting sort by depth, keeping the current order within a level
+  levels_.assign(n == 0 ? 1 : max_depth + 2, 0);
+  for (std::uint32_t i = 0; i < n; i++) {
+    levels_[depth[i] + 1]++;
+  }
+  for (std::size_t d = 1; d < levels_.size(); d++) {
+    levels_[d] += levels_[d - 1];
+  }
+  std::vector<std::uint32_t> order(n);
+  std::vector<std::uint32_t> next(levels_.begin(), levels_.end() - 1);
+  for (std::uint32_t i = 0; i < n; i++) {
+    order[next[depth[i]]++] = i;
+  }
+  Permute(order);
+  order_stale_ = false;
+}
+
+std::size_t TransformHierarchy::UpdateRange(std::size_t begin,
+                                            std::size_t end) noexcept {
+  const Mat4 identity = MatIdentity();
+  const auto& c = components_;
+  std::size_t updated = 0;
+  // rotation * scale rows of four nodes: rows[3 * row + column][node]
+  float rows[9][kGroup];
+  for (std::size_t g = begin; g < end; g += kGroup) {
+    const std::size_t count = std::min(kGroup, end - g);
+    // a node is stale if it or its parent is; the parent's flag is final
+    // because its level is done
+    bool any = false;
+    for (std::size_t k = 0; k < count; k++) {
+      const std::uint32_t p = parent_[g + k];
+      if (p != kNone && dirty_[p] != 0) {
+        dirty_[g + k] = 1;
+      }
+      any |= dirty_[g + k] != 0;
+    }
+    if (!any) {
+      continue;
+    }
+
+    // the MatRotationQuat terms for four nodes at once
+    const Vec4 x = math_detail::LoadFloats(&c[kRotationX][g]);
+    const Vec4 y = math_detail::LoadFloats(&c[kRotationY][g]);
+    const Vec4 z = math_detail::LoadFloats(&c[kRotationZ][g]);
+    const Vec4 w = math_detail::LoadFloats(&c[kRotationW][g]);
+    const Vec4 x2 = x + x;
+    const Vec4 y2 = y + y;
+    const Vec4 z2 = z + z;
+    const Vec4 xx = x * x2, yy = y * y2, zz = z * z2;
+    const Vec4 xy = x * y2, xz = x * z2, yz = y * z2;
+    const Vec4 wx = w * x2, wy = w * y2, wz = w * z2;
+    const Vec4 one = VecSplat(1.0f);
+    const Vec4 sx = math_detail::LoadFloats(&c[kScaleX][g]);
+    const Vec4 sy = math_detail::LoadFloats(&c[kScaleY][g]);
+    const Vec4 sz = math_detail::LoadFloats(&c[kScaleZ][g]);
+    math_detail::StoreFloats(rows[0], (one - (yy + zz)) * sx);
+    math_detail::StoreFloats(rows[1], (xy + wz) * sx);
+    math_detail::StoreFloats(rows[2], (xz - wy) * sx);
+    math_detail::StoreFloats(rows[3], (xy - wz) * sy);
+    math_detail::StoreFloats(rows[4], (one - (xx + zz)) * sy);
+    math_detail::StoreFloats(rows[5], (yz + wx) * sy);
+    math_detail::StoreFloats(rows[6], (xz + wy) * sz);
+    math_detail::StoreFloats(rows[7], (yz - wx) * sz);
+    math_detail::StoreFloats(rows[8], (one - (xx + yy)) * sz);
+
+    // local * parent world, a row of the local matrix at a time
+    for (std::size_t k = 0; k < count; k++) {
+      const std::size_t i = g + k;
+      if (dirty_[i] == 0) {
+        continue;
+      }
+      const std::uint32_t p = parent_[i];
+      const Mat4& pw = p == kNone ? identity : world_[p];
+      Mat4& out = world_[i];
+      for (int r = 0; r < 3; r++) {
+        out.r[r] = MulAdd(VecSplat(rows[3 * r][k]), pw.r[0],
+                          MulAdd(VecSplat(rows[3 * r + 1][k]), pw.r[1],
+                                 VecSplat(rows[3 * r + 2][k]) * pw.r[2]));
+      }
+      out.r[3] = MulAdd(VecSplat(c[kPositionX][i]), pw.r[0],
+                        MulAdd(VecSplat(c[kPositionY][i]), pw.r[1],
+                               MulAdd(VecSplat(c[kPositionZ][i]), pw.r[2],
+                                      pw.r[3])));
+      updated++;
+    }
+  }
+  return updated;
+}
+
+}  // namespace hw3d
@@ -0,0 +1,144 @@
+﻿#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "parallel.h"
+#include "resource_registry.h"
+#include "vector_math.h"
+
+namespace hw3d {
+
+// Local transform of a node: scale, then rotate, then translate, relative
+// to the parent.
+struct LocalTransform {
+  Float3 position;
+  // unit quaternion (x, y, z, w)
+  Float4 rotation{0.0f, 0.0f, 0.0f, 1.0f};
+  Float3 scale{1.0f, 1.0f, 1.0f};
+};
+
+// Parent/child transforms for a scene. Local position, rotation and scale
+// are kept component by component in separate arrays, sorted by depth so
+// that each level of the tree is one contiguous range and parents come
+// before their children. Update() walks the levels in order and recomputes
+// the world matrix (local * parent world) of every node whose transform, or
+// an ancestor's, changed since the last update. Local matrices are built
+// four nodes at a time, and a level large enough to be worth it is split
+// across JobSystem workers.
+//
+// Add and SetParent only mark the order stale; the next Update() re-sorts.
+// Remove compacts the arrays at once, so it costs O(size()) per call.
+// Handles stay valid across re-sorts. Not thread-safe.
+class TransformHierarchy {
+ public:
+  using NodeHandle = Handle<TransformHierarchy>;
+  static constexpr std::size_t kMaxNodes = NodeHandle::kIndexMask;
+
+  TransformHierarchy() = default;
+  TransformHierarchy(const TransformHierarchy&) = delete;
+  TransformHierarchy& operator=(const TransformHierarchy&) = delete;
+
+  // Adds a node under `parent`, or a root for a null handle. Throws
+  // std::invalid_argument for a stale parent and std::length_error once
+  // kMaxNodes nodes exist, counting slots retired after kGenerationMask
+  // reuses.
+  NodeHandle Add(NodeHandle parent = NodeHandle(),
+                 const LocalTransform& local = LocalTransform());
+  // Removes the node and all of its descendants, compacting every array:
+  // O(size()) however small the subtree. Stale handles are ignored.
+  void Remove(NodeHandle node);
+  // Moves the node, with its subtree, under `parent` (null for a root).
+  // Throws std::invalid_argument if `parent` is stale or in the subtree.
+  void SetParent(NodeHandle node, NodeHandle parent);
+
+  bool IsAlive(NodeHandle node) const noexcept {
+    return Dense(node) != kNone;
+  }
+  // Null for roots and stale handles.
+  NodeHandle parent(NodeHandle node) const noexcept;
+
+  // Setters ignore stale handles.
+  void SetLocal(NodeHandle node, const LocalTransform& local) noexcept;
+  void SetPosition(NodeHandle node, Float3 position) noexcept;
+  void SetRotation(NodeHandle node, Float4 rotation) noexcept;
+  void SetScale(NodeHandle node, Float3 scale) noexcept;
+  // Default transform for a stale handle.
+  LocalTransform local(NodeHandle node) const noexcept;
+  // As of the last Update(); nullptr for a stale handle.
+  const Mat4* world(NodeHandle node) const noexcept;
+
+  // Brings every world matrix up to date. Call it from a JobSystem job to
+  // spread large levels over the workers; elsewhere it runs serially.
+  void Update();
+
+  std::size_t size() const noexcept { return ids_.size(); }
+  // Depth of the deepest node plus one, as of the last Update().
+  std::size_t level_count() const noexcept {
+    return levels_.empty() ? 0 : levels_.size() - 1;
+  }
+  // World matrices recomputed by the last Update().
+  std::size_t last_update_count() const noexcept { return last_updated_; }
+
+ private:
+  static constexpr std::uint32_t kNone = 0xFFFFFFFF;
+
+  // local transform components, one array each
+  enum Component {
+    kPositionX,
+    kPositionY,
+    kPositionZ,
+    kRotationX,
+    kRotationY,
+    kRotationZ,
+    kRotationW,
+    kScaleX,
+    kScaleY,
+    kScaleZ,
+    kComponentCount,
+  };
+
+  struct Slot {
+    // dense index while alive, next free slot while free
+    std::uint32_t dense;
+    std::uint32_t generation;
+  };
+
+  std::uint32_t Dense(NodeHandle node) const noexcept;
+  void Store(std::uint32_t dense, const LocalTransform& local) noexcept;
+  void MarkDirty(std::uint32_t dense) noexcept {
+    dirty_[dense] = 1;
+    any_dirty_ = true;
+  }
+  // Keeps the component arrays a whole number of groups of four long, so
+  // the four-wide loads in UpdateRange never leave them.
+  void PadComponents();
+  // Moves every array into `order` (new index -> old index) and sets
+  // parent_ and the slots to match.
+  void Permute(const std::vector<std::uint32_t>& order);
+  // Sorts by depth and rebuilds levels_.
+  void Rebuild();
+  std::size_t UpdateRange(std::size_t begin, std::size_t end) noexcept;
+
+  std::vector<Slot> slots_;
+  std::uint32_t free_head_ = kNone;
+
+  // per node, in level order
+  std::vector<std::uint32_t> ids_;  // slot index
+  std::vector<std::uint32_t> parent_;  // dense index or kNone
+  std::vector<std::uint8_t> dirty_;
+  std::vector<Mat4> world_;
+  std::array<std::vector<float>, kComponentCount> components_;
+
+  // levels_[d] is the first node at depth d; one past the end at the back
+  std::vector<std::uint32_t> levels_;
+  bool order_stale_ = false;
+  bool any_dirty_ = false;
+  std::size_t last_updated_ = 0;
+  ParallelCost cost_;
+};
+
+}  // namespace hw3d
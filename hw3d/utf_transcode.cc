@@ -0,0 +1,377 @@
+﻿#include "utf_transcode.h"
+
+#include <cstdint>
+#include <stdexcept>
+
+#include "simd_config.h"
+
+namespace hw3d {
+
+namespace {
+
+// Widens ASCII bytes from `in` to 16-bit units at `out` for as long as whole
+// vectors are pure ASCII. Returns the number of bytes converted. `count` is
+// the number of bytes that may be read and units that may be written.
+template <typename Unit>
+std::size_t WidenAscii(const char* in, Unit* out, std::size_t count) noexcept {
+  static_assert(sizeof(Unit) == 2, "UTF-16 output expects 16-bit units");
+  std::size_t i = 0;
+#if defined(HW3D_SIMD_AVX2)
+  for (; i + 32 <= count; i += 32) {
+    const __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    const auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(bytes));
+    if (mask != 0) {
+      // widen an all-ASCII low half from this load, then hand the rest to the
+      // caller's scalar loop instead of reloading it in the SSE2 loop below
+      if ((mask & 0xFFFF) == 0) {
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i*>(out + i),
+            _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)));
+        i += 16;
+      }
+      return i;
+    }
+    const __m256i lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes));
+    const __m256i hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), lo);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 16), hi);
+  }
+#endif
+#if defined(HW3D_SIMD_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= count; i += 16) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    if (_mm_movemask_epi8(bytes) != 0) {
+      break;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_unpacklo_epi8(bytes, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8),
+                     _mm_unpackhi_epi8(bytes, zero));
+  }
+#elif defined(HW3D_SIMD_NEON)
+  for (; i + 16 <= count; i += 16) {
+    const uint8x16_t bytes =
+        vld1q_u8(reinterpret_cast<const std::uint8_t*>(in + i));
+    if (vmaxvq_u8(bytes) >= 0x80) {
+      break;
+    }
+    vst1q_u16(reinterpret_cast<std::uint16_t*>(out + i),
+              vmovl_u8(vget_low_u8(bytes)));
+    vst1q_u16(reinterpret_cast<std::uint16_t*>(out + i + 8),
+              vmovl_u8(vget_high_u8(bytes)));
+  }
+#endif
+  return i;
+}
+
+// Narrows 16-bit units below 0x80 to bytes, a vector at a time.
+template <typename Unit>
+std::size_t NarrowAscii(const Unit* in, char* out, std::size_t count) noexcept {
+  static_assert(sizeof(Unit) == 2, "UTF-16 input expects 16-bit units");
+  std::size_t i = 0;
+#if defined(HW3D_SIMD_SSE2)
+  const __m128i high_bits = _mm_set1_epi16(static_cast<short>(0xFF80));
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= count; i += 16) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8));
+    const __m128i any = _mm_and_si128(_mm_or_si128(a, b), high_bits);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(any, zero)) != 0xFFFF) {
+      break;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_packus_epi16(a, b));
+  }
+#elif defined(HW3D_SIMD_NEON)
+  for (; i + 16 <= count; i += 16) {
+    const uint16x8_t a =
+        vld1q_u16(reinterpret_cast<const std::uint16_t*>(in + i));
+    const uint16x8_t b =
+        vld1q_u16(reinterpret_cast<const std::uint16_t*>(in + i + 8));
+    if (vmaxvq_u16(vorrq_u16(a, b)) >= 0x80) {
+      break;
+    }
+    vst1q_u8(reinterpret_cast<std::uint8_t*>(out + i),
+             vcombine_u8(vmovn_u16(a), vmovn_u16(b)));
+  }
+#endif
+  return i;
+}
+
+inline bool IsContinuation(std::uint8_t byte) noexcept {
+  return (byte & 0xC0) == 0x80;
+}
+
+constexpr std::uint32_t kReplacementCharacter = 0xFFFD;
+
+// Range of the byte after lead byte `b0`. It is narrower than 80..BF where
+// the full range would allow overlong forms, surrogates or values above
+// U+10FFFF.
+inline bool IsValidSecond(std::uint8_t b0, std::uint8_t b1) noexcept {
+  switch (b0) {
+    case 0xE0:
+      return b1 >= 0xA0 && b1 <= 0xBF;
+    case 0xED:
+      return b1 >= 0x80 && b1 <= 0x9F;
+    case 0xF0:
+      return b1 >= 0x90 && b1 <= 0xBF;
+    case 0xF4:
+      return b1 >= 0x80 && b1 <= 0x8F;
+    default:
+      return IsContinuation(b1);
+  }
+}
+
+// Sequence length announced by lead byte `b0`; 0 for bytes that cannot lead
+// (continuations, the overlong C0/C1 and F5..FF).
+inline std::size_t SequenceLength(std::uint8_t b0) noexcept {
+  if (b0 < 0xC2) {
+    return 0;
+  }
+  if (b0 < 0xE0) {
+    return 2;
+  }
+  if (b0 < 0xF0) {
+    return 3;
+  }
+  return b0 < 0xF5 ? 4 : 0;
+}
+
+// Decodes the multi-byte sequence at `bytes` (at most `n` bytes available).
+// Returns its length, or 0 if it is invalid or truncated.
+inline std::size_t DecodeSequence(const std::uint8_t* bytes,
+                                  std::size_t n,
+                                  std::uint32_t* cp) noexcept {
+  const std::uint8_t b0 = bytes[0];
+  const std::size_t length = SequenceLength(b0);
+  if (length == 0 || n < length || !IsValidSecond(b0, bytes[1])) {
+    return 0;
+  }
+  for (std::size_t k = 2; k < length; k++) {
+    if (!IsContinuation(bytes[k])) {
+      return 0;
+    }
+  }
+  switch (length) {
+    case 2:
+      *cp = (std::uint32_t(b0 & 0x1F) << 6) | (bytes[1] & 0x3F);
+      break;
+    case 3:
+      *cp = (std::uint32_t(b0 & 0x0F) << 12) |
+            (std::uint32_t(bytes[1] & 0x3F) << 6) | (bytes[2] & 0x3F);
+      break;
+    default:
+      *cp = (std::uint32_t(b0 & 0x07) << 18) |
+            (std::uint32_t(bytes[1] & 0x3F) << 12) |
+            (std::uint32_t(bytes[2] & 0x3F) << 6) | (bytes[3] & 0x3F);
+      break;
+  }
+  return length;
+}
+
+// Bytes one U+FFFD replaces at an invalid sequence: the longest prefix that
+// could still have started a valid sequence, and at least one byte. This is
+// the Unicode "maximal subpart" practice, which MultiByteToWideChar follows.
+inline std::size_t MaximalSubpart(const std::uint8_t* bytes,
+                                  std::size_t n) noexcept {
+  const std::size_t length = SequenceLength(bytes[0]);
+  if (length == 0 || n < 2 || !IsValidSecond(bytes[0], bytes[1])) {
+    return 1;
+  }
+  std::size_t k = 2;
+  while (k < length && k < n && IsContinuation(bytes[k])) {
+    k++;
+  }
+  return k;
+}
+
+template <typename Unit>
+UtfResult Utf8ToUtf16Impl(std::string_view in,
+                          Unit* out,
+                          std::size_t capacity,
+                          UtfErrors errors) noexcept {
+  const auto* bytes = reinterpret_cast<const std::uint8_t*>(in.data());
+  const std::size_t n = in.size();
+  // with a worst-case sized buffer the per-character capacity checks go away
+  const bool unchecked = capacity >= Utf16LengthBound(n);
+  std::size_t i = 0;
+  std::size_t o = 0;
+
+  while (i < n) {
+    if (bytes[i] < 0x80) {
+      const std::size_t room = unchecked ? n - i : capacity - o;
+      const std::size_t span = n - i < room ? n - i : room;
+      const std::size_t widened = WidenAscii(in.data() + i, out + o, span);
+      i += widened;
+      o += widened;
+      // finish the ASCII run that did not fill a whole vector
+      while (i < n && bytes[i] < 0x80) {
+        if (!unchecked && o == capacity) {
+          return {UtfStatus::kOutputTooSmall, i, o};
+        }
+        out[o++] = static_cast<Unit>(bytes[i++]);
+      }
+      continue;
+    }
+
+    std::uint32_t cp;
+    std::size_t length = DecodeSequence(bytes + i, n - i, &cp);
+    if (length == 0) {
+      if (errors == UtfErrors::kReject) {
+        return {UtfStatus::kInvalidInput, i, o};
+      }
+      cp = kReplacementCharacter;
+      length = MaximalSubpart(bytes + i, n - i);
+    }
+
+    if (cp < 0x10000) {
+      if (!unchecked && o == capacity) {
+        return {UtfStatus::kOutputTooSmall, i, o};
+      }
+      out[o++] = static_cast<Unit>(cp);
+    } else {
+      if (!unchecked && capacity - o < 2) {
+        return {UtfStatus::kOutputTooSmall, i, o};
+      }
+      cp -= 0x10000;
+      out[o++] = static_cast<Unit>(0xD800 + (cp >> 10));
+      out[o++] = static_cast<Unit>(0xDC00 + (cp & 0x3FF));
+    }
+    i += length;
+  }
+  return {UtfStatus::kOk, i, o};
+}
+
+template <typename Unit>
+UtfResult Utf16ToUtf8Impl(std::basic_string_view<Unit> in,
+                          char* out,
+                          std::size_t capacity) noexcept {
+  const std::size_t n = in.size();
+  const bool unchecked = capacity >= Utf8LengthBound(n);
+  std::size_t i = 0;
+  std::size_t o = 0;
+
+  while (i < n) {
+    const auto u = static_cast<std::uint32_t>(in[i]);
+    if (u < 0x80) {
+      const std::size_t room = unchecked ? n - i : capacity - o;
+      const std::size_t span = n - i < room ? n - i : room;
+      const std::size_t narrowed = NarrowAscii(in.data() + i, out + o, span);
+      i += narrowed;
+      o += narrowed;
+      while (i < n && static_cast<std::uint32_t>(in[i]) < 0x80) {
+        if (!unchecked && o == capacity) {
+          return {UtfStatus::kOutputTooSmall, i, o};
+        }
+        out[o++] = static_cast<char>(in[i++]);
+      }
+      continue;
+    }
+
+    std::uint32_t cp = u;
+    std::size_t length = 1;
+    std::size_t bytes_out;
+    if (u < 0x800) {
+      bytes_out = 2;
+    } else if (u >= 0xD800 && u <= 0xDBFF) {
+      const std::uint32_t low =
+          i + 1 < n ? static_cast<std::uint32_t>(in[i + 1]) : 0u;
+      if (low < 0xDC00 || low > 0xDFFF) {
+        return {UtfStatus::kInvalidInput, i, o};
+      }
+      cp = 0x10000 + ((u - 0xD800) << 10) + (low - 0xDC00);
+      length = 2;
+      bytes_out = 4;
+    } else if (u >= 0xDC00 && u <= 0xDFFF) {
+      // low surrogate without a preceding high surrogate
+      return {UtfStatus::kInvalidInput, i, o};
+    } else {
+      bytes_out = 3;
+    }
+
+    if (!unchecked && capacity - o < bytes_out) {
+      return {UtfStatus::kOutputTooSmall, i, o};
+    }
+    switch (bytes_out) {
+      case 2:
+        out[o++] = static_cast<char>(0xC0 | (cp >> 6));
+        out[o++] = static_cast<char>(0x80 | (cp & 0x3F));
+        break;
+      case 3:
+        out[o++] = static_cast<char>(0xE0 | (cp >> 12));
+        out[o++] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out[o++] = static_cast<char>(0x80 | (cp & 0x3F));
+        break;
+      default:
+        out[o++] = static_cast<char>(0xF0 | (cp >> 18));
+        out[o++] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out[o++] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out[o++] = static_cast<char>(0x80 | (cp & 0x3F));
+        break;
+    }
+    i += length;
+  }
+  return {UtfStatus::kOk, i, o};
+}
+
+[[noreturn]] void ThrowInvalid(const char* what, std::size_t offset) {
+  throw std::runtime_error(std::string(what) + " at offset " +
+                           std::to_string(offset));
+}
+
+}  // namespace
+
+UtfResult Utf8ToUtf16(std::string_view in,
+                      char16_t* out,
+                      std::size_t capacity,
+                      UtfErrors errors) noexcept {
+  return Utf8ToUtf16Impl(in, out, capacity, errors);
+}
+
+UtfResult Utf16ToUtf8(std::u16string_view in,
+                      char* out,
+                      std::size_t capacity) noexcept {
+  return Utf16ToUtf8Impl(in, out, capacity);
+}
+
+#if defined(_WIN32)
+UtfResult Utf8ToUtf16(std::string_view in,
+                      wchar_t* out,
+                      std::size_t capacity,
+                      UtfErrors errors) noexcept {
+  return Utf8ToUtf16Impl(in, out, capacity, errors);
+}
+
+UtfResult Utf16ToUtf8(std::wstring_view in,
+                      char* out,
+                      std::size_t capacity) noexcept {
+  return Utf16ToUtf8Impl(in, out, capacity);
+}
+#endif
+
+std::u16string Utf8ToUtf16(std::string_view in) {
+  std::u16string out(Utf16LengthBound(in.size()), u'\0');
+  const UtfResult result =
+      Utf8ToUtf16Impl(in, &out[0], out.size(), UtfErrors::kReject);
+  if (!result.ok()) {
+    ThrowInvalid("invalid UTF-8", result.read);
+  }
+  out.resize(result.written);
+  return out;
+}
+
+std::string Utf16ToUtf8(std::u16string_view in) {
+  std::string out(Utf8LengthBound(in.size()), '\0');
+  const UtfResult result = Utf16ToUtf8Impl(in, &out[0], out.size());
+  if (!result.ok()) {
+    ThrowInvalid("invalid UTF-16", result.read);
+  }
+  out.resize(result.written);
+  return out;
+}
+
+}  // namespace hw3d
@@ -0,0 +1,75 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace hw3d {
+
+// Validating UTF-8 <-> UTF-16 transcoding. Runs of ASCII are widened or
+// narrowed 16 (SSE2/NEON) or 32 (AVX2) bytes at a time; everything else goes
+// through a scalar decoder that rejects overlong forms, surrogate code points
+// encoded in UTF-8, values above U+10FFFF, truncated sequences and unpaired
+// surrogates.
+
+enum class UtfStatus {
+  kOk,
+  kInvalidInput,
+  kOutputTooSmall,
+};
+
+// What the UTF-8 decoder does with an invalid or truncated sequence: stop
+// with kInvalidInput, or write U+FFFD for it and carry on (one replacement
+// per maximal subpart, as MultiByteToWideChar does without
+// MB_ERR_INVALID_CHARS).
+enum class UtfErrors {
+  kReject,
+  kReplace,
+};
+
+struct UtfResult {
+  UtfStatus status;
+  // input code units consumed; on kInvalidInput, offset of the bad sequence
+  std::size_t read;
+  // output code units written
+  std::size_t written;
+
+  bool ok() const noexcept { return status == UtfStatus::kOk; }
+};
+
+// Output sizes that always suffice, so a single pass never has to re-measure.
+// Every UTF-8 byte yields at most one UTF-16 unit; every UTF-16 unit yields at
+// most three UTF-8 bytes.
+constexpr std::size_t Utf16LengthBound(std::size_t utf8_length) noexcept {
+  return utf8_length;
+}
+constexpr std::size_t Utf8LengthBound(std::size_t utf16_length) noexcept {
+  return utf16_length * 3;
+}
+
+// Buffer overloads: never allocate and never write past `capacity`. Output is
+// not null-terminated. Replacing keeps Utf16LengthBound() a sufficient size.
+UtfResult Utf8ToUtf16(std::string_view in,
+                      char16_t* out,
+                      std::size_t capacity,
+                      UtfErrors errors = UtfErrors::kReject) noexcept;
+UtfResult Utf16ToUtf8(std::u16string_view in,
+                      char* out,
+                      std::size_t capacity) noexcept;
+
+#if defined(_WIN32)
+// wchar_t is UTF-16 on Windows
+UtfResult Utf8ToUtf16(std::string_view in,
+                      wchar_t* out,
+                      std::size_t capacity,
+                      UtfErrors errors = UtfErrors::kReject) noexcept;
+UtfResult Utf16ToUtf8(std::wstring_view in,
+                      char* out,
+                      std::size_t capacity) noexcept;
+#endif
+
+// Allocating convenience overloads. Throw std::runtime_error on invalid input.
+std::u16string Utf8ToUtf16(std::string_view in);
+std::string Utf16ToUtf8(std::u16string_view in);
+
+}  // namespace hw3d
@@ -0,0 +1,787 @@
+﻿#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#include "simd_config.h"
+
+// Vectors, matrices and quaternions for hw3d.
+//
+// Float2/Float3/Float4/Float4x4 are plain storage with constexpr helpers,
+// for members, arrays and anything written to the GPU. Vec4, Mat4 and Quat
+// live in SIMD registers (SSE, NEON, or four floats when neither is
+// available or HW3D_MATH_SCALAR is defined) and carry the arithmetic.
+//
+// Conventions match DirectXMath and the usual D3D11 setup: row vectors,
+// so a point is transformed as p * M and M = A * B applies A first; the
+// translation sits in the last row; rotations and projections are
+// left-handed with depth in [0, 1]. HLSL packs cbuffer matrices column-major
+// by default, so upload ToConstantBuffer(m) (the transpose) and the shader
+// keeps the CPU order: mul(float4(p, 1), m).
+
+#if !defined(HW3D_MATH_SCALAR)
+#if defined(HW3D_SIMD_SSE2)
+#define HW3D_MATH_SSE 1
+#elif defined(HW3D_SIMD_NEON)
+#define HW3D_MATH_NEON 1
+#endif
+#endif
+
+// fused multiply-add: AArch64 always, x86 when the compiler may use FMA3
+#if defined(HW3D_MATH_NEON) ||                    \
+    (defined(HW3D_MATH_SSE) && (defined(__FMA__) || \
+                                (defined(_MSC_VER) && defined(__AVX2__))))
+#define HW3D_MATH_FMA 1
+#endif
+
+// The small functions are forced inline: without SIMD, or in unoptimized
+// builds, a call per vector operation costs more than the operation.
+#if defined(_MSC_VER)
+#define HW3D_MATH_INLINE __forceinline
+#else
+#define HW3D_MATH_INLINE inline __attribute__((always_inline))
+#endif
+
+namespace hw3d {
+
+constexpr float kPi = 3.14159265358979323846f;
+
+constexpr float ToRadians(float degrees) noexcept {
+  return degrees * (kPi / 180.0f);
+}
+
+// ---------------------------------------------------------------------------
+// Storage types
+
+struct Float2 {
+  float x = 0.0f;
+  float y = 0.0f;
+};
+
+struct Float3 {
+  float x = 0.0f;
+  float y = 0.0f;
+  float z = 0.0f;
+};
+
+struct Float4 {
+  float x = 0.0f;
+  float y = 0.0f;
+  float z = 0.0f;
+  float w = 0.0f;
+};
+
+// Row-major: m[row][column].
+struct Float4x4 {
+  float m[4][4] = {};
+};
+
+constexpr Float3 operator+(Float3 a, Float3 b) noexcept {
+  return {a.x + b.x, a.y + b.y, a.z + b.z};
+}
+constexpr Float3 operator-(Float3 a, Float3 b) noexcept {
+  return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+constexpr Float3 operator-(Float3 a) noexcept {
+  return {-a.x, -a.y, -a.z};
+}
+constexpr Float3 operator*(Float3 a, float s) noexcept {
+  return {a.x * s, a.y * s, a.z * s};
+}
+constexpr Float3 operator*(float s, Float3 a) noexcept {
+  return a * s;
+}
+constexpr float Dot(Float3 a, Float3 b) noexcept {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+constexpr Float3 Cross(Float3 a, Float3 b) noexcept {
+  return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+          a.x * b.y - a.y * b.x};
+}
+
+constexpr Float4x4 Float4x4Identity() noexcept {
+  Float4x4 r;
+  for (int i = 0; i < 4; i++) {
+    r.m[i][i] = 1.0f;
+  }
+  return r;
+}
+
+constexpr Float4x4 Multiply(const Float4x4& a, const Float4x4& b) noexcept {
+  Float4x4 r;
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      float sum = 0.0f;
+      for (int k = 0; k < 4; k++) {
+        sum += a.m[i][k] * b.m[k][j];
+      }
+      r.m[i][j] = sum;
+    }
+  }
+  return r;
+}
+
+constexpr Float4x4 Transpose(const Float4x4& a) noexcept {
+  Float4x4 r;
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      r.m[i][j] = a.m[j][i];
+    }
+  }
+  return r;
+}
+
+constexpr Float4x4 Float4x4Translation(float x, float y, float z) noexcept {
+  Float4x4 r = Float4x4Identity();
+  r.m[3][0] = x;
+  r.m[3][1] = y;
+  r.m[3][2] = z;
+  return r;
+}
+
+constexpr Float4x4 Float4x4Scaling(float x, float y, float z) noexcept {
+  Float4x4 r;
+  r.m[0][0] = x;
+  r.m[1][1] = y;
+  r.m[2][2] = z;
+  r.m[3][3] = 1.0f;
+  return r;
+}
+
+constexpr Float3 TransformPoint(Float3 p, const Float4x4& m) noexcept {
+  return {p.x * m.m[0][0] + p.y * m.m[1][0] + p.z * m.m[2][0] + m.m[3][0],
+          p.x * m.m[0][1] + p.y * m.m[1][1] + p.z * m.m[2][1] + m.m[3][1],
+          p.x * m.m[0][2] + p.y * m.m[1][2] + p.z * m.m[2][2] + m.m[3][2]};
+}
+
+// ---------------------------------------------------------------------------
+// SIMD vector
+
+#if defined(HW3D_MATH_SSE)
+using NativeFloat4 = __m128;
+#elif defined(HW3D_MATH_NEON)
+using NativeFloat4 = float32x4_t;
+#else
+struct NativeFloat4 {
+  float f[4];
+};
+#endif
+
+// Four floats in a register. Functions ending in 3 ignore w.
+struct Vec4 {
+  NativeFloat4 v;
+};
+
+namespace math_detail {
+
+// r = (v[I0], v[I1], v[I2], v[I3])
+template <int I0, int I1, int I2, int I3>
+HW3D_MATH_INLINE Vec4 Permute(Vec4 v) noexcept {
+#if defined(HW3D_MATH_SSE)
+  return {_mm_shuffle_ps(v.v, v.v, _MM_SHUFFLE(I3, I2, I1, I0))};
+#elif defined(HW3D_MATH_NEON)
+  float32x4_t r = vdupq_laneq_f32(v.v, I0);
+  r = vcopyq_laneq_f32(r, 1, v.v, I1);
+  r = vcopyq_laneq_f32(r, 2, v.v, I2);
+  return {vcopyq_laneq_f32(r, 3, v.v, I3)};
+#else
+  return {{{v.v.f[I0], v.v.f[I1], v.v.f[I2], v.v.f[I3]}}};
+#endif
+}
+
+HW3D_MATH_INLINE Vec4 LoadFloats(const float* p) noexcept {
+#if defined(HW3D_MATH_SSE)
+  return {_mm_loadu_ps(p)};
+#elif defined(HW3D_MATH_NEON)
+  return {vld1q_f32(p)};
+#else
+  return {{{p[0], p[1], p[2], p[3]}}};
+#endif
+}
+
+HW3D_MATH_INLINE void StoreFloats(float* p, Vec4 v) noexcept {
+#if defined(HW3D_MATH_SSE)
+  _mm_storeu_ps(p, v.v);
+#elif defined(HW3D_MATH_NEON)
+  vst1q_f32(p, v.v);
+#else
+  for (int i = 0; i < 4; i++) {
+    p[i] = v.v.f[i];
+  }
+#endif
+}
+
+}  // namespace math_detail
+
+HW3D_MATH_INLINE Vec4 VecSet(float x, float y, float z, float w) noexcept {
+#if defined(HW3D_MATH_SSE)
+  return {_mm_set_ps(w, z, y, x)};
+#elif defined(HW3D_MATH_NEON)
+  const float f[4] = {x, y, z, w};
+  return {vld1q_f32(f)};
+#else
+  return {{{x, y, z, w}}};
+#endif
+}
+
+HW3D_MATH_INLINE Vec4 VecSplat(float s) noexcept {
+#if defined(HW3D_MATH_SSE)
+  return {_mm_set1_ps(s)};
+#elif defined(HW3D_MATH_NEON)
+  return {vdupq_n_f32(s)};
+#else
+  return {{{s, s, s, s}}};
+#endif
+}
+
+HW3D_MATH_INLINE Vec4 VecZero() noexcept {
+  return VecSplat(0.0f);
+}
+
+HW3D_MATH_INLINE Vec4 Load(const Float4& f) noexcept {
+  return VecSet(f.x, f.y, f.z, f.w);
+}
+
+HW3D_MATH_INLINE Vec4 Load(const Float3& f, float w = 0.0f) noexcept {
+  return VecSet(f.x, f.y, f.z, w);
+}
+
+HW3D_MATH_INLINE void Store(Float4* out, Vec4 v) noexcept {
+  float f[4];
+  math_detail::StoreFloats(f, v);
+  *out = {f[0], f[1], f[2], f[3]};
+}
+
+HW3D_MATH_INLINE float GetX(Vec4 v) noexcept {
+#if defined(HW3D_MATH_SSE)
+  return _mm_cvtss_f32(v.v);
+#elif defined(HW3D_MATH_NEON)
+  return vgetq_lane_f32(v.v, 0);
+#else
+  return v.v.f[0];
+#endif
+}
+HW3D_MATH_INLINE float GetY(Vec4 v) noexcept {
+  return GetX(math_detail::Permute<1, 1, 1, 1>(v));
+}
+HW3D_MATH_INLINE float GetZ(Vec4 v) noexcept {
+  return GetX(math_detail::Permute<2, 2, 2, 2>(v));
+}
+HW3D_MATH_INLINE float GetW(Vec4 v) noexcept {
+  return GetX(math_detail::Permute<3, 3, 3, 3>(v));
+}
+
+HW3D_MATH_INLINE void Store(Float3* out, Vec4 v) noexcept {
+  Float4 f;
+  Store(&f, v);
+  *out = {f.x, f.y, f.z};
+}
+
+HW3D_MATH_INLINE Vec4 SplatX(Vec4 v) noexcept {
+  return math_detail::Permute<0, 0, 0, 0>(v);
+}
+HW3D_MATH_INLINE Vec4 SplatY(Vec4 v) noexcept {
+  return math_detail::Permute<1, 1, 1, 1>(v);
+}
+HW3D_MATH_INLINE Vec4 SplatZ(Vec4 v) noexcept {
+  return math_detail::Permute<2, 2, 2, 2>(v);
+}
+HW3D_MATH_INLINE Vec4 SplatW(Vec4 v) noexcept {
+  return math_detail::Permute<3, 3, 3, 3>(v);
+}
+
+#if defined(HW3D_MATH_SSE)
+#define HW3D_MATH_BINARY(name, sse, neon, scalar)       \
+  HW3D_MATH_INLINE Vec4 name(Vec4 a, Vec4 b) noexcept { \
+    return {sse(a.v, b.v)};                             \
+  }
+#elif defined(HW3D_MATH_NEON)
+#define HW3D_MATH_BINARY(name, sse, neon, scalar)       \
+  HW3D_MATH_INLINE Vec4 name(Vec4 a, Vec4 b) noexcept { \
+    return {neon(a.v, b.v)};                            \
+  }
+#else
+#define HW3D_MATH_BINARY(name, sse, neon, scalar)       \
+  HW3D_MATH_INLINE Vec4 name(Vec4 a, Vec4 b) noexcept { \
+    Vec4 r;                                             \
+    for (int i = 0; i < 4; i++) {                       \
+      r.v.f[i] = scalar(a.v.f[i], b.v.f[i]);            \
+    }                                                   \
+    return r;                                           \
+  }
+#endif
+
+namespace math_detail {
+constexpr float Add(float a, float b) noexcept { return a + b; }
+constexpr float Sub(float a, float b) noexcept { return a - b; }
+constexpr float Mul(float a, float b) noexcept { return a * b; }
+constexpr float Div(float a, float b) noexcept { return a / b; }
+constexpr float Min(float a, float b) noexcept { return b < a ? b : a; }
+constexpr float Max(float a, float b) noexcept { return a < b ? b : a; }
+}  // namespace math_detail
+
+HW3D_MATH_BINARY(operator+, _mm_add_ps, vaddq_f32, math_detail::Add)
+HW3D_MATH_BINARY(operator-, _mm_sub_ps, vsubq_f32, math_detail::Sub)
+HW3D_MATH_BINARY(operator*, _mm_mul_ps, vmulq_f32, math_detail::Mul)
+HW3D_MATH_BINARY(operator/, _mm_div_ps, vdivq_f32, math_detail::Div)
+HW3D_MATH_BINARY(Min, _mm_min_ps, vminq_f32, math_detail::Min)
+HW3D_MATH_BINARY(Max, _mm_max_ps, vmaxq_f32, math_detail::Max)
+
+#undef HW3D_MATH_BINARY
+
+HW3D_MATH_INLINE Vec4 operator*(Vec4 a, float s) noexcept {
+  return a * VecSplat(s);
+}
+HW3D_MATH_INLINE Vec4 operator*(float s, Vec4 a) noexcept {
+  return a * VecSplat(s);
+}
+HW3D_MATH_INLINE Vec4 operator-(Vec4 a) noexcept {
+  return VecZero() - a;
+}
+HW3D_MATH_INLINE Vec4& operator+=(Vec4& a, Vec4 b) noexcept {
+  return a = a + b;
+}
+HW3D_MATH_INLINE Vec4& operator-=(Vec4& a, Vec4 b) noexcept {
+  return a = a - b;
+}
+HW3D_MATH_INLINE Vec4& operator*=(Vec4& a, Vec4 b) noexcept {
+  return a = a * b;
+}
+
+// a * b + c, fused where the target has it.
+HW3D_MATH_INLINE Vec4 MulAdd(Vec4 a, Vec4 b, Vec4 c) noexcept {
+#if defined(HW3D_MATH_SSE) && defined(HW3D_MATH_FMA)
+  return {_mm_fmadd_ps(a.v, b.v, c.v)};
+#elif defined(HW3D_MATH_NEON)
+  return {vfmaq_f32(c.v, a.v, b.v)};
+#else
+  return a * b + c;
+#endif
+}
+
+HW3D_MATH_INLINE Vec4 Sqrt(Vec4 v) noexcept {
+#if defined(HW3D_MATH_SSE)
+  return {_mm_sqrt_ps(v.v)};
+#elif defined(HW3D_MATH_NEON)
+  return {vsqrtq_f32(v.v)};
+#else
+  return {{{std::sqrt(v.v.f[0]), std::sqrt(v.v.f[1]), std::sqrt(v.v.f[2]),
+            std::sqrt(v.v.f[3])}}};
+#endif
+}
+
+HW3D_MATH_INLINE Vec4 Lerp(Vec4 a, Vec4 b, float t) noexcept {
+  return MulAdd(b - a, VecSplat(t), a);
+}
+
+// Dot products with the result in every lane.
+HW3D_MATH_INLINE Vec4 Dot4Splat(Vec4 a, Vec4 b) noexcept {
+  const Vec4 m = a * b;
+  const Vec4 s = m + math_detail::Permute<1, 0, 3, 2>(m);
+  return s + math_detail::Permute<2, 3, 0, 1>(s);
+}
+HW3D_MATH_INLINE Vec4 Dot3Splat(Vec4 a, Vec4 b) noexcept {
+  const Vec4 m = a * b;
+  return SplatX(m) + SplatY(m) + SplatZ(m);
+}
+HW3D_MATH_INLINE float Dot4(Vec4 a, Vec4 b) noexcept {
+  return GetX(Dot4Splat(a, b));
+}
+HW3D_MATH_INLINE float Dot3(Vec4 a, Vec4 b) noexcept {
+  return GetX(Dot3Splat(a, b));
+}
+
+// w of the result is 0.
+HW3D_MATH_INLINE Vec4 Cross3(Vec4 a, Vec4 b) noexcept {
+  const Vec4 a_yzx = math_detail::Permute<1, 2, 0, 3>(a);
+  const Vec4 b_yzx = math_detail::Permute<1, 2, 0, 3>(b);
+  const Vec4 c = a * b_yzx - a_yzx * b;
+  return math_detail::Permute<1, 2, 0, 3>(c);
+}
+
+HW3D_MATH_INLINE float Length3(Vec4 v) noexcept {
+  return GetX(Sqrt(Dot3Splat(v, v)));
+}
+
+// Zero-length vectors come back unchanged.
+HW3D_MATH_INLINE Vec4 Normalize3(Vec4 v) noexcept {
+  const Vec4 length = Sqrt(Dot3Splat(v, v));
+  return GetX(length) > 0.0f ? v / length : v;
+}
+HW3D_MATH_INLINE Vec4 Normalize4(Vec4 v) noexcept {
+  const Vec4 length = Sqrt(Dot4Splat(v, v));
+  return GetX(length) > 0.0f ? v / length : v;
+}
+
+// ---------------------------------------------------------------------------
+// Matrix
+
+// Row-major 4x4 in four registers; see the conventions at the top.
+struct Mat4 {
+  Vec4 r[4];
+};
+
+HW3D_MATH_INLINE Mat4 Load(const Float4x4& f) noexcept {
+  Mat4 m;
+  for (int i = 0; i < 4; i++) {
+    m.r[i] = math_detail::LoadFloats(f.m[i]);
+  }
+  return m;
+}
+
+HW3D_MATH_INLINE void Store(Float4x4* out, const Mat4& m) noexcept {
+  for (int i = 0; i < 4; i++) {
+    math_detail::StoreFloats(out->m[i], m.r[i]);
+  }
+}
+
+HW3D_MATH_INLINE Mat4 MatIdentity() noexcept {
+  return {{VecSet(1, 0, 0, 0), VecSet(0, 1, 0, 0), VecSet(0, 0, 1, 0),
+           VecSet(0, 0, 0, 1)}};
+}
+
+// v * m for a full 4-component v.
+HW3D_MATH_INLINE Vec4 Transform(Vec4 v, const Mat4& m) noexcept {
+  Vec4 r = SplatX(v) * m.r[0];
+  r = MulAdd(SplatY(v), m.r[1], r);
+  r = MulAdd(SplatZ(v), m.r[2], r);
+  return MulAdd(SplatW(v), m.r[3], r);
+}
+
+// (x, y, z, 1) * m; no divide by w.
+HW3D_MATH_INLINE Vec4 TransformPoint(Vec4 p, const Mat4& m) noexcept {
+  Vec4 r = MulAdd(SplatX(p), m.r[0], m.r[3]);
+  r = MulAdd(SplatY(p), m.r[1], r);
+  return MulAdd(SplatZ(p), m.r[2], r);
+}
+
+// (x, y, z, 0) * m: directions ignore the translation.
+HW3D_MATH_INLINE Vec4 TransformVector(Vec4 v, const Mat4& m) noexcept {
+  Vec4 r = SplatX(v) * m.r[0];
+  r = MulAdd(SplatY(v), m.r[1], r);
+  return MulAdd(SplatZ(v), m.r[2], r);
+}
+
+HW3D_MATH_INLINE Mat4 operator*(const Mat4& a, const Mat4& b) noexcept {
+  return {{Transform(a.r[0], b), Transform(a.r[1], b), Transform(a.r[2], b),
+           Transform(a.r[3], b)}};
+}
+
+HW3D_MATH_INLINE Mat4 Transpose(const Mat4& m) noexcept {
+#if defined(HW3D_MATH_SSE)
+  Mat4 t = m;
+  _MM_TRANSPOSE4_PS(t.r[0].v, t.r[1].v, t.r[2].v, t.r[3].v);
+  return t;
+#elif defined(HW3D_MATH_NEON)
+  const float32x4x2_t a = vtrnq_f32(m.r[0].v, m.r[1].v);
+  const float32x4x2_t b = vtrnq_f32(m.r[2].v, m.r[3].v);
+  return {{{vcombine_f32(vget_low_f32(a.val[0]), vget_low_f32(b.val[0]))},
+           {vcombine_f32(vget_low_f32(a.val[1]), vget_low_f32(b.val[1]))},
+           {vcombine_f32(vget_high_f32(a.val[0]), vget_high_f32(b.val[0]))},
+           {vcombine_f32(vget_high_f32(a.val[1]), vget_high_f32(b.val[1]))}}};
+#else
+  Mat4 t;
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      t.r[i].v.f[j] = m.r[j].v.f[i];
+    }
+  }
+  return t;
+#endif
+}
+
+// What to copy into a constant buffer for mul(v, m) in HLSL with the
+// default column-major packing.
+HW3D_MATH_INLINE Float4x4 ToConstantBuffer(const Mat4& m) noexcept {
+  Float4x4 out;
+  Store(&out, Transpose(m));
+  return out;
+}
+
+HW3D_MATH_INLINE Mat4 MatTranslation(float x, float y, float z) noexcept {
+  Mat4 m = MatIdentity();
+  m.r[3] = VecSet(x, y, z, 1.0f);
+  return m;
+}
+
+HW3D_MATH_INLINE Mat4 MatScaling(float x, float y, float z) noexcept {
+  return {{VecSet(x, 0, 0, 0), VecSet(0, y, 0, 0), VecSet(0, 0, z, 0),
+           VecSet(0, 0, 0, 1)}};
+}
+
+// Rotations by `angle` radians, clockwise looking down the axis towards
+// the origin (left-handed).
+HW3D_MATH_INLINE Mat4 MatRotationX(float angle) noexcept {
+  const float s = std::sin(angle);
+  const float c = std::cos(angle);
+  return {{VecSet(1, 0, 0, 0), VecSet(0, c, s, 0), VecSet(0, -s, c, 0),
+           VecSet(0, 0, 0, 1)}};
+}
+
+HW3D_MATH_INLINE Mat4 MatRotationY(float angle) noexcept {
+  const float s = std::sin(angle);
+  const float c = std::cos(angle);
+  return {{VecSet(c, 0, -s, 0), VecSet(0, 1, 0, 0), VecSet(s, 0, c, 0),
+           VecSet(0, 0, 0, 1)}};
+}
+
+HW3D_MATH_INLINE Mat4 MatRotationZ(float angle) noexcept {
+  const float s = std::sin(angle);
+  const float c = std::cos(angle);
+  return {{VecSet(c, s, 0, 0), VecSet(-s, c, 0, 0), VecSet(0, 0, 1, 0),
+           VecSet(0, 0, 0, 1)}};
+}
+
+// Left-handed perspective projection, depth mapped to [0, 1].
+inline Mat4 MatPerspectiveFovLH(float fov_y,
+                                float aspect,
+                                float near_z,
+                                float far_z) noexcept {
+  const float h = 1.0f / std::tan(fov_y * 0.5f);
+  const float w = h / aspect;
+  const float range = far_z / (far_z - near_z);
+  return {{VecSet(w, 0, 0, 0), VecSet(0, h, 0, 0), VecSet(0, 0, range, 1),
+           VecSet(0, 0, -range * near_z, 0)}};
+}
+
+// Left-handed view matrix looking from `eye` at `target`.
+inline Mat4 MatLookAtLH(Vec4 eye, Vec4 target, Vec4 up) noexcept {
+  const Vec4 z = Normalize3(target - eye);
+  const Vec4 x = Normalize3(Cross3(up, z));
+  const Vec4 y = Cross3(z, x);
+  const Vec4 neg_eye = -eye;
+  Mat4 m = {{x, y, z, VecSet(0, 0, 0, 1)}};
+  m = Transpose(m);
+  m.r[3] = VecSet(Dot3(x, neg_eye), Dot3(y, neg_eye), Dot3(z, neg_eye), 1.0f);
+  return m;
+}
+
+// General inverse by cofactors. A singular matrix gives non-finite values.
+inline Mat4 Inverse(const Mat4& m) noexcept {
+  Float4x4 f;
+  Store(&f, m);
+  const float(*a)[4] = f.m;
+  const float s0 = a[0][0] * a[1][1] - a[1][0] * a[0][1];
+  const float s1 = a[0][0] * a[1][2] - a[1][0] * a[0][2];
+  const float s2 = a[0][0] * a[1][3] - a[1][0] * a[0][3];
+  const float s3 = a[0][1] * a[1][2] - a[1][1] * a[0][2];
+  const float s4 = a[0][1] * a[1][3] - a[1][1] * a[0][3];
+  const float s5 = a[0][2] * a[1][3] - a[1][2] * a[0][3];
+  const float c5 = a[2][2] * a[3][3] - a[3][2] * a[2][3];
+  const float c4 = a[2][1] * a[3][3] - a[3][1] * a[2][3];
+  const float c3 = a[2][1] * a[3][2] - a[3][1] * a[2][2];
+  const float c2 = a[2][0] * a[3][3] - a[3][0] * a[2][3];
+  const float c1 = a[2][0] * a[3][2] - a[3][0] * a[2][2];
+  const float c0 = a[2][0] * a[3][1] - a[3][0] * a[2][1];
+  const float inv_det =
+      1.0f / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+  Float4x4 r;
+  r.m[0][0] = (a[1][1] * c5 - a[1][2] * c4 + a[1][3] * c3) * inv_det;
+  r.m[0][1] = (-a[0][1] * c5 + a[0][2] * c4 - a[0][3] * c3) * inv_det;
+  r.m[0][2] = (a[3][1] * s5 - a[3][2] * s4 + a[3][3] * s3) * inv_det;
+  r.m[0][3] = (-a[2][1] * s5 + a[2][2] * s4 - a[2][3] * s3) * inv_det;
+  r.m[1][0] = (-a[1][0] * c5 + a[1][2] * c2 - a[1][3] * c1) * inv_det;
+  r.m[1][1] = (a[0][0] * c5 - a[0][2] * c2 + a[0][3] * c1) * inv_det;
+  r.m[1][2] = (-a[3][0] * s5 + a[3][2] * s2 - a[3][3] * s1) * inv_det;
+  r.m[1][3] = (a[2][0] * s5 - a[2][2] * s2 + a[2][3] * s1) * inv_det;
+  r.m[2][0] = (a[1][0] * c4 - a[1][1] * c2 + a[1][3] * c0) * inv_det;
+  r.m[2][1] = (-a[0][0] * c4 + a[0][1] * c2 - a[0][3] * c0) * inv_det;
+  r.m[2][2] = (a[3][0] * s4 - a[3][1] * s2 + a[3][3] * s0) * inv_det;
+  r.m[2][3] = (-a[2][0] * s4 + a[2][1] * s2 - a[2][3] * s0) * inv_det;
+  r.m[3][0] = (-a[1][0] * c3 + a[1][1] * c1 - a[1][2] * c0) * inv_det;
+  r.m[3][1] = (a[0][0] * c3 - a[0][1] * c1 + a[0][2] * c0) * inv_det;
+  r.m[3][2] = (-a[3][0] * s3 + a[3][1] * s1 - a[3][2] * s0) * inv_det;
+  r.m[3][3] = (a[2][0] * s3 - a[2][1] * s1 + a[2][2] * s0) * inv_det;
+  return Load(r);
+}
+
+// ---------------------------------------------------------------------------
+// Quaternion
+
+// Unit quaternion (x, y, z, w) for rotations. a * b rotates by a, then b,
+// the same order as matrices.
+struct Quat {
+  Vec4 v;
+};
+
+HW3D_MATH_INLINE Quat QuatIdentity() noexcept {
+  return {VecSet(0, 0, 0, 1)};
+}
+
+// `axis` must be normalized.
+HW3D_MATH_INLINE Quat QuatFromAxisAngle(Vec4 axis, float angle) noexcept {
+  const float s = std::sin(angle * 0.5f);
+  const float c = std::cos(angle * 0.5f);
+  const Vec4 xyz = axis * s;
+  return {VecSet(GetX(xyz), GetY(xyz), GetZ(xyz), c)};
+}
+
+HW3D_MATH_INLINE Quat operator*(Quat a, Quat b) noexcept {
+  // Hamilton product b * a, so that a is applied first
+  const Vec4 aw = SplatW(a.v);
+  const Vec4 bw = SplatW(b.v);
+  Vec4 r = MulAdd(aw, b.v, bw * a.v) + Cross3(b.v, a.v);
+  const float w = GetW(a.v) * GetW(b.v) - Dot3(a.v, b.v);
+  Float4 f;
+  Store(&f, r);
+  f.w = w;
+  return {Load(f)};
+}
+
+HW3D_MATH_INLINE Quat Conjugate(Quat q) noexcept {
+  return {q.v * VecSet(-1.0f, -1.0f, -1.0f, 1.0f)};
+}
+
+HW3D_MATH_INLINE Quat Normalize(Quat q) noexcept {
+  return {Normalize4(q.v)};
+}
+
+// Rotates the xyz of `v`; w of the result is 0.
+HW3D_MATH_INLINE Vec4 Rotate(Vec4 v, Quat q) noexcept {
+  const Vec4 t = Cross3(q.v, v) * 2.0f;
+  const Vec4 r = MulAdd(SplatW(q.v), t, v) + Cross3(q.v, t);
+  return r * VecSet(1.0f, 1.0f, 1.0f, 0.0f);
+}
+
+// Shortest-path spherical interpolation; falls back to a normalized lerp
+// when the rotations are nearly equal.
+inline Quat Slerp(Quat a, Quat b, float t) noexcept {
+  float cos_theta = Dot4(a.v, b.v);
+  Vec4 end = b.v;
+  if (cos_theta < 0.0f) {
+    cos_theta = -cos_theta;
+    end = -end;
+  }
+  if (cos_theta > 0.9995f) {
+    return {Normalize4(Lerp(a.v, end, t))};
+  }
+  const float theta = std::acos(cos_theta);
+  const float inv_sin = 1.0f / std::sin(theta);
+  const float wa = std::sin((1.0f - t) * theta) * inv_sin;
+  const float wb = std::sin(t * theta) * inv_sin;
+  return {MulAdd(a.v, VecSplat(wa), end * wb)};
+}
+
+HW3D_MATH_INLINE Mat4 MatRotationQuat(Quat q) noexcept {
+  Float4 f;
+  Store(&f, q.v);
+  const float xx = f.x * f.x, yy = f.y * f.y, zz = f.z * f.z;
+  const float xy = f.x * f.y, xz = f.x * f.z, yz = f.y * f.z;
+  const float wx = f.w * f.x, wy = f.w * f.y, wz = f.w * f.z;
+  return {{VecSet(1 - 2 * (yy + zz), 2 * (xy + wz), 2 * (xz - wy), 0),
+           VecSet(2 * (xy - wz), 1 - 2 * (xx + zz), 2 * (yz + wx), 0),
+           VecSet(2 * (xz + wy), 2 * (yz - wx), 1 - 2 * (xx + yy), 0),
+           VecSet(0, 0, 0, 1)}};
+}
+
+// Scale, then rotate, then translate.
+inline Mat4 MatAffine(Vec4 scale, Quat rotation, Vec4 translation) noexcept {
+  Mat4 m = MatRotationQuat(rotation);
+  m.r[0] = m.r[0] * SplatX(scale);
+  m.r[1] = m.r[1] * SplatY(scale);
+  m.r[2] = m.r[2] * SplatZ(scale);
+  m.r[3] = VecSet(GetX(translation), GetY(translation), GetZ(translation),
+                  1.0f);
+  return m;
+}
+
+// ---------------------------------------------------------------------------
+// Batches
+
+// out[i] = in[i] * m as points. `in` and `out` may be the same array.
+inline void TransformPoints(const Mat4& m,
+                            const Float3* in,
+                            Float3* out,
+                            std::size_t n) noexcept {
+  for (std::size_t i = 0; i < n; i++) {
+    const Vec4 p = TransformPoint(Load(in[i]), m);
+    Store(&out[i], p);
+  }
+}
+
+// As above, keeping w for a projection.
+inline void TransformPoints(const Mat4& m,
+                            const Float3* in,
+                            Float4* out,
+                            std::size_t n) noexcept {
+  for (std::size_t i = 0; i < n; i++) {
+    Store(&out[i], TransformPoint(Load(in[i]), m));
+  }
+}
+
+// Points stored as separate x, y and z arrays, eight (AVX2) or four at a
+// time. Outputs may alias the matching inputs.
+inline void TransformPointsSoA(const Mat4& m,
+                               const float* x,
+                               const float* y,
+                               const float* z,
+                               float* out_x,
+                               float* out_y,
+                               float* out_z,
+                               std::size_t n) noexcept {
+  Float4x4 f;
+  Store(&f, m);
+  const auto& a = f.m;
+  std::size_t i = 0;
+#if defined(HW3D_MATH_SSE) && defined(HW3D_SIMD_AVX2)
+  for (const std::size_t n8 = n & ~std::size_t{7}; i < n8; i += 8) {
+    const __m256 px = _mm256_loadu_ps(x + i);
+    const __m256 py = _mm256_loadu_ps(y + i);
+    const __m256 pz = _mm256_loadu_ps(z + i);
+    __m256 r[3];
+    for (int c = 0; c < 3; c++) {
+#if defined(HW3D_MATH_FMA)
+      __m256 v = _mm256_fmadd_ps(px, _mm256_set1_ps(a[0][c]),
+                                 _mm256_set1_ps(a[3][c]));
+      v = _mm256_fmadd_ps(py, _mm256_set1_ps(a[1][c]), v);
+      r[c] = _mm256_fmadd_ps(pz, _mm256_set1_ps(a[2][c]), v);
+#else
+      __m256 v = _mm256_add_ps(_mm256_mul_ps(px, _mm256_set1_ps(a[0][c])),
+                               _mm256_set1_ps(a[3][c]));
+      v = _mm256_add_ps(_mm256_mul_ps(py, _mm256_set1_ps(a[1][c])), v);
+      r[c] = _mm256_add_ps(_mm256_mul_ps(pz, _mm256_set1_ps(a[2][c])), v);
+#endif
+    }
+    _mm256_storeu_ps(out_x + i, r[0]);
+    _mm256_storeu_ps(out_y + i, r[1]);
+    _mm256_storeu_ps(out_z + i, r[2]);
+  }
+#endif
+#if defined(HW3D_MATH_SSE) || defined(HW3D_MATH_NEON)
+  for (const std::size_t n4 = n & ~std::size_t{3}; i < n4; i += 4) {
+    const Vec4 px = math_detail::LoadFloats(x + i);
+    const Vec4 py = math_detail::LoadFloats(y + i);
+    const Vec4 pz = math_detail::LoadFloats(z + i);
+    Vec4 r[3];
+    for (int c = 0; c < 3; c++) {
+      Vec4 v = MulAdd(px, VecSplat(a[0][c]), VecSplat(a[3][c]));
+      v = MulAdd(py, VecSplat(a[1][c]), v);
+      r[c] = MulAdd(pz, VecSplat(a[2][c]), v);
+    }
+    math_detail::StoreFloats(out_x + i, r[0]);
+    math_detail::StoreFloats(out_y + i, r[1]);
+    math_detail::StoreFloats(out_z + i, r[2]);
+  }
+#endif
+  for (; i < n; i++) {
+    const float px = x[i];
+    const float py = y[i];
+    const float pz = z[i];
+    out_x[i] = px * a[0][0] + py * a[1][0] + pz * a[2][0] + a[3][0];
+    out_y[i] = px * a[0][1] + py * a[1][1] + pz * a[2][1] + a[3][1];
+    out_z[i] = px * a[0][2] + py * a[1][2] + pz * a[2][2] + a[3][2];
+  }
+}
+
+// out[i] = a[i] * b, e.g. local-to-world for many objects sharing a parent.
+// `out` may alias `a`.
+inline void MultiplyMatrices(const Mat4* a,
+                             const Mat4& b,
+                             Mat4* out,
+                             std::size_t n) noexcept {
+  for (std::size_t i = 0; i < n; i++) {
+    out[i] = a[i] * b;
+  }
+}
+
+}  // namespace hw3d
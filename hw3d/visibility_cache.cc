@@ -0,0 +1,333 @@
+﻿#include "visibility_cache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace hw3d {
+
+namespace {
+
+// Morton cells per axis.
+constexpr std::uint32_t kMortonCells = 1024;
+
+// Radix sort digits: three passes cover a 30-bit Morton code.
+constexpr int kRadixBits = 10;
+constexpr std::size_t kRadix = std::size_t{1} << kRadixBits;
+
+// Slack is cut by this fraction of the magnitudes in the plane test, so
+// that rounding in CullAabbs() cannot put a box on the other side of a
+// plane from its cluster.
+constexpr float kTolerance = 1e-5f;
+
+constexpr float kInfinity = std::numeric_limits<float>::infinity();
+
+std::uint64_t NowNs() noexcept {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+// Spreads the low 10 bits of v to every third bit.
+std::uint32_t SpreadBits(std::uint32_t v) noexcept {
+  v &= 0x3FF;
+  v = (v | (v << 16)) & 0x030000FF;
+  v = (v | (v << 8)) & 0x0300F00F;
+  v = (v | (v << 4)) & 0x030C30C3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+// Morton cell of `value` on an axis starting at `low`; NaN lands in 0.
+std::uint32_t MortonCell(float value, float low, float scale) noexcept {
+  const float cell = (value - low) * scale;
+  if (!(cell > 0.0f)) {
+    return 0;
+  }
+  return cell < kMortonCells - 1 ? static_cast<std::uint32_t>(cell)
+                                 : kMortonCells - 1;
+}
+
+bool IsFinite(Float3 v) noexcept {
+  return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z);
+}
+
+Float3 Abs(Float3 v) noexcept {
+  return {std::fabs(v.x), std::fabs(v.y), std::fabs(v.z)};
+}
+
+float Length(Float3 v) noexcept {
+  return std::sqrt(Dot(v, v));
+}
+
+Float3 Normal(const Float4& plane) noexcept {
+  return {plane.x, plane.y, plane.z};
+}
+
+// The CullAabbs() test for one box, with its terms in the order of its
+// scalar path so that both give the same answer; NaN fails every
+// comparison, so it stays visible.
+bool Visible(const Frustum& frustum, Float3 c, Float3 e) noexcept {
+  bool outside = false;
+  for (const Float4& p : frustum.planes) {
+    const float v = c.x * p.x + c.y * p.y + c.z * p.z + p.w +
+                    e.x * std::fabs(p.x) + e.y * std::fabs(p.y) +
+                    e.z * std::fabs(p.z);
+    outside |= v < 0.0f;
+  }
+  return !outside;
+}
+
+Float3 CenterOf(const AabbArray& boxes, std::size_t i) noexcept {
+  return {boxes.center_x()[i], boxes.center_y()[i], boxes.center_z()[i]};
+}
+
+Float3 ExtentOf(const AabbArray& boxes, std::size_t i) noexcept {
+  return {boxes.extent_x()[i], boxes.extent_y()[i], boxes.extent_z()[i]};
+}
+
+}  // namespace
+
+VisibilityCache::VisibilityCache(const VisibilityCacheConfig& config)
+    : config_(config) {}
+
+void VisibilityCache::Build(const AabbArray& boxes) {
+  const std::size_t n = boxes.size();
+  if (n > std::numeric_limits<std::uint32_t>::max()) {
+    throw std::length_error("too many boxes for a VisibilityCache");
+  }
+  Aabb bounds;
+  for (std::size_t i = 0; i < n; i++) {
+    const Float3 center = CenterOf(boxes, i);
+    if (IsFinite(center)) {
+      bounds = Union(bounds, center);
+    }
+  }
+  // cubic cells, so that a cluster is about as deep as it is wide
+  const Float3 size = bounds.max - bounds.min;
+  const float length = std::max(size.x, std::max(size.y, size.z));
+  const float scale = length > 0.0f ? kMortonCells / length : 0.0f;
+
+  // Morton code above, index below
+  std::vector<std::uint64_t> keys(n);
+  for (std::size_t i = 0; i < n; i++) {
+    const Float3 c = CenterOf(boxes, i);
+    const std::uint32_t code =
+        SpreadBits(MortonCell(c.x, bounds.min.x, scale)) |
+        SpreadBits(MortonCell(c.y, bounds.min.y, scale)) << 1 |
+        SpreadBits(MortonCell(c.z, bounds.min.z, scale)) << 2;
+    keys[i] = std::uint64_t{code} << 32 | i;
+  }
+  // least significant digit first; every pass is stable
+  std::vector<std::uint64_t> swap(n);
+  for (int shift = 32; shift < 62; shift += kRadixBits) {
+    std::size_t starts[kRadix + 1] = {};
+    for (const std::uint64_t key : keys) {
+      starts[(key >> shift & (kRadix - 1)) + 1]++;
+    }
+    for (std::size_t d = 0; d < kRadix; d++) {
+      starts[d + 1] += starts[d];
+    }
+    for (const std::uint64_t key : keys) {
+      swap[starts[key >> shift & (kRadix - 1)]++] = key;
+    }
+    keys.swap(swap);
+  }
+
+  order_.resize(n);
+  positions_.resize(n);
+  sorted_.Resize(n);
+  scratch_.resize(n);
+  moved_.clear();
+  moved_flags_.assign(n, 0);
+  for (std::size_t i = 0; i < n; i++) {
+    const auto index = static_cast<std::uint32_t>(keys[i]);
+    order_[i] = index;
+    positions_[index] = static_cast<std::uint32_t>(i);
+    sorted_.Set(i, CenterOf(boxes, index), ExtentOf(boxes, index));
+  }
+  clusters_.assign((n + kClusterSize - 1) / kClusterSize, Cluster());
+  for (std::size_t c = 0; c < clusters_.size(); c++) {
+    FitCluster(c);
+  }
+  visible_.reserve(n);
+  built_ = true;
+  has_reference_ = false;
+}
+
+void VisibilityCache::FitCluster(std::size_t c) noexcept {
+  const std::size_t begin = c * kClusterSize;
+  const std::size_t end = std::min(begin + kClusterSize, order_.size());
+  Cluster& cluster = clusters_[c];
+  cluster.box = Aabb();
+  cluster.exact = false;
+  for (std::size_t i = begin; i < end; i++) {
+    const Float3 center = CenterOf(sorted_, i);
+    const Float3 extent = ExtentOf(sorted_, i);
+    cluster.box = Union(cluster.box, Aabb{center - extent, center + extent});
+    cluster.exact |= !IsFinite(center) || !IsFinite(extent);
+  }
+}
+
+void VisibilityCache::Reset(const Frustum& frustum,
+                            Float3 eye,
+                            const AabbArray& boxes) {
+  reference_ = frustum;
+  reference_eye_ = eye;
+  has_reference_ = true;
+  for (const std::uint32_t position : moved_) {
+    const std::uint32_t index = order_[position];
+    sorted_.Set(position, CenterOf(boxes, index), ExtentOf(boxes, index));
+    moved_flags_[position] = 0;
+  }
+  moved_.clear();
+  for (std::size_t c = 0; c < clusters_.size(); c++) {
+    Cluster& cluster = clusters_[c];
+    if (cluster.moved != 0) {
+      FitCluster(c);
+      cluster.moved = 0;
+    }
+    const Float3 center = Center(cluster.box);
+    const Float3 extent = Extent(cluster.box);
+    cluster.reach = Length(center - eye) + Length(extent);
+    cluster.side = Side::kAcross;
+    if (cluster.exact || !(cluster.reach < kInfinity)) {
+      continue;
+    }
+    // A box inside the cluster's box is outside a plane when the cluster
+    // is, and inside all of them when the cluster is.
+    float outside = -kInfinity;
+    float inside = kInfinity;
+    for (const Float4& plane : frustum.planes) {
+      const Float3 n = Normal(plane);
+      const float distance = Dot(n, center) + plane.w;
+      const float radius = Dot(Abs(n), extent);
+      const float tolerance =
+          kTolerance *
+          (Dot(Abs(n), Abs(center)) + std::fabs(plane.w) + radius);
+      outside = std::max(outside, -(distance + radius) - tolerance);
+      inside = std::min(inside, distance - radius - tolerance);
+    }
+    if (outside > 0.0f) {
+      cluster.side = Side::kOutside;
+      cluster.slack = outside;
+    } else if (inside > 0.0f) {
+      cluster.side = Side::kInside;
+      cluster.slack = inside;
+    }
+  }
+}
+
+void VisibilityCache::Cull(const Frustum& frustum,
+                           Float3 eye,
+                           const AabbArray& boxes,
+                           const std::uint32_t* moved,
+                           std::size_t moved_count) {
+  const std::uint64_t start = NowNs();
+  stats_ = Stats();
+  const std::size_t n = boxes.size();
+  if (!built_ || n != order_.size()) {
+    Build(boxes);
+    stats_.rebuilt = true;
+  } else {
+    for (std::size_t m = 0; m < moved_count; m++) {
+      const std::uint32_t index = moved[m];
+      assert(index < n);
+      const std::uint32_t position = positions_[index];
+      if (moved_flags_[position] == 0) {
+        moved_flags_[position] = 1;
+        moved_.push_back(position);
+        clusters_[position / kClusterSize].moved++;
+      }
+    }
+  }
+
+  // How far the planes can have moved since the reference, as a function
+  // of the distance from the reference eye.
+  float turn = 0.0f;
+  float shift = 0.0f;
+  for (int k = 0; k < Frustum::kSideCount && has_reference_; k++) {
+    const Float4& now = frustum.planes[k];
+    const Float4& then = reference_.planes[k];
+    const Float3 dn = Normal(now) - Normal(then);
+    turn = std::max(turn, Length(dn));
+    shift = std::max(shift,
+                     std::fabs(Dot(dn, reference_eye_) + now.w - then.w));
+  }
+  const auto needs_test = [&](const Cluster& cluster) {
+    return cluster.side == Side::kAcross ||
+           !(cluster.slack > turn * cluster.reach + shift);
+  };
+  bool reset = !has_reference_ || !(turn <= config_.max_turn);
+  if (!reset) {
+    std::size_t tested = moved_.size();
+    for (const Cluster& cluster : clusters_) {
+      tested += needs_test(cluster) ? kClusterSize : 0;
+    }
+    reset = tested > config_.max_retest_fraction * n;
+  }
+  if (reset) {
+    Reset(frustum, eye, boxes);
+    turn = 0.0f;
+    shift = 0.0f;
+    stats_.reset = true;
+  }
+
+  // Runs of clusters to re-test go to CullAabbs() together. Moved boxes
+  // are left out everywhere and tested last.
+  visible_.clear();
+  std::size_t run = 0;
+  const auto flush = [&](std::size_t end) {
+    const std::size_t count =
+        CullAabbs(frustum, sorted_, run, end, scratch_.data());
+    for (std::size_t j = 0; j < count; j++) {
+      const std::uint32_t position = scratch_[j];
+      if (moved_flags_[position] == 0) {
+        visible_.push_back(order_[position]);
+      }
+    }
+    stats_.tested_boxes += end - run;
+  };
+  for (std::size_t c = 0; c < clusters_.size(); c++) {
+    const Cluster& cluster = clusters_[c];
+    const std::size_t begin = c * kClusterSize;
+    if (needs_test(cluster)) {
+      stats_.tested_clusters++;
+      continue;
+    }
+    if (run < begin) {
+      flush(begin);
+    }
+    run = std::min(begin + kClusterSize, n);
+    if (cluster.side != Side::kInside) {
+      continue;
+    }
+    if (cluster.moved == 0) {
+      visible_.insert(visible_.end(), order_.begin() + begin,
+                      order_.begin() + run);
+      continue;
+    }
+    for (std::size_t i = begin; i < run; i++) {
+      if (moved_flags_[i] == 0) {
+        visible_.push_back(order_[i]);
+      }
+    }
+  }
+  if (run < n) {
+    flush(n);
+  }
+  for (const std::uint32_t position : moved_) {
+    const std::uint32_t index = order_[position];
+    if (Visible(frustum, CenterOf(boxes, index), ExtentOf(boxes, index))) {
+      visible_.push_back(index);
+    }
+  }
+  stats_.tested_boxes += moved_.size();
+  stats_.ns = NowNs() - start;
+}
+
+}  // namespace hw3d
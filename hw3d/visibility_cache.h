@@ -0,0 +1,132 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "bounds.h"
+#include "frustum_culling.h"
+
+// Frame-to-frame frustum culling that only re-tests what can have changed.
+//
+// The cache keeps its own copy of the boxes in Morton order, so that runs
+// of kClusterSize boxes sit close together, and a bounding box per run. A
+// reference cull records for every cluster whether it was inside, outside
+// or across the frustum, and its slack: how far the nearest plane could
+// move before that could change. While the camera stays near the
+// reference, a plane moves by at most
+//   turn * (distance from the reference eye + cluster radius) + shift,
+// where turn and shift measure how far that plane's normal and offset have
+// changed. Each frame, only the clusters across the frustum border and
+// those whose slack that bound has used up are re-tested, box by box with
+// CullAabbs(); the others are known to be
+// wholly visible or wholly culled without touching their boxes. On screen
+// that is a band along the border of the view that widens as the camera
+// drifts. Moved boxes are re-tested on their own every frame until the
+// next reset, which copies them in and fits their clusters' boxes again.
+//
+// The reference is reset, which costs about one plane test per cluster, on
+// the first call, when a plane has turned past max_turn, and when more
+// than max_retest_fraction of the boxes would be re-tested. The copy is
+// rebuilt and sorted again, at the cost of a few dozen plain culls, when
+// the number of boxes changes and after Invalidate(). Boxes that travel
+// far from where they were sorted make their cluster's box large, so
+// Invalidate() after big changes.
+
+namespace hw3d {
+
+struct VisibilityCacheConfig {
+  // Reset the reference once a plane normal has turned by more than this
+  // (the length of the change of a unit normal: about the angle in
+  // radians). Camera cuts end up here.
+  float max_turn = 0.35f;
+  // Reset the reference once more than this fraction of the boxes would
+  // be re-tested.
+  float max_retest_fraction = 0.25f;
+};
+
+class VisibilityCache {
+ public:
+  // Boxes per cluster.
+  static constexpr std::size_t kClusterSize = 64;
+
+  // Work of the last Cull().
+  struct Stats {
+    // the copy was sorted again
+    bool rebuilt = false;
+    // the reference was reset
+    bool reset = false;
+    std::size_t tested_clusters = 0;
+    std::size_t tested_boxes = 0;
+    std::uint64_t ns = 0;
+  };
+
+  explicit VisibilityCache(
+      const VisibilityCacheConfig& config = VisibilityCacheConfig());
+
+  // Brings visible() up to date for this frame. `eye` is the camera
+  // position; any point works, but the bound is tightest around it.
+  // `moved` lists the boxes that changed since the previous call; listing
+  // one that did not is harmless. Throws std::length_error for 2^32 boxes
+  // or more.
+  void Cull(const Frustum& frustum,
+            Float3 eye,
+            const AabbArray& boxes,
+            const std::uint32_t* moved,
+            std::size_t moved_count);
+  // Makes the next Cull() rebuild the copy from scratch.
+  void Invalidate() noexcept { built_ = false; }
+
+  // Indices of the visible boxes, the same ones CullAabbs() finds, in
+  // cluster order.
+  const std::vector<std::uint32_t>& visible() const noexcept {
+    return visible_;
+  }
+  const Stats& stats() const noexcept { return stats_; }
+
+ private:
+  enum class Side : std::uint8_t { kInside, kOutside, kAcross };
+
+  struct Cluster {
+    Aabb box;
+    // relative to the reference frustum
+    Side side;
+    // some box is NaN or infinite; CullAabbs() decides those alone
+    bool exact;
+    // boxes moved since the reference was reset
+    std::uint16_t moved;
+    float slack;
+    // distance from the reference eye plus the box's half diagonal
+    float reach;
+  };
+
+  void Build(const AabbArray& boxes);
+  void Reset(const Frustum& frustum, Float3 eye, const AabbArray& boxes);
+  // Fits cluster c's box to its boxes.
+  void FitCluster(std::size_t c) noexcept;
+
+  VisibilityCacheConfig config_;
+  bool built_ = false;
+  bool has_reference_ = false;
+  Stats stats_;
+
+  Frustum reference_;
+  Float3 reference_eye_;
+
+  // the boxes in Morton order, and the index each came from
+  AabbArray sorted_;
+  std::vector<std::uint32_t> order_;
+  // position of every box in sorted_
+  std::vector<std::uint32_t> positions_;
+  std::vector<Cluster> clusters_;
+  // positions in sorted_ moved since the reference was reset, and a flag
+  // per position
+  std::vector<std::uint32_t> moved_;
+  std::vector<std::uint8_t> moved_flags_;
+  // CullAabbs() output
+  std::vector<std::uint32_t> scratch_;
+
+  std::vector<std::uint32_t> visible_;
+};
+
+}  // namespace hw3d
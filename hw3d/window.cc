@@ -1,8 +1,11 @@
 ﻿#include "window.h"
 
-#include <sstream>
+#include <cstdint>
 #include <stdexcept>
 
+#include "flight_recorder.h"
+#include "log.h"
+#include "memory_tracker.h"
 #include "resource.h"
 #include "string_utils.h"
 #include "windows_message_map.h"
@@ -11,39 +14,50 @@ namespace hw3d {
 
 // WindowException Stuff
 std::string Window::Exception::TranslateErrorCode(HRESULT hr) noexcept {
-  char* pMsgBuf = nullptr;
-  // windows will allocate memory for err string and make our pointer point to
-  // it
-  const DWORD nMsgLen = FormatMessage(
-      FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM |
-          FORMAT_MESSAGE_IGNORE_INSERTS,
-      nullptr, hr, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-      reinterpret_cast<LPSTR>(&pMsgBuf), 0, nullptr);
+  char buffer[512];
+  return std::string(TranslateErrorCode(hr, buffer, sizeof(buffer)));
+}
+
+std::string_view Window::Exception::TranslateErrorCode(
+    HRESULT hr,
+    char* buffer,
+    std::size_t size) noexcept {
+  // format straight into the caller's buffer instead of letting windows
+  // allocate one for us
+  DWORD nMsgLen = FormatMessage(
+      FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr, hr,
+      MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), buffer,
+      static_cast<DWORD>(size), nullptr);
   // 0 string length returned indicates a failure
   if (nMsgLen == 0) {
     return "Unidentified error code";
   }
-  std::string errorString = pMsgBuf;
-  // free windows buffer
-  LocalFree(pMsgBuf);
-  return errorString;
+  // system messages end with "\r\n"
+  while (nMsgLen > 0 &&
+         (buffer[nMsgLen - 1] == '\r' || buffer[nMsgLen - 1] == '\n')) {
+    --nMsgLen;
+  }
+  return std::string_view(buffer, nMsgLen);
 }
 
 // WindowHrException Stuff
 Window::HrException::HrException(int line,
                                  const char* file,
                                  HRESULT hr) noexcept
-    : Exception(line, file), hr(hr) {}
-const char* Window::HrException::what() const noexcept {
-  std::ostringstream oss;
-  oss << GetType() << std::endl
-      << "[Error Code] 0x" << std::hex << std::uppercase << GetErrorCode()
-      << std::dec << " (" << (unsigned long)GetErrorCode() << ")" << std::endl
-      << "[Description] " << GetErrorDescription() << std::endl
-      << GetOriginString();
-  what_buffer_ = oss.str();
-  return what_buffer_.c_str();
+    : Exception(line, file), hr(hr) {
+  FlightRecorder::Get().RecordError(hr, file, line);
+}
+
+void Window::HrException::FormatWhat(WhatBuffer& out) const noexcept {
+  char description[512];
+  out.Append(GetType()).Append('\n');
+  AppendErrorCode(out, GetErrorCode());
+  out.Append("[Description] ")
+      .Append(GetErrorDescription(description, sizeof(description)))
+      .Append('\n');
+  AppendOrigin(out);
 }
+
 const char* Window::HrException::GetType() const noexcept {
   return "hw3d Window Exception";
 }
@@ -52,8 +66,10 @@ HRESULT Window::HrException::GetErrorCode() const noexcept {
   return hr;
 }
 
-std::string Window::HrException::GetErrorDescription() const noexcept {
-  return Exception::TranslateErrorCode(hr);
+std::string_view Window::HrException::GetErrorDescription(
+    char* buffer,
+    std::size_t size) const noexcept {
+  return Exception::TranslateErrorCode(hr, buffer, size);
 }
 
 // WindowHrNoGfxException Stuff
@@ -65,8 +81,45 @@ const char* Window::NoGfxException::GetType() const noexcept {
 // Define the static WindowClass instance
 Window::WindowClass Window::WindowClass::wndClass;
 
-Window::Window(int width, int height, const char* name)
-    : width_(width), height_(height) {
+Window::Window(int width, int height, const char* name, PumpMode mode)
+    : input_(kbd_, mouse_, width, height),
+      pump_capture_(width, height),
+      width_(width),
+      height_(height) {
+  HW3D_MEMORY_SCOPE(MemoryTag::kWindow);
+  if (mode == PumpMode::kDedicatedThread) {
+    // a window's messages go to the thread that created it, so the pump
+    // thread creates it; wait for the outcome and rethrow any failure here
+    channel_ = std::make_unique<InputChannel>();
+    std::promise<void> created;
+    std::future<void> ready = created.get_future();
+    pump_thread_ =
+        std::thread(&Window::PumpThread, this, name, std::move(created));
+    try {
+      ready.get();
+    } catch (...) {
+      pump_thread_.join();
+      throw;
+    }
+  } else {
+    CreateHwnd(name);
+  }
+
+  try {
+    graphics_ = std::make_unique<Graphics>(hwnd_);
+  } catch (...) {
+    DestroyHwnd();
+    throw;
+  }
+}
+
+Window::~Window() noexcept {
+  // release the swap chain before the window it presents to
+  graphics_.reset();
+  DestroyHwnd();
+}
+
+void Window::CreateHwnd(const char* name) {
   /*
     Window construction sequence (purpose of each step):
 
@@ -111,9 +164,9 @@ Window::Window(int width, int height, const char* name)
 
   RECT wr;
   wr.left = 100;
-  wr.right = wr.left + width;
+  wr.right = wr.left + width_;
   wr.top = 100;
-  wr.bottom = wr.top + height;
+  wr.bottom = wr.top + height_;
 
   // Expand the rectangle to include non-client area (borders, title bar)
   if ((AdjustWindowRect(&wr, WS_CAPTION | WS_MINIMIZEBOX | WS_SYSMENU,
@@ -145,12 +198,54 @@ Window::Window(int width, int height, const char* name)
   }
 
   ShowWindow(hwnd_, SW_SHOWDEFAULT);
+}
 
-  graphics_ = std::make_unique<Graphics>(hwnd_);
+void Window::DestroyHwnd() noexcept {
+  if (pump_thread_.joinable()) {
+    // DestroyWindow only works on the thread that owns the window
+    PostMessage(hwnd_, kStopPumpMessage, 0, 0);
+    pump_thread_.join();
+  } else {
+    DestroyWindow(hwnd_);
+  }
 }
 
-Window::~Window() noexcept {
-  DestroyWindow(hwnd_);
+void Window::PumpThread(const char* name,
+                        std::promise<void> created) noexcept {
+  try {
+    CreateHwnd(name);
+  } catch (...) {
+    created.set_exception(std::current_exception());
+    return;
+  }
+  created.set_value();
+
+  MSG msg;
+  for (;;) {
+    // input held back while the channel was full goes out as the game
+    // thread makes room, so poll for that until the next message arrives
+    while (!channel_->Flush() &&
+           MsgWaitForMultipleObjects(0, nullptr, FALSE, 1, QS_ALLINPUT) ==
+               WAIT_TIMEOUT) {
+    }
+    // block until the next message; this thread has nothing else to do
+    const BOOL result = GetMessage(&msg, nullptr, 0, 0);
+    if (result == -1) {
+      break;
+    }
+    if (result == 0) {
+      // WM_QUIT: hand the exit code to the game thread, which keeps using
+      // the window until it is destroyed, so keep pumping
+      channel_->RequestQuit(static_cast<int>(msg.wParam));
+      continue;
+    }
+    if (msg.message == kStopPumpMessage) {
+      DestroyWindow(hwnd_);
+      break;
+    }
+    TranslateMessage(&msg);
+    DispatchMessage(&msg);
+  }
 }
 
 void Window::SetTitle(const std::string& title) {
@@ -237,6 +332,19 @@ void Window::SetIconFromResource(int resourceID, int width, int height) {
 }
 #endif
 
+std::optional<int> Window::PumpMessages() noexcept {
+  if (channel_ == nullptr) {
+    return ProcessMessages();
+  }
+  // capture was already handled on the pump thread
+  return channel_->Drain(
+      [this](const InputEvent& event) { input_.Dispatch(event); });
+}
+
+InputChannel::Stats Window::input_stats() const noexcept {
+  return channel_ != nullptr ? channel_->stats() : InputChannel::Stats();
+}
+
 std::optional<int> Window::ProcessMessages() noexcept {
   MSG msg;
   // while queue has messages, remove and dispatch them (but do not block on
@@ -330,100 +438,85 @@ LRESULT Window::HandleMsg(HWND hWnd,
                           UINT msg,
                           WPARAM wParam,
                           LPARAM lParam) noexcept {
-  // static WindowsMessageMap messageMap;
-  // OutputDebugString(messageMap(msg, lParam, wParam).c_str());
+  // every message at trace level; filtered out (one branch) by default
+  HW3D_LOG(LogLevel::kTrace, "msg 0x{:x} wparam 0x{:x} lparam 0x{:x}",
+           static_cast<unsigned int>(msg), static_cast<std::uint64_t>(wParam),
+           static_cast<std::int64_t>(lParam));
 
   switch (msg) {
     // we don't want the DefProc to handle this message because
     // we want our destructor to destroy the window, so return 0 instead of
     // break
     case WM_CLOSE:
+      HW3D_LOG(LogLevel::kInfo, "window close requested");
       PostQuitMessage(0);
       return 0;
 
     // clear keystate when window loses focus to prevent input getting "stuck"
     case WM_KILLFOCUS:
-      kbd_.ClearState();
+      HW3D_LOG(LogLevel::kDebug, "focus lost, clearing key state");
+      Dispatch({InputEvent::Type::kFocusLost});
       break;
 
     /*********** KEYBOARD MESSAGES ***********/
     case WM_KEYDOWN:
-    case WM_SYSKEYDOWN:
-      // Only handle the key press event the first time a key is pressed,
-      // preventing repeated triggers when holding down the key, unless
-      // auto-repeat is enabled.
-      if (!(lParam & 0x40000000) ||
-          kbd_.AutorepeatIsEnabled()) {  // filter autorepeat
-        kbd_.OnKeyPressed(static_cast<unsigned char>(wParam));
-      }
-      break;
-    case WM_KEYUP:
-    case WM_SYSKEYUP:
-      kbd_.OnKeyReleased(static_cast<unsigned char>(wParam));
-      break;
-    case WM_CHAR:
-      kbd_.OnChar(static_cast<unsigned char>(wParam));
-      break;
-      /*********** END KEYBOARD MESSAGES ***********/
-
-      /************* MOUSE MESSAGES ****************/
-    case WM_MOUSEMOVE: {
-      const POINTS pt = MAKEPOINTS(lParam);
-      // in client region -> log move, and log enter + capture mouse (if not
-      // previously in window)
-      if (pt.x >= 0 && pt.x < width_ && pt.y >= 0 && pt.y < height_) {
-        mouse_.OnMouseMove(pt.x, pt.y);
-        if (!mouse_.IsInWindow()) {
-          // capture mouse (prevent loss of capture to other windows)
-          SetCapture(hwnd_);
-          mouse_.OnMouseEnter();
-        }
-      } else {  // not in client region -> log move / maintain capture if button
-                // down
-        if (wParam & (MK_LBUTTON | MK_RBUTTON)) {
-          mouse_.OnMouseMove(pt.x, pt.y);
-        } else {  // button up -> release capture / log event for leaving
-          ReleaseCapture();
-          mouse_.OnMouseLeave();
-        }
-      }
-      break;
-    }
-    case WM_LBUTTONDOWN: {
-      const POINTS pt = MAKEPOINTS(lParam);
-      mouse_.OnLeftPressed(pt.x, pt.y);
-      // release mouse if outside of window
-      if (pt.x < 0 || pt.x >= width_ || pt.y < 0 || pt.y >= height_) {
-        ReleaseCapture();
-        mouse_.OnMouseLeave();
-      }
+    case WM_SYSKEYDOWN: {
+      InputEvent event{InputEvent::Type::kKeyDown};
+      // bit 30 is set when the key was already down (autorepeat)
+      event.repeat = (lParam & 0x40000000) != 0;
+      event.code = static_cast<int>(wParam);
+      Dispatch(event);
       break;
     }
-    case WM_RBUTTONDOWN: {
-      const POINTS pt = MAKEPOINTS(lParam);
-      mouse_.OnRightPressed(pt.x, pt.y);
+    case WM_KEYUP:
+    case WM_SYSKEYUP: {
+      InputEvent event{InputEvent::Type::kKeyUp};
+      event.code = static_cast<int>(wParam);
+      Dispatch(event);
       break;
     }
-    case WM_LBUTTONUP: {
-      const POINTS pt = MAKEPOINTS(lParam);
-      mouse_.OnLeftReleased(pt.x, pt.y);
+    case WM_CHAR: {
+      InputEvent event{InputEvent::Type::kChar};
+      event.code = static_cast<unsigned char>(wParam);
+      Dispatch(event);
       break;
     }
-    case WM_RBUTTONUP: {
-      const POINTS pt = MAKEPOINTS(lParam);
-      mouse_.OnRightReleased(pt.x, pt.y);
-      // release mouse if outside of window
-      if (pt.x < 0 || pt.x >= width_ || pt.y < 0 || pt.y >= height_) {
-        ReleaseCapture();
-        mouse_.OnMouseLeave();
-      }
+      /*********** END KEYBOARD MESSAGES ***********/
 
-      break;
-    }
+      /************* MOUSE MESSAGES ****************/
+    case WM_MOUSEMOVE:
+    case WM_LBUTTONDOWN:
+    case WM_RBUTTONDOWN:
+    case WM_LBUTTONUP:
+    case WM_RBUTTONUP:
     case WM_MOUSEWHEEL: {
       const POINTS pt = MAKEPOINTS(lParam);
-      const int delta = GET_WHEEL_DELTA_WPARAM(wParam);
-      mouse_.OnWheelDelta(pt.x, pt.y, delta);
+      InputEvent event;
+      event.x = pt.x;
+      event.y = pt.y;
+      switch (msg) {
+        case WM_MOUSEMOVE:
+          event.type = InputEvent::Type::kMouseMove;
+          event.buttons_held = (wParam & (MK_LBUTTON | MK_RBUTTON)) != 0;
+          break;
+        case WM_LBUTTONDOWN:
+          event.type = InputEvent::Type::kLeftDown;
+          break;
+        case WM_RBUTTONDOWN:
+          event.type = InputEvent::Type::kRightDown;
+          break;
+        case WM_LBUTTONUP:
+          event.type = InputEvent::Type::kLeftUp;
+          break;
+        case WM_RBUTTONUP:
+          event.type = InputEvent::Type::kRightUp;
+          break;
+        default:
+          event.type = InputEvent::Type::kWheel;
+          event.code = GET_WHEEL_DELTA_WPARAM(wParam);
+          break;
+      }
+      Dispatch(event);
       break;
     }
       /************** END MOUSE MESSAGES **************/
@@ -433,6 +526,29 @@ LRESULT Window::HandleMsg(HWND hWnd,
   return DefWindowProc(hWnd, msg, wParam, lParam);
 }
 
+void Window::Dispatch(const InputEvent& event) noexcept {
+  MouseCapture capture;
+  if (channel_ != nullptr) {
+    // on the pump thread: Keyboard and Mouse belong to the game thread, so
+    // forward the event and decide capture from the shadow state
+    capture = pump_capture_.Update(event);
+    channel_->Push(event);
+  } else {
+    capture = input_.Dispatch(event);
+  }
+  switch (capture) {
+    case MouseCapture::kAcquire:
+      // capture mouse (prevent loss of capture to other windows)
+      SetCapture(hwnd_);
+      break;
+    case MouseCapture::kRelease:
+      ReleaseCapture();
+      break;
+    case MouseCapture::kKeep:
+      break;
+  }
+}
+
 Window::WindowClass::WindowClass() noexcept : hInst(GetModuleHandle(nullptr)) {
   WNDCLASSEX wc = {};
   wc.cbSize = sizeof(wc);
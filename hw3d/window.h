@@ -1,18 +1,25 @@
 ﻿#pragma once
 
+#include <cstddef>
+#include <future>
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
 
 #include "exception.h"
 #include "graphics.h"
+#include "input_channel.h"
+#include "input_event.h"
 #include "keyboard.h"
 #include "mouse.h"
+#include "platform_window.h"
 #include "windows_config.h"
 
 namespace hw3d {
 
-class Window {
+class Window : public PlatformWindow {
  public:
   // Exception class for window-related errors
   class Exception : public Hw3dException {
@@ -20,15 +27,24 @@ class Window {
 
    public:
     static std::string TranslateErrorCode(HRESULT hr) noexcept;
+    // Writes the system message for `hr` into `buffer` without allocating and
+    // returns a view of it (trailing line breaks removed).
+    static std::string_view TranslateErrorCode(HRESULT hr,
+                                               char* buffer,
+                                               std::size_t size) noexcept;
   };
   // Exception class for HRESULT errors
   class HrException : public Exception {
    public:
     HrException(int line, const char* file, HRESULT hr) noexcept;
-    const char* what() const noexcept override;
     const char* GetType() const noexcept override;
     HRESULT GetErrorCode() const noexcept;
-    std::string GetErrorDescription() const noexcept;
+    // Writes the system message for the error into `buffer`.
+    std::string_view GetErrorDescription(char* buffer,
+                                         std::size_t size) const noexcept;
+
+   protected:
+    void FormatWhat(WhatBuffer& out) const noexcept override;
 
    private:
     HRESULT hr;
@@ -42,20 +58,27 @@ class Window {
   };
 
  public:
-  Window(int width, int height, const char* name);
-  ~Window() noexcept;
+  // With PumpMode::kDedicatedThread the HWND is created on, and owned by, a
+  // pump thread; all public members are still called from the constructing
+  // thread.
+  Window(int width,
+         int height,
+         const char* name,
+         PumpMode mode = PumpMode::kCallerThread);
+  ~Window() noexcept override;
   Window(const Window&) = delete;
   Window& operator=(const Window&) = delete;
 
-  Keyboard& kbd() noexcept { return kbd_; }
-  Mouse& mouse() noexcept { return mouse_; }
+  Keyboard& kbd() noexcept override { return kbd_; }
+  Mouse& mouse() noexcept override { return mouse_; }
+  Surface& surface() noexcept override { return *graphics_; }
   Graphics& graphics() noexcept { return *graphics_; }
 
   // Sets the window title shown in the window's title bar.
   // The provided `title` string will be applied to the associated
   // HWND (platform window). Call this to update the displayed title
   // at runtime.
-  void SetTitle(const std::string& title);
+  void SetTitle(const std::string& title) override;
   // Load an icon from an external .ico file (multibyte string path) and set
   // it as the window's large and small icon. Throws `WindowException` on
   // failure.
@@ -66,6 +89,11 @@ class Window {
   void SetIconFromResource(int resourceID, int width = 32, int height = 32);
 
   static std::optional<int> ProcessMessages() noexcept;
+  // Runs ProcessMessages() or, with a pump thread, dispatches the input it
+  // forwarded and reports its quit request.
+  std::optional<int> PumpMessages() noexcept override;
+  // Handoff counters of the pump thread; all zero without one.
+  InputChannel::Stats input_stats() const noexcept;
 
  private:
   class WindowClass {
@@ -95,16 +123,32 @@ class Window {
                                          LPARAM lParam) noexcept;
 
   LRESULT HandleMsg(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) noexcept;
+  // Hands a translated message to the dispatcher and applies the capture
+  // change it asks for.
+  void Dispatch(const InputEvent& event) noexcept;
+
+  void CreateHwnd(const char* name);
+  void DestroyHwnd() noexcept;
+  void PumpThread(const char* name, std::promise<void> created) noexcept;
 
  private:
   Keyboard kbd_;
   Mouse mouse_;
+  InputDispatcher input_;
+  // pump thread's shadow of the mouse's in-window state, for capture
+  MouseCaptureTracker pump_capture_;
 
  private:
   int width_;
   int height_;
   HWND hwnd_;
   std::unique_ptr<Graphics> graphics_;
+
+  // posted to the pump thread to have it destroy the window and exit
+  static constexpr UINT kStopPumpMessage = WM_APP;
+  // only with PumpMode::kDedicatedThread
+  std::unique_ptr<InputChannel> channel_;
+  std::thread pump_thread_;
 };
 
 // error exception helper macro
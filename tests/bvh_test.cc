@@ -0,0 +1,275 @@
+﻿#include "hw3d/bvh.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "hw3d/job_system.h"
+#include "test.h"
+
+namespace {
+
+using hw3d::Aabb;
+using hw3d::Bvh;
+using hw3d::Float3;
+using hw3d::Ray;
+
+class Random {
+ public:
+  explicit Random(std::uint32_t seed) : state_(seed) {}
+  // Uniform in [lo, hi).
+  float Next(float lo, float hi) {
+    state_ = state_ * 1664525u + 1013904223u;
+    return lo + (hi - lo) * static_cast<float>(state_ >> 8) / 16777216.0f;
+  }
+
+ private:
+  std::uint32_t state_;
+};
+
+constexpr float kInf = std::numeric_limits<float>::infinity();
+
+// Mostly small boxes, some large, some flat along one axis, some empty.
+Aabb RandomBox(Random& random) {
+  const float kind = random.Next(0, 1);
+  if (kind < 0.05f) {
+    return Aabb();
+  }
+  const Float3 c{random.Next(-100, 100), random.Next(-100, 100),
+                 random.Next(-100, 100)};
+  Float3 e{random.Next(0.1f, 2), random.Next(0.1f, 2), random.Next(0.1f, 2)};
+  if (kind < 0.10f) {
+    e = e * 15.0f;
+  } else if (kind < 0.15f) {
+    e.y = 0.0f;
+  }
+  return {c - e, c + e};
+}
+
+Float3 RandomPoint(Random& random) {
+  return {random.Next(-120, 120), random.Next(-120, 120),
+          random.Next(-120, 120)};
+}
+
+// Random directions, and every axis-parallel one in turn.
+Float3 RandomDirection(Random& random, int q) {
+  static const Float3 kAxes[] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0},
+                                 {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+  if (q % 3 == 0) {
+    return kAxes[(q / 3) % 6];
+  }
+  return {random.Next(-1, 1), random.Next(-1, 1), random.Next(-1, 1)};
+}
+
+// Checks every query of `bvh` against a scan of `boxes`.
+void CheckAgainstScan(const Bvh& bvh, const std::vector<Aabb>& boxes,
+                      Random& random) {
+  HW3D_CHECK(bvh.size() == boxes.size());
+  for (int q = 0; q < 150; q++) {
+    // rays: the closest entry point below max_t
+    const Ray ray{RandomPoint(random), RandomDirection(random, q)};
+    const float max_t = q % 2 == 0 ? kInf : random.Next(1, 200);
+    const Float3 inv = hw3d::InverseDirection(ray);
+    float best_t = max_t;
+    bool any = false;
+    for (const Aabb& box : boxes) {
+      float t;
+      if (hw3d::IntersectRay(ray.origin, inv, box, best_t, &t) &&
+          t < best_t) {
+        best_t = t;
+        any = true;
+      }
+    }
+    Bvh::RayHit ray_hit;
+    HW3D_CHECK(bvh.Raycast(ray, max_t, &ray_hit) == any);
+    if (any) {
+      HW3D_CHECK(ray_hit.t == best_t);
+      float t;
+      HW3D_CHECK(hw3d::IntersectRay(ray.origin, inv, boxes[ray_hit.object],
+                                    kInf, &t) &&
+                 t == best_t);
+    }
+
+    // nearest: the smallest squared distance below max_distance squared
+    const Float3 point = RandomPoint(random);
+    const float max_distance = q % 2 == 0 ? kInf : random.Next(1, 50);
+    float best_d = max_distance * max_distance;
+    any = false;
+    for (const Aabb& box : boxes) {
+      if (hw3d::IsEmpty(box)) {
+        continue;
+      }
+      const float d = hw3d::DistanceSquared(box, point);
+      if (d < best_d) {
+        best_d = d;
+        any = true;
+      }
+    }
+    Bvh::NearestHit near_hit;
+    HW3D_CHECK(bvh.Nearest(point, max_distance, &near_hit) == any);
+    if (any) {
+      HW3D_CHECK(near_hit.distance_squared == best_d);
+      HW3D_CHECK(hw3d::DistanceSquared(boxes[near_hit.object], point) ==
+                 best_d);
+    }
+
+    // overlap: every overlapping box once
+    const float r = random.Next(0.5f, 30);
+    const Aabb query{point - Float3{r, r, r}, point + Float3{r, r, r}};
+    std::vector<std::uint32_t> hits, scan;
+    bvh.QueryOverlap(query, [&](std::uint32_t o) { hits.push_back(o); });
+    for (std::uint32_t i = 0; i < boxes.size(); i++) {
+      if (hw3d::Overlaps(boxes[i], query)) {
+        scan.push_back(i);
+      }
+    }
+    std::sort(hits.begin(), hits.end());
+    HW3D_CHECK(hits == scan);
+  }
+}
+
+// Moves a third of the objects a little, some far, and empties or fills a
+// few, then refits and checks again.
+void MoveAndCheck(Bvh& bvh, std::vector<Aabb>& boxes, Random& random) {
+  for (int round = 0; round < 4; round++) {
+    for (std::uint32_t i = 0; i < boxes.size(); i++) {
+      const float roll = random.Next(0, 1);
+      if (roll < 0.25f && !hw3d::IsEmpty(boxes[i])) {
+        const Float3 v{random.Next(-3, 3), random.Next(-3, 3),
+                       random.Next(-3, 3)};
+        boxes[i] = {boxes[i].min + v, boxes[i].max + v};
+      } else if (roll < 0.30f) {
+        boxes[i] = RandomBox(random);
+      } else if (roll < 0.32f) {
+        boxes[i] = Aabb();
+      } else {
+        continue;
+      }
+      bvh.Update(i, boxes[i]);
+    }
+    bvh.Refit();
+    HW3D_CHECK(bvh.last_rebuilt_objects() <= boxes.size());
+    CheckAgainstScan(bvh, boxes, random);
+  }
+}
+
+HW3D_TEST(EmptyTreeFindsNothing) {
+  Bvh bvh;
+  bvh.Build(nullptr, 0);
+  HW3D_CHECK(bvh.size() == 0);
+  Bvh::RayHit ray_hit;
+  HW3D_CHECK(!bvh.Raycast(Ray{}, kInf, &ray_hit));
+  Bvh::NearestHit near_hit;
+  HW3D_CHECK(!bvh.Nearest(Float3{}, kInf, &near_hit));
+  bool called = false;
+  bvh.QueryOverlap(Aabb{{-1, -1, -1}, {1, 1, 1}},
+                   [&](std::uint32_t) { called = true; });
+  HW3D_CHECK(!called);
+  bvh.Refit();
+}
+
+HW3D_TEST(OnlyEmptyBoxes) {
+  const std::vector<Aabb> boxes(5);
+  Bvh bvh;
+  bvh.Build(boxes.data(), boxes.size());
+  Bvh::RayHit ray_hit;
+  HW3D_CHECK(!bvh.Raycast(Ray{{0, 0, -10}, {0, 0, 1}}, kInf, &ray_hit));
+  Bvh::NearestHit near_hit;
+  HW3D_CHECK(!bvh.Nearest(Float3{}, kInf, &near_hit));
+}
+
+HW3D_TEST(MatchesScanOnRandomScenes) {
+  Random random(7);
+  for (std::size_t count : {1u, 2u, 9u, 100u, 3000u}) {
+    std::vector<Aabb> boxes(count);
+    for (Aabb& box : boxes) {
+      box = RandomBox(random);
+    }
+    Bvh bvh;
+    bvh.Build(boxes.data(), boxes.size());
+    HW3D_CHECK(bvh.node_count() <= 2 * count);
+    CheckAgainstScan(bvh, boxes, random);
+    MoveAndCheck(bvh, boxes, random);
+  }
+}
+
+HW3D_TEST(RefitRebuildsOnlyDegradedSubtrees) {
+  Random random(5);
+  std::vector<Aabb> boxes(3000);
+  for (Aabb& box : boxes) {
+    const Float3 c = RandomPoint(random);
+    box = {c - Float3{1, 1, 1}, c + Float3{1, 1, 1}};
+  }
+  Bvh bvh;
+  bvh.Build(boxes.data(), boxes.size());
+  bvh.Refit();
+  HW3D_CHECK(bvh.last_rebuilt_objects() == 0);
+  // a few objects drifting away stretch their subtrees only
+  bool partial = false;
+  for (int round = 0; round < 3; round++) {
+    for (std::uint32_t i = 0; i < 20; i++) {
+      boxes[i] = {boxes[i].min + Float3{30, 0, 0},
+                  boxes[i].max + Float3{30, 0, 0}};
+      bvh.Update(i, boxes[i]);
+    }
+    bvh.Refit();
+    partial |= bvh.last_rebuilt_objects() > 0 &&
+               bvh.last_rebuilt_objects() < boxes.size();
+    CheckAgainstScan(bvh, boxes, random);
+  }
+  HW3D_CHECK(partial);
+}
+
+HW3D_TEST(ExactCallbacksSeeOnlyCandidates) {
+  Random random(11);
+  std::vector<Aabb> boxes(500);
+  for (Aabb& box : boxes) {
+    box = RandomBox(random);
+  }
+  Bvh bvh;
+  bvh.Build(boxes.data(), boxes.size());
+  // an exact shape that starts a little past each box's near face
+  const Ray ray{{-200, 0.5f, 0.25f}, {1, 0, 0}};
+  Bvh::RayHit hit;
+  const bool found = bvh.Raycast(
+      ray, kInf,
+      [&](std::uint32_t object, float t_max) {
+        HW3D_CHECK(!hw3d::IsEmpty(boxes[object]));
+        const float t = boxes[object].min.x - ray.origin.x + 0.125f;
+        return t < t_max ? t : t_max;
+      },
+      &hit);
+  if (found) {
+    HW3D_CHECK(hit.t == boxes[hit.object].min.x - ray.origin.x + 0.125f);
+  }
+  Bvh::NearestHit near_hit;
+  int calls = 0;
+  HW3D_CHECK(bvh.Nearest(
+      Float3{}, kInf,
+      [&](std::uint32_t object, float best) {
+        calls++;
+        HW3D_CHECK(hw3d::DistanceSquared(boxes[object], Float3{}) <= best);
+        return hw3d::DistanceSquared(boxes[object], Float3{}) + 1.0f;
+      },
+      &near_hit));
+  HW3D_CHECK(calls > 0 && calls < 500);
+}
+
+HW3D_TEST(ParallelBuildMatchesScan) {
+  Random random(3);
+  std::vector<Aabb> boxes(40000);
+  for (Aabb& box : boxes) {
+    box = RandomBox(random);
+  }
+  Bvh serial;
+  serial.Build(boxes.data(), boxes.size());
+  hw3d::JobSystemSession session(4);
+  Bvh parallel;
+  parallel.Build(boxes.data(), boxes.size());
+  HW3D_CHECK(parallel.node_count() == serial.node_count());
+  HW3D_CHECK(parallel.SahCost() == serial.SahCost());
+  CheckAgainstScan(parallel, boxes, random);
+}
+
+}  // namespace
@@ -0,0 +1,143 @@
+﻿#include "hw3d/diagnostic_sink.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+using hw3d::DiagnosticCursor;
+using hw3d::DiagnosticSink;
+using hw3d::InfoQueueSource;
+
+// Stands in for IDXGIInfoQueue: each entry is a header followed by the
+// description text, and reads into a short buffer report the size needed.
+class FakeInfoQueue : public InfoQueueSource {
+ public:
+  struct Header {
+    std::size_t length;
+  };
+
+  void Push(std::string text) { messages_.push_back(std::move(text)); }
+  void FailAt(std::uint64_t index) { failing_.push_back(index); }
+
+  std::uint64_t GetNumStoredMessages() const noexcept override {
+    return messages_.size();
+  }
+
+  ReadResult ReadMessage(std::uint64_t index,
+                         void* buffer,
+                         std::size_t* size,
+                         std::string_view* description) const
+      noexcept override {
+    ++reads;
+    for (const std::uint64_t failing : failing_) {
+      if (failing == index) {
+        return ReadResult::kFailed;
+      }
+    }
+    const std::string& text = messages_[index];
+    const std::size_t required = sizeof(Header) + text.size();
+    if (*size < required) {
+      *size = required;
+      ++too_small;
+      return ReadResult::kBufferTooSmall;
+    }
+    auto* header = static_cast<Header*>(buffer);
+    header->length = text.size();
+    char* chars = reinterpret_cast<char*>(header + 1);
+    std::memcpy(chars, text.data(), text.size());
+    *description = std::string_view(chars, header->length);
+    return ReadResult::kOk;
+  }
+
+  mutable int reads = 0;
+  mutable int too_small = 0;
+
+ private:
+  std::vector<std::string> messages_;
+  std::vector<std::uint64_t> failing_;
+};
+
+std::vector<std::string> Collect(const DiagnosticSink& sink) {
+  std::vector<std::string> out;
+  sink.ForEach([&](std::string_view message) { out.emplace_back(message); });
+  return out;
+}
+
+}  // namespace
+
+HW3D_TEST(DrainCapturesOnlyMessagesSinceCursor) {
+  FakeInfoQueue queue;
+  queue.Push("old warning");
+  const DiagnosticCursor cursor{queue.GetNumStoredMessages()};
+  queue.Push("first");
+  queue.Push("second");
+
+  DiagnosticSink sink;
+  HW3D_CHECK(sink.Drain(queue, cursor) == 2);
+  HW3D_CHECK(sink.Joined() == "first\nsecond");
+  HW3D_CHECK((Collect(sink) == std::vector<std::string>{"first", "second"}));
+}
+
+HW3D_TEST(DrainWithNothingNewLeavesSinkEmpty) {
+  FakeInfoQueue queue;
+  queue.Push("old");
+  DiagnosticSink sink;
+  sink.Append("stale");
+  HW3D_CHECK(sink.Drain(queue, DiagnosticCursor{1}) == 0);
+  HW3D_CHECK(sink.empty());
+  HW3D_CHECK(sink.Joined().empty());
+}
+
+HW3D_TEST(DrainGrowsScratchOnceForLongMessages) {
+  FakeInfoQueue queue;
+  const std::string long_message(10000, 'x');
+  queue.Push(long_message);
+  queue.Push(long_message + std::string(100, 'y'));
+  queue.Push("short");
+
+  DiagnosticSink sink(64);
+  HW3D_CHECK(sink.Drain(queue, DiagnosticCursor{}) == 3);
+  // each long message grows the buffer once; the short one fits
+  HW3D_CHECK(queue.too_small == 2);
+  HW3D_CHECK(queue.reads == 5);
+  const auto messages = Collect(sink);
+  HW3D_CHECK(messages.size() == 3);
+  HW3D_CHECK(messages[0] == long_message);
+  HW3D_CHECK(messages[1] == long_message + std::string(100, 'y'));
+  HW3D_CHECK(messages[2] == "short");
+
+  // a second drain reuses the grown buffer
+  queue.too_small = 0;
+  HW3D_CHECK(sink.Drain(queue, DiagnosticCursor{}) == 3);
+  HW3D_CHECK(queue.too_small == 0);
+}
+
+HW3D_TEST(DrainSkipsFailedAndEmptyMessages) {
+  FakeInfoQueue queue;
+  queue.Push("a");
+  queue.Push("broken");
+  queue.Push("");
+  queue.Push("b");
+  queue.FailAt(1);
+
+  DiagnosticSink sink;
+  HW3D_CHECK(sink.Drain(queue, DiagnosticCursor{}) == 2);
+  HW3D_CHECK(sink.Joined() == "a\nb");
+}
+
+HW3D_TEST(AppendAndClearKeepJoinedFormat) {
+  DiagnosticSink sink;
+  sink.Append("one");
+  HW3D_CHECK(sink.Joined() == "one");
+  sink.Append("two");
+  HW3D_CHECK(sink.size() == 2);
+  HW3D_CHECK(sink.Joined() == "one\ntwo");
+  sink.Clear();
+  HW3D_CHECK(sink.empty());
+  sink.Append("three");
+  HW3D_CHECK(sink.Joined() == "three");
+}
@@ -0,0 +1,218 @@
+﻿#include "hw3d/ecs.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "hw3d/job_system.h"
+#include "hw3d/system_scheduler.h"
+#include "test.h"
+
+namespace {
+
+using hw3d::CommandBuffer;
+using hw3d::Entity;
+using hw3d::Reads;
+using hw3d::SystemScheduler;
+using hw3d::World;
+using hw3d::Writes;
+
+struct Position {
+  float x, y, z;
+};
+struct Velocity {
+  float x, y, z;
+};
+struct Health {
+  int value;
+};
+struct alignas(64) Aligned {
+  float values[16];
+};
+// Non-trivial: relocating it must go through the move constructor.
+struct Name {
+  std::unique_ptr<int> id;
+};
+
+}  // namespace
+
+HW3D_TEST(ComponentsMoveBetweenArchetypes) {
+  World world;
+  const Entity e = world.Create(Position{1, 2, 3}, Velocity{4, 5, 6});
+  HW3D_CHECK(world.Has<Position>(e) && world.Has<Velocity>(e));
+  HW3D_CHECK(!world.Has<Health>(e));
+
+  HW3D_CHECK(world.Add(e, Health{7}));
+  HW3D_CHECK(world.Get<Health>(e)->value == 7);
+  HW3D_CHECK(world.Get<Position>(e)->y == 2.0f);
+  HW3D_CHECK(world.Get<Velocity>(e)->z == 6.0f);
+
+  HW3D_CHECK(world.Remove<Velocity>(e));
+  HW3D_CHECK(!world.Remove<Velocity>(e));
+  HW3D_CHECK(world.Get<Velocity>(e) == nullptr);
+  HW3D_CHECK(world.Get<Position>(e)->x == 1.0f);
+  HW3D_CHECK(world.Get<Health>(e)->value == 7);
+  HW3D_CHECK(world.archetype_count() >= 3);
+}
+
+HW3D_TEST(NonTrivialComponentsAreRelocatedByMove) {
+  World world;
+  std::vector<Entity> entities;
+  for (int i = 0; i < 1000; i++) {
+    entities.push_back(world.Create(Name{std::make_unique<int>(i)}));
+  }
+  // moving every other entity to another archetype fills holes by moving
+  // the last row of each chunk
+  for (int i = 0; i < 1000; i += 2) {
+    world.Add(entities[i], Health{i});
+  }
+  for (int i = 0; i < 1000; i += 3) {
+    world.Destroy(entities[i]);
+  }
+  for (int i = 0; i < 1000; i++) {
+    const Name* name = world.Get<Name>(entities[i]);
+    if (i % 3 == 0) {
+      HW3D_CHECK(name == nullptr);
+    } else {
+      HW3D_CHECK(name != nullptr && *name->id == i);
+    }
+  }
+}
+
+HW3D_TEST(ChunkArraysAreAlignedAndContiguous) {
+  World world;
+  for (int i = 0; i < 5000; i++) {
+    world.Create(Position{static_cast<float>(i), 0, 0}, Aligned{},
+                 Health{i});
+  }
+  std::size_t seen = 0;
+  world.ForEachChunk<Position, const Aligned, Health>(
+      [&](std::size_t n, const Entity* entities, Position* positions,
+          const Aligned* aligned, Health* health) {
+        HW3D_CHECK(reinterpret_cast<std::uintptr_t>(aligned) % 64 == 0);
+        HW3D_CHECK(reinterpret_cast<std::uintptr_t>(positions) % 64 == 0);
+        for (std::size_t i = 0; i < n; i++) {
+          HW3D_CHECK(world.Get<Health>(entities[i]) == &health[i]);
+          HW3D_CHECK(positions[i].x == static_cast<float>(health[i].value));
+        }
+        seen += n;
+      });
+  HW3D_CHECK(seen == 5000);
+  HW3D_CHECK(world.chunk_count() > 1);
+}
+
+HW3D_TEST(StaleHandlesAreIgnored) {
+  World world;
+  const Entity e = world.Create(Health{1});
+  world.Destroy(e);
+  HW3D_CHECK(!world.IsAlive(e));
+  HW3D_CHECK(world.Get<Health>(e) == nullptr);
+  HW3D_CHECK(!world.Add(e, Position{}));
+  HW3D_CHECK(!world.Remove<Health>(e));
+  world.Destroy(e);
+
+  // the slot is reused with a new generation
+  const Entity reused = world.Create(Health{2});
+  HW3D_CHECK(reused.index() == e.index());
+  HW3D_CHECK(world.IsAlive(reused) && !world.IsAlive(e));
+  HW3D_CHECK(world.size() == 1);
+
+  // until it runs out of generations; then it is retired, not wrapped
+  Entity last = reused;
+  for (std::uint32_t i = 0;
+       i <= Entity::kGenerationMask && last.index() == e.index(); i++) {
+    world.Destroy(last);
+    HW3D_CHECK(!world.IsAlive(e));
+    last = world.Create(Health{3});
+  }
+  HW3D_CHECK(last.generation() == 1);
+  HW3D_CHECK(world.IsAlive(last) && !world.IsAlive(e) &&
+             !world.IsAlive(reused));
+  HW3D_CHECK(world.size() == 1);
+}
+
+HW3D_TEST(CommandBufferDefersStructuralChanges) {
+  World world;
+  for (int i = 0; i < 100; i++) {
+    world.Create(Health{i});
+  }
+  CommandBuffer commands;
+  world.ForEachChunk<const Health>(
+      [&](std::size_t n, const Entity* entities, const Health* health) {
+        for (std::size_t i = 0; i < n; i++) {
+          if (health[i].value % 2 == 0) {
+            commands.Destroy(entities[i]);
+          } else {
+            commands.Add(entities[i], Position{1, 1, 1});
+            commands.Create(Name{std::make_unique<int>(health[i].value)});
+          }
+        }
+      });
+  HW3D_CHECK(world.size() == 100);
+  commands.Apply(world);
+  HW3D_CHECK(commands.empty());
+  HW3D_CHECK(world.size() == 100);
+  int with_position = 0;
+  world.ForEach<const Position, const Health>(
+      [&](const Position&, const Health& h) {
+        HW3D_CHECK(h.value % 2 == 1);
+        with_position++;
+      });
+  HW3D_CHECK(with_position == 50);
+  int named = 0;
+  world.ForEach<const Name>([&](const Name& name) {
+    HW3D_CHECK(*name.id % 2 == 1);
+    named++;
+  });
+  HW3D_CHECK(named == 50);
+}
+
+HW3D_TEST(SchedulerBatchesNonConflictingSystems) {
+  hw3d::JobSystemSession session(4);
+  World world;
+  for (int i = 0; i < 20000; i++) {
+    world.Create(Position{}, Velocity{1, 2, 3}, Health{100});
+  }
+  SystemScheduler scheduler;
+  std::atomic<int> health_sum{0};
+  scheduler.Add("move", Reads<Velocity>(), Writes<Position>(),
+                [](World& w, CommandBuffer&) {
+                  w.ParallelForEachChunk<Position, const Velocity>(
+                      [](std::size_t n, const Entity*, Position* p,
+                         const Velocity* v) {
+                        for (std::size_t i = 0; i < n; i++) {
+                          p[i].x += v[i].x;
+                        }
+                      });
+                });
+  scheduler.Add("damage", Reads<>(), Writes<Health>(),
+                [](World& w, CommandBuffer&) {
+                  w.ForEach<Health>([](Health& h) { h.value -= 1; });
+                });
+  // reads Position, which "move" writes: next batch
+  scheduler.Add("report", Reads<Position, Health>(), Writes<>(),
+                [&](World& w, CommandBuffer&) {
+                  w.ForEach<const Position, const Health>(
+                      [&](const Position& p, const Health& h) {
+                        if (p.x == 1.0f) {
+                          health_sum.fetch_add(h.value,
+                                               std::memory_order_relaxed);
+                        }
+                      });
+                });
+  scheduler.Add("cull", Reads<Health>(), Writes<>(),
+                [](World& w, CommandBuffer& commands) {
+                  w.ForEachChunk<const Health>(
+                      [&](std::size_t n, const Entity* e, const Health*) {
+                        for (std::size_t i = 0; i < n; i += 2) {
+                          commands.Destroy(e[i]);
+                        }
+                      });
+                });
+  HW3D_CHECK(scheduler.system_count() == 4);
+  HW3D_CHECK(scheduler.batch_count() == 2);
+  scheduler.Run(world);
+  HW3D_CHECK(health_sum.load() == 20000 * 99);
+  HW3D_CHECK(world.size() < 20000 && world.size() >= 10000);
+}
@@ -0,0 +1,159 @@
+﻿#include "hw3d/exception.h"
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+using hw3d::Hw3dException;
+
+// Shaped like Window::HrException and Graphics::HrException, on the
+// portable HRESULT.
+class TestHrException : public Hw3dException {
+ public:
+  TestHrException(int line,
+                  const char* file,
+                  HRESULT hr,
+                  std::string_view detail = {}) noexcept
+      : Hw3dException(line, file), hr_(hr) {
+    if (!detail.empty()) {
+      SetDetail(detail);
+    }
+  }
+
+  const char* GetType() const noexcept override { return "Test Exception"; }
+  std::string_view detail() const noexcept { return GetDetail(); }
+  int format_count() const noexcept {
+    return format_count_.load(std::memory_order_relaxed);
+  }
+
+ protected:
+  void FormatWhat(WhatBuffer& out) const noexcept override {
+    format_count_.fetch_add(1, std::memory_order_relaxed);
+    out.Append(GetType()).Append('\n');
+    AppendErrorCode(out, hr_);
+    if (!GetDetail().empty()) {
+      out.Append("[Error Info]\n").Append(GetDetail()).Append('\n');
+    }
+    AppendOrigin(out);
+  }
+
+ private:
+  HRESULT hr_;
+  // FormatWhat() calls on this object
+  mutable std::atomic<int> format_count_{0};
+};
+
+}  // namespace
+
+HW3D_TEST(WhatHasTypeFileAndLine) {
+  bool threw = false;
+  try {
+    throw Hw3dException(42, "hw3d/window.cc");
+  } catch (const Hw3dException& e) {
+    threw = true;
+    HW3D_CHECK(std::string(e.what()) ==
+               "hw3d Exception\n[File] hw3d/window.cc\n[Line] 42");
+    HW3D_CHECK(e.GetOriginString() == "[File] hw3d/window.cc\n[Line] 42");
+    HW3D_CHECK(e.GetLine() == 42 && e.GetFile() == "hw3d/window.cc");
+    // cached: the same text at the same address
+    HW3D_CHECK(e.what() == e.what());
+  }
+  HW3D_CHECK(threw);
+}
+
+HW3D_TEST(HrReportHasCodeAndTrimmedDetail) {
+  const TestHrException e(7, "graphics.cc", static_cast<HRESULT>(0x887A0005),
+                          "device removed\r\n\n");
+  HW3D_CHECK(e.detail() == "device removed");
+  HW3D_CHECK(std::string(e.what()) ==
+             "Test Exception\n"
+             "[Error Code] 0x887A0005 (2289696773)\n"
+             "[Error Info]\ndevice removed\n"
+             "[File] graphics.cc\n[Line] 7");
+  HW3D_CHECK(e.format_count() == 1);
+  e.what();
+  HW3D_CHECK(e.format_count() == 1);
+}
+
+HW3D_TEST(LongTextIsTruncatedNotOverrun) {
+  const std::string detail(Hw3dException::kDetailCapacity * 2, 'x');
+  const TestHrException e(1, "a.cc", 0, detail);
+  HW3D_CHECK(e.detail().size() == Hw3dException::kDetailCapacity - 1);
+  const std::string what = e.what();
+  HW3D_CHECK(what.size() < Hw3dException::kWhatCapacity);
+  HW3D_CHECK(what.find("[Error Info]\nxxx") != std::string::npos);
+}
+
+HW3D_TEST(CopiesShareTheReport) {
+  const char* original_what = nullptr;
+  Hw3dException* copy = nullptr;
+  {
+    const Hw3dException original(3, "x.cc");
+    original_what = original.what();
+    copy = new Hw3dException(original);
+  }
+  // the report outlives the original
+  HW3D_CHECK(copy->what() == original_what);
+  HW3D_CHECK(std::string(copy->what()) ==
+             "hw3d Exception\n[File] x.cc\n[Line] 3");
+  Hw3dException assigned(9, "y.cc");
+  assigned = *copy;
+  delete copy;
+  HW3D_CHECK(assigned.GetLine() == 3);
+  HW3D_CHECK(std::string(assigned.what()) ==
+             "hw3d Exception\n[File] x.cc\n[Line] 3");
+}
+
+HW3D_TEST(MoreLiveExceptionsThanPoolReportsKeepTheirText) {
+  // well past the static pool, so the rest come from the heap
+  constexpr int kLive = 100;
+  std::vector<TestHrException*> live;
+  for (int i = 0; i < kLive; i++) {
+    live.push_back(new TestHrException(i, "many.cc", -i, "detail"));
+  }
+  for (int i = 0; i < kLive; i++) {
+    const std::string what = live[i]->what();
+    HW3D_CHECK(what.find("[Line] " + std::to_string(i)) != std::string::npos);
+    HW3D_CHECK(what.find("[Error Info]\ndetail\n") != std::string::npos);
+  }
+  for (TestHrException* e : live) {
+    delete e;
+  }
+  // and the pool is free again
+  const TestHrException e(1, "after.cc", 0, "still kept");
+  HW3D_CHECK(e.detail() == "still kept");
+}
+
+HW3D_TEST(ConcurrentWhatFormatsOnce) {
+  constexpr int kThreads = 8;
+  for (int round = 0; round < 50; round++) {
+    const TestHrException e(round, "race.cc", -1, "shared");
+    std::atomic<int> ready{0};
+    std::vector<std::string> seen(kThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+      threads.emplace_back([&, t] {
+        ready.fetch_add(1);
+        while (ready.load() < kThreads) {
+          std::this_thread::yield();
+        }
+        seen[t] = e.what();
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    HW3D_CHECK(e.format_count() == 1);
+    for (const std::string& what : seen) {
+      HW3D_CHECK(what == seen[0]);
+    }
+    HW3D_CHECK(seen[0].find("[Line] " + std::to_string(round)) !=
+               std::string::npos);
+  }
+}
@@ -0,0 +1,94 @@
+﻿#include "hw3d/fiber_job_system.h"
+
+#include <atomic>
+
+#include "test.h"
+
+namespace {
+
+using hw3d::FiberJobSystem;
+using hw3d::FiberJobSystemConfig;
+using hw3d::JobCounter;
+
+struct Session {
+  explicit Session(const FiberJobSystemConfig& config) {
+    started = FiberJobSystem::Get().Start(config);
+  }
+  ~Session() { FiberJobSystem::Get().Stop(); }
+  bool started;
+};
+
+struct Tree {
+  std::atomic<int> leaves{0};
+};
+
+// Each job at `depth` > 0 submits `fanout` children and waits on them.
+void Spawn(Tree* tree, int depth, int fanout) {
+  if (depth == 0) {
+    tree->leaves.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  JobCounter children;
+  for (int i = 0; i < fanout; i++) {
+    FiberJobSystem::Get().Run(
+        [tree, depth, fanout] { Spawn(tree, depth - 1, fanout); },
+        &children);
+  }
+  FiberJobSystem::Get().Wait(children);
+}
+
+int Power(int base, int exponent) {
+  int result = 1;
+  while (exponent-- > 0) {
+    result *= base;
+  }
+  return result;
+}
+
+}  // namespace
+
+HW3D_TEST(NestedWaitsFinishWithEnoughFibers) {
+  FiberJobSystemConfig config;
+  config.worker_count = 4;
+  Session session(config);
+  HW3D_CHECK(session.started);
+  Tree tree;
+  JobCounter root;
+  Tree* t = &tree;
+  FiberJobSystem::Get().Run([t] { Spawn(t, 4, 6); }, &root);
+  FiberJobSystem::Get().Wait(root);
+  HW3D_CHECK(tree.leaves.load() == Power(6, 4));
+}
+
+HW3D_TEST(ExhaustedFiberPoolRunsJobsInline) {
+  // far more jobs wait at once than there are fibers; requeueing the job
+  // that would free them used to livelock here
+  FiberJobSystemConfig config;
+  config.worker_count = 2;
+  config.fiber_count = 2;
+  Session session(config);
+  HW3D_CHECK(session.started);
+  Tree tree;
+  JobCounter root;
+  Tree* t = &tree;
+  for (int i = 0; i < 8; i++) {
+    FiberJobSystem::Get().Run([t] { Spawn(t, 3, 4); }, &root);
+  }
+  FiberJobSystem::Get().Wait(root);
+  HW3D_CHECK(tree.leaves.load() == 8 * Power(4, 3));
+}
+
+HW3D_TEST(ExternalWaitSleepsUntilDone) {
+  FiberJobSystemConfig config;
+  config.worker_count = 1;
+  Session session(config);
+  std::atomic<int> ran{0};
+  JobCounter counter;
+  std::atomic<int>* r = &ran;
+  for (int i = 0; i < 100; i++) {
+    FiberJobSystem::Get().Run([r] { r->fetch_add(1); }, &counter);
+  }
+  FiberJobSystem::Get().Wait(counter);
+  HW3D_CHECK(ran.load() == 100);
+  HW3D_CHECK(counter.IsDone());
+}
@@ -0,0 +1,269 @@
+﻿#include "hw3d/flight_recorder.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+using hw3d::FlightRecorder;
+using hw3d::FlightRecorderConfig;
+using Kind = FlightRecorder::InputKind;
+
+constexpr const char* kReportPath = "flight_recorder_test.txt";
+constexpr const char* kRingPath = "flight_recorder_test.bin";
+
+std::string ReadFile(const char* path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>());
+}
+
+std::string Dump() {
+  HW3D_CHECK(FlightRecorder::Get().DumpText(kReportPath));
+  std::string text = ReadFile(kReportPath);
+  std::remove(kReportPath);
+  return text;
+}
+
+// Runs FlightRecorder::DecodeFile; the report is empty if it fails.
+std::pair<bool, std::string> Decode(const char* path) {
+  std::FILE* out = std::fopen(kReportPath, "w");
+  HW3D_CHECK(out != nullptr);
+  const bool ok = FlightRecorder::DecodeFile(path, out);
+  std::fclose(out);
+  std::string text = ReadFile(kReportPath);
+  std::remove(kReportPath);
+  return {ok, ok ? text : std::string()};
+}
+
+// The lines of the report section that starts with `title`, title line
+// included.
+std::vector<std::string> Section(const std::string& report,
+                                 const std::string& title) {
+  std::vector<std::string> lines;
+  std::istringstream in(report.substr(report.find("\n" + title) + 1));
+  for (std::string line; std::getline(in, line) && !line.empty();) {
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+struct Input {
+  unsigned long long frame;
+  unsigned code;
+  int x;
+  int y;
+};
+
+Input ParseInput(const std::string& line) {
+  Input input{};
+  // the kind name may contain a space, so skip to "code"
+  HW3D_CHECK(std::sscanf(line.c_str(), "frame %llu", &input.frame) == 1);
+  HW3D_CHECK(std::sscanf(line.c_str() + line.find("code"),
+                         "code %u at (%d, %d)", &input.code, &input.x,
+                         &input.y) == 3);
+  return input;
+}
+
+FlightRecorderConfig SmallConfig(std::uint32_t frames,
+                                 std::uint32_t inputs,
+                                 std::uint32_t errors) {
+  FlightRecorderConfig config;
+  config.frame_capacity = frames;
+  config.input_capacity = inputs;
+  config.error_capacity = errors;
+  return config;
+}
+
+}  // namespace
+
+HW3D_TEST(RingsKeepTheNewestEntries) {
+  FlightRecorder& recorder = FlightRecorder::Get();
+  HW3D_CHECK(recorder.Start(SmallConfig(4, 8, 2)));
+  HW3D_CHECK(!recorder.Start());
+  const std::string path(60, 'd');
+  for (int frame = 0; frame < 10; frame++) {
+    recorder.RecordInput(Kind::kKeyDown, frame, frame, -frame);
+    if (frame % 3 == 0) {
+      recorder.RecordError(static_cast<HRESULT>(0x887A0005), path.c_str(),
+                           frame);
+    }
+    recorder.EndFrame(0.016f);
+  }
+  const std::string report = Dump();
+  recorder.Stop();
+
+  const std::vector<std::string> frames = Section(report, "[Frames]");
+  HW3D_CHECK(frames.size() == 2 + 4);
+  HW3D_CHECK(frames[0] == "[Frames] 10 total, last 4");
+  for (int i = 0; i < 4; i++) {
+    unsigned long long index = 0;
+    HW3D_CHECK(std::sscanf(frames[2 + i].c_str(), "%llu", &index) == 1);
+    HW3D_CHECK(index == 6u + i);
+  }
+
+  const std::vector<std::string> inputs = Section(report, "[Input]");
+  HW3D_CHECK(inputs.size() == 1 + 8);
+  HW3D_CHECK(inputs[0] == "[Input] 10 total");
+  for (int i = 0; i < 8; i++) {
+    const Input input = ParseInput(inputs[1 + i]);
+    // recorded before EndFrame, so tagged with the frame it belongs to
+    HW3D_CHECK(input.frame == 2u + i && input.code == 2u + i);
+    HW3D_CHECK(input.x == 2 + i && input.y == -(2 + i));
+  }
+
+  const std::vector<std::string> errors = Section(report, "[Errors]");
+  HW3D_CHECK(errors.size() == 1 + 2);
+  HW3D_CHECK(errors[0] == "[Errors] 4 total");
+  // only the tail of the path fits
+  const std::string tail(FlightRecorder::ErrorRecord::kFileChars - 1, 'd');
+  HW3D_CHECK(errors[1].find("0x887A0005 " + tail + ":6") !=
+             std::string::npos);
+  HW3D_CHECK(errors[2].find(tail + ":9") != std::string::npos);
+}
+
+HW3D_TEST(ConcurrentWritersLoseNothingWhileTheRingHasRoom) {
+  constexpr int kThreads = 4;
+  constexpr int kPerThread = 1000;
+  FlightRecorder& recorder = FlightRecorder::Get();
+  HW3D_CHECK(recorder.Start(SmallConfig(4, kThreads * kPerThread, 64)));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&recorder, t] {
+      for (int i = 0; i < kPerThread; i++) {
+        recorder.RecordInput(Kind::kMouseMove, t, i, 0);
+        if (i % 100 == 0) {
+          recorder.RecordError(static_cast<HRESULT>(0x80004005), "job.cc", i);
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  recorder.EndFrame(0.016f);
+  const std::string report = Dump();
+  recorder.Stop();
+
+  // the frame counts every event once
+  const std::vector<std::string> frames = Section(report, "[Frames]");
+  HW3D_CHECK(frames.size() == 3);
+  HW3D_CHECK(frames[2].find(" 4000      40") != std::string::npos);
+
+  const std::vector<std::string> inputs = Section(report, "[Input]");
+  HW3D_CHECK(inputs.size() == 1 + kThreads * kPerThread);
+  std::vector<int> next(kThreads, 0);
+  for (std::size_t i = 1; i < inputs.size(); i++) {
+    const Input input = ParseInput(inputs[i]);
+    HW3D_CHECK(input.code < static_cast<unsigned>(kThreads));
+    // each writer claims slots in program order
+    HW3D_CHECK(input.x == next[input.code]);
+    next[input.code]++;
+  }
+  for (int count : next) {
+    HW3D_CHECK(count == kPerThread);
+  }
+  HW3D_CHECK(Section(report, "[Errors]").size() == 1 + kThreads * 10);
+}
+
+HW3D_TEST(ConcurrentWritersWrapAround) {
+  constexpr int kThreads = 4;
+  constexpr int kPerThread = 5000;
+  FlightRecorder& recorder = FlightRecorder::Get();
+  HW3D_CHECK(recorder.Start(SmallConfig(4, 64, 4)));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&recorder, t] {
+      for (int i = 0; i < kPerThread; i++) {
+        recorder.RecordInput(Kind::kMouseMove, t, i, i);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  const std::string report = Dump();
+  recorder.Stop();
+
+  const std::vector<std::string> inputs = Section(report, "[Input]");
+  HW3D_CHECK(inputs[0] == "[Input] 20000 total");
+  HW3D_CHECK(inputs.size() == 1 + 64);
+  // A writer that stalls between claiming a slot and filling it can land in
+  // a slot that a later lap has already reused, so entries may be stale or
+  // mix fields of two writers. Each field is still one a writer stored.
+  for (std::size_t i = 1; i < inputs.size(); i++) {
+    const Input input = ParseInput(inputs[i]);
+    HW3D_CHECK(input.code < static_cast<unsigned>(kThreads));
+    HW3D_CHECK(input.x >= 0 && input.x < kPerThread);
+    HW3D_CHECK(input.y >= 0 && input.y < kPerThread);
+  }
+}
+
+HW3D_TEST(MappedFileDecodesLikeDumpText) {
+  FlightRecorder& recorder = FlightRecorder::Get();
+  FlightRecorderConfig config = SmallConfig(8, 16, 4);
+  config.mapped_path = kRingPath;
+  HW3D_CHECK(recorder.Start(config));
+  for (int frame = 0; frame < 20; frame++) {
+    recorder.RecordInput(Kind::kResize, 0, 640 + frame, 480);
+    recorder.RecordPresent(frame == 12 ? static_cast<HRESULT>(0x887A0001)
+                                       : 0);
+    recorder.EndFrame(0.02f);
+  }
+  recorder.RecordError(static_cast<HRESULT>(0x887A0006), "graphics.cc", 42);
+  const std::string dumped = Dump();
+
+  // read while still mapped, as after a crash: nothing flushed or closed
+  const std::pair<bool, std::string> decoded = Decode(kRingPath);
+  HW3D_CHECK(decoded.first);
+  // identical except that the file does not know when it was read
+  const auto without_times = [](const std::string& report) {
+    const std::size_t first = report.find('\n');
+    return report.substr(0, report.find(" (unix seconds)")) +
+           report.substr(report.find('\n', first + 1));
+  };
+  HW3D_CHECK(without_times(decoded.second) == without_times(dumped));
+  HW3D_CHECK(decoded.second.find("dumped") == std::string::npos);
+  HW3D_CHECK(dumped.find("resize     code     0 at (659, 480)") !=
+             std::string::npos);
+  HW3D_CHECK(dumped.find("0x887A0001") != std::string::npos);
+  HW3D_CHECK(dumped.find("graphics.cc:42") != std::string::npos);
+
+  // and after a clean stop the file is left behind
+  recorder.Stop();
+  HW3D_CHECK(Decode(kRingPath).second == decoded.second);
+  std::remove(kRingPath);
+}
+
+HW3D_TEST(DecodeFileRejectsOtherFiles) {
+  HW3D_CHECK(!Decode("flight_recorder_test_missing.bin").first);
+
+  {
+    std::ofstream out(kRingPath, std::ios::binary);
+    out << std::string(4096, 'x');
+  }
+  HW3D_CHECK(!Decode(kRingPath).first);
+
+  FlightRecorderConfig config = SmallConfig(8, 16, 4);
+  config.mapped_path = kRingPath;
+  HW3D_CHECK(FlightRecorder::Get().Start(config));
+  FlightRecorder::Get().Stop();
+  std::string ring = ReadFile(kRingPath);
+  HW3D_CHECK(Decode(kRingPath).first);
+  ring.pop_back();
+  {
+    std::ofstream out(kRingPath, std::ios::binary | std::ios::trunc);
+    out << ring;
+  }
+  HW3D_CHECK(!Decode(kRingPath).first);
+  std::remove(kRingPath);
+}
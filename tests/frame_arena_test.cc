@@ -0,0 +1,132 @@
+﻿#include "hw3d/frame_arena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+using hw3d::FrameArena;
+using hw3d::ScratchScope;
+
+bool IsAligned(const void* p, std::size_t alignment) {
+  return reinterpret_cast<std::uintptr_t>(p) % alignment == 0;
+}
+
+}  // namespace
+
+HW3D_TEST(AllocationsAreAlignedAndDisjoint) {
+  FrameArena arena(4096);
+  std::vector<std::pair<std::uintptr_t, std::size_t>> ranges;
+  const std::size_t alignments[] = {1, 2, 8, 16, 64, 256};
+  for (int i = 0; i < 24; i++) {
+    const std::size_t alignment = alignments[i % 6];
+    const std::size_t size = 1 + i * 5;
+    void* p = arena.Allocate(size, alignment);
+    HW3D_CHECK(IsAligned(p, alignment));
+    ranges.push_back({reinterpret_cast<std::uintptr_t>(p), size});
+  }
+  std::sort(ranges.begin(), ranges.end());
+  for (std::size_t i = 1; i < ranges.size(); i++) {
+    HW3D_CHECK(ranges[i - 1].first + ranges[i - 1].second <=
+               ranges[i].first);
+  }
+  HW3D_CHECK(arena.stats().overflow_allocations == 0);
+}
+
+HW3D_TEST(OverflowGoesToHeapAndResetRecordsTheFrame) {
+  FrameArena arena(1024);
+  arena.Allocate(1000, 8);
+  void* big = arena.Allocate(4000, 64);
+  HW3D_CHECK(IsAligned(big, 64));
+  HW3D_CHECK(arena.stats().overflow_allocations == 1);
+  arena.Reset();
+  FrameArena::Stats stats = arena.stats();
+  HW3D_CHECK(stats.frames == 1);
+  HW3D_CHECK(stats.last_frame_bytes == 5000);
+  HW3D_CHECK(stats.peak_frame_bytes == 5000);
+  HW3D_CHECK(arena.used() == 0);
+
+  arena.Allocate(100, 4);
+  arena.Reset();
+  stats = arena.stats();
+  HW3D_CHECK(stats.frames == 2);
+  HW3D_CHECK(stats.last_frame_bytes == 100);
+  HW3D_CHECK(stats.peak_frame_bytes == 5000);
+}
+
+HW3D_TEST(ConcurrentAllocationsNeverOverlap) {
+  FrameArena arena(64 * 1024);
+  constexpr int kThreads = 4;
+  constexpr int kPerThread = 2000;
+  std::vector<std::vector<std::uintptr_t>> seen(kThreads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&arena, &seen, t] {
+      for (int i = 0; i < kPerThread; i++) {
+        // 32 bytes each: 4 * 2000 * 32 overflows the block partway through
+        seen[t].push_back(reinterpret_cast<std::uintptr_t>(
+            arena.Allocate(32, 16)));
+        if (i % 256 == 0) {
+          arena.stats();
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::vector<std::uintptr_t> all;
+  for (const auto& s : seen) {
+    all.insert(all.end(), s.begin(), s.end());
+  }
+  std::sort(all.begin(), all.end());
+  bool disjoint = true;
+  for (std::size_t i = 1; i < all.size(); i++) {
+    disjoint = disjoint && all[i - 1] + 32 <= all[i];
+  }
+  HW3D_CHECK(disjoint);
+  const FrameArena::Stats stats = arena.stats();
+  HW3D_CHECK(stats.overflow_allocations ==
+             kThreads * kPerThread - 64 * 1024 / 32);
+  arena.Reset();
+  HW3D_CHECK(arena.stats().last_frame_bytes ==
+             std::size_t{kThreads} * kPerThread * 32);
+}
+
+HW3D_TEST(PmrContainersAllocateFromTheArena) {
+  FrameArena arena(16 * 1024);
+  std::pmr::vector<int> values(arena.resource());
+  for (int i = 0; i < 1000; i++) {
+    values.push_back(i);
+  }
+  HW3D_CHECK(values[999] == 999);
+  HW3D_CHECK(arena.used() >= 1000 * sizeof(int));
+  HW3D_CHECK(arena.stats().overflow_allocations == 0);
+}
+
+HW3D_TEST(ScratchScopesRewindWhenTheyClose) {
+  void* first;
+  {
+    ScratchScope outer;
+    first = outer.Allocate(100);
+    {
+      ScratchScope inner;
+      void* nested = inner.Allocate(100);
+      HW3D_CHECK(nested != first);
+      // past the stack: heap block freed with the scope
+      void* huge = inner.Allocate(ScratchScope::kCapacity, 32);
+      HW3D_CHECK(IsAligned(huge, 32));
+    }
+    ScratchScope again;
+    void* reused = again.Allocate(100);
+    HW3D_CHECK(reused != first);
+  }
+  ScratchScope fresh;
+  HW3D_CHECK(fresh.Allocate(100) == first);
+  HW3D_CHECK(ScratchScope::stats().overflow_allocations >= 1);
+}
@@ -0,0 +1,125 @@
+﻿#include "hw3d/frame_pipeline.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+using hw3d::FramePipeline;
+
+HW3D_TEST(ClampsDepth) {
+  FramePipeline none(0, [](unsigned) {});
+  HW3D_CHECK(none.depth() == 1);
+  FramePipeline deep(100, [](unsigned) {});
+  HW3D_CHECK(deep.depth() == FramePipeline::kMaxDepth);
+  FramePipeline two(2, [](unsigned) {});
+  HW3D_CHECK(two.depth() == 2);
+}
+
+HW3D_TEST(RendersEveryFrameInOrder) {
+  for (unsigned depth : {1u, 2u, 3u, FramePipeline::kMaxDepth}) {
+    constexpr int kFrames = 200;
+    // written by the simulation, read by render: each slot is owned by one
+    // stage at a time
+    std::array<int, FramePipeline::kMaxDepth> slots{};
+    std::vector<int> rendered;
+    FramePipeline pipeline(depth, [&](unsigned slot) {
+      rendered.push_back(slots[slot]);
+    });
+    for (int frame = 0; frame < kFrames; frame++) {
+      const unsigned slot = pipeline.BeginFrame();
+      HW3D_CHECK(slot == static_cast<unsigned>(frame) % depth);
+      slots[slot] = frame;
+      pipeline.EndFrame();
+    }
+    pipeline.Flush();
+    HW3D_CHECK(rendered.size() == static_cast<std::size_t>(kFrames));
+    for (std::size_t i = 0; i < rendered.size(); i++) {
+      HW3D_CHECK(rendered[i] == static_cast<int>(i));
+    }
+    const FramePipeline::Stats stats = pipeline.stats();
+    HW3D_CHECK(stats.frames == static_cast<std::uint64_t>(kFrames));
+    HW3D_CHECK(stats.max_latency_ns * kFrames >= stats.total_latency_ns);
+  }
+}
+
+HW3D_TEST(FlushWaitsForRendering) {
+  std::atomic<int> rendered{0};
+  FramePipeline pipeline(4, [&](unsigned) {
+    rendered.fetch_add(1, std::memory_order_relaxed);
+  });
+  for (int frame = 0; frame < 3; frame++) {
+    pipeline.BeginFrame();
+    pipeline.EndFrame();
+  }
+  pipeline.Flush();
+  HW3D_CHECK(rendered.load() == 3);
+  // nothing handed over: returns at once
+  pipeline.Flush();
+  HW3D_CHECK(pipeline.stats().frames == 3);
+}
+
+HW3D_TEST(DestructorRendersHandedOverFrames) {
+  std::atomic<int> rendered{0};
+  {
+    FramePipeline pipeline(3, [&](unsigned) {
+      rendered.fetch_add(1, std::memory_order_relaxed);
+    });
+    for (int frame = 0; frame < 2; frame++) {
+      pipeline.BeginFrame();
+      pipeline.EndFrame();
+    }
+  }
+  HW3D_CHECK(rendered.load() == 2);
+}
+
+// Runs frames until one of the calls throws; returns how many frames were
+// begun, or -1 if nothing threw.
+int RunUntilThrow(FramePipeline& pipeline, int limit) {
+  for (int frame = 0; frame < limit; frame++) {
+    try {
+      pipeline.BeginFrame();
+      pipeline.EndFrame();
+    } catch (const std::runtime_error&) {
+      return frame;
+    }
+  }
+  return -1;
+}
+
+HW3D_TEST(RethrowsRenderErrors) {
+  for (unsigned depth : {1u, 2u, 4u}) {
+    int renders = 0;
+    FramePipeline pipeline(depth, [&](unsigned) {
+      if (++renders == 3) {
+        throw std::runtime_error("device lost");
+      }
+    });
+    const int thrown_at = RunUntilThrow(pipeline, 100);
+    HW3D_CHECK(thrown_at >= 2);
+    HW3D_CHECK(thrown_at <= 2 + static_cast<int>(depth));
+    // every later call rethrows instead of waiting for the lost frame
+    bool threw = false;
+    try {
+      pipeline.BeginFrame();
+    } catch (const std::runtime_error&) {
+      threw = true;
+    }
+    HW3D_CHECK(threw);
+    threw = false;
+    try {
+      pipeline.Flush();
+    } catch (const std::runtime_error&) {
+      threw = true;
+    }
+    HW3D_CHECK(threw);
+    HW3D_CHECK(renders == 3);
+  }
+}
+
+}  // namespace
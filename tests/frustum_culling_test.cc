@@ -0,0 +1,165 @@
+﻿#include "hw3d/frustum_culling.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "hw3d/job_system.h"
+#include "test.h"
+
+namespace {
+
+using hw3d::Aabb;
+using hw3d::AabbArray;
+using hw3d::BoundingSphere;
+using hw3d::Float3;
+using hw3d::Frustum;
+using hw3d::SphereArray;
+
+class Random {
+ public:
+  explicit Random(std::uint32_t seed) : state_(seed) {}
+  // Uniform in [lo, hi).
+  float Next(float lo, float hi) {
+    state_ = state_ * 1664525u + 1013904223u;
+    return lo + (hi - lo) * static_cast<float>(state_ >> 8) / 16777216.0f;
+  }
+
+ private:
+  std::uint32_t state_;
+};
+
+Frustum CameraFrustum() {
+  const hw3d::Mat4 view = hw3d::MatLookAtLH(hw3d::VecSet(0, 0, -50, 1),
+                                            hw3d::VecSet(10, 5, 0, 1),
+                                            hw3d::VecSet(0, 1, 0, 0));
+  return hw3d::FrustumFromMatrix(
+      view * hw3d::MatPerspectiveFovLH(1.0f, 16.0f / 9.0f, 0.1f, 200.0f));
+}
+
+// Volumes scattered around the frustum, so that roughly a third pass.
+void Fill(std::size_t n, std::uint32_t seed, std::vector<Aabb>* boxes,
+          std::vector<BoundingSphere>* spheres) {
+  Random random(seed);
+  boxes->resize(n);
+  spheres->resize(n);
+  for (std::size_t i = 0; i < n; i++) {
+    const Float3 c{random.Next(-200, 200), random.Next(-200, 200),
+                   random.Next(-100, 250)};
+    const Float3 e{random.Next(0, 5), random.Next(0, 5), random.Next(0, 5)};
+    (*boxes)[i] = {c - e, c + e};
+    (*spheres)[i] = {c, random.Next(0, 5)};
+  }
+}
+
+template <typename Volume>
+std::vector<std::uint32_t> Reference(const Frustum& frustum,
+                                     const std::vector<Volume>& volumes,
+                                     std::size_t begin, std::size_t end) {
+  std::vector<std::uint32_t> visible;
+  for (std::size_t i = begin; i < end; i++) {
+    if (hw3d::Intersects(frustum, volumes[i])) {
+      visible.push_back(static_cast<std::uint32_t>(i));
+    }
+  }
+  return visible;
+}
+
+struct Arrays {
+  AabbArray boxes;
+  SphereArray spheres;
+};
+
+void Load(const std::vector<Aabb>& boxes,
+          const std::vector<BoundingSphere>& spheres, Arrays* arrays) {
+  arrays->boxes.Resize(boxes.size());
+  arrays->spheres.Resize(spheres.size());
+  for (std::size_t i = 0; i < boxes.size(); i++) {
+    arrays->boxes.Set(i, boxes[i]);
+    arrays->spheres.Set(i, spheres[i]);
+  }
+}
+
+bool Matches(const std::vector<std::uint32_t>& expected,
+             const std::vector<std::uint32_t>& visible, std::size_t count) {
+  return count == expected.size() &&
+         std::equal(expected.begin(), expected.end(), visible.begin());
+}
+
+}  // namespace
+
+HW3D_TEST(BatchesMatchScalarReferenceOnOddRanges) {
+  const Frustum frustum = CameraFrustum();
+  std::vector<Aabb> boxes;
+  std::vector<BoundingSphere> spheres;
+  Fill(1000, 1, &boxes, &spheres);
+  Arrays arrays;
+  Load(boxes, spheres, &arrays);
+  // ranges that start and end off every batch width
+  const std::size_t ranges[][2] = {
+      {0, 1000}, {0, 0}, {3, 4}, {1, 16}, {5, 38}, {17, 999}, {993, 1000}};
+  std::vector<std::uint32_t> visible(1000);
+  for (const auto& range : ranges) {
+    std::size_t count = hw3d::CullAabbs(frustum, arrays.boxes, range[0],
+                                        range[1], visible.data());
+    HW3D_CHECK(Matches(Reference(frustum, boxes, range[0], range[1]),
+                       visible, count));
+    count = hw3d::CullSpheres(frustum, arrays.spheres, range[0], range[1],
+                              visible.data());
+    HW3D_CHECK(Matches(Reference(frustum, spheres, range[0], range[1]),
+                       visible, count));
+  }
+  const std::size_t all = Reference(frustum, boxes, 0, 1000).size();
+  HW3D_CHECK(all > 100 && all < 900);
+}
+
+HW3D_TEST(NanVolumesCountAsVisible) {
+  const Frustum frustum = CameraFrustum();
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  std::vector<Aabb> boxes;
+  std::vector<BoundingSphere> spheres;
+  Fill(40, 2, &boxes, &spheres);
+  // far behind the camera: culled unless the NaN keeps them
+  for (std::size_t i = 0; i < 40; i++) {
+    boxes[i] = {{-1, -1, -1000}, {1, 1, -999}};
+    spheres[i] = {{0, 0, -1000}, 1};
+  }
+  boxes[7].min.x = nan;
+  boxes[30].max.z = nan;
+  spheres[9].center.y = nan;
+  spheres[31].radius = nan;
+  Arrays arrays;
+  Load(boxes, spheres, &arrays);
+  std::vector<std::uint32_t> visible(40);
+  std::size_t count =
+      hw3d::CullAabbs(frustum, arrays.boxes, 0, 40, visible.data());
+  HW3D_CHECK(count == 2 && visible[0] == 7 && visible[1] == 30);
+  count = hw3d::CullSpheres(frustum, arrays.spheres, 0, 40, visible.data());
+  HW3D_CHECK(count == 2 && visible[0] == 9 && visible[1] == 31);
+}
+
+HW3D_TEST(ParallelCullerMatchesSerial) {
+  const Frustum frustum = CameraFrustum();
+  std::vector<Aabb> boxes;
+  std::vector<BoundingSphere> spheres;
+  constexpr std::size_t kCount = 300001;
+  Fill(kCount, 3, &boxes, &spheres);
+  Arrays arrays;
+  Load(boxes, spheres, &arrays);
+  const std::vector<std::uint32_t> expected_boxes =
+      Reference(frustum, boxes, 0, kCount);
+  const std::vector<std::uint32_t> expected_spheres =
+      Reference(frustum, spheres, 0, kCount);
+
+  hw3d::JobSystemSession session(4);
+  hw3d::FrustumCuller culler;
+  std::vector<std::uint32_t> visible(kCount);
+  // the first runs measure the cost; later ones split by it
+  for (int run = 0; run < 3; run++) {
+    std::size_t count = culler.Cull(frustum, arrays.boxes, visible.data());
+    HW3D_CHECK(Matches(expected_boxes, visible, count));
+    count = culler.Cull(frustum, arrays.spheres, visible.data());
+    HW3D_CHECK(Matches(expected_spheres, visible, count));
+  }
+}
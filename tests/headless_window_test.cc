@@ -0,0 +1,239 @@
+﻿#include "hw3d/headless_window.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+using hw3d::HeadlessWindow;
+using hw3d::InputEvent;
+using hw3d::Keyboard;
+using hw3d::Mouse;
+using hw3d::PumpMode;
+using hw3d::ScriptedEventSource;
+using Type = InputEvent::Type;
+
+InputEvent Key(Type type, int code, bool repeat = false) {
+  InputEvent event;
+  event.type = type;
+  event.code = code;
+  event.repeat = repeat;
+  return event;
+}
+
+InputEvent At(Type type, int x, int y, bool buttons_held = false) {
+  InputEvent event;
+  event.type = type;
+  event.x = x;
+  event.y = y;
+  event.buttons_held = buttons_held;
+  return event;
+}
+
+InputEvent Wheel(int x, int y, int delta) {
+  InputEvent event = At(Type::kWheel, x, y);
+  event.code = delta;
+  return event;
+}
+
+// Pumps until the window quits and returns the exit code, or nullopt if it
+// is still running after ten seconds. Yields between pumps like a frame loop
+// would, so the source thread gets to run on a single core.
+std::optional<int> RunToQuit(HeadlessWindow& window) {
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (const std::optional<int> code = window.PumpMessages()) {
+      return code;
+    }
+    std::this_thread::yield();
+  }
+  return std::nullopt;
+}
+
+std::vector<Mouse::Event::Type> ReadMouse(Mouse& mouse) {
+  std::vector<Mouse::Event::Type> types;
+  while (!mouse.IsEmpty()) {
+    types.push_back(mouse.Read().GetType());
+  }
+  return types;
+}
+
+// The script of the dedicated-thread test: keys, then mouse, then a resize.
+std::unique_ptr<ScriptedEventSource> FullScript() {
+  auto script = std::make_unique<ScriptedEventSource>();
+  script->At(0, Key(Type::kKeyDown, 'W'))
+      .At(0, Key(Type::kChar, 'w'))
+      .At(1, At(Type::kMouseMove, 10, 10))
+      .At(1, At(Type::kRightDown, 10, 10))
+      .At(2, Key(Type::kKeyDown, 'Q'))
+      .At(2, Key(Type::kKeyUp, 'W'))
+      .At(3, At(Type::kResize, 32, 16))
+      .At(3, At(Type::kMouseMove, 20, 8))
+      .QuitAt(5, 7);
+  return script;
+}
+
+}  // namespace
+
+HW3D_TEST(KeysReachTheKeyboard) {
+  auto script = std::make_unique<ScriptedEventSource>();
+  script->At(0, Key(Type::kKeyDown, 'A'))
+      .At(1, Key(Type::kKeyDown, 'A', true))
+      .At(1, Key(Type::kChar, 'a'))
+      .At(2, Key(Type::kKeyDown, 'B'))
+      .At(3, Key(Type::kKeyUp, 'A'))
+      .At(4, Key(Type::kFocusLost, 0));
+  HeadlessWindow window(64, 48, std::move(script));
+  Keyboard& kbd = window.kbd();
+
+  HW3D_CHECK(!window.PumpMessages());
+  HW3D_CHECK(window.frame() == 1);
+  HW3D_CHECK(kbd.KeyIsPressed('A'));
+  window.PumpMessages();
+  window.PumpMessages();
+  HW3D_CHECK(kbd.KeyIsPressed('A') && kbd.KeyIsPressed('B'));
+  window.PumpMessages();
+  HW3D_CHECK(!kbd.KeyIsPressed('A') && kbd.KeyIsPressed('B'));
+  // losing focus releases everything
+  window.PumpMessages();
+  HW3D_CHECK(!kbd.KeyIsPressed('B'));
+
+  // the autorepeat was filtered out
+  const Keyboard::Event first = kbd.ReadKey();
+  HW3D_CHECK(first.IsPress() && first.GetCode() == 'A');
+  const Keyboard::Event second = kbd.ReadKey();
+  HW3D_CHECK(second.IsPress() && second.GetCode() == 'B');
+  const Keyboard::Event third = kbd.ReadKey();
+  HW3D_CHECK(third.IsRelease() && third.GetCode() == 'A');
+  HW3D_CHECK(kbd.KeyIsEmpty());
+  HW3D_CHECK(kbd.ReadChar() == 'a');
+  HW3D_CHECK(kbd.CharIsEmpty());
+}
+
+HW3D_TEST(MouseEntersDragsAndLeaves) {
+  auto script = std::make_unique<ScriptedEventSource>();
+  script->At(0, At(Type::kMouseMove, 5, 6))
+      .At(1, At(Type::kLeftDown, 5, 6))
+      // dragged outside: still held, so still in the window
+      .At(2, At(Type::kMouseMove, 100, 6, true))
+      .At(3, At(Type::kLeftUp, 100, 6))
+      .At(4, At(Type::kMouseMove, 101, 6))
+      .At(5, At(Type::kMouseMove, 7, 8))
+      .At(5, Wheel(7, 8, 120));
+  HeadlessWindow window(64, 48, std::move(script));
+  Mouse& mouse = window.mouse();
+  using MouseType = Mouse::Event::Type;
+
+  window.PumpMessages();
+  HW3D_CHECK(mouse.IsInWindow());
+  HW3D_CHECK(mouse.GetPosX() == 5 && mouse.GetPosY() == 6);
+  window.PumpMessages();
+  HW3D_CHECK(mouse.LeftIsPressed());
+  window.PumpMessages();
+  HW3D_CHECK(mouse.IsInWindow());
+  HW3D_CHECK(mouse.GetPosX() == 100);
+  window.PumpMessages();
+  HW3D_CHECK(!mouse.LeftIsPressed());
+  window.PumpMessages();
+  HW3D_CHECK(!mouse.IsInWindow());
+  window.PumpMessages();
+  HW3D_CHECK(mouse.IsInWindow());
+  HW3D_CHECK(mouse.GetPosX() == 7 && mouse.GetPosY() == 8);
+
+  const std::vector<MouseType> expected = {
+      MouseType::Move,     MouseType::Enter, MouseType::LPress,
+      MouseType::Move,     MouseType::LRelease, MouseType::Leave,
+      MouseType::Move,     MouseType::Enter, MouseType::WheelUp};
+  HW3D_CHECK(ReadMouse(mouse) == expected);
+}
+
+HW3D_TEST(ResizeChangesTheSurfaceAndClientArea) {
+  auto script = std::make_unique<ScriptedEventSource>();
+  script->At(0, At(Type::kMouseMove, 100, 10))
+      .At(1, At(Type::kResize, 200, 100))
+      .At(2, At(Type::kMouseMove, 100, 10))
+      .At(3, At(Type::kResize, 20, 20))
+      .At(4, At(Type::kMouseMove, 30, 10));
+  HeadlessWindow window(64, 48, std::move(script));
+  hw3d::OffscreenSurface& surface = window.offscreen();
+  HW3D_CHECK(surface.width() == 64 && surface.height() == 48);
+
+  window.PumpMessages();
+  HW3D_CHECK(!window.mouse().IsInWindow());
+  window.PumpMessages();
+  HW3D_CHECK(surface.width() == 200 && surface.height() == 100);
+  // the same point is inside now
+  window.PumpMessages();
+  HW3D_CHECK(window.mouse().IsInWindow());
+
+  window.surface().ClearBuffer(1.0f, 0.5f, 0.0f);
+  window.surface().Present();
+  HW3D_CHECK(surface.present_count() == 1);
+  // RGBA in memory order
+  const std::uint32_t orange = 0xFF0080FFu;
+  HW3D_CHECK(surface.pixels()[0] == orange);
+  HW3D_CHECK(surface.pixels()[200 * 100 - 1] == orange);
+
+  window.PumpMessages();
+  HW3D_CHECK(surface.width() == 20 && surface.height() == 20);
+  window.PumpMessages();
+  HW3D_CHECK(!window.mouse().IsInWindow());
+  HW3D_CHECK(!window.PumpMessages());
+}
+
+HW3D_TEST(EmptyResizeEndsTheRun) {
+  auto script = std::make_unique<ScriptedEventSource>();
+  script->At(2, At(Type::kResize, 0, 10));
+  HeadlessWindow window(64, 48, std::move(script));
+  HW3D_CHECK(!window.PumpMessages());
+  HW3D_CHECK(!window.PumpMessages());
+  HW3D_CHECK(window.PumpMessages() == -1);
+  HW3D_CHECK(window.offscreen().width() == 64);
+}
+
+HW3D_TEST(QuitAtReturnsTheExitCodeFromThenOn) {
+  auto script = std::make_unique<ScriptedEventSource>();
+  script->At(2, Key(Type::kKeyDown, 'X')).QuitAt(2, 3);
+  HeadlessWindow window(8, 8, std::move(script));
+  window.SetTitle("headless");
+  HW3D_CHECK(window.title() == "headless");
+  HW3D_CHECK(!window.PumpMessages());
+  HW3D_CHECK(!window.PumpMessages());
+  // the events of the last frame are still delivered
+  HW3D_CHECK(window.PumpMessages() == 3);
+  HW3D_CHECK(window.kbd().KeyIsPressed('X'));
+  HW3D_CHECK(window.PumpMessages() == 3);
+  HW3D_CHECK(window.frame() == 3);
+}
+
+HW3D_TEST(DedicatedThreadDeliversTheSameInput) {
+  for (const PumpMode mode :
+       {PumpMode::kCallerThread, PumpMode::kDedicatedThread}) {
+    HeadlessWindow window(64, 48, FullScript(), mode);
+    HW3D_CHECK(RunToQuit(window) == 7);
+    Keyboard& kbd = window.kbd();
+    HW3D_CHECK(kbd.KeyIsPressed('Q') && !kbd.KeyIsPressed('W'));
+    HW3D_CHECK(kbd.ReadChar() == 'w');
+    Mouse& mouse = window.mouse();
+    HW3D_CHECK(mouse.RightIsPressed());
+    // (20, 8) is outside the 32x16 client area only if the resize was lost
+    HW3D_CHECK(mouse.IsInWindow());
+    HW3D_CHECK(mouse.GetPosX() == 20 && mouse.GetPosY() == 8);
+    HW3D_CHECK(window.offscreen().width() == 32);
+    HW3D_CHECK(window.offscreen().height() == 16);
+    const hw3d::InputChannel::Stats stats = window.input_stats();
+    if (mode == PumpMode::kDedicatedThread) {
+      HW3D_CHECK(stats.delivered == 8);
+      HW3D_CHECK(stats.dropped == 0);
+    } else {
+      HW3D_CHECK(stats.delivered == 0);
+    }
+  }
+}
@@ -0,0 +1,154 @@
+﻿#include "hw3d/input_channel.h"
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+using hw3d::InputChannel;
+using hw3d::InputEvent;
+
+using Type = InputEvent::Type;
+
+InputEvent Make(Type type, int code = 0, int x = 0) {
+  InputEvent event;
+  event.type = type;
+  event.code = code;
+  event.x = x;
+  return event;
+}
+
+// Fills the queue with mouse moves, so the next push spills.
+void Fill(InputChannel& channel) {
+  for (std::size_t i = 0; i < InputChannel::kCapacity; i++) {
+    HW3D_CHECK(channel.Push(Make(Type::kMouseMove, 0, -1)));
+  }
+}
+
+// Drains and flushes until nothing is held; returns the events past the
+// filler moves.
+std::vector<InputEvent> DrainAll(InputChannel& channel,
+                                 std::optional<int>* exit_code = nullptr) {
+  std::vector<InputEvent> events;
+  std::optional<int> code;
+  for (;;) {
+    code = channel.Drain([&](const InputEvent& event) {
+      if (event.x != -1) {
+        events.push_back(event);
+      }
+    });
+    if (channel.Flush()) {
+      break;
+    }
+  }
+  code = channel.Drain([&](const InputEvent& event) {
+    events.push_back(event);
+  });
+  if (exit_code != nullptr) {
+    *exit_code = code;
+  }
+  return events;
+}
+
+HW3D_TEST(DeliversInOrder) {
+  InputChannel channel;
+  HW3D_CHECK(channel.Push(Make(Type::kKeyDown, 'A')));
+  HW3D_CHECK(channel.TryPush(Make(Type::kChar, 'a')));
+  HW3D_CHECK(channel.Push(Make(Type::kKeyUp, 'A')));
+  std::vector<InputEvent> events;
+  const std::optional<int> code = channel.Drain(
+      [&](const InputEvent& event) { events.push_back(event); });
+  HW3D_CHECK(!code);
+  HW3D_CHECK(events.size() == 3);
+  HW3D_CHECK(events[0].type == Type::kKeyDown && events[0].code == 'A');
+  HW3D_CHECK(events[1].type == Type::kChar);
+  HW3D_CHECK(events[2].type == Type::kKeyUp);
+  HW3D_CHECK(channel.stats().delivered == 3);
+  HW3D_CHECK(channel.stats().dropped == 0);
+}
+
+HW3D_TEST(KeepsTransitionsBehindAFullQueue) {
+  InputChannel channel;
+  Fill(channel);
+  HW3D_CHECK(!channel.TryPush(Make(Type::kKeyDown, 'B')));
+  HW3D_CHECK(channel.Push(Make(Type::kKeyDown, 'A')));
+  for (int i = 0; i < 5000; i++) {
+    HW3D_CHECK(channel.Push(Make(Type::kMouseMove, 0, i)));
+  }
+  HW3D_CHECK(channel.Push(Make(Type::kKeyUp, 'A')));
+  HW3D_CHECK(channel.Push(Make(Type::kLeftDown)));
+  for (int i = 0; i < 1000; i++) {
+    HW3D_CHECK(channel.Push(Make(Type::kMouseMove, 0, i)));
+  }
+  HW3D_CHECK(channel.Push(Make(Type::kLeftUp)));
+  // a held event keeps TryPush from overtaking it
+  HW3D_CHECK(!channel.TryPush(Make(Type::kChar, 'x')));
+
+  const std::vector<InputEvent> events = DrainAll(channel);
+  HW3D_CHECK(events.size() == 6);
+  if (events.size() == 6) {
+    HW3D_CHECK(events[0].type == Type::kKeyDown && events[0].code == 'A');
+    HW3D_CHECK(events[1].type == Type::kMouseMove && events[1].x == 4999);
+    HW3D_CHECK(events[2].type == Type::kKeyUp && events[2].code == 'A');
+    HW3D_CHECK(events[3].type == Type::kLeftDown);
+    HW3D_CHECK(events[4].type == Type::kMouseMove && events[4].x == 999);
+    HW3D_CHECK(events[5].type == Type::kLeftUp);
+  }
+  HW3D_CHECK(channel.stats().dropped == 0);
+  HW3D_CHECK(channel.stats().coalesced == 4999 + 999);
+}
+
+HW3D_TEST(DropsDetailBeforeTransitions) {
+  InputChannel channel;
+  Fill(channel);
+  constexpr std::size_t kHalf = InputChannel::kOverflowCapacity / 2;
+  std::size_t kept = 0;
+  for (std::size_t i = 0; i < kHalf + 10; i++) {
+    kept += channel.Push(Make(Type::kChar, 'c')) ? 1 : 0;
+  }
+  HW3D_CHECK(kept == kHalf);
+  // autorepeat is detail too
+  InputEvent repeat = Make(Type::kKeyDown, 'R');
+  repeat.repeat = true;
+  HW3D_CHECK(!channel.Push(repeat));
+  for (std::size_t i = 0; i < kHalf; i++) {
+    HW3D_CHECK(channel.Push(Make(i % 2 == 0 ? Type::kKeyDown : Type::kKeyUp,
+                                 static_cast<int>(i / 2))));
+  }
+  // only a full overflow drops a transition
+  HW3D_CHECK(!channel.Push(Make(Type::kRightDown)));
+  HW3D_CHECK(channel.stats().dropped == 10 + 1 + 1);
+
+  const std::vector<InputEvent> events = DrainAll(channel);
+  HW3D_CHECK(events.size() == 2 * kHalf);
+  for (std::size_t i = 0; i < events.size() && i < 2 * kHalf; i++) {
+    if (i < kHalf) {
+      HW3D_CHECK(events[i].type == Type::kChar);
+    } else {
+      const std::size_t k = i - kHalf;
+      HW3D_CHECK(events[i].code == static_cast<int>(k / 2));
+      HW3D_CHECK(events[i].type ==
+                 (k % 2 == 0 ? Type::kKeyDown : Type::kKeyUp));
+    }
+  }
+}
+
+HW3D_TEST(QuitWaitsForHeldEvents) {
+  InputChannel channel;
+  Fill(channel);
+  HW3D_CHECK(channel.Push(Make(Type::kKeyUp, 'Q')));
+  channel.RequestQuit(7);
+  std::size_t drained = 0;
+  std::optional<int> code =
+      channel.Drain([&](const InputEvent&) { drained++; });
+  HW3D_CHECK(drained == InputChannel::kCapacity);
+  HW3D_CHECK(!code);
+  const std::vector<InputEvent> events = DrainAll(channel, &code);
+  HW3D_CHECK(events.size() == 1);
+  HW3D_CHECK(code && *code == 7);
+}
+
+}  // namespace
@@ -0,0 +1,234 @@
+﻿#include "hw3d/lod_selector.h"
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+#include "test.h"
+
+namespace {
+
+using hw3d::BoundingSphere;
+using hw3d::Float3;
+using hw3d::LodSelector;
+using hw3d::LodSelectorConfig;
+using hw3d::LodView;
+using hw3d::SphereArray;
+
+// errors 0, 1 and 4 world units: with pixel_scale 100 and a 1 pixel
+// allowance, level 1 fits from distance 100 on and level 2 from 400
+constexpr float kErrors[] = {0.0f, 1.0f, 4.0f};
+
+LodView ViewAt(float z) {
+  LodView view;
+  view.eye = Float3{0, 0, z};
+  view.pixel_scale = 100.0f;
+  view.max_error_pixels = 1.0f;
+  return view;
+}
+
+std::size_t InstanceCount(const LodSelector& lod, std::uint32_t mesh) {
+  std::size_t count = 0;
+  for (std::uint32_t level = 0; level < lod.level_count(mesh); level++) {
+    count += lod.instances(mesh, level).size();
+  }
+  return count;
+}
+
+bool Throws(LodSelector& lod, const LodView& view, const SphereArray& s) {
+  try {
+    lod.Update(view, s);
+  } catch (const std::invalid_argument&) {
+    return true;
+  }
+  return false;
+}
+
+HW3D_TEST(ChoosesLevelByDistance) {
+  LodSelector lod;
+  const std::uint32_t mesh = lod.AddMesh(kErrors, 3);
+  SphereArray spheres;
+  spheres.Resize(3);
+  spheres.Set(0, BoundingSphere{{0, 0, 0}, 1});
+  spheres.Set(1, BoundingSphere{{0, 0, 200}, 1});
+  spheres.Set(2, BoundingSphere{{0, 0, 1000}, 1});
+  lod.Resize(3);
+  for (std::uint32_t i = 0; i < 3; i++) {
+    HW3D_CHECK(lod.level(i) == LodSelector::kNoLevel);
+    lod.SetMesh(i, mesh);
+  }
+  lod.Update(ViewAt(-10), spheres);
+  HW3D_CHECK(lod.level(0) == 0);
+  HW3D_CHECK(lod.level(1) == 1);
+  HW3D_CHECK(lod.level(2) == 2);
+  HW3D_CHECK(lod.stats().switched == 3);
+  for (std::uint32_t level = 0; level < 3; level++) {
+    HW3D_CHECK(lod.instances(mesh, level).size() == 1);
+    HW3D_CHECK(lod.instances(mesh, level)[0] == level);
+  }
+  HW3D_CHECK(lod.changed_batches().size() == 3);
+}
+
+HW3D_TEST(NeverPicksPastTheLastLevel) {
+  // A tiny pixel_scale or a huge distance makes the allowance overflow to
+  // infinity, which the padding past a mesh's last level also fits.
+  LodSelectorConfig config;
+  config.coarsen_delay = 0;
+  LodSelector lod(config);
+  const std::uint32_t two = lod.AddMesh(kErrors, 2);
+  const std::uint32_t three = lod.AddMesh(kErrors, 3);
+  SphereArray spheres;
+  spheres.Resize(4);
+  spheres.Set(0, BoundingSphere{{0, 0, 1e30f}, 1});
+  spheres.Set(1, BoundingSphere{{0, 0, 1e30f}, 1});
+  spheres.Set(2, BoundingSphere{{0, 0, 10}, 1});
+  spheres.Set(3, BoundingSphere{{0, 0, 10}, 1});
+  lod.Resize(4);
+  lod.SetMesh(0, two);
+  lod.SetMesh(1, three);
+  lod.SetMesh(2, two);
+  lod.SetMesh(3, three);
+  LodView view = ViewAt(0);
+  view.pixel_scale = 1e-30f;
+  for (int frame = 0; frame < 3; frame++) {
+    lod.Update(view, spheres);
+    HW3D_CHECK(lod.level(0) == 1);
+    HW3D_CHECK(lod.level(1) == 2);
+    HW3D_CHECK(lod.level(2) == 1);
+    HW3D_CHECK(lod.level(3) == 2);
+    HW3D_CHECK(InstanceCount(lod, two) == 2);
+    HW3D_CHECK(InstanceCount(lod, three) == 2);
+  }
+}
+
+HW3D_TEST(RejectsBadViews) {
+  LodSelector lod;
+  const std::uint32_t mesh = lod.AddMesh(kErrors, 2);
+  SphereArray spheres;
+  spheres.Resize(1);
+  spheres.Set(0, BoundingSphere{{0, 0, 10}, 1});
+  lod.Resize(1);
+  lod.SetMesh(0, mesh);
+  const float inf = std::numeric_limits<float>::infinity();
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  for (float bad : {inf, nan, -1.0f}) {
+    LodView view = ViewAt(0);
+    view.max_error_pixels = bad;
+    HW3D_CHECK(Throws(lod, view, spheres));
+  }
+  for (float bad : {inf, nan, 0.0f, -1.0f}) {
+    LodView view = ViewAt(0);
+    view.pixel_scale = bad;
+    HW3D_CHECK(Throws(lod, view, spheres));
+  }
+  HW3D_CHECK(lod.level(0) == LodSelector::kNoLevel);
+  HW3D_CHECK(!Throws(lod, ViewAt(0), spheres));
+  HW3D_CHECK(lod.level(0) == 0);
+}
+
+HW3D_TEST(CoarsensLateAndRefinesAtOnce) {
+  LodSelectorConfig config;
+  config.hysteresis = 0.2f;
+  config.coarsen_delay = 4;
+  LodSelector lod(config);
+  const std::uint32_t mesh = lod.AddMesh(kErrors, 3);
+  SphereArray spheres;
+  spheres.Resize(1);
+  spheres.Set(0, BoundingSphere{{0, 0, 0}, 1});
+  lod.Resize(1);
+  lod.SetMesh(0, mesh);
+  lod.Update(ViewAt(-50), spheres);
+  HW3D_CHECK(lod.level(0) == 0);
+  // Level 1 fits from 101 units on, but with hysteresis only from about
+  // 126, and only once the object has kept level 0 for 4 frames.
+  lod.Update(ViewAt(-110), spheres);
+  HW3D_CHECK(lod.level(0) == 0);
+  for (int frame = 0; frame < 4; frame++) {
+    lod.Update(ViewAt(-130), spheres);
+  }
+  HW3D_CHECK(lod.level(0) == 1);
+  HW3D_CHECK(lod.stats().switched == 1);
+  // Moving back in takes the finer level on the next frame.
+  lod.Update(ViewAt(-90), spheres);
+  HW3D_CHECK(lod.level(0) == 0);
+  HW3D_CHECK(lod.instances(mesh, 0).size() == 1);
+  HW3D_CHECK(lod.instances(mesh, 1).empty());
+}
+
+HW3D_TEST(ReportsEachChangedBatchOnce) {
+  LodSelector lod;
+  const std::uint32_t mesh = lod.AddMesh(kErrors, 3);
+  SphereArray spheres;
+  spheres.Resize(8);
+  lod.Resize(8);
+  for (std::uint32_t i = 0; i < 8; i++) {
+    spheres.Set(i, BoundingSphere{{0, 0, 1000}, 1});
+    lod.SetMesh(i, mesh);
+  }
+  lod.Update(ViewAt(0), spheres);
+  HW3D_CHECK(lod.changed_batches().size() == 1);
+  HW3D_CHECK(lod.changed_batches()[0].mesh == mesh);
+  HW3D_CHECK(lod.changed_batches()[0].level == 2);
+  lod.ClearChangedBatches();
+  lod.Update(ViewAt(0), spheres);
+  HW3D_CHECK(lod.changed_batches().empty());
+  // all eight move from level 2 to level 0
+  lod.Update(ViewAt(1000), spheres);
+  HW3D_CHECK(lod.stats().switched == 8);
+  HW3D_CHECK(lod.changed_batches().size() == 2);
+}
+
+HW3D_TEST(ResizeAndSetMeshLeaveLists) {
+  LodSelector lod;
+  const std::uint32_t mesh = lod.AddMesh(kErrors, 3);
+  SphereArray spheres;
+  spheres.Resize(4);
+  lod.Resize(4);
+  for (std::uint32_t i = 0; i < 4; i++) {
+    spheres.Set(i, BoundingSphere{{0, 0, 0}, 1});
+    lod.SetMesh(i, mesh);
+  }
+  lod.Update(ViewAt(0), spheres);
+  HW3D_CHECK(lod.instances(mesh, 0).size() == 4);
+  lod.SetMesh(1, LodSelector::kNoMesh);
+  HW3D_CHECK(lod.level(1) == LodSelector::kNoLevel);
+  HW3D_CHECK(lod.instances(mesh, 0).size() == 3);
+  lod.Resize(2);
+  HW3D_CHECK(lod.size() == 2);
+  HW3D_CHECK(lod.instances(mesh, 0).size() == 1);
+  HW3D_CHECK(lod.instances(mesh, 0)[0] == 0);
+  lod.Resize(3);
+  HW3D_CHECK(lod.level(2) == LodSelector::kNoLevel);
+  lod.Update(ViewAt(0), spheres);
+  HW3D_CHECK(InstanceCount(lod, mesh) == 1);
+}
+
+HW3D_TEST(RejectsBadMeshes) {
+  LodSelector lod;
+  const float decreasing[] = {0.0f, 2.0f, 1.0f};
+  const float many[LodSelector::kMaxLevels + 1] = {};
+  bool threw = false;
+  try {
+    lod.AddMesh(kErrors, 0);
+  } catch (const std::invalid_argument&) {
+    threw = true;
+  }
+  HW3D_CHECK(threw);
+  threw = false;
+  try {
+    lod.AddMesh(many, LodSelector::kMaxLevels + 1);
+  } catch (const std::invalid_argument&) {
+    threw = true;
+  }
+  HW3D_CHECK(threw);
+  threw = false;
+  try {
+    lod.AddMesh(decreasing, 3);
+  } catch (const std::invalid_argument&) {
+    threw = true;
+  }
+  HW3D_CHECK(threw);
+  HW3D_CHECK(lod.AddMesh(many, LodSelector::kMaxLevels) == 0);
+}
+
+}  // namespace
@@ -0,0 +1,123 @@
+﻿#include "hw3d/log.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "hw3d/log_decoder.h"
+#include "test.h"
+
+namespace {
+
+using hw3d::DecodeLog;
+using hw3d::Logger;
+using hw3d::LogLevel;
+
+constexpr const char* kPath = "log_test.bin";
+
+enum class Color : std::uint8_t { kRed = 3 };
+
+// Runs `body` with the logger writing to kPath and returns the decoded text.
+template <typename Body>
+std::string LogAndDecode(Body&& body) {
+  Logger& logger = Logger::Get();
+  HW3D_CHECK(logger.Start(kPath));
+  logger.SetMinLevel(LogLevel::kInfo);
+  body();
+  logger.Stop();
+  std::ifstream in(kPath, std::ios::binary);
+  std::ostringstream out;
+  HW3D_CHECK(DecodeLog(in, out));
+  in.close();
+  std::remove(kPath);
+  return out.str();
+}
+
+// True if some record's message (the text after "file:line ") is `message`.
+bool HasMessage(const std::string& text, std::string_view message) {
+  std::string needle = " ";
+  needle += message;
+  needle += '\n';
+  std::size_t at = 0;
+  while ((at = text.find(needle, at)) != std::string::npos) {
+    const std::size_t line_start = text.rfind('\n', at) + 1;
+    if (text.find("log_test.cc:", line_start) < at) {
+      return true;
+    }
+    at++;
+  }
+  return false;
+}
+
+HW3D_TEST(RoundTripsEveryArgumentType) {
+  const std::string text = LogAndDecode([] {
+    const std::string owned = "owned";
+    HW3D_LOG(LogLevel::kInfo, "ints {} {} {:x}", -42, 7u, 0xBEEFu);
+    HW3D_LOG(LogLevel::kWarning, "double {} bool {} {}", 0.5, true, false);
+    HW3D_LOG(LogLevel::kError, "strings {} {} {}", "literal",
+             std::string_view("view"), owned);
+    HW3D_LOG(LogLevel::kInfo, "enum {} braces {{}} none", Color::kRed);
+  });
+  HW3D_CHECK(text.rfind("# hw3d log", 0) == 0);
+  HW3D_CHECK(HasMessage(text, "ints -42 7 0xBEEF"));
+  HW3D_CHECK(HasMessage(text, "double 0.5 bool true false"));
+  HW3D_CHECK(HasMessage(text, "strings literal view owned"));
+  HW3D_CHECK(HasMessage(text, "enum 3 braces {} none"));
+  HW3D_CHECK(text.find(" WARN  T") != std::string::npos);
+  HW3D_CHECK(text.find(" ERROR T") != std::string::npos);
+}
+
+HW3D_TEST(SkipsRecordsBelowMinLevel) {
+  const std::string text = LogAndDecode([] {
+    HW3D_LOG(LogLevel::kDebug, "hidden {}", 1);
+    Logger::Get().SetMinLevel(LogLevel::kDebug);
+    HW3D_LOG(LogLevel::kDebug, "shown {}", 2);
+  });
+  HW3D_CHECK(text.find("hidden") == std::string::npos);
+  HW3D_CHECK(HasMessage(text, "shown 2"));
+}
+
+HW3D_TEST(TruncatesAtFirstMissingArgument) {
+  const std::string text = LogAndDecode([] {
+    // 1 + 12 * 8 = 97 bytes fit in the 104-byte payload; the 13th integer
+    // does not, and the bool after it must not take its 7 spare bytes.
+    HW3D_LOG(LogLevel::kInfo, "{} {} {} {} {} {} {} {} {} {} {} {} {} {} {}",
+             true, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, false);
+    // a long string is cut to the room left, and what follows is missing
+    const std::string long_text(200, 'x');
+    HW3D_LOG(LogLevel::kInfo, "{} {} {}", 5, long_text, 6);
+  });
+  HW3D_CHECK(HasMessage(text, "true 1 2 3 4 5 6 7 8 9 10 11 12 <?> <?>"));
+  const std::string cut(hw3d::LogRecord::kPayloadCapacity - 8 - 2, 'x');
+  HW3D_CHECK(HasMessage(text, "5 " + cut + " <?>"));
+}
+
+HW3D_TEST(DecoderRejectsBadInput) {
+  std::istringstream not_a_log("hello, world");
+  std::ostringstream out;
+  HW3D_CHECK(!DecodeLog(not_a_log, out));
+
+  Logger& logger = Logger::Get();
+  HW3D_CHECK(logger.Start(kPath));
+  HW3D_LOG(LogLevel::kError, "cut {}", 1);
+  logger.Stop();
+  std::ifstream in(kPath, std::ios::binary);
+  std::string bytes((std::istreambuf_iterator<char>(in)),
+                    std::istreambuf_iterator<char>());
+  in.close();
+  std::remove(kPath);
+  std::istringstream whole(bytes);
+  std::ostringstream whole_out;
+  HW3D_CHECK(DecodeLog(whole, whole_out));
+  HW3D_CHECK(HasMessage(whole_out.str(), "cut 1"));
+  // drop the last byte of the record's payload
+  std::istringstream cut(bytes.substr(0, bytes.size() - 1));
+  std::ostringstream cut_out;
+  HW3D_CHECK(!DecodeLog(cut, cut_out));
+}
+
+}  // namespace
@@ -0,0 +1,245 @@
+﻿#include "hw3d/memory_tracker.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "test.h"
+
+// Built with its own copy of memory_tracker.cc and HW3D_MEMORY_TRACKING on
+// (see CMakeLists.txt), so this runs in Release trees too.
+
+namespace {
+
+using hw3d::MemoryTag;
+using hw3d::MemoryTracker;
+using TagStats = MemoryTracker::TagStats;
+
+// Calls the allocation functions directly: new-expressions whose result is
+// unused may be optimized away.
+void* Allocate(std::size_t size) {
+  return ::operator new(size);
+}
+
+void Free(void* p) {
+  ::operator delete(p);
+}
+
+TagStats Stats(MemoryTag tag) {
+  return MemoryTracker::Get().tag_stats(tag);
+}
+
+// Change in a tag's counters since `before`.
+struct Delta {
+  std::int64_t bytes;
+  std::uint64_t allocations;
+  std::uint64_t frees;
+};
+
+Delta Since(MemoryTag tag, const TagStats& before) {
+  const TagStats now = Stats(tag);
+  return {now.current_bytes - before.current_bytes,
+          now.allocations - before.allocations, now.frees - before.frees};
+}
+
+std::string ReadFile(const char* path) {
+  std::string text;
+  if (std::FILE* f = std::fopen(path, "r")) {
+    char buffer[4096];
+    std::size_t n;
+    while ((n = std::fread(buffer, 1, sizeof(buffer), f)) > 0) {
+      text.append(buffer, n);
+    }
+    std::fclose(f);
+  }
+  return text;
+}
+
+}  // namespace
+
+HW3D_TEST(TrackingIsCompiledIn) {
+  HW3D_CHECK(MemoryTracker::kEnabled);
+}
+
+HW3D_TEST(AllocationsGoToTheCurrentTag) {
+  const TagStats assets = Stats(MemoryTag::kAssets);
+  const TagStats untagged = Stats(MemoryTag::kUntagged);
+  void* p;
+  {
+    HW3D_MEMORY_SCOPE(MemoryTag::kAssets);
+    p = Allocate(1000);
+  }
+  Delta d = Since(MemoryTag::kAssets, assets);
+  HW3D_CHECK(d.bytes == 1000 && d.allocations == 1 && d.frees == 0);
+  HW3D_CHECK(Stats(MemoryTag::kAssets).peak_bytes >= 1000);
+
+  // freed outside the scope, still charged to the tag it was made under
+  Free(p);
+  d = Since(MemoryTag::kAssets, assets);
+  HW3D_CHECK(d.bytes == 0 && d.allocations == 1 && d.frees == 1);
+  d = Since(MemoryTag::kUntagged, untagged);
+  HW3D_CHECK(d.allocations == 0 && d.frees == 0);
+
+  // aligned forms are counted too, and keep their alignment
+  {
+    HW3D_MEMORY_SCOPE(MemoryTag::kAssets);
+    p = ::operator new(200, std::align_val_t{256});
+  }
+  HW3D_CHECK(reinterpret_cast<std::uintptr_t>(p) % 256 == 0);
+  HW3D_CHECK(Since(MemoryTag::kAssets, assets).bytes == 200);
+  ::operator delete(p, std::align_val_t{256});
+  HW3D_CHECK(Since(MemoryTag::kAssets, assets).bytes == 0);
+}
+
+HW3D_TEST(NestedScopesRestoreTheOuterTag) {
+  const TagStats graphics = Stats(MemoryTag::kGraphics);
+  const TagStats assets = Stats(MemoryTag::kAssets);
+  const TagStats untagged = Stats(MemoryTag::kUntagged);
+  void* blocks[4];
+  {
+    HW3D_MEMORY_SCOPE(MemoryTag::kGraphics);
+    blocks[0] = Allocate(10);
+    {
+      HW3D_MEMORY_SCOPE(MemoryTag::kAssets);
+      blocks[1] = Allocate(20);
+    }
+    blocks[2] = Allocate(30);
+  }
+  blocks[3] = Allocate(40);
+  Delta d = Since(MemoryTag::kGraphics, graphics);
+  HW3D_CHECK(d.bytes == 40 && d.allocations == 2);
+  d = Since(MemoryTag::kAssets, assets);
+  HW3D_CHECK(d.bytes == 20 && d.allocations == 1);
+  d = Since(MemoryTag::kUntagged, untagged);
+  HW3D_CHECK(d.bytes == 40 && d.allocations == 1);
+  for (void* p : blocks) {
+    Free(p);
+  }
+  HW3D_CHECK(Since(MemoryTag::kGraphics, graphics).bytes == 0);
+  HW3D_CHECK(Since(MemoryTag::kAssets, assets).bytes == 0);
+}
+
+HW3D_TEST(ScopesArePerThreadAndCountsOutliveThreads) {
+  HW3D_MEMORY_SCOPE(MemoryTag::kJobs);
+  void* left = nullptr;
+  void* untagged = nullptr;
+  std::atomic<bool> go{false};
+  // std::thread allocates its state here, so the counts start after that
+  std::thread thread([&] {
+    while (!go.load()) {
+      std::this_thread::yield();
+    }
+    untagged = Allocate(7);
+    HW3D_MEMORY_SCOPE(MemoryTag::kInput);
+    for (int i = 0; i < 100; i++) {
+      Free(Allocate(64));
+    }
+    // still live when the thread exits
+    left = Allocate(5000);
+  });
+  const TagStats jobs = Stats(MemoryTag::kJobs);
+  const TagStats input = Stats(MemoryTag::kInput);
+  const TagStats none = Stats(MemoryTag::kUntagged);
+  go.store(true);
+  thread.join();
+  const Delta d = Since(MemoryTag::kInput, input);
+  HW3D_CHECK(d.allocations == 101 && d.frees == 100 && d.bytes == 5000);
+  // the thread's scope did not leak into this one, nor this into it
+  HW3D_CHECK(Since(MemoryTag::kJobs, jobs).allocations == 0);
+  HW3D_CHECK(Since(MemoryTag::kUntagged, none).bytes == 7);
+  Free(left);
+  Free(untagged);
+  HW3D_CHECK(Since(MemoryTag::kInput, input).bytes == 0);
+}
+
+HW3D_TEST(EndFrameCountsAllocationsAgainstTheBudget) {
+  MemoryTracker& tracker = MemoryTracker::Get();
+  HW3D_CHECK(tracker.frame_budget() == MemoryTracker::kNoBudget);
+  tracker.set_frame_budget(3);
+  tracker.EndFrame();
+  const MemoryTracker::FrameStats before = tracker.frame_stats();
+
+  void* blocks[5];
+  for (void*& p : blocks) {
+    p = Allocate(8);
+  }
+  tracker.EndFrame();
+  MemoryTracker::FrameStats stats = tracker.frame_stats();
+  HW3D_CHECK(stats.frames == before.frames + 1);
+  HW3D_CHECK(stats.last_frame_allocations == 5);
+  HW3D_CHECK(stats.max_frame_allocations >= 5);
+  HW3D_CHECK(stats.frames_over_budget == before.frames_over_budget + 1);
+
+  // frees do not count; a frame at the budget is within it
+  for (void* p : blocks) {
+    Free(p);
+  }
+  for (int i = 0; i < 3; i++) {
+    blocks[i] = Allocate(8);
+  }
+  tracker.EndFrame();
+  stats = tracker.frame_stats();
+  HW3D_CHECK(stats.last_frame_allocations == 3);
+  HW3D_CHECK(stats.frames_over_budget == before.frames_over_budget + 1);
+
+  // a zero budget allows nothing
+  tracker.set_frame_budget(0);
+  tracker.EndFrame();
+  HW3D_CHECK(tracker.frame_stats().last_frame_allocations == 0);
+  HW3D_CHECK(tracker.frame_stats().frames_over_budget ==
+             before.frames_over_budget + 1);
+  Free(blocks[0]);
+  Free(blocks[1]);
+  blocks[0] = Allocate(8);
+  tracker.EndFrame();
+  HW3D_CHECK(tracker.frame_stats().frames_over_budget ==
+             before.frames_over_budget + 2);
+  Free(blocks[0]);
+  Free(blocks[2]);
+  tracker.set_frame_budget(MemoryTracker::kNoBudget);
+}
+
+HW3D_TEST(LeakCheckListsLiveBlocks) {
+  MemoryTracker& tracker = MemoryTracker::Get();
+  const std::size_t base = tracker.LiveTrackedAllocations();
+  void* untracked = Allocate(16);
+
+  tracker.BeginLeakCheck();
+  void* kept;
+  void* freed;
+  {
+    HW3D_MEMORY_SCOPE(MemoryTag::kLogging);
+    kept = Allocate(300);
+    freed = Allocate(400);
+  }
+  void* late_freed = Allocate(500);
+  Free(freed);
+  tracker.EndLeakCheck();
+  HW3D_CHECK(tracker.LiveTrackedAllocations() == base + 2);
+
+  // blocks from outside the check never show up, nor do their frees matter
+  void* after = Allocate(600);
+  Free(untracked);
+  HW3D_CHECK(tracker.LiveTrackedAllocations() == base + 2);
+
+  const char* path = "memory_tracker_test.txt";
+  HW3D_CHECK(tracker.WriteReport(path));
+  const std::string report = ReadFile(path);
+  std::remove(path);
+  HW3D_CHECK(report.find("(tracking on)") != std::string::npos);
+  HW3D_CHECK(report.find("[Leaks] 2 blocks, 800 bytes still live") !=
+             std::string::npos);
+  // the scope names the line that opened it
+  HW3D_CHECK(report.find("logging") != std::string::npos);
+  HW3D_CHECK(report.find("memory_tracker_test.cc:") != std::string::npos);
+
+  Free(late_freed);
+  HW3D_CHECK(tracker.LiveTrackedAllocations() == base + 1);
+  Free(kept);
+  Free(after);
+  HW3D_CHECK(tracker.LiveTrackedAllocations() == base);
+}
@@ -0,0 +1,206 @@
+﻿#include "hw3d/occlusion_culling.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "hw3d/job_system.h"
+#include "test.h"
+
+namespace {
+
+using hw3d::Aabb;
+using hw3d::AabbArray;
+using hw3d::Float3;
+using hw3d::OcclusionCuller;
+
+class Random {
+ public:
+  explicit Random(std::uint32_t seed) : state_(seed) {}
+  // Uniform in [lo, hi).
+  float Next(float lo, float hi) {
+    state_ = state_ * 1664525u + 1013904223u;
+    return lo + (hi - lo) * static_cast<float>(state_ >> 8) / 16777216.0f;
+  }
+
+ private:
+  std::uint32_t state_;
+};
+
+constexpr int kWidth = 320;
+constexpr int kHeight = 192;
+// The camera sits at the origin looking down +z, so a point is on screen
+// while |x| < 0.9 z and |y| < 0.54 z.
+constexpr float kNear = 0.1f;
+
+hw3d::Mat4 Camera() {
+  return hw3d::MatPerspectiveFovLH(
+      1.0f, static_cast<float>(kWidth) / kHeight, kNear, 100.0f);
+}
+
+// A quad facing the camera at depth z over [x0, x1] x [y0, y1]; clockwise
+// on screen, so front facing, unless `reversed`.
+void AddWall(OcclusionCuller* culler, float x0, float x1, float y0, float y1,
+             float z, bool reversed, bool cull_back_faces) {
+  const Float3 vertices[] = {{x0, y0, z}, {x0, y1, z}, {x1, y1, z},
+                             {x1, y0, z}};
+  const std::uint32_t front[] = {0, 1, 2, 0, 2, 3};
+  const std::uint32_t back[] = {0, 2, 1, 0, 3, 2};
+  culler->AddOccluder(vertices, 4, reversed ? back : front, 6,
+                      hw3d::MatIdentity(), cull_back_faces);
+}
+
+Aabb Box(Float3 center, Float3 extent) {
+  return {center - extent, center + extent};
+}
+
+// A box on screen whose nearest face is at least `depth` away.
+Aabb BoxBeyond(Random& random, float depth) {
+  const float z = random.Next(depth + 2.0f, 90.0f);
+  return Box({random.Next(-0.7f, 0.7f) * z, random.Next(-0.4f, 0.4f) * z, z},
+             {random.Next(0.0f, 2.0f), random.Next(0.0f, 2.0f),
+              random.Next(0.0f, 2.0f)});
+}
+
+}  // namespace
+
+HW3D_TEST(EmptyBufferHidesOnlyOffScreenBoxes) {
+  OcclusionCuller culler(kWidth, kHeight);
+  culler.BeginFrame(Camera());
+  culler.Rasterize();
+  HW3D_CHECK(culler.IsVisible(Box({0, 0, 50}, {1, 1, 1})));
+  // corners of the screen
+  HW3D_CHECK(culler.IsVisible(Box({-44, -26, 50}, {1, 1, 1})));
+  HW3D_CHECK(culler.IsVisible(Box({44, 26, 50}, {1, 1, 1})));
+  // left, right, above and below the screen
+  HW3D_CHECK(!culler.IsVisible(Box({-60, 0, 50}, {1, 1, 1})));
+  HW3D_CHECK(!culler.IsVisible(Box({60, 0, 50}, {1, 1, 1})));
+  HW3D_CHECK(!culler.IsVisible(Box({0, 35, 50}, {1, 1, 1})));
+  HW3D_CHECK(!culler.IsVisible(Box({0, -35, 50}, {1, 1, 1})));
+  // off screen on one side but reaching onto it
+  HW3D_CHECK(culler.IsVisible(Box({-60, 0, 50}, {20, 1, 1})));
+  HW3D_CHECK(!culler.IsVisible(Aabb()));
+}
+
+HW3D_TEST(FullscreenWallHidesEverythingBehindIt) {
+  OcclusionCuller culler(kWidth, kHeight);
+  culler.BeginFrame(Camera());
+  AddWall(&culler, -100, 100, -100, 100, 10, false, true);
+  culler.Rasterize();
+  HW3D_CHECK(culler.stats().occluder_triangles == 2);
+  HW3D_CHECK(culler.stats().rasterized_triangles == 2);
+
+  Random random(1);
+  for (int i = 0; i < 2000; i++) {
+    HW3D_CHECK(!culler.IsVisible(BoxBeyond(random, 11)));
+  }
+  // in front of the wall, or reaching in front of it
+  HW3D_CHECK(culler.IsVisible(Box({0, 0, 5}, {1, 1, 1})));
+  HW3D_CHECK(culler.IsVisible(Box({3, -2, 8}, {0.5f, 0.5f, 0.5f})));
+  HW3D_CHECK(culler.IsVisible(Box({0, 0, 15}, {1, 1, 6})));
+}
+
+HW3D_TEST(BoxesAcrossTheNearPlaneStayVisible) {
+  OcclusionCuller culler(kWidth, kHeight);
+  culler.BeginFrame(Camera());
+  AddWall(&culler, -100, 100, -100, 100, 10, false, true);
+  culler.Rasterize();
+  // from behind the camera to behind the wall
+  HW3D_CHECK(culler.IsVisible(Box({0, 0, 9}, {1, 1, 10})));
+  // in front of the camera but across the near plane
+  HW3D_CHECK(culler.IsVisible(Box({0, 0, 10}, {1, 1, 10 - kNear / 2})));
+  // off to the side, so off screen if it were projected naively
+  HW3D_CHECK(culler.IsVisible(Box({50, 0, 9}, {1, 1, 10})));
+
+  AabbArray boxes;
+  boxes.Resize(2);
+  boxes.Set(0, Box({0, 0, 9}, {1, 1, 10}));
+  boxes.Set(1, Box({0, 0, 30}, {1, 1, 1}));
+  const std::uint32_t candidates[] = {0, 1};
+  std::uint32_t visible[2];
+  HW3D_CHECK(culler.Cull(boxes, candidates, 2, visible) == 1);
+  HW3D_CHECK(visible[0] == 0);
+}
+
+HW3D_TEST(BackFaceCulling) {
+  Random random(2);
+  std::vector<Aabb> behind;
+  for (int i = 0; i < 200; i++) {
+    behind.push_back(BoxBeyond(random, 11));
+  }
+  for (int reversed = 0; reversed < 2; reversed++) {
+    for (int cull = 0; cull < 2; cull++) {
+      OcclusionCuller culler(kWidth, kHeight);
+      culler.BeginFrame(Camera());
+      AddWall(&culler, -100, 100, -100, 100, 10, reversed != 0, cull != 0);
+      culler.Rasterize();
+      // only a back-facing wall with culling on is skipped
+      const bool skipped = reversed != 0 && cull != 0;
+      HW3D_CHECK(culler.stats().rasterized_triangles == (skipped ? 0 : 2));
+      for (const Aabb& box : behind) {
+        HW3D_CHECK(culler.IsVisible(box) == skipped);
+      }
+    }
+  }
+}
+
+HW3D_TEST(PartialWallHidesOnlyWhatItCovers) {
+  OcclusionCuller culler(kWidth, kHeight);
+  culler.BeginFrame(Camera());
+  // the left half of the screen
+  AddWall(&culler, -100, 0, -100, 100, 10, false, true);
+  culler.Rasterize();
+  Random random(3);
+  for (int i = 0; i < 1000; i++) {
+    const float z = random.Next(13, 90);
+    const Float3 extent{random.Next(0, 2), random.Next(0, 2),
+                        random.Next(0, 2)};
+    const float y = random.Next(-0.4f, 0.4f) * z;
+    HW3D_CHECK(!culler.IsVisible(
+        Box({random.Next(-0.7f, -0.2f) * z, y, z}, extent)));
+    HW3D_CHECK(culler.IsVisible(
+        Box({random.Next(0.2f, 0.7f) * z, y, z}, extent)));
+  }
+}
+
+HW3D_TEST(ParallelCullMatchesIsVisible) {
+  constexpr std::size_t kCount = 100001;
+  Random random(4);
+  std::vector<Aabb> boxes(kCount);
+  AabbArray arrays;
+  arrays.Resize(kCount);
+  for (std::size_t i = 0; i < kCount; i++) {
+    const Float3 center{random.Next(-60, 60), random.Next(-40, 40),
+                        random.Next(-5, 95)};
+    boxes[i] = Box(center, {random.Next(0, 3), random.Next(0, 3),
+                            random.Next(0, 3)});
+    arrays.Set(i, boxes[i]);
+  }
+
+  hw3d::JobSystemSession session(4);
+  OcclusionCuller culler(kWidth, kHeight);
+  for (int run = 0; run < 3; run++) {
+    culler.BeginFrame(Camera());
+    AddWall(&culler, -100, 5, -100, 100, 20, false, true);
+    AddWall(&culler, -3, 100, -10, 2, 40, false, true);
+    culler.Rasterize();
+    // every third object, culled in place
+    std::vector<std::uint32_t> expected;
+    std::vector<std::uint32_t> visible;
+    for (std::uint32_t i = 0; i < kCount; i += 3) {
+      visible.push_back(i);
+      if (culler.IsVisible(boxes[i])) {
+        expected.push_back(i);
+      }
+    }
+    const std::size_t tested = visible.size();
+    const std::size_t count =
+        culler.Cull(arrays, visible.data(), tested, visible.data());
+    visible.resize(count);
+    HW3D_CHECK(visible == expected);
+    HW3D_CHECK(culler.stats().tested_objects == tested);
+    HW3D_CHECK(culler.stats().occluded_objects == tested - count);
+    // the scene hides a fair share, so the test says something
+    HW3D_CHECK(count < tested * 3 / 4);
+    HW3D_CHECK(count > tested / 10);
+  }
+}
@@ -0,0 +1,90 @@
+﻿#include "hw3d/parallel.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+using hw3d::JobSystemSession;
+using hw3d::ParallelCost;
+using hw3d::ParallelOptions;
+
+// Counts how often ParallelFor visits each index of [0, n).
+bool VisitsEachIndexOnce(std::size_t n, const ParallelOptions& options) {
+  auto hits = std::make_unique<std::atomic<std::uint8_t>[]>(n);
+  hw3d::ParallelFor(
+      0, n,
+      [&](std::size_t i) { hits[i].fetch_add(1, std::memory_order_relaxed); },
+      options);
+  for (std::size_t i = 0; i < n; i++) {
+    if (hits[i].load() != 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+HW3D_TEST(CoversRangeWithMeasuredGrain) {
+  JobSystemSession session(4);
+  HW3D_CHECK(VisitsEachIndexOnce(1, ParallelOptions()));
+  HW3D_CHECK(VisitsEachIndexOnce(100000, ParallelOptions()));
+  ParallelOptions fixed;
+  fixed.grain = 7;
+  fixed.item_bytes = 4;
+  HW3D_CHECK(VisitsEachIndexOnce(12345, fixed));
+}
+
+HW3D_TEST(TinyRecordedCostStillCoversRange) {
+  // a per-item cost so small that the chunk size quotient exceeds size_t
+  JobSystemSession session(4);
+  ParallelCost cost;
+  cost.Record(std::size_t{1} << 62, 1);
+  HW3D_CHECK(cost.ns_per_item() > 0.0 && cost.ns_per_item() < 1e-15);
+  ParallelOptions options;
+  options.cost = &cost;
+  HW3D_CHECK(VisitsEachIndexOnce(50000, options));
+
+  ParallelCost huge;
+  huge.Record(1, 1000000);
+  options.cost = &huge;
+  HW3D_CHECK(VisitsEachIndexOnce(5000, options));
+}
+
+HW3D_TEST(ReduceAndScansMatchSerial) {
+  JobSystemSession session(4);
+  const std::size_t n = 300000;
+  std::vector<std::uint64_t> values(n);
+  std::iota(values.begin(), values.end(), 1);
+  const std::uint64_t sum = hw3d::ParallelReduce(
+      0, n, std::uint64_t{0},
+      [&](std::size_t b, std::size_t e) {
+        std::uint64_t s = 0;
+        for (std::size_t i = b; i < e; i++) {
+          s += values[i];
+        }
+        return s;
+      },
+      [](std::uint64_t a, std::uint64_t b) { return a + b; });
+  HW3D_CHECK(sum == std::uint64_t{n} * (n + 1) / 2);
+
+  const auto add = [](std::uint64_t a, std::uint64_t b) { return a + b; };
+  std::vector<std::uint64_t> inclusive(n);
+  std::vector<std::uint64_t> exclusive(n);
+  hw3d::ParallelInclusiveScan(values.data(), inclusive.data(), n,
+                              std::uint64_t{0}, add);
+  hw3d::ParallelExclusiveScan(values.data(), exclusive.data(), n,
+                              std::uint64_t{0}, add);
+  bool ok = true;
+  for (std::size_t i = 0; i < n; i++) {
+    ok = ok && inclusive[i] == std::uint64_t{i + 1} * (i + 2) / 2 &&
+         exclusive[i] == std::uint64_t{i} * (i + 1) / 2;
+  }
+  HW3D_CHECK(ok);
+}
@@ -0,0 +1,154 @@
+﻿#include "hw3d/resource_registry.h"
+
+#include <cstdint>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+struct Mesh {
+  int id;
+};
+struct Texture {
+  int id;
+};
+
+using MeshPool = hw3d::ResourcePool<Mesh>;
+using MeshHandle = MeshPool::HandleType;
+
+}  // namespace
+
+HW3D_TEST(RandomOperationsMatchAMap) {
+  // Reference model: live handles map to their id; released ones wait for
+  // their frame. Every step checks every handle ever made.
+  MeshPool pool;
+  std::map<std::uint32_t, int> live;
+  std::vector<std::pair<std::uint64_t, int>> pending;
+  std::vector<MeshHandle> made;
+  std::mt19937 rng(42);
+  std::uint64_t frame = 0;
+  int next_id = 0;
+  bool ok = true;
+  for (int step = 0; step < 20000; step++) {
+    const int op = static_cast<int>(rng() % 10);
+    if (op < 5 || live.empty()) {
+      const MeshHandle h = pool.Create(Mesh{next_id});
+      ok = ok && live.count(h.value()) == 0;
+      live[h.value()] = next_id++;
+      made.push_back(h);
+    } else if (op < 9) {
+      auto it = live.begin();
+      std::advance(it, rng() % live.size());
+      const MeshHandle h = MeshHandle::FromParts(
+          it->first & MeshHandle::kIndexMask,
+          it->first >> MeshHandle::kIndexBits);
+      if (op < 7) {
+        pool.Destroy(h);
+      } else {
+        pool.Release(h, frame + 2);
+        pending.push_back({frame + 2, it->second});
+      }
+      live.erase(it);
+    } else {
+      frame++;
+      pool.RetireFrames(frame);
+      std::size_t kept = 0;
+      for (const auto& p : pending) {
+        if (p.first > frame) {
+          pending[kept++] = p;
+        }
+      }
+      pending.resize(kept);
+    }
+    if (step % 97 == 0) {
+      for (const MeshHandle h : made) {
+        const auto it = live.find(h.value());
+        const Mesh* mesh = pool.Get(h);
+        ok = ok && (it == live.end() ? mesh == nullptr
+                                     : mesh != nullptr &&
+                                           mesh->id == it->second);
+      }
+      ok = ok && pool.size() == live.size() + pending.size();
+      ok = ok && pool.pending() == pending.size();
+    }
+  }
+  HW3D_CHECK(ok);
+}
+
+HW3D_TEST(SlotsOutOfGenerationsAreRetired) {
+  MeshPool pool;
+  const MeshHandle first = pool.Create(Mesh{0});
+  MeshHandle h = first;
+  // one slot recycled through every generation; it never wraps back to a
+  // generation an old handle holds
+  for (std::uint32_t g = 2; g <= MeshHandle::kGenerationMask; g++) {
+    pool.Destroy(h);
+    h = pool.Create(Mesh{1});
+    HW3D_CHECK(h.index() == first.index() && h.generation() == g);
+    HW3D_CHECK(pool.Get(first) == nullptr);
+  }
+  pool.Destroy(h);
+  const MeshHandle next = pool.Create(Mesh{2});
+  HW3D_CHECK(next.index() != first.index());
+  HW3D_CHECK(next.generation() == 1);
+  HW3D_CHECK(pool.Get(first) == nullptr && pool.Get(h) == nullptr);
+  HW3D_CHECK(pool.Get(MeshHandle()) == nullptr);
+  HW3D_CHECK(pool.Get(next)->id == 2);
+  HW3D_CHECK(pool.size() == 1);
+  // released resources retire their slot the same way
+  MeshHandle r = next;
+  for (std::uint32_t g = 2; g <= MeshHandle::kGenerationMask + 1; g++) {
+    pool.Release(r, g);
+    pool.RetireFrames(g);
+    r = pool.Create(Mesh{3});
+  }
+  HW3D_CHECK(r.index() != next.index() && r.index() != first.index());
+  HW3D_CHECK(pool.Get(next) == nullptr && pool.Get(r)->id == 3);
+}
+
+HW3D_TEST(ReleasedHandlesGoStaleBeforeTheValueIsDestroyed) {
+  MeshPool pool;
+  const MeshHandle a = pool.Create(Mesh{1});
+  const MeshHandle b = pool.Create(Mesh{2});
+  pool.Release(a, 10);
+  HW3D_CHECK(pool.Get(a) == nullptr);
+  HW3D_CHECK(pool.size() == 2);
+  HW3D_CHECK(pool.RetireFrames(9) == 0);
+  HW3D_CHECK(pool.RetireFrames(10) == 1);
+  HW3D_CHECK(pool.size() == 1);
+  HW3D_CHECK(pool.Get(b)->id == 2);
+  // the retired slot is reused with a new generation
+  const MeshHandle c = pool.Create(Mesh{3});
+  HW3D_CHECK(c.index() == a.index());
+  HW3D_CHECK(c != a);
+}
+
+HW3D_TEST(RegistryRetiresEveryPool) {
+  hw3d::ResourceRegistry<Mesh, Texture> registry;
+  const auto mesh = registry.Create<Mesh>(Mesh{1});
+  const auto texture = registry.Create<Texture>(Texture{2});
+  registry.Release(mesh, 5);
+  registry.Release(texture, 6);
+  HW3D_CHECK(registry.RetireFrames(5) == 1);
+  HW3D_CHECK(registry.RetireFrames(6) == 1);
+  HW3D_CHECK(registry.pool<Mesh>().size() == 0);
+  HW3D_CHECK(registry.pool<Texture>().size() == 0);
+}
+
+HW3D_TEST(RunningOutOfHandlesThrows) {
+  MeshPool pool;
+  for (std::size_t i = 0; i < MeshPool::kMaxResources; i++) {
+    pool.Create(Mesh{0});
+  }
+  bool threw = false;
+  try {
+    pool.Create(Mesh{0});
+  } catch (const std::length_error&) {
+    threw = true;
+  }
+  HW3D_CHECK(threw);
+}
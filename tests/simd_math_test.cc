@@ -0,0 +1,209 @@
+﻿#include "hw3d/simd_math.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+// Bounds from the table in simd_math.h, rounded up.
+#if defined(HW3D_MATH_FMA) || defined(HW3D_SIMD_AVX512)
+constexpr double kSinCosUlp = 1.7;
+#else
+constexpr double kSinCosUlp = 2.5;
+#endif
+constexpr double kExpUlp = 1.4;
+constexpr double kLogUlp = 1.0;
+constexpr double kAtan2Ulp = 3.3;
+
+constexpr float kInf = std::numeric_limits<float>::infinity();
+constexpr float kNan = std::numeric_limits<float>::quiet_NaN();
+
+float FromBits(std::uint32_t bits) {
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+std::uint32_t ToBits(float f) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+// Error of `got` in units of the float spacing at `expected`.
+double UlpError(float got, double expected) {
+  if (std::isnan(expected)) {
+    return std::isnan(got) ? 0.0 : kInf;
+  }
+  if (std::isinf(expected) || std::isinf(got)) {
+    return static_cast<double>(got) == expected ? 0.0 : kInf;
+  }
+  const int exponent =
+      expected == 0.0 ? -126 : std::max(std::ilogb(expected), -126);
+  return std::fabs(got - expected) / std::ldexp(1.0, exponent - 23);
+}
+
+// Floats from `lo` to `hi` by bit pattern, both signs when `lo` is 0.
+std::vector<float> Sweep(float lo, float hi, std::uint32_t step,
+                         bool both_signs) {
+  std::vector<float> values;
+  for (std::uint32_t bits = ToBits(lo); bits <= ToBits(hi); bits += step) {
+    values.push_back(FromBits(bits));
+    if (both_signs) {
+      values.push_back(-FromBits(bits));
+    }
+  }
+  return values;
+}
+
+template <typename Reference>
+double MaxUlp(const std::vector<float>& x, const std::vector<float>& got,
+              Reference reference) {
+  double worst = 0.0;
+  for (std::size_t i = 0; i < x.size(); i++) {
+    worst = std::max(worst, UlpError(got[i], reference(x[i])));
+  }
+  return worst;
+}
+
+bool SameFloat(float a, float b) {
+  return std::isnan(a) ? std::isnan(b) : ToBits(a) == ToBits(b);
+}
+
+}  // namespace
+
+HW3D_TEST(SinCosWithinDocumentedUlp) {
+  // odd step so the low mantissa bits vary; ~2.4M values up to 1e5
+  std::vector<float> x = Sweep(0.0f, 1e5f, 1021, true);
+  // the hardest inputs for the reduction sit next to multiples of pi/2
+  for (int k = 1; k < 63662; k += 7) {
+    const float near = static_cast<float>(k * 1.5707963267948966);
+    x.push_back(std::nextafter(near, 0.0f));
+    x.push_back(near);
+    x.push_back(std::nextafter(near, kInf));
+  }
+  std::vector<float> s(x.size()), c(x.size());
+  hw3d::SinCosBatch(x.data(), s.data(), c.data(), x.size());
+  const double sin_ulp =
+      MaxUlp(x, s, [](float v) { return std::sin(static_cast<double>(v)); });
+  const double cos_ulp =
+      MaxUlp(x, c, [](float v) { return std::cos(static_cast<double>(v)); });
+  HW3D_CHECK(sin_ulp <= kSinCosUlp);
+  HW3D_CHECK(cos_ulp <= kSinCosUlp);
+
+  std::vector<float> single(x.size());
+  hw3d::SinBatch(x.data(), single.data(), x.size());
+  HW3D_CHECK(std::equal(single.begin(), single.end(), s.begin(), SameFloat));
+  hw3d::CosBatch(x.data(), single.data(), x.size());
+  HW3D_CHECK(std::equal(single.begin(), single.end(), c.begin(), SameFloat));
+}
+
+HW3D_TEST(SinCosStaysAccurateForHugeArguments) {
+  // past the polynomial path's range up to FLT_MAX, where the int32
+  // quadrant used to overflow
+  std::vector<float> x = Sweep(8192.0f, std::numeric_limits<float>::max(),
+                               9973, true);
+  x.push_back(1e7f);
+  x.push_back(1e9f);
+  x.push_back(3.4e9f);
+  std::vector<float> s(x.size()), c(x.size());
+  hw3d::SinCosBatch(x.data(), s.data(), c.data(), x.size());
+  for (std::size_t i = 0; i < x.size(); i++) {
+    HW3D_CHECK(s[i] >= -1.0f && s[i] <= 1.0f);
+    HW3D_CHECK(c[i] >= -1.0f && c[i] <= 1.0f);
+  }
+  const double sin_ulp =
+      MaxUlp(x, s, [](float v) { return std::sin(static_cast<double>(v)); });
+  const double cos_ulp =
+      MaxUlp(x, c, [](float v) { return std::cos(static_cast<double>(v)); });
+  HW3D_CHECK(sin_ulp <= kSinCosUlp);
+  HW3D_CHECK(cos_ulp <= kSinCosUlp);
+
+  // one huge lane must not disturb its neighbours
+  float mixed[4] = {0.5f, 1e9f, -2.0f, 3.0f};
+  hw3d::Vec4 sin4, cos4;
+  hw3d::SinCos(hw3d::math_detail::LoadFloats(mixed), &sin4, &cos4);
+  float out[4];
+  hw3d::math_detail::StoreFloats(out, sin4);
+  for (int i = 0; i < 4; i++) {
+    HW3D_CHECK(UlpError(out[i], std::sin(static_cast<double>(mixed[i]))) <=
+               kSinCosUlp);
+  }
+}
+
+HW3D_TEST(ExpLogAtan2WithinDocumentedUlp) {
+  std::vector<float> x = Sweep(0.0f, 88.7f, 307, true);
+  x.erase(std::remove_if(x.begin(), x.end(),
+                         [](float v) { return v < -103.9f; }),
+          x.end());
+  std::vector<float> out(x.size());
+  hw3d::ExpBatch(x.data(), out.data(), x.size());
+  HW3D_CHECK(MaxUlp(x, out, [](float v) {
+               return std::exp(static_cast<double>(v));
+             }) <= kExpUlp);
+
+  // every exponent, denormals included
+  x = Sweep(FromBits(1), std::numeric_limits<float>::max(), 1009, false);
+  out.resize(x.size());
+  hw3d::LogBatch(x.data(), out.data(), x.size());
+  HW3D_CHECK(MaxUlp(x, out, [](float v) {
+               return std::log(static_cast<double>(v));
+             }) <= kLogUlp);
+
+  std::vector<float> y;
+  x.clear();
+  for (int i = -200; i <= 200; i++) {
+    for (int j = -200; j <= 200; j++) {
+      y.push_back(static_cast<float>(i) * 0.37f);
+      x.push_back(static_cast<float>(j) * 0.41f);
+    }
+  }
+  out.resize(x.size());
+  hw3d::Atan2Batch(y.data(), x.data(), out.data(), x.size());
+  double worst = 0.0;
+  for (std::size_t i = 0; i < x.size(); i++) {
+    worst = std::max(worst, UlpError(out[i], std::atan2(static_cast<double>(
+                                                            y[i]),
+                                                        static_cast<double>(
+                                                            x[i]))));
+  }
+  HW3D_CHECK(worst <= kAtan2Ulp);
+}
+
+HW3D_TEST(SpecialValuesFollowLibm) {
+  const float x[] = {0.0f, -0.0f, kInf, -kInf, kNan, 1e-40f, -1.0f, 89.0f};
+  constexpr std::size_t n = sizeof(x) / sizeof(x[0]);
+  float s[n], c[n], e[n], l[n];
+  hw3d::SinCosBatch(x, s, c, n);
+  hw3d::ExpBatch(x, e, n);
+  hw3d::LogBatch(x, l, n);
+  for (std::size_t i = 0; i < n; i++) {
+    HW3D_CHECK(UlpError(s[i], std::sin(static_cast<double>(x[i]))) <=
+               kSinCosUlp);
+    HW3D_CHECK(UlpError(c[i], std::cos(static_cast<double>(x[i]))) <=
+               kSinCosUlp);
+    HW3D_CHECK(std::isnan(l[i]) == std::isnan(std::log(x[i])));
+  }
+  HW3D_CHECK(!std::signbit(s[0]) && std::signbit(s[1]));
+  HW3D_CHECK(e[0] == 1.0f && e[2] == kInf && e[3] == 0.0f && e[7] == kInf);
+  HW3D_CHECK(std::isnan(e[4]));
+  HW3D_CHECK(l[0] == -kInf && l[1] == -kInf && l[2] == kInf);
+
+  const float ys[] = {0.0f, -0.0f, 0.0f, -0.0f, kInf, -kInf, 1.0f};
+  const float xs[] = {0.0f, 0.0f, -0.0f, -0.0f, kInf, -kInf, kNan};
+  constexpr std::size_t m = sizeof(ys) / sizeof(ys[0]);
+  float a[m];
+  hw3d::Atan2Batch(ys, xs, a, m);
+  for (std::size_t i = 0; i < m; i++) {
+    HW3D_CHECK(UlpError(a[i], std::atan2(static_cast<double>(ys[i]),
+                                         static_cast<double>(xs[i]))) <=
+               kAtan2Ulp);
+    HW3D_CHECK(std::signbit(a[i]) == std::signbit(std::atan2(ys[i], xs[i])));
+  }
+}
@@ -0,0 +1,186 @@
+﻿#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "hw3d/job_system.h"
+#include "hw3d/loose_octree.h"
+#include "hw3d/spatial_hash_grid.h"
+#include "test.h"
+
+namespace {
+
+using hw3d::Aabb;
+using hw3d::Float3;
+using hw3d::LooseOctree;
+using hw3d::SpatialHashGrid;
+
+class Random {
+ public:
+  explicit Random(std::uint32_t seed) : state_(seed) {}
+  // Uniform in [lo, hi).
+  float Next(float lo, float hi) {
+    state_ = state_ * 1664525u + 1013904223u;
+    return lo + (hi - lo) * static_cast<float>(state_ >> 8) / 16777216.0f;
+  }
+
+ private:
+  std::uint32_t state_;
+};
+
+const Aabb kWorld{{-100, -100, -100}, {100, 100, 100}};
+
+// Mostly small boxes, some large ones, and a few centred outside kWorld.
+Aabb RandomBox(Random& random) {
+  const Float3 c{random.Next(-120, 120), random.Next(-120, 120),
+                 random.Next(-120, 120)};
+  const float e = random.Next(0, 1) < 0.05f ? random.Next(5, 40)
+                                            : random.Next(0.1f, 2);
+  return {c - Float3{e, e, e}, c + Float3{e, e, e}};
+}
+
+// Checks sphere and box queries of `index` against a scan of `boxes`,
+// where only objects with live[i] set are in the index.
+template <typename Index>
+bool MatchesScan(const Index& index, const std::vector<Aabb>& boxes,
+                 const std::vector<bool>& live, Random& random) {
+  for (int q = 0; q < 50; q++) {
+    const Float3 center{random.Next(-110, 110), random.Next(-110, 110),
+                        random.Next(-110, 110)};
+    const float radius = random.Next(1, 25);
+    const Aabb query{center - Float3{radius, radius, radius},
+                     center + Float3{radius, radius, radius}};
+    std::vector<std::uint32_t> sphere_hits, box_hits;
+    index.QuerySphere(center, radius,
+                      [&](std::uint32_t o) { sphere_hits.push_back(o); });
+    index.QueryOverlap(query, [&](std::uint32_t o) { box_hits.push_back(o); });
+    std::vector<std::uint32_t> sphere_scan, box_scan;
+    for (std::uint32_t i = 0; i < boxes.size(); i++) {
+      if (!live[i]) {
+        continue;
+      }
+      if (hw3d::DistanceSquared(boxes[i], center) <= radius * radius) {
+        sphere_scan.push_back(i);
+      }
+      if (hw3d::Overlaps(boxes[i], query)) {
+        box_scan.push_back(i);
+      }
+    }
+    std::sort(sphere_hits.begin(), sphere_hits.end());
+    std::sort(box_hits.begin(), box_hits.end());
+    if (sphere_hits != sphere_scan || box_hits != box_scan) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Inserts, moves and removes objects one at a time and in batches,
+// checking queries against a scan after each step.
+template <typename Index>
+void Exercise(Index& index) {
+  constexpr std::uint32_t kCount = 3000;
+  Random random(7);
+  std::vector<Aabb> boxes(kCount);
+  std::vector<bool> live(kCount, false);
+  std::vector<std::uint32_t> batch;
+  std::vector<Aabb> batch_boxes;
+  for (std::uint32_t i = 0; i < kCount; i++) {
+    boxes[i] = RandomBox(random);
+    if (i % 2 == 0) {
+      index.Insert(i, boxes[i]);
+    } else {
+      batch.push_back(i);
+      batch_boxes.push_back(boxes[i]);
+    }
+    live[i] = true;
+  }
+  index.Insert(batch.data(), batch_boxes.data(), batch.size());
+  HW3D_CHECK(index.size() == kCount);
+  HW3D_CHECK(MatchesScan(index, boxes, live, random));
+
+  for (int frame = 0; frame < 3; frame++) {
+    batch.clear();
+    batch_boxes.clear();
+    for (std::uint32_t i = 0; i < kCount; i++) {
+      const Float3 v{random.Next(-3, 3), random.Next(-3, 3),
+                     random.Next(-3, 3)};
+      boxes[i] = {boxes[i].min + v, boxes[i].max + v};
+      if (i % 3 == 0) {
+        index.Update(i, boxes[i]);
+      } else {
+        batch.push_back(i);
+        batch_boxes.push_back(boxes[i]);
+      }
+    }
+    index.Update(batch.data(), batch_boxes.data(), batch.size());
+    HW3D_CHECK(MatchesScan(index, boxes, live, random));
+  }
+
+  for (std::uint32_t i = 0; i < kCount; i += 3) {
+    index.Remove(i);
+    live[i] = false;
+  }
+  // removing twice is a no-op
+  index.Remove(0);
+  HW3D_CHECK(!index.Contains(0) && index.Contains(1));
+  HW3D_CHECK(index.size() == kCount - (kCount + 2) / 3);
+  HW3D_CHECK(MatchesScan(index, boxes, live, random));
+
+  for (std::uint32_t i = 0; i < kCount; i += 3) {
+    boxes[i] = RandomBox(random);
+    index.Insert(i, boxes[i]);
+    live[i] = true;
+  }
+  HW3D_CHECK(MatchesScan(index, boxes, live, random));
+  HW3D_CHECK(index.bounds(5).min.x == boxes[5].min.x);
+
+  index.Clear();
+  HW3D_CHECK(index.size() == 0 && !index.Contains(1));
+}
+
+}  // namespace
+
+HW3D_TEST(OctreeMatchesLinearScan) {
+  LooseOctree octree(kWorld, 5);
+  Exercise(octree);
+  HW3D_CHECK(octree.node_count() == 1);
+}
+
+HW3D_TEST(GridMatchesLinearScan) {
+  SpatialHashGrid grid(4.0f);
+  Exercise(grid);
+  HW3D_CHECK(grid.cell_count() == 0 && grid.large_count() == 0);
+}
+
+HW3D_TEST(BatchesMatchLinearScanOnWorkers) {
+  hw3d::JobSystemSession session(4);
+  LooseOctree octree(kWorld, 6);
+  Exercise(octree);
+  SpatialHashGrid grid(8.0f);
+  Exercise(grid);
+}
+
+HW3D_TEST(RejectsBadParameters) {
+  bool threw = false;
+  try {
+    LooseOctree octree(Aabb(), 4);
+  } catch (const std::invalid_argument&) {
+    threw = true;
+  }
+  HW3D_CHECK(threw);
+  threw = false;
+  try {
+    LooseOctree octree(kWorld, LooseOctree::kMaxDepth + 1);
+  } catch (const std::invalid_argument&) {
+    threw = true;
+  }
+  HW3D_CHECK(threw);
+  threw = false;
+  try {
+    SpatialHashGrid grid(0.0f);
+  } catch (const std::invalid_argument&) {
+    threw = true;
+  }
+  HW3D_CHECK(threw);
+}
@@ -0,0 +1,28 @@
+﻿#pragma once
+
+// Minimal harness for the unit tests under tests/. Each test file defines
+// cases with HW3D_TEST and is linked with test_main.cc, which runs them all
+// and exits non-zero if any check failed.
+
+namespace hw3d::test {
+
+using TestFunction = void (*)();
+
+bool Register(const char* name, TestFunction function);
+void Fail(const char* file, int line, const char* expression);
+
+}  // namespace hw3d::test
+
+#define HW3D_TEST(name)                                             \
+  static void name();                                               \
+  static const bool name##_registered =                             \
+      ::hw3d::test::Register(#name, &name);                         \
+  static void name()
+
+// Records a failure and keeps going, so one run reports every broken check.
+#define HW3D_CHECK(condition)                                       \
+  do {                                                              \
+    if (!(condition)) {                                             \
+      ::hw3d::test::Fail(__FILE__, __LINE__, #condition);           \
+    }                                                               \
+  } while (0)
@@ -0,0 +1,47 @@
+﻿#include <cstdio>
+#include <vector>
+
+#include "test.h"
+
+namespace hw3d::test {
+namespace {
+
+struct TestCase {
+  const char* name;
+  TestFunction function;
+};
+
+std::vector<TestCase>& Registry() {
+  static std::vector<TestCase> tests;
+  return tests;
+}
+
+int failures = 0;
+
+}  // namespace
+
+bool Register(const char* name, TestFunction function) {
+  Registry().push_back({name, function});
+  return true;
+}
+
+void Fail(const char* file, int line, const char* expression) {
+  std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+  ++failures;
+}
+
+}  // namespace hw3d::test
+
+int main() {
+  using namespace hw3d::test;
+  int failed_tests = 0;
+  for (const TestCase& test : Registry()) {
+    const int before = failures;
+    test.function();
+    const bool ok = failures == before;
+    std::printf("[%s] %s\n", ok ? "  OK  " : " FAIL ", test.name);
+    failed_tests += ok ? 0 : 1;
+  }
+  std::printf("%zu tests, %d failed\n", Registry().size(), failed_tests);
+  return failed_tests == 0 ? 0 : 1;
+}
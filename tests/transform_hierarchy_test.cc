@@ -0,0 +1,437 @@
+﻿#include "hw3d/transform_hierarchy.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+#include "hw3d/job_system.h"
+#include "test.h"
+
+namespace {
+
+using hw3d::Float3;
+using hw3d::Float4;
+using hw3d::LocalTransform;
+using hw3d::Mat4;
+using hw3d::TransformHierarchy;
+using NodeHandle = TransformHierarchy::NodeHandle;
+
+class Random {
+ public:
+  explicit Random(std::uint32_t seed) : state_(seed) {}
+  // Uniform in [lo, hi).
+  float Next(float lo, float hi) {
+    state_ = state_ * 1664525u + 1013904223u;
+    return lo + (hi - lo) * static_cast<float>(state_ >> 8) / 16777216.0f;
+  }
+  std::uint32_t Below(std::uint32_t n) {
+    return static_cast<std::uint32_t>(Next(0.0f, 1.0f) * n) % n;
+  }
+
+ private:
+  std::uint32_t state_;
+};
+
+LocalTransform RandomLocal(Random& random) {
+  LocalTransform local;
+  local.position = {random.Next(-5, 5), random.Next(-5, 5),
+                    random.Next(-5, 5)};
+  const hw3d::Vec4 axis = hw3d::Normalize3(hw3d::VecSet(
+      random.Next(-1, 1), random.Next(-1, 1), random.Next(-1, 1) + 2.0f, 0));
+  hw3d::Store(&local.rotation,
+              hw3d::QuatFromAxisAngle(axis, random.Next(-3, 3)).v);
+  local.scale = {random.Next(0.5f, 1.5f), random.Next(0.5f, 1.5f),
+                 random.Next(0.5f, 1.5f)};
+  return local;
+}
+
+Mat4 LocalMatrix(const LocalTransform& t) {
+  return hw3d::MatAffine(
+      hw3d::VecSet(t.scale.x, t.scale.y, t.scale.z, 0),
+      hw3d::Quat{hw3d::Load(t.rotation)},
+      hw3d::VecSet(t.position.x, t.position.y, t.position.z, 1));
+}
+
+float MaxDifference(const Mat4& a, const Mat4& b) {
+  hw3d::Float4x4 fa, fb;
+  hw3d::Store(&fa, a);
+  hw3d::Store(&fb, b);
+  float diff = 0.0f;
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      diff = std::max(diff, std::fabs(fa.m[i][j] - fb.m[i][j]));
+    }
+  }
+  return diff;
+}
+
+// The hierarchy as a map from handle to parent and local transform, with
+// world matrices computed the obvious way.
+class Reference {
+ public:
+  struct Node {
+    NodeHandle parent;
+    LocalTransform local;
+  };
+
+  std::map<std::uint32_t, Node> nodes;
+
+  Mat4 World(NodeHandle node) const {
+    const Node& n = nodes.at(node.value());
+    const Mat4 local = LocalMatrix(n.local);
+    return n.parent ? local * World(n.parent) : local;
+  }
+  bool InSubtree(NodeHandle node, NodeHandle root) const {
+    for (; node; node = nodes.at(node.value()).parent) {
+      if (node == root) {
+        return true;
+      }
+    }
+    return false;
+  }
+  void Remove(NodeHandle root) {
+    std::vector<std::uint32_t> doomed;
+    for (const auto& entry : nodes) {
+      if (InSubtree(NodeHandle::FromParts(
+                        entry.first & NodeHandle::kIndexMask,
+                        entry.first >> NodeHandle::kIndexBits),
+                    root)) {
+        doomed.push_back(entry.first);
+      }
+    }
+    for (const std::uint32_t value : doomed) {
+      nodes.erase(value);
+    }
+  }
+};
+
+NodeHandle HandleOf(std::uint32_t value) {
+  return NodeHandle::FromParts(value & NodeHandle::kIndexMask,
+                               value >> NodeHandle::kIndexBits);
+}
+
+// Every live node's parent and world matrix match the reference.
+bool Matches(const TransformHierarchy& hierarchy, const Reference& reference) {
+  if (hierarchy.size() != reference.nodes.size()) {
+    return false;
+  }
+  for (const auto& entry : reference.nodes) {
+    const NodeHandle node = HandleOf(entry.first);
+    const Mat4* world = hierarchy.world(node);
+    if (world == nullptr || hierarchy.parent(node) != entry.second.parent ||
+        MaxDifference(*world, reference.World(node)) > 1e-3f) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+HW3D_TEST(WorldIsLocalTimesParentWorld) {
+  Random random(1);
+  TransformHierarchy hierarchy;
+  Reference reference;
+  NodeHandle parent;
+  // a chain, with a sibling at every level
+  for (int depth = 0; depth < 6; depth++) {
+    for (int k = 0; k < 2; k++) {
+      const LocalTransform local = RandomLocal(random);
+      const NodeHandle node = hierarchy.Add(parent, local);
+      reference.nodes[node.value()] = {parent, local};
+      if (k == 1) {
+        parent = node;
+      }
+    }
+  }
+  hierarchy.Update();
+  HW3D_CHECK(hierarchy.level_count() == 6);
+  HW3D_CHECK(hierarchy.last_update_count() == 12);
+  HW3D_CHECK(Matches(hierarchy, reference));
+  const LocalTransform local = hierarchy.local(parent);
+  const LocalTransform expected = reference.nodes[parent.value()].local;
+  HW3D_CHECK(local.position.x == expected.position.x);
+  HW3D_CHECK(local.rotation.w == expected.rotation.w);
+  HW3D_CHECK(local.scale.z == expected.scale.z);
+}
+
+HW3D_TEST(AddAndRemove) {
+  TransformHierarchy hierarchy;
+  const NodeHandle root = hierarchy.Add();
+  const NodeHandle child = hierarchy.Add(root);
+  const NodeHandle grandchild = hierarchy.Add(child);
+  const NodeHandle other = hierarchy.Add();
+  HW3D_CHECK(hierarchy.size() == 4);
+  HW3D_CHECK(hierarchy.parent(grandchild) == child);
+  HW3D_CHECK(!hierarchy.parent(root));
+
+  // removing a node takes its subtree and nothing else
+  hierarchy.SetPosition(other, {1, 2, 3});
+  hierarchy.Remove(child);
+  HW3D_CHECK(hierarchy.size() == 2);
+  HW3D_CHECK(hierarchy.IsAlive(root));
+  HW3D_CHECK(!hierarchy.IsAlive(child));
+  HW3D_CHECK(!hierarchy.IsAlive(grandchild));
+  HW3D_CHECK(hierarchy.IsAlive(other));
+  hierarchy.Update();
+  HW3D_CHECK(hierarchy.level_count() == 1);
+  const Mat4* world = hierarchy.world(other);
+  HW3D_CHECK(world != nullptr);
+  HW3D_CHECK(world != nullptr &&
+             MaxDifference(*world, hw3d::MatTranslation(1, 2, 3)) == 0.0f);
+
+  // stale handles are ignored or reported, even once their slots are reused
+  const NodeHandle reused = hierarchy.Add();
+  const NodeHandle reused2 = hierarchy.Add();
+  HW3D_CHECK(reused.index() == child.index() ||
+             reused.index() == grandchild.index());
+  HW3D_CHECK(reused2.index() == child.index() ||
+             reused2.index() == grandchild.index());
+  HW3D_CHECK(!hierarchy.IsAlive(child));
+  HW3D_CHECK(hierarchy.world(child) == nullptr);
+  HW3D_CHECK(!hierarchy.parent(grandchild));
+  hierarchy.SetPosition(child, {9, 9, 9});
+  hierarchy.SetParent(child, root);
+  hierarchy.Remove(grandchild);
+  HW3D_CHECK(hierarchy.size() == 4);
+  HW3D_CHECK(hierarchy.local(reused).position.x == 0.0f);
+  HW3D_CHECK(hierarchy.local(reused2).position.x == 0.0f);
+  HW3D_CHECK(!hierarchy.parent(reused));
+
+  hierarchy.Remove(root);
+  hierarchy.Remove(other);
+  hierarchy.Remove(reused);
+  hierarchy.Remove(reused2);
+  HW3D_CHECK(hierarchy.size() == 0);
+  hierarchy.Update();
+  HW3D_CHECK(hierarchy.level_count() == 0);
+}
+
+HW3D_TEST(SlotsOutOfGenerationsAreRetired) {
+  TransformHierarchy hierarchy;
+  const NodeHandle root = hierarchy.Add();
+  const NodeHandle first = hierarchy.Add(root);
+  NodeHandle node = first;
+  for (std::uint32_t i = 0;
+       i <= NodeHandle::kGenerationMask && node.index() == first.index();
+       i++) {
+    hierarchy.Remove(node);
+    HW3D_CHECK(!hierarchy.IsAlive(first));
+    node = hierarchy.Add(root);
+  }
+  // the slot went through every generation, then was left unused
+  HW3D_CHECK(node.generation() == 1);
+  HW3D_CHECK(hierarchy.IsAlive(node) && !hierarchy.IsAlive(first));
+  HW3D_CHECK(hierarchy.parent(node) == root);
+  HW3D_CHECK(hierarchy.size() == 2);
+}
+
+HW3D_TEST(StaleParentsAndCyclesThrow) {
+  TransformHierarchy hierarchy;
+  const NodeHandle root = hierarchy.Add();
+  const NodeHandle child = hierarchy.Add(root);
+  const NodeHandle grandchild = hierarchy.Add(child);
+  const NodeHandle gone = hierarchy.Add();
+  hierarchy.Remove(gone);
+
+  bool threw = false;
+  try {
+    hierarchy.Add(gone);
+  } catch (const std::invalid_argument&) {
+    threw = true;
+  }
+  HW3D_CHECK(threw);
+  HW3D_CHECK(hierarchy.size() == 3);
+
+  threw = false;
+  try {
+    hierarchy.SetParent(child, gone);
+  } catch (const std::invalid_argument&) {
+    threw = true;
+  }
+  HW3D_CHECK(threw);
+
+  // under itself or a descendant
+  for (const NodeHandle parent : {child, grandchild}) {
+    threw = false;
+    try {
+      hierarchy.SetParent(child, parent);
+    } catch (const std::invalid_argument&) {
+      threw = true;
+    }
+    HW3D_CHECK(threw);
+  }
+  HW3D_CHECK(hierarchy.parent(child) == root);
+  HW3D_CHECK(hierarchy.parent(grandchild) == child);
+
+  // a stale node is ignored, whatever the parent
+  hierarchy.SetParent(gone, child);
+  hierarchy.Update();
+  HW3D_CHECK(hierarchy.level_count() == 3);
+}
+
+HW3D_TEST(SetParentResorts) {
+  Random random(2);
+  TransformHierarchy hierarchy;
+  Reference reference;
+  std::vector<NodeHandle> roots;
+  for (int i = 0; i < 8; i++) {
+    const LocalTransform local = RandomLocal(random);
+    roots.push_back(hierarchy.Add(NodeHandle(), local));
+    reference.nodes[roots.back().value()] = {NodeHandle(), local};
+  }
+  hierarchy.Update();
+  HW3D_CHECK(hierarchy.level_count() == 1);
+
+  // chain the roots one under the next: the last added becomes the root,
+  // so every child sat before its new parent in the arrays
+  for (int i = 0; i + 1 < 8; i++) {
+    hierarchy.SetParent(roots[i], roots[i + 1]);
+    reference.nodes[roots[i].value()].parent = roots[i + 1];
+  }
+  hierarchy.Update();
+  HW3D_CHECK(hierarchy.level_count() == 8);
+  HW3D_CHECK(hierarchy.last_update_count() == 7);
+  HW3D_CHECK(Matches(hierarchy, reference));
+
+  // and back to roots
+  for (int i = 0; i + 1 < 8; i++) {
+    hierarchy.SetParent(roots[i], NodeHandle());
+    reference.nodes[roots[i].value()].parent = NodeHandle();
+  }
+  hierarchy.Update();
+  HW3D_CHECK(hierarchy.level_count() == 1);
+  HW3D_CHECK(Matches(hierarchy, reference));
+}
+
+HW3D_TEST(OnlyDirtySubtreesUpdate) {
+  TransformHierarchy hierarchy;
+  // two subtrees of 1 + 4 + 16 nodes
+  std::vector<NodeHandle> roots;
+  std::vector<NodeHandle> leaves;
+  for (int t = 0; t < 2; t++) {
+    roots.push_back(hierarchy.Add());
+    for (int i = 0; i < 4; i++) {
+      const NodeHandle mid = hierarchy.Add(roots.back());
+      for (int j = 0; j < 4; j++) {
+        leaves.push_back(hierarchy.Add(mid));
+      }
+    }
+  }
+  hierarchy.Update();
+  HW3D_CHECK(hierarchy.last_update_count() == 42);
+  hierarchy.Update();
+  HW3D_CHECK(hierarchy.last_update_count() == 0);
+
+  hierarchy.SetPosition(leaves[5], {1, 0, 0});
+  hierarchy.Update();
+  HW3D_CHECK(hierarchy.last_update_count() == 1);
+
+  hierarchy.SetScale(roots[1], {2, 2, 2});
+  hierarchy.Update();
+  HW3D_CHECK(hierarchy.last_update_count() == 21);
+  const Mat4* world = hierarchy.world(leaves[20]);
+  HW3D_CHECK(world != nullptr &&
+             MaxDifference(*world, hw3d::MatScaling(2, 2, 2)) == 0.0f);
+
+  // a moved node updates with its subtree, and so does its new parent's
+  // level only where dirty
+  hierarchy.SetParent(hierarchy.parent(leaves[0]), roots[1]);
+  hierarchy.Update();
+  HW3D_CHECK(hierarchy.last_update_count() == 5);
+  world = hierarchy.world(leaves[0]);
+  HW3D_CHECK(world != nullptr &&
+             MaxDifference(*world, hw3d::MatScaling(2, 2, 2)) == 0.0f);
+}
+
+HW3D_TEST(RandomOperationsMatchReference) {
+  Random random(3);
+  TransformHierarchy hierarchy;
+  Reference reference;
+  std::vector<NodeHandle> made;
+  const auto pick = [&] {
+    auto it = reference.nodes.begin();
+    std::advance(it, random.Below(
+                         static_cast<std::uint32_t>(reference.nodes.size())));
+    return HandleOf(it->first);
+  };
+  bool ok = true;
+  for (int step = 0; step < 4000; step++) {
+    const std::uint32_t op = random.Below(10);
+    if (op < 4 || reference.nodes.size() < 2) {
+      const NodeHandle parent =
+          reference.nodes.empty() || op == 0 ? NodeHandle() : pick();
+      const LocalTransform local = RandomLocal(random);
+      const NodeHandle node = hierarchy.Add(parent, local);
+      reference.nodes[node.value()] = {parent, local};
+      made.push_back(node);
+    } else if (op < 5) {
+      const NodeHandle node = pick();
+      hierarchy.Remove(node);
+      reference.Remove(node);
+    } else if (op < 7) {
+      const NodeHandle node = pick();
+      NodeHandle parent = random.Below(4) == 0 ? NodeHandle() : pick();
+      if (parent && reference.InSubtree(parent, node)) {
+        parent = NodeHandle();
+      }
+      hierarchy.SetParent(node, parent);
+      reference.nodes[node.value()].parent = parent;
+    } else if (op < 9) {
+      const NodeHandle node = pick();
+      const LocalTransform local = RandomLocal(random);
+      hierarchy.SetLocal(node, local);
+      reference.nodes[node.value()].local = local;
+    } else {
+      hierarchy.Update();
+      ok = ok && Matches(hierarchy, reference);
+    }
+  }
+  hierarchy.Update();
+  ok = ok && Matches(hierarchy, reference);
+  HW3D_CHECK(ok);
+  for (const NodeHandle node : made) {
+    ok = ok && hierarchy.IsAlive(node) == (reference.nodes.count(
+                                              node.value()) != 0);
+  }
+  HW3D_CHECK(ok);
+}
+
+HW3D_TEST(ParallelUpdateMatchesReference) {
+  Random random(4);
+  TransformHierarchy hierarchy;
+  Reference reference;
+  // wide levels, so each one is split across the workers
+  std::vector<NodeHandle> level;
+  for (int i = 0; i < 50; i++) {
+    const LocalTransform local = RandomLocal(random);
+    level.push_back(hierarchy.Add(NodeHandle(), local));
+    reference.nodes[level.back().value()] = {NodeHandle(), local};
+  }
+  for (int depth = 1; depth < 4; depth++) {
+    std::vector<NodeHandle> next;
+    for (const NodeHandle parent : level) {
+      for (int k = 0; k < 20; k++) {
+        const LocalTransform local = RandomLocal(random);
+        next.push_back(hierarchy.Add(parent, local));
+        reference.nodes[next.back().value()] = {parent, local};
+      }
+    }
+    level.swap(next);
+  }
+
+  hw3d::JobSystemSession session(4);
+  for (int run = 0; run < 3; run++) {
+    hierarchy.Update();
+    HW3D_CHECK(Matches(hierarchy, reference));
+    // a fresh set of leaves each time
+    for (std::size_t i = run; i < level.size(); i += 7) {
+      const LocalTransform local = RandomLocal(random);
+      hierarchy.SetLocal(level[i], local);
+      reference.nodes[level[i].value()].local = local;
+    }
+  }
+}
@@ -0,0 +1,177 @@
+﻿#include "hw3d/utf_transcode.h"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+using hw3d::UtfErrors;
+using hw3d::UtfResult;
+using hw3d::UtfStatus;
+
+// Straightforward reference encoders the SIMD paths are checked against.
+void AppendUtf8(std::string& out, std::uint32_t cp) {
+  if (cp < 0x80) {
+    out += static_cast<char>(cp);
+  } else if (cp < 0x800) {
+    out += static_cast<char>(0xC0 | (cp >> 6));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    out += static_cast<char>(0xE0 | (cp >> 12));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else {
+    out += static_cast<char>(0xF0 | (cp >> 18));
+    out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+}
+
+void AppendUtf16(std::u16string& out, std::uint32_t cp) {
+  if (cp < 0x10000) {
+    out += static_cast<char16_t>(cp);
+  } else {
+    cp -= 0x10000;
+    out += static_cast<char16_t>(0xD800 + (cp >> 10));
+    out += static_cast<char16_t>(0xDC00 + (cp & 0x3FF));
+  }
+}
+
+// Random scalar values, mostly ASCII runs so the vector paths get exercised
+// and leave off at every alignment.
+std::vector<std::uint32_t> RandomText(std::mt19937& rng, std::size_t count) {
+  std::uniform_int_distribution<int> kind(0, 9);
+  std::uniform_int_distribution<std::uint32_t> ascii(0, 0x7F);
+  std::uniform_int_distribution<std::uint32_t> two(0x80, 0x7FF);
+  std::uniform_int_distribution<std::uint32_t> three(0x800, 0xFFFF);
+  std::uniform_int_distribution<std::uint32_t> four(0x10000, 0x10FFFF);
+  std::vector<std::uint32_t> text;
+  while (text.size() < count) {
+    const int k = kind(rng);
+    std::uint32_t cp;
+    if (k < 6) {
+      cp = ascii(rng);
+    } else if (k < 7) {
+      cp = two(rng);
+    } else if (k < 9) {
+      do {
+        cp = three(rng);
+      } while (cp >= 0xD800 && cp <= 0xDFFF);
+    } else {
+      cp = four(rng);
+    }
+    text.push_back(cp);
+  }
+  return text;
+}
+
+std::u16string Decode(std::string_view in, UtfErrors errors) {
+  std::u16string out(hw3d::Utf16LengthBound(in.size()), u'\0');
+  const UtfResult result = hw3d::Utf8ToUtf16(in, &out[0], out.size(), errors);
+  out.resize(result.ok() ? result.written : 0);
+  return out;
+}
+
+}  // namespace
+
+HW3D_TEST(RandomTextRoundTripsAndMatchesReference) {
+  std::mt19937 rng(1234);
+  for (int round = 0; round < 200; round++) {
+    const auto text = RandomText(rng, 1 + round * 7);
+    std::string utf8;
+    std::u16string utf16;
+    for (const std::uint32_t cp : text) {
+      AppendUtf8(utf8, cp);
+      AppendUtf16(utf16, cp);
+    }
+    HW3D_CHECK(hw3d::Utf8ToUtf16(utf8) == utf16);
+    HW3D_CHECK(hw3d::Utf16ToUtf8(utf16) == utf8);
+  }
+}
+
+HW3D_TEST(AsciiRunsEndingAtEveryOffset) {
+  // a non-ASCII character after 0..80 ASCII bytes covers the 16- and 32-byte
+  // vector loops leaving off at every position
+  for (std::size_t run = 0; run <= 80; run++) {
+    std::string utf8(run, 'a');
+    std::u16string utf16(run, u'a');
+    AppendUtf8(utf8, 0x20AC);
+    AppendUtf16(utf16, 0x20AC);
+    utf8 += "tail";
+    utf16 += u"tail";
+    HW3D_CHECK(hw3d::Utf8ToUtf16(utf8) == utf16);
+    HW3D_CHECK(hw3d::Utf16ToUtf8(utf16) == utf8);
+  }
+}
+
+HW3D_TEST(RejectsInvalidUtf8AtItsOffset) {
+  const struct {
+    const char* text;
+    std::size_t offset;
+  } cases[] = {
+      {"ab\x80", 2},              // stray continuation
+      {"\xC0\xAF", 0},            // overlong two-byte
+      {"x\xE0\x80\xAF", 1},       // overlong three-byte
+      {"\xED\xA0\x80", 0},        // encoded surrogate
+      {"\xF4\x90\x80\x80", 0},    // above U+10FFFF
+      {"\xF5\x80\x80\x80", 0},    // invalid lead
+      {"abc\xE2\x82", 3},         // truncated at the end
+  };
+  for (const auto& c : cases) {
+    char16_t out[16];
+    const UtfResult result = hw3d::Utf8ToUtf16(c.text, out, 16);
+    HW3D_CHECK(result.status == UtfStatus::kInvalidInput);
+    HW3D_CHECK(result.read == c.offset);
+  }
+}
+
+HW3D_TEST(ReplacesEachMaximalSubpartWithOneReplacementCharacter) {
+  // expectations follow the Unicode "maximal subpart" practice
+  HW3D_CHECK(Decode("a\x80z", UtfErrors::kReplace) == u"a\uFFFDz");
+  HW3D_CHECK(Decode("\xE0\x80\x80", UtfErrors::kReplace) ==
+             u"\uFFFD\uFFFD\uFFFD");
+  HW3D_CHECK(Decode("\xE2\x82" "A", UtfErrors::kReplace) == u"\uFFFDA");
+  HW3D_CHECK(Decode("\xF0\x9F\x98" "A", UtfErrors::kReplace) == u"\uFFFDA");
+  HW3D_CHECK(Decode("\xF0\x9F\x98", UtfErrors::kReplace) == u"\uFFFD");
+  HW3D_CHECK(Decode("\xED\xA0\x80", UtfErrors::kReplace) ==
+             u"\uFFFD\uFFFD\uFFFD");
+  HW3D_CHECK(Decode("\xC0\xAF", UtfErrors::kReplace) == u"\uFFFD\uFFFD");
+  // valid text around the bad byte is untouched
+  HW3D_CHECK(Decode("\xE2\x82\xAC\xFF\xE2\x82\xAC", UtfErrors::kReplace) ==
+             u"\u20AC\uFFFD\u20AC");
+  HW3D_CHECK(Decode("a\x80z", UtfErrors::kReject).empty());
+}
+
+HW3D_TEST(RejectsUnpairedSurrogates) {
+  char out[16];
+  const char16_t lone_high[] = {u'a', 0xD800, u'b'};
+  const char16_t lone_low[] = {0xDC00};
+  HW3D_CHECK(hw3d::Utf16ToUtf8(std::u16string_view(lone_high, 3), out, 16)
+                 .status == UtfStatus::kInvalidInput);
+  HW3D_CHECK(hw3d::Utf16ToUtf8(std::u16string_view(lone_low, 1), out, 16)
+                 .status == UtfStatus::kInvalidInput);
+}
+
+HW3D_TEST(SmallOutputStopsWithoutWritingPastCapacity) {
+  const std::string utf8(100, 'q');
+  std::u16string out(64, u'#');
+  const UtfResult result = hw3d::Utf8ToUtf16(utf8, &out[0], 40);
+  HW3D_CHECK(result.status == UtfStatus::kOutputTooSmall);
+  HW3D_CHECK(result.written == 40);
+  HW3D_CHECK(out[39] == u'q');
+  HW3D_CHECK(out[40] == u'#');
+
+  // a surrogate pair that does not fit is not split
+  std::string emoji;
+  AppendUtf8(emoji, 0x1F600);
+  char16_t pair[2] = {u'#', u'#'};
+  const UtfResult split = hw3d::Utf8ToUtf16(emoji, pair, 1);
+  HW3D_CHECK(split.status == UtfStatus::kOutputTooSmall);
+  HW3D_CHECK(split.written == 0);
+  HW3D_CHECK(pair[0] == u'#');
+}
@@ -0,0 +1,260 @@
+﻿#include "hw3d/vector_math.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+using hw3d::Conjugate;
+using hw3d::Dot4;
+using hw3d::Float3;
+using hw3d::Float4;
+using hw3d::Float4x4;
+using hw3d::Float4x4Scaling;
+using hw3d::Float4x4Translation;
+using hw3d::GetW;
+using hw3d::GetZ;
+using hw3d::Inverse;
+using hw3d::Length3;
+using hw3d::Load;
+using hw3d::Mat4;
+using hw3d::MatAffine;
+using hw3d::MatIdentity;
+using hw3d::MatLookAtLH;
+using hw3d::MatPerspectiveFovLH;
+using hw3d::MatRotationQuat;
+using hw3d::MatRotationX;
+using hw3d::MatRotationY;
+using hw3d::MatRotationZ;
+using hw3d::Multiply;
+using hw3d::Normalize3;
+using hw3d::Quat;
+using hw3d::QuatFromAxisAngle;
+using hw3d::Rotate;
+using hw3d::Slerp;
+using hw3d::Store;
+using hw3d::ToConstantBuffer;
+using hw3d::TransformPoint;
+using hw3d::TransformPoints;
+using hw3d::TransformPointsSoA;
+using hw3d::TransformVector;
+using hw3d::Transpose;
+using hw3d::Vec4;
+using hw3d::VecSet;
+
+// Tolerance for results compared against the constexpr scalar helpers:
+// a few ulp of the largest magnitude involved, which FMA may round
+// differently.
+constexpr float kTolerance = 2e-6f;
+
+static_assert(Multiply(Float4x4Translation(1, 2, 3),
+                       Float4x4Scaling(2, 2, 2)).m[3][2] == 6.0f,
+              "constexpr multiply applies the left matrix first");
+static_assert(TransformPoint(Float3{1, 1, 1},
+                             Float4x4Translation(1, 2, 3)).z == 4.0f,
+              "constexpr point transform adds the last row");
+
+class Random {
+ public:
+  explicit Random(std::uint32_t seed) : state_(seed) {}
+  // Uniform in [lo, hi).
+  float Next(float lo, float hi) {
+    state_ = state_ * 1664525u + 1013904223u;
+    return lo + (hi - lo) * static_cast<float>(state_ >> 8) / 16777216.0f;
+  }
+
+ private:
+  std::uint32_t state_;
+};
+
+Float4x4 RandomMatrix(Random& random) {
+  Float4x4 m;
+  for (auto& row : m.m) {
+    for (float& v : row) {
+      v = random.Next(-2.0f, 2.0f);
+    }
+  }
+  return m;
+}
+
+float MaxDifference(const Float4x4& a, const Float4x4& b) {
+  float diff = 0.0f;
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      diff = std::max(diff, std::fabs(a.m[i][j] - b.m[i][j]));
+    }
+  }
+  return diff;
+}
+
+float MaxDifference(const Mat4& a, const Mat4& b) {
+  Float4x4 fa, fb;
+  Store(&fa, a);
+  Store(&fb, b);
+  return MaxDifference(fa, fb);
+}
+
+float MaxDifference(Vec4 a, Vec4 b) {
+  Float4 fa, fb;
+  Store(&fa, a);
+  Store(&fb, b);
+  return std::max(std::max(std::fabs(fa.x - fb.x), std::fabs(fa.y - fb.y)),
+                  std::max(std::fabs(fa.z - fb.z), std::fabs(fa.w - fb.w)));
+}
+
+float MaxDifference(Float3 a, Float3 b) {
+  return std::max(std::max(std::fabs(a.x - b.x), std::fabs(a.y - b.y)),
+                  std::fabs(a.z - b.z));
+}
+
+Quat RandomRotation(Random& random) {
+  const Vec4 axis = Normalize3(VecSet(random.Next(-1, 1), random.Next(-1, 1),
+                                      random.Next(-1, 1), 0));
+  return QuatFromAxisAngle(axis, random.Next(-3.14f, 3.14f));
+}
+
+}  // namespace
+
+HW3D_TEST(MatrixMultiplyMatchesScalar) {
+  Random random(1);
+  float worst = 0.0f;
+  for (int i = 0; i < 1000; i++) {
+    const Float4x4 a = RandomMatrix(random);
+    const Float4x4 b = RandomMatrix(random);
+    Float4x4 simd;
+    Store(&simd, Load(a) * Load(b));
+    worst = std::max(worst, MaxDifference(simd, Multiply(a, b)));
+  }
+  // entries are sums of four products of magnitude < 4
+  HW3D_CHECK(worst < 16 * kTolerance);
+
+  Float4x4 transposed;
+  const Float4x4 m = RandomMatrix(random);
+  Store(&transposed, Transpose(Load(m)));
+  HW3D_CHECK(MaxDifference(transposed, Transpose(m)) == 0.0f);
+  HW3D_CHECK(MaxDifference(ToConstantBuffer(Load(m)), Transpose(m)) == 0.0f);
+}
+
+HW3D_TEST(BatchTransformsMatchScalar) {
+  Random random(2);
+  const Float4x4 m = RandomMatrix(random);
+  const Mat4 mat = Load(m);
+  // 8 * 4 + 3 exercises the eight-wide, four-wide and scalar tails.
+  constexpr std::size_t kCount = 35;
+  std::vector<Float3> points(kCount);
+  std::vector<float> x(kCount), y(kCount), z(kCount);
+  for (std::size_t i = 0; i < kCount; i++) {
+    points[i] = {random.Next(-10, 10), random.Next(-10, 10),
+                 random.Next(-10, 10)};
+    x[i] = points[i].x;
+    y[i] = points[i].y;
+    z[i] = points[i].z;
+  }
+  std::vector<Float3> aos(kCount);
+  std::vector<Float4> aos4(kCount);
+  TransformPoints(mat, points.data(), aos.data(), kCount);
+  TransformPoints(mat, points.data(), aos4.data(), kCount);
+  TransformPointsSoA(mat, x.data(), y.data(), z.data(), x.data(), y.data(),
+                     z.data(), kCount);
+  float worst = 0.0f;
+  for (std::size_t i = 0; i < kCount; i++) {
+    const Float3 expected = TransformPoint(points[i], m);
+    worst = std::max(worst, MaxDifference(aos[i], expected));
+    worst = std::max(worst, MaxDifference(Float3{x[i], y[i], z[i]}, expected));
+    worst = std::max(worst, MaxDifference(
+                                Float3{aos4[i].x, aos4[i].y, aos4[i].z},
+                                expected));
+    const float w = points[i].x * m.m[0][3] + points[i].y * m.m[1][3] +
+                    points[i].z * m.m[2][3] + m.m[3][3];
+    worst = std::max(worst, std::fabs(aos4[i].w - w));
+  }
+  // |p| < 10 and |m| < 2: sums reach about 62
+  HW3D_CHECK(worst < 64 * kTolerance);
+}
+
+HW3D_TEST(QuaternionsAgreeWithMatrices) {
+  Random random(3);
+  float worst = 0.0f;
+  for (int i = 0; i < 1000; i++) {
+    const Quat a = RandomRotation(random);
+    const Quat b = RandomRotation(random);
+    const Vec4 v = VecSet(random.Next(-1, 1), random.Next(-1, 1),
+                          random.Next(-1, 1), 0);
+    worst = std::max(worst, MaxDifference(Rotate(v, a),
+                                          TransformVector(v,
+                                                          MatRotationQuat(a))));
+    worst = std::max(worst, MaxDifference(MatRotationQuat(a * b),
+                                          MatRotationQuat(a) *
+                                              MatRotationQuat(b)));
+    worst = std::max(worst, MaxDifference(Rotate(Rotate(v, a), Conjugate(a)),
+                                          v));
+  }
+  HW3D_CHECK(worst < 4 * kTolerance);
+
+  const float angle = 0.7f;
+  HW3D_CHECK(MaxDifference(
+                 MatRotationQuat(QuatFromAxisAngle(VecSet(1, 0, 0, 0), angle)),
+                 MatRotationX(angle)) < kTolerance);
+  HW3D_CHECK(MaxDifference(
+                 MatRotationQuat(QuatFromAxisAngle(VecSet(0, 1, 0, 0), angle)),
+                 MatRotationY(angle)) < kTolerance);
+  HW3D_CHECK(MaxDifference(
+                 MatRotationQuat(QuatFromAxisAngle(VecSet(0, 0, 1, 0), angle)),
+                 MatRotationZ(angle)) < kTolerance);
+}
+
+HW3D_TEST(SlerpHitsEndpointsAndStaysUnit) {
+  Random random(4);
+  for (int i = 0; i < 100; i++) {
+    const Quat a = RandomRotation(random);
+    const Quat b = RandomRotation(random);
+    const Mat4 start = MatRotationQuat(Slerp(a, b, 0.0f));
+    const Mat4 end = MatRotationQuat(Slerp(a, b, 1.0f));
+    HW3D_CHECK(MaxDifference(start, MatRotationQuat(a)) < 4 * kTolerance);
+    HW3D_CHECK(MaxDifference(end, MatRotationQuat(b)) < 4 * kTolerance);
+    const Quat mid = Slerp(a, b, random.Next(0, 1));
+    HW3D_CHECK(std::fabs(Dot4(mid.v, mid.v) - 1.0f) < 4 * kTolerance);
+  }
+}
+
+HW3D_TEST(InverseUndoesAffineTransforms) {
+  Random random(5);
+  float worst = 0.0f;
+  for (int i = 0; i < 1000; i++) {
+    const Vec4 scale = VecSet(random.Next(0.5f, 2), random.Next(0.5f, 2),
+                              random.Next(0.5f, 2), 0);
+    const Vec4 translation = VecSet(random.Next(-10, 10),
+                                    random.Next(-10, 10),
+                                    random.Next(-10, 10), 0);
+    const Mat4 m = MatAffine(scale, RandomRotation(random), translation);
+    worst = std::max(worst, MaxDifference(m * Inverse(m), MatIdentity()));
+  }
+  // the translation row of m carries magnitudes up to 10
+  HW3D_CHECK(worst < 16 * kTolerance);
+}
+
+HW3D_TEST(LookAtAndProjectionFollowD3DConventions) {
+  const Vec4 eye = VecSet(3, 4, -5, 1);
+  const Vec4 target = VecSet(-1, 2, 6, 1);
+  const Mat4 view = MatLookAtLH(eye, target, VecSet(0, 1, 0, 0));
+  HW3D_CHECK(MaxDifference(TransformPoint(eye, view), VecSet(0, 0, 0, 1)) <
+             4 * kTolerance);
+  // the target lies straight ahead on +z, at its distance from the eye
+  const float distance = Length3(target - eye);
+  HW3D_CHECK(MaxDifference(TransformPoint(target, view),
+                           VecSet(0, 0, distance, 1)) < 8 * kTolerance);
+
+  const float near_z = 0.1f;
+  const float far_z = 100.0f;
+  const Mat4 projection = MatPerspectiveFovLH(1.0f, 16.0f / 9.0f, near_z,
+                                              far_z);
+  const Vec4 near_clip = TransformPoint(VecSet(0, 0, near_z, 1), projection);
+  const Vec4 far_clip = TransformPoint(VecSet(0, 0, far_z, 1), projection);
+  HW3D_CHECK(std::fabs(GetZ(near_clip) / GetW(near_clip)) < kTolerance);
+  HW3D_CHECK(std::fabs(GetZ(far_clip) / GetW(far_clip) - 1.0f) < kTolerance);
+  HW3D_CHECK(GetW(far_clip) == far_z);
+}
@@ -0,0 +1,168 @@
+﻿#include "hw3d/visibility_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+using hw3d::AabbArray;
+using hw3d::Float3;
+using hw3d::Frustum;
+using hw3d::VisibilityCache;
+
+class Random {
+ public:
+  explicit Random(std::uint32_t seed) : state_(seed) {}
+  // Uniform in [0, 1).
+  float Next() {
+    state_ = state_ * 1664525u + 1013904223u;
+    return static_cast<float>(state_ >> 8) / 16777216.0f;
+  }
+
+ private:
+  std::uint32_t state_;
+};
+
+Frustum FrustumAt(Float3 eye, float yaw, float pitch) {
+  const Float3 dir{std::cos(pitch) * std::sin(yaw), std::sin(pitch),
+                   std::cos(pitch) * std::cos(yaw)};
+  const hw3d::Mat4 view = hw3d::MatLookAtLH(
+      hw3d::VecSet(eye.x, eye.y, eye.z, 1),
+      hw3d::VecSet(eye.x + dir.x, eye.y + dir.y, eye.z + dir.z, 1),
+      hw3d::VecSet(0, 1, 0, 0));
+  return hw3d::FrustumFromMatrix(
+      view * hw3d::MatPerspectiveFovLH(1.0f, 16.0f / 9.0f, 0.1f, 300.0f));
+}
+
+void Scatter(std::size_t n, Random& random, AabbArray* boxes) {
+  boxes->Resize(n);
+  for (std::size_t i = 0; i < n; i++) {
+    const float e = 0.5f + random.Next() * 3;
+    boxes->Set(i,
+               Float3{random.Next() * 600 - 300, random.Next() * 30,
+                      random.Next() * 600 - 300},
+               Float3{e, e, e});
+  }
+}
+
+// The cache's visible set equals CullAabbs() over all boxes.
+bool MatchesCull(const VisibilityCache& cache, const Frustum& frustum,
+                 const AabbArray& boxes) {
+  std::vector<std::uint32_t> expected(boxes.size());
+  expected.resize(
+      hw3d::CullAabbs(frustum, boxes, 0, boxes.size(), expected.data()));
+  std::vector<std::uint32_t> got = cache.visible();
+  std::sort(got.begin(), got.end());
+  return got == expected;
+}
+
+}  // namespace
+
+HW3D_TEST(CameraPathsMatchPlainCull) {
+  for (int path = 0; path < 4; path++) {
+    Random random(11);
+    AabbArray boxes;
+    Scatter(20000, random, &boxes);
+    std::vector<Float3> velocity(boxes.size());
+    for (Float3& v : velocity) {
+      v = Float3{random.Next() - 0.5f, 0.0f, random.Next() - 0.5f};
+    }
+    VisibilityCache cache;
+    Float3 eye{0, 10, 0};
+    float yaw = 0.0f;
+    float pitch = 0.0f;
+    int resets = 0;
+    std::size_t tested = 0;
+    std::vector<std::uint32_t> moved;
+    for (int frame = 0; frame < 120; frame++) {
+      if (path == 1) {
+        // walk with a slow turn and a bob
+        yaw += 0.01f;
+        pitch = 0.1f * std::sin(frame * 0.1f);
+        eye = eye + Float3{std::sin(yaw), 0.0f, std::cos(yaw)} * 0.5f;
+      } else if (path == 2) {
+        // pan
+        yaw += 0.03f;
+      } else if (path == 3 && frame % 30 == 0) {
+        // cuts
+        eye = {random.Next() * 400 - 200, 10, random.Next() * 400 - 200};
+        yaw = random.Next() * 6.28f;
+      }
+      moved.clear();
+      if (path != 0) {
+        for (std::uint32_t i = 0; i < boxes.size(); i += 97) {
+          boxes.Set(i,
+                    Float3{boxes.center_x()[i] + velocity[i].x,
+                           boxes.center_y()[i],
+                           boxes.center_z()[i] + velocity[i].z},
+                    Float3{1, 1, 1});
+          moved.push_back(i);
+        }
+      }
+      const Frustum frustum = FrustumAt(eye, yaw, pitch);
+      cache.Cull(frustum, eye, boxes, moved.data(), moved.size());
+      HW3D_CHECK(MatchesCull(cache, frustum, boxes));
+      HW3D_CHECK(cache.stats().rebuilt == (frame == 0));
+      resets += cache.stats().reset ? 1 : 0;
+      tested += cache.stats().tested_boxes;
+    }
+    // a still camera keeps its first reference; cuts reset on every jump
+    if (path == 0) {
+      HW3D_CHECK(resets == 1);
+      HW3D_CHECK(tested < 120 * boxes.size() / 4);
+    } else if (path == 3) {
+      HW3D_CHECK(resets >= 4);
+    }
+  }
+}
+
+HW3D_TEST(NonFiniteBoxesFollowCullAabbs) {
+  Random random(12);
+  AabbArray boxes;
+  Scatter(5000, random, &boxes);
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  const float inf = std::numeric_limits<float>::infinity();
+  boxes.Set(10, Float3{nan, 0, 0}, Float3{1, 1, 1});
+  boxes.Set(2000, Float3{0, 0, -1000}, Float3{inf, 1, 1});
+  VisibilityCache cache;
+  const Float3 eye{0, 10, 0};
+  for (int frame = 0; frame < 10; frame++) {
+    const Frustum frustum = FrustumAt(eye, frame * 0.02f, 0.0f);
+    cache.Cull(frustum, eye, boxes, nullptr, 0);
+    HW3D_CHECK(MatchesCull(cache, frustum, boxes));
+  }
+}
+
+HW3D_TEST(RebuildsWhenBoxCountChangesOrInvalidated) {
+  Random random(13);
+  AabbArray boxes;
+  Scatter(3000, random, &boxes);
+  VisibilityCache cache;
+  const Float3 eye{0, 10, 0};
+  const Frustum frustum = FrustumAt(eye, 0.5f, 0.0f);
+  cache.Cull(frustum, eye, boxes, nullptr, 0);
+  HW3D_CHECK(cache.stats().rebuilt);
+  cache.Cull(frustum, eye, boxes, nullptr, 0);
+  HW3D_CHECK(!cache.stats().rebuilt);
+
+  Scatter(4100, random, &boxes);
+  cache.Cull(frustum, eye, boxes, nullptr, 0);
+  HW3D_CHECK(cache.stats().rebuilt);
+  HW3D_CHECK(MatchesCull(cache, frustum, boxes));
+
+  // boxes rewritten in place without being reported, then Invalidate()
+  Scatter(4100, random, &boxes);
+  cache.Invalidate();
+  cache.Cull(frustum, eye, boxes, nullptr, 0);
+  HW3D_CHECK(cache.stats().rebuilt);
+  HW3D_CHECK(MatchesCull(cache, frustum, boxes));
+
+  boxes.Resize(0);
+  cache.Cull(frustum, eye, boxes, nullptr, 0);
+  HW3D_CHECK(cache.visible().empty());
+}
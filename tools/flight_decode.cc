@@ -0,0 +1,21 @@
+﻿// Usage: hw3d_flight_decode <ring file>
+// Writes the flight recorder report for a mapped ring file (hw3d_flight.bin)
+// to stdout.
+#include <cstdio>
+
+#include "hw3d/flight_recorder.h"
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    std::fprintf(stderr, "usage: %s <ring file>\n", argv[0]);
+    return 2;
+  }
+  if (!hw3d::FlightRecorder::DecodeFile(argv[1], stdout)) {
+    std::fprintf(stderr,
+                 "%s is missing, not an hw3d flight recorder file, or "
+                 "truncated\n",
+                 argv[1]);
+    return 1;
+  }
+  return 0;
+}
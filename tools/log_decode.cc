@@ -0,0 +1,23 @@
+﻿// Usage: hw3d_log_decode <log file>
+// Writes the decoded log to stdout.
+#include <fstream>
+#include <iostream>
+
+#include "hw3d/log_decoder.h"
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    std::cerr << "usage: " << argv[0] << " <log file>\n";
+    return 2;
+  }
+  std::ifstream in(argv[1], std::ios::binary);
+  if (!in) {
+    std::cerr << "cannot open " << argv[1] << '\n';
+    return 1;
+  }
+  if (!hw3d::DecodeLog(in, std::cout)) {
+    std::cerr << "log is not an hw3d log or is truncated\n";
+    return 1;
+  }
+  return 0;
+}